@@ -0,0 +1,114 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Interrupt and trap latency benchmark. The benchmark vm runs on two cpus and measures virtual
+ * timer interrupt forwarding, vSGI delivery between its vcpus, vgic distributor mmio trap round
+ * trips and inter-vm notification latency towards the peer vm, which runs on a third cpu. The
+ * results are printed as histograms to the console. The guest image is built along with the
+ * hypervisor (see guest/guest.mk).
+ */
+
+#include <config.h>
+#include <bench.h>
+
+VM_IMAGE(bench, BENCH_GUEST_IMAGE);
+
+struct config config = {
+
+    .shmemlist_size = 1,
+    .shmemlist = (struct shmem[]) {
+        [0] = { .size = BENCH_IPC_SIZE, },
+    },
+
+    .vmlist_size = 2,
+    .vmlist = {
+        {
+            .image = VM_IMAGE_BUILTIN(bench, BENCH_RAM_BASE),
+            .entry = BENCH_ENTRY,
+            .cpu_affinity = 0x3,
+
+            .platform = {
+                .cpu_num = 2,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = BENCH_RAM_BASE,
+                        .size = BENCH_RAM_SIZE,
+                    },
+                },
+
+                .dev_num = 2,
+                .devs = (struct vm_dev_region[]) {
+                    {
+                        /* Console, shared with the hypervisor */
+                        .pa = BENCH_UART_BASE,
+                        .va = BENCH_UART_BASE,
+                        .size = 0x1000,
+                    },
+                    {
+                        /* Virtual timer */
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) { BENCH_TIMER_IRQ },
+                    },
+                },
+
+                .ipc_num = 1,
+                .ipcs = (struct ipc[]) {
+                    {
+                        .base = BENCH_IPC_BASE,
+                        .size = BENCH_IPC_SIZE,
+                        .shmem_id = 0,
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) { BENCH_IPC_IRQ },
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = BENCH_GICD_BASE,
+                        .gicr_addr = BENCH_GICR_BASE,
+                    },
+                },
+            },
+        },
+        {
+            .image = VM_IMAGE_BUILTIN(bench, BENCH_RAM_BASE),
+            .entry = BENCH_ENTRY_PEER,
+            .cpu_affinity = 0x4,
+
+            .platform = {
+                .cpu_num = 1,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = BENCH_RAM_BASE,
+                        .size = BENCH_RAM_SIZE,
+                    },
+                },
+
+                .ipc_num = 1,
+                .ipcs = (struct ipc[]) {
+                    {
+                        .base = BENCH_IPC_BASE,
+                        .size = BENCH_IPC_SIZE,
+                        .shmem_id = 0,
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) { BENCH_IPC_IRQ },
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = BENCH_GICD_BASE,
+                        .gicr_addr = BENCH_GICR_BASE,
+                    },
+                },
+            },
+        },
+    },
+};
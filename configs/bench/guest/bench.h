@@ -0,0 +1,55 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Layout shared by the hypervisor configurations and the benchmark guest. All vms run the same
+ * image and the entry point selects their role: the latency benchmark vm enters at BENCH_ENTRY and
+ * its peer vm, which only answers inter-vm notifications, at BENCH_ENTRY_PEER. The coloring
+ * benchmark's memory hog and pointer chasing vms enter at BENCH_ENTRY_HOG and BENCH_ENTRY_CHASE,
+ * and the ipc benchmark's producer and consumer vms at BENCH_ENTRY_PROD and BENCH_ENTRY_CONS.
+ * Also included by the guest's linker script and assembly sources, so it must only hold macro
+ * definitions.
+ */
+
+#include <bench_platform.h>
+
+#define BENCH_RAM_SIZE    0x100000
+#define BENCH_ENTRY       (BENCH_RAM_BASE)
+#define BENCH_ENTRY_PEER  (BENCH_RAM_BASE + 0x8)
+#define BENCH_ENTRY_HOG   (BENCH_RAM_BASE + 0x10)
+#define BENCH_ENTRY_CHASE (BENCH_RAM_BASE + 0x18)
+#define BENCH_ENTRY_PROD  (BENCH_RAM_BASE + 0x20)
+#define BENCH_ENTRY_CONS  (BENCH_RAM_BASE + 0x28)
+
+#define BENCH_IPC_BASE    (BENCH_RAM_BASE + BENCH_RAM_SIZE)
+#define BENCH_IPC_SIZE    0x1000
+#define BENCH_IPC_IRQ     52
+
+/* The coloring benchmark vms own a buffer right after their image and a shared flag page. */
+#define BENCH_COLOR_BUF_BASE (BENCH_RAM_BASE + BENCH_RAM_SIZE)
+#define BENCH_COLOR_BUF_SIZE 0x1000000
+#define BENCH_COLOR_SHM_BASE (BENCH_COLOR_BUF_BASE + BENCH_COLOR_BUF_SIZE)
+#define BENCH_COLOR_SHM_SIZE 0x1000
+
+/**
+ * The ipc benchmark consumer owns a buffer it copies the messages to, right after its image. The
+ * shared memory holds the ring header and the run parameters in its first page and the message
+ * slots in the rest.
+ */
+#define BENCH_IPCB_BUF_BASE  (BENCH_RAM_BASE + BENCH_RAM_SIZE)
+#define BENCH_IPCB_BUF_SIZE  0x100000
+#define BENCH_IPCB_SHM_BASE  (BENCH_IPCB_BUF_BASE + BENCH_IPCB_BUF_SIZE)
+#define BENCH_IPCB_SHM_SIZE  0x401000
+#define BENCH_IPCB_IRQ       53
+
+#define BENCH_TIMER_IRQ   27
+#define BENCH_SGI_IRQ     1
+
+#define BENCH_STACK_SIZE_SHIFT 13
+
+#endif /* BENCH_H */
@@ -0,0 +1,229 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Cache coloring interference benchmark. Unlike the latency benchmark it needs the caches, so both
+ * vms identity map the first 4GiB with 1GiB blocks: write-back normal memory for the block holding
+ * their ram and device memory for all others.
+ */
+
+#include <guest.h>
+
+#define CACHE_LINE          (64)
+#define SAMPLES             (4096)
+#define CHASE_STEPS         (256)
+
+#define HOG_RUN_MAGIC       (0x4b06c0de)
+
+#define MAIR_ATTR_NORMAL_WB (0xffUL)
+#define MAIR_ATTR_DEVICE    (0x00UL)
+#define MAIR_IDX_NORMAL     (0)
+#define MAIR_IDX_DEVICE     (1)
+
+#define PTE_BLOCK           (0x1UL)
+#define PTE_ATTR(idx)       ((unsigned long)(idx) << 2)
+#define PTE_SH_IS           (0x3UL << 8)
+#define PTE_AF              (1UL << 10)
+#define PTE_XN              ((1UL << 53) | (1UL << 54))
+#define L1_BLOCK_SHIFT      (30)
+#define L1_ENTRIES          (4)
+
+#define TCR_T0SZ_4GIB       (32UL)
+#define TCR_IRGN0_WB        (1UL << 8)
+#define TCR_ORGN0_WB        (1UL << 10)
+#define TCR_SH0_IS          (3UL << 12)
+#define TCR_EPD1            (1UL << 23)
+
+#define SCTLR_M             (1UL << 0)
+#define SCTLR_C             (1UL << 2)
+#define SCTLR_I             (1UL << 12)
+
+#define CLIDR_CTYPE_LEN     (3)
+#define CLIDR_CTYPE_DATA    (2)
+#define CLIDR_LVLS          (7)
+
+struct color_shm {
+    volatile uint32_t hog_run;
+    volatile uint64_t hog_passes;
+};
+
+static struct color_shm* const shm = (struct color_shm*)BENCH_COLOR_SHM_BASE;
+
+static uint64_t l1_table[512] __attribute__((aligned(4096)));
+static uint64_t samples[SAMPLES];
+
+void mmu_enable(void)
+{
+    for (unsigned long i = 0; i < L1_ENTRIES; i++) {
+        uint64_t pte = (i << L1_BLOCK_SHIFT) | PTE_BLOCK | PTE_AF;
+        if (i == ((unsigned long)BENCH_RAM_BASE >> L1_BLOCK_SHIFT)) {
+            pte |= PTE_ATTR(MAIR_IDX_NORMAL) | PTE_SH_IS;
+        } else {
+            pte |= PTE_ATTR(MAIR_IDX_DEVICE) | PTE_XN;
+        }
+        l1_table[i] = pte;
+    }
+
+    SYSREG_WRITE(mair_el1,
+        (MAIR_ATTR_NORMAL_WB << (MAIR_IDX_NORMAL * 8)) | (MAIR_ATTR_DEVICE << (MAIR_IDX_DEVICE * 8)));
+    SYSREG_WRITE(tcr_el1, TCR_T0SZ_4GIB | TCR_IRGN0_WB | TCR_ORGN0_WB | TCR_SH0_IS | TCR_EPD1);
+    SYSREG_WRITE(ttbr0_el1, (unsigned long)l1_table);
+    asm volatile("dsb ish\n\ttlbi vmalle1\n\tdsb ish\n\tisb" ::: "memory");
+    SYSREG_WRITE(sctlr_el1, SYSREG_READ(sctlr_el1) | SCTLR_M | SCTLR_C | SCTLR_I);
+}
+
+/* Size of the last level data or unified cache, as the guest sees it. */
+static size_t llc_size(void)
+{
+    unsigned long clidr = SYSREG_READ(clidr_el1);
+    size_t size = 0;
+
+    for (unsigned long lvl = 0; lvl < CLIDR_LVLS; lvl++) {
+        unsigned long ctype = (clidr >> (lvl * CLIDR_CTYPE_LEN)) & 0x7;
+        if (ctype < CLIDR_CTYPE_DATA) {
+            break;
+        }
+        SYSREG_WRITE(csselr_el1, lvl << 1);
+        unsigned long ccsidr = SYSREG_READ(ccsidr_el1);
+        size_t line = 1UL << ((ccsidr & 0x7) + 4);
+        size_t ways = ((ccsidr >> 3) & 0x3ff) + 1;
+        size_t sets = ((ccsidr >> 13) & 0x7fff) + 1;
+        size = line * ways * sets;
+    }
+
+    return size;
+}
+
+/**
+ * Link the cache lines of the working set in a single random cycle (Sattolo's algorithm), so that
+ * each load depends on the previous one and the prefetchers cannot guess the next line.
+ */
+static void chase_build(uintptr_t buf, size_t lines)
+{
+    uint32_t* perm = (uint32_t*)(buf + (lines * CACHE_LINE));
+    uint64_t rand = 0x2545f4914f6cdd1dULL;
+
+    for (size_t i = 0; i < lines; i++) {
+        perm[i] = (uint32_t)i;
+    }
+
+    for (size_t i = lines - 1; i > 0; i--) {
+        rand = (rand * 6364136223846793005ULL) + 1442695040888963407ULL;
+        size_t j = (rand >> 33) % i;
+        uint32_t tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+
+    for (size_t i = 0; i < lines; i++) {
+        uintptr_t next = buf + ((uintptr_t)perm[(i + 1) % lines] * CACHE_LINE);
+        *(volatile uintptr_t*)(buf + ((uintptr_t)perm[i] * CACHE_LINE)) = next;
+    }
+}
+
+static uintptr_t chase(uintptr_t node, size_t steps)
+{
+    for (size_t i = 0; i < steps; i++) {
+        node = *(volatile uintptr_t*)node;
+    }
+    return node;
+}
+
+static uintptr_t chase_sample(uintptr_t node)
+{
+    for (size_t i = 0; i < SAMPLES; i++) {
+        uint64_t start = now();
+        node = chase(node, CHASE_STEPS);
+        samples[i] = now() - start;
+    }
+    return node;
+}
+
+static void samples_sort(void)
+{
+    for (size_t gap = SAMPLES / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < SAMPLES; i++) {
+            uint64_t val = samples[i];
+            size_t j = i;
+            for (; j >= gap && samples[j - gap] > val; j -= gap) {
+                samples[j] = samples[j - gap];
+            }
+            samples[j] = val;
+        }
+    }
+}
+
+static void print_load_ns(const char* label, uint64_t ticks)
+{
+    print(label);
+    print_dec(ticks_to_ns(ticks) / CHASE_STEPS);
+}
+
+static void samples_report(const char* phase)
+{
+    samples_sort();
+
+    print(phase);
+    print_load_ns(": ns per load p50 ", samples[SAMPLES / 2]);
+    print_load_ns(" p99 ", samples[(SAMPLES * 99) / 100]);
+    print_load_ns(" p99.9 ", samples[(SAMPLES * 999) / 1000]);
+    print_load_ns(" max ", samples[SAMPLES - 1]);
+    print("\n");
+}
+
+void chase_main(void)
+{
+    shm->hog_run = 0;
+    mmu_enable();
+
+    /* A quarter of the cache fits the chasing vm's share for even splits up to half and half. */
+    size_t llc = llc_size();
+    size_t ws = llc / 4;
+    if (ws == 0 || ws * 2 > BENCH_COLOR_BUF_SIZE) {
+        ws = BENCH_COLOR_BUF_SIZE / 2;
+    }
+    size_t lines = ws / CACHE_LINE;
+
+    print("\nBao cache coloring interference benchmark\n");
+    print("llc ");
+    print_dec(llc / 1024);
+    print(" KiB, working set ");
+    print_dec(ws / 1024);
+    print(" KiB\n");
+
+    uintptr_t node = BENCH_COLOR_BUF_BASE;
+    chase_build(BENCH_COLOR_BUF_BASE, lines);
+    node = chase(node, lines);
+
+    node = chase_sample(node);
+    samples_report("solo");
+
+    shm->hog_run = HOG_RUN_MAGIC;
+    node = chase(node, lines * 16);
+
+    node = chase_sample(node);
+    shm->hog_run = 0;
+    samples_report("with hog");
+
+    print("hog passes over its buffer: ");
+    print_dec(shm->hog_passes);
+    print("\nbenchmark done\n");
+}
+
+void hog_main(void)
+{
+    mmu_enable();
+
+    while (shm->hog_run != HOG_RUN_MAGIC) { }
+
+    uint64_t passes = 0;
+    while (shm->hog_run == HOG_RUN_MAGIC) {
+        for (uintptr_t addr = BENCH_COLOR_BUF_BASE;
+             addr < BENCH_COLOR_BUF_BASE + BENCH_COLOR_BUF_SIZE; addr += CACHE_LINE) {
+            (*(volatile uint64_t*)addr)++;
+        }
+        shm->hog_passes = ++passes;
+    }
+}
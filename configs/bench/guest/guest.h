@@ -0,0 +1,53 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef GUEST_H
+#define GUEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <bench.h>
+
+/* Roles in the order of the entry points in start.S */
+#define ROLE_BENCH (0)
+#define ROLE_PEER  (1)
+#define ROLE_HOG   (2)
+#define ROLE_CHASE (3)
+#define ROLE_PROD  (4)
+#define ROLE_CONS  (5)
+
+#define MMIO32(addr) (*(volatile uint32_t*)(uintptr_t)(addr))
+#define MMIO64(addr) (*(volatile uint64_t*)(uintptr_t)(addr))
+
+#define SYSREG_READ(reg)                                      \
+    ({                                                        \
+        unsigned long _val;                                   \
+        asm volatile("mrs %0, " #reg : "=r"(_val)::"memory"); \
+        _val;                                                 \
+    })
+
+#define SYSREG_WRITE(reg, val) asm volatile("msr " #reg ", %0\n\tisb" ::"r"(val) : "memory")
+
+static inline uint64_t now(void)
+{
+    asm volatile("isb" ::: "memory");
+    return SYSREG_READ(cntvct_el0);
+}
+
+unsigned long hvc(unsigned long fid, unsigned long arg0, unsigned long arg1, unsigned long arg2);
+void print(const char* str);
+void print_dec(uint64_t val);
+uint64_t ticks_to_ns(uint64_t ticks);
+void gic_cpu_init(unsigned long cpuid, uint32_t ppi_sgi_mask);
+void gic_spi_init(unsigned int irq, unsigned long cpuid);
+void mmu_enable(void);
+
+void hog_main(void);
+void chase_main(void);
+void prod_main(void);
+void cons_main(void);
+
+#endif /* GUEST_H */
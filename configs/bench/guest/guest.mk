@@ -0,0 +1,26 @@
+## SPDX-License-Identifier: Apache-2.0
+## Copyright (c) Bao Project and Contributors. All rights reserved.
+
+# Rules to build the benchmark guest along with the hypervisor, shared by the benchmark configs. The
+# guest targets aarch64 platforms with a GICv3 and needs a cross compiler for bare-metal aarch64.
+
+bench_guest_dir:=$(patsubst %/,%,$(dir $(lastword $(MAKEFILE_LIST))))
+bench_platforms:=qemu-aarch64-virt fvp-a
+
+ifneq ($(build_targets),)
+ifeq ($(filter $(PLATFORM), $(bench_platforms)),)
+$(error The $(CONFIG) config does not support platform $(PLATFORM))
+endif
+endif
+
+bench_platform_dir:=$(bench_guest_dir)/../platform/$(PLATFORM)
+bench_guest_build_dir:=$(config_build_dir)/guest
+bench_guest_image:=$(bench_guest_build_dir)/bench.bin
+
+override CPPFLAGS+=-I$(bench_guest_dir) -I$(bench_platform_dir) \
+	-DBENCH_GUEST_IMAGE=\"$(bench_guest_image)\"
+
+$(bench_guest_image): $(wildcard $(bench_guest_dir)/* $(bench_platform_dir)/*)
+	@echo "Building guest		$(patsubst $(cur_dir)/%, %, $@)"
+	@$(MAKE) -s -C $(bench_guest_dir) CROSS_COMPILE=$(CROSS_COMPILE) \
+		BUILD_DIR=$(bench_guest_build_dir) PLATFORM_DIR=$(bench_platform_dir)
@@ -0,0 +1,297 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Inter-vm throughput and latency benchmark. The producer vm sends messages of each size through a
+ * single-producer single-consumer ring in the shared memory, in the ipc_ring layout the hypervisor
+ * knows, and the consumer vm copies each one out to its own buffer. The consumer either polls the
+ * ring or waits for an interrupt, asking for one through the ring's head event index, so the
+ * producer only issues the ipc hypercall when the consumer is waiting. For the caches to count,
+ * both vms run with the MMU on, as the coloring benchmark does.
+ *
+ * Latency is measured from the producer stamping a message to the consumer having copied it,
+ * both reading the same virtual counter. The producer prints one line per size and consumer mode.
+ */
+
+#include <guest.h>
+
+#define HC_IPC_FID      (0xC6000001UL)
+
+#define GICD_CTLR       (0x0000)
+#define GICD_CTLR_ENA   (1U << 1)
+
+#define SAMPLES         (4096)
+#define MIN_SAMPLES     (64)
+#define RUN_BYTES       (64UL << 20)
+#define MSG_SIZE_MIN    (64UL)
+#define MSG_SIZE_MAX    (1UL << 20)
+#define SLOT_HDR_SIZE   (64UL)
+
+#define CONS_READY_MAGIC (0xc0a50e11)
+
+#define RING_DATA_OFF   (0x1000UL)
+#define RING_DATA_SIZE  (BENCH_IPCB_SHM_SIZE - RING_DATA_OFF)
+
+/* Same layout as struct ipc_ring, see src/core/inc/ipc_ring.h */
+struct ring_hdr {
+    volatile uint32_t head;
+    volatile uint32_t tail_event;
+    uint8_t res0[56];
+    volatile uint32_t tail;
+    volatile uint32_t head_event;
+    uint8_t res1[56];
+};
+
+/* Run parameters set by the producer and results written back by the consumer */
+struct run_ctrl {
+    volatile uint32_t cons_ready;
+    volatile uint32_t run;
+    volatile uint32_t done;
+    volatile uint32_t interrupt;
+    volatile uint64_t size;
+    volatile uint64_t count;
+    volatile uint64_t lat[4];
+};
+
+enum { LAT_P50, LAT_P99, LAT_P999, LAT_MAX };
+
+struct slot_hdr {
+    volatile uint64_t timestamp;
+    volatile uint64_t seq;
+};
+
+static struct ring_hdr* const ring = (struct ring_hdr*)BENCH_IPCB_SHM_BASE;
+static struct run_ctrl* const ctrl =
+    (struct run_ctrl*)(BENCH_IPCB_SHM_BASE + sizeof(struct ring_hdr));
+
+static uint64_t samples[SAMPLES];
+
+static inline void dmb_ish(void)
+{
+    asm volatile("dmb ish" ::: "memory");
+}
+
+static inline void dmb_ishst(void)
+{
+    asm volatile("dmb ishst" ::: "memory");
+}
+
+static inline void dmb_ishld(void)
+{
+    asm volatile("dmb ishld" ::: "memory");
+}
+
+/* Same check as ipc_ring_need_event */
+static inline bool ring_need_event(uint32_t event, uint32_t new_idx, uint32_t old_idx)
+{
+    return (uint32_t)(new_idx - event - 1) < (uint32_t)(new_idx - old_idx);
+}
+
+static size_t slot_size(size_t size)
+{
+    return SLOT_HDR_SIZE + size;
+}
+
+static size_t slot_num(size_t size)
+{
+    return RING_DATA_SIZE / slot_size(size);
+}
+
+static uintptr_t slot_addr(size_t size, uint32_t idx)
+{
+    return BENCH_IPCB_SHM_BASE + RING_DATA_OFF + ((idx % slot_num(size)) * slot_size(size));
+}
+
+static size_t run_count(size_t size)
+{
+    size_t count = RUN_BYTES / size;
+    if (count > SAMPLES) {
+        count = SAMPLES;
+    } else if (count < MIN_SAMPLES) {
+        count = MIN_SAMPLES;
+    }
+    return count;
+}
+
+/* Keeps the compiler from turning the copy loops into calls to the missing libc routines. */
+__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void msg_fill(uintptr_t dst,
+    size_t size, uint64_t val)
+{
+    for (size_t off = 0; off < size; off += sizeof(uint64_t)) {
+        *(uint64_t*)(dst + off) = val;
+    }
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void msg_copy(uintptr_t dst,
+    uintptr_t src, size_t size)
+{
+    for (size_t off = 0; off < size; off += sizeof(uint64_t)) {
+        *(uint64_t*)(dst + off) = *(const uint64_t*)(src + off);
+    }
+}
+
+static void samples_sort(size_t count)
+{
+    for (size_t gap = count / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < count; i++) {
+            uint64_t val = samples[i];
+            size_t j = i;
+            for (; j >= gap && samples[j - gap] > val; j -= gap) {
+                samples[j] = samples[j - gap];
+            }
+            samples[j] = val;
+        }
+    }
+}
+
+/**
+ * Waits for the next message. Waiting for an interrupt, the consumer sets the head event to the
+ * last head it has seen before checking the ring once more, so a message published meanwhile
+ * either is seen or has the producer issue the hypercall. Polling, it leaves the head event
+ * behind, where each run leaves it, so the producer never notifies it.
+ */
+static void cons_wait(uint32_t tail, bool interrupt)
+{
+    while (ring->head == tail) {
+        if (interrupt) {
+            ring->head_event = tail;
+            dmb_ish();
+            if (ring->head == tail) {
+                asm volatile("wfi" ::: "memory");
+            }
+        }
+    }
+    dmb_ishld();
+}
+
+static void cons_run(void)
+{
+    size_t size = ctrl->size;
+    size_t count = ctrl->count;
+    bool interrupt = ctrl->interrupt != 0;
+    uint32_t tail = ring->tail;
+
+    for (size_t i = 0; i < count; i++) {
+        cons_wait(tail, interrupt);
+        uintptr_t slot = slot_addr(size, tail);
+        msg_copy(BENCH_IPCB_BUF_BASE, slot + SLOT_HDR_SIZE, size);
+        samples[i] = now() - ((struct slot_hdr*)slot)->timestamp;
+        dmb_ish();
+        ring->tail = ++tail;
+    }
+    ring->head_event = tail - 1;
+
+    samples_sort(count);
+    ctrl->lat[LAT_P50] = samples[count / 2];
+    ctrl->lat[LAT_P99] = samples[(count * 99) / 100];
+    ctrl->lat[LAT_P999] = samples[(count * 999) / 1000];
+    ctrl->lat[LAT_MAX] = samples[count - 1];
+}
+
+void cons_main(void)
+{
+    MMIO32(BENCH_GICD_BASE + GICD_CTLR) = GICD_CTLR_ENA;
+    gic_spi_init(BENCH_IPCB_IRQ, 0);
+    gic_cpu_init(0, 0);
+    mmu_enable();
+
+    ring->tail = 0;
+    ring->head_event = ~0U;
+    ctrl->done = 0;
+    dmb_ish();
+    ctrl->cons_ready = CONS_READY_MAGIC;
+
+    uint32_t run = 0;
+    while (true) {
+        while (ctrl->run == run) { }
+        dmb_ishld();
+        run = ctrl->run;
+        cons_run();
+        dmb_ish();
+        ctrl->done = run;
+    }
+}
+
+static void print_ns(const char* label, uint64_t ticks)
+{
+    print(label);
+    print_dec(ticks_to_ns(ticks));
+}
+
+static void prod_run(uint32_t run, size_t size, bool interrupt)
+{
+    size_t count = run_count(size);
+    size_t slots = slot_num(size);
+    uint32_t head = ring->head;
+    uint64_t notifies = 0;
+
+    ctrl->size = size;
+    ctrl->count = count;
+    ctrl->interrupt = interrupt ? 1 : 0;
+    dmb_ish();
+    ctrl->run = run;
+
+    uint64_t start = now();
+    for (size_t i = 0; i < count; i++) {
+        while ((uint32_t)(head - ring->tail) >= slots) { }
+        dmb_ish();
+
+        uintptr_t slot = slot_addr(size, head);
+        msg_fill(slot + SLOT_HDR_SIZE, size, i);
+        ((struct slot_hdr*)slot)->seq = head;
+        ((struct slot_hdr*)slot)->timestamp = now();
+        dmb_ishst();
+
+        uint32_t old_head = head;
+        ring->head = ++head;
+        dmb_ish();
+        if (ring_need_event(ring->head_event, head, old_head)) {
+            hvc(HC_IPC_FID, 0, 0, 0);
+            notifies++;
+        }
+    }
+
+    while (ctrl->done != run) { }
+    uint64_t ticks = now() - start;
+    dmb_ishld();
+
+    uint64_t freq = SYSREG_READ(cntfrq_el0);
+    print(interrupt ? "irq  " : "poll ");
+    print_dec(size);
+    print(" B: ");
+    print_dec((count * freq) / ticks);
+    print(" msg/s ");
+    print_dec((((count * size) * freq) / ticks) >> 20);
+    print(" MiB/s, latency ns");
+    print_ns(" p50 ", ctrl->lat[LAT_P50]);
+    print_ns(" p99 ", ctrl->lat[LAT_P99]);
+    print_ns(" p99.9 ", ctrl->lat[LAT_P999]);
+    print_ns(" max ", ctrl->lat[LAT_MAX]);
+    print(", ");
+    print_dec(count);
+    print(" msgs ");
+    print_dec(notifies);
+    print(" notifies\n");
+}
+
+void prod_main(void)
+{
+    mmu_enable();
+    ring->head = 0;
+    ring->tail_event = 0;
+
+    print("\nBao inter-vm ipc benchmark\n");
+    while (ctrl->cons_ready != CONS_READY_MAGIC) { }
+    dmb_ishld();
+
+    uint32_t run = 0;
+    for (size_t mode = 0; mode < 2; mode++) {
+        for (size_t size = MSG_SIZE_MIN; size <= MSG_SIZE_MAX; size *= 4) {
+            prod_run(++run, size, mode != 0);
+        }
+    }
+
+    print("benchmark done\n");
+}
@@ -0,0 +1,377 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Latency benchmark. It runs with the MMU off, so all accesses are to device memory and the
+ * variables shared between vcpus and vms need no cache maintenance.
+ */
+
+#include <guest.h>
+
+#define ITERATIONS        (1000)
+#define HIST_BUCKETS      (24)
+
+#define PSCI_CPU_ON       (0xC4000003UL)
+#define HC_IPC_FID        (0xC6000001UL)
+#define HC_STATS_FID      (0xC600000CUL)
+
+/* Counter indexes of the stats hypercall, see src/core/inc/stats.h */
+#define STATS_EXITS_IRQ    (0)
+#define STATS_MMIO_TRAPS   (8)
+#define STATS_EXITS_SYNC   (16)
+#define STATS_EXIT_REASONS (64)
+#define STATS_ALL_VCPUS    (~0UL)
+#define BENCH_VM_ID        (0)
+
+#define UART_DR           (0x00)
+#define UART_FR           (0x18)
+#define UART_FR_TXFF      (1U << 5)
+
+#define GICD_CTLR         (0x0000)
+#define GICD_TYPER        (0x0004)
+#define GICD_IGROUPR(n)   (0x0080 + (((n) / 32) * 4))
+#define GICD_ISENABLER(n) (0x0100 + (((n) / 32) * 4))
+#define GICD_IROUTER(n)   (0x6000 + ((n) * 8))
+#define GICD_CTLR_ENA     (1U << 1)
+
+#define GICR_STRIDE       (0x20000)
+#define GICR_SGI_OFF      (0x10000)
+#define GICR_IGROUPR0     (GICR_SGI_OFF + 0x0080)
+#define GICR_ISENABLER0   (GICR_SGI_OFF + 0x0100)
+
+#define ICC_IAR_ID_MSK    (0xffffff)
+#define ICC_SGI1R_ID_OFF  (24)
+
+#define CNTV_CTL_ENABLE   (1UL << 0)
+#define CNTV_CTL_IMASK    (1UL << 1)
+
+struct hist {
+    const char* name;
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t total;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Layout of the shared memory used between the benchmark and the peer vms. */
+struct bench_ipc {
+    volatile uint32_t peer_ready;
+    volatile uint32_t ack;
+    volatile uint64_t timestamp;
+};
+
+#define PEER_READY_MAGIC (0xbe9c4a11)
+
+extern char _start_secondary[];
+
+static struct bench_ipc* const ipc = (struct bench_ipc*)BENCH_IPC_BASE;
+
+static struct hist timer_hist = { .name = "timer ppi to guest handler" };
+static struct hist sgi_hist = { .name = "vsgi vcpu0 to vcpu1" };
+static struct hist mmio_hist = { .name = "vgicd mmio read round trip" };
+static struct hist ipc_hist = { .name = "inter-vm ipc notification" };
+
+static volatile uint64_t timer_deadline;
+static volatile uint32_t timer_fired;
+static volatile uint64_t sgi_timestamp;
+static volatile uint32_t sgi_ack;
+static volatile uint32_t secondary_ready;
+
+/* The vm's exit counters when the last scenario ended */
+static uint64_t exits_irq;
+static uint64_t exits_mmio;
+static uint64_t exits_sync[STATS_EXIT_REASONS];
+
+unsigned long hvc(unsigned long fid, unsigned long arg0, unsigned long arg1,
+    unsigned long arg2)
+{
+    register unsigned long x0 asm("x0") = fid;
+    register unsigned long x1 asm("x1") = arg0;
+    register unsigned long x2 asm("x2") = arg1;
+    register unsigned long x3 asm("x3") = arg2;
+
+    asm volatile("hvc #0" : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)::"memory");
+
+    return x0;
+}
+
+static void uart_putc(char c)
+{
+    while (MMIO32(BENCH_UART_BASE + UART_FR) & UART_FR_TXFF) { }
+    MMIO32(BENCH_UART_BASE + UART_DR) = (uint32_t)c;
+}
+
+void print(const char* str)
+{
+    while (*str != '\0') {
+        if (*str == '\n') {
+            uart_putc('\r');
+        }
+        uart_putc(*str++);
+    }
+}
+
+void print_dec(uint64_t val)
+{
+    char buf[21];
+    size_t i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = (char)('0' + (val % 10));
+        val /= 10;
+    } while (val != 0);
+
+    print(&buf[i]);
+}
+
+uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return (ticks * 1000000000ULL) / SYSREG_READ(cntfrq_el0);
+}
+
+static uint64_t stats_read(unsigned long counter)
+{
+    long ret = (long)hvc(HC_STATS_FID, BENCH_VM_ID, STATS_ALL_VCPUS, counter);
+    return (ret < 0) ? 0 : (uint64_t)ret;
+}
+
+static void exits_print_delta(const char* scenario, const char* reason, uint64_t* last,
+    uint64_t count)
+{
+    if (count != *last) {
+        print("exits ");
+        print(scenario);
+        print(" ");
+        print(reason);
+        print(" ");
+        print_dec(count - *last);
+        print("\n");
+    }
+    *last = count;
+}
+
+/**
+ * Prints the vm's exits since the previous scenario ended, by reason, as one "exits <scenario>
+ * <reason> <count>" line per reason that changed, for scripts/exit_regress.py to compare against
+ * its baseline. Sync exits are named by their exception class. The stats hypercalls themselves
+ * are counted in the next scenario, which they add a constant number of hvc exits to.
+ */
+static void exits_print(const char* scenario)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    exits_print_delta(scenario, "irq", &exits_irq, stats_read(STATS_EXITS_IRQ));
+    exits_print_delta(scenario, "mmio", &exits_mmio, stats_read(STATS_MMIO_TRAPS));
+    for (size_t ec = 0; ec < STATS_EXIT_REASONS; ec++) {
+        char reason[] = "ec_0x00";
+        reason[5] = hex[ec >> 4];
+        reason[6] = hex[ec & 0xf];
+        exits_print_delta(scenario, reason, &exits_sync[ec], stats_read(STATS_EXITS_SYNC + ec));
+    }
+}
+
+static void hist_add(struct hist* hist, uint64_t ticks)
+{
+    if (hist->count == 0 || ticks < hist->min) {
+        hist->min = ticks;
+    }
+    if (ticks > hist->max) {
+        hist->max = ticks;
+    }
+    hist->total += ticks;
+    hist->count++;
+
+    size_t bucket = (ticks == 0) ? 0 : (63 - (size_t)__builtin_clzll(ticks));
+    hist->buckets[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+}
+
+static void hist_print(struct hist* hist)
+{
+    print("\n");
+    print(hist->name);
+    print(": ");
+    print_dec(hist->count);
+    print(" samples, min ");
+    print_dec(ticks_to_ns(hist->min));
+    print(" ns, avg ");
+    print_dec(hist->count ? ticks_to_ns(hist->total / hist->count) : 0);
+    print(" ns, max ");
+    print_dec(ticks_to_ns(hist->max));
+    print(" ns\n");
+
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        if (hist->buckets[i] == 0) {
+            continue;
+        }
+        print("  >= ");
+        print_dec(ticks_to_ns(1ULL << i));
+        print(" ns: ");
+        print_dec(hist->buckets[i]);
+        print("\n");
+    }
+}
+
+void gic_cpu_init(unsigned long cpuid, uint32_t ppi_sgi_mask)
+{
+    uintptr_t gicr = BENCH_GICR_BASE + (cpuid * GICR_STRIDE);
+
+    MMIO32(gicr + GICR_IGROUPR0) = ~0U;
+    MMIO32(gicr + GICR_ISENABLER0) = ppi_sgi_mask;
+
+    SYSREG_WRITE(icc_sre_el1, 0x7UL);
+    SYSREG_WRITE(icc_pmr_el1, 0xffUL);
+    SYSREG_WRITE(icc_bpr1_el1, 0UL);
+    SYSREG_WRITE(icc_igrpen1_el1, 1UL);
+
+    asm volatile("msr daifclr, #2" ::: "memory");
+}
+
+void gic_spi_init(unsigned int irq, unsigned long cpuid)
+{
+    MMIO32(BENCH_GICD_BASE + GICD_IGROUPR(irq)) |= 1U << (irq % 32);
+    MMIO64(BENCH_GICD_BASE + GICD_IROUTER(irq)) = cpuid;
+    MMIO32(BENCH_GICD_BASE + GICD_ISENABLER(irq)) = 1U << (irq % 32);
+}
+
+void irq_handler(void);
+void guest_main(unsigned long role, unsigned long cpuid);
+
+void irq_handler(void)
+{
+    uint64_t timestamp = now();
+    unsigned long iar = SYSREG_READ(icc_iar1_el1);
+    unsigned long id = iar & ICC_IAR_ID_MSK;
+
+    switch (id) {
+        case BENCH_TIMER_IRQ:
+            SYSREG_WRITE(cntv_ctl_el0, CNTV_CTL_IMASK);
+            hist_add(&timer_hist, timestamp - timer_deadline);
+            timer_fired++;
+            break;
+        case BENCH_SGI_IRQ:
+            sgi_timestamp = timestamp;
+            sgi_ack++;
+            break;
+        case BENCH_IPC_IRQ:
+            ipc->timestamp = timestamp;
+            ipc->ack++;
+            break;
+        default:
+            break;
+    }
+
+    SYSREG_WRITE(icc_eoir1_el1, iar);
+}
+
+static void bench_timer(void)
+{
+    uint64_t delay = SYSREG_READ(cntfrq_el0) / 10000;
+
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        uint32_t fired = timer_fired;
+        timer_deadline = now() + delay;
+        SYSREG_WRITE(cntv_cval_el0, timer_deadline);
+        SYSREG_WRITE(cntv_ctl_el0, CNTV_CTL_ENABLE);
+        while (timer_fired == fired) { }
+    }
+}
+
+static void bench_sgi(void)
+{
+    unsigned long sgi1r = ((unsigned long)BENCH_SGI_IRQ << ICC_SGI1R_ID_OFF) | (1UL << 1);
+
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        uint32_t ack = sgi_ack;
+        uint64_t start = now();
+        SYSREG_WRITE(icc_sgi1r_el1, sgi1r);
+        while (sgi_ack == ack) { }
+        hist_add(&sgi_hist, sgi_timestamp - start);
+    }
+}
+
+static void bench_mmio(void)
+{
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        uint64_t start = now();
+        (void)MMIO32(BENCH_GICD_BASE + GICD_TYPER);
+        hist_add(&mmio_hist, now() - start);
+    }
+}
+
+static void bench_ipc(void)
+{
+    while (ipc->peer_ready != PEER_READY_MAGIC) { }
+
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        uint32_t ack = ipc->ack;
+        uint64_t start = now();
+        hvc(HC_IPC_FID, 0, 0, 0);
+        while (ipc->ack == ack) { }
+        hist_add(&ipc_hist, ipc->timestamp - start);
+    }
+}
+
+static void bench_main(void)
+{
+    print("\nBao interrupt latency benchmark\n");
+
+    MMIO32(BENCH_GICD_BASE + GICD_CTLR) = GICD_CTLR_ENA;
+    gic_cpu_init(0, 1U << BENCH_TIMER_IRQ);
+
+    hvc(PSCI_CPU_ON, 1, (unsigned long)_start_secondary, ROLE_BENCH);
+    while (!secondary_ready) { }
+
+    exits_print("boot");
+    bench_timer();
+    exits_print("timer");
+    bench_sgi();
+    exits_print("sgi");
+    bench_mmio();
+    exits_print("mmio");
+    bench_ipc();
+    exits_print("ipc");
+
+    hist_print(&timer_hist);
+    hist_print(&sgi_hist);
+    hist_print(&mmio_hist);
+    hist_print(&ipc_hist);
+    print("\nbenchmark done\n");
+}
+
+static void peer_main(void)
+{
+    MMIO32(BENCH_GICD_BASE + GICD_CTLR) = GICD_CTLR_ENA;
+    gic_spi_init(BENCH_IPC_IRQ, 0);
+    gic_cpu_init(0, 0);
+
+    ipc->ack = 0;
+    ipc->peer_ready = PEER_READY_MAGIC;
+}
+
+void guest_main(unsigned long role, unsigned long cpuid)
+{
+    if (role == ROLE_PEER) {
+        peer_main();
+    } else if (role == ROLE_HOG) {
+        hog_main();
+    } else if (role == ROLE_CHASE) {
+        chase_main();
+    } else if (role == ROLE_PROD) {
+        prod_main();
+    } else if (role == ROLE_CONS) {
+        cons_main();
+    } else if (cpuid == 0) {
+        bench_main();
+    } else {
+        gic_cpu_init(cpuid, 1U << BENCH_SGI_IRQ);
+        secondary_ready = 1;
+    }
+
+    while (true) {
+        asm volatile("wfi" ::: "memory");
+    }
+}
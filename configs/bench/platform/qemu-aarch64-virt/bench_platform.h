@@ -0,0 +1,16 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef BENCH_PLATFORM_H
+#define BENCH_PLATFORM_H
+
+/* Also included by the guest's linker script, so it must only hold macro definitions. */
+
+#define BENCH_RAM_BASE  0x40000000
+#define BENCH_UART_BASE 0x09000000
+#define BENCH_GICD_BASE 0x08000000
+#define BENCH_GICR_BASE 0x080A0000
+
+#endif /* BENCH_PLATFORM_H */
@@ -0,0 +1,107 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Cache coloring interference benchmark. A latency sensitive vm does pointer chasing over a
+ * working set sized to fit its share of the last level cache, first alone and then while a second
+ * vm streams over a large buffer. It reports the tail latency of both phases to the console. The
+ * hypervisor prints the number and size of the colors it derived from the cache geometry at boot.
+ * Build with BENCH_COLORED=n for the uncolored baseline (see config.mk).
+ */
+
+#include <config.h>
+#include <bench.h>
+
+VM_IMAGE(bench, BENCH_GUEST_IMAGE);
+
+struct config config = {
+
+    .shmemlist_size = 1,
+    .shmemlist = (struct shmem[]) {
+        [0] = { .size = BENCH_COLOR_SHM_SIZE, },
+    },
+
+    .vmlist_size = 2,
+    .vmlist = {
+        {
+            .image = VM_IMAGE_BUILTIN(bench, BENCH_RAM_BASE),
+            .entry = BENCH_ENTRY_CHASE,
+            .cpu_affinity = 0x1,
+            .colors = BENCH_CHASE_COLORS,
+
+            .platform = {
+                .cpu_num = 1,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = BENCH_RAM_BASE,
+                        .size = BENCH_RAM_SIZE + BENCH_COLOR_BUF_SIZE,
+                    },
+                },
+
+                .dev_num = 1,
+                .devs = (struct vm_dev_region[]) {
+                    {
+                        /* Console, shared with the hypervisor */
+                        .pa = BENCH_UART_BASE,
+                        .va = BENCH_UART_BASE,
+                        .size = 0x1000,
+                    },
+                },
+
+                .ipc_num = 1,
+                .ipcs = (struct ipc[]) {
+                    {
+                        .base = BENCH_COLOR_SHM_BASE,
+                        .size = BENCH_COLOR_SHM_SIZE,
+                        .shmem_id = 0,
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = BENCH_GICD_BASE,
+                        .gicr_addr = BENCH_GICR_BASE,
+                    },
+                },
+            },
+        },
+        {
+            .image = VM_IMAGE_BUILTIN(bench, BENCH_RAM_BASE),
+            .entry = BENCH_ENTRY_HOG,
+            .cpu_affinity = 0x2,
+            .colors = BENCH_HOG_COLORS,
+
+            .platform = {
+                .cpu_num = 1,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = BENCH_RAM_BASE,
+                        .size = BENCH_RAM_SIZE + BENCH_COLOR_BUF_SIZE,
+                    },
+                },
+
+                .ipc_num = 1,
+                .ipcs = (struct ipc[]) {
+                    {
+                        .base = BENCH_COLOR_SHM_BASE,
+                        .size = BENCH_COLOR_SHM_SIZE,
+                        .shmem_id = 0,
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = BENCH_GICD_BASE,
+                        .gicr_addr = BENCH_GICR_BASE,
+                    },
+                },
+            },
+        },
+    },
+};
@@ -0,0 +1,25 @@
+## SPDX-License-Identifier: Apache-2.0
+## Copyright (c) Bao Project and Contributors. All rights reserved.
+
+# BENCH_COLORED=n runs the same vms without coloring, as the baseline. The color splits default to
+# interleaved halves, which apply to whatever number of colors the platform's cache yields.
+BENCH_COLORED?=y
+BENCH_HOG_COLORS?=0xAAAAAAAAAAAAAAAA
+BENCH_CHASE_COLORS?=0x5555555555555555
+
+ifeq ($(BENCH_COLORED),y)
+override CPPFLAGS+=-DBENCH_HOG_COLORS=$(BENCH_HOG_COLORS) -DBENCH_CHASE_COLORS=$(BENCH_CHASE_COLORS)
+else
+override CPPFLAGS+=-DBENCH_HOG_COLORS=0 -DBENCH_CHASE_COLORS=0
+endif
+
+include $(config_dir)/../bench/guest/guest.mk
+
+# Rebuild the configuration whenever the coloring mode changes.
+bench_color_stamp:=$(config_build_dir)/colors-$(BENCH_COLORED)-$(BENCH_HOG_COLORS)-$(BENCH_CHASE_COLORS)
+
+$(bench_color_stamp): | $(config_build_dir)
+	@rm -f $(config_build_dir)/colors-*
+	@touch $@
+
+$(config_build_dir)/config.o: $(bench_color_stamp)
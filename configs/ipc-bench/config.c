@@ -0,0 +1,113 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Inter-vm ipc throughput and latency benchmark. A producer vm streams messages from 64B to 1MiB
+ * through a ring in a shared memory to a consumer vm, which either polls the ring or waits for the
+ * ipc hypercall's interrupt. For each message size and consumer mode, the producer prints the
+ * messages and MiB per second, the p50, p99 and p99.9 latency, and the number of notifications it
+ * did issue, to the console. Build with BENCH_COLORED=n for an uncolored shared memory (see
+ * config.mk).
+ */
+
+#include <config.h>
+#include <bench.h>
+
+VM_IMAGE(bench, BENCH_GUEST_IMAGE);
+
+struct config config = {
+
+    .shmemlist_size = 1,
+    .shmemlist = (struct shmem[]) {
+        [0] = {
+            .size = BENCH_IPCB_SHM_SIZE,
+            .colors = BENCH_SHM_COLORS,
+            .color_placement = SHMEM_COLORS_FIXED,
+            .ring = true,
+        },
+    },
+
+    .vmlist_size = 2,
+    .vmlist = {
+        {
+            .image = VM_IMAGE_BUILTIN(bench, BENCH_RAM_BASE),
+            .entry = BENCH_ENTRY_PROD,
+            .cpu_affinity = 0x1,
+
+            .platform = {
+                .cpu_num = 1,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = BENCH_RAM_BASE,
+                        .size = BENCH_RAM_SIZE,
+                    },
+                },
+
+                .dev_num = 1,
+                .devs = (struct vm_dev_region[]) {
+                    {
+                        /* Console, shared with the hypervisor */
+                        .pa = BENCH_UART_BASE,
+                        .va = BENCH_UART_BASE,
+                        .size = 0x1000,
+                    },
+                },
+
+                .ipc_num = 1,
+                .ipcs = (struct ipc[]) {
+                    {
+                        .base = BENCH_IPCB_SHM_BASE,
+                        .size = BENCH_IPCB_SHM_SIZE,
+                        .shmem_id = 0,
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = BENCH_GICD_BASE,
+                        .gicr_addr = BENCH_GICR_BASE,
+                    },
+                },
+            },
+        },
+        {
+            .image = VM_IMAGE_BUILTIN(bench, BENCH_RAM_BASE),
+            .entry = BENCH_ENTRY_CONS,
+            .cpu_affinity = 0x2,
+
+            .platform = {
+                .cpu_num = 1,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = BENCH_RAM_BASE,
+                        .size = BENCH_RAM_SIZE + BENCH_IPCB_BUF_SIZE,
+                    },
+                },
+
+                .ipc_num = 1,
+                .ipcs = (struct ipc[]) {
+                    {
+                        .base = BENCH_IPCB_SHM_BASE,
+                        .size = BENCH_IPCB_SHM_SIZE,
+                        .shmem_id = 0,
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) { BENCH_IPCB_IRQ },
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = BENCH_GICD_BASE,
+                        .gicr_addr = BENCH_GICR_BASE,
+                    },
+                },
+            },
+        },
+    },
+};
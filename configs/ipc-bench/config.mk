@@ -0,0 +1,24 @@
+## SPDX-License-Identifier: Apache-2.0
+## Copyright (c) Bao Project and Contributors. All rights reserved.
+
+# BENCH_COLORED=n places the shared memory without coloring, as the baseline. The shared memory
+# colors default to a quarter of them, interleaved, whatever number of colors the platform yields.
+BENCH_COLORED?=y
+BENCH_SHM_COLORS?=0x1111111111111111
+
+ifeq ($(BENCH_COLORED),y)
+override CPPFLAGS+=-DBENCH_SHM_COLORS=$(BENCH_SHM_COLORS)
+else
+override CPPFLAGS+=-DBENCH_SHM_COLORS=0
+endif
+
+include $(config_dir)/../bench/guest/guest.mk
+
+# Rebuild the configuration whenever the coloring mode changes.
+bench_color_stamp:=$(config_build_dir)/colors-$(BENCH_COLORED)-$(BENCH_SHM_COLORS)
+
+$(bench_color_stamp): | $(config_build_dir)
+	@rm -f $(config_build_dir)/colors-*
+	@touch $@
+
+$(config_build_dir)/config.o: $(bench_color_stamp)
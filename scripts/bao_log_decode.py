@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (c) Bao Project and Contributors. All rights reserved.
+
+"""
+Decodes the console output of a hypervisor built with CONSOLE_LOG=binary. Each record is the sync
+sequence, the address of the format string, the number of arguments and the arguments themselves,
+all as the target's unsigned long. Format strings, and string arguments, are read from the loadable
+segments of the hypervisor's elf.
+
+usage: bao_log_decode.py bao.elf [captured_output]
+"""
+
+import re
+import struct
+import sys
+
+SYNC = b"\x1bB"
+PT_LOAD = 1
+
+
+class Image:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF":
+            sys.exit(f"{path}: not an elf file")
+        self.wide = data[4] == 2
+        self.endian = "<" if data[5] == 1 else ">"
+        self.word = 8 if self.wide else 4
+        if self.wide:
+            phoff, = struct.unpack_from(self.endian + "Q", data, 0x20)
+            phentsize, phnum = struct.unpack_from(self.endian + "HH", data, 0x36)
+        else:
+            phoff, = struct.unpack_from(self.endian + "I", data, 0x1c)
+            phentsize, phnum = struct.unpack_from(self.endian + "HH", data, 0x2a)
+        self.segments = []
+        for i in range(phnum):
+            off = phoff + i * phentsize
+            if self.wide:
+                p_type, _, p_offset, p_vaddr, _, p_filesz = \
+                    struct.unpack_from(self.endian + "IIQQQQ", data, off)
+            else:
+                p_type, p_offset, p_vaddr, _, p_filesz = \
+                    struct.unpack_from(self.endian + "IIIII", data, off)
+            if p_type == PT_LOAD:
+                self.segments.append((p_vaddr, data[p_offset:p_offset + p_filesz]))
+
+    def string(self, addr):
+        for vaddr, seg in self.segments:
+            if vaddr <= addr < vaddr + len(seg):
+                start = addr - vaddr
+                end = seg.find(b"\0", start)
+                return seg[start:end if end >= 0 else len(seg)].decode(errors="replace")
+        return None
+
+
+SPEC = re.compile(r"%(l{0,2})([diuxXsc%])")
+
+
+def format_record(image, fmt, args):
+    args = list(args)
+    mask = (1 << (8 * image.word)) - 1
+
+    def conv(m):
+        length, spec = m.groups()
+        if spec == "%":
+            return "%"
+        if not args:
+            return m.group(0)
+        val = args.pop(0)
+        bits = 8 * image.word if length else 32
+        val &= (1 << bits) - 1
+        if spec in "di":
+            return str(val - (1 << bits) if val >> (bits - 1) else val)
+        if spec == "u":
+            return str(val)
+        if spec in "xX":
+            return f"{val:x}"
+        if spec == "c":
+            return chr(val & 0xff)
+        s = image.string(val & mask)
+        return s if s is not None else f"<0x{val:x}>"
+
+    return SPEC.sub(conv, fmt)
+
+
+def decode(image, stream, out):
+    word = image.word
+    hdr = image.endian + ("QQ" if image.wide else "II")
+    buf = stream.read()
+    i = 0
+    while True:
+        start = buf.find(SYNC, i)
+        if start < 0:
+            break
+        pos = start + len(SYNC)
+        if pos + 2 * word > len(buf):
+            break
+        fmt_addr, nargs = struct.unpack_from(hdr, buf, pos)
+        pos += 2 * word
+        if pos + nargs * word > len(buf):
+            break
+        args = struct.unpack_from(image.endian + ("Q" if image.wide else "I") * nargs, buf, pos)
+        pos += nargs * word
+        fmt = image.string(fmt_addr)
+        if fmt is None:
+            out.write(f"<unknown format 0x{fmt_addr:x}>\n")
+        else:
+            out.write(format_record(image, fmt, args).replace("\r", ""))
+        i = pos
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    image = Image(sys.argv[1])
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "rb") as f:
+            decode(image, f, sys.stdout)
+    else:
+        decode(image, sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -6,14 +6,96 @@
 #include <stdio.h>
 #include <config.h>
 
+#define PT_LVL_SIZE(LVL) (1ULL << (12 + (9 * (LVL))))
+
+/**
+ * Counts the tables of the given level a mapping of size bytes from va to pa might need, i.e., the
+ * windows of the level above it touched but not mapped as a block, assuming 4KiB pages and 512
+ * entries per table, for the widest stage 2 layouts.
+ */
+static size_t pt_tables(unsigned long long va, unsigned long long pa, unsigned long long size,
+    size_t lvl)
+{
+    unsigned long long win = PT_LVL_SIZE(lvl + 1);
+    unsigned long long first = va / win;
+    unsigned long long last = (va + size - 1) / win;
+
+    if ((lvl == 2) || (((va ^ pa) % win) != 0)) {
+        return (size_t)(last - first + 1);
+    }
+
+    size_t n = 0;
+    if ((va % win) != 0) {
+        n++;
+    }
+    if ((((va + size) % win) != 0) && ((last != first) || (n == 0))) {
+        n++;
+    }
+    return n;
+}
+
+static size_t pt_pages(unsigned long long va, unsigned long long pa, unsigned long long size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    return pt_tables(va, pa, size, 0) + pt_tables(va, pa, size, 1) + pt_tables(va, pa, size, 2);
+}
+
+/**
+ * The stage 2 tables of the regions placed at a fixed physical address and of the devices are
+ * fully determined by the config, so the number of table pages they take is worked out here for
+ * the hypervisor to reserve them in one go. Their layout depends on the physical address range
+ * only known at run time, so the tables themselves are still built at boot.
+ */
+static void print_vm_pt_pages(void)
+{
+    printf("#define CONFIG_VM_PT_PAGES {");
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_platform* vm_platform = &config.vmlist[i].platform;
+        size_t n = 0;
+        for (size_t j = 0; j < vm_platform->region_num; j++) {
+            const struct vm_mem_region* reg = &vm_platform->regions[j];
+            if (reg->place_phys) {
+                n += pt_pages(reg->base, reg->phys, reg->size);
+            }
+        }
+        for (size_t j = 0; j < vm_platform->dev_num; j++) {
+            const struct vm_dev_region* dev = &vm_platform->devs[j];
+            n += pt_pages(dev->va, dev->pa, dev->size);
+        }
+        printf(" %ld,", n);
+    }
+    printf(" }\n");
+}
+
 int main() {
     size_t vcpu_num = 0;
+    size_t vm_int_num = 1;
+    bool vm_cpu_num_uniform = config.vmlist_size > 0;
     for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_platform* vm_platform = &config.vmlist[i].platform;
+        for (size_t j = 0; j < vm_platform->dev_num; j++) {
+            for (size_t k = 0; k < vm_platform->devs[j].interrupt_num; k++) {
+                if (vm_platform->devs[j].interrupts[k] >= vm_int_num) {
+                    vm_int_num = vm_platform->devs[j].interrupts[k] + 1;
+                }
+            }
+        }
+
         vcpu_num += config.vmlist[i].platform.cpu_num;
+        if (config.vmlist[i].platform.cpu_num != config.vmlist[0].platform.cpu_num) {
+            vm_cpu_num_uniform = false;
+        }
     }
 
     printf("#define CONFIG_VM_NUM %ld\n", config.vmlist_size);
     printf("#define CONFIG_VCPU_NUM %ld\n", vcpu_num);
+    printf("#define CONFIG_VM_INT_NUM %ld\n", vm_int_num);
+    if (vm_cpu_num_uniform) {
+        printf("#define CONFIG_VM_CPU_NUM %ld\n", config.vmlist[0].platform.cpu_num);
+    }
+    print_vm_pt_pages();
 
     if(config.hyp.relocate) {
         printf("#define CONFIG_HYP_BASE_ADDR (0x%lx)\n", config.hyp.base_addr);
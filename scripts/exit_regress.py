@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (c) Bao Project and Contributors. All rights reserved.
+
+"""
+Compares the exit counts the benchmark guest (configs/bench) prints after each scenario against a
+baseline, failing if any scenario exits more often for any reason than the baseline allows. The
+console output is read from a file, standard input, or from running the given command, e.g. qemu
+booting the hypervisor image, until the benchmark is done. With --update, the counts are written
+to the baseline instead.
+
+usage: exit_regress.py [--update] [--tolerance PERCENT] baseline [captured_output | -- command...]
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+EXITS = re.compile(r"^exits (\S+) (\S+) (\d+)\s*$")
+DONE = "benchmark done"
+TIMEOUT = 600
+
+# Exits driven by the guest's timing loops rather than by the code under test vary between runs
+SLACK = 16
+
+
+def parse(lines):
+    counts = {}
+    done = False
+    for line in lines:
+        match = EXITS.match(line.strip())
+        if match:
+            scenario, reason, count = match.groups()
+            counts[(scenario, reason)] = int(count)
+        elif DONE in line:
+            done = True
+            break
+    return counts, done
+
+
+def run(command):
+    proc = subprocess.Popen(command, stdout=subprocess.PIPE, stdin=subprocess.DEVNULL, text=True,
+                            errors="replace")
+    lines = []
+    try:
+        for line in proc.stdout:
+            sys.stdout.write(line)
+            lines.append(line)
+            if DONE in line:
+                break
+    finally:
+        proc.kill()
+        proc.wait(timeout=TIMEOUT)
+    return lines
+
+
+def read_baseline(path):
+    with open(path) as f:
+        counts, _ = parse(f"exits {line}" for line in f if not line.startswith("#"))
+    return counts
+
+
+def write_baseline(path, counts):
+    with open(path, "w") as f:
+        f.write("# scenario reason count, written by scripts/exit_regress.py --update\n")
+        for (scenario, reason), count in counts.items():
+            f.write(f"{scenario} {reason} {count}\n")
+
+
+def compare(baseline, counts, tolerance):
+    failures = []
+    for key in sorted(set(baseline) | set(counts)):
+        base = baseline.get(key, 0)
+        count = counts.get(key, 0)
+        limit = base + max(SLACK, (base * tolerance) // 100)
+        status = "ok"
+        if count > limit:
+            status = "REGRESSION"
+            failures.append(key)
+        print(f"{key[0]:<8} {key[1]:<8} {base:>10} {count:>10}  {status}")
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__)
+    parser.add_argument("--update", action="store_true")
+    parser.add_argument("--tolerance", type=int, default=5)
+    parser.add_argument("baseline")
+    parser.add_argument("output", nargs="?", default="-")
+    argv = sys.argv[1:]
+    command = None
+    if "--" in argv:
+        command = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+
+    if command:
+        lines = run(command)
+    elif args.output == "-":
+        lines = sys.stdin.readlines()
+    else:
+        with open(args.output, errors="replace") as f:
+            lines = f.readlines()
+
+    counts, done = parse(lines)
+    if not done:
+        sys.exit("benchmark did not complete")
+
+    if args.update:
+        write_baseline(args.baseline, counts)
+        return
+
+    if compare(read_baseline(args.baseline), counts, args.tolerance):
+        sys.exit("exit counts regressed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,21 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved
+ */
+
+#include <bao.h>
+#include <cpu.h>
+#include <vm.h>
+#include <config_defs.h>
+
+void footprint_defines() __attribute__((used));
+void footprint_defines()
+{
+    DEFINE_SIZE(CPU_SIZE, struct cpu);
+    DEFINE_SIZE(CPU_STACK_SIZE, ((struct cpu*)NULL)->stack);
+    DEFINE_SIZE(VM_SIZE, struct vm);
+    DEFINE_SIZE(VCPU_SIZE, struct vcpu);
+    DEFINE_VALUE(CPU_NUM, PLAT_CPU_NUM);
+    DEFINE_VALUE(VM_NUM, CONFIG_VM_NUM);
+    DEFINE_VALUE(VCPU_NUM, CONFIG_VCPU_NUM);
+}
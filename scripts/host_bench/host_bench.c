@@ -0,0 +1,414 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Host microbenchmarks of the architecture independent data structures, built and run with
+ * `make host-bench`. They exercise them at the sizes the hypervisor uses them at, timing each
+ * operation so that algorithmic regressions show without a board. The numbers are only
+ * comparable between runs on the same host.
+ */
+
+#include <bao.h>
+#include <bitmap.h>
+#include <mem.h>
+#include <list.h>
+#include <objpool.h>
+#include <string.h>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* A 4GiB page pool */
+#define BENCH_POOL_PAGES  ((4ULL << 30) / PAGE_SIZE)
+#define BENCH_POOL_BASE   (0x80000000UL)
+#define BENCH_COLORS      (16)
+#define BENCH_INTERRUPTS  (1024)
+#define BENCH_BITMAP_BITS (64 * 1024)
+#define BENCH_OBJPOOL_NUM (128)
+#define BENCH_LIST_NODES  (1024)
+
+/* The platform coloring cache.c would enumerate, 16 colors of one page and no dram banks */
+size_t COLOR_NUM = BENCH_COLORS;
+size_t COLOR_SIZE = 1;
+size_t COLOR_BANK_NUM = 1;
+size_t COLOR_BANK_SIZE = 1;
+size_t COLOR_BANK_BITS = 0;
+paddr_t COLOR_BANK_MASKS[COLOR_BANK_BITS_MAX];
+
+void console_printk(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void console_flush(void)
+{
+    fflush(stderr);
+}
+
+void mcs_lock(mcslock_t* lock)
+{
+    lock->node = 1;
+}
+
+void mcs_unlock(mcslock_t* lock)
+{
+    lock->node = 0;
+}
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/* Keeps the compiler from discarding the benchmarked results */
+static volatile size_t bench_sink;
+
+#define BENCH(name, iters, body)                                                     \
+    {                                                                                \
+        uint64_t start = bench_now();                                                \
+        for (size_t iter = 0; iter < (iters); iter++) {                              \
+            body;                                                                    \
+        }                                                                            \
+        uint64_t ns = bench_now() - start;                                           \
+        printf("%-40s %10zu iters %12.1f ns/iter\n", name, (size_t)(iters),          \
+            (double)ns / (double)(iters));                                           \
+    }
+
+static void bench_bitmap_pool(void)
+{
+    size_t size = BENCH_POOL_PAGES;
+    bitmap_t* map = calloc(BITMAP_SIZE(size), sizeof(bitmap_granule_t));
+    if (map == NULL) {
+        ERROR("failed to allocate pool bitmap");
+    }
+
+    /* Fragment the pool with one page in use every 64, leaving the last quarter free */
+    for (size_t i = 0; i < (size * 3) / 4; i += 64) {
+        bitmap_set(map, i);
+    }
+
+    BENCH("pool find 1 free page", 100000, {
+        bench_sink = (size_t)bitmap_find_consec(map, size, iter % size, 1, false);
+    });
+    BENCH("pool find 512 consecutive free pages", 1000, {
+        bench_sink = (size_t)bitmap_find_consec(map, size, 0, 512, false);
+    });
+    BENCH("pool count free pages", 100, {
+        bench_sink = bitmap_count(map, 0, size, false);
+    });
+    BENCH("pool set/clear 256 pages", 100000, {
+        size_t base = ((size * 3) / 4) + ((iter * 256) % (size / 4));
+        bitmap_set_consecutive(map, base, 256);
+        bitmap_clear_consecutive(map, base, 256);
+    });
+
+    free(map);
+}
+
+/* As mem_free_ppages, for the single pool of the benchmark */
+static void bench_pp_free(struct page_pool* pool, struct ppages* ppages)
+{
+    size_t index = (ppages->base - pool->base) / PAGE_SIZE;
+    if (!all_clrs(ppages->colors)) {
+        size_t end = pp_clr_update_bitmap(pool, index, ppages->num_pages, ppages->colors, false);
+        pp_buddy_update(pool, index, end - index);
+    } else {
+        bitmap_clear_consecutive(pool->bitmap, index, ppages->num_pages);
+        pp_buddy_update(pool, index, ppages->num_pages);
+    }
+    pool->free += ppages->num_pages;
+}
+
+static void bench_page_pool(void)
+{
+    struct page_pool pool = {
+        .base = BENCH_POOL_BASE,
+        .size = BENCH_POOL_PAGES,
+        .free = BENCH_POOL_PAGES,
+        .last = 0,
+    };
+    struct ppages ppages;
+    colormap_t colors = 0x5;
+
+    pool.bitmap = calloc(pp_metadata_num_pages(pool.base, pool.size), PAGE_SIZE);
+    if (pool.bitmap == NULL) {
+        ERROR("failed to allocate pool metadata");
+    }
+
+    /* Fragment the pool as bench_bitmap_pool does before indexing it */
+    for (size_t i = 0; i < (pool.size * 3) / 4; i += 64) {
+        bitmap_set(pool.bitmap, i);
+        pool.free--;
+    }
+    pp_buddy_init(&pool);
+
+    BENCH("pp_alloc/free 1 page", 100000, {
+        bench_sink = pp_alloc(&pool, 1, false, &ppages);
+        bench_pp_free(&pool, &ppages);
+    });
+    BENCH("pp_alloc/free 512 aligned pages", 100000, {
+        bench_sink = pp_alloc(&pool, 512, true, &ppages);
+        bench_pp_free(&pool, &ppages);
+    });
+    BENCH("pp_alloc/free 300 pages", 100000, {
+        bench_sink = pp_alloc(&pool, 300, false, &ppages);
+        bench_pp_free(&pool, &ppages);
+    });
+    BENCH("pp_alloc_clr/free 1 page, 2 colors", 100000, {
+        bench_sink = pp_alloc_clr(&pool, 1, colors, &ppages);
+        bench_pp_free(&pool, &ppages);
+    });
+    BENCH("pp_alloc_clr/free 64 pages, 2 colors", 10000, {
+        bench_sink = pp_alloc_clr(&pool, 64, colors, &ppages);
+        bench_pp_free(&pool, &ppages);
+    });
+
+    free(pool.bitmap);
+}
+
+/**
+ * The previous bitmap routines, mostly walking the map bit by bit, kept as the reference the word
+ * at a time ones are compared against.
+ */
+static ssize_t bench_old_find_nth(bitmap_t* map, size_t size, size_t nth, size_t start, bool set)
+{
+    size_t count = 0;
+    unsigned bit = set ? 1 : 0;
+
+    for (size_t i = start; i < size; i++) {
+        if ((bitmap_get(map, i) == bit) && (++count == nth)) {
+            return (ssize_t)i;
+        }
+    }
+
+    return -1;
+}
+
+static size_t bench_old_count_consecutive(bitmap_t* map, size_t size, size_t start, size_t n)
+{
+    size_t pos = start;
+    size_t count = 0;
+    size_t start_offset = start % BITMAP_GRANULE_LEN;
+    size_t first_word_bits = min(BITMAP_GRANULE_LEN - start_offset, n);
+    bool set = !!bitmap_get(map, start);
+    bitmap_granule_t init_mask = BITMAP_GRANULE_MASK(start_offset, first_word_bits);
+    bitmap_granule_t mask;
+
+    if (n <= 1) {
+        return n;
+    }
+
+    mask = set ? init_mask : ~init_mask;
+    if (!((map[pos / BITMAP_GRANULE_LEN] ^ mask) & init_mask)) {
+        count += first_word_bits;
+        pos += first_word_bits;
+    }
+
+    mask = set ? ~0 : 0;
+    while ((pos < size) && !(map[pos / BITMAP_GRANULE_LEN] ^ mask) && (count < n)) {
+        count += BITMAP_GRANULE_LEN;
+        pos += BITMAP_GRANULE_LEN;
+    }
+
+    while ((pos < size) && (!!bitmap_get(map, pos) == set) && (count < n)) {
+        count++;
+        pos += 1;
+    }
+
+    return count;
+}
+
+static ssize_t bench_old_find_consec(bitmap_t* map, size_t size, size_t start, size_t n, bool set)
+{
+    ssize_t i = bench_old_find_nth(map, size, 1, start, set);
+    if (i < 0) {
+        return -1;
+    }
+
+    while ((size_t)i < size) {
+        size_t count = bench_old_count_consecutive(map, size, (size_t)i, n);
+        if (count < n) {
+            i += (ssize_t)count;
+            i += (ssize_t)bench_old_count_consecutive(map, size, (size_t)i, (size_t)-1);
+        } else {
+            break;
+        }
+    }
+
+    return ((size_t)i >= size) ? -1 : i;
+}
+
+static void bench_old_clear_consecutive(bitmap_t* map, size_t start, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        bitmap_clear(map, start + i);
+    }
+}
+
+static size_t bench_old_count(bitmap_t* map, size_t start, size_t n, bool set)
+{
+    size_t count = 0;
+    for (size_t i = start; i < n; i++) {
+        if (bitmap_get(map, i) == set) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void bench_bitmap_old_new(void)
+{
+    size_t size = BENCH_BITMAP_BITS;
+    BITMAP_ALLOC(map, BENCH_BITMAP_BITS);
+    memset(map, 0, sizeof(map));
+
+    /* Sparse set bits over the first half, one every 64, and a dense half set every other bit */
+    for (size_t i = 0; i < size / 2; i += 64) {
+        bitmap_set(map, i);
+    }
+    for (size_t i = size / 2; i < size; i += 2) {
+        bitmap_set(map, i);
+    }
+
+    BENCH("64K old find first set", 10000, {
+        bench_sink = (size_t)bench_old_find_nth(map, size, 1, iter % (size / 2), true);
+    });
+    BENCH("64K new find first set", 10000, {
+        bench_sink = (size_t)bitmap_find_first(map, size, iter % (size / 2), true);
+    });
+    BENCH("64K old find 256th set", 10000, {
+        bench_sink = (size_t)bench_old_find_nth(map, size, 256, 0, true);
+    });
+    BENCH("64K new find 256th set", 10000, {
+        bench_sink = (size_t)bitmap_find_nth(map, size, 256, 0, true);
+    });
+    BENCH("64K old find 128 clear, none free", 10000, {
+        bench_sink = (size_t)bench_old_find_consec(map, size, 0, 128, false);
+    });
+    BENCH("64K new find 128 clear, none free", 10000, {
+        bench_sink = (size_t)bitmap_find_consec(map, size, 0, 128, false);
+    });
+    BENCH("64K old find 32 consecutive clear", 10000, {
+        bench_sink = (size_t)bench_old_find_consec(map, size, iter % (size / 2), 32, false);
+    });
+    BENCH("64K new find 32 consecutive clear", 10000, {
+        bench_sink = (size_t)bitmap_find_consec(map, size, iter % (size / 2), 32, false);
+    });
+    BENCH("64K old count set", 1000, {
+        bench_sink = bench_old_count(map, 0, size, true);
+    });
+    BENCH("64K new count set", 1000, {
+        bench_sink = bitmap_count(map, 0, size, true);
+    });
+    BENCH("64K old set/clear 4K bits", 10000, {
+        size_t base = (iter * 4096) % (size / 2);
+        bitmap_set_consecutive(map, base, 4096);
+        bench_old_clear_consecutive(map, base, 4096);
+        bench_sink = map[base / BITMAP_GRANULE_LEN];
+    });
+    BENCH("64K new set/clear 4K bits", 10000, {
+        size_t base = (iter * 4096) % (size / 2);
+        bitmap_set_consecutive(map, base, 4096);
+        bitmap_clear_consecutive(map, base, 4096);
+        bench_sink = map[base / BITMAP_GRANULE_LEN];
+    });
+}
+
+static void bench_bitmap_interrupts(void)
+{
+    BITMAP_ALLOC(map, BENCH_INTERRUPTS);
+    memset(map, 0, sizeof(map));
+    for (size_t i = 0; i < BENCH_INTERRUPTS; i += 37) {
+        bitmap_set(map, i);
+    }
+
+    BENCH("interrupts find next set", 1000000, {
+        bench_sink = (size_t)bitmap_find_first(map, BENCH_INTERRUPTS, iter % BENCH_INTERRUPTS,
+            true);
+    });
+    BENCH("interrupts find nth set", 1000000, {
+        bench_sink = (size_t)bitmap_find_nth(map, BENCH_INTERRUPTS, (iter % 27) + 1, 0, true);
+    });
+    BENCH("interrupts count set", 1000000, {
+        bench_sink = bitmap_count(map, 0, BENCH_INTERRUPTS, true);
+    });
+}
+
+struct bench_obj {
+    uint64_t data[4];
+};
+
+OBJPOOL_ALLOC(bench_pool, struct bench_obj, BENCH_OBJPOOL_NUM);
+
+static void bench_objpool(void)
+{
+    static void* objs[BENCH_OBJPOOL_NUM];
+
+    objpool_init(&bench_pool);
+
+    BENCH("objpool alloc/free all slots", 100000, {
+        for (size_t i = 0; i < BENCH_OBJPOOL_NUM; i++) {
+            objs[i] = objpool_alloc(&bench_pool);
+        }
+        for (size_t i = 0; i < BENCH_OBJPOOL_NUM; i++) {
+            objpool_free(&bench_pool, objs[(i * 7) % BENCH_OBJPOOL_NUM]);
+        }
+    });
+}
+
+struct bench_node {
+    node_t node;
+    size_t key;
+};
+
+static int bench_node_cmp(node_t* a, node_t* b)
+{
+    size_t ka = ((struct bench_node*)a)->key;
+    size_t kb = ((struct bench_node*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static void bench_list(void)
+{
+    static struct bench_node nodes[BENCH_LIST_NODES];
+    struct list list;
+
+    for (size_t i = 0; i < BENCH_LIST_NODES; i++) {
+        nodes[i].key = (i * 7919) % BENCH_LIST_NODES;
+    }
+
+    BENCH("list push/pop all nodes", 10000, {
+        list_init(&list);
+        for (size_t i = 0; i < BENCH_LIST_NODES; i++) {
+            list_push(&list, &nodes[i].node);
+        }
+        while (list_pop(&list) != NULL) { }
+    });
+    BENCH("list insert ordered all nodes", 10, {
+        list_init(&list);
+        for (size_t i = 0; i < BENCH_LIST_NODES; i++) {
+            list_insert_ordered(&list, &nodes[i].node, bench_node_cmp);
+        }
+    });
+}
+
+int main(void)
+{
+    bench_bitmap_pool();
+    bench_page_pool();
+    bench_bitmap_old_new();
+    bench_bitmap_interrupts();
+    bench_objpool();
+    bench_list();
+    return 0;
+}
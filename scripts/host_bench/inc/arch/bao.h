@@ -0,0 +1,16 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_BAO_H__
+#define __ARCH_BAO_H__
+
+/* Host build of the architecture independent code, see scripts/host_bench/host_bench.c */
+
+#define PAGE_SIZE (0x1000)
+#ifndef STACK_SIZE
+#define STACK_SIZE (PAGE_SIZE)
+#endif
+
+#endif /* __ARCH_BAO_H__ */
@@ -0,0 +1,13 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_CACHE_H__
+#define __ARCH_CACHE_H__
+
+#include <bao.h>
+
+#define CACHE_MAX_LVL 8
+
+#endif /* __ARCH_CACHE_H__ */
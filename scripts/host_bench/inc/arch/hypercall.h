@@ -0,0 +1,11 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef ARCH_HYPERCALL_H
+#define ARCH_HYPERCALL_H
+
+#define HYPCALL_ARG_REG(ARG) ((ARG) + 1)
+
+#endif /* ARCH_HYPERCALL_H */
@@ -0,0 +1,51 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_SPINLOCK__
+#define __ARCH_SPINLOCK__
+
+#include <bao.h>
+
+/* The benchmarks are single threaded, so the locks only need to build */
+
+typedef struct {
+    uint32_t ticket;
+    uint32_t next;
+} spinlock_t;
+
+#define SPINLOCK_INITVAL ((spinlock_t){ 0, 0 })
+
+static inline void spinlock_init(spinlock_t* lock)
+{
+    lock->ticket = 0;
+    lock->next = 0;
+}
+
+static inline void spin_lock(spinlock_t* lock)
+{
+    (void)lock;
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+    (void)lock;
+}
+
+static inline uint32_t spin_atomic_xchg(volatile uint32_t* ptr, uint32_t val)
+{
+    return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t spin_atomic_cmpxchg(volatile uint32_t* ptr, uint32_t expected, uint32_t val)
+{
+    __atomic_compare_exchange_n(ptr, &expected, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+static inline void spin_wait(void) { }
+
+static inline void spin_notify(void) { }
+
+#endif /* __ARCH_SPINLOCK__ */
@@ -0,0 +1,31 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __MEM_PROT_H__
+#define __MEM_PROT_H__
+
+#include <bao.h>
+#include <spinlock.h>
+
+/* Only the page pools are built on the host, which never map anything */
+
+struct addr_space {
+    enum AS_TYPE type;
+    colormap_t colors;
+    struct mem_place place;
+    spinlock_t lock;
+};
+
+typedef uint64_t mem_flags_t;
+
+#define PTE_VM_FLAGS       (0)
+#define PTE_VM_NC_FLAGS    (0)
+#define PTE_VM_INNER_FLAGS (0)
+
+struct page_pool;
+size_t pp_clr_update_bitmap(struct page_pool* pool, size_t index, size_t n, colormap_t colors,
+    bool set);
+
+#endif /* __MEM_PROT_H__ */
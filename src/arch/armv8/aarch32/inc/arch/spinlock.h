@@ -65,4 +65,51 @@ static inline void spin_unlock(spinlock_t* lock)
         "sev\n\t" : "=&r"(temp) : "Q"(lock->next) : "memory");
 }
 
+/**
+ * Atomic primitives used by the generic queued lock (see spinlock.h). Both are fully ordered.
+ */
+
+static inline uint32_t spin_atomic_xchg(volatile uint32_t* ptr, uint32_t val)
+{
+    uint32_t old;
+    uint32_t temp;
+
+    __asm__ volatile(
+        "1:\n\t"
+        "ldaex  %0, %2\n\t"
+        "stlex  %1, %3, %2\n\t"
+        "cmp    %1, #0\n\t"
+        "bne    1b\n\t" : "=&r"(old), "=&r"(temp), "+Q"(*ptr) : "r"(val) : "cc", "memory");
+    return old;
+}
+
+static inline uint32_t spin_atomic_cmpxchg(volatile uint32_t* ptr, uint32_t expected, uint32_t val)
+{
+    uint32_t old;
+    uint32_t temp;
+
+    __asm__ volatile(
+        "1:\n\t"
+        "ldaex  %0, %2\n\t"
+        "cmp    %0, %3\n\t"
+        "bne    2f\n\t"
+        "stlex  %1, %4, %2\n\t"
+        "cmp    %1, #0\n\t"
+        "bne    1b\n\t"
+        "2:\n\t" : "=&r"(old), "=&r"(temp), "+Q"(*ptr) : "r"(expected), "r"(val)
+        : "cc", "memory");
+    return old;
+}
+
+static inline void spin_wait(void)
+{
+    __asm__ volatile("wfe\n\t" ::: "memory");
+}
+
+static inline void spin_notify(void)
+{
+    __asm__ volatile("dsb ish\n\t"
+                     "sev\n\t" ::: "memory");
+}
+
 #endif /* __ARCH_SPINLOCK__ */
@@ -65,6 +65,7 @@
 SYSREG_GEN_ACCESSORS(esr_el2, 4, c5, c2, 0); // hsr
 SYSREG_GEN_ACCESSORS_BANKED(elr_el2, elr_hyp);
 SYSREG_GEN_ACCESSORS(far_el2, 4, c6, c0, 0); // hdfar
+SYSREG_GEN_ACCESSORS(hifar_el2, 4, c6, c0, 2);
 SYSREG_GEN_ACCESSORS(hpfar_el2, 4, c6, c0, 4);
 SYSREG_GEN_ACCESSORS(clidr_el1, 1, c0, c0, 1);
 SYSREG_GEN_ACCESSORS(csselr_el1, 2, c0, c0, 0);
@@ -72,9 +73,25 @@ SYSREG_GEN_ACCESSORS(ctr_el0, 0, c0, c0, 1);
 SYSREG_GEN_ACCESSORS(mpidr_el1, 0, c0, c0, 5);
 SYSREG_GEN_ACCESSORS(vmpidr_el2, 4, c0, c0, 5);
 SYSREG_GEN_ACCESSORS_64(cntvoff_el2, 4, c14);
+SYSREG_GEN_ACCESSORS(cnthctl_el2, 4, c14, c1, 0);
 SYSREG_GEN_ACCESSORS(sctlr_el1, 0, c1, c0, 0);
 SYSREG_GEN_ACCESSORS(cntkctl_el1, 0, c14, c1, 0);
 SYSREG_GEN_ACCESSORS(pmcr_el0, 0, c9, c12, 0);
+SYSREG_GEN_ACCESSORS(pmselr_el0, 0, c9, c12, 5);
+SYSREG_GEN_ACCESSORS(pmxevtyper_el0, 0, c9, c13, 1);
+SYSREG_GEN_ACCESSORS(pmxevcntr_el0, 0, c9, c13, 2);
+SYSREG_GEN_ACCESSORS(pmcntenset_el0, 0, c9, c12, 1);
+SYSREG_GEN_ACCESSORS(pmcntenclr_el0, 0, c9, c12, 2);
+SYSREG_GEN_ACCESSORS(pmintenset_el1, 0, c9, c14, 1);
+SYSREG_GEN_ACCESSORS(pmintenclr_el1, 0, c9, c14, 2);
+SYSREG_GEN_ACCESSORS(pmovsclr_el0, 0, c9, c12, 3);
+SYSREG_GEN_ACCESSORS(pmccntr_el0, 0, c9, c13, 0);
+SYSREG_GEN_ACCESSORS(pmccfiltr_el0, 0, c14, c15, 7);
+SYSREG_GEN_ACCESSORS(pmuserenr_el0, 0, c9, c14, 0);
+SYSREG_GEN_ACCESSORS(clusterthreadsid_el1, 0, c15, c4, 0);
+SYSREG_GEN_ACCESSORS(clusterpartcr_el1, 0, c15, c4, 3);
+SYSREG_GEN_ACCESSORS(id_dfr0_el1, 0, c0, c1, 2);
+SYSREG_GEN_ACCESSORS(mdcr_el2, 4, c1, c1, 1); // hdcr
 SYSREG_GEN_ACCESSORS_64(par_el1, 0, c7);
 SYSREG_GEN_ACCESSORS(tcr_el2, 4, c2, c0, 2);    // htcr
 SYSREG_GEN_ACCESSORS_64(ttbr0_el2, 4, c2);      // httbr
@@ -91,6 +108,9 @@ SYSREG_GEN_ACCESSORS(hcr, 4, c1, c1, 0);
 SYSREG_GEN_ACCESSORS(hcr2, 4, c6, c0, 0);
 SYSREG_GEN_ACCESSORS_MERGE(hcr_el2, hcr, hcr2);
 SYSREG_GEN_ACCESSORS(cntfrq_el0, 0, c14, c0, 0);
+SYSREG_GEN_ACCESSORS_64(cntpct_el0, 0, c14);
+SYSREG_GEN_ACCESSORS(cnthp_ctl_el2, 4, c14, c2, 1);
+SYSREG_GEN_ACCESSORS_64(cnthp_cval_el2, 6, c14);
 
 SYSREG_GEN_ACCESSORS(mpuir_el2, 4, c0, c0, 4);
 SYSREG_GEN_ACCESSORS(prselr_el2, 4, c6, c2, 1);
@@ -111,6 +131,7 @@ SYSREG_GEN_ACCESSORS(icc_bpr1_el1, 0, c12, c12, 3);
 SYSREG_GEN_ACCESSORS(icc_ctlr_el1, 0, c12, c12, 4);
 SYSREG_GEN_ACCESSORS(icc_igrpen1_el1, 0, c12, c12, 7);
 SYSREG_GEN_ACCESSORS(ich_hcr_el2, 4, c12, c11, 0);
+SYSREG_GEN_ACCESSORS(ich_vmcr_el2, 4, c12, c11, 7);
 SYSREG_GEN_ACCESSORS_64(icc_sgi1r_el1, 0, c12);
 
 SYSREG_GEN_ACCESSORS(vsctlr_el2, 4, c2, c0, 0);
@@ -143,6 +164,24 @@ static inline void arm_dc_civac(vaddr_t cache_addr)
     sysreg_dccivac_write(cache_addr);
 }
 
+SYSREG_GEN_ACCESSORS(dccmvac, 0, c7, c10, 1);
+static inline void arm_dc_cvac(vaddr_t cache_addr)
+{
+    sysreg_dccmvac_write(cache_addr);
+}
+
+SYSREG_GEN_ACCESSORS(dcimvac, 0, c7, c6, 1);
+static inline void arm_dc_ivac(vaddr_t cache_addr)
+{
+    sysreg_dcimvac_write(cache_addr);
+}
+
+SYSREG_GEN_ACCESSORS(iciallu, 0, c7, c5, 0);
+static inline void arm_ic_iallu(void)
+{
+    sysreg_iciallu_write(0);
+}
+
 static inline void arm_at_s1e2w(vaddr_t vaddr)
 {
     asm volatile("mcr p15, 4, %0, c7, c8, 1" ::"r"(vaddr)); // ats1hw
@@ -173,6 +212,11 @@ static inline void arm_tlbi_ipas2e1is(vaddr_t vaddr)
     asm volatile("mcr p15, 4, %0, c8, c0, 1" ::"r"(vaddr >> 12));
 }
 
+static inline void arm_tlbi_vmalle1is()
+{
+    asm volatile("mcr p15, 0, r0, c8, c3, 0"); // tlbiallis
+}
+
 #endif /* |__ASSEMBLER__ */
 
 #endif /* ARCH_PROFILE_SYSREGS_H */
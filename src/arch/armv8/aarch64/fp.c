@@ -0,0 +1,65 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/fp.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+#include <cpu.h>
+#include <vm.h>
+#include <string.h>
+
+/**
+ * The fp/simd registers are switched lazily. A vcpu starts running with its accesses trapped
+ * through CPTR_EL2.TFP, unless the cpu's registers still hold its state, and only gets them on its
+ * first access, when the state of their previous owner is saved. So vcpus that never use them
+ * add nothing to a switch, and a vcpu running alone on its cpu traps only once.
+ */
+void fp_vcpu_init(struct vcpu* vcpu)
+{
+    memset(&vcpu->arch.fp, 0, sizeof(vcpu->arch.fp));
+}
+
+static inline void fp_trap_set(bool trap)
+{
+    unsigned long cptr = sysreg_cptr_el2_read();
+    sysreg_cptr_el2_write(trap ? (cptr | CPTR_TFP_BIT) : (cptr & ~CPTR_TFP_BIT));
+    ISB();
+}
+
+void fp_vcpu_run(struct vcpu* vcpu)
+{
+    fp_trap_set(cpu()->arch.fp_owner != vcpu);
+}
+
+void fp_trap_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    struct vcpu* owner = cpu()->arch.fp_owner;
+
+    fp_trap_set(false);
+
+    if (owner != vcpu) {
+        if (owner != NULL) {
+            fp_ctx_save(&owner->arch.fp);
+        }
+        fp_ctx_restore(&vcpu->arch.fp);
+        cpu()->arch.fp_owner = vcpu;
+    }
+}
+
+/**
+ * The registers lose their contents when the cpu powers down, so their owner's state is saved
+ * beforehand.
+ */
+void fp_cpu_save(void)
+{
+    struct vcpu* owner = cpu()->arch.fp_owner;
+
+    if (owner != NULL) {
+        fp_trap_set(false);
+        fp_ctx_save(&owner->arch.fp);
+        cpu()->arch.fp_owner = NULL;
+    }
+}
@@ -23,15 +23,57 @@ static inline void spinlock_init(spinlock_t* lock)
 
 /**
  * This lock follows the ticket lock algorithm described in Arm's ARM DDI0487I.a Appendix K13.
+ *
+ * On cores implementing the Armv8.1 large system extensions (ID_AA64ISAR0_EL1.Atomic), the
+ * ticket is taken by a single ldadda instead of the exclusives' retry loop, which under contention
+ * keeps failing as other cores take tickets. Both variants access the lock atomically, so cpus
+ * that start with the exclusives before spinlock_lse is set by cpu_arch_init can share locks with
+ * cpus already using ldadda.
  */
 
+extern bool spinlock_lse;
+
+static inline void spin_lock_lse(spinlock_t* lock)
+{
+    uint32_t ticket;
+    uint32_t next;
+
+    __asm__ volatile(
+        ".arch_extension lse\n\t"
+        /* Get ticket */
+        "ldadda %w2, %w0, %3\n\t"
+        /* Wait for your turn */
+        "2:\n\t"
+        "ldar   %w1, %4\n\t"
+        "cmp    %w0, %w1\n\t"
+        "b.eq   3f\n\t"
+        "wfe\n\t"
+        "b 2b\n\t"
+        "3:\n\t" : "=&r"(ticket), "=&r"(next) : "r"(1U), "Q"(lock->ticket), "Q"(lock->next)
+        : "memory");
+}
+
+static inline void spin_unlock_lse(spinlock_t* lock)
+{
+    __asm__ volatile(
+        ".arch_extension lse\n\t"
+        /* increment to next ticket */
+        "staddl %w0, %1\n\t"
+        "dsb ish\n\t"
+        "sev\n\t" ::"r"(1U), "Q"(lock->next) : "memory");
+}
+
 static inline void spin_lock(spinlock_t* lock)
 {
     uint32_t ticket;
     uint32_t next;
     uint32_t temp;
 
-    (void)lock;
+    if (spinlock_lse) {
+        spin_lock_lse(lock);
+        return;
+    }
+
     __asm__ volatile(
         /* Get ticket */
         "1:\n\t"
@@ -54,6 +96,11 @@ static inline void spin_unlock(spinlock_t* lock)
 {
     uint32_t temp;
 
+    if (spinlock_lse) {
+        spin_unlock_lse(lock);
+        return;
+    }
+
     __asm__ volatile(
         /* increment to next ticket */
         "ldr    %w0, %1\n\t"
@@ -63,4 +110,62 @@ static inline void spin_unlock(spinlock_t* lock)
         "sev\n\t" : "=&r"(temp) : "Q"(lock->next) : "memory");
 }
 
+/**
+ * Atomic primitives used by the generic queued lock (see spinlock.h). Both are fully ordered.
+ */
+
+static inline uint32_t spin_atomic_xchg(volatile uint32_t* ptr, uint32_t val)
+{
+    uint32_t old;
+    uint32_t temp;
+
+    if (spinlock_lse) {
+        __asm__ volatile(".arch_extension lse\n\t"
+                         "swpal  %w2, %w0, %1\n\t" : "=&r"(old), "+Q"(*ptr) : "r"(val) : "memory");
+        return old;
+    }
+
+    __asm__ volatile(
+        "1:\n\t"
+        "ldaxr  %w0, %2\n\t"
+        "stlxr  %w1, %w3, %2\n\t"
+        "cbnz   %w1, 1b\n\t" : "=&r"(old), "=&r"(temp), "+Q"(*ptr) : "r"(val) : "memory");
+    return old;
+}
+
+static inline uint32_t spin_atomic_cmpxchg(volatile uint32_t* ptr, uint32_t expected, uint32_t val)
+{
+    uint32_t old;
+    uint32_t temp;
+
+    if (spinlock_lse) {
+        old = expected;
+        __asm__ volatile(".arch_extension lse\n\t"
+                         "casal  %w0, %w2, %1\n\t" : "+&r"(old), "+Q"(*ptr) : "r"(val) : "memory");
+        return old;
+    }
+
+    __asm__ volatile(
+        "1:\n\t"
+        "ldaxr  %w0, %2\n\t"
+        "cmp    %w0, %w3\n\t"
+        "b.ne   2f\n\t"
+        "stlxr  %w1, %w4, %2\n\t"
+        "cbnz   %w1, 1b\n\t"
+        "2:\n\t" : "=&r"(old), "=&r"(temp), "+Q"(*ptr) : "r"(expected), "r"(val)
+        : "cc", "memory");
+    return old;
+}
+
+static inline void spin_wait(void)
+{
+    __asm__ volatile("wfe\n\t" ::: "memory");
+}
+
+static inline void spin_notify(void)
+{
+    __asm__ volatile("dsb ish\n\t"
+                     "sev\n\t" ::: "memory");
+}
+
 #endif /* __ARCH_SPINLOCK__ */
@@ -26,6 +26,7 @@
 #define icc_ctlr_el1    S3_0_C12_C12_4
 #define icc_igrpen1_el1 S3_0_C12_C12_7
 #define ich_hcr_el2     S3_4_C12_C11_0
+#define ich_vmcr_el2    S3_4_C12_C11_7
 #define icc_sgi1r_el1   S3_0_C12_C11_5
 #define ich_lr0_el2     S3_4_C12_C12_0
 #define ich_lr1_el2     S3_4_C12_C12_1
@@ -44,6 +45,28 @@
 #define ich_lr14_el2    S3_4_C12_C13_6
 #define ich_lr15_el2    S3_4_C12_C13_7
 
+/* DynamIQ Shared Unit */
+#define clusterthreadsid_el1 S3_0_C15_C4_0
+#define clusterpartcr_el1    S3_0_C15_C4_3
+
+/* Memory System Resource Partitioning and Monitoring */
+#define mpamidr_el1          S3_0_C10_C4_4
+#define mpam1_el1            S3_0_C10_C5_0
+#define mpam2_el2            S3_4_C10_C5_0
+#define mpamhcr_el2          S3_4_C10_C4_0
+#define mpamvpmv_el2         S3_4_C10_C4_1
+#define mpamvpm0_el2         S3_4_C10_C6_0
+#define mpamvpm1_el2         S3_4_C10_C6_1
+#define mpamvpm2_el2         S3_4_C10_C6_2
+#define mpamvpm3_el2         S3_4_C10_C6_3
+#define mpamvpm4_el2         S3_4_C10_C6_4
+#define mpamvpm5_el2         S3_4_C10_C6_5
+#define mpamvpm6_el2         S3_4_C10_C6_6
+#define mpamvpm7_el2         S3_4_C10_C6_7
+
+/* Enhanced Counter Virtualization */
+#define cntpoff_el2          S3_4_C14_C0_6
+
 #ifndef __ASSEMBLER__
 
 #define SYSREG_GEN_ACCESSORS_NAME(reg, name)                      \
@@ -72,10 +95,28 @@ SYSREG_GEN_ACCESSORS(ctr_el0);
 SYSREG_GEN_ACCESSORS(mpidr_el1);
 SYSREG_GEN_ACCESSORS(vmpidr_el2);
 SYSREG_GEN_ACCESSORS(cntvoff_el2);
+SYSREG_GEN_ACCESSORS(cntpoff_el2);
+SYSREG_GEN_ACCESSORS(cnthctl_el2);
 SYSREG_GEN_ACCESSORS(sctlr_el1);
 SYSREG_GEN_ACCESSORS(cntkctl_el1);
 SYSREG_GEN_ACCESSORS(cntfrq_el0);
+SYSREG_GEN_ACCESSORS(cntpct_el0);
+SYSREG_GEN_ACCESSORS(cnthp_ctl_el2);
+SYSREG_GEN_ACCESSORS(cnthp_cval_el2);
 SYSREG_GEN_ACCESSORS(pmcr_el0);
+SYSREG_GEN_ACCESSORS(pmselr_el0);
+SYSREG_GEN_ACCESSORS(pmxevtyper_el0);
+SYSREG_GEN_ACCESSORS(pmxevcntr_el0);
+SYSREG_GEN_ACCESSORS(pmcntenset_el0);
+SYSREG_GEN_ACCESSORS(pmcntenclr_el0);
+SYSREG_GEN_ACCESSORS(pmintenset_el1);
+SYSREG_GEN_ACCESSORS(pmintenclr_el1);
+SYSREG_GEN_ACCESSORS(pmovsclr_el0);
+SYSREG_GEN_ACCESSORS(pmccntr_el0);
+SYSREG_GEN_ACCESSORS(pmccfiltr_el0);
+SYSREG_GEN_ACCESSORS(pmuserenr_el0);
+SYSREG_GEN_ACCESSORS(id_aa64dfr0_el1);
+SYSREG_GEN_ACCESSORS(mdcr_el2);
 SYSREG_GEN_ACCESSORS(par_el1);
 SYSREG_GEN_ACCESSORS(tcr_el2);
 SYSREG_GEN_ACCESSORS(ttbr0_el2);
@@ -85,6 +126,9 @@ SYSREG_GEN_ACCESSORS(hcr_el2);
 SYSREG_GEN_ACCESSORS(vtcr_el2);
 SYSREG_GEN_ACCESSORS(vttbr_el2);
 SYSREG_GEN_ACCESSORS(id_aa64mmfr0_el1);
+SYSREG_GEN_ACCESSORS(id_aa64mmfr1_el1);
+SYSREG_GEN_ACCESSORS(id_aa64isar0_el1);
+SYSREG_GEN_ACCESSORS(dczid_el0);
 SYSREG_GEN_ACCESSORS(tpidr_el2);
 SYSREG_GEN_ACCESSORS(vsctlr_el2);
 SYSREG_GEN_ACCESSORS(mpuir_el2);
@@ -105,6 +149,7 @@ SYSREG_GEN_ACCESSORS(icc_bpr1_el1);
 SYSREG_GEN_ACCESSORS(icc_ctlr_el1);
 SYSREG_GEN_ACCESSORS(icc_igrpen1_el1);
 SYSREG_GEN_ACCESSORS(ich_hcr_el2);
+SYSREG_GEN_ACCESSORS(ich_vmcr_el2);
 SYSREG_GEN_ACCESSORS(icc_sgi1r_el1);
 SYSREG_GEN_ACCESSORS(ich_lr0_el2);
 SYSREG_GEN_ACCESSORS(ich_lr1_el2);
@@ -122,12 +167,72 @@ SYSREG_GEN_ACCESSORS(ich_lr12_el2);
 SYSREG_GEN_ACCESSORS(ich_lr13_el2);
 SYSREG_GEN_ACCESSORS(ich_lr14_el2);
 SYSREG_GEN_ACCESSORS(ich_lr15_el2);
+SYSREG_GEN_ACCESSORS(clusterthreadsid_el1);
+SYSREG_GEN_ACCESSORS(clusterpartcr_el1);
+SYSREG_GEN_ACCESSORS(id_aa64pfr0_el1);
+SYSREG_GEN_ACCESSORS(mpamidr_el1);
+SYSREG_GEN_ACCESSORS(mpam1_el1);
+SYSREG_GEN_ACCESSORS(mpam2_el2);
+SYSREG_GEN_ACCESSORS(mpamhcr_el2);
+SYSREG_GEN_ACCESSORS(mpamvpmv_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm0_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm1_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm2_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm3_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm4_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm5_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm6_el2);
+SYSREG_GEN_ACCESSORS(mpamvpm7_el2);
+SYSREG_GEN_ACCESSORS(ttbr0_el1);
+SYSREG_GEN_ACCESSORS(ttbr1_el1);
+SYSREG_GEN_ACCESSORS(tcr_el1);
+SYSREG_GEN_ACCESSORS(mair_el1);
+SYSREG_GEN_ACCESSORS(amair_el1);
+SYSREG_GEN_ACCESSORS(vbar_el1);
+SYSREG_GEN_ACCESSORS(contextidr_el1);
+SYSREG_GEN_ACCESSORS(tpidr_el0);
+SYSREG_GEN_ACCESSORS(tpidrro_el0);
+SYSREG_GEN_ACCESSORS(tpidr_el1);
+SYSREG_GEN_ACCESSORS(sp_el0);
+SYSREG_GEN_ACCESSORS(sp_el1);
+SYSREG_GEN_ACCESSORS(elr_el1);
+SYSREG_GEN_ACCESSORS(spsr_el1);
+SYSREG_GEN_ACCESSORS(esr_el1);
+SYSREG_GEN_ACCESSORS(far_el1);
+SYSREG_GEN_ACCESSORS(afsr0_el1);
+SYSREG_GEN_ACCESSORS(afsr1_el1);
+SYSREG_GEN_ACCESSORS(cpacr_el1);
+SYSREG_GEN_ACCESSORS(mdscr_el1);
+SYSREG_GEN_ACCESSORS(cntv_ctl_el0);
+SYSREG_GEN_ACCESSORS(cntv_cval_el0);
+SYSREG_GEN_ACCESSORS(cntp_ctl_el0);
+SYSREG_GEN_ACCESSORS(cntp_cval_el0);
 
 static inline void arm_dc_civac(vaddr_t cache_addr)
 {
     asm volatile("dc civac, %0\n\t" ::"r"(cache_addr));
 }
 
+static inline void arm_dc_cvac(vaddr_t cache_addr)
+{
+    asm volatile("dc cvac, %0\n\t" ::"r"(cache_addr));
+}
+
+static inline void arm_dc_ivac(vaddr_t cache_addr)
+{
+    asm volatile("dc ivac, %0\n\t" ::"r"(cache_addr));
+}
+
+static inline void arm_dc_zva(vaddr_t addr)
+{
+    asm volatile("dc zva, %0\n\t" ::"r"(addr) : "memory");
+}
+
+static inline void arm_ic_iallu(void)
+{
+    asm volatile("ic iallu\n\t" ::: "memory");
+}
+
 static inline void arm_at_s1e2w(vaddr_t vaddr)
 {
     asm volatile("at s1e2w, %0" ::"r"(vaddr));
@@ -138,6 +243,11 @@ static inline void arm_at_s12e1w(vaddr_t vaddr)
     asm volatile("at s12e1w, %0" ::"r"(vaddr));
 }
 
+static inline void arm_at_s12e1r(vaddr_t vaddr)
+{
+    asm volatile("at s12e1r, %0" ::"r"(vaddr));
+}
+
 static inline void arm_tlbi_alle2is()
 {
     asm volatile("tlbi alle2is");
@@ -158,6 +268,23 @@ static inline void arm_tlbi_ipas2e1is(vaddr_t vaddr)
     asm volatile("tlbi ipas2e1is, %0" ::"r"(vaddr >> 12));
 }
 
+static inline void arm_tlbi_vmalle1is()
+{
+    asm volatile("tlbi vmalle1is");
+}
+
+/* Range operations (FEAT_TLBIRANGE) are encoded explicitly to not depend on assembler support */
+
+static inline void arm_tlbi_rvae2is(uint64_t range)
+{
+    asm volatile("sys #4, c8, c2, #1, %0" ::"r"(range)); // tlbi rvae2is
+}
+
+static inline void arm_tlbi_ripas2e1is(uint64_t range)
+{
+    asm volatile("sys #4, c8, c0, #2, %0" ::"r"(range)); // tlbi ripas2e1is
+}
+
 #endif /* |__ASSEMBLER__ */
 
 #endif /* __ARCH_SYSREGS_H__ */
@@ -14,4 +14,42 @@ struct arch_regs {
     uint64_t spsr_el2;
 } __attribute__((aligned(16))); // makes size always aligned to 16 to respect stack alignment
 
-#endif                          /* VM_SUBARCH_H */
+/**
+ * The guest's EL1 and EL0 system registers, which the hypervisor otherwise leaves alone as each
+ * cpu only ever runs one vcpu. Only saved and restored by vm snapshots.
+ */
+struct vcpu_subarch_snapshot {
+    uint64_t sctlr_el1;
+    uint64_t ttbr0_el1;
+    uint64_t ttbr1_el1;
+    uint64_t tcr_el1;
+    uint64_t mair_el1;
+    uint64_t amair_el1;
+    uint64_t vbar_el1;
+    uint64_t contextidr_el1;
+    uint64_t tpidr_el0;
+    uint64_t tpidrro_el0;
+    uint64_t tpidr_el1;
+    uint64_t sp_el0;
+    uint64_t sp_el1;
+    uint64_t elr_el1;
+    uint64_t spsr_el1;
+    uint64_t esr_el1;
+    uint64_t far_el1;
+    uint64_t afsr0_el1;
+    uint64_t afsr1_el1;
+    uint64_t par_el1;
+    uint64_t cpacr_el1;
+    uint64_t csselr_el1;
+    uint64_t mdscr_el1;
+    uint64_t cntkctl_el1;
+    uint64_t cntv_ctl_el0;
+    uint64_t cntv_cval_el0;
+    uint64_t cntp_ctl_el0;
+    uint64_t cntp_cval_el0;
+};
+
+void vcpu_subarch_snapshot_save(struct vcpu_subarch_snapshot* snap);
+void vcpu_subarch_snapshot_restore(const struct vcpu_subarch_snapshot* snap);
+
+#endif /* VM_SUBARCH_H */
@@ -0,0 +1,162 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/mpam.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <mem.h>
+#include <platform.h>
+#include <spinlock.h>
+#include <bit.h>
+#include <vm_qos.h>
+
+static volatile struct mpam_msc_hw* mpam_msc[MPAM_MSC_MAX];
+
+/* The partition id selected in an msc must not change until its configuration is written. */
+static spinlock_t mpam_msc_lock = SPINLOCK_INITVAL;
+
+static void (*const mpam_vpm_write[MPAMVPM_NUM])(unsigned long) = {
+    sysreg_mpamvpm0_el2_write,
+    sysreg_mpamvpm1_el2_write,
+    sysreg_mpamvpm2_el2_write,
+    sysreg_mpamvpm3_el2_write,
+    sysreg_mpamvpm4_el2_write,
+    sysreg_mpamvpm5_el2_write,
+    sysreg_mpamvpm6_el2_write,
+    sysreg_mpamvpm7_el2_write,
+};
+
+static inline bool mpam_present(void)
+{
+    return bit64_extract(sysreg_id_aa64pfr0_el1_read(), ID_AA64PFR0_MPAM_OFF,
+               ID_AA64PFR0_MPAM_LEN) != 0;
+}
+
+/**
+ * The maximum bandwidth is a fixed point fraction of which the msc implements only the most
+ * significant bits.
+ */
+static inline uint32_t mpam_mbw_max(uint32_t percent)
+{
+    uint32_t max = BIT32_MASK(0, MPAMCFG_MBW_MAX_MAX_LEN);
+    return (percent >= 100) ? max : ((percent << MPAMCFG_MBW_MAX_MAX_LEN) / 100);
+}
+
+static void mpam_msc_config(size_t partid, uint64_t cache_portions, uint32_t mbw_max)
+{
+    spin_lock(&mpam_msc_lock);
+    for (size_t i = 0; i < platform.arch.mpam.msc_num; i++) {
+        volatile struct mpam_msc_hw* msc = mpam_msc[i];
+        uint64_t idr = msc->IDR;
+
+        if (partid > bit64_extract(idr, MPAMF_IDR_PARTID_MAX_OFF, MPAMF_IDR_PARTID_MAX_LEN)) {
+            WARNING("MPAM msc %d does not support partition id %d", i, partid);
+            continue;
+        }
+
+        msc->PART_SEL = (uint32_t)partid;
+
+        if ((cache_portions != 0) && ((idr & MPAMF_IDR_HAS_CPOR_PART_BIT) != 0)) {
+            size_t cpbm_wd = bit32_extract(msc->CPOR_IDR, MPAMF_CPOR_IDR_CPBM_WD_OFF,
+                MPAMF_CPOR_IDR_CPBM_WD_LEN);
+            size_t cpbm_num = min(ALIGN(cpbm_wd, 32) / 32, (size_t)MPAM_MSC_CPBM_MAX);
+            for (size_t j = 0; j < cpbm_num; j++) {
+                msc->CPBM[j] = (j < 2) ? (uint32_t)(cache_portions >> (j * 32)) : 0;
+            }
+        }
+
+        if ((mbw_max != 0) && ((idr & MPAMF_IDR_HAS_MBW_PART_BIT) != 0) &&
+            ((msc->MBW_IDR & MPAMF_MBW_IDR_HAS_MAX_BIT) != 0)) {
+            msc->MBW_MAX = mpam_mbw_max(mbw_max);
+        }
+    }
+    fence_sync_write();
+    spin_unlock(&mpam_msc_lock);
+}
+
+/**
+ * Whatever the firmware left in MPAM2_EL2, every cpu starts out in the default partition id and
+ * without trapping the guest's MPAM registers, as their accesses have no emulation.
+ */
+void mpam_init(void)
+{
+    if (!mpam_present()) {
+        return;
+    }
+
+    sysreg_mpam2_el2_write(MPAM2_PARTID(0));
+    ISB();
+
+    if (cpu_is_master()) {
+        if (platform.arch.mpam.msc_num > MPAM_MSC_MAX) {
+            ERROR("Platform defines more MPAM mscs than supported");
+        }
+
+        for (size_t i = 0; i < platform.arch.mpam.msc_num; i++) {
+            mpam_msc[i] = (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+                platform.arch.mpam.msc_addr[i], NUM_PAGES(sizeof(struct mpam_msc_hw)));
+        }
+    }
+}
+
+/**
+ * A partitioned vm's partition id is vm id + 1, the default partition id 0 being left to the
+ * hypervisor and the unpartitioned vms. Every virtual partition id the guest might select is
+ * mapped to it, so the guest can not leave its partition, and the hypervisor's own accesses on
+ * the vm's behalf are accounted to it as well. The vm's first vcpu configures the mscs.
+ */
+void mpam_vcpu_init(struct vcpu* vcpu, struct vm* vm)
+{
+    const struct vm_config* config = vm->config;
+    if ((config->qos.cache_portions == 0) && (config->qos.mbw_max == 0)) {
+        return;
+    }
+
+    size_t partid = vm->id + 1;
+    unsigned long idr = mpam_present() ? sysreg_mpamidr_el1_read() : 0;
+    if (((idr & MPAMIDR_HAS_HCR_BIT) == 0) ||
+        (partid > bit64_extract(idr, MPAMIDR_PARTID_MAX_OFF, MPAMIDR_PARTID_MAX_LEN))) {
+        WARNING("MPAM partitioning not supported for VM %d, ignored", vm->id);
+        return;
+    }
+
+    size_t vpm_num = bit64_extract(idr, MPAMIDR_VPMR_MAX_OFF, MPAMIDR_VPMR_MAX_LEN) + 1;
+    unsigned long vpm = 0;
+    for (size_t i = 0; i < MPAMVPM_PARTIDS; i++) {
+        vpm |= (unsigned long)partid << (i * MPAMVPM_PARTID_LEN);
+    }
+    for (size_t i = 0; i < vpm_num; i++) {
+        mpam_vpm_write[i](vpm);
+    }
+    sysreg_mpamvpmv_el2_write(BIT_MASK(0, vpm_num * MPAMVPM_PARTIDS));
+    sysreg_mpamhcr_el2_write(MPAMHCR_EL0_VPMEN_BIT | MPAMHCR_EL1_VPMEN_BIT);
+    sysreg_mpam1_el1_write(0);
+    sysreg_mpam2_el2_write(MPAM2_PARTID(partid));
+    ISB();
+
+    if (vcpu->id == 0) {
+        mpam_msc_config(partid, config->qos.cache_portions, config->qos.mbw_max);
+    }
+}
+
+/**
+ * Only a vm given a partition at boot can be repartitioned, as its cpus are only then set up to
+ * select its partition id. Unrestricted resources are given all portions or the whole bandwidth.
+ */
+bool vm_qos_arch_partition(vmid_t vm_id, uint64_t cache_portions, uint32_t mbw_max)
+{
+    const struct vm_config* vm_config = &config.vmlist[vm_id];
+    if (!mpam_present() ||
+        ((vm_config->qos.cache_portions == 0) && (vm_config->qos.mbw_max == 0))) {
+        return false;
+    }
+
+    mpam_msc_config(vm_id + 1, (cache_portions != 0) ? cache_portions : ~0ULL,
+        (mbw_max != 0) ? mbw_max : 100);
+    return true;
+}
@@ -5,3 +5,6 @@ cpu-objs-y+=$(ARCH_SUB)/boot.o
 cpu-objs-y+=$(ARCH_SUB)/exceptions.o
 cpu-objs-y+=$(ARCH_SUB)/vm.o
 cpu-objs-y+=$(ARCH_SUB)/aborts.o
+cpu-objs-y+=$(ARCH_SUB)/mpam.o
+cpu-objs-y+=$(ARCH_SUB)/fp.o
+cpu-objs-y+=$(ARCH_SUB)/fp_switch.o
@@ -5,6 +5,7 @@
 
 #include <vm.h>
 #include <arch/sysregs.h>
+#include <arch/fences.h>
 
 unsigned long vcpu_readreg(struct vcpu* vcpu, unsigned long reg)
 {
@@ -36,3 +37,72 @@ void vcpu_subarch_reset(struct vcpu* vcpu)
 {
     vcpu->regs.spsr_el2 = SPSR_EL1h | SPSR_F | SPSR_I | SPSR_A | SPSR_D;
 }
+
+void vcpu_subarch_snapshot_save(struct vcpu_subarch_snapshot* snap)
+{
+    snap->sctlr_el1 = sysreg_sctlr_el1_read();
+    snap->ttbr0_el1 = sysreg_ttbr0_el1_read();
+    snap->ttbr1_el1 = sysreg_ttbr1_el1_read();
+    snap->tcr_el1 = sysreg_tcr_el1_read();
+    snap->mair_el1 = sysreg_mair_el1_read();
+    snap->amair_el1 = sysreg_amair_el1_read();
+    snap->vbar_el1 = sysreg_vbar_el1_read();
+    snap->contextidr_el1 = sysreg_contextidr_el1_read();
+    snap->tpidr_el0 = sysreg_tpidr_el0_read();
+    snap->tpidrro_el0 = sysreg_tpidrro_el0_read();
+    snap->tpidr_el1 = sysreg_tpidr_el1_read();
+    snap->sp_el0 = sysreg_sp_el0_read();
+    snap->sp_el1 = sysreg_sp_el1_read();
+    snap->elr_el1 = sysreg_elr_el1_read();
+    snap->spsr_el1 = sysreg_spsr_el1_read();
+    snap->esr_el1 = sysreg_esr_el1_read();
+    snap->far_el1 = sysreg_far_el1_read();
+    snap->afsr0_el1 = sysreg_afsr0_el1_read();
+    snap->afsr1_el1 = sysreg_afsr1_el1_read();
+    snap->par_el1 = sysreg_par_el1_read();
+    snap->cpacr_el1 = sysreg_cpacr_el1_read();
+    snap->csselr_el1 = sysreg_csselr_el1_read();
+    snap->mdscr_el1 = sysreg_mdscr_el1_read();
+    snap->cntkctl_el1 = sysreg_cntkctl_el1_read();
+    snap->cntv_ctl_el0 = sysreg_cntv_ctl_el0_read();
+    snap->cntv_cval_el0 = sysreg_cntv_cval_el0_read();
+    snap->cntp_ctl_el0 = sysreg_cntp_ctl_el0_read();
+    snap->cntp_cval_el0 = sysreg_cntp_cval_el0_read();
+}
+
+/**
+ * The timers' compare values are restored before enabling them. As the counters are not rolled
+ * back, deadlines that passed since the snapshot expire right away.
+ */
+void vcpu_subarch_snapshot_restore(const struct vcpu_subarch_snapshot* snap)
+{
+    sysreg_sctlr_el1_write(snap->sctlr_el1);
+    sysreg_ttbr0_el1_write(snap->ttbr0_el1);
+    sysreg_ttbr1_el1_write(snap->ttbr1_el1);
+    sysreg_tcr_el1_write(snap->tcr_el1);
+    sysreg_mair_el1_write(snap->mair_el1);
+    sysreg_amair_el1_write(snap->amair_el1);
+    sysreg_vbar_el1_write(snap->vbar_el1);
+    sysreg_contextidr_el1_write(snap->contextidr_el1);
+    sysreg_tpidr_el0_write(snap->tpidr_el0);
+    sysreg_tpidrro_el0_write(snap->tpidrro_el0);
+    sysreg_tpidr_el1_write(snap->tpidr_el1);
+    sysreg_sp_el0_write(snap->sp_el0);
+    sysreg_sp_el1_write(snap->sp_el1);
+    sysreg_elr_el1_write(snap->elr_el1);
+    sysreg_spsr_el1_write(snap->spsr_el1);
+    sysreg_esr_el1_write(snap->esr_el1);
+    sysreg_far_el1_write(snap->far_el1);
+    sysreg_afsr0_el1_write(snap->afsr0_el1);
+    sysreg_afsr1_el1_write(snap->afsr1_el1);
+    sysreg_par_el1_write(snap->par_el1);
+    sysreg_cpacr_el1_write(snap->cpacr_el1);
+    sysreg_csselr_el1_write(snap->csselr_el1);
+    sysreg_mdscr_el1_write(snap->mdscr_el1);
+    sysreg_cntkctl_el1_write(snap->cntkctl_el1);
+    sysreg_cntv_cval_el0_write(snap->cntv_cval_el0);
+    sysreg_cntv_ctl_el0_write(snap->cntv_ctl_el0);
+    sysreg_cntp_cval_el0_write(snap->cntp_cval_el0);
+    sysreg_cntp_ctl_el0_write(snap->cntp_ctl_el0);
+    ISB();
+}
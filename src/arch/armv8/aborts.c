@@ -11,12 +11,57 @@
 #include <emul.h>
 #include <config.h>
 #include <hypercall.h>
+#include <trace.h>
 
 typedef void (*abort_handler_t)(unsigned long, unsigned long, unsigned long, unsigned long);
 
+static inline bool aborts_resolve_fault(unsigned long iss, unsigned long far)
+{
+    /* Instruction and data aborts share the layout of the fault status code */
+    unsigned long fsc = bit64_extract(iss, ESR_ISS_DA_DSFC_OFF, ESR_ISS_DA_DSFC_LEN) & (0xf << 2);
+
+    if (iss & ESR_ISS_DA_FnV_BIT) {
+        return false;
+    } else if (fsc != ESR_ISS_DA_DSFC_TRNSLT && fsc != ESR_ISS_DA_DSFC_PERMIS) {
+        return false;
+    }
+
+    /**
+     * On mpu-based platforms, the fault may be on a guest region evicted from the mpu. Otherwise,
+     * it may be on a lazily mapped region not yet populated, or a permission fault on a page write
+     * protected for dirty logging.
+     */
+    return mem_handle_fault(&cpu()->vcpu->vm->as, far) || vm_mem_populate(cpu()->vcpu->vm, far) ||
+        ((fsc == ESR_ISS_DA_DSFC_PERMIS) && vm_mem_dirty_fault(cpu()->vcpu->vm, far));
+}
+
+/**
+ * Aborts without a syndrome are emulated by decoding the faulting instruction, which is only
+ * supported for aarch64 guests on the mmu.
+ */
+static inline bool aborts_data_decode(unsigned long far, bool write)
+{
+#if defined(AARCH64) && defined(MEM_PROT_MMU)
+    return emul_decode_abort(cpu()->vcpu, far, write);
+#else
+    return false;
+#endif
+}
+
 void aborts_data_lower(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
 {
-    if (!(iss & ESR_ISS_DA_ISV_BIT) || (iss & ESR_ISS_DA_FnV_BIT)) {
+    /* Doorbell writes are done with as soon as they are recognized, whatever the written value */
+    if ((iss & ESR_ISS_DA_ISV_BIT) && (iss & ESR_ISS_DA_WnR_BIT) &&
+        ipc_doorbell_write(cpu()->vcpu, far)) {
+        vcpu_writepc(cpu()->vcpu, vcpu_readpc(cpu()->vcpu) + 2 + (2 * il));
+        return;
+    }
+
+    if (aborts_resolve_fault(iss, far)) {
+        return;
+    }
+
+    if (iss & ESR_ISS_DA_FnV_BIT) {
         ERROR("no information to handle data abort (0x%x)", far);
     }
 
@@ -26,6 +71,14 @@ void aborts_data_lower(unsigned long iss, unsigned long far, unsigned long il, u
         ERROR("data abort is not translation fault - cant deal with it");
     }
 
+    if (!(iss & ESR_ISS_DA_ISV_BIT)) {
+        if (!aborts_data_decode(far, (iss & ESR_ISS_DA_WnR_BIT) != 0)) {
+            ERROR("no information to handle data abort (0x%x at 0x%x)", far,
+                vcpu_readpc(cpu()->vcpu));
+        }
+        return;
+    }
+
     vaddr_t addr = far;
     emul_handler_t handler = vm_emul_get_mem(cpu()->vcpu->vm, addr);
     if (handler != NULL) {
@@ -50,6 +103,21 @@ void aborts_data_lower(unsigned long iss, unsigned long far, unsigned long il, u
     }
 }
 
+static void aborts_inst_lower(unsigned long iss, unsigned long far, unsigned long il,
+    unsigned long ec)
+{
+#ifdef AARCH32
+    /* Unlike far_el2, the aarch32 hdfar does not hold the address of instruction aborts */
+    if (!DEFINED(MEM_PROT_MMU) && !cpu()->vcpu->vm->config->platform.mmu) {
+        far = sysreg_hifar_el2_read();
+    }
+#endif
+
+    if (!aborts_resolve_fault(iss, far)) {
+        ERROR("unhandled instruction abort (0x%x at 0x%x)", far, vcpu_readpc(cpu()->vcpu));
+    }
+}
+
 long int standard_service_call(unsigned long _fn_num)
 {
     int64_t ret = -1;
@@ -68,6 +136,49 @@ long int standard_service_call(unsigned long _fn_num)
     return ret;
 }
 
+static long smcc_arch_call(unsigned long fid)
+{
+    long ret = SMCC_E_NOT_SUPPORTED;
+    unsigned long feature = vcpu_readreg(cpu()->vcpu, 1);
+
+    switch (fid) {
+        case SMCC_VERSION:
+            ret = SMCC_VERSION_1_1;
+            break;
+        case SMCC_ARCH_FEATURES:
+            if ((feature == SMCC_PV_TIME_FEATURES) && (cpu()->vcpu->vm->arch.pv_time != NULL)) {
+                ret = SMCC_SUCCESS;
+            }
+            break;
+    }
+
+    return ret;
+}
+
+static long pv_time_call(unsigned long fid)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    long ret = SMCC_E_NOT_SUPPORTED;
+
+    if (vcpu->vm->arch.pv_time == NULL) {
+        return ret;
+    }
+
+    switch (fid) {
+        case SMCC_PV_TIME_FEATURES:
+            if (vcpu_readreg(vcpu, 1) == SMCC_PV_TIME_ST) {
+                ret = SMCC_SUCCESS;
+            }
+            break;
+        case SMCC_PV_TIME_ST:
+            ret = (long)(vcpu->vm->config->platform.arch.pv_time_addr +
+                (vcpu->id * sizeof(struct pv_time_st)));
+            break;
+    }
+
+    return ret;
+}
+
 static inline void syscall_handler(unsigned long iss, unsigned long far, unsigned long il,
     unsigned long ec)
 {
@@ -75,10 +186,23 @@ static inline void syscall_handler(unsigned long iss, unsigned long far, unsigne
 
     long ret = SMCC_E_NOT_SUPPORTED;
     switch (fid & ~SMCC_FID_FN_NUM_MSK) {
+        case SMCC32_FID_ARCH:
+            ret = smcc_arch_call(fid);
+            break;
+        case SMCC32_FID_STD_HYP_SRVC:
+        case SMCC64_FID_STD_HYP_SRVC:
+            ret = pv_time_call(fid);
+            break;
         case SMCC32_FID_STD_SRVC:
         case SMCC64_FID_STD_SRVC:
             ret = standard_service_call(fid);
             break;
+#ifdef MEM_PROT_MMU
+        case SMCC32_FID_SIP_SRVC:
+        case SMCC64_FID_SIP_SRVC:
+            ret = scmi_smc_handler(fid);
+            break;
+#endif
         case SMCC32_FID_VND_HYP_SRVC:
         case SMCC64_FID_VND_HYP_SRVC:
             ret = hypercall(fid & SMCC_FID_FN_NUM_MSK);
@@ -95,6 +219,26 @@ void hvc_handler(unsigned long iss, unsigned long far, unsigned long il, unsigne
     syscall_handler(iss, far, il, ec);
 }
 
+/**
+ * Entered from the aarch64 hypercall fast path for the whitelisted hypercalls. Only the guest's
+ * caller-saved registers were saved, the remaining ones and the return state are left live in
+ * hardware. Handlers reached from here must therefore only access the argument and return
+ * registers and always return.
+ */
+__hot void hvc_fast_handler()
+{
+    uint64_t trace_start = trace_exit_begin();
+    struct vcpu_exit_stamp exit_stamp = vcpu_exit_begin();
+    unsigned long fid = vcpu_readreg(cpu()->vcpu, 0);
+
+    vgic_lr_cache_invalidate(cpu()->vcpu);
+    syscall_handler(0, 0, 0, ESR_EC_HVC64);
+
+    vcpu_exit_end(exit_stamp);
+    stats_exit_sync(ESR_EC_HVC64);
+    trace_exit_end(TRACE_EXIT_SYNC, ESR_EC_HVC64, fid, trace_start);
+}
+
 void smc_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
 {
     syscall_handler(iss, far, il, ec);
@@ -150,7 +294,20 @@ void sysreg_handler(unsigned long iss, unsigned long far, unsigned long il, unsi
     }
 }
 
+static void wfx_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
+{
+    /* Only wfi is trapped, but a trapped wfe would simply return to the guest. */
+    if (!(iss & ESR_ISS_WFX_TI_WFE)) {
+        cpu_standby();
+    }
+
+    unsigned long pc_step = 2 + (2 * il);
+    vcpu_writepc(cpu()->vcpu, vcpu_readpc(cpu()->vcpu) + pc_step);
+}
+
 abort_handler_t abort_handlers[64] = {
+    [ESR_EC_WFIE] = wfx_handler,
+    [ESR_EC_IALEL] = aborts_inst_lower,
     [ESR_EC_DALEL] = aborts_data_lower,
     [ESR_EC_SMC32] = smc_handler,
     [ESR_EC_SMC64] = smc_handler,
@@ -159,10 +316,33 @@ abort_handler_t abort_handlers[64] = {
     [ESR_EC_RG_64] = sysreg_handler,
     [ESR_EC_HVC32] = hvc_handler,
     [ESR_EC_HVC64] = hvc_handler,
+#ifdef AARCH64
+    [ESR_EC_FP] = fp_trap_handler,
+#endif
 };
 
-void aborts_sync_handler()
+static unsigned long aborts_trace_info(unsigned long ec, unsigned long iss, unsigned long far)
 {
+    switch (ec) {
+        case ESR_EC_DALEL:
+            return far;
+        case ESR_EC_HVC32:
+        case ESR_EC_HVC64:
+        case ESR_EC_SMC32:
+        case ESR_EC_SMC64:
+            return vcpu_readreg(cpu()->vcpu, 0);
+        default:
+            return iss;
+    }
+}
+
+__hot void aborts_sync_handler()
+{
+    uint64_t trace_start = trace_exit_begin();
+    struct vcpu_exit_stamp exit_stamp = vcpu_exit_begin();
+
+    vgic_lr_cache_invalidate(cpu()->vcpu);
+
     unsigned long esr = sysreg_esr_el2_read();
     unsigned long far = sysreg_far_el2_read();
     unsigned long hpfar = sysreg_hpfar_el2_read();
@@ -178,10 +358,21 @@ void aborts_sync_handler()
     unsigned long il = bit64_extract(esr, ESR_IL_OFF, ESR_IL_LEN);
     unsigned long iss = bit64_extract(esr, ESR_ISS_OFF, ESR_ISS_LEN);
 
+    unsigned long trace_info = 0;
+    if (DEFINED(TRACE)) {
+        trace_info = aborts_trace_info(ec, iss, ipa_fault_addr);
+    }
+
     abort_handler_t handler = abort_handlers[ec];
     if (handler) {
         handler(iss, ipa_fault_addr, il, ec);
     } else {
         ERROR("no handler for abort ec = 0x%x", ec); // unknown guest exception
     }
+
+    vcpu_exit_end(exit_stamp);
+    stats_exit_sync(ec);
+    trace_exit_end(TRACE_EXIT_SYNC, ec, trace_info, trace_start);
+
+    vcpu_check_restart();
 }
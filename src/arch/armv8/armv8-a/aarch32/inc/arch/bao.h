@@ -11,7 +11,9 @@
 #define BAO_VM_BASE  (0x60000000)
 #define BAO_VAS_TOP  (0x80000000)
 #define PAGE_SIZE    (0x1000)
+#ifndef STACK_SIZE
 #define STACK_SIZE   (PAGE_SIZE)
+#endif
 
 #define GPR(N)       "r" #N
 
@@ -7,6 +7,16 @@
 #include <arch/sysregs.h>
 #include <page_table.h>
 
+void vmm_arch_write_vtcr(size_t ipa_bits)
+{
+    (void)ipa_bits;
+
+    uint64_t vtcr = VTCR_RES1 | VTCR_ORGN0_WB_RA_WA | VTCR_IRGN0_WB_RA_WA | VTCR_T0SZ(0) |
+        VTCR_SH0_IS | VTCR_SL0_12;
+
+    sysreg_vtcr_el2_write(vtcr);
+}
+
 void vmm_arch_init_tcr()
 {
     if (cpu_is_master()) {
@@ -16,8 +26,5 @@ void vmm_arch_init_tcr()
 
     cpu_sync_barrier(&cpu_glb_sync);
 
-    uint64_t vtcr = VTCR_RES1 | VTCR_ORGN0_WB_RA_WA | VTCR_IRGN0_WB_RA_WA | VTCR_T0SZ(0) |
-        VTCR_SH0_IS | VTCR_SL0_12;
-
-    sysreg_vtcr_el2_write(vtcr);
+    vmm_arch_write_vtcr(parange_table[parange]);
 }
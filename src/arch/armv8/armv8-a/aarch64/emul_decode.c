@@ -0,0 +1,298 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/emul_decode.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+#include <cpu.h>
+#include <vm.h>
+#include <emul.h>
+#include <mem.h>
+#include <platform.h>
+#include <string.h>
+
+#define LDST_IMM_IDX_MSK   (0x3f200400U)
+#define LDST_IMM_IDX_VAL   (0x38000400U)
+#define LDST_PAIR_MSK      (0x3e000000U)
+#define LDST_PAIR_VAL      (0x28000000U)
+
+#define LDST_RT_OFF        (0)
+#define LDST_RN_OFF        (5)
+#define LDST_RT2_OFF       (10)
+#define LDST_REG_LEN       (5)
+#define LDST_IMM_PRE_BIT   (1U << 11)
+#define LDST_IMM9_OFF      (12)
+#define LDST_IMM9_LEN      (9)
+#define LDST_IMM_OPC_OFF   (22)
+#define LDST_IMM_SIZE_OFF  (30)
+#define LDST_PAIR_IMM7_OFF (15)
+#define LDST_PAIR_IMM7_LEN (7)
+#define LDST_PAIR_L_BIT    (1U << 22)
+#define LDST_PAIR_MODE_OFF (23)
+#define LDST_PAIR_OPC_OFF  (30)
+#define LDST_FIELD2_LEN    (2)
+
+#define LDST_PAIR_NO_ALLOC (0)
+#define LDST_PAIR_POST     (1)
+#define LDST_PAIR_OFFSET   (2)
+#define LDST_PAIR_PRE      (3)
+
+#define REG_SP             (31)
+
+struct emul_decode {
+    bool write;
+    bool sign_ext;
+    bool pair;
+    bool writeback;
+    size_t width;
+    size_t reg_width;
+    unsigned long rt;
+    unsigned long rt2;
+    unsigned long rn;
+    /* Added to the base register for the address of the access, and for its writeback */
+    long offset;
+    long wb_offset;
+};
+
+static inline unsigned long insn_field(uint32_t insn, size_t off, size_t len)
+{
+    return (insn >> off) & BIT32_MASK(0, len);
+}
+
+static inline long insn_sfield(uint32_t insn, size_t off, size_t len)
+{
+    unsigned long val = insn_field(insn, off, len);
+    return (long)(val ^ (1UL << (len - 1))) - (long)(1UL << (len - 1));
+}
+
+/* LDR/STR (immediate), pre and post-indexed, on general purpose registers */
+static bool emul_decode_ldst_imm_idx(uint32_t insn, struct emul_decode* dec)
+{
+    size_t size = insn_field(insn, LDST_IMM_SIZE_OFF, LDST_FIELD2_LEN);
+    unsigned long opc = insn_field(insn, LDST_IMM_OPC_OFF, LDST_FIELD2_LEN);
+    long imm = insn_sfield(insn, LDST_IMM9_OFF, LDST_IMM9_LEN);
+
+    /* opc 2 loads sign extended to 64 bits and 3 to 32 bits, neither exists for all sizes */
+    if (((opc == 2) && (size == 3)) || ((opc == 3) && (size >= 2))) {
+        return false;
+    }
+
+    dec->write = (opc == 0);
+    dec->sign_ext = (opc >= 2);
+    dec->pair = false;
+    dec->width = 1UL << size;
+    if (opc == 2) {
+        dec->reg_width = 8;
+    } else if (opc == 3) {
+        dec->reg_width = 4;
+    } else {
+        dec->reg_width = (size == 3) ? 8 : 4;
+    }
+    dec->writeback = true;
+    dec->offset = (insn & LDST_IMM_PRE_BIT) ? imm : 0;
+    dec->wb_offset = imm;
+
+    return true;
+}
+
+/* LDP/STP/LDPSW and LDNP/STNP on general purpose registers */
+static bool emul_decode_ldst_pair(uint32_t insn, struct emul_decode* dec)
+{
+    unsigned long opc = insn_field(insn, LDST_PAIR_OPC_OFF, LDST_FIELD2_LEN);
+    unsigned long mode = insn_field(insn, LDST_PAIR_MODE_OFF, LDST_FIELD2_LEN);
+    bool load = (insn & LDST_PAIR_L_BIT) != 0;
+
+    /* opc 1 is only LDPSW, without a non-temporal form, the rest being tag stores */
+    if ((opc == 3) || ((opc == 1) && (!load || (mode == LDST_PAIR_NO_ALLOC)))) {
+        return false;
+    }
+
+    dec->write = !load;
+    dec->sign_ext = (opc == 1);
+    dec->pair = true;
+    dec->width = (opc == 2) ? 8 : 4;
+    dec->reg_width = (opc == 0) ? 4 : 8;
+
+    long imm = insn_sfield(insn, LDST_PAIR_IMM7_OFF, LDST_PAIR_IMM7_LEN) * (long)dec->width;
+    dec->writeback = (mode == LDST_PAIR_POST) || (mode == LDST_PAIR_PRE);
+    dec->offset = (mode == LDST_PAIR_POST) ? 0 : imm;
+    dec->wb_offset = imm;
+
+    /* Loading both registers of the pair with the same register is unpredictable */
+    return !(load && (insn_field(insn, LDST_RT_OFF, LDST_REG_LEN) ==
+        insn_field(insn, LDST_RT2_OFF, LDST_REG_LEN)));
+}
+
+static bool emul_decode_insn(uint32_t insn, struct emul_decode* dec)
+{
+    bool decoded = false;
+
+    if ((insn & LDST_IMM_IDX_MSK) == LDST_IMM_IDX_VAL) {
+        decoded = emul_decode_ldst_imm_idx(insn, dec);
+    } else if ((insn & LDST_PAIR_MSK) == LDST_PAIR_VAL) {
+        decoded = emul_decode_ldst_pair(insn, dec);
+    }
+
+    if (!decoded) {
+        return false;
+    }
+
+    dec->rt = insn_field(insn, LDST_RT_OFF, LDST_REG_LEN);
+    dec->rt2 = insn_field(insn, LDST_RT2_OFF, LDST_REG_LEN);
+    dec->rn = insn_field(insn, LDST_RN_OFF, LDST_REG_LEN);
+
+    /**
+     * Accesses based on the stack pointer are not expected on emulated memory, and writing back to
+     * a register also loaded is unpredictable.
+     */
+    if (dec->rn == REG_SP) {
+        return false;
+    } else if (dec->writeback && !dec->write &&
+        ((dec->rn == dec->rt) || (dec->pair && (dec->rn == dec->rt2)))) {
+        return false;
+    }
+
+    return true;
+}
+
+static bool emul_decode_translate_pc(vaddr_t pc, paddr_t* pa)
+{
+    unsigned long par_saved = sysreg_par_el1_read();
+    arm_at_s12e1r(pc);
+    ISB();
+    unsigned long par = sysreg_par_el1_read();
+    sysreg_par_el1_write(par_saved);
+
+    if (par & PAR_F) {
+        return false;
+    }
+
+    *pa = (par & PAR_PA_MSK) | (pc & (PAGE_SIZE - 1));
+    return true;
+}
+
+static bool emul_decode_read_insn(paddr_t pa, uint32_t* insn)
+{
+    paddr_t page_pa = pa & ~((paddr_t)PAGE_SIZE - 1);
+
+    if (!platform_is_mem(page_pa)) {
+        return false;
+    }
+
+    struct ppages ppages = mem_ppages_get(page_pa, 1);
+    vaddr_t va = mem_alloc_map(&cpu()->as, SEC_HYP_PRIVATE, &ppages, INVALID_VA, 1, PTE_HYP_FLAGS);
+    if (va == INVALID_VA) {
+        return false;
+    }
+
+    *insn = *(volatile uint32_t*)(va + (pa - page_pa));
+    mem_unmap(&cpu()->as, va, 1, false);
+
+    return true;
+}
+
+/**
+ * Gets the instruction at the guest's pc, from the cache if it is there and still matches the
+ * access, i.e., it still is a store for a write abort or a load otherwise, or else from the guest's
+ * memory.
+ */
+static bool emul_decode_fetch(struct vcpu* vcpu, bool write, struct emul_decode* dec)
+{
+    vaddr_t pc = vcpu_readpc(vcpu);
+    paddr_t pa = 0;
+
+    if ((pc % sizeof(uint32_t)) != 0 || !emul_decode_translate_pc(pc, &pa)) {
+        return false;
+    }
+
+    struct emul_decode_cache* cache = &vcpu->arch.emul_decode;
+    size_t idx = (pc / sizeof(uint32_t)) % EMUL_DECODE_CACHE_SIZE;
+    if (cache->entries[idx].valid && (cache->entries[idx].pc == pc) &&
+        (cache->entries[idx].pa == pa) && emul_decode_insn(cache->entries[idx].insn, dec) &&
+        (dec->write == write)) {
+        return true;
+    }
+
+    uint32_t insn = 0;
+    if (!emul_decode_read_insn(pa, &insn) || !emul_decode_insn(insn, dec) ||
+        (dec->write != write)) {
+        cache->entries[idx].valid = false;
+        return false;
+    }
+
+    cache->entries[idx].valid = true;
+    cache->entries[idx].insn = insn;
+    cache->entries[idx].pc = pc;
+    cache->entries[idx].pa = pa;
+
+    return true;
+}
+
+static bool emul_decode_access(struct vcpu* vcpu, struct emul_decode* dec, vaddr_t addr,
+    unsigned long reg)
+{
+    emul_handler_t handler = vm_emul_get_mem(vcpu->vm, addr);
+    if (handler == NULL) {
+        return false;
+    }
+
+    struct emul_access emul = {
+        .addr = addr,
+        .write = dec->write,
+        .sign_ext = dec->sign_ext,
+        .width = dec->width,
+        .reg = reg,
+        .reg_high = 0,
+        .multi_reg = false,
+        .reg_width = dec->reg_width,
+    };
+
+    return handler(&emul);
+}
+
+void emul_decode_reset(struct vcpu* vcpu)
+{
+    memset(&vcpu->arch.emul_decode, 0, sizeof(vcpu->arch.emul_decode));
+}
+
+/**
+ * Emulates the data abort of the vcpu at the intermediate physical address addr, which reported no
+ * syndrome. The guest virtual address of the fault, in far_el2, locates the abort within the
+ * instruction's access. A pair is emulated as two accesses, the lower address first, and both
+ * must be within the faulting page. Returns false if the instruction is not supported.
+ */
+bool emul_decode_abort(struct vcpu* vcpu, vaddr_t addr, bool write)
+{
+    struct emul_decode dec;
+
+    if ((vcpu->regs.spsr_el2 & SPSR_M_AARCH32) || !emul_decode_fetch(vcpu, write, &dec)) {
+        return false;
+    }
+
+    vaddr_t base = vcpu_readreg(vcpu, dec.rn);
+    vaddr_t va = base + (vaddr_t)dec.offset;
+    vaddr_t fault_va = sysreg_far_el2_read();
+    size_t size = dec.pair ? (2 * dec.width) : dec.width;
+    vaddr_t page = fault_va & ~((vaddr_t)PAGE_SIZE - 1);
+
+    if ((va < page) || ((va + size) > (page + PAGE_SIZE))) {
+        return false;
+    }
+
+    vaddr_t ipa = addr - (fault_va - va);
+    if (!emul_decode_access(vcpu, &dec, ipa, dec.rt)) {
+        return false;
+    }
+    if (dec.pair && !emul_decode_access(vcpu, &dec, ipa + dec.width, dec.rt2)) {
+        return false;
+    }
+
+    if (dec.writeback) {
+        vcpu_writereg(vcpu, dec.rn, base + (vaddr_t)dec.wb_offset);
+    }
+    vcpu_writepc(vcpu, vcpu_readpc(vcpu) + sizeof(uint32_t));
+
+    return true;
+}
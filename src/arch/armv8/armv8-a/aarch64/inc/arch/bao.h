@@ -11,7 +11,9 @@
 #define BAO_VM_BASE  (0xfe8000000000)
 #define BAO_VAS_TOP  (0xff0000000000)
 #define PAGE_SIZE    (0x1000)
+#ifndef STACK_SIZE
 #define STACK_SIZE   (PAGE_SIZE)
+#endif
 
 #define GPR(N)       "x" #N
 
@@ -4,3 +4,5 @@
 cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/boot.o
 cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/relocate.o
 cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/vmm.o
+cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/string.o
+cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/emul_decode.o
@@ -7,6 +7,31 @@
 #include <arch/sysregs.h>
 #include <page_table.h>
 
+/**
+ * The walk starts at level 1 up to 43 bits of guest physical address space, matching the stage 2
+ * descriptor from pt_s2_dscr. Cpus managing the dirty state in hardware set the write permission
+ * of the entries dirty logging protects themselves, which only those entries are marked for, see
+ * pte_dirty_arm. Others take the fault, so clusters may differ. The access flag is managed in
+ * hardware wherever supported, for working set sampling, see mem_arch_hw_access.
+ */
+void vmm_arch_write_vtcr(size_t ipa_bits)
+{
+    uint64_t vtcr = VTCR_RES1 | ((parange << VTCR_PS_OFF) & VTCR_PS_MSK) | VTCR_TG0_4K |
+        VTCR_ORGN0_WB_RA_WA | VTCR_IRGN0_WB_RA_WA | VTCR_T0SZ(64 - ipa_bits) | VTCR_SH0_IS |
+        ((ipa_bits < 44) ? VTCR_SL0_12 : VTCR_SL0_01);
+
+    size_t hafdbs = bit64_extract(sysreg_id_aa64mmfr1_el1_read(), ID_AA64MMFR1_HAFDBS_OFF,
+        ID_AA64MMFR1_HAFDBS_LEN);
+    if (hafdbs >= ID_AA64MMFR1_HAFDBS_AF) {
+        vtcr |= VTCR_HA;
+    }
+    if (hafdbs >= ID_AA64MMFR1_HAFDBS_AF_DS) {
+        vtcr |= VTCR_HD;
+    }
+
+    sysreg_vtcr_el2_write(vtcr);
+}
+
 void vmm_arch_init_tcr()
 {
     /**
@@ -41,13 +66,10 @@ void vmm_arch_init_tcr()
             vm_pt_dscr->lvl_wdt[0] = parange_table[parange];
             vm_pt_dscr->lvls = vm_pt_dscr->lvls - 1;
         }
+        pt_s2_dscr_init();
     }
 
     cpu_sync_barrier(&cpu_glb_sync);
 
-    uint64_t vtcr = VTCR_RES1 | ((parange << VTCR_PS_OFF) & VTCR_PS_MSK) | VTCR_TG0_4K |
-        VTCR_ORGN0_WB_RA_WA | VTCR_IRGN0_WB_RA_WA | VTCR_T0SZ(64 - parange_table[parange]) |
-        VTCR_SH0_IS | ((parange_table[parange] < 44) ? VTCR_SL0_12 : VTCR_SL0_01);
-
-    sysreg_vtcr_el2_write(vtcr);
+    vmm_arch_write_vtcr(parange_table[parange]);
 }
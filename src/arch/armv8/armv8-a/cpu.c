@@ -4,6 +4,7 @@
  */
 
 #include <cpu.h>
+#include <vm.h>
 #include <platform.h>
 #include <arch/psci.h>
 #include <arch/sysregs.h>
@@ -29,6 +30,15 @@ void cpu_arch_profile_init(cpuid_t cpuid, paddr_t load_addr)
 
 void cpu_arch_profile_idle()
 {
+    /**
+     * A vcpu armed for a fast start must find its cpu's state as its reset left it, so its cpu
+     * only waits for the message starting it.
+     */
+    if ((cpu()->vcpu != NULL) && cpu()->vcpu->arch.psci_ctx.armed) {
+        asm volatile("wfi" ::: "memory");
+        return;
+    }
+
     int64_t err = psci_power_down(PSCI_WAKEUP_IDLE);
     if (err) {
         switch (err) {
@@ -0,0 +1,37 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_EMUL_DECODE_H__
+#define __ARCH_EMUL_DECODE_H__
+
+#include <bao.h>
+
+/**
+ * Data aborts of aarch64 guests on emulated memory do not report a syndrome (ISV is zero) for
+ * load/store pair instructions and for the pre and post-indexed forms of single register loads and
+ * stores. For those, the faulting instruction is fetched from the guest and decoded instead. As
+ * fetching it means translating the guest pc through both stages and mapping its page, the last
+ * instructions fetched are kept per vcpu, keyed on the guest pc and the physical address it
+ * translates to.
+ */
+#ifndef EMUL_DECODE_CACHE_SIZE
+#define EMUL_DECODE_CACHE_SIZE (8)
+#endif
+
+struct emul_decode_cache {
+    struct {
+        bool valid;
+        uint32_t insn;
+        vaddr_t pc;
+        paddr_t pa;
+    } entries[EMUL_DECODE_CACHE_SIZE];
+};
+
+struct vcpu;
+
+void emul_decode_reset(struct vcpu* vcpu);
+bool emul_decode_abort(struct vcpu* vcpu, vaddr_t addr, bool write);
+
+#endif /* __ARCH_EMUL_DECODE_H__ */
@@ -7,11 +7,13 @@
 #define __IOMMU_ARCH_H__
 
 #include <bao.h>
-#include <arch/smmuv2.h>
+#include <arch/smmu.h>
 
 struct iommu_vm_arch {
     streamid_t global_mask;
+#if (SMMU_VERSION != SMMUV3)
     size_t ctx_id;
+#endif
 };
 
 #endif
@@ -94,6 +94,7 @@
 #define PTE_MEMATTR_NRML_INC      ((0x01 << 0) << PTE_MEMATTR_OFF)
 #define PTE_MEMATTR_NRML_IWTC     ((0x02 << 0) << PTE_MEMATTR_OFF)
 #define PTE_MEMATTR_NRML_IWBC     ((0x03 << 0) << PTE_MEMATTR_OFF)
+#define PTE_MEMATTR_MSK           (0xfLL << PTE_MEMATTR_OFF)
 
 #define PTE_S2AP_RO               (0x1 << PTE_AP_OFF)
 #define PTE_S2AP_WO               (0x2 << PTE_AP_OFF)
@@ -107,7 +108,7 @@
 
 #define PTE_RSW_EMPT              (0x0LL << PTE_RSW_OFF)
 #define PTE_RSW_OPEN              (0x1LL << PTE_RSW_OFF)
-#define PTE_RSW_FULL              (0x2LL << PTE_RSW_OFF)
+#define PTE_RSW_STALE             (0x2LL << PTE_RSW_OFF)
 #define PTE_RSW_RSRV              (0x3LL << PTE_RSW_OFF)
 
 #define PT_ROOT_FLAGS_REC_IND_OFF (0)
@@ -117,6 +118,22 @@
 #define PT_CPU_REC_IND            (pt_nentries(&cpu()->as.pt, 0) - 1)
 #define PT_VM_REC_IND             (pt_nentries(&cpu()->as.pt, 0) - 2)
 
+#if defined(PT_LINEAR) && !defined(AARCH32)
+/**
+ * With PT_LINEAR, the hypervisor walks the page tables through a window where all of the
+ * platform's memory is mapped at BAO_VAS_TOP plus its physical address, instead of through the
+ * recursive entries. The window takes the root slot otherwise used for PT_VM_REC_IND.
+ */
+#define PT_LINEAR_BASE            (BAO_VAS_TOP)
+#define PT_LINEAR_SIZE            (1ULL << 39)
+#ifndef PT_LINEAR_L2_NUM
+#define PT_LINEAR_L2_NUM          (8)
+#endif
+#endif
+
+/* Number of adjacent entries covered by the contiguous hint with a 4K granule */
+#define PT_CONTIG_NUM             (16)
+
 #define PTE_INVALID               (0)
 #define PTE_HYP_FLAGS             (PTE_ATTR(1) | PTE_AP_RW | PTE_SH_IS | PTE_AF)
 #define PTE_HYP_DEV_FLAGS         (PTE_ATTR(2) | PTE_AP_RW | PTE_SH_IS | PTE_AF | PTE_XN)
@@ -125,6 +142,18 @@
     (PTE_MEMATTR_NRML_OWBC | PTE_MEMATTR_NRML_IWBC | PTE_SH_NS | PTE_S2AP_RW | PTE_AF)
 
 #define PTE_VM_DEV_FLAGS (PTE_MEMATTR_DEV_GRE | PTE_SH_NS | PTE_S2AP_RW | PTE_AF)
+#define PTE_VM_RO_FLAGS  ((PTE_VM_FLAGS & ~PTE_AP_MSK) | PTE_S2AP_RO)
+
+/**
+ * Stage 2 attributes only restrict the guest's own, so these make the vm's accesses non cacheable,
+ * i.e., normal non-cacheable memory which still allows write gathering, or cached in the inner
+ * cache levels only, whatever the guest maps the memory as.
+ */
+#define PTE_VM_ATTR_MSK  PTE_MEMATTR_MSK
+#define PTE_VM_NC_FLAGS \
+    ((PTE_VM_FLAGS & ~PTE_MEMATTR_MSK) | PTE_MEMATTR_NRML_ONC | PTE_MEMATTR_NRML_INC)
+#define PTE_VM_INNER_FLAGS \
+    ((PTE_VM_FLAGS & ~PTE_MEMATTR_MSK) | PTE_MEMATTR_NRML_ONC | PTE_MEMATTR_NRML_IWBC)
 
 #ifndef __ASSEMBLER__
 
@@ -136,6 +165,7 @@ extern size_t parange;
 extern size_t parange_table[];
 
 struct page_table;
+struct page_table_dscr;
 
 struct page_table_arch {
     pte_t rec_mask;
@@ -143,6 +173,13 @@ struct page_table_arch {
 };
 
 void pt_set_recursive(struct page_table* pt, size_t index);
+void pt_s2_dscr_init(void);
+struct page_table_dscr* pt_s2_dscr(size_t ipa_bits);
+size_t pt_s2_ipa_bits(struct page_table* pt);
+#if defined(PT_LINEAR) && !defined(AARCH32)
+bool pt_linear_init(void);
+void pt_set_linear(struct page_table* pt);
+#endif
 
 static inline void pte_set(pte_t* pte, paddr_t addr, pte_type_t type, pte_flags_t flags)
 {
@@ -169,6 +206,55 @@ static inline paddr_t pte_addr(pte_t* pte)
     return (paddr_t)(*pte & PTE_ADDR_MSK);
 }
 
+static inline bool pte_contig(pte_t* pte)
+{
+    return (*pte & PTE_Con) != 0;
+}
+
+static inline void pte_set_contig(pte_t* pte)
+{
+    *pte |= PTE_Con;
+}
+
+static inline void pte_clear_contig(pte_t* pte, paddr_t addr)
+{
+    *pte = (*pte & ~(PTE_Con | PTE_ADDR_MSK)) | (addr & PTE_ADDR_MSK);
+}
+
+/* Set on the first access through an entry by cpus managing the access flag (VTCR_EL2.HA) */
+#define PTE_ACCESSED_BIT PTE_AF
+
+/**
+ * Dirty logging write protects a stage 2 entry and marks it with DBM, which the hardware takes as
+ * writable-clean if it manages the dirty state itself (VTCR_EL2.HD), giving the entry back its
+ * write permission on the first write. Otherwise, the write faults and the hypervisor does so.
+ */
+#define PTE_DIRTY_LOG_BIT PTE_S2AP_WO
+
+static inline bool pte_dirty_armed(pte_t* pte)
+{
+    return (*pte & PTE_DBM) != 0;
+}
+
+static inline bool pte_dirty_writable(pte_t* pte)
+{
+    return (*pte & PTE_DIRTY_LOG_BIT) != 0;
+}
+
+static inline void pte_dirty_arm(pte_t* pte)
+{
+    if (pte_dirty_writable(pte)) {
+        *pte = (*pte & ~PTE_DIRTY_LOG_BIT) | PTE_DBM;
+    }
+}
+
+static inline void pte_dirty_disarm(pte_t* pte)
+{
+    if (pte_dirty_armed(pte)) {
+        *pte = (*pte & ~PTE_DBM) | PTE_DIRTY_LOG_BIT;
+    }
+}
+
 #endif /* |__ASSEMBLER__ */
 
 #endif /* __ARCH_PAGE_TABLE_H__ */
@@ -0,0 +1,101 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_SCMI_H__
+#define __ARCH_SCMI_H__
+
+#include <bao.h>
+
+/**
+ * Each vm may be given an SCMI channel of its own, i.e., a shared memory page and the SiP function
+ * id of its doorbell smc, as described by the arm,scmi-smc device tree binding. The vm only sees
+ * the base and the performance protocols, the latter exposing the vm's performance domains, which
+ * the hypervisor maps to the platform's. Level requests for a platform domain are arbitrated
+ * among the vms sharing it, the highest wins, and forwarded to the firmware through the
+ * hypervisor's own channel.
+ */
+
+/* The largest message payload exchanged with the guests, as the firmware's channels commonly are */
+#ifndef SCMI_MSG_PAYLOAD_MAX
+#define SCMI_MSG_PAYLOAD_MAX (128)
+#endif
+
+#define SCMI_SHMEM_CHAN_FREE                (1UL << 0)
+#define SCMI_SHMEM_CHAN_ERROR               (1UL << 1)
+
+#define SCMI_MSG_ID_OFF                     (0)
+#define SCMI_MSG_ID_LEN                     (8)
+#define SCMI_MSG_TYPE_OFF                   (8)
+#define SCMI_MSG_TYPE_LEN                   (2)
+#define SCMI_MSG_PROTOCOL_OFF               (10)
+#define SCMI_MSG_PROTOCOL_LEN               (8)
+#define SCMI_MSG_TYPE_COMMAND               (0)
+
+#define SCMI_PROTOCOL_BASE                  (0x10)
+#define SCMI_PROTOCOL_PERF                  (0x13)
+
+#define SCMI_PROTOCOL_VERSION               (0x0)
+#define SCMI_PROTOCOL_ATTRIBUTES            (0x1)
+#define SCMI_PROTOCOL_MESSAGE_ATTRIBUTES    (0x2)
+
+#define SCMI_BASE_DISCOVER_VENDOR           (0x3)
+#define SCMI_BASE_DISCOVER_SUB_VENDOR       (0x4)
+#define SCMI_BASE_DISCOVER_IMPL_VERSION     (0x5)
+#define SCMI_BASE_DISCOVER_LIST_PROTOCOLS   (0x6)
+
+#define SCMI_PERF_DOMAIN_ATTRIBUTES         (0x3)
+#define SCMI_PERF_DESCRIBE_LEVELS           (0x4)
+#define SCMI_PERF_LIMITS_SET                (0x5)
+#define SCMI_PERF_LIMITS_GET                (0x6)
+#define SCMI_PERF_LEVEL_SET                 (0x7)
+#define SCMI_PERF_LEVEL_GET                 (0x8)
+
+#define SCMI_PERF_DOMAIN_SET_LEVEL_BIT      (1UL << 30)
+#define SCMI_PERF_LEVELS_NUM_OFF            (0)
+#define SCMI_PERF_LEVELS_NUM_LEN            (12)
+#define SCMI_PERF_LEVELS_REMAINING_OFF      (16)
+#define SCMI_PERF_LEVELS_REMAINING_LEN      (16)
+
+#define SCMI_SUCCESS                        (0)
+#define SCMI_NOT_SUPPORTED                  (-1)
+#define SCMI_INVALID_PARAMETERS             (-2)
+#define SCMI_NOT_FOUND                      (-4)
+#define SCMI_BUSY                           (-6)
+#define SCMI_COMMS_ERROR                    (-7)
+#define SCMI_PROTOCOL_ERROR                 (-10)
+
+struct scmi_shmem {
+    uint32_t reserved0;
+    volatile uint32_t channel_status;
+    uint32_t reserved1[2];
+    volatile uint32_t flags;
+    volatile uint32_t length;
+    volatile uint32_t msg_header;
+    volatile uint32_t msg_payload[];
+} __attribute__((packed, aligned(4)));
+
+struct scmi_vm_domain {
+    /* The platform's performance domain */
+    uint32_t domain;
+    /**
+     * The level kept for the domain while the vm runs, whatever it requests, and the highest level
+     * it may request, or zero for none.
+     */
+    uint32_t floor;
+    uint32_t ceiling;
+
+    /* The level last requested by the vm, or zero if it requested none */
+    uint32_t level;
+};
+
+struct vm;
+struct vm_config;
+
+void scmi_init(void);
+void scmi_vm_init(struct vm* vm, const struct vm_config* config);
+void scmi_vm_reset(struct vm* vm);
+long scmi_smc_handler(unsigned long fid);
+
+#endif /* __ARCH_SCMI_H__ */
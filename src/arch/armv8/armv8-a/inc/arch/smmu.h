@@ -0,0 +1,18 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_SMMU_H__
+#define __ARCH_SMMU_H__
+
+#define SMMUV2 (2)
+#define SMMUV3 (3)
+
+#if (SMMU_VERSION == SMMUV3)
+#include <arch/smmuv3.h>
+#else
+#include <arch/smmuv2.h>
+#endif
+
+#endif /* __ARCH_SMMU_H__ */
@@ -284,7 +284,15 @@ struct smmu_glbl_rs1_hw {
 
 #define SMMUV2_SCTLR_CLEAR(sctlr)  (sctlr & (0xF << 28 | 0x1 << 20 | 0xF << 9 | 0x1 << 11))
 
-#define SMMUV2_SCTLR_DEFAULT       (SMMUV2_SCTLR_CFCFG | SMMUV2_SCTLR_M)
+#define SMMUV2_SCTLR_DEFAULT       (SMMUV2_SCTLR_CFCFG | SMMUV2_SCTLR_CFIE | SMMUV2_SCTLR_M)
+
+#define SMMUV2_FSR_FAULT_MSK       (0xFF << 1)
+#define SMMUV2_FSR_SS              (0x1 << 30)
+#define SMMUV2_RESUME_TERMINATE    (0x1 << 0)
+
+#define SMMUV2_TLBSTATUS_SACTIVE   (0x1 << 0)
+#define SMMUV2_TLBGSTATUS_GSACTIVE (0x1 << 0)
+#define SMMUV2_TLBIIPAS2_ADDR(ipa) (((ipa) >> 12) & ((1ULL << 36) - 1))
 
 #define SMMUV2_TCR_T0SZ_MSK        (0x1F)
 #define SMMUV2_TCR_T0SZ(SZ)        ((SZ) & SMMUV2_TCR_T0SZ_MSK)
@@ -375,13 +383,19 @@ void smmu_init();
 
 ssize_t smmu_alloc_ctxbnk();
 ssize_t smmu_alloc_sme();
-void smmu_write_ctxbnk(size_t ctx_id, paddr_t root_pt, asid_t vm_id);
+void smmu_write_ctxbnk(size_t ctx_id, paddr_t root_pt, asid_t vm_id, size_t ipa_bits);
 void smmu_write_sme(size_t sme, streamid_t mask, streamid_t id, bool group);
 void smmu_write_s2c(size_t sme, size_t ctx_id);
+bool smmu_merge_sme(streamid_t mask, streamid_t id, size_t ctx);
 size_t smmu_sme_get_ctx(size_t sme);
 streamid_t smmu_sme_get_id(size_t sme);
 streamid_t smmu_sme_get_mask(size_t sme);
 bool smmu_sme_is_group(size_t sme);
 bool smmu_compatible_sme_exists(streamid_t mask, streamid_t id, size_t ctx, bool group);
+void smmu_commit(asid_t vm_id);
+size_t smmu_free_sme_num(void);
+size_t smmu_free_ctxbnk_num(void);
+void smmu_inv_vm_range(asid_t vm_id, vaddr_t ipa, size_t size);
+void smmu_inv_vm_all(asid_t vm_id);
 
 #endif
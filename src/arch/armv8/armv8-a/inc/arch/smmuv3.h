@@ -0,0 +1,175 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_SMMUV3_H__
+#define __ARCH_SMMUV3_H__
+
+#include <bao.h>
+#include <bit.h>
+
+#define SMMUV3_IDR0_S2P_BIT              (0x1 << 0)
+#define SMMUV3_IDR0_TTF_AARCH64_BIT      (0x1 << 3)
+#define SMMUV3_IDR0_COHACC_BIT           (0x1 << 4)
+#define SMMUV3_IDR0_BTM_BIT              (0x1 << 5)
+#define SMMUV3_IDR0_ST_LEVEL_OFF         (27)
+#define SMMUV3_IDR0_ST_LEVEL_LEN         (2)
+#define SMMUV3_IDR0_ST_LEVEL_LINEAR      (0)
+#define SMMUV3_IDR0_ST_LEVEL_2LVL        (1)
+
+#define SMMUV3_IDR1_SIDSIZE_OFF          (0)
+#define SMMUV3_IDR1_SIDSIZE_LEN          (6)
+#define SMMUV3_IDR1_EVENTQS_OFF          (16)
+#define SMMUV3_IDR1_EVENTQS_LEN          (5)
+#define SMMUV3_IDR1_CMDQS_OFF            (21)
+#define SMMUV3_IDR1_CMDQS_LEN            (5)
+#define SMMUV3_IDR1_QUEUES_PRESET_BIT    (0x1 << 29)
+#define SMMUV3_IDR1_TABLES_PRESET_BIT    (0x1 << 30)
+
+#define SMMUV3_IDR5_OAS_OFF              (0)
+#define SMMUV3_IDR5_OAS_LEN              (3)
+#define SMMUV3_IDR5_GRAN4K_BIT           (0x1 << 4)
+
+#define SMMUV3_CR0_SMMUEN                (0x1 << 0)
+#define SMMUV3_CR0_EVENTQEN              (0x1 << 2)
+#define SMMUV3_CR0_CMDQEN                (0x1 << 3)
+
+#define SMMUV3_CR1_QUEUE_IC_OFF          (0)
+#define SMMUV3_CR1_QUEUE_OC_OFF          (2)
+#define SMMUV3_CR1_QUEUE_SH_OFF          (4)
+#define SMMUV3_CR1_TABLE_IC_OFF          (6)
+#define SMMUV3_CR1_TABLE_OC_OFF          (8)
+#define SMMUV3_CR1_TABLE_SH_OFF          (10)
+#define SMMUV3_CR1_CACHE_NC              (0x0)
+#define SMMUV3_CR1_CACHE_WB              (0x1)
+#define SMMUV3_CR1_SH_NS                 (0x0)
+#define SMMUV3_CR1_SH_IS                 (0x3)
+
+#define SMMUV3_CR2_RECINVSID             (0x1 << 1)
+#define SMMUV3_CR2_PTM                   (0x1 << 2)
+
+#define SMMUV3_GERROR_CMDQ_ERR           (0x1 << 0)
+
+#define SMMUV3_Q_BASE_RWA                (0x1ULL << 62)
+#define SMMUV3_Q_BASE_ADDR_MSK           BIT64_MASK(5, 47)
+#define SMMUV3_Q_BASE_LOG2SIZE_MSK       BIT64_MASK(0, 5)
+
+#define SMMUV3_Q_IDX(q, val)             ((val) & BIT32_MASK(0, (q)->log2size))
+#define SMMUV3_Q_WRP(q, val)             ((val) & (0x1U << (q)->log2size))
+#define SMMUV3_Q_IDX_WRP(q, val)         ((val) & BIT32_MASK(0, (q)->log2size + 1))
+#define SMMUV3_CMDQ_CONS_ERR_OFF         (24)
+#define SMMUV3_CMDQ_CONS_ERR_LEN         (7)
+
+#define SMMUV3_STRTAB_BASE_RA            (0x1ULL << 62)
+#define SMMUV3_STRTAB_BASE_ADDR_MSK      BIT64_MASK(6, 46)
+
+#define SMMUV3_STRTAB_BASE_CFG_LOG2SIZE  (0)
+#define SMMUV3_STRTAB_BASE_CFG_SPLIT_OFF (6)
+#define SMMUV3_STRTAB_BASE_CFG_FMT_OFF   (16)
+#define SMMUV3_STRTAB_BASE_CFG_FMT_LIN   (0x0 << SMMUV3_STRTAB_BASE_CFG_FMT_OFF)
+#define SMMUV3_STRTAB_BASE_CFG_FMT_2LVL  (0x1 << SMMUV3_STRTAB_BASE_CFG_FMT_OFF)
+
+#define SMMUV3_STRTAB_L1_SPAN_MSK        BIT64_MASK(0, 5)
+#define SMMUV3_STRTAB_L1_L2PTR_MSK       BIT64_MASK(6, 46)
+
+#define SMMUV3_STE_DWORDS                (8)
+#define SMMUV3_STE_SIZE                  (SMMUV3_STE_DWORDS * sizeof(uint64_t))
+
+#define SMMUV3_STE_V                     (0x1ULL << 0)
+#define SMMUV3_STE_CONFIG_OFF            (1)
+#define SMMUV3_STE_CONFIG_MSK            (0x7ULL << SMMUV3_STE_CONFIG_OFF)
+#define SMMUV3_STE_CONFIG_ABORT          (0x0ULL << SMMUV3_STE_CONFIG_OFF)
+#define SMMUV3_STE_CONFIG_S2_TRANS       (0x6ULL << SMMUV3_STE_CONFIG_OFF)
+
+#define SMMUV3_STE_SHCFG_INCOMING        (0x1ULL << 44)
+
+#define SMMUV3_STE_S2VMID_MSK            BIT64_MASK(0, 16)
+#define SMMUV3_STE_S2T0SZ_OFF            (32)
+#define SMMUV3_STE_S2T0SZ_MSK            (0x3fULL << SMMUV3_STE_S2T0SZ_OFF)
+#define SMMUV3_STE_S2SL0_OFF             (38)
+#define SMMUV3_STE_S2SL0_0               (0x2ULL << SMMUV3_STE_S2SL0_OFF)
+#define SMMUV3_STE_S2SL0_1               (0x1ULL << SMMUV3_STE_S2SL0_OFF)
+#define SMMUV3_STE_S2IR0_WB_RA_WA        (0x1ULL << 40)
+#define SMMUV3_STE_S2OR0_WB_RA_WA        (0x1ULL << 42)
+#define SMMUV3_STE_S2SH0_IS              (0x3ULL << 44)
+#define SMMUV3_STE_S2TG_4K               (0x0ULL << 46)
+#define SMMUV3_STE_S2PS_OFF              (48)
+#define SMMUV3_STE_S2PS_MSK              (0x7ULL << SMMUV3_STE_S2PS_OFF)
+#define SMMUV3_STE_S2AA64                (0x1ULL << 51)
+#define SMMUV3_STE_S2R                   (0x1ULL << 58)
+
+#define SMMUV3_STE_S2TTB_MSK             BIT64_MASK(4, 48)
+
+#define SMMUV3_CMD_DWORDS                (2)
+#define SMMUV3_CMD_SIZE                  (SMMUV3_CMD_DWORDS * sizeof(uint64_t))
+#define SMMUV3_EVT_SIZE                  (32)
+
+#define SMMUV3_CMD_CFGI_STE              (0x03)
+#define SMMUV3_CMD_CFGI_ALL              (0x04)
+#define SMMUV3_CMD_TLBI_NSNH_ALL         (0x30)
+#define SMMUV3_CMD_SYNC                  (0x46)
+#define SMMUV3_CMD_SID_OFF               (32)
+#define SMMUV3_CMD_CFGI_LEAF             (0x1ULL << 0)
+#define SMMUV3_CMD_CFGI_ALL_RANGE        (31)
+
+struct smmuv3_regs_pg0_hw {
+    uint32_t IDR0;
+    uint32_t IDR1;
+    uint32_t IDR2;
+    uint32_t IDR3;
+    uint32_t IDR4;
+    uint32_t IDR5;
+    uint32_t IIDR;
+    uint32_t AIDR;
+    uint32_t CR0;
+    uint32_t CR0ACK;
+    uint32_t CR1;
+    uint32_t CR2;
+    uint8_t pad1[0x40 - 0x30];
+    uint32_t STATUSR;
+    uint32_t GBPA;
+    uint32_t AGBPA;
+    uint8_t pad2[0x50 - 0x4c];
+    uint32_t IRQ_CTRL;
+    uint32_t IRQ_CTRLACK;
+    uint8_t pad3[0x60 - 0x58];
+    uint32_t GERROR;
+    uint32_t GERRORN;
+    uint64_t GERROR_IRQ_CFG0;
+    uint32_t GERROR_IRQ_CFG1;
+    uint32_t GERROR_IRQ_CFG2;
+    uint8_t pad4[0x80 - 0x78];
+    uint64_t STRTAB_BASE;
+    uint32_t STRTAB_BASE_CFG;
+    uint8_t pad5[0x90 - 0x8c];
+    uint64_t CMDQ_BASE;
+    uint32_t CMDQ_PROD;
+    uint32_t CMDQ_CONS;
+    uint64_t EVENTQ_BASE;
+    uint8_t pad6[0xb0 - 0xa8];
+    uint64_t EVENTQ_IRQ_CFG0;
+    uint32_t EVENTQ_IRQ_CFG1;
+    uint32_t EVENTQ_IRQ_CFG2;
+    uint8_t pad7[0x1000 - 0xc0];
+} __attribute__((__packed__, __aligned__(PAGE_SIZE)));
+
+struct smmuv3_regs_pg1_hw {
+    uint8_t pad1[0xa8];
+    uint32_t EVENTQ_PROD;
+    uint32_t EVENTQ_CONS;
+    uint8_t pad2[0x1000 - 0xb0];
+} __attribute__((__packed__, __aligned__(PAGE_SIZE)));
+
+/* The event queue producer and consumer registers live in the second 64KiB page. */
+#define SMMUV3_PG1_OFF (0x10000)
+
+typedef deviceid_t streamid_t;
+
+#define SMMU_ID_MSK BIT32_MASK(0, 32)
+
+void smmu_init();
+
+bool smmu_write_ste(streamid_t sid, paddr_t root_pt, asid_t vm_id, size_t ipa_bits);
+
+#endif /* __ARCH_SMMUV3_H__ */
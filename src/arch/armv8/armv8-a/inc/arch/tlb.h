@@ -66,4 +66,106 @@ static inline void tlb_vm_inv_all(asid_t vmid)
     }
 }
 
+#ifndef TLB_INV_RANGE_MAX_OPS
+/* Above this number of per page invalidations the whole context is invalidated instead */
+#define TLB_INV_RANGE_MAX_OPS (512)
+#endif
+
+static inline bool tlb_range_ops_supported()
+{
+#ifdef AARCH64
+    return bit64_extract(sysreg_id_aa64isar0_el1_read(), ID_AA64ISAR0_TLB_OFF,
+               ID_AA64ISAR0_TLB_LEN) >= ID_AA64ISAR0_TLB_RANGE;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Invalidates pages starting at va, using range operations when available and falling back to
+ * per page operations otherwise. Returns false without issuing anything if the range is large
+ * enough that the caller should invalidate the whole context instead.
+ */
+static inline bool tlb_inv_range_ops(vaddr_t va, size_t pages, bool stage2)
+{
+    bool range = tlb_range_ops_supported();
+
+    if ((range && (pages >= TLBI_RANGE_MAX_PAGES)) ||
+        (!range && (pages > TLB_INV_RANGE_MAX_OPS))) {
+        return false;
+    }
+
+    size_t scale = 0;
+    while (pages > 0) {
+        if (!range || ((pages % 2) == 1)) {
+            if (stage2) {
+                arm_tlbi_ipas2e1is(va);
+            } else {
+                arm_tlbi_vae2is(va);
+            }
+            va += PAGE_SIZE;
+            pages--;
+            continue;
+        }
+#ifdef AARCH64
+        size_t num = bit64_extract(pages, (5 * scale) + 1, TLBI_RANGE_NUM_LEN);
+        if (num > 0) {
+            uint64_t op = TLBI_RANGE_TG_4K | ((uint64_t)scale << TLBI_RANGE_SCALE_OFF) |
+                ((uint64_t)(num - 1) << TLBI_RANGE_NUM_OFF) | ((va >> 12) & TLBI_RANGE_BADDR_MSK);
+            if (stage2) {
+                arm_tlbi_ripas2e1is(op);
+            } else {
+                arm_tlbi_rvae2is(op);
+            }
+            va += TLBI_RANGE_PAGES(num - 1, scale) * PAGE_SIZE;
+            pages -= TLBI_RANGE_PAGES(num - 1, scale);
+        }
+#endif
+        scale++;
+    }
+
+    return true;
+}
+
+static inline void tlb_hyp_inv_range(vaddr_t va, size_t size)
+{
+    vaddr_t base = va & ~(PAGE_SIZE - 1);
+
+    DSB(ish);
+    if (!tlb_inv_range_ops(base, NUM_PAGES((va - base) + size), false)) {
+        arm_tlbi_alle2is();
+    }
+    DSB(ish);
+    ISB();
+}
+
+static inline void tlb_vm_inv_range(asid_t vmid, vaddr_t va, size_t size)
+{
+    vaddr_t base = va & ~(PAGE_SIZE - 1);
+    uint64_t vttbr = 0;
+    vttbr = sysreg_vttbr_el2_read();
+    bool switch_vmid = bit64_extract(vttbr, VTTBR_VMID_OFF, VTTBR_VMID_LEN) != vmid;
+
+    if (switch_vmid) {
+        sysreg_vttbr_el2_write(((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK);
+        DSB(ish);
+        ISB();
+    }
+
+    DSB(ish);
+    if (tlb_inv_range_ops(base, NUM_PAGES((va - base) + size), true)) {
+        /* Combined stage 1 and 2 entries might still hold the old translations */
+        DSB(ish);
+        arm_tlbi_vmalle1is();
+    } else {
+        arm_tlbi_vmalls12e1is();
+    }
+    DSB(ish);
+
+    if (switch_vmid) {
+        sysreg_vttbr_el2_write(vttbr);
+    }
+    ISB();
+}
+
 #endif /* __ARCH_TLB_H__ */
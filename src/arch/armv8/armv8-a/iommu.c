@@ -19,6 +19,33 @@ bool iommu_arch_init()
     return false;
 }
 
+#if (SMMU_VERSION == SMMUV3)
+
+static bool iommu_vm_arch_add(struct vm* vm, streamid_t mask, streamid_t id)
+{
+    streamid_t prep_mask = (mask & SMMU_ID_MSK) | vm->io.prot.mmu.global_mask;
+    streamid_t prep_id = (id & SMMU_ID_MSK) & ~prep_mask;
+    streamid_t sid_off = 0;
+    paddr_t rootpt;
+
+    mem_translate(&cpu()->as, (vaddr_t)vm->as.pt.root, &rootpt);
+
+    /**
+     * There is no stream matching in the smmuv3, so every stream id covered by the mask gets its
+     * own ste. This walks all subsets of the mask bits.
+     */
+    do {
+        if (!smmu_write_ste(prep_id | sid_off, rootpt, vm->id, pt_s2_ipa_bits(&vm->as.pt))) {
+            return false;
+        }
+        sid_off = (sid_off - prep_mask) & prep_mask;
+    } while (sid_off != 0);
+
+    return true;
+}
+
+#else
+
 static ssize_t iommu_vm_arch_init_ctx(struct vm* vm)
 {
     ssize_t ctx_id = vm->io.prot.mmu.ctx_id;
@@ -28,7 +55,7 @@ static ssize_t iommu_vm_arch_init_ctx(struct vm* vm)
         if (ctx_id >= 0) {
             paddr_t rootpt;
             mem_translate(&cpu()->as, (vaddr_t)vm->as.pt.root, &rootpt);
-            smmu_write_ctxbnk(ctx_id, rootpt, vm->id);
+            smmu_write_ctxbnk(ctx_id, rootpt, vm->id, pt_s2_ipa_bits(&vm->as.pt));
             vm->io.prot.mmu.ctx_id = ctx_id;
         } else {
             INFO("iommu: smmuv2 could not allocate ctx for vm: %d", vm->id);
@@ -51,7 +78,8 @@ static bool iommu_vm_arch_add(struct vm* vm, streamid_t mask, streamid_t id)
         return false;
     }
 
-    if (!smmu_compatible_sme_exists(prep_mask, prep_id, vm_ctx, group)) {
+    if (!smmu_compatible_sme_exists(prep_mask, prep_id, vm_ctx, group) &&
+        !smmu_merge_sme(prep_mask, prep_id, vm_ctx)) {
         ssize_t sme = smmu_alloc_sme();
         if (sme < 0) {
             INFO("iommu: smmuv2 no more free sme available.");
@@ -64,6 +92,56 @@ static bool iommu_vm_arch_add(struct vm* vm, streamid_t mask, streamid_t id)
     return true;
 }
 
+/**
+ * Checks the smmu can take the vm's stream ids before any is added, i.e., that the vm gets the
+ * single context bank all its entries share, and warns if there are not enough entries left for
+ * its groups and devices, which still fit if enough of them are merged.
+ */
+static void iommu_vm_arch_check_capacity(struct vm* vm, const struct vm_config* config)
+{
+    size_t sme_num = config->platform.arch.smmu.group_num;
+    for (size_t i = 0; i < config->platform.dev_num; i++) {
+        if (config->platform.devs[i].id != 0) {
+            sme_num++;
+        }
+    }
+
+    if (sme_num == 0) {
+        return;
+    }
+
+    size_t free_smes = smmu_free_sme_num();
+    if (smmu_free_ctxbnk_num() == 0) {
+        ERROR("iommu: smmuv2 has no free context bank for vm %d", vm->id);
+    } else if (sme_num > free_smes) {
+        WARNING("iommu: vm %d needs up to %d smmuv2 stream match entries, %d are free", vm->id,
+            sme_num, free_smes);
+    }
+}
+
+void iommu_arch_vm_commit(struct vm* vm)
+{
+    if (vm->io.prot.mmu.ctx_id != (size_t)-1) {
+        smmu_commit(vm->id);
+    }
+}
+
+void iommu_arch_vm_inv_range(asid_t vmid, vaddr_t va, size_t size)
+{
+    if (platform.arch.smmu.base) {
+        smmu_inv_vm_range(vmid, va, size);
+    }
+}
+
+void iommu_arch_vm_inv_all(asid_t vmid)
+{
+    if (platform.arch.smmu.base) {
+        smmu_inv_vm_all(vmid);
+    }
+}
+
+#endif
+
 inline bool iommu_arch_vm_add_device(struct vm* vm, streamid_t id)
 {
     return iommu_vm_arch_add(vm, 0, id);
@@ -73,7 +151,10 @@ bool iommu_arch_vm_init(struct vm* vm, const struct vm_config* config)
 {
     vm->io.prot.mmu.global_mask =
         config->platform.arch.smmu.global_mask | platform.arch.smmu.global_mask;
+#if (SMMU_VERSION != SMMUV3)
     vm->io.prot.mmu.ctx_id = -1;
+    iommu_vm_arch_check_capacity(vm, config);
+#endif
 
     /* This section relates only to arm's iommu so we parse it here. */
     for (size_t i = 0; i < config->platform.arch.smmu.group_num; i++) {
@@ -7,11 +7,22 @@
 #include <cpu.h>
 #include <arch/sysregs.h>
 #include <arch/fences.h>
+#include <string.h>
 
 void as_arch_init(struct addr_space* as)
 {
     size_t index;
 
+#if defined(PT_LINEAR) && !defined(AARCH32)
+    /* Vm tables are walked through the window as well, so they need nothing of their own */
+    if (pt_linear_init()) {
+        if (as->type != AS_VM) {
+            pt_set_linear(&as->pt);
+        }
+        return;
+    }
+#endif
+
     /*
      * If the address space is a copy of an existing hypervisor space it's not possible to use the
      * PT_CPU_REC index to navigate it, so we have to use the PT_VM_REC_IND.
@@ -24,7 +35,7 @@ void as_arch_init(struct addr_space* as)
     pt_set_recursive(&as->pt, index);
 }
 
-bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
+bool mem_arch_translate(struct addr_space* as, vaddr_t va, paddr_t* pa, size_t* block_size)
 {
     uint64_t par = 0, par_saved = 0;
 
@@ -32,6 +43,27 @@ bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
      * TODO: are barriers needed in this operation?
      */
 
+    if (as->type == AS_VM) {
+        /**
+         * Stage 2 tables are walked in software as the address translation instructions would
+         * also go through the guest's stage 1.
+         */
+        size_t lvl = 0;
+        pte_t* pte = NULL;
+        for (lvl = 0; lvl < as->pt.dscr->lvls; lvl++) {
+            pte = pt_get_pte(&as->pt, lvl, va);
+            if (!pte_valid(pte) || !pte_table(&as->pt, pte, lvl)) {
+                break;
+            }
+        }
+        if (pte == NULL || !pte_valid(pte)) {
+            return false;
+        }
+        *pa = pte_addr(pte) | (va & (pt_lvlsize(&as->pt, lvl) - 1));
+        *block_size = pt_lvlsize(&as->pt, lvl);
+        return true;
+    }
+
     par_saved = sysreg_par_el1_read();
 
     if (as->type == AS_HYP || as->type == AS_HYP_CPY) {
@@ -46,9 +78,40 @@ bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
     if (par & PAR_F) {
         return false;
     } else {
-        if (pa != NULL) {
-            *pa = (par & PAR_PA_MSK) | (va & (PAGE_SIZE - 1));
-        }
+        /* The translation instructions do not tell the size of the block the page is part of */
+        *pa = (par & PAR_PA_MSK) | (va & (PAGE_SIZE - 1));
+        *block_size = PAGE_SIZE;
         return true;
     }
 }
+
+#ifdef AARCH64
+void mem_zero_pages(void* base, size_t num_pages)
+{
+    unsigned long dczid = sysreg_dczid_el0_read();
+    size_t size = num_pages * PAGE_SIZE;
+
+    if (dczid & DCZID_DZP_BIT) {
+        memset(base, 0, size);
+        return;
+    }
+
+    /**
+     * The block size is 4 << DCZID_EL0.BS bytes, at most 2KiB, so it always evenly divides a page.
+     */
+    size_t block_size = 4UL << bit64_extract(dczid, DCZID_BS_OFF, DCZID_BS_LEN);
+    for (vaddr_t addr = (vaddr_t)base; addr < (vaddr_t)base + size; addr += block_size) {
+        arm_dc_zva(addr);
+    }
+}
+#endif
+
+bool mem_arch_hw_access(void)
+{
+#ifdef AARCH64
+    return bit64_extract(sysreg_id_aa64mmfr1_el1_read(), ID_AA64MMFR1_HAFDBS_OFF,
+               ID_AA64MMFR1_HAFDBS_LEN) >= ID_AA64MMFR1_HAFDBS_AF;
+#else
+    return false;
+#endif
+}
@@ -7,6 +7,11 @@
 #include <page_table.h>
 #include <arch/sysregs.h>
 #include <cpu.h>
+#include <mem.h>
+#include <platform.h>
+#include <config.h>
+#include <spinlock.h>
+#include <fences.h>
 
 #ifdef AARCH32
 
@@ -53,6 +58,75 @@ struct page_table_dscr* vm_pt_dscr = &armv8_pt_s2_dscr;
 
 size_t parange __attribute__((section(".data")));
 
+#ifndef AARCH32
+
+/**
+ * Each vm's stage 2 translates only as many guest physical address bits as its regions span, but
+ * at least PT_S2_IPA_BITS_MIN. Up to 43 bits, the walk starts at level 1 from as many as 16
+ * concatenated tables, so that it takes one level less. The descriptors differ only in the width
+ * of their root level.
+ */
+#define PT_S2_IPA_BITS_MIN (32)
+#define PT_S2_IPA_BITS_MAX (48)
+#define PT_S2_IPA_BITS_L1  (43)
+#define PT_S2_DSCR_NUM     (PT_S2_IPA_BITS_MAX - PT_S2_IPA_BITS_MIN + 1)
+
+static size_t pt_s2_lvl_off[] = { 39, 30, 21, 12 };
+static bool pt_s2_lvl_term[] = { false, true, true, true };
+static size_t pt_s2_lvl_wdt[PT_S2_DSCR_NUM][PT_LVLS_MAX];
+static struct page_table_dscr pt_s2_dscrs[PT_S2_DSCR_NUM];
+
+void pt_s2_dscr_init(void)
+{
+    for (size_t i = 0; i < PT_S2_DSCR_NUM; i++) {
+        size_t ipa_bits = PT_S2_IPA_BITS_MIN + i;
+        size_t lvl = (ipa_bits <= PT_S2_IPA_BITS_L1) ? 1 : 0;
+        size_t* wdt = pt_s2_lvl_wdt[i];
+
+        wdt[0] = ipa_bits;
+        for (size_t j = 1; j < PT_LVLS_MAX - lvl; j++) {
+            wdt[j] = pt_s2_lvl_off[lvl + j - 1];
+        }
+        pt_s2_dscrs[i] = (struct page_table_dscr){
+            .lvls = PT_LVLS_MAX - lvl,
+            .lvl_off = &pt_s2_lvl_off[lvl],
+            .lvl_wdt = wdt,
+            .lvl_term = &pt_s2_lvl_term[lvl],
+        };
+    }
+}
+
+/**
+ * Returns the descriptor translating at least ipa_bits, which must be called after the parange is
+ * known, as the descriptors never go beyond it.
+ */
+struct page_table_dscr* pt_s2_dscr(size_t ipa_bits)
+{
+    ipa_bits = min(max(ipa_bits, (size_t)PT_S2_IPA_BITS_MIN), parange_table[parange]);
+    return &pt_s2_dscrs[ipa_bits - PT_S2_IPA_BITS_MIN];
+}
+
+size_t pt_s2_ipa_bits(struct page_table* pt)
+{
+    return pt->dscr->lvl_wdt[0];
+}
+
+#else
+
+struct page_table_dscr* pt_s2_dscr(size_t ipa_bits)
+{
+    (void)ipa_bits;
+    return vm_pt_dscr;
+}
+
+size_t pt_s2_ipa_bits(struct page_table* pt)
+{
+    (void)pt;
+    return parange_table[parange];
+}
+
+#endif
+
 void pt_set_recursive(struct page_table* pt, size_t index)
 {
     paddr_t pa;
@@ -68,8 +142,122 @@ void pt_set_recursive(struct page_table* pt, size_t index)
     }
 }
 
+#if defined(PT_LINEAR) && !defined(AARCH32)
+
+#define PT_LINEAR_L1_SIZE (1ULL << 30)
+#define PT_LINEAR_L2_SIZE (1ULL << 21)
+#define PT_LINEAR_NENTRIES (PAGE_SIZE / sizeof(pte_t))
+
+enum { PT_LINEAR_PENDING, PT_LINEAR_ON, PT_LINEAR_OFF };
+
+static volatile size_t pt_linear_state = PT_LINEAR_PENDING;
+static pte_t pt_linear_l1[PT_LINEAR_NENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static pte_t pt_linear_l2[PT_LINEAR_L2_NUM][PT_LINEAR_NENTRIES]
+    __attribute__((aligned(PAGE_SIZE)));
+/* The L2 table, plus one, backing each L1 entry of the window not mapped as a block */
+static uint8_t pt_linear_l2_ind[PT_LINEAR_NENTRIES];
+
+static void pt_linear_set(pte_t* pte, vaddr_t va, pte_type_t type)
+{
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, va, &pa);
+    pte_set(pte, pa, type, PTE_HYP_FLAGS | PTE_XN);
+}
+
+/**
+ * Maps every memory region of the platform in the window, in 1GiB blocks where the region covers
+ * them and 2MiB blocks elsewhere. It bails out, so that the recursive entries are used instead, if
+ * the regions are not 2MiB aligned, lie above the window's 512GiB, or need more L2 tables than
+ * there are. It also does if the hypervisor is colored, as its image, and with it these tables, is
+ * moved after its address space is set up.
+ */
+static bool pt_linear_build(void)
+{
+    size_t l2_num = 0;
+
+    if (!all_clrs(config.hyp.colors)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < platform.region_num; i++) {
+        paddr_t pa = platform.regions[i].base;
+        paddr_t top = pa + platform.regions[i].size;
+
+        if (((pa | top) % PT_LINEAR_L2_SIZE) != 0 || top > PT_LINEAR_SIZE) {
+            return false;
+        }
+
+        while (pa < top) {
+            size_t l1_ind = pa / PT_LINEAR_L1_SIZE;
+            if ((pa % PT_LINEAR_L1_SIZE) == 0 && (top - pa) >= PT_LINEAR_L1_SIZE) {
+                pte_set(&pt_linear_l1[l1_ind], pa, PTE_SUPERPAGE, PTE_HYP_FLAGS | PTE_XN);
+                pa += PT_LINEAR_L1_SIZE;
+                continue;
+            }
+
+            if (pt_linear_l2_ind[l1_ind] == 0) {
+                if (l2_num >= PT_LINEAR_L2_NUM) {
+                    return false;
+                }
+                pt_linear_l2_ind[l1_ind] = (uint8_t)++l2_num;
+                pt_linear_set(&pt_linear_l1[l1_ind], (vaddr_t)pt_linear_l2[l2_num - 1], PTE_TABLE);
+            }
+
+            pte_t* l2 = pt_linear_l2[pt_linear_l2_ind[l1_ind] - 1];
+            pte_set(&l2[(pa / PT_LINEAR_L2_SIZE) % PT_LINEAR_NENTRIES], pa, PTE_SUPERPAGE,
+                PTE_HYP_FLAGS | PTE_XN);
+            pa += PT_LINEAR_L2_SIZE;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns whether the window is used, the master building it the first time it is called and the
+ * other cpus waiting for it.
+ */
+bool pt_linear_init(void)
+{
+    if (cpu_is_master() && pt_linear_state == PT_LINEAR_PENDING) {
+        bool built = pt_linear_build();
+        if (!built) {
+            WARNING("Page table linear window unsupported, falling back to recursive mappings");
+        }
+        fence_sync_write();
+        pt_linear_state = built ? PT_LINEAR_ON : PT_LINEAR_OFF;
+        spin_notify();
+    }
+
+    while (pt_linear_state == PT_LINEAR_PENDING) {
+        spin_wait();
+    }
+
+    return pt_linear_state == PT_LINEAR_ON;
+}
+
+void pt_set_linear(struct page_table* pt)
+{
+    pte_t* pte = &pt->root[pt_getpteindex_by_va(pt, PT_LINEAR_BASE, 0)];
+    pt_linear_set(pte, (vaddr_t)pt_linear_l1, PTE_TABLE);
+    fence_sync_write();
+}
+
+#endif
+
 pte_t* pt_get_pte(struct page_table* pt, size_t lvl, vaddr_t va)
 {
+#if defined(PT_LINEAR) && !defined(AARCH32)
+    if (pt_linear_state == PT_LINEAR_ON) {
+        pte_t* pte = &pt->root[pt_getpteindex_by_va(pt, va, 0)];
+        for (size_t i = 1; i <= lvl; i++) {
+            pte_t* table = (pte_t*)(PT_LINEAR_BASE + (*pte & PTE_ADDR_MSK));
+            pte = &table[pt_getpteindex_by_va(pt, va, i)];
+        }
+        return pte;
+    }
+#endif
+
     struct page_table* cpu_pt = &cpu()->as.pt;
 
     size_t rec_ind_off = cpu_pt->dscr->lvl_off[cpu_pt->dscr->lvls - lvl - 1];
@@ -106,6 +294,11 @@ bool pte_page(struct page_table* pt, pte_t* pte, size_t lvl)
     return (*pte & PTE_TYPE_MSK) == PTE_PAGE;
 }
 
+size_t pt_contig_num(struct page_table* pt, size_t lvl)
+{
+    return pt_lvl_terminal(pt, lvl) ? PT_CONTIG_NUM : 0;
+}
+
 bool pte_table(struct page_table* pt, pte_t* pte, size_t lvl)
 {
     if (lvl == pt->dscr->lvls - 1) {
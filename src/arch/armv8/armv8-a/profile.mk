@@ -1,7 +1,9 @@
 ## SPDX-License-Identifier: Apache-2.0
 ## Copyright (c) Bao Project and Contributors. All rights reserved.
 
-arch-cppflags+= 
+SMMU_VERSION?=SMMUV2
+
+arch-cppflags+=-DSMMU_VERSION=$(SMMU_VERSION)
 arch-cflags+= -march=armv8-a
 arch-asflags+=
 arch-ldflags+=
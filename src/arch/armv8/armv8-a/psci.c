@@ -13,6 +13,10 @@ extern uint8_t root_l1_flat_pt;
 
 static void psci_save_state(enum wakeup_reason wakeup_reason)
 {
+#ifdef AARCH64
+    fp_cpu_save();
+#endif
+
     cpu()->arch.profile.psci_off_state.tcr_el2 = sysreg_tcr_el2_read();
     cpu()->arch.profile.psci_off_state.ttbr0_el2 = sysreg_ttbr0_el2_read();
     cpu()->arch.profile.psci_off_state.mair_el2 = sysreg_mair_el2_read();
@@ -80,27 +84,33 @@ void psci_wake(uint32_t handler_id)
     }
 }
 
+int32_t psci_standby_state(uint32_t power_state)
+{
+    return psci_cpu_suspend(power_state, 0, 0);
+}
+
 int32_t psci_standby()
 {
     /* only apply request to core level */
-    uint32_t pwr_state_aux = PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_STANDBY;
-
-    return psci_cpu_suspend(pwr_state_aux, 0, 0);
+    return psci_standby_state(PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_STANDBY);
 }
 
-int32_t psci_power_down(enum wakeup_reason reason)
+int32_t psci_power_down_state(uint32_t power_state, enum wakeup_reason reason)
 {
     extern void psci_boot_entry(unsigned long x0);
 
-    uint32_t pwr_state_aux = PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_POWERDOWN;
-
     psci_save_state(reason);
     paddr_t cntxt_paddr;
     paddr_t psci_wakeup_addr;
     mem_translate(&cpu()->as, (vaddr_t)&cpu()->arch.profile.psci_off_state, &cntxt_paddr);
     mem_translate(&cpu()->as, (vaddr_t)&psci_boot_entry, &psci_wakeup_addr);
 
-    return psci_cpu_suspend(pwr_state_aux, psci_wakeup_addr, cntxt_paddr);
+    return psci_cpu_suspend(power_state, psci_wakeup_addr, cntxt_paddr);
+}
+
+int32_t psci_power_down(enum wakeup_reason reason)
+{
+    return psci_power_down_state(PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_POWERDOWN, reason);
 }
 
 int32_t psci_cpu_suspend(uint32_t power_state, unsigned long entrypoint, unsigned long context_id)
@@ -112,3 +122,12 @@ int32_t psci_cpu_on(unsigned long target_cpu, unsigned long entrypoint, unsigned
 {
     return smc_call(PSCI_CPU_ON, target_cpu, entrypoint, context_id, NULL);
 }
+
+/* SYSTEM_RESET is a cold reset, which need not keep the contents of memory */
+int32_t psci_system_reset_warm(void)
+{
+    if ((int32_t)smc_call(PSCI_FEATURES, PSCI_SYSTEM_RESET2, 0, 0, NULL) < 0) {
+        return PSCI_E_NOT_SUPPORTED;
+    }
+    return smc_call(PSCI_SYSTEM_RESET2, PSCI_SYSTEM_WARM_RESET, 0, 0, NULL);
+}
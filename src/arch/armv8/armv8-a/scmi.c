@@ -0,0 +1,459 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/scmi.h>
+#include <arch/smc.h>
+#include <arch/smcc.h>
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <mem.h>
+#include <cache.h>
+#include <platform.h>
+#include <spinlock.h>
+#include <fences.h>
+#include <string.h>
+#include <bit.h>
+
+#define SCMI_MSG_PAYLOAD_WORDS   (SCMI_MSG_PAYLOAD_MAX / sizeof(uint32_t))
+#define SCMI_SHMEM_GUEST_SIZE    (sizeof(struct scmi_shmem) + SCMI_MSG_PAYLOAD_MAX)
+
+#define SCMI_BASE_VERSION        (0x10000)
+#define SCMI_PERF_VERSION        (0x20000)
+#define SCMI_PERF_LEVEL_WORDS    (3)
+#define SCMI_PERF_V4_LEVEL_WORDS (5)
+
+#define SCMI_MSG_HDR(protocol, id) \
+    (((uint32_t)(protocol) << SCMI_MSG_PROTOCOL_OFF) | ((uint32_t)(id) << SCMI_MSG_ID_OFF))
+
+/* Serializes the use of the hypervisor's channel and the vms' level requests */
+static spinlock_t scmi_lock = SPINLOCK_INITVAL;
+static volatile struct scmi_shmem* scmi_fw_shmem;
+static size_t scmi_fw_level_words = SCMI_PERF_LEVEL_WORDS;
+
+/**
+ * Sends a command through the hypervisor's channel and returns the status of the response, whose
+ * payload is then read from the channel. The smc transport is synchronous, the firmware frees the
+ * channel before the smc returns. Must be called with scmi_lock held.
+ */
+static int32_t scmi_fw_call(uint32_t protocol, uint32_t msg_id, const uint32_t* payload,
+    size_t words, size_t* resp_words)
+{
+    volatile struct scmi_shmem* shmem = scmi_fw_shmem;
+    *resp_words = 0;
+
+    if ((shmem == NULL) || !(shmem->channel_status & SCMI_SHMEM_CHAN_FREE)) {
+        return SCMI_BUSY;
+    }
+
+    for (size_t i = 0; i < words; i++) {
+        shmem->msg_payload[i] = payload[i];
+    }
+    shmem->msg_header = SCMI_MSG_HDR(protocol, msg_id);
+    shmem->length = (uint32_t)((words + 1) * sizeof(uint32_t));
+    shmem->flags = 0;
+    fence_sync_write();
+    shmem->channel_status = 0;
+    fence_sync();
+
+    smc_call(platform.arch.scmi.smc_id, 0, 0, 0, NULL);
+
+    fence_sync();
+    if ((shmem->channel_status & (SCMI_SHMEM_CHAN_FREE | SCMI_SHMEM_CHAN_ERROR)) !=
+        SCMI_SHMEM_CHAN_FREE) {
+        return SCMI_COMMS_ERROR;
+    }
+
+    size_t length = shmem->length;
+    if (length < (2 * sizeof(uint32_t))) {
+        return SCMI_PROTOCOL_ERROR;
+    }
+    size_t max_words = (platform.arch.scmi.shmem_size - sizeof(struct scmi_shmem)) /
+        sizeof(uint32_t);
+    *resp_words = min((length / sizeof(uint32_t)) - 1, max_words);
+
+    return (int32_t)shmem->msg_payload[0];
+}
+
+void scmi_init(void)
+{
+    if (!cpu_is_master() || (platform.arch.scmi.shmem_addr == 0)) {
+        return;
+    }
+
+    if (platform.arch.scmi.shmem_size < (sizeof(struct scmi_shmem) + sizeof(uint32_t))) {
+        ERROR("Platform SCMI channel too small");
+    }
+
+    paddr_t base = ALIGN_FLOOR(platform.arch.scmi.shmem_addr, PAGE_SIZE);
+    size_t off = platform.arch.scmi.shmem_addr - base;
+    vaddr_t va = mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, base,
+        NUM_PAGES(off + platform.arch.scmi.shmem_size));
+    if (va == INVALID_VA) {
+        ERROR("failed to map the platform SCMI channel");
+    }
+    scmi_fw_shmem = (struct scmi_shmem*)(va + off);
+
+    /* Version 4 firmware describes each level with its indicative frequency and index */
+    size_t resp_words = 0;
+    spin_lock(&scmi_lock);
+    int32_t status = scmi_fw_call(SCMI_PROTOCOL_PERF, SCMI_PROTOCOL_VERSION, NULL, 0,
+        &resp_words);
+    if ((status == SCMI_SUCCESS) && (resp_words >= 2) &&
+        ((scmi_fw_shmem->msg_payload[1] >> 16) >= 4)) {
+        scmi_fw_level_words = SCMI_PERF_V4_LEVEL_WORDS;
+    }
+    spin_unlock(&scmi_lock);
+
+    if (status != SCMI_SUCCESS) {
+        WARNING("SCMI performance protocol not available (%d)", status);
+    }
+}
+
+/**
+ * The level of a platform domain is the highest among the vms sharing it, each vm's level being
+ * its last request, kept within its ceiling, or its floor, if higher. A vm's ceiling only bounds
+ * its own requests. Must be called with scmi_lock held.
+ */
+static int32_t scmi_perf_arbitrate(uint32_t domain)
+{
+    uint32_t level = 0;
+
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_platform* vm_platform = &config.vmlist[i].platform;
+        for (size_t j = 0; j < vm_platform->arch.scmi.domain_num; j++) {
+            struct scmi_vm_domain* vm_domain = &vm_platform->arch.scmi.domains[j];
+            if (vm_domain->domain == domain) {
+                level = max(level, max(vm_domain->floor, vm_domain->level));
+            }
+        }
+    }
+
+    if (level == 0) {
+        return SCMI_SUCCESS;
+    }
+
+    uint32_t payload[] = { domain, level };
+    size_t resp_words = 0;
+    return scmi_fw_call(SCMI_PROTOCOL_PERF, SCMI_PERF_LEVEL_SET, payload, 2, &resp_words);
+}
+
+void scmi_vm_init(struct vm* vm, const struct vm_config* config)
+{
+    vaddr_t addr = config->platform.arch.scmi.shmem_addr;
+
+    vm->arch.scmi_shmem = NULL;
+    if (addr == 0) {
+        return;
+    }
+
+    if ((addr % PAGE_SIZE) != 0) {
+        WARNING("VM %d SCMI channel not page aligned. Ignored.", vm->id);
+        return;
+    }
+
+    if (scmi_fw_shmem == NULL) {
+        WARNING("VM %d SCMI channel given but the platform has none. Ignored.", vm->id);
+        return;
+    }
+
+    struct scmi_shmem* shmem = mem_alloc_page(NUM_PAGES(SCMI_SHMEM_GUEST_SIZE), SEC_HYP_VM, false);
+    if (shmem == NULL) {
+        ERROR("failed to allocate SCMI channel");
+    }
+    memset(shmem, 0, NUM_PAGES(SCMI_SHMEM_GUEST_SIZE) * PAGE_SIZE);
+    shmem->channel_status = SCMI_SHMEM_CHAN_FREE;
+    cache_flush_range((vaddr_t)shmem, SCMI_SHMEM_GUEST_SIZE);
+
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, (vaddr_t)shmem, &pa);
+    struct ppages ppages = mem_ppages_get(pa, NUM_PAGES(SCMI_SHMEM_GUEST_SIZE));
+    mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, addr, ppages.num_pages, PTE_VM_FLAGS);
+    vm->arch.scmi_shmem = shmem;
+
+    scmi_vm_reset(vm);
+}
+
+/**
+ * Frees the vm's channel, drops its requests and applies its floors, which it is guaranteed from
+ * the start.
+ */
+void scmi_vm_reset(struct vm* vm)
+{
+    if (vm->arch.scmi_shmem == NULL) {
+        return;
+    }
+
+    vm->arch.scmi_shmem->channel_status = SCMI_SHMEM_CHAN_FREE;
+    cache_flush_range((vaddr_t)vm->arch.scmi_shmem, SCMI_SHMEM_GUEST_SIZE);
+
+    spin_lock(&scmi_lock);
+    for (size_t i = 0; i < vm->config->platform.arch.scmi.domain_num; i++) {
+        struct scmi_vm_domain* vm_domain = &vm->config->platform.arch.scmi.domains[i];
+        vm_domain->level = 0;
+        int32_t status = scmi_perf_arbitrate(vm_domain->domain);
+        if (status != SCMI_SUCCESS) {
+            WARNING("VM %d failed to set SCMI performance domain %d (%d)", vm->id,
+                vm_domain->domain, status);
+        }
+    }
+    spin_unlock(&scmi_lock);
+}
+
+static size_t scmi_base_handler(uint32_t msg_id, const uint32_t* req, size_t req_words,
+    uint32_t* resp)
+{
+    size_t words = 1;
+    resp[0] = (uint32_t)SCMI_SUCCESS;
+
+    switch (msg_id) {
+        case SCMI_PROTOCOL_VERSION:
+            resp[words++] = SCMI_BASE_VERSION;
+            break;
+        case SCMI_PROTOCOL_ATTRIBUTES:
+            /* A single protocol and no other agent */
+            resp[words++] = 1;
+            break;
+        case SCMI_PROTOCOL_MESSAGE_ATTRIBUTES:
+            if ((req_words < 1) || (req[0] > SCMI_BASE_DISCOVER_LIST_PROTOCOLS) ||
+                (req[0] == SCMI_BASE_DISCOVER_SUB_VENDOR)) {
+                resp[0] = (uint32_t)SCMI_NOT_FOUND;
+            } else {
+                resp[words++] = 0;
+            }
+            break;
+        case SCMI_BASE_DISCOVER_VENDOR:
+            memset(&resp[words], 0, 4 * sizeof(uint32_t));
+            memcpy(&resp[words], "Bao", sizeof("Bao"));
+            words += 4;
+            break;
+        case SCMI_BASE_DISCOVER_IMPL_VERSION:
+            resp[words++] = 0;
+            break;
+        case SCMI_BASE_DISCOVER_LIST_PROTOCOLS:
+            if ((req_words < 1) || (req[0] > 1)) {
+                resp[0] = (uint32_t)SCMI_INVALID_PARAMETERS;
+            } else if (req[0] == 1) {
+                resp[words++] = 0;
+            } else {
+                resp[words++] = 1;
+                resp[words++] = SCMI_PROTOCOL_PERF;
+            }
+            break;
+        default:
+            resp[0] = (uint32_t)SCMI_NOT_SUPPORTED;
+    }
+
+    return words;
+}
+
+/**
+ * Forwards a perf command for the platform domain the vm's domain maps to, copying up to max
+ * words of the response after its status.
+ */
+static int32_t scmi_perf_forward(uint32_t msg_id, uint32_t* payload, size_t words,
+    uint32_t* resp, size_t max)
+{
+    size_t resp_words = 0;
+    memset(&resp[1], 0, max * sizeof(uint32_t));
+
+    spin_lock(&scmi_lock);
+    int32_t status = scmi_fw_call(SCMI_PROTOCOL_PERF, msg_id, payload, words, &resp_words);
+    for (size_t i = 1; (status == SCMI_SUCCESS) && (i < resp_words) && (i <= max); i++) {
+        resp[i] = scmi_fw_shmem->msg_payload[i];
+    }
+    spin_unlock(&scmi_lock);
+
+    return status;
+}
+
+/**
+ * Since the firmware's response is copied to the guest in a single message, at most as many
+ * levels as fit are returned, the remaining ones being left to the guest's next request.
+ */
+static size_t scmi_perf_describe_levels(struct scmi_vm_domain* vm_domain, uint32_t index,
+    uint32_t* resp)
+{
+    size_t max_levels = (SCMI_MSG_PAYLOAD_WORDS - 2) / SCMI_PERF_LEVEL_WORDS;
+    uint32_t payload[] = { vm_domain->domain, index };
+    size_t resp_words = 0;
+
+    spin_lock(&scmi_lock);
+    int32_t status = scmi_fw_call(SCMI_PROTOCOL_PERF, SCMI_PERF_DESCRIBE_LEVELS, payload, 2,
+        &resp_words);
+    size_t levels = 0;
+    size_t remaining = 0;
+    if ((status == SCMI_SUCCESS) && (resp_words >= 2)) {
+        uint32_t num = scmi_fw_shmem->msg_payload[1];
+        size_t returned = bit32_extract(num, SCMI_PERF_LEVELS_NUM_OFF, SCMI_PERF_LEVELS_NUM_LEN);
+        remaining = bit32_extract(num, SCMI_PERF_LEVELS_REMAINING_OFF,
+            SCMI_PERF_LEVELS_REMAINING_LEN);
+        levels = min(min(returned, max_levels), (resp_words - 2) / scmi_fw_level_words);
+        remaining += returned - levels;
+        for (size_t i = 0; i < levels; i++) {
+            for (size_t j = 0; j < SCMI_PERF_LEVEL_WORDS; j++) {
+                resp[2 + (i * SCMI_PERF_LEVEL_WORDS) + j] =
+                    scmi_fw_shmem->msg_payload[2 + (i * scmi_fw_level_words) + j];
+            }
+        }
+    }
+    spin_unlock(&scmi_lock);
+
+    resp[0] = (uint32_t)status;
+    if (status != SCMI_SUCCESS) {
+        return 1;
+    }
+    resp[1] = (uint32_t)((levels << SCMI_PERF_LEVELS_NUM_OFF) |
+        (min(remaining, (size_t)BIT32_MASK(0, SCMI_PERF_LEVELS_REMAINING_LEN))
+            << SCMI_PERF_LEVELS_REMAINING_OFF));
+
+    return 2 + (levels * SCMI_PERF_LEVEL_WORDS);
+}
+
+static size_t scmi_perf_handler(struct vm* vm, uint32_t msg_id, const uint32_t* req,
+    size_t req_words, uint32_t* resp)
+{
+    size_t words = 1;
+    resp[0] = (uint32_t)SCMI_SUCCESS;
+
+    if (msg_id <= SCMI_PROTOCOL_MESSAGE_ATTRIBUTES) {
+        switch (msg_id) {
+            case SCMI_PROTOCOL_VERSION:
+                resp[words++] = SCMI_PERF_VERSION;
+                break;
+            case SCMI_PROTOCOL_ATTRIBUTES:
+                /* The vm's domains, with no power values nor statistics */
+                resp[words++] = (uint32_t)vm->config->platform.arch.scmi.domain_num;
+                resp[words++] = 0;
+                resp[words++] = 0;
+                resp[words++] = 0;
+                break;
+            case SCMI_PROTOCOL_MESSAGE_ATTRIBUTES:
+                if ((req_words < 1) || (req[0] > SCMI_PERF_LEVEL_GET) ||
+                    (req[0] == SCMI_PERF_LIMITS_SET)) {
+                    resp[0] = (uint32_t)SCMI_NOT_FOUND;
+                } else {
+                    resp[words++] = 0;
+                }
+                break;
+        }
+        return words;
+    }
+
+    if ((req_words < 1) || (req[0] >= vm->config->platform.arch.scmi.domain_num)) {
+        resp[0] = (uint32_t)SCMI_NOT_FOUND;
+        return words;
+    }
+
+    struct scmi_vm_domain* vm_domain = &vm->config->platform.arch.scmi.domains[req[0]];
+    uint32_t payload[] = { vm_domain->domain, 0 };
+    int32_t status = SCMI_SUCCESS;
+
+    switch (msg_id) {
+        case SCMI_PERF_DOMAIN_ATTRIBUTES:
+            /**
+             * Attributes, rate limit, sustained frequency and level, and name. The vm may only set
+             * the level, it gets no limits control, notifications nor fast channels.
+             */
+            status = scmi_perf_forward(msg_id, payload, 1, resp, 8);
+            resp[1] &= SCMI_PERF_DOMAIN_SET_LEVEL_BIT;
+            words = 9;
+            break;
+        case SCMI_PERF_DESCRIBE_LEVELS:
+            if (req_words < 2) {
+                status = SCMI_INVALID_PARAMETERS;
+                break;
+            }
+            return scmi_perf_describe_levels(vm_domain, req[1], resp);
+        case SCMI_PERF_LIMITS_GET:
+            status = scmi_perf_forward(msg_id, payload, 1, resp, 2);
+            if (vm_domain->ceiling != 0) {
+                resp[1] = min(resp[1], vm_domain->ceiling);
+            }
+            resp[2] = max(resp[2], vm_domain->floor);
+            words = 3;
+            break;
+        case SCMI_PERF_LEVEL_SET: {
+            if (req_words < 2) {
+                status = SCMI_INVALID_PARAMETERS;
+                break;
+            }
+            uint32_t level = req[1];
+            if (vm_domain->ceiling != 0) {
+                level = min(level, vm_domain->ceiling);
+            }
+            spin_lock(&scmi_lock);
+            vm_domain->level = max(level, vm_domain->floor);
+            status = scmi_perf_arbitrate(vm_domain->domain);
+            spin_unlock(&scmi_lock);
+            break;
+        }
+        case SCMI_PERF_LEVEL_GET:
+            if (vm_domain->level != 0) {
+                resp[words++] = vm_domain->level;
+            } else {
+                status = scmi_perf_forward(msg_id, payload, 1, resp, 1);
+                words = 2;
+            }
+            break;
+        default:
+            status = SCMI_NOT_SUPPORTED;
+    }
+
+    resp[0] = (uint32_t)status;
+    return (status == SCMI_SUCCESS) ? words : 1;
+}
+
+/**
+ * Handles the command the guest placed in its channel. As the guest may map the channel as non
+ * cacheable, it is cleaned and invalidated from the caches both before it is read and once the
+ * response is written. The command is copied first so that the guest can not change it while it
+ * is handled.
+ */
+long scmi_smc_handler(unsigned long fid)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    volatile struct scmi_shmem* shmem = vm->arch.scmi_shmem;
+    uint32_t req[SCMI_MSG_PAYLOAD_WORDS];
+    uint32_t resp[SCMI_MSG_PAYLOAD_WORDS];
+
+    if ((shmem == NULL) || (fid != vm->config->platform.arch.scmi.smc_id)) {
+        return SMCC_E_NOT_SUPPORTED;
+    }
+
+    cache_flush_range((vaddr_t)shmem, SCMI_SHMEM_GUEST_SIZE);
+
+    uint32_t header = shmem->msg_header;
+    size_t length = min((size_t)shmem->length, SCMI_MSG_PAYLOAD_MAX + sizeof(uint32_t));
+    size_t req_words = (length > sizeof(uint32_t)) ? (length / sizeof(uint32_t)) - 1 : 0;
+    for (size_t i = 0; i < req_words; i++) {
+        req[i] = shmem->msg_payload[i];
+    }
+
+    uint32_t msg_id = bit32_extract(header, SCMI_MSG_ID_OFF, SCMI_MSG_ID_LEN);
+    size_t resp_words = 1;
+    resp[0] = (uint32_t)SCMI_NOT_SUPPORTED;
+    if (bit32_extract(header, SCMI_MSG_TYPE_OFF, SCMI_MSG_TYPE_LEN) == SCMI_MSG_TYPE_COMMAND) {
+        switch (bit32_extract(header, SCMI_MSG_PROTOCOL_OFF, SCMI_MSG_PROTOCOL_LEN)) {
+            case SCMI_PROTOCOL_BASE:
+                resp_words = scmi_base_handler(msg_id, req, req_words, resp);
+                break;
+            case SCMI_PROTOCOL_PERF:
+                resp_words = scmi_perf_handler(vm, msg_id, req, req_words, resp);
+                break;
+        }
+    }
+
+    for (size_t i = 0; i < resp_words; i++) {
+        shmem->msg_payload[i] = resp[i];
+    }
+    shmem->msg_header = header;
+    shmem->length = (uint32_t)((resp_words + 1) * sizeof(uint32_t));
+    fence_sync_write();
+    shmem->channel_status = SCMI_SHMEM_CHAN_FREE;
+    cache_flush_range((vaddr_t)shmem, SCMI_SHMEM_GUEST_SIZE);
+
+    return SMCC_SUCCESS;
+}
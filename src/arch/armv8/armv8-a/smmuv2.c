@@ -11,10 +11,21 @@
 #include <platform.h>
 #include <cpu.h>
 #include <mem.h>
+#include <io.h>
+#include <fences.h>
+#include <interrupts.h>
 
 #define SME_MAX_NUM 128
 #define CTX_MAX_NUM 128
 
+/**
+ * Ranges of up to this many pages are invalidated page by page in the vm's context banks, larger
+ * ones by invalidating all of the vm's entries at once.
+ */
+#ifndef SMMUV2_TLBI_PAGES_MAX
+#define SMMUV2_TLBI_PAGES_MAX (64)
+#endif
+
 struct smmu_hw {
     volatile struct smmu_glbl_rs0_hw* glbl_rs0;
     volatile struct smmu_glbl_rs1_hw* glbl_rs1;
@@ -29,10 +40,24 @@ struct smmu_priv {
     size_t sme_num;
     BITMAP_ALLOC(sme_bitmap, SME_MAX_NUM);
     BITMAP_ALLOC(grp_bitmap, SME_MAX_NUM);
+    /* Entries whose shadows changed since the last smmu_commit, including released ones */
+    BITMAP_ALLOC(sme_dirty_bitmap, SME_MAX_NUM);
+    /* Shadows of the SMRs and S2CRs, written to the device by smmu_commit */
+    struct {
+        streamid_t id;
+        streamid_t mask;
+        size_t ctx;
+        uint32_t s2cr;
+    } sme_shadow[SME_MAX_NUM];
 
     spinlock_t ctx_lock;
     size_t ctx_num;
     BITMAP_ALLOC(ctxbank_bitmap, CTX_MAX_NUM);
+    /* The vmid each context bank was written with, to find a vm's banks when invalidating */
+    asid_t ctx_vmid[CTX_MAX_NUM];
+
+    /* Set if the smmu does not see the cpus' tlb maintenance, which must then be repeated here */
+    bool explicit_tlbi;
 };
 
 struct smmu_priv smmu;
@@ -59,17 +84,17 @@ inline bool smmu_sme_is_group(size_t sme)
 
 inline size_t smmu_sme_get_ctx(size_t sme)
 {
-    return S2CR_CBNDX(smmu.hw.glbl_rs0->S2CR[sme]);
+    return smmu.sme_shadow[sme].ctx;
 }
 
 inline streamid_t smmu_sme_get_id(size_t sme)
 {
-    return SMMU_SMR_ID(smmu.hw.glbl_rs0->SMR[sme]);
+    return smmu.sme_shadow[sme].id;
 }
 
 inline streamid_t smmu_sme_get_mask(size_t sme)
 {
-    return SMMU_SMR_MASK(smmu.hw.glbl_rs0->SMR[sme]);
+    return smmu.sme_shadow[sme].mask;
 }
 
 static void smmu_check_features()
@@ -97,8 +122,10 @@ static void smmu_check_features()
         WARNING("smmuv2 does not support coherent page table walks");
     }
 
+    smmu.explicit_tlbi = platform.arch.smmu.explicit_tlbi;
     if (!(smmu.hw.glbl_rs0->IDR0 & SMMUV2_IDR0_BTM_BIT)) {
-        ERROR("smmuv2 does not support tlb maintenance broadcast");
+        INFO("smmuv2 does not support tlb maintenance broadcast, invalidating explicitly");
+        smmu.explicit_tlbi = true;
     }
 
     if (!(smmu.hw.glbl_rs0->IDR2 & SMMUV2_IDR2_PTFSv8_4kB_BIT)) {
@@ -116,6 +143,32 @@ static void smmu_check_features()
     }
 }
 
+/**
+ * Global and context faults are accounted by the io layer. Stalled transactions are terminated so
+ * the faulting master can make progress.
+ */
+static void smmu_fault_handler(irqid_t int_id)
+{
+    uint32_t gfsr = smmu.hw.glbl_rs0->GFSR;
+    if (gfsr != 0) {
+        io_fault_report(smmu.hw.glbl_rs0->GFSYNR1 & SMMU_ID_MSK, gfsr,
+            (unsigned long)smmu.hw.glbl_rs0->GFAR);
+        smmu.hw.glbl_rs0->GFSR = gfsr;
+    }
+
+    for (size_t ctx = 0; ctx < smmu.ctx_num; ctx++) {
+        uint32_t fsr = smmu.hw.cntxt[ctx].FSR;
+        if (bitmap_get(smmu.ctxbank_bitmap, ctx) && (fsr & SMMUV2_FSR_FAULT_MSK)) {
+            io_fault_report(smmu.hw.glbl_rs1->CBFRSYNRA[ctx] & SMMU_ID_MSK, fsr,
+                (unsigned long)smmu.hw.cntxt[ctx].FAR);
+            smmu.hw.cntxt[ctx].FSR = fsr;
+            if (fsr & SMMUV2_FSR_SS) {
+                smmu.hw.cntxt[ctx].RESUME = SMMUV2_RESUME_TERMINATE;
+            }
+        }
+    }
+}
+
 void smmu_init()
 {
     /*
@@ -156,6 +209,7 @@ void smmu_init()
     smmu.sme_num = smmu.hw.glbl_rs0->IDR0 & SMMUV2_IDR0_MASK;
     bitmap_clear_consecutive(smmu.sme_bitmap, 0, smmu.sme_num);
     bitmap_clear_consecutive(smmu.grp_bitmap, 0, smmu.sme_num);
+    bitmap_clear_consecutive(smmu.sme_dirty_bitmap, 0, smmu.sme_num);
 
     /* Clear random reset state. */
     smmu.hw.glbl_rs0->GFSR = smmu.hw.glbl_rs0->GFSR;
@@ -170,11 +224,22 @@ void smmu_init()
         smmu.hw.cntxt[i].FSR = -1;
     }
 
+    INFO("smmuv2: %d stream match entries, %d context banks", smmu.sme_num, smmu.ctx_num);
+
     /* Enable IOMMU. */
     uint32_t cr0 = smmu.hw.glbl_rs0->CR0;
     cr0 = SMMUV2_CR0_CLEAR(cr0);
     cr0 |= SMMUV2_CR0_USFCFG | SMMUV2_CR0_SMCFCFG;
     cr0 &= ~SMMUV2_CR0_CLIENTPD;
+
+    if (platform.arch.smmu.interrupt_id != 0) {
+        if (!interrupts_reserve(platform.arch.smmu.interrupt_id, smmu_fault_handler)) {
+            ERROR("failed to reserve smmu fault interrupt");
+        }
+        interrupts_hyp_enable(platform.arch.smmu.interrupt_id);
+        cr0 |= SMMUV2_CR0_GFIE;
+    }
+
     smmu.hw.glbl_rs0->CR0 = cr0;
 }
 
@@ -195,7 +260,7 @@ static size_t smmu_cb_ttba_offset(size_t t0sz)
 {
     size_t offset = 12;
 
-    if (parange_table[parange] < 44) {
+    if ((64 - t0sz) < 44) {
         /* SMMUV2_TCR_SL0_1 */
         if (t0sz >= 21 && t0sz <= 33) {
             offset = 37 - t0sz;
@@ -210,7 +275,7 @@ static size_t smmu_cb_ttba_offset(size_t t0sz)
     return offset;
 }
 
-void smmu_write_ctxbnk(size_t ctx_id, paddr_t root_pt, asid_t vm_id)
+void smmu_write_ctxbnk(size_t ctx_id, paddr_t root_pt, asid_t vm_id, size_t ipa_bits)
 {
     spin_lock(&smmu.ctx_lock);
     if (!bitmap_get(smmu.ctxbank_bitmap, ctx_id)) {
@@ -218,20 +283,21 @@ void smmu_write_ctxbnk(size_t ctx_id, paddr_t root_pt, asid_t vm_id)
     } else {
         /* Set type as stage 2 only. */
         smmu.hw.glbl_rs1->CBAR[ctx_id] = SMMUV2_CBAR_VMID(vm_id);
+        smmu.ctx_vmid[ctx_id] = vm_id;
         smmu.hw.glbl_rs1->CBA2R[ctx_id] = SMMUV2_CBAR_VA64;
 
         /**
-         * This should closely match to the VTCR configuration set up in vmm_arch_init as we're
-         * sharing page table between the VM and its smmu context.
+         * This should closely match to the VM's VTCR configuration set up in vmm_arch_write_vtcr
+         * as we're sharing page table between the VM and its smmu context.
          */
         uint32_t tcr = ((parange << SMMUV2_TCR_PS_OFF) & SMMUV2_TCR_PS_MSK);
-        size_t t0sz = 64 - parange_table[parange];
+        size_t t0sz = 64 - ipa_bits;
         tcr |= SMMUV2_TCR_TG0_4K;
         tcr |= SMMUV2_TCR_ORGN0_WB_RA_WA;
         tcr |= SMMUV2_TCR_IRGN0_WB_RA_WA;
         tcr |= SMMUV2_TCR_T0SZ(t0sz);
         tcr |= SMMUV2_TCR_SH0_IS;
-        tcr |= ((parange_table[parange] < 44) ? SMMUV2_TCR_SL0_1 : SMMUV2_TCR_SL0_0);
+        tcr |= ((ipa_bits < 44) ? SMMUV2_TCR_SL0_1 : SMMUV2_TCR_SL0_0);
         smmu.hw.cntxt[ctx_id].TCR = tcr;
         smmu.hw.cntxt[ctx_id].TTBR0 = root_pt & SMMUV2_CB_TTBA(smmu_cb_ttba_offset(t0sz));
 
@@ -250,6 +316,8 @@ ssize_t smmu_alloc_sme()
     ssize_t nth = bitmap_find_nth(smmu.sme_bitmap, smmu.sme_num, 1, 0, false);
     if (nth >= 0) {
         bitmap_set(smmu.sme_bitmap, nth);
+        /* Not bound to any context until smmu_write_s2c */
+        smmu.sme_shadow[nth].ctx = (size_t)-1;
     }
     spin_unlock(&smmu.sme_lock);
 
@@ -293,6 +361,8 @@ bool smmu_compatible_sme_exists(streamid_t mask, streamid_t id, size_t ctx, bool
                  */
                 if (mask > sme_mask) {
                     bitmap_clear(smmu.sme_bitmap, sme);
+                    bitmap_clear(smmu.grp_bitmap, sme);
+                    bitmap_set(smmu.sme_dirty_bitmap, sme);
                 } else {
                     included = true;
                     break;
@@ -308,19 +378,85 @@ bool smmu_compatible_sme_exists(streamid_t mask, streamid_t id, size_t ctx, bool
     return included;
 }
 
+/* Must be called holding the sme lock. */
+static void smmu_set_smr(size_t sme, streamid_t mask, streamid_t id, bool group)
+{
+    smmu.sme_shadow[sme].mask = mask & SMMU_ID_MSK;
+    smmu.sme_shadow[sme].id = id & SMMU_ID_MSK;
+    bitmap_set(smmu.sme_dirty_bitmap, sme);
+
+    if (group) {
+        bitmap_set(smmu.grp_bitmap, sme);
+    }
+}
+
+/* Must be called holding the sme lock. */
+static ssize_t smmu_find_buddy_sme(streamid_t mask, streamid_t id, size_t ctx, ssize_t skip)
+{
+    size_t sme = 0;
+
+    smmu_for_each_sme(sme)
+    {
+        streamid_t diff = (smmu_sme_get_id(sme) ^ id) & ~mask & SMMU_ID_MSK;
+        if ((ssize_t)sme != skip && smmu_sme_get_ctx(sme) == ctx &&
+            smmu_sme_get_mask(sme) == mask && bit32_popcount(diff) == 1) {
+            return (ssize_t)sme;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Tries to absorb a new (mask, id) entry into the existing smes of the same context bank. Two
+ * entries with equal masks whose ids differ in a single unmasked bit cover exactly the same streams
+ * as one entry with that bit added to the mask, so they are merged, repeatedly, in a buddy-like
+ * fashion. No stream outside the ones assigned to the context ever gets matched.
+ *
+ * Returns true if the entry was merged, in which case no new sme needs to be allocated.
+ */
+bool smmu_merge_sme(streamid_t mask, streamid_t id, size_t ctx)
+{
+    ssize_t cur = -1;
+
+    mask &= SMMU_ID_MSK;
+    id &= SMMU_ID_MSK & ~mask;
+
+    spin_lock(&smmu.sme_lock);
+    while (true) {
+        ssize_t buddy = smmu_find_buddy_sme(mask, id, ctx, cur);
+        if (buddy < 0) {
+            break;
+        }
+
+        /**
+         * The entry being merged is released before its buddy grows to cover it, so no stream is
+         * matched by two entries at once.
+         */
+        if (cur >= 0) {
+            bitmap_clear(smmu.sme_bitmap, (size_t)cur);
+            bitmap_clear(smmu.grp_bitmap, (size_t)cur);
+            bitmap_set(smmu.sme_dirty_bitmap, (size_t)cur);
+        }
+
+        streamid_t bit = (smmu_sme_get_id((size_t)buddy) ^ id) & ~mask;
+        mask |= bit;
+        id &= ~bit;
+        smmu_set_smr((size_t)buddy, mask, id, true);
+        cur = buddy;
+    }
+    spin_unlock(&smmu.sme_lock);
+
+    return cur >= 0;
+}
+
 void smmu_write_sme(size_t sme, streamid_t mask, streamid_t id, bool group)
 {
     spin_lock(&smmu.sme_lock);
     if (!bitmap_get(smmu.sme_bitmap, sme)) {
         ERROR("smmu: trying to write unallocated sme %d", sme);
     } else {
-        smmu.hw.glbl_rs0->SMR[sme] = mask << SMMU_SMR_MASK_OFF;
-        smmu.hw.glbl_rs0->SMR[sme] |= id & SMMU_ID_MSK;
-        smmu.hw.glbl_rs0->SMR[sme] |= SMMUV2_SMR_VALID;
-
-        if (group) {
-            bitmap_set(smmu.grp_bitmap, sme);
-        }
+        smmu_set_smr(sme, mask, id, group);
     }
     spin_unlock(&smmu.sme_lock);
 }
@@ -340,7 +476,105 @@ void smmu_write_s2c(size_t sme, size_t ctx_id)
         s2cr |= S2CR_DFLT;
         s2cr |= ctx_id & S2CR_CBNDX_MASK;
 
-        smmu.hw.glbl_rs0->S2CR[sme] = s2cr;
+        smmu.sme_shadow[sme].ctx = ctx_id;
+        smmu.sme_shadow[sme].s2cr = s2cr;
+        bitmap_set(smmu.sme_dirty_bitmap, sme);
     }
     spin_unlock(&smmu.sme_lock);
 }
+
+/**
+ * Writes the stream match entries changed since the last commit to the device. The released ones
+ * are invalidated first, so, as when merging them, no stream is ever matched by two entries. Each
+ * new entry gets its S2CR before its SMR becomes valid, so its streams never see a stale context.
+ * The device is then synced once, having the vm's entries invalidated in case its context bank
+ * was used before.
+ */
+void smmu_commit(asid_t vm_id)
+{
+    spin_lock(&smmu.sme_lock);
+    for (size_t sme = 0; sme < smmu.sme_num; sme++) {
+        if (bitmap_get(smmu.sme_dirty_bitmap, sme) && !bitmap_get(smmu.sme_bitmap, sme)) {
+            smmu.hw.glbl_rs0->SMR[sme] = 0;
+            bitmap_clear(smmu.sme_dirty_bitmap, sme);
+        }
+    }
+
+    for (size_t sme = 0; sme < smmu.sme_num; sme++) {
+        if (bitmap_get(smmu.sme_dirty_bitmap, sme)) {
+            smmu.hw.glbl_rs0->S2CR[sme] = smmu.sme_shadow[sme].s2cr;
+            fence_ord_write();
+            smmu.hw.glbl_rs0->SMR[sme] =
+                ((smmu.sme_shadow[sme].mask & SMMU_ID_MSK) << SMMU_SMR_MASK_OFF) |
+                (smmu.sme_shadow[sme].id & SMMU_ID_MSK) | SMMUV2_SMR_VALID;
+            bitmap_clear(smmu.sme_dirty_bitmap, sme);
+        }
+    }
+
+    fence_sync_write();
+    smmu.hw.glbl_rs0->TLBIVMID = SMMUV2_CBAR_VMID(vm_id);
+    smmu.hw.glbl_rs0->TLBGSYNC = 0;
+    while (smmu.hw.glbl_rs0->TLBGSTATUS & SMMUV2_TLBGSTATUS_GSACTIVE) { }
+    spin_unlock(&smmu.sme_lock);
+}
+
+size_t smmu_free_sme_num(void)
+{
+    spin_lock(&smmu.sme_lock);
+    size_t free = smmu.sme_num - bitmap_count(smmu.sme_bitmap, 0, smmu.sme_num, true);
+    spin_unlock(&smmu.sme_lock);
+
+    return free;
+}
+
+size_t smmu_free_ctxbnk_num(void)
+{
+    spin_lock(&smmu.ctx_lock);
+    size_t free = smmu.ctx_num - bitmap_count(smmu.ctxbank_bitmap, 0, smmu.ctx_num, true);
+    spin_unlock(&smmu.ctx_lock);
+
+    return free;
+}
+
+static void smmu_inv_vm_ctx_range(size_t ctx_id, vaddr_t ipa, size_t size)
+{
+    for (vaddr_t addr = ipa; addr < ipa + size; addr += PAGE_SIZE) {
+        smmu.hw.cntxt[ctx_id].TLBIIPAS2 = SMMUV2_TLBIIPAS2_ADDR(addr);
+    }
+    smmu.hw.cntxt[ctx_id].TLBSYNC = 0;
+    while (smmu.hw.cntxt[ctx_id].TLBSTATUS & SMMUV2_TLBSTATUS_SACTIVE) { }
+}
+
+/**
+ * Invalidates the vm's stage 2 entries for the given range, all of them if the size is zero. The
+ * page table updates are made visible to the smmu's walks before the invalidations, which are
+ * waited for with a single sync per context bank, or a global one for a whole vmid.
+ */
+void smmu_inv_vm_range(asid_t vm_id, vaddr_t ipa, size_t size)
+{
+    if (!smmu.explicit_tlbi) {
+        return;
+    }
+
+    fence_sync_write();
+
+    vaddr_t base = ipa & ~(PAGE_SIZE - 1);
+    size_t inv_size = ALIGN((ipa + size) - base, PAGE_SIZE);
+    if ((size == 0) || (NUM_PAGES(inv_size) > SMMUV2_TLBI_PAGES_MAX)) {
+        smmu.hw.glbl_rs0->TLBIVMID = SMMUV2_CBAR_VMID(vm_id);
+        smmu.hw.glbl_rs0->TLBGSYNC = 0;
+        while (smmu.hw.glbl_rs0->TLBGSTATUS & SMMUV2_TLBGSTATUS_GSACTIVE) { }
+        return;
+    }
+
+    for (size_t ctx_id = 0; ctx_id < smmu.ctx_num; ctx_id++) {
+        if (bitmap_get(smmu.ctxbank_bitmap, ctx_id) && (smmu.ctx_vmid[ctx_id] == vm_id)) {
+            smmu_inv_vm_ctx_range(ctx_id, base, inv_size);
+        }
+    }
+}
+
+void smmu_inv_vm_all(asid_t vm_id)
+{
+    smmu_inv_vm_range(vm_id, 0, 0);
+}
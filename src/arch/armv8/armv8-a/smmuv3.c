@@ -0,0 +1,353 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/smmuv3.h>
+#include <arch/spinlock.h>
+#include <arch/fences.h>
+#include <arch/sysregs.h>
+#include <bit.h>
+#include <platform.h>
+#include <cpu.h>
+#include <mem.h>
+
+/**
+ * Each level 2 stream table covers 2^SPLIT stream ids, 256 entries take 16KiB. Stream ids wider
+ * than SMMUV3_MAX_SID_BITS are refused to bound the size of the level 1 table. Queues are capped to
+ * a single page each.
+ */
+#define SMMUV3_STRTAB_SPLIT    (8)
+#define SMMUV3_MAX_SID_BITS    (20)
+#define SMMUV3_CMDQ_MAX_LOG2SZ (8)
+#define SMMUV3_EVTQ_MAX_LOG2SZ (7)
+
+struct smmuv3_queue {
+    void* base;
+    size_t log2size;
+    size_t entry_size;
+    uint32_t prod;
+};
+
+struct smmuv3_hw {
+    volatile struct smmuv3_regs_pg0_hw* pg0;
+    volatile struct smmuv3_regs_pg1_hw* pg1;
+};
+
+struct smmuv3_priv {
+    struct smmuv3_hw hw;
+
+    spinlock_t strtab_lock;
+    size_t sid_bits;
+    bool strtab_2lvl;
+    /* Linear stream table, or level 1 descriptors if strtab_2lvl */
+    uint64_t* strtab;
+    /* Level 2 stream table virtual addresses, indexed as strtab */
+    uint64_t** strtab_l2;
+
+    spinlock_t cmdq_lock;
+    struct smmuv3_queue cmdq;
+    struct smmuv3_queue evtq;
+};
+
+struct smmuv3_priv smmu;
+
+/**
+ * The smmu snoops the cpu caches, see smmuv3_check_features, so the structures it reads from
+ * normal memory only need the writes to them to complete before they are handed over.
+ */
+static inline void smmuv3_sync_mem(void* base, size_t size)
+{
+    (void)base;
+    (void)size;
+    fence_sync();
+}
+
+static void* smmuv3_alloc(size_t size)
+{
+    size_t num_pages = NUM_PAGES(size);
+    void* base = mem_alloc_page(num_pages, SEC_HYP_GLOBAL, true);
+    if (base == NULL) {
+        ERROR("smmuv3 could not allocate %d bytes", size);
+    }
+    mem_zero_pages(base, num_pages);
+    smmuv3_sync_mem(base, num_pages * PAGE_SIZE);
+    return base;
+}
+
+static void smmuv3_check_features()
+{
+    uint32_t idr0 = smmu.hw.pg0->IDR0;
+    uint32_t idr5 = smmu.hw.pg0->IDR5;
+
+    if (!(idr0 & SMMUV3_IDR0_S2P_BIT)) {
+        ERROR("smmuv3 does not support 2nd stage translation");
+    }
+
+    if (!(idr0 & SMMUV3_IDR0_TTF_AARCH64_BIT)) {
+        ERROR("smmuv3 does not support aarch64 translation tables");
+    }
+
+    /**
+     * As we share the page tables with the vm, their updates are only made visible to the smmu
+     * through broadcast tlb invalidations.
+     */
+    if (!(idr0 & SMMUV3_IDR0_BTM_BIT)) {
+        ERROR("smmuv3 does not support tlb maintenance broadcast");
+    }
+
+    /**
+     * The vm's page tables are also walked by the smmu and their updates are not cleaned to the
+     * point of coherency, so its table walks must snoop the cpu caches.
+     */
+    if (!(idr0 & SMMUV3_IDR0_COHACC_BIT)) {
+        ERROR("smmuv3 does not support coherent accesses");
+    }
+
+    if (!(idr5 & SMMUV3_IDR5_GRAN4K_BIT)) {
+        ERROR("smmuv3 does not support 4kb page granule");
+    }
+
+    if (smmu.hw.pg0->IDR1 & (SMMUV3_IDR1_TABLES_PRESET_BIT | SMMUV3_IDR1_QUEUES_PRESET_BIT)) {
+        ERROR("smmuv3 with preset tables or queues is not supported");
+    }
+
+    size_t pasize = bit32_extract(idr5, SMMUV3_IDR5_OAS_OFF, SMMUV3_IDR5_OAS_LEN);
+    if (pasize < parange) {
+        ERROR("smmuv3 does not support the full available pa range");
+    }
+}
+
+static void smmuv3_write_cr0(uint32_t cr0)
+{
+    smmu.hw.pg0->CR0 = cr0;
+    while (smmu.hw.pg0->CR0ACK != cr0) { }
+}
+
+static void smmuv3_queue_init(struct smmuv3_queue* q, size_t log2size, size_t entry_size)
+{
+    q->log2size = log2size;
+    q->entry_size = entry_size;
+    q->prod = 0;
+    q->base = smmuv3_alloc(entry_size << log2size);
+}
+
+static uint64_t smmuv3_queue_base(struct smmuv3_queue* q)
+{
+    paddr_t pa;
+    mem_translate(&cpu()->as, (vaddr_t)q->base, &pa);
+    return SMMUV3_Q_BASE_RWA | (pa & SMMUV3_Q_BASE_ADDR_MSK) |
+        (q->log2size & SMMUV3_Q_BASE_LOG2SIZE_MSK);
+}
+
+static inline bool smmuv3_cmdq_full(uint32_t cons)
+{
+    struct smmuv3_queue* q = &smmu.cmdq;
+    return (SMMUV3_Q_IDX(q, q->prod) == SMMUV3_Q_IDX(q, cons)) &&
+        (SMMUV3_Q_WRP(q, q->prod) != SMMUV3_Q_WRP(q, cons));
+}
+
+/**
+ * Must be called holding the cmdq lock. The command is only consumed after the producer index is
+ * published by smmuv3_cmdq_sync.
+ */
+static void smmuv3_cmdq_push(uint64_t cmd0, uint64_t cmd1)
+{
+    struct smmuv3_queue* q = &smmu.cmdq;
+
+    while (smmuv3_cmdq_full(smmu.hw.pg0->CMDQ_CONS)) { }
+
+    uint64_t* cmd = (uint64_t*)q->base + (SMMUV3_Q_IDX(q, q->prod) * SMMUV3_CMD_DWORDS);
+    cmd[0] = cmd0;
+    cmd[1] = cmd1;
+    smmuv3_sync_mem(cmd, SMMUV3_CMD_SIZE);
+
+    q->prod = SMMUV3_Q_IDX_WRP(q, q->prod + 1);
+}
+
+/**
+ * Must be called holding the cmdq lock. Appends a CMD_SYNC and waits until the smmu has consumed
+ * every command up to it.
+ */
+static void smmuv3_cmdq_sync()
+{
+    struct smmuv3_queue* q = &smmu.cmdq;
+
+    smmuv3_cmdq_push(SMMUV3_CMD_SYNC, 0);
+    smmu.hw.pg0->CMDQ_PROD = q->prod;
+
+    while (SMMUV3_Q_IDX_WRP(q, smmu.hw.pg0->CMDQ_CONS) != q->prod) {
+        if (smmu.hw.pg0->GERROR & SMMUV3_GERROR_CMDQ_ERR) {
+            ERROR("smmuv3 command queue error %d",
+                bit32_extract(smmu.hw.pg0->CMDQ_CONS, SMMUV3_CMDQ_CONS_ERR_OFF,
+                    SMMUV3_CMDQ_CONS_ERR_LEN));
+        }
+    }
+}
+
+static void smmuv3_strtab_init()
+{
+    size_t sid_bits = smmu.sid_bits;
+    size_t st_level = bit32_extract(smmu.hw.pg0->IDR0, SMMUV3_IDR0_ST_LEVEL_OFF,
+        SMMUV3_IDR0_ST_LEVEL_LEN);
+    uint32_t cfg = 0;
+    paddr_t pa;
+
+    /**
+     * A linear table is kept for small stream id spaces. Bigger ones use a two level table whose
+     * level 2 tables are only allocated when a device falling in their span is assigned.
+     */
+    smmu.strtab_2lvl = (st_level == SMMUV3_IDR0_ST_LEVEL_2LVL) && (sid_bits > SMMUV3_STRTAB_SPLIT);
+    if (smmu.strtab_2lvl) {
+        size_t l1_num = 1UL << (sid_bits - SMMUV3_STRTAB_SPLIT);
+        smmu.strtab = smmuv3_alloc(l1_num * sizeof(uint64_t));
+        smmu.strtab_l2 = mem_alloc_page(NUM_PAGES(l1_num * sizeof(uint64_t*)), SEC_HYP_GLOBAL,
+            false);
+        mem_zero_pages(smmu.strtab_l2, NUM_PAGES(l1_num * sizeof(uint64_t*)));
+        cfg = SMMUV3_STRTAB_BASE_CFG_FMT_2LVL |
+            (SMMUV3_STRTAB_SPLIT << SMMUV3_STRTAB_BASE_CFG_SPLIT_OFF);
+    } else {
+        smmu.strtab = smmuv3_alloc((1UL << sid_bits) * SMMUV3_STE_SIZE);
+        cfg = SMMUV3_STRTAB_BASE_CFG_FMT_LIN;
+    }
+    cfg |= sid_bits << SMMUV3_STRTAB_BASE_CFG_LOG2SIZE;
+
+    mem_translate(&cpu()->as, (vaddr_t)smmu.strtab, &pa);
+    smmu.hw.pg0->STRTAB_BASE = SMMUV3_STRTAB_BASE_RA | (pa & SMMUV3_STRTAB_BASE_ADDR_MSK);
+    smmu.hw.pg0->STRTAB_BASE_CFG = cfg;
+}
+
+void smmu_init()
+{
+    vaddr_t smmu_pg0 = mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+        platform.arch.smmu.base, NUM_PAGES(sizeof(struct smmuv3_regs_pg0_hw)));
+    vaddr_t smmu_pg1 = mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+        platform.arch.smmu.base + SMMUV3_PG1_OFF, NUM_PAGES(sizeof(struct smmuv3_regs_pg1_hw)));
+
+    smmu.hw.pg0 = (struct smmuv3_regs_pg0_hw*)smmu_pg0;
+    smmu.hw.pg1 = (struct smmuv3_regs_pg1_hw*)smmu_pg1;
+
+    smmuv3_check_features();
+
+    /* Make sure the smmu is quiescent before reprogramming it. */
+    smmuv3_write_cr0(0);
+
+    uint32_t cache = SMMUV3_CR1_CACHE_WB;
+    uint32_t sh = SMMUV3_CR1_SH_IS;
+    smmu.hw.pg0->CR1 = (cache << SMMUV3_CR1_QUEUE_IC_OFF) | (cache << SMMUV3_CR1_QUEUE_OC_OFF) |
+        (sh << SMMUV3_CR1_QUEUE_SH_OFF) | (cache << SMMUV3_CR1_TABLE_IC_OFF) |
+        (cache << SMMUV3_CR1_TABLE_OC_OFF) | (sh << SMMUV3_CR1_TABLE_SH_OFF);
+    /* Take part in broadcast tlb maintenance, i.e. leave PTM clear. */
+    smmu.hw.pg0->CR2 = SMMUV3_CR2_RECINVSID;
+
+    smmu.strtab_lock = SPINLOCK_INITVAL;
+    smmu.sid_bits = min(
+        bit32_extract(smmu.hw.pg0->IDR1, SMMUV3_IDR1_SIDSIZE_OFF, SMMUV3_IDR1_SIDSIZE_LEN),
+        SMMUV3_MAX_SID_BITS);
+    smmuv3_strtab_init();
+
+    smmu.cmdq_lock = SPINLOCK_INITVAL;
+    size_t cmdq_log2sz =
+        bit32_extract(smmu.hw.pg0->IDR1, SMMUV3_IDR1_CMDQS_OFF, SMMUV3_IDR1_CMDQS_LEN);
+    smmuv3_queue_init(&smmu.cmdq, min(cmdq_log2sz, SMMUV3_CMDQ_MAX_LOG2SZ), SMMUV3_CMD_SIZE);
+    smmu.hw.pg0->CMDQ_BASE = smmuv3_queue_base(&smmu.cmdq);
+    smmu.hw.pg0->CMDQ_PROD = 0;
+    smmu.hw.pg0->CMDQ_CONS = 0;
+
+    size_t evtq_log2sz =
+        bit32_extract(smmu.hw.pg0->IDR1, SMMUV3_IDR1_EVENTQS_OFF, SMMUV3_IDR1_EVENTQS_LEN);
+    smmuv3_queue_init(&smmu.evtq, min(evtq_log2sz, SMMUV3_EVTQ_MAX_LOG2SZ), SMMUV3_EVT_SIZE);
+    smmu.hw.pg0->EVENTQ_BASE = smmuv3_queue_base(&smmu.evtq);
+    smmu.hw.pg1->EVENTQ_PROD = 0;
+    smmu.hw.pg1->EVENTQ_CONS = 0;
+
+    /* Clear random reset state. */
+    smmu.hw.pg0->GERRORN = smmu.hw.pg0->GERROR;
+
+    smmuv3_write_cr0(SMMUV3_CR0_CMDQEN);
+
+    spin_lock(&smmu.cmdq_lock);
+    smmuv3_cmdq_push(SMMUV3_CMD_CFGI_ALL, SMMUV3_CMD_CFGI_ALL_RANGE);
+    smmuv3_cmdq_push(SMMUV3_CMD_TLBI_NSNH_ALL, 0);
+    smmuv3_cmdq_sync();
+    spin_unlock(&smmu.cmdq_lock);
+
+    /**
+     * Enable IOMMU. Streams without a valid ste are aborted, so only devices explicitly assigned
+     * to a vm are able to perform dma.
+     */
+    smmuv3_write_cr0(SMMUV3_CR0_CMDQEN | SMMUV3_CR0_EVENTQEN | SMMUV3_CR0_SMMUEN);
+}
+
+/**
+ * Must be called holding the strtab lock. Returns the ste for a given stream id, allocating level
+ * 2 tables on demand.
+ */
+static uint64_t* smmuv3_get_ste(streamid_t sid)
+{
+    if (!smmu.strtab_2lvl) {
+        return smmu.strtab + (sid * SMMUV3_STE_DWORDS);
+    }
+
+    size_t l1_idx = sid >> SMMUV3_STRTAB_SPLIT;
+    size_t l2_idx = sid & BIT32_MASK(0, SMMUV3_STRTAB_SPLIT);
+
+    if (smmu.strtab_l2[l1_idx] == NULL) {
+        paddr_t pa;
+        smmu.strtab_l2[l1_idx] = smmuv3_alloc((1UL << SMMUV3_STRTAB_SPLIT) * SMMUV3_STE_SIZE);
+        mem_translate(&cpu()->as, (vaddr_t)smmu.strtab_l2[l1_idx], &pa);
+        smmu.strtab[l1_idx] = (pa & SMMUV3_STRTAB_L1_L2PTR_MSK) |
+            ((SMMUV3_STRTAB_SPLIT + 1) & SMMUV3_STRTAB_L1_SPAN_MSK);
+        smmuv3_sync_mem(&smmu.strtab[l1_idx], sizeof(uint64_t));
+    }
+
+    return smmu.strtab_l2[l1_idx] + (l2_idx * SMMUV3_STE_DWORDS);
+}
+
+/**
+ * Points a stream straight at the vm's stage 2 root table. The ste configuration must closely
+ * match the vm's VTCR, set up in vmm_arch_write_vtcr, as the translation tables are shared with
+ * the vm.
+ */
+bool smmu_write_ste(streamid_t sid, paddr_t root_pt, asid_t vm_id, size_t ipa_bits)
+{
+    if ((sid >> smmu.sid_bits) != 0) {
+        INFO("smmuv3 stream id 0x%x out of range", sid);
+        return false;
+    }
+
+    size_t t0sz = 64 - ipa_bits;
+    uint64_t ste2 = ((uint64_t)vm_id & SMMUV3_STE_S2VMID_MSK);
+    ste2 |= ((uint64_t)t0sz << SMMUV3_STE_S2T0SZ_OFF) & SMMUV3_STE_S2T0SZ_MSK;
+    ste2 |= (ipa_bits < 44) ? SMMUV3_STE_S2SL0_1 : SMMUV3_STE_S2SL0_0;
+    ste2 |= SMMUV3_STE_S2IR0_WB_RA_WA | SMMUV3_STE_S2OR0_WB_RA_WA | SMMUV3_STE_S2SH0_IS;
+    ste2 |= SMMUV3_STE_S2TG_4K;
+    ste2 |= ((uint64_t)parange << SMMUV3_STE_S2PS_OFF) & SMMUV3_STE_S2PS_MSK;
+    ste2 |= SMMUV3_STE_S2AA64 | SMMUV3_STE_S2R;
+
+    spin_lock(&smmu.strtab_lock);
+    uint64_t* ste = smmuv3_get_ste(sid);
+    if (ste[0] & SMMUV3_STE_V) {
+        if ((ste[2] & SMMUV3_STE_S2VMID_MSK) != ((uint64_t)vm_id & SMMUV3_STE_S2VMID_MSK)) {
+            ERROR("smmuv3 stream id 0x%x already assigned", sid);
+        }
+    } else {
+        ste[1] = SMMUV3_STE_SHCFG_INCOMING;
+        ste[2] = ste2;
+        ste[3] = root_pt & SMMUV3_STE_S2TTB_MSK;
+        smmuv3_sync_mem(ste, SMMUV3_STE_SIZE);
+
+        /* The entry only becomes valid after all its other fields are observable. */
+        ste[0] = SMMUV3_STE_CONFIG_S2_TRANS | SMMUV3_STE_V;
+        smmuv3_sync_mem(ste, sizeof(uint64_t));
+
+        spin_lock(&smmu.cmdq_lock);
+        smmuv3_cmdq_push(SMMUV3_CMD_CFGI_STE | ((uint64_t)sid << SMMUV3_CMD_SID_OFF),
+            SMMUV3_CMD_CFGI_LEAF);
+        smmuv3_cmdq_sync();
+        spin_unlock(&smmu.cmdq_lock);
+    }
+    spin_unlock(&smmu.strtab_lock);
+
+    return true;
+}
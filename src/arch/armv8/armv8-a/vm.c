@@ -7,9 +7,40 @@
 #include <arch/sysregs.h>
 #include <arch/fences.h>
 #include <tlb.h>
+#include <vmm.h>
+#include <page_table.h>
+#include <bit.h>
+#include <config.h>
+
+/**
+ * Besides what the vm's regions span, the guest physical address space must cover the interrupt
+ * controller and the stolen time records.
+ */
+struct page_table_dscr* vm_arch_pt_dscr(const struct vm_config* config, vaddr_t ipa_top)
+{
+    const struct arch_vm_platform* arch = &config->platform.arch;
+
+    ipa_top = max(ipa_top, arch->gic.gicd_addr + sizeof(struct gicd_hw));
+#if (GIC_VERSION == GICV2)
+    ipa_top = max(ipa_top, arch->gic.gicc_addr + sizeof(struct gicc_hw));
+#else
+    ipa_top = max(ipa_top,
+        arch->gic.gicr_addr + (sizeof(struct gicr_hw) * config->platform.cpu_num));
+#endif
+    if (arch->pv_time_addr != 0) {
+        ipa_top = max(ipa_top,
+            arch->pv_time_addr + ALIGN(config->platform.cpu_num * sizeof(struct pv_time_st),
+                                     PAGE_SIZE));
+    }
+
+    size_t ipa_bits = (ipa_top > 1) ? ((sizeof(ipa_top) * 8) - bit_clz(ipa_top - 1)) : 0;
+    return pt_s2_dscr(ipa_bits);
+}
 
 void vcpu_arch_profile_init(struct vcpu* vcpu, struct vm* vm)
 {
+    vmm_arch_write_vtcr(pt_s2_ipa_bits(&vm->as.pt));
+
     paddr_t root_pt_pa;
     mem_translate(&cpu()->as, (vaddr_t)vm->as.pt.root, &root_pt_pa);
     sysreg_vttbr_el2_write((((uint64_t)vm->id << VTTBR_VMID_OFF) & VTTBR_VMID_MSK) |
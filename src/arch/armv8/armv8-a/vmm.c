@@ -4,8 +4,10 @@
  */
 
 #include <vmm.h>
+#include <arch/scmi.h>
 
 void vmm_arch_profile_init()
 {
     vmm_arch_init_tcr();
+    scmi_init();
 }
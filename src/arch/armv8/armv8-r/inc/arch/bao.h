@@ -8,7 +8,9 @@
 
 #define BAO_VAS_BASE CONFIG_HYP_BASE_ADDR
 #define PAGE_SIZE    (64)
+#ifndef STACK_SIZE
 #define STACK_SIZE   (0x1000)
+#endif
 
 #ifndef __ASSEMBLER__
 
@@ -49,9 +49,24 @@ typedef union {
 #define PTE_VM_FLAGS PTE_FLAGS(PRBAR_AP_RW_EL1_EL2 | PRBAR_SH_IS, PRLAR_ATTR(1) | PRLAR_EN)
 #define PTE_VM_DEV_FLAGS \
     PTE_FLAGS(PRBAR_XN | PRBAR_AP_RW_EL1_EL2 | PRBAR_SH_IS, PRLAR_ATTR(2) | PRLAR_EN)
+#define PTE_VM_RO_FLAGS PTE_FLAGS(PRBAR_AP_RO_EL1_EL2 | PRBAR_SH_IS, PRLAR_ATTR(1) | PRLAR_EN)
+/* There is no spare attribute for inner only caching, so such vm memory is left cacheable */
+#define PTE_VM_NC_FLAGS    PTE_FLAGS(PRBAR_AP_RW_EL1_EL2 | PRBAR_SH_IS, PRLAR_ATTR(3) | PRLAR_EN)
+#define PTE_VM_INNER_FLAGS PTE_VM_FLAGS
 
 #define MPU_ARCH_MAX_NUM_ENTRIES (64)
 
+static inline bool mem_flags_equal(mem_flags_t f1, mem_flags_t f2)
+{
+    return (f1.prbar == f2.prbar) && (f1.prlar == f2.prlar);
+}
+
+/* Whether the flags let the vm write, the read-only permissions all having this bit set */
+static inline bool mem_flags_writable(mem_flags_t flags)
+{
+    return (flags.prbar & PRBAR_AP_RO_EL2) == 0;
+}
+
 static inline const size_t mpu_granularity()
 {
     return (size_t)PAGE_SIZE;
@@ -9,9 +9,7 @@
 #include <bao.h>
 #include <arch/sysregs.h>
 #include <bitmap.h>
-#include <list.h>
 #include <mem.h>
-#include <list.h>
 
 struct cpu_arch_profile {
     struct {
@@ -25,15 +23,28 @@ struct cpu_arch_profile {
             perms_t el1;
         } perms[MPU_ARCH_MAX_NUM_ENTRIES];
         /**
-         * We maintain an ordered list of the regions currently in the mpu to simplify the merging
-         * algorithm when mapping an overllaping region.
+         * Entries only accessible by the guest may be evicted when the mpu runs out of entries,
+         * the one written the longest ago first. The age of an entry is the clock value when it
+         * was last written.
+         */
+        uint64_t clock;
+        uint64_t age[MPU_ARCH_MAX_NUM_ENTRIES];
+        /**
+         * Shadow copy of the prbar and prlar values written to each entry, so that looking up the
+         * regions never needs to select and read back the entries.
+         */
+        struct {
+            unsigned long prbar[MPU_ARCH_MAX_NUM_ENTRIES];
+            unsigned long prlar[MPU_ARCH_MAX_NUM_ENTRIES];
+        } shadow;
+        /**
+         * We maintain an array of the entries currently in the mpu sorted by base address to
+         * simplify the merging algorithm when mapping an overllaping region, and to look up
+         * regions by binary search.
          */
         struct {
-            struct list list;
-            struct mpu_node {
-                node_t node;
-                mpid_t mpid;
-            } node[MPU_ARCH_MAX_NUM_ENTRIES];
+            size_t num;
+            mpid_t mpid[MPU_ARCH_MAX_NUM_ENTRIES];
         } order;
     } mpu;
 };
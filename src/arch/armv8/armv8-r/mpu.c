@@ -15,10 +15,8 @@ static inline const size_t mpu_num_entries()
 
 static void mpu_entry_get_region(mpid_t mpid, struct mp_region* mpe)
 {
-    sysreg_prselr_el2_write(mpid);
-    ISB();
-    unsigned long prbar = sysreg_prbar_el2_read();
-    unsigned long prlar = sysreg_prlar_el2_read();
+    unsigned long prbar = cpu()->arch.profile.mpu.shadow.prbar[mpid];
+    unsigned long prlar = cpu()->arch.profile.mpu.shadow.prlar[mpid];
     mpe->mem_flags.prbar = PRBAR_FLAGS(prbar);
     mpe->mem_flags.prlar = PRLAR_FLAGS(prlar);
     mpe->base = PRBAR_BASE(prbar);
@@ -26,65 +24,131 @@ static void mpu_entry_get_region(mpid_t mpid, struct mp_region* mpe)
     mpe->as_sec = SEC_UNKNOWN;
 }
 
-static int mpu_node_cmp(node_t* _n1, node_t* _n2)
+static inline vaddr_t mpu_entry_base(mpid_t mpid)
 {
-    struct mpu_node* n1 = (struct mpu_node*)_n1;
-    struct mpu_node* n2 = (struct mpu_node*)_n2;
-    struct mp_region r1;
-    struct mp_region r2;
-    mpu_entry_get_region(n1->mpid, &r1);
-    mpu_entry_get_region(n2->mpid, &r2);
-    if (r1.base > r2.base) {
-        return 1;
-    } else if (r1.base < r2.base) {
-        return -1;
-    } else {
-        return 0;
+    return PRBAR_BASE(cpu()->arch.profile.mpu.shadow.prbar[mpid]);
+}
+
+/**
+ * Returns the position in the order of the first entry whose base is not below addr.
+ */
+static size_t mpu_order_lower_bound(vaddr_t addr)
+{
+    size_t low = 0;
+    size_t high = cpu()->arch.profile.mpu.order.num;
+
+    while (low < high) {
+        size_t mid = low + ((high - low) / 2);
+        if (mpu_entry_base(cpu()->arch.profile.mpu.order.mpid[mid]) < addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Returns the position in the order of the first entry that may overlap a region starting at
+ * addr, i.e., the last one starting below it, as the regions in the mpu never overlap.
+ */
+static inline size_t mpu_order_search_start(vaddr_t addr)
+{
+    size_t i = mpu_order_lower_bound(addr);
+    return (i > 0) ? i - 1 : 0;
+}
+
+/**
+ * Returns the position of an entry in the order, or the number of ordered entries if it is not
+ * there.
+ */
+static size_t mpu_order_find(mpid_t mpid)
+{
+    size_t i = mpu_order_lower_bound(mpu_entry_base(mpid));
+
+    while ((i < cpu()->arch.profile.mpu.order.num) &&
+        (cpu()->arch.profile.mpu.order.mpid[i] != mpid)) {
+        i++;
+    }
+
+    return i;
+}
+
+static void mpu_order_insert(mpid_t mpid)
+{
+    mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+    size_t pos = mpu_order_lower_bound(mpu_entry_base(mpid));
+
+    for (size_t i = cpu()->arch.profile.mpu.order.num; i > pos; i--) {
+        order[i] = order[i - 1];
+    }
+    order[pos] = mpid;
+    cpu()->arch.profile.mpu.order.num++;
+}
+
+static void mpu_order_remove(mpid_t mpid)
+{
+    mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+    size_t num = cpu()->arch.profile.mpu.order.num;
+    size_t pos = mpu_order_find(mpid);
+
+    if (pos < num) {
+        for (size_t i = pos; i < (num - 1); i++) {
+            order[i] = order[i + 1];
+        }
+        cpu()->arch.profile.mpu.order.num--;
     }
 }
 
 static void mpu_entry_set(mpid_t mpid, struct mp_region* mpr)
 {
     unsigned long lim = mpr->base + mpr->size - 1;
+    unsigned long prbar = (mpr->base & PRBAR_BASE_MSK) | mpr->mem_flags.prbar;
+    unsigned long prlar = (lim & PRLAR_LIMIT_MSK) | mpr->mem_flags.prlar;
 
     sysreg_prselr_el2_write(mpid);
     ISB();
-    sysreg_prbar_el2_write((mpr->base & PRBAR_BASE_MSK) | mpr->mem_flags.prbar);
-    sysreg_prlar_el2_write((lim & PRLAR_LIMIT_MSK) | mpr->mem_flags.prlar);
+    sysreg_prbar_el2_write(prbar);
+    sysreg_prlar_el2_write(prlar);
+    cpu()->arch.profile.mpu.shadow.prbar[mpid] = prbar;
+    cpu()->arch.profile.mpu.shadow.prlar[mpid] = prlar;
+    cpu()->arch.profile.mpu.age[mpid] = ++cpu()->arch.profile.mpu.clock;
 
-    list_insert_ordered(&cpu()->arch.profile.mpu.order.list,
-        (node_t*)&cpu()->arch.profile.mpu.order.node[mpid], mpu_node_cmp);
+    mpu_order_insert(mpid);
 }
 
 static void mpu_entry_modify(mpid_t mpid, struct mp_region* mpr)
 {
-    list_rm(&cpu()->arch.profile.mpu.order.list, (node_t*)&cpu()->arch.profile.mpu.order.node[mpid]);
+    mpu_order_remove(mpid);
 
     mpu_entry_set(mpid, mpr);
 }
 
 static bool mpu_entry_clear(mpid_t mpid)
 {
-    list_rm(&cpu()->arch.profile.mpu.order.list, (node_t*)&cpu()->arch.profile.mpu.order.node[mpid]);
+    mpu_order_remove(mpid);
 
     sysreg_prselr_el2_write(mpid);
     ISB();
     sysreg_prlar_el2_write(0);
     sysreg_prbar_el2_write(0);
+    cpu()->arch.profile.mpu.shadow.prlar[mpid] = 0;
+    cpu()->arch.profile.mpu.shadow.prbar[mpid] = 0;
     return true;
 }
 
 static inline void mpu_entry_free(mpid_t mpid)
 {
     mpu_entry_clear(mpid);
+    cpu()->arch.profile.mpu.perms[mpid].el1 = PERM_NONE;
+    cpu()->arch.profile.mpu.perms[mpid].el2 = PERM_NONE;
     bitmap_clear(cpu()->arch.profile.mpu.bitmap, mpid);
 }
 
 static inline bool mpu_entry_valid(mpid_t mpid)
 {
-    sysreg_prselr_el2_write(mpid);
-    ISB();
-    return !!(sysreg_prlar_el2_read() & PRLAR_EN);
+    return !!(cpu()->arch.profile.mpu.shadow.prlar[mpid] & PRLAR_EN);
 }
 
 static inline bool mpu_entry_locked(mpid_t mpid)
@@ -148,12 +212,80 @@ static inline bool mpu_perms_equivalent(struct mpu_perms* p1, struct mpu_perms*
 
 static inline mem_attrs_t mpu_entry_attrs(struct mp_region* mpr)
 {
-    mem_flags_t flags = mpr->mem_flags;
-    flags.prbar &= PRBAR_MEM_ATTR_FLAGS_MSK;
-    flags.prbar &= PRLAR_MEM_ATTR_FLAGS_MSK;
+    mem_flags_t flags = { .raw = 0 };
+    flags.prbar = mpr->mem_flags.prbar & PRBAR_MEM_ATTR_FLAGS_MSK;
+    flags.prlar = mpr->mem_flags.prlar & PRLAR_MEM_ATTR_FLAGS_MSK;
     return (mem_attrs_t)flags.raw;
 }
 
+static bool mpu_entry_mergeable(mpid_t mpid, struct mp_region* mpr, struct mpu_perms* perms)
+{
+    struct mp_region reg;
+
+    if ((mpid == INVALID_MPID) || mpu_entry_locked(mpid)) {
+        return false;
+    }
+
+    mpu_entry_get_region(mpid, &reg);
+    bool adjacent = ((reg.base + reg.size) == mpr->base) || ((mpr->base + mpr->size) == reg.base);
+    return adjacent && (mpu_entry_attrs(&reg) == mpu_entry_attrs(mpr)) &&
+        mpu_perms_equivalent(&cpu()->arch.profile.mpu.perms[mpid], perms);
+}
+
+/**
+ * Coalesce an entry with the entries right before and after it in the mpu, if they are adjacent
+ * and have the exact same permissions and memory attributes. This is needed after an entry is
+ * split or has its permissions changed, as mpu_map only merges regions it maps from scratch.
+ */
+static void mpu_entry_merge(mpid_t mpid)
+{
+    mpid_t prev = INVALID_MPID;
+    mpid_t next = INVALID_MPID;
+    struct mp_region reg;
+
+    if ((mpid == INVALID_MPID) || mpu_entry_locked(mpid)) {
+        return;
+    }
+
+    mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+    size_t num = cpu()->arch.profile.mpu.order.num;
+    size_t pos = mpu_order_find(mpid);
+    if (pos >= num) {
+        return;
+    }
+    if (pos > 0) {
+        prev = order[pos - 1];
+    }
+    if ((pos + 1) < num) {
+        next = order[pos + 1];
+    }
+
+    mpu_entry_get_region(mpid, &reg);
+    struct mpu_perms* perms = &cpu()->arch.profile.mpu.perms[mpid];
+    bool merged = false;
+
+    if (mpu_entry_mergeable(prev, &reg, perms)) {
+        struct mp_region r;
+        mpu_entry_get_region(prev, &r);
+        reg.base = r.base;
+        reg.size += r.size;
+        mpu_entry_free(prev);
+        merged = true;
+    }
+
+    if (mpu_entry_mergeable(next, &reg, perms)) {
+        struct mp_region r;
+        mpu_entry_get_region(next, &r);
+        reg.size += r.size;
+        mpu_entry_free(next);
+        merged = true;
+    }
+
+    if (merged) {
+        mpu_entry_modify(mpid, &reg);
+    }
+}
+
 static mpid_t mpu_entry_allocate()
 {
     mpid_t reg_num = INVALID_MPID;
@@ -232,9 +364,10 @@ bool mpu_map(priv_t priv, struct mp_region* mpr)
         bottom_mpid = INVALID_MPID;
         top_mpid = INVALID_MPID;
 
-        struct list* mpu_order_list = &cpu()->arch.profile.mpu.order.list;
-        list_foreach ((*mpu_order_list), struct mpu_node, entry) {
-            mpid_t mpid = entry->mpid;
+        mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+        for (size_t i = mpu_order_search_start(new_reg->base);
+             i < cpu()->arch.profile.mpu.order.num; i++) {
+            mpid_t mpid = order[i];
             struct mp_region overlapped_reg;
 
             mpu_entry_get_region(mpid, &overlapped_reg);
@@ -359,6 +492,8 @@ bool mpu_map(priv_t priv, struct mp_region* mpr)
                 mpu_entry_set(top_mpid, &top);
             }
 
+            mpu_entry_merge(mpid);
+
             if (bottom_left > 0) {
                 reg1_valid = true;
                 reg1.base = new_reg->base;
@@ -442,7 +577,8 @@ bool mpu_map(priv_t priv, struct mp_region* mpr)
             } else {
                 mpid_t mpid = mpu_entry_allocate();
                 if (mpid == INVALID_MPID) {
-                    ERROR("failed to allocate mpu entry");
+                    failed = true;
+                    break;
                 }
                 mpu_entry_update_priv_perms(priv, mpid, new_perms);
                 mpu_entry_set(mpid, new_reg);
@@ -472,20 +608,21 @@ bool mpu_unmap(priv_t priv, struct mp_region* mpr)
         mpid_t mpid = INVALID_MPID;
         struct mp_region reg;
 
-        struct list* mpu_order_list = &cpu()->arch.profile.mpu.order.list;
-        list_foreach ((*mpu_order_list), struct mpu_node, entry) {
-            mpu_entry_get_region(entry->mpid, &reg);
+        mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+        for (size_t i = mpu_order_search_start(mpr->base); i < cpu()->arch.profile.mpu.order.num;
+             i++) {
+            mpu_entry_get_region(order[i], &reg);
 
             if ((mpr->base + mpr->size) < reg.base) {
                 break;
             }
 
-            if (!mpu_entry_has_priv(entry->mpid, priv)) {
+            if (!mpu_entry_has_priv(order[i], priv)) {
                 continue;
             }
 
             if (mem_regions_overlap(&reg, mpr)) {
-                mpid = entry->mpid;
+                mpid = order[i];
                 break;
             }
         }
@@ -514,40 +651,104 @@ bool mpu_unmap(priv_t priv, struct mp_region* mpr)
             mpu_entry_free(mpid);
         }
 
+        mpid_t top_mpid = INVALID_MPID;
         if (top_size > 0) {
             struct mp_region top = reg;
             top.base = mpr_limit;
             top.size = top_size;
-            mpid_t top_mpid = mpu_entry_allocate();
+            top_mpid = mpu_entry_allocate();
+            if (top_mpid == INVALID_MPID) {
+                ERROR("failed to allocate mpu entry");
+            }
             cpu()->arch.profile.mpu.perms[top_mpid] = orig_perms;
             mpu_entry_set(top_mpid, &top);
         }
 
+        mpid_t bottom_mpid = INVALID_MPID;
         if (bottom_size > 0) {
             struct mp_region bottom = reg;
             bottom.size = bottom_size;
-            mpid_t bottom_mpid = mpu_entry_allocate();
+            bottom_mpid = mpu_entry_allocate();
+            if (bottom_mpid == INVALID_MPID) {
+                ERROR("failed to allocate mpu entry");
+            }
             cpu()->arch.profile.mpu.perms[bottom_mpid] = orig_perms;
             mpu_entry_set(bottom_mpid, &bottom);
         }
 
+        /**
+         * Once a privilege is unmapped from a shared region, what is left of it may now match its
+         * neighbours. The split off pieces keep the original permissions, so they can never merge
+         * back with the updated entry.
+         */
+        if (update_perms) {
+            mpu_entry_merge(mpid);
+        }
+        mpu_entry_merge(top_mpid);
+        mpu_entry_merge(bottom_mpid);
+
         size_t overlap_size = reg.size - top_size - bottom_size;
         size_left -= overlap_size;
     }
 
-    // TODO: check if we can merge new regions after unmapping a given privilege from a shared
-    // region
-
     return size_left == 0;
 }
 
+bool mpu_mapped(priv_t priv, vaddr_t addr)
+{
+    bool mapped = false;
+    size_t pos = mpu_order_lower_bound(addr + 1);
+
+    /* The only entry that may contain addr is the last one starting at or below it */
+    if (pos > 0) {
+        mpid_t mpid = cpu()->arch.profile.mpu.order.mpid[pos - 1];
+        struct mp_region reg;
+        mpu_entry_get_region(mpid, &reg);
+        if (addr < (reg.base + reg.size)) {
+            mapped = mpu_entry_has_priv(mpid, priv);
+        }
+    }
+
+    return mapped;
+}
+
+bool mpu_evict(priv_t priv)
+{
+    mpid_t victim = INVALID_MPID;
+
+    for (size_t i = 0; i < cpu()->arch.profile.mpu.order.num; i++) {
+        mpid_t mpid = cpu()->arch.profile.mpu.order.mpid[i];
+        struct mpu_perms* perms = &cpu()->arch.profile.mpu.perms[mpid];
+        perms_t other_perms = (priv == PRIV_VM) ? perms->el2 : perms->el1;
+
+        if (mpu_entry_locked(mpid) || !mpu_entry_has_priv(mpid, priv) ||
+            (other_perms != PERM_NONE)) {
+            continue;
+        }
+
+        if ((victim == INVALID_MPID) ||
+            (cpu()->arch.profile.mpu.age[mpid] < cpu()->arch.profile.mpu.age[victim])) {
+            victim = mpid;
+        }
+    }
+
+    if (victim != INVALID_MPID) {
+        mpu_entry_free(victim);
+    }
+
+    return victim != INVALID_MPID;
+}
+
 void mpu_init()
 {
     bitmap_clear_consecutive(cpu()->arch.profile.mpu.bitmap, 0, mpu_num_entries());
-    list_init(&cpu()->arch.profile.mpu.order.list);
+    cpu()->arch.profile.mpu.order.num = 0;
 
     for (mpid_t mpid = 0; mpid < mpu_num_entries(); mpid++) {
-        cpu()->arch.profile.mpu.order.node[mpid].mpid = mpid;
+        sysreg_prselr_el2_write(mpid);
+        ISB();
+        cpu()->arch.profile.mpu.shadow.prbar[mpid] = sysreg_prbar_el2_read();
+        cpu()->arch.profile.mpu.shadow.prlar[mpid] = sysreg_prlar_el2_read();
 
         if (mpu_entry_valid(mpid)) {
             bitmap_set(cpu()->arch.profile.mpu.bitmap, mpid);
@@ -560,8 +761,7 @@ void mpu_init()
             cpu()->arch.profile.mpu.perms[mpid].el1 = PERM_NONE;
             cpu()->arch.profile.mpu.perms[mpid].el2 = PERM_RWX;
 
-            list_insert_ordered(&cpu()->arch.profile.mpu.order.list,
-                (node_t*)&cpu()->arch.profile.mpu.order.node[mpid], mpu_node_cmp);
+            mpu_order_insert(mpid);
         }
     }
 }
@@ -22,3 +22,18 @@ int32_t psci_power_down(enum wakeup_reason reason)
 {
     return psci_standby();
 }
+
+int32_t psci_standby_state(uint32_t power_state)
+{
+    return psci_standby();
+}
+
+int32_t psci_power_down_state(uint32_t power_state, enum wakeup_reason reason)
+{
+    return psci_standby();
+}
+
+int32_t psci_system_reset_warm(void)
+{
+    return PSCI_E_NOT_SUPPORTED;
+}
@@ -7,6 +7,8 @@
 #include <cpu.h>
 #include <vm.h>
 #include <platform.h>
+#include <hypercall.h>
+#include <arch/smcc.h>
 
 void cpu_defines() __attribute__((used));
 void cpu_defines()
@@ -24,9 +26,16 @@ void vcpu_defines()
 {
     DEFINE_SIZE(VCPU_ARCH_SIZE, struct vcpu_arch);
     DEFINE_OFFSET(VCPU_REGS_OFF, struct vcpu, regs);
+    DEFINE_OFFSET(VCPU_FULL_EXITS_OFF, struct vcpu, full_exits);
     DEFINE_SIZE(VCPU_REGS_SIZE, struct arch_regs);
 }
 
+void hypercall_defines() __attribute__((used));
+void hypercall_defines()
+{
+    DEFINE_VALUE(HC_IPC_FID, SMCC64_FID_VND_HYP_SRVC | HC_IPC);
+}
+
 void platform_defines() __attribute__((used));
 void platform_defines()
 {
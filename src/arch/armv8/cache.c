@@ -8,6 +8,7 @@
 #include <fences.h>
 #include <bit.h>
 #include <platform.h>
+#include <spinlock.h>
 
 void cache_arch_enumerate(struct cache* dscrp)
 {
@@ -96,16 +97,89 @@ void cache_arch_enumerate(struct cache* dscrp)
     }
 }
 
-void cache_flush_range(vaddr_t base, size_t size)
+/**
+ * A cpu's scheme id tags its allocations in the DSU L3, which are restricted to the way groups
+ * enabled for that scheme id in CLUSTERPARTCR. The register is shared by all cpus in the cluster,
+ * so its updates are serialized. The groups previously enabled for the scheme id are dropped, so
+ * that a vm's ways can be changed at run time.
+ */
+static spinlock_t cache_partcr_lock = SPINLOCK_INITVAL;
+
+bool cache_arch_partition(size_t part_id, uint32_t way_groups)
 {
-    vaddr_t cache_addr = base;
-    uint64_t ctr = sysreg_ctr_el0_read();
-    size_t min_line_size = 1UL << bit64_extract(ctr, CTR_DMINLINE_OFF, CTR_DMINLINE_LEN);
+    if (!platform.arch.dsu || (part_id >= CLUSTERPARTCR_SID_NUM) ||
+        ((way_groups & ~BIT_MASK(0, CLUSTERPARTCR_GROUP_NUM)) != 0)) {
+        return false;
+    }
 
-    while (cache_addr < (base + size)) {
-        arm_dc_civac(cache_addr);
-        cache_addr += min_line_size;
+    unsigned long partcr = 0;
+    unsigned long sid_mask = 0;
+    for (size_t group = 0; group < CLUSTERPARTCR_GROUP_NUM; group++) {
+        sid_mask |= CLUSTERPARTCR_GROUP_SID(group, part_id);
+        if ((way_groups & (1UL << group)) != 0) {
+            partcr |= CLUSTERPARTCR_GROUP_SID(group, part_id);
+        }
     }
 
-    DMB(ish);
+    spin_lock(&cache_partcr_lock);
+    sysreg_clusterpartcr_el1_write((sysreg_clusterpartcr_el1_read() & ~sid_mask) | partcr);
+    spin_unlock(&cache_partcr_lock);
+
+    sysreg_clusterthreadsid_el1_write(part_id);
+    ISB();
+
+    return true;
+}
+
+/**
+ * CTR.DminLine holds the log2 of the number of words in the smallest data cache line. It is read
+ * once and cached since some implementations trap CTR accesses or make them slow.
+ */
+static size_t cache_dminline_size;
+
+static inline size_t cache_dminline()
+{
+    if (cache_dminline_size == 0) {
+        uint64_t ctr = sysreg_ctr_el0_read();
+        cache_dminline_size = 4UL << bit64_extract(ctr, CTR_DMINLINE_OFF, CTR_DMINLINE_LEN);
+    }
+    return cache_dminline_size;
+}
+
+/**
+ * Maintenance by VA to the point of coherency. Using set/way operations for large ranges would be
+ * unsafe, as they are not broadcast and race with other cpus' allocations, so all ranges are
+ * walked by line.
+ */
+#define CACHE_RANGE_OP(base, size, op)                                            \
+    do {                                                                          \
+        size_t line_size = cache_dminline();                                      \
+        vaddr_t cache_addr = (base) & ~((vaddr_t)line_size - 1);                  \
+        while (cache_addr < ((base) + (size))) {                                  \
+            op(cache_addr);                                                       \
+            cache_addr += line_size;                                              \
+        }                                                                         \
+        DMB(ish);                                                                 \
+    } while (0)
+
+void cache_flush_range(vaddr_t base, size_t size)
+{
+    CACHE_RANGE_OP(base, size, arm_dc_civac);
+}
+
+void cache_clean_range(vaddr_t base, size_t size)
+{
+    CACHE_RANGE_OP(base, size, arm_dc_cvac);
+}
+
+void cache_inv_range(vaddr_t base, size_t size)
+{
+    CACHE_RANGE_OP(base, size, arm_dc_ivac);
+}
+
+void cache_inv_icache(void)
+{
+    arm_ic_iallu();
+    DSB(nsh);
+    ISB();
 }
@@ -7,14 +7,41 @@
 #include <cpu.h>
 #include <platform.h>
 #include <arch/sysregs.h>
+#include <arch/pmu.h>
+#include <arch/psci.h>
 
 cpuid_t CPU_MASTER __attribute__((section(".data")));
 
+#ifdef AARCH64
+bool spinlock_lse = false;
+
+/**
+ * The lse lock variant is enabled by the master. All cpus must then implement the atomics, which
+ * the others confirm as soon as they start.
+ */
+static void cpu_arch_lse_init(void)
+{
+    bool lse = bit64_extract(sysreg_id_aa64isar0_el1_read(), ID_AA64ISAR0_ATOMIC_OFF,
+                   ID_AA64ISAR0_ATOMIC_LEN) >= ID_AA64ISAR0_ATOMIC_LSE;
+
+    if (cpu_is_master()) {
+        spinlock_lse = lse;
+    } else if (spinlock_lse && !lse) {
+        ERROR("cpu %d does not implement the lse atomics used by the spinlocks", cpu()->id);
+    }
+}
+#endif
+
 /* Perform architecture dependent cpu cores initializations */
 void cpu_arch_init(cpuid_t cpuid, paddr_t load_addr)
 {
     cpu()->arch.mpidr = sysreg_mpidr_el1_read();
+#ifdef AARCH64
+    cpu_arch_lse_init();
+    cpu()->arch.fp_owner = NULL;
+#endif
     cpu_arch_profile_init(cpuid, load_addr);
+    pmu_init();
 }
 
 unsigned long cpu_id_to_mpidr(cpuid_t id)
@@ -22,6 +49,18 @@ unsigned long cpu_id_to_mpidr(cpuid_t id)
     return platform_arch_cpuid_to_mpidr(&platform, id);
 }
 
+void cpu_arch_standby()
+{
+    asm volatile("wfi\n\r" ::: "memory");
+}
+
+/* Only returns if the firmware refuses the warm reset, or has none */
+bool cpu_arch_warm_reset(void)
+{
+    (void)psci_system_reset_warm();
+    return false;
+}
+
 void cpu_arch_idle()
 {
     cpu_arch_profile_idle();
@@ -17,7 +17,10 @@
 #include <cpu.h>
 #include <spinlock.h>
 #include <platform.h>
+#include <trace.h>
+#include <membw.h>
 #include <fences.h>
+#include <vm.h>
 
 volatile struct gicd_hw* gicd;
 spinlock_t gicd_lock;
@@ -89,20 +92,48 @@ void gic_init()
     gic_cpu_init();
 }
 
-void gic_handle()
+static void gic_handle_irq(void)
 {
     uint32_t ack = gicc_iar();
     irqid_t id = bit32_extract(ack, GICC_IAR_ID_OFF, GICC_IAR_ID_LEN);
 
     if (id < GIC_FIRST_SPECIAL_INTID) {
+        uint64_t trace_start = trace_exit_begin();
+        struct vcpu_exit_stamp exit_stamp = vcpu_exit_begin();
         enum irq_res res = interrupts_handle(id);
         gicc_eoir(ack);
         if (res == HANDLED_BY_HYP) {
             gicc_dir(ack);
         }
+        vcpu_exit_end(exit_stamp);
+        stats_inc(STATS_EXITS_IRQ);
+        trace_exit_end(TRACE_EXIT_IRQ, id, 0, trace_start);
     }
 }
 
+__hot void gic_handle()
+{
+    /* The guest may have changed the list registers since the vgic last cached them */
+    if (cpu()->vcpu != NULL) {
+        vgic_lr_cache_invalidate(cpu()->vcpu);
+    }
+
+    gic_handle_irq();
+
+    /**
+     * A vcpu that exhausted its memory bandwidth budget does not return to the guest until the
+     * next regulation period. Meanwhile, the cpu keeps servicing its interrupts here, which are
+     * masked at EL2 but still wake it from wfi. Interrupts forwarded to the guest stay pending in
+     * the list registers.
+     */
+    while (membw_throttled()) {
+        cpu_arch_standby();
+        gic_handle_irq();
+    }
+
+    vcpu_check_restart();
+}
+
 uint8_t gicd_get_prio(irqid_t int_id)
 {
     size_t reg_ind = GIC_PRIO_REG(int_id);
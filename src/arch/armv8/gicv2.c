@@ -131,27 +131,43 @@ void gic_send_sgi(cpuid_t cpu_target, irqid_t sgi_num)
     }
 }
 
-static inline uint8_t gic_translate_cpu_to_trgt(uint8_t cpu_targets)
+/**
+ * Converts the cpus to their gic cpu interface numbers, so that a single SGIR write reaches all
+ * targets. Cpus beyond the interfaces the distributor can target are ignored.
+ */
+static inline uint8_t gic_translate_cpu_to_trgt(const cpumask_t* cpu_targets)
 {
     uint8_t gic_targets = 0;
-    for (size_t i = 0; i < GIC_MAX_TARGETS; i++) {
-        if ((1 << i) & cpu_targets) {
-            gic_targets |= (1 << gic_cpu_map[i]);
+    cpumask_foreach(cpu_targets, cpu)
+    {
+        if (cpu >= GIC_MAX_TARGETS) {
+            break;
         }
+        gic_targets |= (uint8_t)(1U << gic_cpu_map[cpu]);
     }
     return gic_targets;
 }
 
+void gic_send_sgi_mask(const cpumask_t* cpu_targets, irqid_t sgi_num)
+{
+    uint8_t gic_targets = gic_translate_cpu_to_trgt(cpu_targets);
+    if (sgi_num < GIC_MAX_SGIS && gic_targets != 0) {
+        gicd->SGIR = ((unsigned long)gic_targets << GICD_SGIR_CPUTRGLST_OFF) |
+            (sgi_num & GICD_SGIR_SGIINTID_MSK);
+    }
+}
+
 void gicd_set_trgt(irqid_t int_id, uint8_t cpu_targets)
 {
     size_t reg_ind = GIC_TARGET_REG(int_id);
     size_t off = GIC_TARGET_OFF(int_id);
     uint32_t mask = BIT32_MASK(off, GIC_TARGET_BITS);
+    cpumask_t targets = cpumask_from_map(cpu_targets);
 
     spin_lock(&gicd_lock);
 
     gicd->ITARGETSR[reg_ind] = (gicd->ITARGETSR[reg_ind] & ~mask) |
-        ((gic_translate_cpu_to_trgt(cpu_targets) << off) & mask);
+        (((uint32_t)gic_translate_cpu_to_trgt(&targets) << off) & mask);
 
     spin_unlock(&gicd_lock);
 }
@@ -215,14 +215,54 @@ void gicd_set_route(irqid_t int_id, unsigned long route)
     spin_unlock(&gicd_lock);
 }
 
+/**
+ * An ICC_SGI1R write targets the cpus of a single cluster whose Aff0 fall in the same range of 16,
+ * selected by RS. Returns the cpu's cluster and range fields, setting its bit in the target list.
+ * We only support two affinity levels.
+ */
+static inline uint64_t gic_sgi_route(cpuid_t cpu, uint64_t* trgtlist)
+{
+    unsigned long mpidr = cpu_id_to_mpidr(cpu) & MPIDR_AFF_MSK;
+    unsigned long aff0 = MPIDR_AFF_LVL(mpidr, 0);
+
+    *trgtlist |= 1UL << (aff0 % ICC_SGIR_RS_CPUS);
+    return (MPIDR_AFF_LVL(mpidr, 1) << ICC_SGIR_AFF1_OFFSET) |
+        ((uint64_t)(aff0 / ICC_SGIR_RS_CPUS) << ICC_SGIR_RS_OFFSET);
+}
+
 void gic_send_sgi(cpuid_t cpu_target, irqid_t sgi_num)
 {
     if (sgi_num < GIC_MAX_SGIS) {
-        unsigned long mpidr = cpu_id_to_mpidr(cpu_target) & MPIDR_AFF_MSK;
-        /* We only support two affinity levels */
-        uint64_t sgi = (MPIDR_AFF_LVL(mpidr, 1) << ICC_SGIR_AFF1_OFFSET) |
-            (1UL << MPIDR_AFF_LVL(mpidr, 0)) | (sgi_num << ICC_SGIR_SGIINTID_OFF);
-        sysreg_icc_sgi1r_el1_write(sgi);
+        uint64_t trgtlist = 0;
+        uint64_t route = gic_sgi_route(cpu_target, &trgtlist);
+        sysreg_icc_sgi1r_el1_write(route | trgtlist | (sgi_num << ICC_SGIR_SGIINTID_OFF));
+    }
+}
+
+void gic_send_sgi_mask(const cpumask_t* cpu_mask, irqid_t sgi_num)
+{
+    if (sgi_num >= GIC_MAX_SGIS) {
+        return;
+    }
+
+    cpumask_t cpu_targets = *cpu_mask;
+
+    /* Issue one write per cluster and range with targets in the mask */
+    for (cpuid_t first = cpumask_next(&cpu_targets, 0); first < PLAT_CPU_NUM;
+         first = cpumask_next(&cpu_targets, first + 1)) {
+        uint64_t trgtlist = 0;
+        uint64_t route = gic_sgi_route(first, &trgtlist);
+
+        for (cpuid_t cpu = cpumask_next(&cpu_targets, first + 1); cpu < PLAT_CPU_NUM;
+             cpu = cpumask_next(&cpu_targets, cpu + 1)) {
+            uint64_t cpu_trgt = 0;
+            if (gic_sgi_route(cpu, &cpu_trgt) == route) {
+                trgtlist |= cpu_trgt;
+                cpumask_clear(&cpu_targets, cpu);
+            }
+        }
+
+        sysreg_icc_sgi1r_el1_write(route | trgtlist | (sgi_num << ICC_SGIR_SGIINTID_OFF));
     }
 }
 
@@ -14,6 +14,12 @@
 struct cpu_arch {
     struct cpu_arch_profile profile;
     unsigned long mpidr;
+    unsigned long pmu_hyp_base;
+    unsigned long pmu_hyp_counters;
+#ifdef AARCH64
+    /* The vcpu whose state the fp/simd registers hold, see fp_vcpu_run */
+    struct vcpu* fp_owner;
+#endif
 };
 
 unsigned long cpu_id_to_mpidr(cpuid_t id);
@@ -0,0 +1,33 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_FP_H__
+#define __ARCH_FP_H__
+
+#include <bao.h>
+
+#define CPTR_TFP_BIT (1UL << 10)
+
+#ifndef __ASSEMBLER__
+
+struct fp_ctx {
+    uint64_t q[32][2];
+    uint64_t fpsr;
+    uint64_t fpcr;
+} __attribute__((aligned(16)));
+
+struct vcpu;
+
+void fp_ctx_save(struct fp_ctx* ctx);
+void fp_ctx_restore(struct fp_ctx* ctx);
+
+void fp_vcpu_init(struct vcpu* vcpu);
+void fp_vcpu_run(struct vcpu* vcpu);
+void fp_trap_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec);
+void fp_cpu_save(void);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* __ARCH_FP_H__ */
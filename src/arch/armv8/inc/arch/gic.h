@@ -10,6 +10,7 @@
 #include <emul.h>
 #include <bitmap.h>
 #include <spinlock.h>
+#include <cpumask.h>
 #include <arch/sysregs.h>
 
 #define GICV2                     (2)
@@ -30,6 +31,9 @@
 #define GIC_SGI_BITS              8
 #define GICD_IROUTER_INV          (~MPIDR_AFF_MSK)
 #define GIC_LOWEST_PRIO           (0xff)
+/* Every implementation has at least the 4 most significant priority bits */
+#define GIC_CRITICAL_PRIO         (0x00)
+#define GIC_HYP_PRIO              (0x10)
 
 #define GIC_INT_REG(NINT)         (NINT / (sizeof(uint32_t) * 8))
 #define GIC_INT_MASK(NINT)        (1U << NINT % (sizeof(uint32_t) * 8))
@@ -224,6 +228,8 @@ struct gicr_hw {
 #define ICC_SGIR_TRGLSTFLT_MSK   BIT64_MASK(ICC_SGIR_TRGLSTFLT_OFF, ICC_SGIR_TRGLSTFLT_LEN)
 #define ICC_SGIR_TRGLSTFLT(sgir) bit64_extract(sgir, ICC_SGIR_TRGLSTFLT_OFF, ICC_SGIR_TRGLSTFLT_LEN)
 #define ICC_SGIR_AFF1_OFFSET     (16)
+#define ICC_SGIR_RS_OFFSET       (44)
+#define ICC_SGIR_RS_CPUS         (16)
 
 #define ICC_SRE_ENB_BIT          (0x8)
 #define ICC_SRE_DIB_BIT          (0x4)
@@ -397,6 +403,7 @@ extern size_t NUM_LRS;
 void gic_init();
 void gic_cpu_init();
 void gic_send_sgi(cpuid_t cpu_target, irqid_t sgi_num);
+void gic_send_sgi_mask(const cpumask_t* cpu_targets, irqid_t sgi_num);
 
 void gicc_save_state(struct gicc_state* state);
 void gicc_restore_state(struct gicc_state* state);
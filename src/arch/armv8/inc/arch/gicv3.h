@@ -120,6 +120,16 @@ static inline void gich_set_hcr(uint32_t hcr)
     sysreg_ich_hcr_el2_write(hcr);
 }
 
+static inline uint32_t gich_get_vmcr()
+{
+    return sysreg_ich_vmcr_el2_read();
+}
+
+static inline void gich_set_vmcr(uint32_t vmcr)
+{
+    sysreg_ich_vmcr_el2_write(vmcr);
+}
+
 static inline uint32_t gich_get_misr()
 {
     return sysreg_ich_misr_el2_read();
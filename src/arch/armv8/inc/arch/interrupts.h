@@ -8,7 +8,14 @@
 
 #include <bao.h>
 
-#define IPI_CPU_MSG    1
+#define IPI_CPU_MSG 1
+
+/**
+ * Platforms whose gic implements fewer interrupts than the architectural maximum may lower this,
+ * which sizes the handler table and the interrupt bitmaps. Higher ids can then not be assigned.
+ */
+#ifndef MAX_INTERRUPTS
 #define MAX_INTERRUPTS GIC_MAX_INTERUPTS
+#endif
 
 #endif /* __ARCH_INTERRUPTS_H__ */
@@ -0,0 +1,65 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_MPAM_H__
+#define __ARCH_MPAM_H__
+
+#include <bao.h>
+
+#define ID_AA64PFR0_MPAM_OFF        40
+#define ID_AA64PFR0_MPAM_LEN        4
+
+#define MPAMIDR_PARTID_MAX_OFF      0
+#define MPAMIDR_PARTID_MAX_LEN      16
+#define MPAMIDR_HAS_HCR_BIT         (1UL << 17)
+#define MPAMIDR_VPMR_MAX_OFF        18
+#define MPAMIDR_VPMR_MAX_LEN        3
+
+#define MPAM2_PARTID_I_OFF          0
+#define MPAM2_PARTID_D_OFF          16
+#define MPAM2_PARTID(partid)                              \
+    (((unsigned long)(partid) << MPAM2_PARTID_I_OFF) | \
+        ((unsigned long)(partid) << MPAM2_PARTID_D_OFF))
+
+#define MPAMHCR_EL0_VPMEN_BIT       (1UL << 0)
+#define MPAMHCR_EL1_VPMEN_BIT       (1UL << 1)
+
+#define MPAMVPM_NUM                 8
+#define MPAMVPM_PARTIDS             4
+#define MPAMVPM_PARTID_LEN          16
+
+#define MPAMF_IDR_PARTID_MAX_OFF    0
+#define MPAMF_IDR_PARTID_MAX_LEN    16
+#define MPAMF_IDR_HAS_CPOR_PART_BIT (1ULL << 25)
+#define MPAMF_IDR_HAS_MBW_PART_BIT  (1ULL << 26)
+#define MPAMF_CPOR_IDR_CPBM_WD_OFF  0
+#define MPAMF_CPOR_IDR_CPBM_WD_LEN  16
+#define MPAMF_MBW_IDR_HAS_MAX_BIT   (1UL << 11)
+#define MPAMCFG_MBW_MAX_MAX_LEN     16
+
+#define MPAM_MSC_MAX                16
+#define MPAM_MSC_CPBM_MAX           (0x800)
+
+struct mpam_msc_hw {
+    uint64_t IDR;
+    uint8_t pad0[0x0030 - 0x0008];
+    uint32_t CPOR_IDR;
+    uint8_t pad1[0x0040 - 0x0034];
+    uint32_t MBW_IDR;
+    uint8_t pad2[0x0100 - 0x0044];
+    uint32_t PART_SEL;
+    uint8_t pad3[0x0208 - 0x0104];
+    uint32_t MBW_MAX;
+    uint8_t pad4[0x1000 - 0x020C];
+    uint32_t CPBM[MPAM_MSC_CPBM_MAX];
+} __attribute__((__packed__, aligned(PAGE_SIZE)));
+
+struct vcpu;
+struct vm;
+
+void mpam_init(void);
+void mpam_vcpu_init(struct vcpu* vcpu, struct vm* vm);
+
+#endif /* __ARCH_MPAM_H__ */
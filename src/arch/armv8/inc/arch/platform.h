@@ -8,7 +8,7 @@
 
 #include <bao.h>
 #ifdef MEM_PROT_MMU
-#include <arch/smmuv2.h>
+#include <arch/smmu.h>
 #endif
 
 struct arch_platform {
@@ -27,7 +27,22 @@ struct arch_platform {
         paddr_t base;
         irqid_t interrupt_id;
         streamid_t global_mask;
+        /**
+         * Invalidate the smmu's tlbs explicitly on stage 2 changes, for an smmu not receiving
+         * the cpus' broadcast tlb maintenance even if it supports it. Always done if it does not.
+         */
+        bool explicit_tlbi;
     } smmu;
+
+    /**
+     * The hypervisor's SCMI channel to the firmware, i.e., its shared memory and the function id
+     * of its doorbell smc, through which the vms' performance requests are forwarded.
+     */
+    struct {
+        paddr_t shmem_addr;
+        size_t shmem_size;
+        uint32_t smc_id;
+    } scmi;
 #endif
 
     struct {
@@ -38,6 +53,36 @@ struct arch_platform {
         size_t num;
         size_t* core_num;
     } clusters;
+
+    /**
+     * The clusters are DynamIQ clusters whose DSU L3 can be partitioned by ways among scheme ids.
+     */
+    bool dsu;
+
+    /**
+     * The memory system components, e.g. caches and memory controllers, implementing MPAM
+     * partitioning controls.
+     */
+    struct {
+        size_t msc_num;
+        paddr_t* msc_addr;
+    } mpam;
+
+    /**
+     * The cpu low-power states the firmware offers through PSCI CPU_SUSPEND, ordered from the
+     * shallowest to the deepest, as the idle states of the board's device tree. Entering a state
+     * is only worth it if the cpu stays there at least min_residency_us microseconds, and waking
+     * up from it takes up to exit_latency_us. Without states, guest suspends are handled as a wait
+     * for interrupt, or a core powerdown if the guest requests a powerdown state.
+     */
+    struct {
+        size_t state_num;
+        struct psci_pwr_state {
+            uint32_t power_state;
+            uint32_t exit_latency_us;
+            uint32_t min_residency_us;
+        }* states;
+    } psci;
 };
 
 struct platform;
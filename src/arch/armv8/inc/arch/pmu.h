@@ -0,0 +1,40 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_PMU_H__
+#define __ARCH_PMU_H__
+
+#include <bao.h>
+
+/**
+ * Number of topmost event counters reserved for the hypervisor through mdcr_el2.hpmn. The guest
+ * running on the cpu gets all the others plus the cycle counter. The first one counts the memory
+ * bandwidth budget of regulated vms, profiling builds need two more for instructions and cycles.
+ */
+#ifndef PMU_HYP_COUNTERS
+#ifdef PROF
+#define PMU_HYP_COUNTERS (3)
+#else
+#define PMU_HYP_COUNTERS (1)
+#endif
+#endif
+
+/* Indexes of the hypervisor's counters, relative to cpu()->arch.pmu_hyp_base */
+#define PMU_HYP_CNT_MEMBW  (0)
+#define PMU_HYP_CNT_INSTRS (1)
+#define PMU_HYP_CNT_CYCLES (2)
+
+/**
+ * The performance monitors overflow PPI as recommended by the Server Base System Architecture. It
+ * may be overridden by the platform.
+ */
+#ifndef PMU_PPI_ID
+#define PMU_PPI_ID (23)
+#endif
+
+void pmu_init(void);
+void pmu_guest_reset(void);
+
+#endif /* __ARCH_PMU_H__ */
@@ -0,0 +1,45 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_PROF_H__
+#define __ARCH_PROF_H__
+
+#include <bao.h>
+#include <bit.h>
+#include <cpu.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+#include <arch/pmu.h>
+
+/**
+ * Samples are taken from the event counters reserved for the hypervisor (see arch/pmu.h), which are
+ * neither visible to nor reset by the guest. As pmselr_el0 belongs to the guest, it is restored
+ * after selecting one of the hypervisor's counters.
+ */
+#define PROF_ARCH_CNT_MSK BIT64_MASK(0, 32)
+
+static inline uint64_t prof_arch_read_counter(unsigned long counter)
+{
+    unsigned long pmselr = sysreg_pmselr_el0_read();
+    sysreg_pmselr_el0_write(counter);
+    ISB();
+    uint64_t value = sysreg_pmxevcntr_el0_read();
+    sysreg_pmselr_el0_write(pmselr);
+    return value;
+}
+
+static inline uint64_t prof_arch_cycles(void)
+{
+    return prof_arch_read_counter(cpu()->arch.pmu_hyp_base + PMU_HYP_CNT_CYCLES);
+}
+
+static inline uint64_t prof_arch_instrs(void)
+{
+    return prof_arch_read_counter(cpu()->arch.pmu_hyp_base + PMU_HYP_CNT_INSTRS);
+}
+
+bool prof_arch_init(void);
+
+#endif /* __ARCH_PROF_H__ */
@@ -21,15 +21,28 @@
 #define PSCI_AFFINITY_INFO_SMC64 (0xc4000004)
 #define PSCI_FEATURES            (0x8400000A)
 #define PSCI_MIG_INFO_TYPE       (0x84000006)
+#define PSCI_SYSTEM_RESET        (0x84000009)
+#define PSCI_SYSTEM_RESET2_SMC32 (0x84000012)
+#define PSCI_SYSTEM_RESET2_SMC64 (0xc4000012)
+
+/* The architectural warm reset type of SYSTEM_RESET2, which keeps the contents of memory */
+#define PSCI_SYSTEM_WARM_RESET (0)
 
 #ifdef AARCH32
 #define PSCI_CPU_SUSPEND   PSCI_CPU_SUSPEND_SMC32
 #define PSCI_CPU_ON        PSCI_CPU_ON_SMC32
 #define PSCI_AFFINITY_INFO PSCI_AFFINITY_INFO_SMC32
+#define PSCI_SYSTEM_RESET2 PSCI_SYSTEM_RESET2_SMC32
 #else
 #define PSCI_CPU_SUSPEND   PSCI_CPU_SUSPEND_SMC64
 #define PSCI_CPU_ON        PSCI_CPU_ON_SMC64
 #define PSCI_AFFINITY_INFO PSCI_AFFINITY_INFO_SMC64
+#define PSCI_SYSTEM_RESET2 PSCI_SYSTEM_RESET2_SMC64
+#endif
+
+/* The power level field of the platform's power state format */
+#ifndef PSCI_POWER_STATE_LVL_MASK
+#define PSCI_POWER_STATE_LVL_MASK (PSCI_POWER_STATE_LVL_1 | PSCI_POWER_STATE_LVL_2)
 #endif
 
 #define PSCI_TOS_NOT_PRESENT_MP        2
@@ -40,6 +53,7 @@
 #define PSCI_INVALID_ADDRESS           (-1L)
 
 #define PSCI_VERSION_0_2               (2U)
+#define PSCI_VERSION_1_0               (0x10000U)
 #define PSCI_GET_VERSION_MAJOR(ver)    (u16)((ver) >> 16)
 #define PSCI_GET_VERSION(major, minor) (((major) << 16) | (minor))
 
@@ -74,6 +88,8 @@ struct psci_ctx {
     paddr_t entrypoint;
     unsigned long context_id;
     enum { ON, OFF, ON_PENDING } state;
+    /* The vcpu was reset on its cpu, which kept its state since, see vm_config.fast_start */
+    bool armed;
 };
 
 struct psci_off_state {
@@ -105,6 +121,8 @@ int32_t psci_smc_handler(uint32_t smc_fid, unsigned long x1, unsigned long x2, u
 
 int32_t psci_standby();
 int32_t psci_power_down(enum wakeup_reason reason);
+int32_t psci_standby_state(uint32_t power_state);
+int32_t psci_power_down_state(uint32_t power_state, enum wakeup_reason reason);
 
 /* --------------------------------
         SMC PSCI interface
@@ -114,4 +132,7 @@ int32_t psci_cpu_suspend(uint32_t power_state, unsigned long entrypoint, unsigne
 
 int32_t psci_cpu_on(unsigned long target_cpu, unsigned long entrypoint, unsigned long context_id);
 
+/* Warm resets the system, failing if the firmware has no SYSTEM_RESET2 */
+int32_t psci_system_reset_warm(void);
+
 #endif /* __PSCI_H__ */
@@ -8,12 +8,25 @@
 
 #define SMCC64_BIT              (0x40000000)
 
+#define SMCC_SUCCESS            (0)
 #define SMCC_E_NOT_SUPPORTED    (-1)
 
+#define SMCC32_FID_ARCH         (0x80000000)
+#define SMCC_VERSION            (SMCC32_FID_ARCH | 0x0)
+#define SMCC_ARCH_FEATURES      (SMCC32_FID_ARCH | 0x1)
+#define SMCC_VERSION_1_1        (0x10001)
+
+#define SMCC32_FID_SIP_SRVC     (0x82000000)
+#define SMCC64_FID_SIP_SRVC     (SMCC32_FID_SIP_SRVC | SMCC64_BIT)
 #define SMCC32_FID_STD_SRVC     (0x84000000)
 #define SMCC64_FID_STD_SRVC     (SMCC32_FID_STD_SRVC | SMCC64_BIT)
 #define SMCC32_FID_VND_HYP_SRVC (0x86000000)
 #define SMCC64_FID_VND_HYP_SRVC (SMCC32_FID_VND_HYP_SRVC | SMCC64_BIT)
+#define SMCC32_FID_STD_HYP_SRVC (0x85000000)
+#define SMCC64_FID_STD_HYP_SRVC (SMCC32_FID_STD_HYP_SRVC | SMCC64_BIT)
 #define SMCC_FID_FN_NUM_MSK     (0xFFFF)
 
+#define SMCC_PV_TIME_FEATURES   (SMCC64_FID_STD_HYP_SRVC | 0x20)
+#define SMCC_PV_TIME_ST         (SMCC64_FID_STD_HYP_SRVC | 0x21)
+
 #endif /* SMCC_H */
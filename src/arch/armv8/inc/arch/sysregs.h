@@ -14,6 +14,54 @@
 #define ID_AA64MMFR0_PAR_OFF      0
 #define ID_AA64MMFR0_PAR_LEN      4
 #define ID_AA64MMFR0_PAR_MSK      BIT64_MASK(ID_AA64MMFR0_PAR_OFF, ID_AA64MMFR0_PAR_LEN)
+#define ID_AA64MMFR0_ECV_OFF      60
+#define ID_AA64MMFR0_ECV_LEN      4
+#define ID_AA64MMFR0_ECV_CNTPOFF  (0x2)
+
+/* ID_AA64MMFR1_EL1, AArch64 Memory Model Feature Register 1 */
+#define ID_AA64MMFR1_HAFDBS_OFF   0
+#define ID_AA64MMFR1_HAFDBS_LEN   4
+#define ID_AA64MMFR1_HAFDBS_AF    (0x1)
+#define ID_AA64MMFR1_HAFDBS_AF_DS (0x2)
+
+/* CNTHCTL_EL2, Counter-timer Hypervisor Control Register, with HCR_EL2.E2H clear */
+#define CNTHCTL_EL1PCTEN_BIT      (1UL << 0)
+#define CNTHCTL_EL1PCEN_BIT       (1UL << 1)
+#define CNTHCTL_ECV_BIT           (1UL << 12)
+
+/* ID_AA64DFR0_EL1 and ID_DFR0, Debug Feature Registers */
+#define ID_AA64DFR0_PMUVER_OFF    8
+#define ID_AA64DFR0_PMUVER_LEN    4
+#define ID_DFR0_PERFMON_OFF       24
+#define ID_DFR0_PERFMON_LEN       4
+#define PMUVER_V3P1               4
+#define PMUVER_IMPDEF             0xf
+
+/* ID_AA64ISAR0_EL1, AArch64 Instruction Set Attribute Register 0 */
+#define ID_AA64ISAR0_TLB_OFF      56
+#define ID_AA64ISAR0_TLB_LEN      4
+#define ID_AA64ISAR0_TLB_RANGE    (0x2)
+#define ID_AA64ISAR0_ATOMIC_OFF   20
+#define ID_AA64ISAR0_ATOMIC_LEN   4
+#define ID_AA64ISAR0_ATOMIC_LSE   (0x2)
+
+/* DCZID_EL0, Data Cache Zero ID Register */
+#define DCZID_BS_OFF              0
+#define DCZID_BS_LEN              4
+#define DCZID_DZP_BIT             (1UL << 4)
+
+/* TLBI range operations operand */
+#define TLBI_RANGE_BADDR_LEN      37
+#define TLBI_RANGE_BADDR_MSK      BIT64_MASK(0, TLBI_RANGE_BADDR_LEN)
+#define TLBI_RANGE_NUM_OFF        39
+#define TLBI_RANGE_NUM_LEN        5
+#define TLBI_RANGE_SCALE_OFF      44
+#define TLBI_RANGE_SCALE_MAX      (3)
+#define TLBI_RANGE_TG_4K          (0x1ULL << 46)
+#define TLBI_RANGE_PAGES(NUM, SCALE) \
+    (((size_t)(NUM) + 1) << ((5 * (SCALE)) + 1))
+#define TLBI_RANGE_MAX_PAGES \
+    TLBI_RANGE_PAGES((1 << TLBI_RANGE_NUM_LEN) - 1, TLBI_RANGE_SCALE_MAX)
 
 #define PAR_32BIT                 (0)
 
@@ -43,6 +91,7 @@
 #define SPSR_EL3t                 (0xc)
 #define SPSR_EL3h                 (0xd)
 
+#define SPSR_M_AARCH32            (1 << 4)
 #define SPSR_F                    (1 << 6)
 #define SPSR_I                    (1 << 7)
 #define SPSR_A                    (1 << 8)
@@ -160,6 +209,8 @@
 #define VTCR_PS_48B          (5 << 16)
 #define VTCR_PS_52B          (6 << 16)
 #define VTCR_TBI             (1 << 20)
+#define VTCR_HA              (1UL << 21)
+#define VTCR_HD              (1UL << 22)
 
 /**
  * Default stage-2 translation control
@@ -197,11 +248,13 @@
 
 /**
  * Default hypervisor memory attributes 0 -> Device-nGnRnE 1 -> Normal, Inner/Outer  WB/WA/RA 2 ->
- * Device-nGnRE
+ * Device-nGnRE 3 -> Normal, Inner/Outer NC. The latter is only used by the MPU for non cacheable vm
+ * memory, and kept within the first 4 attributes so it fits the aarch32 HMAIR0.
  */
 #define MAIR_EL2_DFLT                                                                             \
     (((MAIR_OWBNT | MAIR_ORA | MAIR_OWA | MAIR_IWBNT | MAIR_IRA | MAIR_IWA) << MAIR_ATTR_WIDTH) | \
-        ((MAIR_DEV_nGnRE) << (MAIR_ATTR_WIDTH * 2)))
+        ((MAIR_DEV_nGnRE) << (MAIR_ATTR_WIDTH * 2)) |                                             \
+        ((MAIR_ONC | MAIR_INC) << (MAIR_ATTR_WIDTH * 3)))
 
 /* PAR -  Physical Address Register */
 
@@ -239,6 +292,13 @@
 #define CLIDR_CTYPE_SP             3
 #define CLIDR_CTYPE_UN             4
 
+/* CLUSTERPARTCR_EL1 - DSU Cluster Partition Control Register */
+
+#define CLUSTERPARTCR_GROUP_NUM    (4)
+#define CLUSTERPARTCR_SID_NUM      (8)
+#define CLUSTERPARTCR_GROUP_SID(group, sid) \
+    (1UL << (((group) * CLUSTERPARTCR_SID_NUM) + (sid)))
+
 /* CTR_EL0 - Cache Type Register */
 
 #define CTR_IMINLINE_OFF           0
@@ -343,6 +403,7 @@
 #define ESR_EC_WFIE                (0x01)
 #define ESR_EC_RG_32               (0x03)
 #define ESR_EC_RG_64               (0x04)
+#define ESR_EC_FP                  (0x07)
 #define ESR_EC_SVC32               (0x11)
 #define ESR_EC_HVC32               (0x12)
 #define ESR_EC_SMC32               (0x13)
@@ -394,6 +455,7 @@
 #define ESR_ISS_DA_DSFC_PERMIS     (0xC)
 
 #define ESR_ISS_SYSREG_ADDR        ((0xfff << 10) | (0xf << 1))
+#define ESR_ISS_WFX_TI_WFE         (1 << 0)
 #define ESR_ISS_SYSREG_ADDR_32     (0xFFC1E)
 #define ESR_ISS_SYSREG_ADDR_64     (0xF001E)
 #define ESR_ISS_SYSREG_DIR         (0x1)
@@ -414,6 +476,26 @@
 
 #define CPUACTLR_EL1               S3_1_C15_C2_0
 
+/* MDCR_EL2, Monitor Debug Configuration Register */
+
+#define MDCR_HPMN_OFF              (0)
+#define MDCR_HPMN_LEN              (5)
+#define MDCR_HPMN_MSK              BIT_MASK(MDCR_HPMN_OFF, MDCR_HPMN_LEN)
+#define MDCR_HPME_BIT              (1UL << 7)
+#define MDCR_HPMD_BIT              (1UL << 17)
+
+/* PMCR_EL0 and PMEVTYPER<n>_EL0, Performance Monitors Registers */
+
+#define PMCR_N_OFF                 (11)
+#define PMCR_N_LEN                 (5)
+#define PMCNTEN_C_BIT              (1UL << 31)
+#define PMEVTYPER_P_BIT            (1UL << 31)
+#define PMEVTYPER_U_BIT            (1UL << 30)
+#define PMEVTYPER_NSH_BIT          (1UL << 27)
+#define PMU_EVT_INST_RETIRED       (0x08)
+#define PMU_EVT_CPU_CYCLES         (0x11)
+#define PMU_EVT_L2D_CACHE_REFILL   (0x17)
+
 /* VSCTLR, Virtualization System Control Register */
 
 #define REG_LENGTH                 (sizeof(long) * 8)
@@ -0,0 +1,43 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_TIMER_H__
+#define __ARCH_TIMER_H__
+
+#include <bao.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+
+#define CNTHP_CTL_ENABLE (1UL << 0)
+#define CNTHP_CTL_IMASK  (1UL << 1)
+#define CNTV_CTL_ENABLE  (1UL << 0)
+#define CNTV_CTL_IMASK   (1UL << 1)
+
+/**
+ * The non-secure EL2 physical timer PPI as recommended by the Server Base System Architecture. It
+ * may be overridden by the platform.
+ */
+#ifndef GENERIC_TIMER_HYP_PPI_ID
+#define GENERIC_TIMER_HYP_PPI_ID (26)
+#endif
+
+#define TIMER_ARCH_IRQ_ID (GENERIC_TIMER_HYP_PPI_ID)
+
+static inline uint64_t timer_arch_get(void)
+{
+    ISB();
+    return sysreg_cntpct_el0_read();
+}
+
+static inline uint64_t timer_arch_get_freq(void)
+{
+    return sysreg_cntfrq_el0_read();
+}
+
+void timer_arch_init(void);
+void timer_arch_program(uint64_t deadline);
+void timer_arch_disable(void);
+
+#endif /* __ARCH_TIMER_H__ */
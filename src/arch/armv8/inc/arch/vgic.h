@@ -49,11 +49,20 @@ struct vgic_int {
 
 struct vgicd {
     struct vgic_int* interrupts;
+    /* Only guards CTLR, the interrupts' state is guarded by their own locks */
     spinlock_t lock;
     size_t int_num;
     uint32_t CTLR;
     uint32_t TYPER;
     uint32_t IIDR;
+    /**
+     * Shadows of the shared interrupts' enable bits, indexed as the ISENABLER words, and of their
+     * priorities, laid out as the IPRIORITYR bytes, so that register accesses and scans need not
+     * pull in each interrupt's cache line. Kept along with each interrupt's own fields, under its
+     * lock. Ids the vm does not have read as disabled and with priority zero.
+     */
+    uint32_t enabled[GIC_NUM_INT_REGS(GIC_MAX_INTERUPTS)];
+    uint8_t prio[GIC_MAX_INTERUPTS] __attribute__((aligned(4)));
 };
 
 struct vgicr {
@@ -63,19 +72,67 @@ struct vgicr {
     uint32_t IIDR;
 };
 
+/**
+ * The list register state, only touched by the vcpu's own cpu, comes first. The redistributor and
+ * the private interrupts, which other cpus lock and write, e.g. when sending sgis, start on their
+ * own cache line.
+ */
 struct vgic_priv {
-#if (GIC_VERSION != GICV2)
-    struct vgicr vgicr;
-#endif
     irqid_t curr_lrs[GIC_NUM_LIST_REGS];
+    /**
+     * Write-through cache of the list registers and ELRSR. Only the guest changes them, so it is
+     * valid from a vm exit until the next guest entry.
+     */
+    struct {
+        uint64_t valid;
+        bool elrsr_valid;
+        uint64_t elrsr;
+        gic_lr_t lrs[GIC_NUM_LIST_REGS];
+    } lr_cache;
+#if (GIC_VERSION != GICV2)
+    struct vgicr vgicr __attribute__((aligned(CACHE_LINE_SIZE)));
     struct vgic_int interrupts[GIC_CPU_PRIV];
+#else
+    struct vgic_int interrupts[GIC_CPU_PRIV] __attribute__((aligned(CACHE_LINE_SIZE)));
+#endif
+};
+
+/**
+ * An interrupt's configuration as last programmed by the guest, kept by vm snapshots. The route
+ * holds the IROUTER value, or the ITARGETSR targets on gicv2, and is unused for private interrupts.
+ */
+struct vgic_int_snapshot {
+    unsigned long route;
+    uint8_t cfg;
+    uint8_t prio;
+    bool enabled;
+};
+
+struct vgic_snapshot {
+    uint32_t CTLR;
+    struct vgic_int_snapshot* interrupts;
+};
+
+struct vgic_priv_snapshot {
+    uint32_t vmcr;
+    uint32_t vgicr_ctlr;
+    struct vgic_int_snapshot interrupts[GIC_CPU_PRIV];
 };
 
 void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp);
 void vgic_cpu_init(struct vcpu* vcpu);
+void vgic_reset(struct vm* vm);
+void vgic_cpu_reset(struct vcpu* vcpu);
+bool vgic_snapshot_init(struct vm* vm, struct vgic_snapshot* snap);
+void vgic_snapshot_save(struct vm* vm, struct vgic_snapshot* snap);
+void vgic_snapshot_restore(struct vm* vm, const struct vgic_snapshot* snap);
+void vgic_cpu_snapshot_save(struct vcpu* vcpu, struct vgic_priv_snapshot* snap);
+void vgic_cpu_snapshot_restore(struct vcpu* vcpu, const struct vgic_priv_snapshot* snap);
+void vgic_lr_cache_invalidate(struct vcpu* vcpu);
 void vgic_set_hw(struct vm* vm, irqid_t id);
 void vgic_inject(struct vcpu* vcpu, irqid_t id, vcpuid_t source);
 void vgic_inject_hw(struct vcpu* vcpu, irqid_t id);
+bool vgic_vcpu_irq_pending(struct vcpu* vcpu);
 
 /* VGIC INTERNALS */
 
@@ -110,20 +167,23 @@ bool vgicd_emul_handler(struct emul_access*);
 bool vgic_check_reg_alignment(struct emul_access* acc, struct vgic_reg_handler_info* handlers);
 bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt);
 bool vgic_remove_lr(struct vcpu* vcpu, struct vgic_int* interrupt);
+void vgic_lrs_reset(struct vcpu* vcpu);
+void vgic_int_reset_hw(struct vcpu* vcpu, struct vgic_int* interrupt);
 bool vgic_get_ownership(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_yield_ownership(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_emul_generic_access(struct emul_access*, struct vgic_reg_handler_info*, bool, vcpuid_t);
-void vgic_send_sgi_msg(struct vcpu* vcpu, cpumap_t pcpu_mask, irqid_t int_id);
+void vgic_send_sgi_msg(struct vcpu* vcpu, cpumask_t pcpu_mask, irqid_t int_id);
 size_t vgic_get_itln(const struct vgic_dscrp* vgic_dscrp);
 struct vgic_int* vgic_get_int(struct vcpu* vcpu, irqid_t int_id, vcpuid_t vgicr_id);
 void vgic_int_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcpu,
     struct vgic_int* interrupt, unsigned long data);
+void vgicd_shadow_reset(struct vgicd* vgicd);
 void vgic_emul_razwi(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
     bool gicr_access, cpuid_t vgicr_id);
 
 /* interface for version specific vgic */
 bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt);
-uint8_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt);
+cpumask_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_inject_sgi(struct vcpu* vcpu, struct vgic_int* interrupt, vcpuid_t source);
 
 #endif /* __VGIC_H__ */
@@ -10,8 +10,13 @@
 #include <arch/subarch/vm.h>
 #include <arch/vgic.h>
 #include <arch/psci.h>
+#include <arch/fp.h>
 #ifdef MEM_PROT_MMU
-#include <arch/smmuv2.h>
+#include <arch/smmu.h>
+#include <arch/scmi.h>
+#ifdef AARCH64
+#include <arch/emul_decode.h>
+#endif
 #endif
 #include <list.h>
 
@@ -21,8 +26,28 @@ struct arch_vm_platform {
         paddr_t gicc_addr;
         paddr_t gicr_addr;
         size_t interrupt_num;
+        /**
+         * Do not request a maintenance interrupt when the guest completes a virtual spi. Its list
+         * register is reclaimed when next needed instead, and until then the interrupt stays with
+         * the vcpu, so other vcpus raising it go through that vcpu's cpu.
+         */
+        bool lazy_eoi;
     } gic;
 
+    /**
+     * Guest address of the page aligned, read only, array of stolen time records, one per vcpu,
+     * the vm finds through the SMCCC paravirtual time interface. Left at zero, the interface is
+     * not offered.
+     */
+    vaddr_t pv_time_addr;
+
+    /**
+     * The worst case wake-up latency, in microseconds, the vm tolerates when its vcpus suspend
+     * through PSCI CPU_SUSPEND. The deepest platform state at most as deep as the one requested
+     * and within this budget is entered. Zero leaves the latency unbounded.
+     */
+    uint32_t psci_max_latency_us;
+
 #ifdef MEM_PROT_MMU
     struct {
         streamid_t global_mask;
@@ -32,9 +57,30 @@ struct arch_vm_platform {
             streamid_t id;
         }* groups;
     } smmu;
+
+    /**
+     * The vm's SCMI channel, i.e., the guest address of the page aligned shared memory and the SiP
+     * function id of the doorbell smc, exposing the given platform performance domains to the
+     * guest, in order, as domains 0 to domain_num - 1. Left at zero, no channel is offered.
+     */
+    struct {
+        vaddr_t shmem_addr;
+        uint32_t smc_id;
+        size_t domain_num;
+        struct scmi_vm_domain* domains;
+    } scmi;
 #endif
 };
 
+/* Stolen time record, as laid out by the Arm paravirtualized time specification (DEN0057A) */
+struct pv_time_st {
+    uint32_t revision;
+    uint32_t attributes;
+    /* Little endian, as is the hypervisor, and in nanoseconds */
+    volatile uint64_t stolen_time;
+    uint8_t res[48];
+} __attribute__((__packed__, aligned(64)));
+
 struct vm_arch {
     struct vgicd vgicd;
     vaddr_t vgicr_addr;
@@ -44,15 +90,47 @@ struct vm_arch {
     struct emul_mem vgicr_emul;
     struct emul_reg icc_sgir_emul;
     struct emul_reg icc_sre_emul;
+    struct pv_time_st* pv_time;
+#ifdef MEM_PROT_MMU
+    struct scmi_shmem* scmi_shmem;
+#endif
 };
 
 struct vcpu_arch {
     unsigned long vmpidr;
-    struct vgic_priv vgic_priv;
     struct list vgic_spilled;
+    struct vgic_priv vgic_priv;
+#ifdef AARCH64
+    struct fp_ctx fp;
+#endif
+#if defined(AARCH64) && defined(MEM_PROT_MMU)
+    struct emul_decode_cache emul_decode;
+#endif
+    /* Written by the cpus turning the vcpu on or off */
+    struct psci_ctx psci_ctx __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct vm_arch_snapshot {
+    struct vgic_snapshot vgic;
+};
+
+struct vcpu_arch_snapshot {
+    struct vgic_priv_snapshot vgic;
     struct psci_ctx psci_ctx;
+#ifdef AARCH64
+    struct vcpu_subarch_snapshot sysregs;
+    struct fp_ctx fp;
+#endif
 };
 
+#if (GIC_VERSION != GICV2)
+_Static_assert((offsetof(struct vgic_priv, vgicr) % CACHE_LINE_SIZE) == 0,
+    "vgic redistributor shares a cache line with the list register state");
+#else
+_Static_assert((offsetof(struct vgic_priv, interrupts) % CACHE_LINE_SIZE) == 0,
+    "vgic private interrupts share a cache line with the list register state");
+#endif
+
 struct vcpu* vm_get_vcpu_by_mpidr(struct vm* vm, unsigned long mpidr);
 void vcpu_arch_entry();
 
@@ -8,5 +8,6 @@
 
 void vmm_arch_profile_init();
 void vmm_arch_init_tcr();
+void vmm_arch_write_vtcr(size_t ipa_bits);
 
 #endif /* ARCH_VMM_H */
@@ -30,10 +30,17 @@ void interrupts_arch_ipi_send(cpuid_t target_cpu, irqid_t ipi_id)
     }
 }
 
+void interrupts_arch_ipi_send_mask(const cpumask_t* cpu_mask, irqid_t ipi_id)
+{
+    if (ipi_id < GIC_MAX_SGIS) {
+        gic_send_sgi_mask(cpu_mask, ipi_id);
+    }
+}
+
 void interrupts_arch_enable(irqid_t int_id, bool en)
 {
     gic_set_enable(int_id, en);
-    gic_set_prio(int_id, 0x01);
+    gic_set_prio(int_id, GIC_HYP_PRIO);
     if (GIC_VERSION == GICV2) {
         gicd_set_trgt(int_id, 1 << cpu()->id);
     } else {
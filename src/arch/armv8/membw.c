@@ -0,0 +1,91 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <membw.h>
+#include <cpu.h>
+#include <interrupts.h>
+#include <arch/pmu.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+
+/**
+ * The event counting the guest's memory traffic. It may be overridden by the platform, e.g. with
+ * bus accesses on cores whose last level cache is not the L2.
+ */
+#ifndef MEMBW_PMU_EVENT
+#define MEMBW_PMU_EVENT (PMU_EVT_L2D_CACHE_REFILL)
+#endif
+
+static inline unsigned long membw_counter(void)
+{
+    return cpu()->arch.pmu_hyp_base + PMU_HYP_CNT_MEMBW;
+}
+
+/**
+ * The budget is counted by one of the hypervisor's event counters (see arch/pmu.h). As pmselr_el0
+ * belongs to the guest, it is restored after selecting the counter.
+ */
+static inline unsigned long membw_counter_select(void)
+{
+    unsigned long pmselr = sysreg_pmselr_el0_read();
+    sysreg_pmselr_el0_write(membw_counter());
+    ISB();
+    return pmselr;
+}
+
+bool membw_arch_init(irq_handler_t handler)
+{
+    if (cpu_is_master() && !interrupts_reserve(PMU_PPI_ID, handler)) {
+        ERROR("Failed to reserve the pmu overflow interrupt");
+    }
+
+    if (cpu()->arch.pmu_hyp_counters <= PMU_HYP_CNT_MEMBW) {
+        return false;
+    }
+
+    /* Clearing the filter bits counts at EL0 and EL1 but not at EL2, i.e., only the guest. */
+    sysreg_mdcr_el2_write(sysreg_mdcr_el2_read() | MDCR_HPME_BIT);
+    unsigned long pmselr = membw_counter_select();
+    sysreg_pmxevtyper_el0_write(MEMBW_PMU_EVENT);
+    sysreg_pmselr_el0_write(pmselr);
+    ISB();
+
+    interrupts_cpu_enable(PMU_PPI_ID, true);
+
+    return true;
+}
+
+void membw_arch_start(uint32_t budget)
+{
+    unsigned long cnt_bit = 1UL << membw_counter();
+
+    /* Preload the counter so that it overflows once budget events were counted. */
+    sysreg_pmcntenclr_el0_write(cnt_bit);
+    unsigned long pmselr = membw_counter_select();
+    sysreg_pmxevcntr_el0_write((uint32_t)(0 - budget));
+    sysreg_pmselr_el0_write(pmselr);
+    sysreg_pmovsclr_el0_write(cnt_bit);
+    sysreg_pmintenset_el1_write(cnt_bit);
+    sysreg_pmcntenset_el0_write(cnt_bit);
+    ISB();
+}
+
+bool membw_arch_ack(void)
+{
+    unsigned long cnt_bit = 1UL << membw_counter();
+    unsigned long hpmn = cpu()->arch.pmu_hyp_base;
+    unsigned long guest_cnts = (hpmn != 0 ? BIT_MASK(0, hpmn) : 0) | PMCNTEN_C_BIT;
+    unsigned long ovs = sysreg_pmovsclr_el0_read();
+
+    /**
+     * The guest can not be given the overflow interrupt while the hypervisor owns it, so the
+     * interrupt of any guest counter that overflowed is disabled instead of leaving it asserted.
+     */
+    sysreg_pmovsclr_el0_write(ovs & cnt_bit);
+    sysreg_pmintenclr_el1_write(ovs & guest_cnts);
+    ISB();
+
+    return (ovs & cnt_bit) != 0;
+}
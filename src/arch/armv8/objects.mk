@@ -11,6 +11,12 @@ cpu-objs-y+=gic.o
 cpu-objs-y+=vgic.o
 cpu-objs-y+=vmm.o
 cpu-objs-y+=psci.o
+cpu-objs-y+=timer.o
+cpu-objs-y+=pmu.o
+cpu-objs-y+=membw.o
+ifeq ($(PROF),y)
+cpu-objs-y+=prof.o
+endif
 
 ifeq ($(GIC_VERSION), GICV2)
 	cpu-objs-y+=vgicv2.o
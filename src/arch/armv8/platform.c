@@ -42,3 +42,15 @@ unsigned long platform_arch_cpuid_to_mpidr(const struct platform* plat, cpuid_t
 
     return mpidr;
 }
+
+size_t platform_cpu_cluster(cpuid_t cpuid)
+{
+    for (size_t i = 0, j = 0; i < platform.arch.clusters.num; i++) {
+        j += platform.arch.clusters.core_num[i];
+        if (cpuid < j) {
+            return i;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/pmu.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+#include <cpu.h>
+
+static bool pmu_has_hpmd(void)
+{
+#ifdef AARCH32
+    unsigned long pmuver =
+        bit32_extract(sysreg_id_dfr0_el1_read(), ID_DFR0_PERFMON_OFF, ID_DFR0_PERFMON_LEN);
+#else
+    unsigned long pmuver = bit64_extract(sysreg_id_aa64dfr0_el1_read(), ID_AA64DFR0_PMUVER_OFF,
+        ID_AA64DFR0_PMUVER_LEN);
+#endif
+    return pmuver >= PMUVER_V3P1 && pmuver != PMUVER_IMPDEF;
+}
+
+/**
+ * Split the cpu's event counters between the guest and the hypervisor. As a cpu only ever runs a
+ * single vcpu, the guest's counters are never shared with another vm and can be left live in
+ * hardware. Where supported, the guest's counters (including the cycle counter, if the guest sets
+ * pmcr.dp) do not count while the hypervisor is running.
+ */
+void pmu_init(void)
+{
+    unsigned long ncounters = bit64_extract(sysreg_pmcr_el0_read(), PMCR_N_OFF, PMCR_N_LEN);
+    unsigned long hpmn = ncounters - min(ncounters, (unsigned long)PMU_HYP_COUNTERS);
+
+    unsigned long mdcr = sysreg_mdcr_el2_read() & ~(MDCR_HPMN_MSK | MDCR_HPME_BIT | MDCR_HPMD_BIT);
+    mdcr |= hpmn << MDCR_HPMN_OFF;
+    if (pmu_has_hpmd()) {
+        mdcr |= MDCR_HPMD_BIT;
+    }
+    sysreg_mdcr_el2_write(mdcr);
+
+    cpu()->arch.pmu_hyp_base = hpmn;
+    cpu()->arch.pmu_hyp_counters = ncounters - hpmn;
+}
+
+/**
+ * Bring the guest's counters to a known state without touching the hypervisor's ones, which a
+ * write of pmcr_el0.p or .c from EL2 would also reset.
+ */
+void pmu_guest_reset(void)
+{
+    unsigned long hpmn = cpu()->arch.pmu_hyp_base;
+    unsigned long guest_cnts = (hpmn != 0 ? BIT_MASK(0, hpmn) : 0) | PMCNTEN_C_BIT;
+
+    sysreg_pmcr_el0_write(0);
+    sysreg_pmcntenclr_el0_write(guest_cnts);
+    sysreg_pmintenclr_el1_write(guest_cnts);
+    sysreg_pmovsclr_el0_write(guest_cnts);
+    for (unsigned long i = 0; i < hpmn; i++) {
+        sysreg_pmselr_el0_write(i);
+        ISB();
+        sysreg_pmxevtyper_el0_write(0);
+        sysreg_pmxevcntr_el0_write(0);
+    }
+    sysreg_pmselr_el0_write(0);
+    sysreg_pmccfiltr_el0_write(0);
+    sysreg_pmccntr_el0_write(0);
+    sysreg_pmuserenr_el0_write(0);
+}
@@ -0,0 +1,31 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/prof.h>
+
+bool prof_arch_init(void)
+{
+    if (cpu()->arch.pmu_hyp_counters <= PMU_HYP_CNT_CYCLES) {
+        return false;
+    }
+
+    /* Count only at EL2 so that guest execution does not pollute the samples. */
+    unsigned long instrs = cpu()->arch.pmu_hyp_base + PMU_HYP_CNT_INSTRS;
+    unsigned long cycles = cpu()->arch.pmu_hyp_base + PMU_HYP_CNT_CYCLES;
+    unsigned long filter = PMEVTYPER_P_BIT | PMEVTYPER_U_BIT | PMEVTYPER_NSH_BIT;
+
+    sysreg_mdcr_el2_write(sysreg_mdcr_el2_read() | MDCR_HPME_BIT);
+
+    sysreg_pmselr_el0_write(instrs);
+    ISB();
+    sysreg_pmxevtyper_el0_write(filter | PMU_EVT_INST_RETIRED);
+    sysreg_pmselr_el0_write(cycles);
+    ISB();
+    sysreg_pmxevtyper_el0_write(filter | PMU_EVT_CPU_CYCLES);
+    sysreg_pmcntenset_el0_write((1UL << instrs) | (1UL << cycles));
+    ISB();
+
+    return true;
+}
@@ -4,6 +4,7 @@
  */
 
 #include <arch/psci.h>
+#include <arch/smcc.h>
 #include <arch/sysregs.h>
 #include <fences.h>
 #include <vm.h>
@@ -11,6 +12,8 @@
 #include <mem.h>
 #include <cache.h>
 #include <config.h>
+#include <platform.h>
+#include <timer.h>
 
 enum { PSCI_MSG_ON };
 
@@ -27,7 +30,12 @@ void psci_wake_from_off()
     /* update vcpu()->psci_ctx */
     spin_lock(&cpu()->vcpu->arch.psci_ctx.lock);
     if (cpu()->vcpu->arch.psci_ctx.state == ON_PENDING) {
-        vcpu_arch_reset(cpu()->vcpu, cpu()->vcpu->arch.psci_ctx.entrypoint);
+        if (cpu()->vcpu->arch.psci_ctx.armed) {
+            vcpu_writepc(cpu()->vcpu, cpu()->vcpu->arch.psci_ctx.entrypoint);
+        } else {
+            vcpu_arch_reset(cpu()->vcpu, cpu()->vcpu->arch.psci_ctx.entrypoint);
+        }
+        cpu()->vcpu->arch.psci_ctx.armed = false;
         cpu()->vcpu->arch.psci_ctx.state = ON;
         vcpu_writereg(cpu()->vcpu, 0, cpu()->vcpu->arch.psci_ctx.context_id);
     }
@@ -45,32 +53,99 @@ void psci_cpumsg_handler(uint32_t event, uint64_t data)
 
 CPU_MSG_HANDLER(psci_cpumsg_handler, PSCI_CPUMSG_ID);
 
+/**
+ * The cpu is expected to stay suspended until the next hypervisor timer event or, on aarch64,
+ * until the guest's virtual timer fires, whichever comes first. Other interrupts may of course
+ * wake it up earlier.
+ */
+static uint64_t psci_predicted_residency_us(void)
+{
+    uint64_t now = timer_get();
+    uint64_t wakeup = timer_next_deadline();
+
+#ifdef AARCH64
+    unsigned long cntv_ctl = sysreg_cntv_ctl_el0_read();
+    if ((cntv_ctl & CNTV_CTL_ENABLE) && !(cntv_ctl & CNTV_CTL_IMASK)) {
+        uint64_t cntv_deadline = sysreg_cntv_cval_el0_read() + sysreg_cntvoff_el2_read();
+        wakeup = min(wakeup, cntv_deadline);
+    }
+#endif
+
+    if (wakeup == UINT64_MAX) {
+        return UINT64_MAX;
+    }
+
+    return (wakeup > now) ? (timer_ticks_to_ns(wakeup - now) / 1000) : 0;
+}
+
+/**
+ * Selects the deepest platform state no deeper than the requested one, i.e., at most at its power
+ * level and only a standby state if standby was requested, whose exit latency fits the vm's
+ * budget and whose minimum residency is expected to be reached.
+ */
+static const struct psci_pwr_state* psci_select_state(uint32_t power_state)
+{
+    uint32_t max_latency = cpu()->vcpu->vm->config->platform.arch.psci_max_latency_us;
+    bool powerdown = (power_state & PSCI_STATE_TYPE_BIT) != 0;
+    uint32_t level = power_state & PSCI_POWER_STATE_LVL_MASK;
+    const struct psci_pwr_state* selected = NULL;
+    uint64_t residency = 0;
+
+    if (platform.arch.psci.state_num > 0) {
+        residency = psci_predicted_residency_us();
+    }
+
+    for (size_t i = 0; i < platform.arch.psci.state_num; i++) {
+        const struct psci_pwr_state* state = &platform.arch.psci.states[i];
+        bool state_powerdown = (state->power_state & PSCI_STATE_TYPE_BIT) != 0;
+        if ((state_powerdown && !powerdown) ||
+            ((state->power_state & PSCI_POWER_STATE_LVL_MASK) > level) ||
+            ((max_latency != 0) && (state->exit_latency_us > max_latency)) ||
+            (state->min_residency_us > residency)) {
+            continue;
+        }
+        selected = state;
+    }
+
+    return selected;
+}
+
 int32_t psci_cpu_suspend_handler(uint32_t power_state, unsigned long entrypoint,
     unsigned long context_id)
 {
     /**
-     * !! Ignoring the rest of the requested  powerstate for now. This might be a problem howwver
-     * since powerlevel and stateid are implementation defined.
+     * The guest's state id is not forwarded, the state entered being one of the platform's. If it
+     * is a standby state, even if the guest requested a powerdown, the call simply returns once
+     * the cpu wakes up, which PSCI allows.
      */
-    uint32_t state_type = power_state & PSCI_STATE_TYPE_BIT;
+    const struct psci_pwr_state* state = psci_select_state(power_state);
+    bool powerdown = false;
+    uint32_t pwr_state_aux = PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_POWERDOWN;
     int32_t ret;
 
-    if (state_type) {
-        // PSCI_STATE_TYPE_POWERDOWN:
+    if (state != NULL) {
+        pwr_state_aux = state->power_state;
+        powerdown = (pwr_state_aux & PSCI_STATE_TYPE_BIT) != 0;
+    } else if (platform.arch.psci.state_num == 0) {
+        powerdown = (power_state & PSCI_STATE_TYPE_BIT) != 0;
+    }
+
+    if (powerdown) {
         spin_lock(&cpu()->vcpu->arch.psci_ctx.lock);
         cpu()->vcpu->arch.psci_ctx.entrypoint = entrypoint;
         cpu()->vcpu->arch.psci_ctx.context_id = context_id;
         spin_unlock(&cpu()->vcpu->arch.psci_ctx.lock);
-        ret = psci_power_down(PSCI_WAKEUP_POWERDOWN);
+        ret = psci_power_down_state(pwr_state_aux, PSCI_WAKEUP_POWERDOWN);
+    } else if (state != NULL) {
+        ret = psci_standby_state(pwr_state_aux);
     } else {
-        // PSCI_STATE_TYPE_STANDBY:
         /**
          *  TODO: ideally we would emmit a standby request to PSCI (currently, ATF), but when we
          * do, we do not wake up on interrupts on the current development target zcu104. We should
-         * understand why. To circunvent this, we directly emmit a wfi
+         * understand why. To circunvent this, we directly wait for interrupts. Platforms whose
+         * firmware standby states work list them in their state table instead.
          */
-        // ret = psci_standby();
-        asm volatile("wfi\n\r");
+        cpu_standby();
         ret = PSCI_E_SUCCESS;
     }
 
@@ -86,6 +161,7 @@ int32_t psci_cpu_off_handler(void)
 
     spin_lock(&cpu()->vcpu->arch.psci_ctx.lock);
     cpu()->vcpu->arch.psci_ctx.state = OFF;
+    cpu()->vcpu->arch.psci_ctx.armed = false;
     spin_unlock(&cpu()->vcpu->arch.psci_ctx.lock);
 
     cpu_idle();
@@ -105,16 +181,19 @@ int32_t psci_cpu_on_handler(unsigned long target_cpu, unsigned long entrypoint,
     struct vcpu* target_vcpu = vm_get_vcpu_by_mpidr(vm, target_cpu);
 
     if (target_vcpu != NULL) {
+        /**
+         * Only the target's lock is taken, which its cpu takes as well before starting it, so the
+         * guest may start several vcpus back to back, none waiting for the others to come up.
+         */
         bool already_on = true;
-        spin_lock(&cpu()->vcpu->arch.psci_ctx.lock);
+        spin_lock(&target_vcpu->arch.psci_ctx.lock);
         if (target_vcpu->arch.psci_ctx.state == OFF) {
             target_vcpu->arch.psci_ctx.state = ON_PENDING;
             target_vcpu->arch.psci_ctx.entrypoint = entrypoint;
             target_vcpu->arch.psci_ctx.context_id = context_id;
-            fence_sync_write();
             already_on = false;
         }
-        spin_unlock(&cpu()->vcpu->arch.psci_ctx.lock);
+        spin_unlock(&target_vcpu->arch.psci_ctx.lock);
 
         if (already_on) {
             return PSCI_E_ALREADY_ON;
@@ -154,6 +233,20 @@ int32_t psci_affinity_info_handler(unsigned long target_affinity, uint32_t lowes
     return 0;
 }
 
+/**
+ * Only the calling vm is reset. On success this returns to the guest which is then immediately
+ * restarted by the reset message sent to its own cpu.
+ */
+int32_t psci_system_reset_handler(void)
+{
+    if (!vm_reset(cpu()->vcpu->vm->id)) {
+        WARNING("VM %d can not be reset without a pristine image copy", cpu()->vcpu->vm->id);
+        return PSCI_E_NOT_SUPPORTED;
+    }
+
+    return PSCI_E_SUCCESS;
+}
+
 int32_t psci_features_handler(uint32_t feature_id)
 {
     int32_t ret = PSCI_E_NOT_SUPPORTED;
@@ -168,6 +261,8 @@ int32_t psci_features_handler(uint32_t feature_id)
         case PSCI_AFFINITY_INFO_SMC32:
         case PSCI_AFFINITY_INFO_SMC64:
         case PSCI_FEATURES:
+        case PSCI_SYSTEM_RESET:
+        case SMCC_VERSION:
             ret = PSCI_E_SUCCESS;
             break;
     }
@@ -181,7 +276,7 @@ int32_t psci_smc_handler(uint32_t smc_fid, unsigned long x1, unsigned long x2, u
 
     switch (smc_fid) {
         case PSCI_VERSION:
-            ret = PSCI_VERSION_0_2;
+            ret = PSCI_VERSION_1_0;
             break;
 
         case PSCI_CPU_OFF:
@@ -211,6 +306,10 @@ int32_t psci_smc_handler(uint32_t smc_fid, unsigned long x1, unsigned long x2, u
             ret = PSCI_TOS_NOT_PRESENT_MP;
             break;
 
+        case PSCI_SYSTEM_RESET:
+            ret = psci_system_reset_handler();
+            break;
+
         default:
             INFO("unkown psci smc_fid 0x%lx", smc_fid);
     }
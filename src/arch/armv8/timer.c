@@ -0,0 +1,27 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <timer.h>
+#include <interrupts.h>
+
+void timer_arch_init(void)
+{
+    sysreg_cnthp_ctl_el2_write(0);
+    ISB();
+    interrupts_cpu_enable(TIMER_ARCH_IRQ_ID, true);
+}
+
+void timer_arch_program(uint64_t deadline)
+{
+    sysreg_cnthp_cval_el2_write(deadline);
+    sysreg_cnthp_ctl_el2_write(CNTHP_CTL_ENABLE);
+    ISB();
+}
+
+void timer_arch_disable(void)
+{
+    sysreg_cnthp_ctl_el2_write(0);
+    ISB();
+}
@@ -20,17 +20,24 @@
 #include <cpu.h>
 #include <interrupts.h>
 #include <vm.h>
+#include <string.h>
 #include <platform.h>
+#include <prof.h>
+#include <config.h>
 
-enum VGIC_EVENTS { VGIC_UPDATE_ENABLE, VGIC_ROUTE, VGIC_INJECT, VGIC_SET_REG };
+enum VGIC_EVENTS { VGIC_UPDATE_ENABLE, VGIC_ROUTE, VGIC_INJECT, VGIC_SET_REG, VGIC_SET_REG_BATCH };
 extern volatile const size_t VGIC_IPI_ID;
 
 #define GICD_IS_REG(REG, offset)                    \
     (((offset) >= offsetof(struct gicd_hw, REG)) && \
         (offset) < (offsetof(struct gicd_hw, REG) + sizeof(gicd->REG)))
-#define GICD_REG_GROUP(REG) ((offsetof(struct gicd_hw, REG) & 0xff80) >> 7)
 #define GICD_REG_MASK(ADDR) ((ADDR) & (GIC_VERSION == GICV2 ? 0xfffUL : 0xffffUL))
 #define GICD_REG_IND(REG)   (offsetof(struct gicd_hw, REG) & 0x7f)
+#define GICD_REG_GROUP(REG) (GICD_REG_MASK(offsetof(struct gicd_hw, REG)) >> 7)
+#define GICD_REG_GROUP_LAST(REG) \
+    (GICD_REG_MASK(offsetof(struct gicd_hw, REG) + sizeof(gicd->REG) - 1) >> 7)
+#define GICD_REG_GROUPS(REG) [GICD_REG_GROUP(REG)... GICD_REG_GROUP_LAST(REG)]
+#define GICD_REG_GROUP_NUM   ((GICD_REG_MASK(~0UL) >> 7) + 1)
 
 #define VGIC_MSG_DATA(VM_ID, VGICRID, INT_ID, REG, VAL)                   \
     (((uint64_t)(VM_ID) << 48) | (((uint64_t)(VGICRID) & 0xffff) << 32) | \
@@ -41,6 +48,17 @@ extern volatile const size_t VGIC_IPI_ID;
 #define VGIC_MSG_REG(DATA)     (((DATA) >> 8) & 0xff)
 #define VGIC_MSG_VAL(DATA)     ((DATA) & 0xff)
 
+/**
+ * Batched writes to single bit field registers carry the 32 interrupt bitmap of a register word
+ * instead of the vgicr id, interrupt id and value.
+ */
+#define VGIC_BATCH_MSG_DATA(VM_ID, REG, WORD, BITMAP)                             \
+    (((uint64_t)(VM_ID) << 48) | (((uint64_t)(REG) & 0x3f) << 42) |               \
+        (((uint64_t)(WORD) & 0x3ff) << 32) | ((uint64_t)(BITMAP) & 0xffffffff))
+#define VGIC_BATCH_MSG_REG(DATA)    (((DATA) >> 42) & 0x3f)
+#define VGIC_BATCH_MSG_WORD(DATA)   (((DATA) >> 32) & 0x3ff)
+#define VGIC_BATCH_MSG_BITMAP(DATA) ((DATA) & 0xffffffff)
+
 void vgic_ipi_handler(uint32_t event, uint64_t data);
 CPU_MSG_HANDLER(vgic_ipi_handler, VGIC_IPI_ID);
 
@@ -61,13 +79,54 @@ static inline bool vgic_int_is_hw(struct vgic_int* interrupt)
     return !(interrupt->id < GIC_MAX_SGIS) && interrupt->hw;
 }
 
+void vgic_lr_cache_invalidate(struct vcpu* vcpu)
+{
+    vcpu->arch.vgic_priv.lr_cache.valid = 0;
+    vcpu->arch.vgic_priv.lr_cache.elrsr_valid = false;
+}
+
+static inline gic_lr_t vgic_lr_read(struct vcpu* vcpu, size_t lr_ind)
+{
+    if (!bit64_get(vcpu->arch.vgic_priv.lr_cache.valid, lr_ind)) {
+        vcpu->arch.vgic_priv.lr_cache.lrs[lr_ind] = gich_read_lr(lr_ind);
+        vcpu->arch.vgic_priv.lr_cache.valid =
+            bit64_set(vcpu->arch.vgic_priv.lr_cache.valid, lr_ind);
+    }
+    return vcpu->arch.vgic_priv.lr_cache.lrs[lr_ind];
+}
+
+static inline void vgic_lr_write(struct vcpu* vcpu, size_t lr_ind, gic_lr_t lr)
+{
+    gich_write_lr(lr_ind, lr);
+    vcpu->arch.vgic_priv.lr_cache.lrs[lr_ind] = lr;
+    vcpu->arch.vgic_priv.lr_cache.valid = bit64_set(vcpu->arch.vgic_priv.lr_cache.valid, lr_ind);
+
+    if (vcpu->arch.vgic_priv.lr_cache.elrsr_valid) {
+        /* An invalid list register is only empty if it is not waiting for a maintenance eoi */
+        bool empty = (GICH_LR_STATE(lr) == INV) &&
+            (!(lr & GICH_LR_EOI_BIT) || (lr & GICH_LR_HW_BIT));
+        uint64_t elrsr = vcpu->arch.vgic_priv.lr_cache.elrsr;
+        vcpu->arch.vgic_priv.lr_cache.elrsr =
+            empty ? bit64_set(elrsr, lr_ind) : bit64_clear(elrsr, lr_ind);
+    }
+}
+
+static inline uint64_t vgic_lr_elrsr(struct vcpu* vcpu)
+{
+    if (!vcpu->arch.vgic_priv.lr_cache.elrsr_valid) {
+        vcpu->arch.vgic_priv.lr_cache.elrsr = gich_get_elrsr();
+        vcpu->arch.vgic_priv.lr_cache.elrsr_valid = true;
+    }
+    return vcpu->arch.vgic_priv.lr_cache.elrsr;
+}
+
 static inline int64_t gich_get_lr(struct vgic_int* interrupt, unsigned long* lr)
 {
     if (!interrupt->in_lr || interrupt->owner->phys_id != cpu()->id) {
         return -1;
     }
 
-    unsigned long lr_val = gich_read_lr(interrupt->lr);
+    unsigned long lr_val = vgic_lr_read(cpu()->vcpu, interrupt->lr);
     if ((GICH_LR_VID(lr_val) == interrupt->id) && (GICH_LR_STATE(lr_val) != INV)) {
         if (lr != NULL) {
             *lr = lr_val;
@@ -117,28 +176,41 @@ bool vgic_owns(struct vcpu* vcpu, struct vgic_int* interrupt)
     return interrupt->owner == vcpu;
 }
 
-void vgic_yield_ownership(struct vcpu* vcpu, struct vgic_int* interrupt)
+static void vgic_hand_ownership(struct vcpu* vcpu, struct vgic_int* interrupt,
+    struct vcpu* new_owner)
 {
     if ((GIC_VERSION == GICV2 && gic_is_priv(interrupt->id)) || !vgic_owns(vcpu, interrupt) ||
         interrupt->in_lr || (vgic_get_state(interrupt) & ACT)) {
         return;
     }
 
-    interrupt->owner = NULL;
+    interrupt->owner = new_owner;
 }
 
-void vgic_send_sgi_msg(struct vcpu* vcpu, cpumap_t pcpu_mask, irqid_t int_id)
+void vgic_yield_ownership(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
-    struct cpu_msg msg = {
-        VGIC_IPI_ID,
-        VGIC_INJECT,
-        VGIC_MSG_DATA(cpu()->vcpu->vm->id, 0, int_id, 0, cpu()->vcpu->id),
-    };
+    vgic_hand_ownership(vcpu, interrupt, NULL);
+}
 
-    for (size_t i = 0; i < platform.cpu_num; i++) {
-        if (pcpu_mask & (1ull << i)) {
-            cpu_send_msg(i, &msg);
-        }
+void vgic_send_sgi_msg(struct vcpu* vcpu, cpumask_t pcpu_mask, irqid_t int_id)
+{
+    /**
+     * A vcpu targeting itself is injected directly instead of going through its own message ring
+     * and a self-IPI. The remaining targets are all posted in a single urgent message broadcast.
+     */
+    if (cpumask_test(&pcpu_mask, cpu()->id)) {
+        cpumask_clear(&pcpu_mask, cpu()->id);
+        vgic_inject(cpu()->vcpu, int_id, cpu()->vcpu->id);
+    }
+
+    if (!cpumask_empty(&pcpu_mask)) {
+        struct cpu_msg msg = {
+            VGIC_IPI_ID,
+            VGIC_INJECT,
+            VGIC_MSG_DATA(cpu()->vcpu->vm->id, 0, int_id, 0, cpu()->vcpu->id),
+        };
+
+        cpu_send_urgent_msg_mask(&pcpu_mask, &msg);
     }
 }
 
@@ -158,13 +230,25 @@ void vgic_route(struct vcpu* vcpu, struct vgic_int* interrupt)
             VGIC_ROUTE,
             VGIC_MSG_DATA(vcpu->vm->id, vcpu->id, interrupt->id, 0, 0),
         };
-        vgic_yield_ownership(vcpu, interrupt);
-        cpumap_t trgtlist = vgic_int_ptarget_mask(vcpu, interrupt) & ~(1ull << vcpu->phys_id);
-        for (size_t i = 0; i < platform.cpu_num; i++) {
-            if (trgtlist & (1ull << i)) {
-                cpu_send_msg(i, &msg);
-            }
+        cpumask_t trgtlist = vgic_int_ptarget_mask(vcpu, interrupt);
+        cpumask_clear(&trgtlist, vcpu->phys_id);
+
+        /**
+         * An interrupt with a single other target is handed over to its vcpu along with the
+         * message, which then adds it to its list registers without contending for it. Otherwise,
+         * the first of the targets to take it gets it.
+         */
+        struct vcpu* new_owner = NULL;
+        if (cpumask_weight(&trgtlist) == 1) {
+            cpuid_t pcpu = cpumask_next(&trgtlist, 0);
+            new_owner = vm_get_vcpu(vcpu->vm, vcpu->vm->pcpu_to_vcpu[pcpu]);
+        }
+        vgic_hand_ownership(vcpu, interrupt, new_owner);
+
+        if (vgic_int_is_hw(interrupt)) {
+            stats_inc(STATS_IRQS_FORWARDED);
         }
+        cpu_send_urgent_msg_mask(&trgtlist, &msg);
     }
 }
 
@@ -228,7 +312,8 @@ static inline void vgic_write_lr(struct vcpu* vcpu, struct vgic_int* interrupt,
     }
 #endif
     else {
-        if (!gic_is_priv(interrupt->id) && !vgic_int_is_hw(interrupt)) {
+        if (!gic_is_priv(interrupt->id) && !vgic_int_is_hw(interrupt) &&
+            !vcpu->vm->config->platform.arch.gic.lazy_eoi) {
             lr |= GICH_LR_EOI_BIT;
         }
 
@@ -239,7 +324,7 @@ static inline void vgic_write_lr(struct vcpu* vcpu, struct vgic_int* interrupt,
     interrupt->in_lr = true;
     interrupt->lr = lr_ind;
     vcpu->arch.vgic_priv.curr_lrs[lr_ind] = interrupt->id;
-    gich_write_lr(lr_ind, lr);
+    vgic_lr_write(vcpu, lr_ind, lr);
 }
 
 bool vgic_remove_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
@@ -253,7 +338,7 @@ bool vgic_remove_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
     unsigned long lr_val = 0;
     ssize_t lr_ind = -1;
     if ((lr_ind = gich_get_lr(interrupt, &lr_val)) >= 0) {
-        gich_write_lr(lr_ind, 0);
+        vgic_lr_write(vcpu, lr_ind, 0);
     }
 
     interrupt->in_lr = false;
@@ -281,29 +366,63 @@ bool vgic_remove_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
     return ret;
 }
 
-void vgic_add_spilled(struct vcpu* vcpu, struct vgic_int* interrupt)
+/**
+ * Empties the list registers of the current cpu, dropping the interrupts they held. Their state is
+ * left for the caller to reset.
+ */
+void vgic_lrs_reset(struct vcpu* vcpu)
+{
+    for (size_t i = 0; i < NUM_LRS; i++) {
+        vgic_lr_write(vcpu, i, 0);
+        vcpu->arch.vgic_priv.curr_lrs[i] = 0;
+    }
+
+    gich_set_hcr(gich_get_hcr() &
+        ~(GICH_HCR_En_BIT | GICH_HCR_UIE_BIT | GICH_HCR_NPIE_BIT | GICH_HCR_EOICount_MASK));
+}
+
+static inline struct list* vgic_spilled_list(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
-    spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
-    struct list* spilled_list = NULL;
     if (gic_is_priv(interrupt->id)) {
-        spilled_list = &vcpu->arch.vgic_spilled;
+        return &vcpu->arch.vgic_spilled;
+    } else {
+        return &vcpu->vm->arch.vgic_spilled;
+    }
+}
+
+/**
+ * Spilled lists are kept sorted by priority, and by id for same priority interrupts, so the highest
+ * priority spilled interrupt is found at, or close to, the head of the list.
+ */
+static int vgic_spilled_cmp(node_t* _n1, node_t* _n2)
+{
+    struct vgic_int* n1 = (struct vgic_int*)_n1;
+    struct vgic_int* n2 = (struct vgic_int*)_n2;
+    if (n1->prio != n2->prio) {
+        return (int)n1->prio - (int)n2->prio;
     } else {
-        spilled_list = &vcpu->vm->arch.vgic_spilled;
+        return (int)n1->id - (int)n2->id;
     }
-    list_push(spilled_list, (node_t*)interrupt);
+}
+
+void vgic_add_spilled(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
+    list_insert_ordered(vgic_spilled_list(vcpu, interrupt), (node_t*)interrupt, vgic_spilled_cmp);
     spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
     gich_set_hcr(gich_get_hcr() | GICH_HCR_NPIE_BIT);
 }
 
 void vgic_spill_lr(struct vcpu* vcpu, unsigned lr_ind)
 {
-    unsigned long lr = gich_read_lr(lr_ind);
+    unsigned long lr = vgic_lr_read(vcpu, lr_ind);
     struct vgic_int* spilled_int = vgic_get_int(vcpu, GICH_LR_VID(lr), vcpu->id);
 
     if (spilled_int != NULL) {
         spin_lock(&spilled_int->lock);
         vgic_remove_lr(vcpu, spilled_int);
         vgic_add_spilled(vcpu, spilled_int);
+        stats_inc(STATS_LRS_SPILLED);
         vgic_yield_ownership(vcpu, spilled_int);
         spin_unlock(&spilled_int->lock);
     }
@@ -311,6 +430,8 @@ void vgic_spill_lr(struct vcpu* vcpu, unsigned lr_ind)
 
 bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
+    PROF_SCOPE(PROF_VGIC_ADD_LR);
+
     bool ret = false;
 
     if (!interrupt->enabled || interrupt->in_lr) {
@@ -318,7 +439,7 @@ bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
     }
 
     ssize_t lr_ind = -1;
-    uint64_t elrsr = gich_get_elrsr();
+    uint64_t elrsr = vgic_lr_elrsr(vcpu);
     for (size_t i = 0; i < NUM_LRS; i++) {
         if (bit64_get(elrsr, i)) {
             lr_ind = i;
@@ -333,7 +454,7 @@ bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
         ssize_t pend_ind = -1, act_ind = -1;
 
         for (size_t i = 0; i < NUM_LRS; i++) {
-            unsigned long lr = gich_read_lr(i);
+            unsigned long lr = vgic_lr_read(vcpu, i);
             unsigned lr_id = GICH_LR_VID(lr);
             unsigned lr_prio = (lr & GICH_LR_PRIO_MSK) >> GICH_LR_PRIO_OFF;
             if (GIC_VERSION == GICV2) {
@@ -399,6 +520,7 @@ void vgicd_emul_misc_access(struct emul_access* acc, struct vgic_reg_handler_inf
     switch (reg) {
         case GICD_REG_IND(CTLR):
             if (acc->write) {
+                spin_lock(&vgicd->lock);
                 uint32_t prev_ctrl = vgicd->CTLR;
                 vgicd->CTLR = vcpu_readreg(cpu()->vcpu, acc->reg) & VGIC_ENABLE_MASK;
                 if (prev_ctrl ^ vgicd->CTLR) {
@@ -410,6 +532,7 @@ void vgicd_emul_misc_access(struct emul_access* acc, struct vgic_reg_handler_inf
                     };
                     vm_msg_broadcast(cpu()->vcpu->vm, &msg);
                 }
+                spin_unlock(&vgicd->lock);
             } else {
                 vcpu_writereg(cpu()->vcpu, acc->reg, vgicd->CTLR | GICD_CTLR_ARE_NS_BIT);
             }
@@ -430,11 +553,42 @@ void vgicd_emul_misc_access(struct emul_access* acc, struct vgic_reg_handler_inf
 void vgicd_emul_pidr_access(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
     bool gicr_access, cpuid_t vgicr_id)
 {
+    /* The group holding the id registers also spans the reserved space before them */
     if (!acc->write) {
-        vcpu_writereg(cpu()->vcpu, acc->reg, gicd->ID[((acc->addr & 0xff) - 0xd0) / 4]);
+        unsigned long val = 0;
+        if (GICD_IS_REG(ID, GICD_REG_MASK(acc->addr))) {
+            val = gicd->ID[((acc->addr & 0xff) - 0xd0) / 4];
+        }
+        vcpu_writereg(cpu()->vcpu, acc->reg, val);
     }
 }
 
+/**
+ * Other vcpus might concurrently own other interrupts of the same word, so the shadow bit is
+ * updated atomically rather than under the interrupt's lock alone.
+ */
+static void vgicd_shadow_enable(struct vgicd* vgicd, irqid_t int_id, bool enable)
+{
+    volatile uint32_t* word = (volatile uint32_t*)&vgicd->enabled[GIC_INT_REG(int_id)];
+    uint32_t old = 0;
+    uint32_t new = 0;
+    do {
+        old = *word;
+        new = enable ? (old | GIC_INT_MASK(int_id)) : (old & ~GIC_INT_MASK(int_id));
+    } while (spin_atomic_cmpxchg(word, old, new) != old);
+}
+
+/**
+ * Run once the shared interrupts are reset, so the shadows match them.
+ */
+void vgicd_shadow_reset(struct vgicd* vgicd)
+{
+    memset(vgicd->enabled, 0, sizeof(vgicd->enabled));
+    memset(vgicd->prio, 0, sizeof(vgicd->prio));
+    memset(&vgicd->prio[GIC_CPU_PRIV], GIC_LOWEST_PRIO, min(vgicd->int_num,
+        (size_t)(GIC_MAX_INTERUPTS - GIC_CPU_PRIV)));
+}
+
 bool vgic_int_update_enable(struct vcpu* vcpu, struct vgic_int* interrupt, bool enable)
 {
     if (GIC_VERSION == GICV2 && gic_is_sgi(interrupt->id)) {
@@ -443,6 +597,9 @@ bool vgic_int_update_enable(struct vcpu* vcpu, struct vgic_int* interrupt, bool
 
     if (enable != interrupt->enabled) {
         interrupt->enabled = enable;
+        if (!gic_is_priv(interrupt->id)) {
+            vgicd_shadow_enable(&vcpu->vm->arch.vgicd, interrupt->id, enable);
+        }
         return true;
     } else {
         return false;
@@ -522,6 +679,20 @@ void vgic_int_state_hw(struct vcpu* vcpu, struct vgic_int* interrupt)
 #endif
 }
 
+/**
+ * A hw interrupt forwarded to the guest stays active in the physical gic until the guest completes
+ * it, so on a reset it is deactivated, and disabled, there as well.
+ */
+void vgic_int_reset_hw(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    if (vgic_int_is_hw(interrupt)) {
+        interrupt->state = INV;
+        interrupt->enabled = false;
+        vgic_int_enable_hw(vcpu, interrupt);
+        vgic_int_state_hw(vcpu, interrupt);
+    }
+}
+
 bool vgic_int_clear_pend(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long data)
 {
     if (!data) {
@@ -611,6 +782,18 @@ bool vgic_int_set_prio(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned l
 {
     uint8_t prev_prio = interrupt->prio;
     interrupt->prio = (uint8_t)prio & BIT_MASK(8 - GICH_LR_PRIO_LEN, GICH_LR_PRIO_LEN);
+    if (!gic_is_priv(interrupt->id)) {
+        vcpu->vm->arch.vgicd.prio[interrupt->id] = interrupt->prio;
+    }
+    if (prev_prio != interrupt->prio) {
+        /* Keep the spilled list sorted if the interrupt is currently spilled */
+        struct list* list = vgic_spilled_list(vcpu, interrupt);
+        spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
+        if (list_rm(list, (node_t*)interrupt)) {
+            list_insert_ordered(list, (node_t*)interrupt, vgic_spilled_cmp);
+        }
+        spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
+    }
     return prev_prio != prio;
 }
 
@@ -619,16 +802,30 @@ unsigned long vgic_int_get_prio(struct vcpu* vcpu, struct vgic_int* interrupt)
     return (unsigned long)interrupt->prio;
 }
 
+/**
+ * The physical priority only orders the interrupts the hypervisor takes, the guest seeing the
+ * virtual one in the list registers. A critical vm's interrupts are always taken first, while the
+ * other vms' are kept from outranking them.
+ */
+static inline uint8_t vgic_int_hw_prio(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    if (vcpu->vm->config->critical) {
+        return GIC_CRITICAL_PRIO;
+    }
+    return max(interrupt->prio, (uint8_t)GIC_HYP_PRIO);
+}
+
 void vgic_int_set_prio_hw(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
+    uint8_t prio = vgic_int_hw_prio(vcpu, interrupt);
 #if (GIC_VERSION != GICV2)
     if (gic_is_priv(interrupt->id)) {
-        gicr_set_prio(interrupt->id, interrupt->prio, interrupt->phys.redist);
+        gicr_set_prio(interrupt->id, prio, interrupt->phys.redist);
     } else {
-        gicd_set_prio(interrupt->id, interrupt->prio);
+        gicd_set_prio(interrupt->id, prio);
     }
 #else
-    gic_set_prio(interrupt->id, interrupt->prio);
+    gic_set_prio(interrupt->id, prio);
 #endif
 }
 
@@ -640,18 +837,32 @@ void vgic_emul_razwi(struct emul_access* acc, struct vgic_reg_handler_info* hand
     }
 }
 
+/**
+ * Must be called holding the interrupt lock. Returns false if the interrupt is owned by another
+ * vcpu, which must then apply the update itself.
+ */
+static bool vgic_int_try_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcpu,
+    struct vgic_int* interrupt, unsigned long data)
+{
+    if (!vgic_get_ownership(vcpu, interrupt)) {
+        return false;
+    }
+
+    vgic_remove_lr(vcpu, interrupt);
+    if (handlers->update_field(vcpu, interrupt, data) && vgic_int_is_hw(interrupt)) {
+        handlers->update_hw(vcpu, interrupt);
+    }
+    vgic_route(vcpu, interrupt);
+    vgic_yield_ownership(vcpu, interrupt);
+
+    return true;
+}
+
 void vgic_int_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcpu,
     struct vgic_int* interrupt, unsigned long data)
 {
     spin_lock(&interrupt->lock);
-    if (vgic_get_ownership(vcpu, interrupt)) {
-        vgic_remove_lr(vcpu, interrupt);
-        if (handlers->update_field(vcpu, interrupt, data) && vgic_int_is_hw(interrupt)) {
-            handlers->update_hw(vcpu, interrupt);
-        }
-        vgic_route(vcpu, interrupt);
-        vgic_yield_ownership(vcpu, interrupt);
-    } else {
+    if (!vgic_int_try_set_field(handlers, vcpu, interrupt, data)) {
         struct cpu_msg msg = {
             VGIC_IPI_ID,
             VGIC_SET_REG,
@@ -662,6 +873,52 @@ void vgic_int_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcp
     spin_unlock(&interrupt->lock);
 }
 
+/**
+ * Applies a write of a single bit field, write-one-to-set or write-one-to-clear, register word to
+ * shared interrupts. Interrupts owned by other vcpus are forwarded with a single message per owner
+ * instead of one per interrupt.
+ */
+static void vgic_int_set_field_batch(struct vgic_reg_handler_info* handlers, struct vcpu* vcpu,
+    irqid_t first_int, uint32_t bitmap)
+{
+    uint32_t remote[PLAT_CPU_NUM] = { 0 };
+    size_t word = first_int / 32;
+
+    /* Bits that would not change an interrupt's enable need not take its lock */
+    if (handlers->regid == VGIC_ISENABLER_ID) {
+        bitmap &= ~vcpu->vm->arch.vgicd.enabled[word];
+    } else if (handlers->regid == VGIC_ICENABLER_ID) {
+        bitmap &= vcpu->vm->arch.vgicd.enabled[word];
+    }
+
+    for (size_t i = 0; i < 32; i++) {
+        if (!bit32_get(bitmap, i)) {
+            continue;
+        }
+        struct vgic_int* interrupt = vgic_get_int(vcpu, first_int + i, vcpu->id);
+        if (interrupt == NULL) {
+            break;
+        }
+        spin_lock(&interrupt->lock);
+        if (!vgic_int_try_set_field(handlers, vcpu, interrupt, 1)) {
+            cpuid_t owner = interrupt->owner->phys_id;
+            remote[owner] = bit32_set(remote[owner], (first_int + i) % 32);
+        }
+        spin_unlock(&interrupt->lock);
+    }
+
+    for (cpuid_t cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        if (remote[cpuid] != 0) {
+            struct cpu_msg msg = {
+                VGIC_IPI_ID,
+                VGIC_SET_REG_BATCH,
+                VGIC_BATCH_MSG_DATA(vcpu->vm->id, handlers->regid, word, remote[cpuid]),
+            };
+            cpu_send_msg(cpuid, &msg);
+        }
+    }
+}
+
 void vgic_emul_generic_access(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
     bool gicr_access, cpuid_t vgicr_id)
 {
@@ -670,9 +927,31 @@ void vgic_emul_generic_access(struct emul_access* acc, struct vgic_reg_handler_i
     unsigned long val = acc->write ? vcpu_readreg(cpu()->vcpu, acc->reg) : 0;
     unsigned long mask = (1ull << field_width) - 1;
     bool valid_access = (GIC_VERSION == GICV2) || !(gicr_access ^ gic_is_priv(first_int));
-
-    if (valid_access) {
+    bool word_access = valid_access && field_width == 1 && !gic_is_priv(first_int) &&
+        ((first_int % 32) + (acc->width * 8)) <= 32;
+    bool enabler = (handlers->regid == VGIC_ISENABLER_ID) || (handlers->regid == VGIC_ICENABLER_ID);
+    bool prio_access = valid_access && (handlers->regid == VGIC_IPRIORITYR_ID) &&
+        !gic_is_priv(first_int) && (first_int + acc->width) <= GIC_MAX_INTERUPTS;
+    uint8_t* prio = prio_access ? &cpu()->vcpu->vm->arch.vgicd.prio[first_int] : NULL;
+
+    if (word_access && acc->write) {
+        uint32_t bitmap = (uint32_t)(bit_extract(val, 0, acc->width * 8) << (first_int % 32));
+        vgic_int_set_field_batch(handlers, cpu()->vcpu, first_int & ~0x1fUL, bitmap);
+    } else if (word_access && enabler) {
+        val = bit32_extract(cpu()->vcpu->vm->arch.vgicd.enabled[first_int / 32], first_int % 32,
+            acc->width * 8);
+    } else if (prio_access && !acc->write) {
+        for (size_t i = 0; i < acc->width; i++) {
+            val |= (unsigned long)prio[i] << (i * 8);
+        }
+    } else if (valid_access) {
         for (size_t i = 0; i < ((acc->width * 8) / field_width); i++) {
+            /* A priority write matching the shadow would change nothing */
+            if (prio_access &&
+                (bit_extract(val, i * 8, 8) & BIT_MASK(8 - GICH_LR_PRIO_LEN, GICH_LR_PRIO_LEN)) ==
+                    prio[i]) {
+                continue;
+            }
             struct vgic_int* interrupt = vgic_get_int(cpu()->vcpu, first_int + i, vgicr_id);
             if (interrupt == NULL) {
                 break;
@@ -840,64 +1119,48 @@ bool vgic_check_reg_alignment(struct emul_access* acc, struct vgic_reg_handler_i
     }
 }
 
+/**
+ * Handlers indexed by the distributor's 128 byte register groups, to which all its register arrays
+ * are aligned. Groups without an entry are reserved or not emulated, so read as zero.
+ */
+static struct vgic_reg_handler_info* const vgicd_reg_handlers[GICD_REG_GROUP_NUM] = {
+    GICD_REG_GROUPS(CTLR) = &vgicd_misc_info,
+    GICD_REG_GROUPS(ISENABLER) = &isenabler_info,
+    GICD_REG_GROUPS(ICENABLER) = &icenabler_info,
+    GICD_REG_GROUPS(ISPENDR) = &ispendr_info,
+    GICD_REG_GROUPS(ICPENDR) = &icpendr_info,
+    GICD_REG_GROUPS(ISACTIVER) = &isactiver_info,
+    GICD_REG_GROUPS(ICACTIVER) = &iactiver_info,
+    GICD_REG_GROUPS(IPRIORITYR) = &ipriorityr_info,
+    GICD_REG_GROUPS(ITARGETSR) = &itargetr_info,
+    GICD_REG_GROUPS(ICFGR) = &icfgr_info,
+    GICD_REG_GROUPS(SGIR) = &sgir_info,
+#if (GIC_VERSION != GICV2)
+    GICD_REG_GROUPS(IROUTER) = &irouter_info,
+#endif
+    GICD_REG_GROUPS(ID) = &vgicd_pidr_info,
+};
+
 bool vgicd_emul_handler(struct emul_access* acc)
 {
-    struct vgic_reg_handler_info* handler_info = NULL;
-    switch (GICD_REG_MASK(acc->addr) >> 7) {
-        case GICD_REG_GROUP(CTLR):
-            handler_info = &vgicd_misc_info;
-            break;
-        case GICD_REG_GROUP(ISENABLER):
-            handler_info = &isenabler_info;
-            break;
-        case GICD_REG_GROUP(ISPENDR):
-            handler_info = &ispendr_info;
-            break;
-        case GICD_REG_GROUP(ISACTIVER):
-            handler_info = &isactiver_info;
-            break;
-        case GICD_REG_GROUP(ICENABLER):
-            handler_info = &icenabler_info;
-            break;
-        case GICD_REG_GROUP(ICPENDR):
-            handler_info = &icpendr_info;
-            break;
-        case GICD_REG_GROUP(ICACTIVER):
-            handler_info = &iactiver_info;
-            break;
-        case GICD_REG_GROUP(ICFGR):
-            handler_info = &icfgr_info;
-            break;
-        case GICD_REG_GROUP(SGIR):
-            handler_info = &sgir_info;
-            break;
-        default: {
-            size_t acc_off = GICD_REG_MASK(acc->addr);
-            if (GICD_IS_REG(IPRIORITYR, acc_off)) {
-                handler_info = &ipriorityr_info;
-            } else if (GICD_IS_REG(ITARGETSR, acc_off)) {
-                handler_info = &itargetr_info;
-            } else if (GICD_IS_REG(IROUTER, acc_off)) {
-                handler_info = &irouter_info;
-            } else if (GICD_IS_REG(ID, acc_off)) {
-                handler_info = &vgicd_pidr_info;
-            } else {
-                handler_info = &razwi_info;
-            }
-        }
+    struct vgic_reg_handler_info* handler_info = vgicd_reg_handlers[GICD_REG_MASK(acc->addr) >> 7];
+    if (handler_info == NULL) {
+        handler_info = &razwi_info;
     }
 
+    /**
+     * No vm-wide lock is taken here, so accesses by different vcpus run in parallel. Each interrupt
+     * is updated under its own lock and the global registers under the distributor's.
+     */
     if (vgic_check_reg_alignment(acc, handler_info)) {
-        spin_lock(&cpu()->vcpu->vm->arch.vgicd.lock);
         handler_info->reg_access(acc, handler_info, false, cpu()->vcpu->id);
-        spin_unlock(&cpu()->vcpu->vm->arch.vgicd.lock);
         return true;
     } else {
         return false;
     }
 }
 
-void vgic_inject_hw(struct vcpu* vcpu, irqid_t id)
+__hot void vgic_inject_hw(struct vcpu* vcpu, irqid_t id)
 {
     struct vgic_int* interrupt = vgic_get_int(vcpu, id, vcpu->id);
     spin_lock(&interrupt->lock);
@@ -908,7 +1171,7 @@ void vgic_inject_hw(struct vcpu* vcpu, irqid_t id)
     spin_unlock(&interrupt->lock);
 }
 
-void vgic_inject(struct vcpu* vcpu, irqid_t id, vcpuid_t source)
+__hot void vgic_inject(struct vcpu* vcpu, irqid_t id, vcpuid_t source)
 {
     struct vgic_int* interrupt = vgic_get_int(vcpu, id, vcpu->id);
     if (interrupt != NULL) {
@@ -922,6 +1185,24 @@ void vgic_inject(struct vcpu* vcpu, irqid_t id, vcpuid_t source)
     }
 }
 
+/**
+ * Check if any of the vcpu's list registers holds a pending interrupt, which would prevent a guest
+ * wfi from waiting. This is a conservative approximation as the guest's running priority and
+ * priority mask are not taken into account.
+ */
+bool vgic_vcpu_irq_pending(struct vcpu* vcpu)
+{
+    uint64_t elrsr = gich_get_elrsr();
+
+    for (size_t i = 0; i < NUM_LRS; i++) {
+        if (!bit64_get(elrsr, i) && ((gich_read_lr(i) & GICH_LR_STATE_MSK) == GICH_LR_STATE_PND)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void vgic_ipi_handler(uint32_t event, uint64_t data)
 {
     uint16_t vm_id = VGIC_MSG_VM(data);
@@ -965,6 +1246,15 @@ void vgic_ipi_handler(uint32_t event, uint64_t data)
                 vgic_int_set_field(handlers, cpu()->vcpu, interrupt, val);
             }
         } break;
+
+        case VGIC_SET_REG_BATCH: {
+            struct vgic_reg_handler_info* handlers =
+                vgic_get_reg_handler_info(VGIC_BATCH_MSG_REG(data));
+            if (handlers != NULL) {
+                vgic_int_set_field_batch(handlers, cpu()->vcpu, VGIC_BATCH_MSG_WORD(data) * 32,
+                    VGIC_BATCH_MSG_BITMAP(data));
+            }
+        } break;
     }
 }
 
@@ -986,16 +1276,12 @@ static inline struct vgic_int* vgic_highest_prio_spilled(struct vcpu* vcpu, unsi
             if (!(vgic_get_state(temp_irq) & flags)) {
                 continue;
             }
-            bool irq_is_null = irq == NULL;
-            uint8_t irq_prio = irq_is_null ? GIC_LOWEST_PRIO : irq->prio;
-            irqid_t irq_id = irq_is_null ? GIC_MAX_VALID_INTERRUPTS : irq->id;
-            bool is_higher_prio = (temp_irq->prio < irq_prio);
-            bool is_same_prio = temp_irq->prio == irq_prio;
-            bool is_lower_id = temp_irq->id < irq_id;
-            if (is_higher_prio || (is_same_prio && is_lower_id)) {
+            /* Lists are sorted, so the first matching interrupt is the list's highest priority */
+            if (irq == NULL || vgic_spilled_cmp((node_t*)temp_irq, (node_t*)irq) < 0) {
                 irq = temp_irq;
                 *outlist = list;
             }
+            break;
         }
     }
     return irq;
@@ -1003,7 +1289,9 @@ static inline struct vgic_int* vgic_highest_prio_spilled(struct vcpu* vcpu, unsi
 
 static void vgic_refill_lrs(struct vcpu* vcpu, bool npie)
 {
-    uint64_t elrsr = gich_get_elrsr();
+    PROF_SCOPE(PROF_VGIC_REFILL_LRS);
+
+    uint64_t elrsr = vgic_lr_elrsr(vcpu);
     ssize_t lr_ind = bit64_ffs(elrsr & BIT64_MASK(0, NUM_LRS));
     unsigned flags = npie ? PEND : ACT | PEND;
     spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
@@ -1027,7 +1315,7 @@ static void vgic_refill_lrs(struct vcpu* vcpu, bool npie)
             break;
         }
         flags = ACT | PEND;
-        elrsr = gich_get_elrsr();
+        elrsr = vgic_lr_elrsr(vcpu);
         lr_ind = bit64_ffs(elrsr & BIT64_MASK(0, NUM_LRS));
     }
     spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
@@ -1059,8 +1347,8 @@ void vgic_handle_trapped_eoir(struct vcpu* vcpu)
     uint64_t eisr = gich_get_eisr();
     int64_t lr_ind = bit64_ffs(eisr & BIT64_MASK(0, NUM_LRS));
     while (lr_ind >= 0) {
-        unsigned long lr_val = gich_read_lr(lr_ind);
-        gich_write_lr(lr_ind, 0);
+        unsigned long lr_val = vgic_lr_read(vcpu, lr_ind);
+        vgic_lr_write(vcpu, lr_ind, 0);
 
         struct vgic_int* interrupt = vgic_get_int(vcpu, GICH_LR_VID(lr_val), vcpu->id);
         if (interrupt == NULL) {
@@ -1080,7 +1368,7 @@ void vgic_handle_trapped_eoir(struct vcpu* vcpu)
     }
 }
 
-void gic_maintenance_handler(irqid_t irq_id)
+__hot void gic_maintenance_handler(irqid_t irq_id)
 {
     uint32_t misr = gich_get_misr();
 
@@ -1146,9 +1434,110 @@ void vgic_set_hw(struct vm* vm, irqid_t id)
         if (interrupt != NULL) {
             spin_lock(&interrupt->lock);
             interrupt->hw = true;
+            vgic_int_set_prio_hw(vm_get_vcpu(vm, 0), interrupt);
             spin_unlock(&interrupt->lock);
         } else {
             WARNING("trying to link non-existent virtual irq to physical irq")
         }
     }
 }
+
+#define VGIC_ROUTE_REG_ID ((GIC_VERSION == GICV2) ? VGIC_ITARGETSR_ID : VGIC_IROUTER_ID)
+
+bool vgic_snapshot_init(struct vm* vm, struct vgic_snapshot* snap)
+{
+    size_t size = vm->arch.vgicd.int_num * sizeof(struct vgic_int_snapshot);
+    snap->interrupts = vm_arena_alloc(vm, size);
+    return snap->interrupts != NULL;
+}
+
+static void vgic_int_snapshot_save(struct vcpu* vcpu, struct vgic_int* interrupt,
+    struct vgic_int_snapshot* snap)
+{
+    spin_lock(&interrupt->lock);
+    snap->cfg = (uint8_t)icfgr_info.read_field(vcpu, interrupt);
+    snap->prio = (uint8_t)ipriorityr_info.read_field(vcpu, interrupt);
+    snap->enabled = isenabler_info.read_field(vcpu, interrupt) != 0;
+    snap->route = 0;
+    if (!gic_is_priv(interrupt->id)) {
+        snap->route = reg_handler_info_table[VGIC_ROUTE_REG_ID]->read_field(vcpu, interrupt);
+    }
+    spin_unlock(&interrupt->lock);
+}
+
+/**
+ * The configuration is written back through the same handlers as the guest's own writes, so that
+ * the physical interrupts backing hw interrupts are reprogrammed as well. Enabling comes last, once
+ * the interrupt is routed.
+ */
+static void vgic_int_snapshot_restore(struct vcpu* vcpu, struct vgic_int* interrupt,
+    const struct vgic_int_snapshot* snap)
+{
+    vgic_int_set_field(&icfgr_info, vcpu, interrupt, snap->cfg);
+    vgic_int_set_field(&ipriorityr_info, vcpu, interrupt, snap->prio);
+    if (!gic_is_priv(interrupt->id)) {
+        vgic_int_set_field(reg_handler_info_table[VGIC_ROUTE_REG_ID], vcpu, interrupt, snap->route);
+    }
+    if (snap->enabled) {
+        vgic_int_set_field(&isenabler_info, vcpu, interrupt, 1);
+    }
+}
+
+void vgic_snapshot_save(struct vm* vm, struct vgic_snapshot* snap)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    snap->CTLR = vm->arch.vgicd.CTLR;
+    for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
+        vgic_int_snapshot_save(vcpu, &vm->arch.vgicd.interrupts[i], &snap->interrupts[i]);
+    }
+}
+
+/**
+ * Only the configuration is restored on top of a reset distributor, the pending and active state
+ * of the interrupts being dropped. So interrupts in flight when the snapshot was taken are lost,
+ * except for level triggered hw interrupts, which the device raises again.
+ */
+void vgic_snapshot_restore(struct vm* vm, const struct vgic_snapshot* snap)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    vgic_reset(vm);
+
+    spin_lock(&vm->arch.vgicd.lock);
+    vm->arch.vgicd.CTLR = snap->CTLR;
+    spin_unlock(&vm->arch.vgicd.lock);
+
+    for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
+        vgic_int_snapshot_restore(vcpu, &vm->arch.vgicd.interrupts[i], &snap->interrupts[i]);
+    }
+}
+
+void vgic_cpu_snapshot_save(struct vcpu* vcpu, struct vgic_priv_snapshot* snap)
+{
+    snap->vmcr = gich_get_vmcr();
+#if (GIC_VERSION != GICV2)
+    snap->vgicr_ctlr = vcpu->arch.vgic_priv.vgicr.CTLR;
+#endif
+    for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
+        vgic_int_snapshot_save(vcpu, &vcpu->arch.vgic_priv.interrupts[i], &snap->interrupts[i]);
+    }
+}
+
+/* Must run after the distributor is restored, which the cpu interface enable is taken from */
+void vgic_cpu_snapshot_restore(struct vcpu* vcpu, const struct vgic_priv_snapshot* snap)
+{
+    vgic_cpu_reset(vcpu);
+
+#if (GIC_VERSION != GICV2)
+    spin_lock(&vcpu->arch.vgic_priv.vgicr.lock);
+    vcpu->arch.vgic_priv.vgicr.CTLR = snap->vgicr_ctlr;
+    spin_unlock(&vcpu->arch.vgic_priv.vgicr.lock);
+#endif
+    for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
+        vgic_int_snapshot_restore(vcpu, &vcpu->arch.vgic_priv.interrupts[i], &snap->interrupts[i]);
+    }
+
+    gich_set_vmcr(snap->vmcr);
+    vgic_update_enable(vcpu);
+}
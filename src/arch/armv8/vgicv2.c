@@ -12,6 +12,7 @@
 #include <interrupts.h>
 #include <vm.h>
 #include <platform.h>
+#include <string.h>
 
 bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
@@ -20,9 +21,9 @@ bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt)
     return !priv && has_other_targets;
 }
 
-uint8_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt)
+cpumask_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
-    return interrupt->targets;
+    return cpumask_from_map(interrupt->targets);
 }
 
 bool vgicd_set_trgt(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long targets)
@@ -32,7 +33,8 @@ bool vgicd_set_trgt(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long
     }
 
     uint8_t prev_targets = interrupt->targets;
-    targets = vm_translate_to_pcpu_mask(vcpu->vm, targets, GIC_TARGET_BITS);
+    cpumask_t ptargets = vm_translate_to_pcpu_mask(vcpu->vm, targets, GIC_TARGET_BITS);
+    targets = cpumask_to_map(&ptargets);
     interrupt->targets = (uint8_t)targets;
     return prev_targets != targets;
 }
@@ -47,7 +49,8 @@ unsigned long vgicd_get_trgt(struct vcpu* vcpu, struct vgic_int* interrupt)
     if (gic_is_priv(interrupt->id)) {
         return (((unsigned long)1) << vcpu->id);
     } else {
-        return vm_translate_to_vcpu_mask(vcpu->vm, interrupt->targets, GIC_TARGET_BITS);
+        cpumask_t ptargets = cpumask_from_map(interrupt->targets);
+        return vm_translate_to_vcpu_mask(vcpu->vm, &ptargets);
     }
 }
 
@@ -58,7 +61,7 @@ void vgicd_emul_sgiregs_access(struct emul_access* acc, struct vgic_reg_handler_
 
     if ((acc->addr & 0xfff) == (((uintptr_t)&gicd->SGIR) & 0xfff)) {
         if (acc->write) {
-            cpumap_t trgtlist = 0;
+            cpumask_t trgtlist = CPUMASK_EMPTY;
             irqid_t int_id = GICD_SGIR_SGIINTID(val);
             switch (GICD_SGIR_TRGLSTFLT(val)) {
                 case 0:
@@ -66,10 +69,11 @@ void vgicd_emul_sgiregs_access(struct emul_access* acc, struct vgic_reg_handler_
                         GIC_TARGET_BITS);
                     break;
                 case 1:
-                    trgtlist = cpu()->vcpu->vm->cpus & ~(1U << cpu()->vcpu->phys_id);
+                    trgtlist = cpu()->vcpu->vm->cpus;
+                    cpumask_clear(&trgtlist, cpu()->vcpu->phys_id);
                     break;
                 case 2:
-                    trgtlist = (1U << cpu()->id);
+                    trgtlist = cpumask_of(cpu()->id);
                     break;
                 case 3:
                     return;
@@ -124,6 +128,29 @@ void vgic_inject_sgi(struct vcpu* vcpu, struct vgic_int* interrupt, vcpuid_t sou
     spin_unlock(&interrupt->lock);
 }
 
+static void vgicd_int_reset(struct vgic_int* interrupt)
+{
+    interrupt->owner = NULL;
+    interrupt->state = INV;
+    interrupt->prio = GIC_LOWEST_PRIO;
+    interrupt->cfg = 0;
+    interrupt->targets = 0;
+    interrupt->in_lr = false;
+    interrupt->enabled = false;
+}
+
+static void vgic_priv_int_reset(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    interrupt->owner = vcpu;
+    interrupt->state = INV;
+    interrupt->prio = GIC_LOWEST_PRIO;
+    interrupt->cfg = 0;
+    interrupt->sgi.act = 0;
+    interrupt->sgi.pend = 0;
+    interrupt->in_lr = false;
+    interrupt->enabled = (interrupt->id < GIC_MAX_SGIS);
+}
+
 void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 {
     vm->arch.vgicd.CTLR = 0;
@@ -138,23 +165,18 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
         (vaddr_t)platform.arch.gic.gicv_addr, n);
 
     size_t vgic_int_size = vm->arch.vgicd.int_num * sizeof(struct vgic_int);
-    vm->arch.vgicd.interrupts = mem_alloc_page(NUM_PAGES(vgic_int_size), SEC_HYP_VM, false);
+    vm->arch.vgicd.interrupts = vm_arena_alloc(vm, vgic_int_size);
     if (vm->arch.vgicd.interrupts == NULL) {
         ERROR("failed to alloc vgic");
     }
 
     for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
-        vm->arch.vgicd.interrupts[i].owner = NULL;
         vm->arch.vgicd.interrupts[i].lock = SPINLOCK_INITVAL;
         vm->arch.vgicd.interrupts[i].id = i + GIC_CPU_PRIV;
-        vm->arch.vgicd.interrupts[i].state = INV;
-        vm->arch.vgicd.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vm->arch.vgicd.interrupts[i].cfg = 0;
-        vm->arch.vgicd.interrupts[i].targets = 0;
         vm->arch.vgicd.interrupts[i].hw = false;
-        vm->arch.vgicd.interrupts[i].in_lr = false;
-        vm->arch.vgicd.interrupts[i].enabled = false;
+        vgicd_int_reset(&vm->arch.vgicd.interrupts[i]);
     }
+    vgicd_shadow_reset(&vm->arch.vgicd);
 
     vm->arch.vgicd_emul = (struct emul_mem){ .va_base = vgic_dscrp->gicd_addr,
         .size = ALIGN(sizeof(struct gicd_hw), PAGE_SIZE),
@@ -168,21 +190,42 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 void vgic_cpu_init(struct vcpu* vcpu)
 {
     for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
-        vcpu->arch.vgic_priv.interrupts[i].owner = vcpu;
         vcpu->arch.vgic_priv.interrupts[i].lock = SPINLOCK_INITVAL;
         vcpu->arch.vgic_priv.interrupts[i].id = i;
-        vcpu->arch.vgic_priv.interrupts[i].state = INV;
-        vcpu->arch.vgic_priv.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vcpu->arch.vgic_priv.interrupts[i].cfg = 0;
-        vcpu->arch.vgic_priv.interrupts[i].sgi.act = 0;
-        vcpu->arch.vgic_priv.interrupts[i].sgi.pend = 0;
         vcpu->arch.vgic_priv.interrupts[i].hw = false;
-        vcpu->arch.vgic_priv.interrupts[i].in_lr = false;
-        vcpu->arch.vgic_priv.interrupts[i].enabled = false;
+        vgic_priv_int_reset(vcpu, &vcpu->arch.vgic_priv.interrupts[i]);
     }
 
-    for (size_t i = 0; i < GIC_MAX_SGIS; i++) {
-        vcpu->arch.vgic_priv.interrupts[i].enabled = true;
+    list_init(&vcpu->arch.vgic_spilled);
+}
+
+void vgic_reset(struct vm* vm)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    vm->arch.vgicd.CTLR = 0;
+    for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
+        struct vgic_int* interrupt = &vm->arch.vgicd.interrupts[i];
+        spin_lock(&interrupt->lock);
+        vgic_int_reset_hw(vcpu, interrupt);
+        vgicd_int_reset(interrupt);
+        spin_unlock(&interrupt->lock);
+    }
+    vgicd_shadow_reset(&vm->arch.vgicd);
+
+    list_init(&vm->arch.vgic_spilled);
+}
+
+void vgic_cpu_reset(struct vcpu* vcpu)
+{
+    vgic_lrs_reset(vcpu);
+
+    for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
+        struct vgic_int* interrupt = &vcpu->arch.vgic_priv.interrupts[i];
+        spin_lock(&interrupt->lock);
+        vgic_int_reset_hw(vcpu, interrupt);
+        vgic_priv_int_reset(vcpu, interrupt);
+        spin_unlock(&interrupt->lock);
     }
 
     list_init(&vcpu->arch.vgic_spilled);
@@ -12,13 +12,23 @@
 #include <interrupts.h>
 #include <vm.h>
 #include <platform.h>
+#include <string.h>
 
 #define GICR_IS_REG(REG, offset)                    \
     (((offset) >= offsetof(struct gicr_hw, REG)) && \
         (offset) < (offsetof(struct gicr_hw, REG) + sizeof(gicr[0].REG)))
 #define GICR_REG_OFF(REG)   (offsetof(struct gicr_hw, REG) & 0x1ffff)
 #define GICR_REG_MASK(ADDR) ((ADDR) & 0x1ffff)
+#define GICR_REG_GROUP(REG) (GICR_REG_OFF(REG) >> 7)
+#define GICR_REG_GROUP_LAST(REG) \
+    (GICR_REG_MASK(offsetof(struct gicr_hw, REG) + sizeof(gicr[0].REG) - 1) >> 7)
+#define GICR_REG_GROUPS(REG) [GICR_REG_GROUP(REG)... GICR_REG_GROUP_LAST(REG)]
+#define GICR_REG_GROUP_NUM   ((GICR_REG_MASK(~0UL) >> 7) + 1)
 #define GICD_REG_MASK(ADDR) ((ADDR) & (GIC_VERSION == GICV2 ? 0xfffUL : 0xffffUL))
+#define GICR_FRAME_SHIFT     (17)
+
+_Static_assert(sizeof(struct gicr_hw) == (1UL << GICR_FRAME_SHIFT),
+    "the redistributors' frames must be indexed by a shift");
 
 bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
@@ -30,13 +40,24 @@ bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt)
     return any || (!routed_here && route_valid);
 }
 
-uint8_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt)
+cpumask_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
+    cpumask_t targets = CPUMASK_EMPTY;
+
     if (vgic_broadcast(vcpu, interrupt)) {
-        return cpu()->vcpu->vm->cpus & ~(1U << cpu()->vcpu->phys_id);
+        targets = cpu()->vcpu->vm->cpus;
+        cpumask_clear(&targets, cpu()->vcpu->phys_id);
     } else {
-        return (1 << interrupt->phys.route);
+        /* The physical route is an affinity, so look up the cpu it names */
+        for (cpuid_t i = 0; i < platform.cpu_num; i++) {
+            if ((cpu_id_to_mpidr(i) & MPIDR_AFF_MSK) == interrupt->phys.route) {
+                cpumask_set(&targets, i);
+                break;
+            }
+        }
     }
+
+    return targets;
 }
 
 bool vgic_int_set_route(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long route)
@@ -108,10 +129,12 @@ void vgicr_emul_typer_access(struct emul_access* acc, struct vgic_reg_handler_in
 void vgicr_emul_pidr_access(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
     bool gicr_access, vcpuid_t vgicr_id)
 {
+    /* The group holding the id registers also spans the reserved space before them */
+    size_t acc_offset = GICR_REG_MASK(acc->addr - cpu()->vcpu->vm->arch.vgicr_addr);
     if (!acc->write) {
         unsigned long val = 0;
         cpuid_t pgicr_id = vm_translate_to_pcpuid(cpu()->vcpu->vm, vgicr_id);
-        if (pgicr_id != INVALID_CPUID) {
+        if ((pgicr_id != INVALID_CPUID) && GICR_IS_REG(ID, acc_offset)) {
             val = gicr[pgicr_id].ID[((acc->addr & 0xff) - 0xd0) / 4];
         }
         vcpu_writereg(cpu()->vcpu, acc->reg, val);
@@ -188,59 +211,51 @@ struct vgic_reg_handler_info vgicr_pidr_info = {
     0b0100,
 };
 
-static inline vcpuid_t vgicr_get_id(struct emul_access* acc)
+static inline vcpuid_t vgicr_get_id(vaddr_t vgicr_off)
 {
-    return (acc->addr - cpu()->vcpu->vm->arch.vgicr_addr) / sizeof(struct gicr_hw);
+    return vgicr_off >> GICR_FRAME_SHIFT;
 }
 
+/**
+ * Handlers indexed by the redistributor's 128 byte register groups. The first group holds both
+ * CTLR and TYPER, which is told apart on access. Groups without an entry read as zero.
+ */
+static struct vgic_reg_handler_info* const vgicr_reg_handlers[GICR_REG_GROUP_NUM] = {
+    GICR_REG_GROUPS(CTLR) = &vgicr_ctrl_info,
+    GICR_REG_GROUPS(ID) = &vgicr_pidr_info,
+    GICR_REG_GROUPS(ISENABLER0) = &isenabler_info,
+    GICR_REG_GROUPS(ICENABLER0) = &icenabler_info,
+    GICR_REG_GROUPS(ISPENDR0) = &ispendr_info,
+    GICR_REG_GROUPS(ICPENDR0) = &icpendr_info,
+    GICR_REG_GROUPS(ISACTIVER0) = &isactiver_info,
+    GICR_REG_GROUPS(ICACTIVER0) = &iactiver_info,
+    GICR_REG_GROUPS(IPRIORITYR) = &ipriorityr_info,
+    GICR_REG_GROUPS(ICFGR0) = &icfgr_info,
+};
+
+/**
+ * The redistributor's lock only guards its CTLR, the interrupts' state having locks of its own, so
+ * it is only taken for the CTLR group or another vcpu's redistributor. A vcpu accessing the
+ * registers of its own SGIs and PPIs, as it does most of the time, goes without it.
+ */
 bool vgicr_emul_handler(struct emul_access* acc)
 {
-    struct vgic_reg_handler_info* handler_info = NULL;
-    switch (GICR_REG_MASK(acc->addr)) {
-        case GICR_REG_OFF(CTLR):
-            handler_info = &vgicr_ctrl_info;
-            break;
-        case GICR_REG_OFF(ISENABLER0):
-            handler_info = &isenabler_info;
-            break;
-        case GICR_REG_OFF(ISPENDR0):
-            handler_info = &ispendr_info;
-            break;
-        case GICR_REG_OFF(ISACTIVER0):
-            handler_info = &iactiver_info;
-            break;
-        case GICR_REG_OFF(ICENABLER0):
-            handler_info = &icenabler_info;
-            break;
-        case GICR_REG_OFF(ICPENDR0):
-            handler_info = &icpendr_info;
-            break;
-        case GICR_REG_OFF(ICACTIVER0):
-            handler_info = &icfgr_info;
-            break;
-        case GICR_REG_OFF(ICFGR0):
-        case GICR_REG_OFF(ICFGR1):
-            handler_info = &icfgr_info;
-            break;
-        default: {
-            size_t base_offset = acc->addr - cpu()->vcpu->vm->arch.vgicr_addr;
-            size_t acc_offset = GICR_REG_MASK(base_offset);
-            if (GICR_IS_REG(TYPER, acc_offset)) {
-                handler_info = &vgicr_typer_info;
-            } else if (GICR_IS_REG(IPRIORITYR, acc_offset)) {
-                handler_info = &ipriorityr_info;
-            } else if (GICR_IS_REG(ID, acc_offset)) {
-                handler_info = &vgicr_pidr_info;
-            } else {
-                handler_info = &razwi_info;
-            }
-        }
+    vaddr_t vgicr_off = acc->addr - cpu()->vcpu->vm->arch.vgicr_addr;
+    size_t acc_offset = GICR_REG_MASK(vgicr_off);
+    struct vgic_reg_handler_info* handler_info = vgicr_reg_handlers[acc_offset >> 7];
+    if (handler_info == NULL) {
+        handler_info = &razwi_info;
+    } else if (GICR_IS_REG(TYPER, acc_offset)) {
+        handler_info = &vgicr_typer_info;
     }
 
     if (vgic_check_reg_alignment(acc, handler_info)) {
-        vcpuid_t vgicr_id = vgicr_get_id(acc);
-        struct vcpu* vcpu =
-            vgicr_id == cpu()->vcpu->id ? cpu()->vcpu : vm_get_vcpu(cpu()->vcpu->vm, vgicr_id);
+        vcpuid_t vgicr_id = vgicr_get_id(vgicr_off);
+        if ((vgicr_id == cpu()->vcpu->id) && (handler_info != &vgicr_ctrl_info)) {
+            handler_info->reg_access(acc, handler_info, true, vgicr_id);
+            return true;
+        }
+        struct vcpu* vcpu = vm_get_vcpu(cpu()->vcpu->vm, vgicr_id);
         spin_lock(&vcpu->arch.vgic_priv.vgicr.lock);
         handler_info->reg_access(acc, handler_info, true, vgicr_id);
         spin_unlock(&vcpu->arch.vgic_priv.vgicr.lock);
@@ -259,16 +274,17 @@ bool vgic_icc_sgir_handler(struct emul_access* acc)
             sgir |= (sgir_high << 32);
         }
         irqid_t int_id = ICC_SGIR_SGIINTID(sgir);
-        cpumap_t trgtlist;
+        cpumask_t trgtlist;
         if (sgir & ICC_SGIR_IRM_BIT) {
-            trgtlist = cpu()->vcpu->vm->cpus & ~(1U << cpu()->vcpu->phys_id);
+            trgtlist = cpu()->vcpu->vm->cpus;
+            cpumask_clear(&trgtlist, cpu()->vcpu->phys_id);
         } else {
             /**
              * TODO: we are assuming the vm has a single cluster. Change this when adding virtual
              * cluster support.
              */
             trgtlist = vm_translate_to_pcpu_mask(cpu()->vcpu->vm, ICC_SGIR_TRGLSTFLT(sgir),
-                cpu()->vcpu->vm->cpu_num);
+                vm_cpu_num(cpu()->vcpu->vm));
         }
         vgic_send_sgi_msg(cpu()->vcpu, trgtlist, int_id);
     }
@@ -284,36 +300,59 @@ bool vgic_icc_sre_handler(struct emul_access* acc)
     return true;
 }
 
+static void vgicd_int_reset(struct vgic_int* interrupt)
+{
+    interrupt->owner = NULL;
+    interrupt->state = INV;
+    interrupt->prio = GIC_LOWEST_PRIO;
+    interrupt->cfg = 0;
+    interrupt->route = GICD_IROUTER_INV;
+    interrupt->phys.route = GICD_IROUTER_INV;
+    interrupt->in_lr = false;
+    interrupt->enabled = false;
+}
+
+static void vgicr_int_reset(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    interrupt->owner = NULL;
+    interrupt->state = INV;
+    interrupt->prio = GIC_LOWEST_PRIO;
+    interrupt->cfg = (interrupt->id < GIC_MAX_SGIS) ? 0b10 : 0;
+    interrupt->route = GICD_IROUTER_INV;
+    interrupt->phys.redist = vcpu->phys_id;
+    interrupt->in_lr = false;
+    interrupt->enabled = false;
+}
+
 void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 {
     vm->arch.vgicr_addr = vgic_dscrp->gicr_addr;
     vm->arch.vgicd.CTLR = 0;
     size_t vtyper_itln = vgic_get_itln(vgic_dscrp);
     vm->arch.vgicd.int_num = 32 * (vtyper_itln + 1);
+    /**
+     * TYPER.LPIS, and GICR_TYPER.PLPIS below, are deliberately left clear, as there is no ITS, nor
+     * physical LPI support behind it, to emulate. Guests then use wired interrupts for passthrough
+     * devices instead of probing for LPIs.
+     */
     vm->arch.vgicd.TYPER = ((vtyper_itln << GICD_TYPER_ITLN_OFF) & GICD_TYPER_ITLN_MSK) |
         (((vm->cpu_num - 1) << GICD_TYPER_CPUNUM_OFF) & GICD_TYPER_CPUNUM_MSK) |
         (((10 - 1) << GICD_TYPER_IDBITS_OFF) & GICD_TYPER_IDBITS_MSK);
     vm->arch.vgicd.IIDR = gicd->IIDR;
 
     size_t vgic_int_size = vm->arch.vgicd.int_num * sizeof(struct vgic_int);
-    vm->arch.vgicd.interrupts = mem_alloc_page(NUM_PAGES(vgic_int_size), SEC_HYP_VM, false);
+    vm->arch.vgicd.interrupts = vm_arena_alloc(vm, vgic_int_size);
     if (vm->arch.vgicd.interrupts == NULL) {
         ERROR("failed to alloc vgic");
     }
 
     for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
-        vm->arch.vgicd.interrupts[i].owner = NULL;
         vm->arch.vgicd.interrupts[i].lock = SPINLOCK_INITVAL;
         vm->arch.vgicd.interrupts[i].id = i + GIC_CPU_PRIV;
-        vm->arch.vgicd.interrupts[i].state = INV;
-        vm->arch.vgicd.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vm->arch.vgicd.interrupts[i].cfg = 0;
-        vm->arch.vgicd.interrupts[i].route = GICD_IROUTER_INV;
-        vm->arch.vgicd.interrupts[i].phys.route = GICD_IROUTER_INV;
         vm->arch.vgicd.interrupts[i].hw = false;
-        vm->arch.vgicd.interrupts[i].in_lr = false;
-        vm->arch.vgicd.interrupts[i].enabled = false;
+        vgicd_int_reset(&vm->arch.vgicd.interrupts[i]);
     }
+    vgicd_shadow_reset(&vm->arch.vgicd);
 
     vm->arch.vgicd_emul = (struct emul_mem){ .va_base = vgic_dscrp->gicd_addr,
         .size = ALIGN(sizeof(struct gicd_hw), PAGE_SIZE),
@@ -330,6 +369,25 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
         vcpu->arch.vgic_priv.vgicr.IIDR = gicr[cpu()->id].IIDR;
     }
 
+    /**
+     * The last page of the distributor and of each redistributor's RD frame holds nothing but the
+     * read only id registers, so those are served from shadow pages without trapping.
+     */
+    size_t id_num = sizeof(gicd->ID) / sizeof(uint32_t);
+    uint32_t* gicd_shadow = vm_emul_add_shadow(vm, vgic_dscrp->gicd_addr + 0xF000, NULL);
+    for (size_t i = 0; (gicd_shadow != NULL) && (i < id_num); i++) {
+        gicd_shadow[(0xFD0 / sizeof(uint32_t)) + i] = gicd->ID[i];
+    }
+    uint32_t* gicr_shadow = NULL;
+    for (vcpuid_t vcpuid = 0; vcpuid < vm->cpu_num; vcpuid++) {
+        vaddr_t va = vgic_dscrp->gicr_addr + (vcpuid * sizeof(struct gicr_hw)) + 0xF000;
+        uint32_t* shadow = vm_emul_add_shadow(vm, va, gicr_shadow);
+        for (size_t i = 0; (shadow != NULL) && (gicr_shadow == NULL) && (i < id_num); i++) {
+            shadow[(0xFD0 / sizeof(uint32_t)) + i] = gicr[cpu()->id].ID[i];
+        }
+        gicr_shadow = (gicr_shadow != NULL) ? gicr_shadow : shadow;
+    }
+
     vm->arch.vgicr_emul = (struct emul_mem){ .va_base = vgic_dscrp->gicr_addr,
         .size = ALIGN(sizeof(struct gicr_hw), PAGE_SIZE) * vm->cpu_num,
         .handler = vgicr_emul_handler };
@@ -350,21 +408,43 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 void vgic_cpu_init(struct vcpu* vcpu)
 {
     for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
-        vcpu->arch.vgic_priv.interrupts[i].owner = NULL;
         vcpu->arch.vgic_priv.interrupts[i].lock = SPINLOCK_INITVAL;
         vcpu->arch.vgic_priv.interrupts[i].id = i;
-        vcpu->arch.vgic_priv.interrupts[i].state = INV;
-        vcpu->arch.vgic_priv.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vcpu->arch.vgic_priv.interrupts[i].cfg = 0;
-        vcpu->arch.vgic_priv.interrupts[i].route = GICD_IROUTER_INV;
-        vcpu->arch.vgic_priv.interrupts[i].phys.redist = vcpu->phys_id;
         vcpu->arch.vgic_priv.interrupts[i].hw = false;
-        vcpu->arch.vgic_priv.interrupts[i].in_lr = false;
-        vcpu->arch.vgic_priv.interrupts[i].enabled = false;
+        vgicr_int_reset(vcpu, &vcpu->arch.vgic_priv.interrupts[i]);
+    }
+
+    list_init(&vcpu->arch.vgic_spilled);
+}
+
+void vgic_reset(struct vm* vm)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    vm->arch.vgicd.CTLR = 0;
+    for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
+        struct vgic_int* interrupt = &vm->arch.vgicd.interrupts[i];
+        spin_lock(&interrupt->lock);
+        vgic_int_reset_hw(vcpu, interrupt);
+        vgicd_int_reset(interrupt);
+        spin_unlock(&interrupt->lock);
     }
+    vgicd_shadow_reset(&vm->arch.vgicd);
+
+    list_init(&vm->arch.vgic_spilled);
+}
 
-    for (size_t i = 0; i < GIC_MAX_SGIS; i++) {
-        vcpu->arch.vgic_priv.interrupts[i].cfg = 0b10;
+void vgic_cpu_reset(struct vcpu* vcpu)
+{
+    vgic_lrs_reset(vcpu);
+
+    vcpu->arch.vgic_priv.vgicr.CTLR = 0;
+    for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
+        struct vgic_int* interrupt = &vcpu->arch.vgic_priv.interrupts[i];
+        spin_lock(&interrupt->lock);
+        vgic_int_reset_hw(vcpu, interrupt);
+        vgicr_int_reset(vcpu, interrupt);
+        spin_unlock(&interrupt->lock);
     }
 
     list_init(&vcpu->arch.vgic_spilled);
@@ -8,18 +8,69 @@
 #include <fences.h>
 #include <string.h>
 #include <config.h>
+#include <arch/pmu.h>
+#ifdef AARCH64
+#include <arch/mpam.h>
+#endif
+
+static void vm_pv_time_init(struct vm* vm, vaddr_t addr)
+{
+    vm->arch.pv_time = NULL;
+    if (addr == 0) {
+        return;
+    }
+
+    if ((addr % PAGE_SIZE) != 0) {
+        WARNING("VM %d stolen time records not page aligned. Ignored.", vm->id);
+        return;
+    }
+
+    size_t n = NUM_PAGES(vm->cpu_num * sizeof(struct pv_time_st));
+    struct pv_time_st* pv_time = mem_alloc_page(n, SEC_HYP_VM, false);
+    if (pv_time == NULL) {
+        ERROR("failed to allocate stolen time records");
+    }
+    memset(pv_time, 0, n * PAGE_SIZE);
+
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, (vaddr_t)pv_time, &pa);
+    struct ppages ppages = mem_ppages_get(pa, n);
+    mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, addr, n, PTE_VM_RO_FLAGS);
+    vm->arch.pv_time = pv_time;
+}
 
 void vm_arch_init(struct vm* vm, const struct vm_config* config)
 {
     if (vm->master == cpu()->id) {
         vgic_init(vm, &config->platform.arch.gic);
+        vm_pv_time_init(vm, config->platform.arch.pv_time_addr);
+#ifdef MEM_PROT_MMU
+        scmi_vm_init(vm, config);
+#endif
     }
     cpu_sync_and_clear_msgs(&vm->sync);
+
+    if (vm->arch.pv_time != NULL) {
+        cpu()->vcpu->steal.record = &vm->arch.pv_time[cpu()->vcpu->id];
+    }
+}
+
+void vcpu_arch_steal_update(struct vcpu* vcpu, uint64_t steal_ns)
+{
+    ((struct pv_time_st*)vcpu->steal.record)->stolen_time = steal_ns;
+}
+
+void vm_arch_reset(struct vm* vm)
+{
+    vgic_reset(vm);
+#ifdef MEM_PROT_MMU
+    scmi_vm_reset(vm);
+#endif
 }
 
 struct vcpu* vm_get_vcpu_by_mpidr(struct vm* vm, unsigned long mpidr)
 {
-    for (cpuid_t vcpuid = 0; vcpuid < vm->cpu_num; vcpuid++) {
+    for (cpuid_t vcpuid = 0; vcpuid < vm_cpu_num(vm); vcpuid++) {
         struct vcpu* vcpu = vm_get_vcpu(vm, vcpuid);
         if ((vcpu->arch.vmpidr & MPIDR_AFF_MSK) == (mpidr & MPIDR_AFF_MSK)) {
             return vcpu;
@@ -54,7 +105,168 @@ void vcpu_arch_init(struct vcpu* vcpu, struct vm* vm)
 
     vcpu_arch_profile_init(vcpu, vm);
 
+    if (vm->config->trap_wfi) {
+        sysreg_hcr_el2_write(sysreg_hcr_el2_read() | HCR_TWI_BIT);
+    }
+
     vgic_cpu_init(vcpu);
+
+#ifdef AARCH64
+    mpam_vcpu_init(vcpu, vm);
+    fp_vcpu_init(vcpu);
+#endif
+}
+
+/**
+ * The instruction cache is invalidated on the vcpu's cpu as it might still hold the code the
+ * guest ran, e.g. patched at runtime, instead of the reinstalled image.
+ */
+void vcpu_arch_vm_reset(struct vcpu* vcpu)
+{
+    spin_lock(&vcpu->arch.psci_ctx.lock);
+    vcpu->arch.psci_ctx.state = vcpu->id == 0 ? ON : OFF;
+    spin_unlock(&vcpu->arch.psci_ctx.lock);
+
+    vgic_cpu_reset(vcpu);
+
+    DSB(ish);
+    arm_ic_iallu();
+    DSB(ish);
+    ISB();
+}
+
+/**
+ * The vcpu's private interrupts are disabled and deactivated in the physical gic, as on a reset,
+ * and the guest's virtual timer is turned off, so that none of them wakes the idle cpu.
+ */
+void vcpu_arch_stop(struct vcpu* vcpu)
+{
+    vgic_cpu_reset(vcpu);
+#ifdef AARCH64
+    sysreg_cntv_ctl_el0_write(0);
+    ISB();
+#endif
+}
+
+/* Snapshots need the guest's system registers, which are only kept for aarch64 guests */
+bool vm_arch_snapshot_init(struct vm* vm, struct vm_arch_snapshot* snap)
+{
+#ifdef AARCH64
+    return vgic_snapshot_init(vm, &snap->vgic);
+#else
+    (void)vm;
+    (void)snap;
+    return false;
+#endif
+}
+
+/* The interrupts' configuration is kept out of line, its size depending on the vm's vgic */
+size_t vm_arch_snapshot_data_size(struct vm* vm)
+{
+    return vm->arch.vgicd.int_num * sizeof(struct vgic_int_snapshot);
+}
+
+bool vm_arch_snapshot_place(struct vm* vm, struct vm_arch_snapshot* snap, void* data)
+{
+    (void)vm;
+    snap->vgic.interrupts = data;
+    return DEFINED(AARCH64);
+}
+
+void vm_arch_snapshot_save(struct vm* vm, struct vm_arch_snapshot* snap)
+{
+    vgic_snapshot_save(vm, &snap->vgic);
+}
+
+void vm_arch_snapshot_restore(struct vm* vm, const struct vm_arch_snapshot* snap)
+{
+    vgic_snapshot_restore(vm, &snap->vgic);
+}
+
+void vcpu_arch_snapshot_save(struct vcpu* vcpu, struct vcpu_arch_snapshot* snap)
+{
+    spin_lock(&vcpu->arch.psci_ctx.lock);
+    snap->psci_ctx = vcpu->arch.psci_ctx;
+    spin_unlock(&vcpu->arch.psci_ctx.lock);
+
+    vgic_cpu_snapshot_save(vcpu, &snap->vgic);
+
+#ifdef AARCH64
+    vcpu_subarch_snapshot_save(&snap->sysregs);
+    if (cpu()->arch.fp_owner == vcpu) {
+        fp_ctx_save(&vcpu->arch.fp);
+    }
+    snap->fp = vcpu->arch.fp;
+#endif
+}
+
+/**
+ * The restored image must not be fetched from stale instruction cache lines, as on a reset, nor
+ * translated through the guest's stage 1 entries from after the snapshot. The fp registers are
+ * reloaded right away if the vcpu owns them, or else on its next fp access.
+ */
+void vcpu_arch_snapshot_restore(struct vcpu* vcpu, const struct vcpu_arch_snapshot* snap)
+{
+    spin_lock(&vcpu->arch.psci_ctx.lock);
+    vcpu->arch.psci_ctx.entrypoint = snap->psci_ctx.entrypoint;
+    vcpu->arch.psci_ctx.context_id = snap->psci_ctx.context_id;
+    vcpu->arch.psci_ctx.state = snap->psci_ctx.state;
+    vcpu->arch.psci_ctx.armed = false;
+    spin_unlock(&vcpu->arch.psci_ctx.lock);
+
+    vgic_cpu_snapshot_restore(vcpu, &snap->vgic);
+
+#ifdef AARCH64
+    vcpu_subarch_snapshot_restore(&snap->sysregs);
+    vcpu->arch.fp = snap->fp;
+    if (cpu()->arch.fp_owner == vcpu) {
+        fp_ctx_restore(&vcpu->arch.fp);
+    }
+    DSB(ish);
+    arm_tlbi_vmalle1is();
+#endif
+
+    DSB(ish);
+    arm_ic_iallu();
+    DSB(ish);
+    ISB();
+}
+
+bool vcpu_arch_irq_pending(struct vcpu* vcpu)
+{
+    return vgic_vcpu_irq_pending(vcpu);
+}
+
+/* The ipi is an sgi, delivered as if sent through the vgic by the calling vcpu */
+bool vcpu_arch_send_ipi(struct vcpu* vcpu, cpumask_t pcpu_mask, unsigned long ipi_id)
+{
+    if (ipi_id >= GIC_MAX_SGIS) {
+        return false;
+    }
+
+    vgic_send_sgi_msg(vcpu, pcpu_mask, (irqid_t)ipi_id);
+
+    return true;
+}
+
+/**
+ * The guest gets the virtual and the physical timer and counter without traps, whatever the
+ * firmware left in CNTHCTL_EL2, whose ECV trap controls reset to unknown values. With CNTPOFF,
+ * the physical counter is offset as the virtual one, so the two always agree for the guest.
+ */
+static void vcpu_arch_timer_reset(void)
+{
+    unsigned long cnthctl = CNTHCTL_EL1PCTEN_BIT | CNTHCTL_EL1PCEN_BIT;
+
+    sysreg_cntvoff_el2_write(0);
+#ifdef AARCH64
+    if (bit64_extract(sysreg_id_aa64mmfr0_el1_read(), ID_AA64MMFR0_ECV_OFF,
+            ID_AA64MMFR0_ECV_LEN) >= ID_AA64MMFR0_ECV_CNTPOFF) {
+        sysreg_cntpoff_el2_write(0);
+        cnthctl |= CNTHCTL_ECV_BIT;
+    }
+#endif
+    sysreg_cnthctl_el2_write(cnthctl);
 }
 
 void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry)
@@ -64,15 +276,20 @@ void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry)
     vcpu_subarch_reset(vcpu);
 
     vcpu_writepc(vcpu, entry);
+    vcpu->arch.psci_ctx.armed = vcpu->vm->config->fast_start;
 
-    sysreg_cntvoff_el2_write(0);
+#if defined(AARCH64) && defined(MEM_PROT_MMU)
+    emul_decode_reset(vcpu);
+#endif
+
+    vcpu_arch_timer_reset();
 
     /**
      *  See ARMv8-A ARM section D1.9.1 for registers that must be in a known state at reset.
      */
     sysreg_sctlr_el1_write(SCTLR_RES1);
     sysreg_cntkctl_el1_write(0);
-    sysreg_pmcr_el0_write(0);
+    pmu_guest_reset();
 
     /**
      *  TODO: ARMv8-A ARM mentions another implementation optional registers that reset to a known
@@ -88,6 +305,9 @@ static inline bool vcpu_psci_state_on(struct vcpu* vcpu)
 void vcpu_arch_run(struct vcpu* vcpu)
 {
     if (vcpu_psci_state_on(vcpu)) {
+#ifdef AARCH64
+        fp_vcpu_run(vcpu);
+#endif
         vcpu_arch_entry();
     } else {
         cpu_idle();
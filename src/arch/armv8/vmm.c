@@ -6,6 +6,9 @@
 #include <vmm.h>
 #include <arch/sysregs.h>
 #include <interrupts.h>
+#ifdef AARCH64
+#include <arch/mpam.h>
+#endif
 
 void vmm_arch_init()
 {
@@ -17,4 +20,8 @@ void vmm_arch_init()
     sysreg_hcr_el2_write(hcr);
 
     sysreg_cptr_el2_write(0);
+
+#ifdef AARCH64
+    mpam_init();
+#endif
 }
@@ -7,6 +7,7 @@
 #include <cpu.h>
 #include <bao.h>
 #include <platform.h>
+#include <bit.h>
 
 volatile struct aclint_sswi_hw* aclint_sswi;
 
@@ -19,11 +20,25 @@ void aclint_init()
 void aclint_send_ipi(cpuid_t target_hart)
 {
     cpuid_t aclint_index = aclint_plat_hart_id_to_sswi_index(target_hart);
-    if (target_hart < platform.cpu_num) {
+    if (target_hart < PLAT_CPU_NUM) {
         aclint_sswi->setssip[aclint_index] = ACLINT_SSWI_SET_SETSSIP;
     }
 }
 
+/**
+ * Raise the software interrupt of every hart in the mask. The SSWI registers are written back to
+ * back, visiting only the set bits of the mask.
+ */
+void aclint_send_ipi_mask(const cpumask_t* hart_mask)
+{
+    cpumask_foreach (hart_mask, hart) {
+        if (hart >= PLAT_CPU_NUM) {
+            break;
+        }
+        aclint_sswi->setssip[aclint_plat_hart_id_to_sswi_index(hart)] = ACLINT_SSWI_SET_SETSSIP;
+    }
+}
+
 /**
  * By default aclint hart index is equal to the hart identifier
  * This may be overwritten on the platform defined code
@@ -24,5 +24,6 @@ void vcpu_defines()
 {
     DEFINE_SIZE(VCPU_ARCH_SIZE, struct vcpu_arch);
     DEFINE_OFFSET(VCPU_REGS_OFF, struct vcpu, regs);
+    DEFINE_OFFSET(VCPU_FULL_EXITS_OFF, struct vcpu, full_exits);
     DEFINE_SIZE(VCPU_REGS_SIZE, struct arch_regs);
 }
@@ -5,6 +5,7 @@
 
 #include <cache.h>
 #include <platform.h>
+#include <arch/instructions.h>
 
 /**
  * The riscv spec does not include cache maintenance. There are current efforts to define and
@@ -30,3 +31,18 @@ __attribute__((weak)) void cache_flush_range(vaddr_t base, size_t size)
     WARNING("trying to flush caches but the operation is not defined for this "
             "platform");
 }
+
+__attribute__((weak)) void cache_clean_range(vaddr_t base, size_t size)
+{
+    cache_flush_range(base, size);
+}
+
+__attribute__((weak)) void cache_inv_range(vaddr_t base, size_t size)
+{
+    cache_flush_range(base, size);
+}
+
+void cache_inv_icache(void)
+{
+    fence_i();
+}
@@ -13,6 +13,8 @@ cpuid_t CPU_MASTER __attribute__((section(".data")));
 /* Perform architecture dependent cpu cores initializations */
 void cpu_arch_init(cpuid_t cpuid, paddr_t load_addr)
 {
+    cpu()->arch.fp_owner = NULL;
+
     if (cpuid == CPU_MASTER) {
         sbi_init();
         for (size_t hartid = 0; hartid < platform.cpu_num; hartid++) {
@@ -27,6 +29,18 @@ void cpu_arch_init(cpuid_t cpuid, paddr_t load_addr)
     }
 }
 
+void cpu_arch_standby()
+{
+    asm volatile("wfi\n\t" ::: "memory");
+}
+
+/* Only returns if the firmware refuses the warm reset, or has none */
+bool cpu_arch_warm_reset(void)
+{
+    (void)sbi_system_reset_warm();
+    return false;
+}
+
 void cpu_arch_idle()
 {
     asm volatile("wfi\n\t" ::: "memory");
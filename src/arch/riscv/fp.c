@@ -0,0 +1,56 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/fp.h>
+#include <arch/csrs.h>
+#include <cpu.h>
+#include <vm.h>
+#include <string.h>
+
+/**
+ * The fp registers are switched lazily. A vcpu starts running with sstatus.FS off, so that its fp
+ * instructions trap as illegal, unless the hart's registers still hold its state. It only gets
+ * them on its first access, when the state of their previous owner is saved if the owner dirtied
+ * it. So vcpus that never use them add nothing to a switch, and a vcpu running alone on its hart
+ * traps only once.
+ */
+void fp_vcpu_init(struct vcpu* vcpu)
+{
+    memset(&vcpu->arch.fp, 0, sizeof(vcpu->arch.fp));
+}
+
+void fp_vcpu_run(struct vcpu* vcpu)
+{
+    if (cpu()->arch.fp_owner != vcpu) {
+        vcpu->regs.sstatus &= ~SSTATUS_FS_MSK;
+    }
+}
+
+size_t fp_trap_handler(void)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    struct vcpu* owner = cpu()->arch.fp_owner;
+
+    if ((vcpu->regs.sstatus & SSTATUS_FS_MSK) != SSTATUS_FS_AOFF) {
+        ERROR("illegal instruction (0x%lx at 0x%lx)", CSRR(stval), CSRR(sepc));
+    }
+
+    CSRS(sstatus, SSTATUS_FS_CLEAN);
+
+    if (owner != vcpu) {
+        if (owner != NULL) {
+            if ((owner->regs.sstatus & SSTATUS_FS_MSK) == SSTATUS_FS_DIRTY) {
+                fp_ctx_save(&owner->arch.fp);
+            }
+            owner->regs.sstatus &= ~SSTATUS_FS_MSK;
+        }
+        fp_ctx_restore(&vcpu->arch.fp);
+        cpu()->arch.fp_owner = vcpu;
+    }
+
+    vcpu->regs.sstatus |= SSTATUS_FS_CLEAN;
+
+    return 0;
+}
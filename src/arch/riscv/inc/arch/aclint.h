@@ -8,6 +8,7 @@
 
 #include <bao.h>
 #include <platform.h>
+#include <cpumask.h>
 
 #define ACLINT_SSWI_MAX_HARTS   (4095)
 #define ACLINT_SSWI_SET_SETSSIP (0x1)
@@ -21,6 +22,7 @@ extern volatile struct aclint_sswi_hw* aclint_sswi;
 
 void aclint_init();
 void aclint_send_ipi(cpuid_t hart);
+void aclint_send_ipi_mask(const cpumask_t* hart_mask);
 
 cpuid_t aclint_plat_sswi_index_to_hart_id(cpuid_t sswi_index);
 cpuid_t aclint_plat_hart_id_to_sswi_index(cpuid_t hard_id);
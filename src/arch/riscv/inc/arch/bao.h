@@ -40,7 +40,9 @@
 #endif
 
 #define PAGE_SIZE  (0x1000)
+#ifndef STACK_SIZE
 #define STACK_SIZE (PAGE_SIZE)
+#endif
 
 #ifndef __ASSEMBLER__
 
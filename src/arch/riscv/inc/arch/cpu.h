@@ -15,6 +15,10 @@ extern cpuid_t CPU_MASTER;
 struct cpu_arch {
     unsigned hart_id;
     unsigned plic_cntxt;
+    /* The vcpu owns the plic context, claiming from it itself, see plic_handle */
+    bool plic_direct;
+    /* The vcpu whose state the fp registers hold, see fp_vcpu_run */
+    struct vcpu* fp_owner;
 };
 
 static inline struct cpu* cpu()
@@ -43,6 +43,13 @@
 #define CSR_STIMECMP      0x14D
 #define CSR_STIMECMPH     0x15D
 
+/* Ssqosid Extension */
+#define CSR_SRMCFG        0x181
+#define SRMCFG_RCID_OFF   (0)
+#define SRMCFG_RCID_LEN   (12)
+#define SRMCFG_MCID_OFF   (16)
+#define SRMCFG_MCID_LEN   (12)
+
 #define STVEC_MODE_OFF    (0)
 #define STVEC_MODE_LEN    (2)
 #define STVEC_MODE_MSK    BIT_MASK(STVEC_MODE_OFF, STVEC_MODE_LEN)
@@ -80,6 +87,11 @@
 #define SSTATUS_UPIE_BIT            (1ULL << 4)
 #define SSTATUS_SPIE_BIT            (1ULL << 5)
 #define SSTATUS_SPP_BIT             (1ULL << 8)
+#define SSTATUS_VS_OFF              (9)
+#define SSTATUS_VS_LEN              (2)
+#define SSTATUS_VS_MSK              BIT_MASK(SSTATUS_VS_OFF, SSTATUS_VS_LEN)
+#define SSTATUS_VS_AOFF             (0)
+#define SSTATUS_VS_INITIAL          (1ULL << SSTATUS_VS_OFF)
 #define SSTATUS_FS_OFF              (13)
 #define SSTATUS_FS_LEN              (2)
 #define SSTATUS_FS_MSK              BIT_MASK(SSTATUS_FS_OFF, SSTATUS_FS_LEN)
@@ -203,6 +215,7 @@
 #define HSTATUS_CBIE_MSK            (BIT_MASK(HSTATUS_CBIE_OFF, HSTATUS_CBIE_LEN))
 #define HENVCFG_CBCFE               (1ULL << 6)
 #define HENVCFG_CBZE                (1ULL << 7)
+#define HENVCFG_ADUE                (1ULL << 61)
 #define HENVCFG_PBMTE               (1ULL << 62)
 #define HENVCFG_STCE                (1ULL << 63)
 
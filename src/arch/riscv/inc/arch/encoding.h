@@ -16,6 +16,7 @@
 #define INS_RS2(ins)        (((ins) >> 20) & 0x1f)
 #define MATCH_LOAD          (0x03)
 #define MATCH_STORE         (0x23)
+#define MATCH_WFI           (0x10500073)
 
 #define INS_C_OPCODE(ins)   ((ins) & 0xe003)
 #define INS_C_RD_RS2(ins)   ((ins >> 2) & 0x7)
@@ -0,0 +1,25 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_FP_H__
+#define __ARCH_FP_H__
+
+#include <bao.h>
+
+struct fp_ctx {
+    uint64_t f[32];
+    uint64_t fcsr;
+};
+
+struct vcpu;
+
+void fp_ctx_save(struct fp_ctx* ctx);
+void fp_ctx_restore(struct fp_ctx* ctx);
+
+void fp_vcpu_init(struct vcpu* vcpu);
+void fp_vcpu_run(struct vcpu* vcpu);
+size_t fp_trap_handler(void);
+
+#endif /* __ARCH_FP_H__ */
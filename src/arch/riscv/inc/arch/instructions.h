@@ -13,4 +13,76 @@ static inline uint64_t hlvxhu(uintptr_t addr)
     return value;
 }
 
+static inline void cbo_zero(uintptr_t addr)
+{
+    asm volatile(".insn i 0x0f, 0x2, x0, %0, 0x4\n\t" ::"r"(addr) : "memory");
+}
+
+static inline void fence_i(void)
+{
+    asm volatile(".insn i 0x0f, 0x1, x0, x0, 0\n\t" ::: "memory");
+}
+
+/**
+ * hfence.vvma fences the current VMID's VS-stage translations. A zero register operand selects all
+ * addresses or all asids.
+ */
+static inline void hfence_vvma(uintptr_t addr, unsigned long asid)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x11, x0, %0, %1\n\t" ::"r"(addr), "r"(asid) : "memory");
+}
+
+static inline void hfence_vvma_all_asid(uintptr_t addr)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x11, x0, %0, x0\n\t" ::"r"(addr) : "memory");
+}
+
+static inline void hfence_vvma_all_addr(unsigned long asid)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x11, x0, x0, %0\n\t" ::"r"(asid) : "memory");
+}
+
+static inline void hfence_vvma_all(void)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x11, x0, x0, x0\n\t" ::: "memory");
+}
+
+static inline void sfence_vma_all(void)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x09, x0, x0, x0\n\t" ::: "memory");
+}
+
+/**
+ * hfence.gvma and hinval.gvma take the guest physical address shifted right by two bits.
+ */
+static inline void hfence_gvma_all_addr(unsigned long vmid)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x31, x0, x0, %0\n\t" ::"r"(vmid) : "memory");
+}
+
+/**
+ * Svinval splits the fences in invalidations which are not ordered with respect to each other or
+ * to memory accesses, and the sfence.w.inval/sfence.inval.ir pair ordering them before and after.
+ */
+static inline void sinval_vma_all_asid(uintptr_t addr)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x0b, x0, %0, x0\n\t" ::"r"(addr) : "memory");
+}
+
+static inline void hinval_gvma(uintptr_t gaddr, unsigned long vmid)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x33, x0, %0, %1\n\t" ::"r"(gaddr >> 2), "r"(vmid)
+                 : "memory");
+}
+
+static inline void sfence_w_inval(void)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x0c, x0, x0, x0\n\t" ::: "memory");
+}
+
+static inline void sfence_inval_ir(void)
+{
+    asm volatile(".insn r 0x73, 0x0, 0x0c, x0, x0, x1\n\t" ::: "memory");
+}
+
 #endif /* ARCH_INSTRUCTIONS_H */
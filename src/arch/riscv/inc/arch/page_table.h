@@ -22,7 +22,16 @@
 #define PTE_ADDR_MSK PTE_MASK(12, 22)
 #endif
 
-#define PTE_FLAGS_MSK             PTE_MASK(0, 8)
+/* Svpbmt memory types, which only exist in 64-bit PTEs */
+#if (RV64)
+#define PTE_PBMT_MSK PTE_MASK(61, 2)
+#define PTE_PBMT_NC  (1ULL << 61)
+#else
+#define PTE_PBMT_MSK (0)
+#define PTE_PBMT_NC  (0)
+#endif
+
+#define PTE_FLAGS_MSK             (PTE_MASK(0, 8) | PTE_PBMT_MSK)
 
 #define PTE_VALID                 (1ULL << 0)
 #define PTE_READ                  (1ULL << 1)
@@ -39,10 +48,29 @@
 #define PTE_RX                    (PTE_READ | PTE_EXECUTE)
 #define PTE_RWX                   (PTE_READ | PTE_WRITE | PTE_EXECUTE)
 
+/**
+ * Permissions come with the page type, so leaves are always writable unless given this pseudo
+ * flag, which pte_set strips along with the write permission.
+ */
+#define PTE_NO_WRITE              (1ULL << 60)
+
 #define PTE_RSW_OFF               8
 #define PTE_RSW_LEN               2
 #define PTE_RSW_MSK               PTE_MASK(PTE_RSW_OFF, PTE_RSW_LEN)
 
+/**
+ * Svnapot PTEs. Only the 64KiB NAPOT size is defined, encoded in the lower 4 bits of the PPN, and
+ * the N bit only exists in 64-bit PTEs.
+ */
+#if (RV64)
+#define PTE_NAPOT (1ULL << 63)
+#else
+#define PTE_NAPOT (0)
+#endif
+#define PTE_NAPOT_NUM             (16)
+#define PTE_NAPOT_PPN_MSK         PTE_MASK(10, 4)
+#define PTE_NAPOT_64K             (0x8ULL << 10)
+
 #define PTE_TABLE                 (PTE_VALID)
 #define PTE_PAGE                  (PTE_RWX | PTE_VALID)
 #define PTE_SUPERPAGE             (PTE_PAGE)
@@ -51,7 +79,7 @@
 
 #define PTE_RSW_EMPT              (0x0LL << PTE_RSW_OFF)
 #define PTE_RSW_OPEN              (0x1LL << PTE_RSW_OFF)
-#define PTE_RSW_FULL              (0x2LL << PTE_RSW_OFF)
+#define PTE_RSW_STALE             (0x2LL << PTE_RSW_OFF)
 #define PTE_RSW_RSRV              (0x3LL << PTE_RSW_OFF)
 
 #define PT_ROOT_FLAGS_REC_IND_OFF ? ? ?
@@ -67,6 +95,16 @@
 
 #define PTE_VM_FLAGS              (PTE_ACCESS | PTE_DIRTY | PTE_USER)
 #define PTE_VM_DEV_FLAGS          PTE_VM_FLAGS
+#define PTE_VM_RO_FLAGS           (PTE_VM_FLAGS | PTE_NO_WRITE)
+
+/**
+ * The G-stage memory type overrides the guest's, but there is none for inner only caching, so such
+ * vm memory is left cacheable, as is all vm memory without Svpbmt.
+ */
+#define PTE_VM_ATTR_MSK           PTE_PBMT_MSK
+#define PTE_VM_NC_FLAGS \
+    (PTE_VM_FLAGS | (DEFINED(CPU_EXT_SVPBMT) ? PTE_PBMT_NC : 0))
+#define PTE_VM_INNER_FLAGS        PTE_VM_FLAGS
 
 #ifndef __ASSEMBLER__
 
@@ -80,13 +118,35 @@ struct page_table_arch { };
 
 static inline void pte_set(pte_t* pte, paddr_t addr, pte_type_t type, pte_flags_t flags)
 {
-    *pte = ((addr & PTE_ADDR_MSK) >> 2) |
-        (((type == PTE_TABLE) ? type : (type | flags)) & PTE_FLAGS_MSK);
+    pte_t val = (type == PTE_TABLE) ? type : (type | flags);
+    if ((type != PTE_TABLE) && ((flags & PTE_NO_WRITE) != 0)) {
+        val &= ~PTE_WRITE;
+    }
+    *pte = ((addr & PTE_ADDR_MSK) >> 2) | (val & PTE_FLAGS_MSK);
 }
 
 static inline paddr_t pte_addr(pte_t* pte)
 {
-    return (*pte << 2) & PTE_ADDR_MSK;
+    paddr_t addr = (*pte << 2) & PTE_ADDR_MSK;
+    if (*pte & PTE_NAPOT) {
+        addr &= ~((PTE_NAPOT_PPN_MSK) << 2);
+    }
+    return addr;
+}
+
+static inline bool pte_contig(pte_t* pte)
+{
+    return (*pte & PTE_NAPOT) != 0;
+}
+
+static inline void pte_set_contig(pte_t* pte)
+{
+    *pte = (*pte & ~PTE_NAPOT_PPN_MSK) | PTE_NAPOT_64K | PTE_NAPOT;
+}
+
+static inline void pte_clear_contig(pte_t* pte, paddr_t addr)
+{
+    *pte = (*pte & ~(PTE_NAPOT | (PTE_ADDR_MSK >> 2))) | ((addr & PTE_ADDR_MSK) >> 2);
 }
 
 static inline bool pte_valid(pte_t* pte)
@@ -109,6 +169,40 @@ static inline bool pte_table(struct page_table* pt, pte_t* pte, size_t lvl)
     return (*pte & 0xf) == PTE_VALID;
 }
 
+/* Set on the first access through an entry by the hardware with Svadu */
+#define PTE_ACCESSED_BIT PTE_ACCESS
+
+/**
+ * Dirty logging write protects a writable g-stage entry by clearing its dirty bit, which is
+ * otherwise always set for the vm's entries. The first write then has the hardware set it back,
+ * with Svadu, or faults for the hypervisor to do so.
+ */
+#define PTE_DIRTY_LOG_BIT PTE_DIRTY
+
+static inline bool pte_dirty_armed(pte_t* pte)
+{
+    return (*pte & PTE_WRITE) != 0;
+}
+
+static inline bool pte_dirty_writable(pte_t* pte)
+{
+    return (*pte & (PTE_WRITE | PTE_DIRTY_LOG_BIT)) == (PTE_WRITE | PTE_DIRTY_LOG_BIT);
+}
+
+static inline void pte_dirty_arm(pte_t* pte)
+{
+    if (pte_dirty_armed(pte)) {
+        *pte &= ~PTE_DIRTY_LOG_BIT;
+    }
+}
+
+static inline void pte_dirty_disarm(pte_t* pte)
+{
+    if (pte_dirty_armed(pte)) {
+        *pte |= PTE_DIRTY_LOG_BIT;
+    }
+}
+
 #endif /* |__ASSEMBLER__ */
 
 #endif /* __ARCH_PAGE_TABLE_H__ */
@@ -30,6 +30,13 @@ struct arch_platform {
     struct {
         paddr_t base; // Base address of the ACLINT supervisor software interrupts
     } aclint_sswi;
+
+    struct {
+        size_t cc_num;     // Number of CBQRI capacity controllers, e.g. of the LLC
+        paddr_t* cc_addr;  // Base addresses of the capacity controllers
+        size_t bc_num;     // Number of CBQRI bandwidth controllers, e.g. of the DRAM
+        paddr_t* bc_addr;  // Base addresses of the bandwidth controllers
+    } qos;
 };
 
 #endif /* __ARCH_PLATFORM_H__ */
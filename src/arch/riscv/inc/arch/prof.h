@@ -0,0 +1,33 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_PROF_H__
+#define __ARCH_PROF_H__
+
+#include <bao.h>
+#include <arch/csrs.h>
+
+/**
+ * The cycle and instret counters are read through their unprivileged shadows, so the firmware
+ * must have delegated them to S-mode in mcounteren.
+ */
+#define PROF_ARCH_CNT_MSK (~UINT64_C(0))
+
+static inline uint64_t prof_arch_cycles(void)
+{
+    return CSRR(cycle);
+}
+
+static inline uint64_t prof_arch_instrs(void)
+{
+    return CSRR(instret);
+}
+
+static inline bool prof_arch_init(void)
+{
+    return true;
+}
+
+#endif /* __ARCH_PROF_H__ */
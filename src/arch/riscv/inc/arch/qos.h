@@ -0,0 +1,53 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_QOS_H__
+#define __ARCH_QOS_H__
+
+#include <bao.h>
+
+#define CBQRI_CC_CAP_NCBLKS_OFF      (8)
+#define CBQRI_CC_CAP_NCBLKS_LEN      (16)
+#define CBQRI_BC_CAP_MRBWB_OFF       (32)
+#define CBQRI_BC_CAP_MRBWB_LEN       (16)
+
+#define CBQRI_ALLOC_CTL_OP_OFF       (0)
+#define CBQRI_ALLOC_CTL_OP_CFG_LIMIT (1)
+#define CBQRI_ALLOC_CTL_RCID_OFF     (8)
+#define CBQRI_ALLOC_CTL_RCID_LEN     (12)
+#define CBQRI_ALLOC_CTL_STATUS_OFF   (32)
+#define CBQRI_ALLOC_CTL_STATUS_LEN   (7)
+#define CBQRI_ALLOC_CTL_STATUS_OK    (1)
+#define CBQRI_ALLOC_CTL_BUSY_BIT     (1ULL << 39)
+
+#define CBQRI_BW_ALLOC_RBWB_OFF      (0)
+#define CBQRI_BW_ALLOC_RBWB_LEN      (16)
+
+#define CBQRI_CTL_MAX                (16)
+#define CBQRI_CC_BLOCK_MASK_MAX      ((0x1000 - 0x20) / sizeof(uint64_t))
+
+struct cbqri_cc_hw {
+    uint64_t capabilities;
+    uint64_t mon_ctl;
+    uint64_t mon_ctr_val;
+    uint64_t alloc_ctl;
+    uint64_t block_mask[CBQRI_CC_BLOCK_MASK_MAX];
+} __attribute__((__packed__, aligned(PAGE_SIZE)));
+
+struct cbqri_bc_hw {
+    uint64_t capabilities;
+    uint64_t mon_ctl;
+    uint64_t mon_ctr_val;
+    uint64_t alloc_ctl;
+    uint64_t bw_alloc;
+} __attribute__((__packed__, aligned(PAGE_SIZE)));
+
+struct vcpu;
+struct vm;
+
+void qos_init(void);
+void qos_vcpu_init(struct vcpu* vcpu, struct vm* vm);
+
+#endif /* __ARCH_QOS_H__ */
@@ -31,11 +31,26 @@ struct sbi_hsm {
     enum { STARTED, STOPPED, START_PENDING, STOP_PENDING } state;
     vaddr_t start_addr;
     unsigned priv;
+    /* The vcpu was reset on its hart, which kept its state since, see vm_config.fast_start */
+    bool armed;
 };
 
+/* Steal time accounting shared memory, as laid out by the sbi sta extension */
+struct sbi_sta_shmem {
+    volatile uint32_t sequence;
+    uint32_t flags;
+    volatile uint64_t steal;
+    uint8_t preempted;
+    uint8_t pad[47];
+} __attribute__((__packed__, aligned(64)));
+
+struct vcpu;
+
 void sbi_init();
+void sbi_sta_reset(struct vcpu* vcpu);
 
 void sbi_console_putchar(int ch);
+size_t sbi_debug_console_write(const char* buf, size_t n);
 
 struct sbiret sbi_get_spec_version(void);
 struct sbiret sbi_get_impl_id(void);
@@ -46,8 +61,11 @@ struct sbiret sbi_get_marchid(void);
 struct sbiret sbi_get_mimpid(void);
 
 struct sbiret sbi_send_ipi(const unsigned long hart_mask, unsigned long hart_mask_base);
+struct sbiret sbi_system_reset_warm(void);
 
 struct sbiret sbi_set_timer(uint64_t stime_value);
+struct timer_event;
+void sbi_vstimer_handler(struct timer_event* event);
 
 struct sbiret sbi_remote_fence_i(const unsigned long hart_mask, unsigned long hart_mask_base);
 
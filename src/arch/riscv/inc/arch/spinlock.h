@@ -46,4 +46,39 @@ static inline void spin_unlock(spinlock_t* lock)
                  "sw %1, %0 \n\t" : "=A"(lock->ticket) : "r"(update_lock) : "memory");
 }
 
+/**
+ * Atomic primitives used by the generic queued lock (see spinlock.h). Both are fully ordered.
+ */
+
+static inline uint32_t spin_atomic_xchg(volatile uint32_t* ptr, uint32_t val)
+{
+    uint32_t old;
+
+    asm volatile("amoswap.w.aqrl  %0, %2, %1\n\t" : "=&r"(old), "+A"(*ptr) : "r"(val) : "memory");
+    return old;
+}
+
+static inline uint32_t spin_atomic_cmpxchg(volatile uint32_t* ptr, uint32_t expected, uint32_t val)
+{
+    uint32_t old;
+    uint32_t temp;
+
+    asm volatile("1:\n\t"
+                 "lr.w.aqrl  %0, %2\n\t"
+                 "bne  %0, %3, 2f\n\t"
+                 "sc.w.aqrl  %1, %4, %2\n\t"
+                 "bnez  %1, 1b\n\t"
+                 "2:\n\t" : "=&r"(old), "=&r"(temp), "+A"(*ptr) : "r"(expected), "r"(val)
+                 : "memory");
+    return old;
+}
+
+static inline void spin_wait(void)
+{
+    /* Zihintpause's pause, encoded as a fence hint so it needs no assembler support */
+    asm volatile(".4byte 0x0100000f\n\t" ::: "memory");
+}
+
+static inline void spin_notify(void) { }
+
 #endif /* __ARCH_SPINLOCK__ */
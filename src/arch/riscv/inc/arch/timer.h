@@ -0,0 +1,37 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_TIMER_H__
+#define __ARCH_TIMER_H__
+
+#include <bao.h>
+#include <arch/csrs.h>
+#include <arch/interrupts.h>
+
+/**
+ * The timebase frequency is not discoverable from supervisor mode. It defaults to the one of
+ * qemu's virt machine and may be overridden by the platform.
+ */
+#ifndef RISCV_TIMEBASE_FREQ
+#define RISCV_TIMEBASE_FREQ (10000000ULL)
+#endif
+
+#define TIMER_ARCH_IRQ_ID (TIMR_INT_ID)
+
+static inline uint64_t timer_arch_get(void)
+{
+    return CSRR(time);
+}
+
+static inline uint64_t timer_arch_get_freq(void)
+{
+    return RISCV_TIMEBASE_FREQ;
+}
+
+void timer_arch_init(void);
+void timer_arch_program(uint64_t deadline);
+void timer_arch_disable(void);
+
+#endif /* __ARCH_TIMER_H__ */
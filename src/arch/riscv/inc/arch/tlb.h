@@ -8,20 +8,41 @@
 
 #include <bao.h>
 #include <platform.h>
+#include <arch/cpu.h>
 #include <arch/sbi.h>
 
+#ifndef TLB_INV_RANGE_MAX_OPS
+/* Above this number of pages the whole context is fenced instead of each page in the range */
+#define TLB_INV_RANGE_MAX_OPS (512)
+#endif
+
+/**
+ * With Svinval, the local hart invalidates the range itself, a size of 0 standing for the whole
+ * context, and only the other harts are left to the firmware.
+ */
+void tlb_svinval_hyp(vaddr_t va, size_t size);
+void tlb_svinval_vm(asid_t vmid, vaddr_t va, size_t size);
+
 /**
  * TODO: we are assuming platform.cpu_num is power of two. Make this not true.
  */
 
 static inline void tlb_hyp_inv_va(vaddr_t va)
 {
-    sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, (unsigned long)va, PAGE_SIZE);
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVINVAL)) {
+        tlb_svinval_hyp(va, PAGE_SIZE);
+    } else {
+        sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, (unsigned long)va, PAGE_SIZE);
+    }
 }
 
 static inline void tlb_hyp_inv_all()
 {
-    sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, 0, 0);
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVINVAL)) {
+        tlb_svinval_hyp(0, 0);
+    } else {
+        sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, 0, 0);
+    }
 }
 
 /**
@@ -30,12 +51,59 @@ static inline void tlb_hyp_inv_all()
 
 static inline void tlb_vm_inv_va(asid_t vmid, vaddr_t va)
 {
-    sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0, (unsigned long)va, PAGE_SIZE, vmid);
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVINVAL)) {
+        tlb_svinval_vm(vmid, va, PAGE_SIZE);
+    } else {
+        sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0, (unsigned long)va, PAGE_SIZE,
+            vmid);
+    }
 }
 
 static inline void tlb_vm_inv_all(asid_t vmid)
 {
-    sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0, 0, 0, vmid);
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVINVAL)) {
+        tlb_svinval_vm(vmid, 0, 0);
+    } else {
+        sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0, 0, 0, vmid);
+    }
+}
+
+/**
+ * A single sbi call covers the whole range, the firmware then fences each page in it. Large ranges
+ * are turned into a full fence (size 0) so the firmware does not walk them page by page.
+ */
+
+static inline void tlb_hyp_inv_range(vaddr_t va, size_t size)
+{
+    vaddr_t base = va & ~(PAGE_SIZE - 1);
+    size_t len = NUM_PAGES((va - base) + size) * PAGE_SIZE;
+    if ((len / PAGE_SIZE) > TLB_INV_RANGE_MAX_OPS) {
+        base = 0;
+        len = 0;
+    }
+
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVINVAL)) {
+        tlb_svinval_hyp(base, len);
+    } else {
+        sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, (unsigned long)base, len);
+    }
+}
+
+static inline void tlb_vm_inv_range(asid_t vmid, vaddr_t va, size_t size)
+{
+    vaddr_t base = va & ~(PAGE_SIZE - 1);
+    size_t len = NUM_PAGES((va - base) + size) * PAGE_SIZE;
+    if ((len / PAGE_SIZE) > TLB_INV_RANGE_MAX_OPS) {
+        base = 0;
+        len = 0;
+    }
+
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVINVAL)) {
+        tlb_svinval_vm(vmid, base, len);
+    } else {
+        sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0, (unsigned long)base, len,
+            vmid);
+    }
 }
 
 #endif /* __ARCH_TLB_H__ */
@@ -9,7 +9,9 @@
 #include <bao.h>
 #include <irqc.h>
 #include <arch/sbi.h>
+#include <arch/fp.h>
 #include <arch/interrupts.h>
+#include <timer.h>
 
 #define REG_RA  (1)
 #define REG_SP  (2)
@@ -47,6 +49,11 @@ struct arch_vm_platform {
     union vm_irqc_dscrp {
         struct {
             paddr_t base;
+            /**
+             * Map each vcpu's S-mode context straight to its hart's, see vplic_direct_init, so that
+             * the guest's claims and threshold reads do not trap.
+             */
+            bool direct_cntxt;
         } plic;
         struct {
             struct {
@@ -66,8 +73,56 @@ struct vm_arch {
 #endif
 };
 
+#ifndef VCPU_INS_CACHE_SIZE
+#define VCPU_INS_CACHE_SIZE (16)
+#endif
+
+/**
+ * A decoded guest load or store, for mmio traps htinst gives no information about. The pc is a
+ * guest virtual address, so entries are also tagged with the vsatp they were decoded under. An
+ * entry with a zero ins_size is invalid.
+ */
+struct vcpu_ins_cache_entry {
+    vaddr_t pc;
+    unsigned long vsatp;
+    uint8_t ins_size;
+    uint8_t width;
+    uint8_t reg;
+    bool write;
+    bool sign_ext;
+};
+
 struct vcpu_arch {
     vcpuid_t hart_id;
+    struct timer_event vstimer;
+    unsigned long srmcfg;
+    /* Hypervisor mapping of the guest page holding the sta shared memory, at sta_ipa */
+    vaddr_t sta_page;
+    vaddr_t sta_ipa;
+    struct vcpu_ins_cache_entry ins_cache[VCPU_INS_CACHE_SIZE];
+    struct fp_ctx fp;
+    /* Written by the harts starting or stopping the vcpu */
+    struct sbi_hsm sbi_ctx __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct vm_arch_snapshot {
+    struct virqc_snapshot virqc;
+};
+
+/* The guest's VS-level state, which the hart otherwise keeps for its only vcpu */
+struct vcpu_arch_snapshot {
+    unsigned long vsstatus;
+    unsigned long hie;
+    unsigned long hvip;
+    unsigned long vstvec;
+    unsigned long vsscratch;
+    unsigned long vsepc;
+    unsigned long vscause;
+    unsigned long vstval;
+    unsigned long vsatp;
+    uint64_t vstimecmp;
+    bool vstimer_armed;
+    struct fp_ctx fp;
     struct sbi_hsm sbi_ctx;
 };
 
@@ -126,6 +181,7 @@ struct arch_regs {
 } __attribute__((__packed__, aligned(sizeof(unsigned long))));
 
 void vcpu_arch_entry();
+void vcpu_arch_ins_cache_inv(struct vcpu* vcpu);
 
 static inline void vcpu_arch_inject_hw_irq(struct vcpu* vcpu, irqid_t id)
 {
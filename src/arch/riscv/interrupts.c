@@ -12,6 +12,7 @@
 #include <mem.h>
 #include <platform.h>
 #include <vm.h>
+#include <trace.h>
 #include <arch/csrs.h>
 #include <fences.h>
 #include <arch/aclint.h>
@@ -45,6 +46,20 @@ void interrupts_arch_ipi_send(cpuid_t target_cpu, irqid_t ipi_id)
     }
 }
 
+void interrupts_arch_ipi_send_mask(const cpumask_t* cpu_mask, irqid_t ipi_id)
+{
+    if (ACLINT_PRESENT()) {
+        aclint_send_ipi_mask(cpu_mask);
+    } else {
+        /* The firmware takes one word of harts at a time, offset by a base hart */
+        for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+            if (cpu_mask->words[i] != 0) {
+                sbi_send_ipi(cpu_mask->words[i], i * CPUMASK_WORD_BITS);
+            }
+        }
+    }
+}
+
 void interrupts_arch_cpu_enable(bool en)
 {
     if (en) {
@@ -73,8 +88,10 @@ void interrupts_arch_enable(irqid_t int_id, bool en)
     }
 }
 
-void interrupts_arch_handle()
+__hot void interrupts_arch_handle()
 {
+    uint64_t trace_start = trace_exit_begin();
+    struct vcpu_exit_stamp exit_stamp = vcpu_exit_begin();
     unsigned long _scause = CSRR(scause);
 
     switch (_scause) {
@@ -99,6 +116,12 @@ void interrupts_arch_handle()
             // WARNING("unkown interrupt");
             break;
     }
+
+    vcpu_exit_end(exit_stamp);
+    stats_inc(STATS_EXITS_IRQ);
+    trace_exit_end(TRACE_EXIT_IRQ, _scause & SCAUSE_CODE_MSK, 0, trace_start);
+
+    vcpu_check_restart();
 }
 
 bool interrupts_arch_check(irqid_t int_id)
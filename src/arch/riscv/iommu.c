@@ -9,6 +9,10 @@
 #include <string.h>
 #include <arch/spinlock.h>
 #include <bitmap.h>
+#include <fences.h>
+#include <tlb.h>
+#include <io.h>
+#include <defer.h>
 
 // We initially use a 1-LVL DDT with DC in extended format
 // N entries = 4kiB / 64 B p/ entry = 64 Entries
@@ -18,6 +22,10 @@
 #define FQ_LOG2SZ_1                (5ULL)
 #define FQ_INDEX_MASK              BIT32_MASK(0, FQ_LOG2SZ_1 + 1)
 
+#define CQ_N_ENTRIES               (64)
+#define CQ_LOG2SZ_1                (5ULL)
+#define CQ_INDEX_MASK              BIT32_MASK(0, CQ_LOG2SZ_1 + 1)
+
 #define RV_IOMMU_SUPPORTED_VERSION (0x10)
 
 // # Memory-mapped Register Interface
@@ -58,6 +66,13 @@
 #define RV_IOMMU_XQCSR_ON_BIT      (1ULL << 16)
 #define RV_IOMMU_XQCSR_BUSY_BIT    (1ULL << 17)
 
+// CQ CSR
+#define RV_IOMMU_CQCSR_CMD_TO_BIT  (1ULL << 9)
+#define RV_IOMMU_CQCSR_CMD_ILL_BIT (1ULL << 10)
+#define RV_IOMMU_CQCSR_DEFAULT     (RV_IOMMU_XQCSR_EN_BIT)
+#define RV_IOMMU_CQCSR_ERR \
+    (RV_IOMMU_XQCSR_MF_BIT | RV_IOMMU_CQCSR_CMD_TO_BIT | RV_IOMMU_CQCSR_CMD_ILL_BIT)
+
 // FQ CSR
 #define RV_IOMMU_FQCSR_OF_BIT      (1ULL << 9)
 #define RV_IOMMU_FQCSR_DEFAULT \
@@ -157,6 +172,8 @@ struct riscv_iommu_regmap {
 #define RV_IOMMU_DC_MSIPTP_MODE_LEN (4)
 #define RV_IOMMU_DC_MSIPTP_MODE_MASK \
     BIT64_MASK(RV_IOMMU_DC_MSIPTP_MODE_OFF, RV_IOMMU_DC_MSIPTP_MODE_LEN)
+#define RV_IOMMU_DC_MSIPTP_MODE_OFF_VAL  (0ULL << RV_IOMMU_DC_MSIPTP_MODE_OFF)
+#define RV_IOMMU_DC_MSIPTP_MODE_FLAT_VAL (1ULL << RV_IOMMU_DC_MSIPTP_MODE_OFF)
 
 #define RV_IOMMU_DC_MSIMASK_OFF  (0)
 #define RV_IOMMU_DC_MSIMASK_LEN  (52)
@@ -190,12 +207,47 @@ struct fq_entry {
     uint64_t iotval2;
 } __attribute__((__packed__));
 
+// # Command Queue Entry
+#define RV_IOMMU_CMD_OPCODE_OFF        (0)
+#define RV_IOMMU_CMD_FUNC3_OFF         (7)
+
+#define RV_IOMMU_CMD_IOTINVAL          (1ULL << RV_IOMMU_CMD_OPCODE_OFF)
+#define RV_IOMMU_CMD_IOTINVAL_GVMA     (1ULL << RV_IOMMU_CMD_FUNC3_OFF)
+#define RV_IOMMU_CMD_IOTINVAL_AV_BIT   (1ULL << 10)
+#define RV_IOMMU_CMD_IOTINVAL_GV_BIT   (1ULL << 33)
+#define RV_IOMMU_CMD_IOTINVAL_GSCID_OFF (44)
+#define RV_IOMMU_CMD_IOTINVAL_GSCID_LEN (16)
+#define RV_IOMMU_CMD_IOTINVAL_GSCID_MASK \
+    BIT64_MASK(RV_IOMMU_CMD_IOTINVAL_GSCID_OFF, RV_IOMMU_CMD_IOTINVAL_GSCID_LEN)
+#define RV_IOMMU_CMD_IOTINVAL_ADDR_OFF (10)
+#define RV_IOMMU_CMD_IOTINVAL_ADDR_LEN (52)
+#define RV_IOMMU_CMD_IOTINVAL_ADDR_MASK \
+    BIT64_MASK(RV_IOMMU_CMD_IOTINVAL_ADDR_OFF, RV_IOMMU_CMD_IOTINVAL_ADDR_LEN)
+
+#define RV_IOMMU_CMD_IOFENCE           (2ULL << RV_IOMMU_CMD_OPCODE_OFF)
+#define RV_IOMMU_CMD_IOFENCE_C         (0ULL << RV_IOMMU_CMD_FUNC3_OFF)
+#define RV_IOMMU_CMD_IOFENCE_PR_BIT    (1ULL << 12)
+#define RV_IOMMU_CMD_IOFENCE_PW_BIT    (1ULL << 13)
+
+#define RV_IOMMU_CMD_IODIR             (3ULL << RV_IOMMU_CMD_OPCODE_OFF)
+#define RV_IOMMU_CMD_IODIR_INVAL_DDT   (0ULL << RV_IOMMU_CMD_FUNC3_OFF)
+#define RV_IOMMU_CMD_IODIR_DV_BIT      (1ULL << 33)
+#define RV_IOMMU_CMD_IODIR_DID_OFF     (40)
+#define RV_IOMMU_CMD_IODIR_DID_LEN     (24)
+#define RV_IOMMU_CMD_IODIR_DID_MASK \
+    BIT64_MASK(RV_IOMMU_CMD_IODIR_DID_OFF, RV_IOMMU_CMD_IODIR_DID_LEN)
+
+struct cq_entry {
+    uint64_t cmd0;
+    uint64_t cmd1;
+} __attribute__((__packed__));
+
 // # Memory-mapped and in-memory structures
-//  TODO: Add CQ
 struct riscv_iommu_hw {
     volatile struct riscv_iommu_regmap* reg_ptr;
     volatile struct ddt_entry* ddt;
     volatile struct fq_entry* fq;
+    volatile struct cq_entry* cq;
 };
 
 struct riscv_iommu_priv {
@@ -203,6 +255,10 @@ struct riscv_iommu_priv {
 
     spinlock_t ddt_lock;
     BITMAP_ALLOC(ddt_bitmap, DDT_N_ENTRIES);
+
+    // Commands are queued at cq_tail and only handed to the IOMMU by rv_iommu_cq_submit
+    spinlock_t cq_lock;
+    uint32_t cq_tail;
 };
 
 struct riscv_iommu_priv rv_iommu;
@@ -237,7 +293,29 @@ static void rv_iommu_check_features(void)
 }
 
 /**
- * RISC-V IOMMU Fault Queue IRQ handler.
+ * Report the fault queue's records. Records arriving meanwhile raise the interrupt again, as its
+ * pending bit is cleared before, so they are never left behind.
+ */
+static void rv_iommu_fq_drain(uint64_t data)
+{
+    uint32_t fqh = rv_iommu.hw.reg_ptr->fqh;
+    uint32_t fqt = rv_iommu.hw.reg_ptr->fqt;
+
+    while (fqh != fqt) {
+        struct fq_entry record = rv_iommu.hw.fq[fqh];
+        io_fault_report(
+            (deviceid_t)bit64_extract(record.tags, RV_IOMMU_FQ_DID_OFF, RV_IOMMU_FQ_DID_LEN),
+            bit64_extract(record.tags, RV_IOMMU_FQ_CAUSE_OFF, RV_IOMMU_FQ_CAUSE_LEN),
+            record.iotval);
+        fqh = (fqh + 1) & FQ_INDEX_MASK;
+    }
+
+    // Update fqh
+    rv_iommu.hw.reg_ptr->fqh = fqh;
+}
+
+/**
+ * RISC-V IOMMU Fault Queue IRQ handler. Reporting the records is left to the cpu's deferred work.
  */
 void rv_iommu_fq_irq_handler(irqid_t irq_id)
 {
@@ -270,21 +348,54 @@ void rv_iommu_fq_irq_handler(irqid_t irq_id)
     rv_iommu.hw.reg_ptr->ipsr = RV_IOMMU_IPSR_FIP_BIT;
 
     // Check if new records are available. If yes, report all remaining faults.
-    uint32_t fqh = rv_iommu.hw.reg_ptr->fqh;
-    uint32_t fqt = rv_iommu.hw.reg_ptr->fqt;
+    if (!defer_work(rv_iommu_fq_drain, 0)) {
+        rv_iommu_fq_drain(0);
+    }
+}
 
-    while (fqh != fqt) {
-        struct fq_entry record = rv_iommu.hw.fq[fqh];
-        WARNING("RV IOMMU FQ: CAUSE: %d | DID: %d | iotval: %x | iotval2: %x",
-            bit64_extract(record.tags, RV_IOMMU_FQ_CAUSE_OFF, RV_IOMMU_FQ_CAUSE_LEN),
-            bit64_extract(record.tags, RV_IOMMU_FQ_DID_OFF, RV_IOMMU_FQ_DID_LEN), record.iotval,
-            record.iotval2);
-        fqh = (fqh + 1) & FQ_INDEX_MASK;
-        // TODO: Translation faults management
+/**
+ * Queue a command without publishing it to the IOMMU. Must be called holding the cq lock.
+ *
+ * @cmd0: first double word of the command
+ * @cmd1: second double word of the command
+ */
+static void rv_iommu_cq_push(uint64_t cmd0, uint64_t cmd1)
+{
+    uint32_t next = (rv_iommu.cq_tail + 1) & CQ_INDEX_MASK;
+
+    // Wait for a free slot, i.e. for the IOMMU to consume pending commands
+    while (next == rv_iommu.hw.reg_ptr->cqh) {
+        if (rv_iommu.hw.reg_ptr->cqh == rv_iommu.hw.reg_ptr->cqt) {
+            // The queue is full of unpublished commands, callers must keep batches smaller
+            ERROR("RV IOMMU: CQ batch too big");
+        }
     }
 
-    // Update fqh
-    rv_iommu.hw.reg_ptr->fqh = fqh;
+    rv_iommu.hw.cq[rv_iommu.cq_tail].cmd0 = cmd0;
+    rv_iommu.hw.cq[rv_iommu.cq_tail].cmd1 = cmd1;
+    rv_iommu.cq_tail = next;
+}
+
+/**
+ * Close the queued batch with a single IOFENCE.C, publish the whole batch and wait for its
+ * completion. Must be called holding the cq lock.
+ */
+static void rv_iommu_cq_submit(void)
+{
+    rv_iommu_cq_push(RV_IOMMU_CMD_IOFENCE | RV_IOMMU_CMD_IOFENCE_C | RV_IOMMU_CMD_IOFENCE_PR_BIT |
+            RV_IOMMU_CMD_IOFENCE_PW_BIT,
+        0);
+
+    // Make the commands visible before the IOMMU is told about them
+    fence_sync_write();
+    rv_iommu.hw.reg_ptr->cqt = rv_iommu.cq_tail;
+
+    while (rv_iommu.hw.reg_ptr->cqh != rv_iommu.cq_tail) {
+        uint32_t cqcsr = rv_iommu.hw.reg_ptr->cqcsr;
+        if (cqcsr & RV_IOMMU_CQCSR_ERR) {
+            ERROR("RV IOMMU: CQ error (cqcsr: 0x%x)", cqcsr);
+        }
+    }
 }
 
 /**
@@ -312,8 +423,23 @@ void rv_iommu_init(void)
     // Clear all IP flags (ipsr)
     rv_iommu.hw.reg_ptr->ipsr = RV_IOMMU_IPSR_CLEAR;
 
-    // TODO Allocate memory for CQ Configure cqb with queue size and base address. Clear cqt
-    // Allocate IRQ for CQ Enable CQ (cqcsr)
+    // Allocate memory for CQ (aligned to 4kiB)
+    vaddr_t cq_vaddr = (vaddr_t)mem_alloc_page(NUM_PAGES(sizeof(struct cq_entry) * CQ_N_ENTRIES),
+        SEC_HYP_GLOBAL, true);
+    memset((void*)cq_vaddr, 0, sizeof(struct cq_entry) * CQ_N_ENTRIES);
+    rv_iommu.hw.cq = (struct cq_entry*)cq_vaddr;
+
+    // Configure cqb with queue size and base address. Clear cqt
+    paddr_t cq_paddr;
+    mem_translate(&cpu()->as, cq_vaddr, &cq_paddr);
+    rv_iommu.hw.reg_ptr->cqb = CQ_LOG2SZ_1 | ((cq_paddr >> 2) & RV_IOMMU_XQB_PPN_MASK);
+    rv_iommu.hw.reg_ptr->cqt = 0;
+    rv_iommu.cq_lock = SPINLOCK_INITVAL;
+    rv_iommu.cq_tail = 0;
+
+    // Enable CQ (cqcsr). Completion is polled so no CQ interrupt is needed
+    rv_iommu.hw.reg_ptr->cqcsr = RV_IOMMU_CQCSR_DEFAULT;
+    while (!(rv_iommu.hw.reg_ptr->cqcsr & RV_IOMMU_XQCSR_ON_BIT)) { }
 
     // Allocate memory for FQ (aligned to 4kiB)
     vaddr_t fq_vaddr = (vaddr_t)mem_alloc_page(NUM_PAGES(sizeof(struct fq_entry) * FQ_N_ENTRIES),
@@ -332,7 +458,7 @@ void rv_iommu_init(void)
         ERROR("Failed to reserve IOMMU FQ interrupt");
     }
 
-    interrupts_cpu_enable(platform.arch.iommu.fq_irq_id, true);
+    interrupts_hyp_enable(platform.arch.iommu.fq_irq_id);
 
     // Enable FQ (fqcsr)
     rv_iommu.hw.reg_ptr->fqcsr = RV_IOMMU_FQCSR_DEFAULT;
@@ -395,25 +521,86 @@ void rv_iommu_write_ddt(deviceid_t dev_id, struct vm* vm, paddr_t root_pt)
     if (!bitmap_get(rv_iommu.ddt_bitmap, dev_id)) {
         ERROR("IOMMU DC %d is not allocated", dev_id);
     } else {
-        // Configure DC
-        uint64_t tc = 0;
-        tc |= RV_IOMMU_DC_VALID_BIT;
-        rv_iommu.hw.ddt[dev_id].tc = tc;
-
+        // Configure DC. The valid bit is only set after the translation config is in place
         uint64_t iohgatp = 0;
         iohgatp |= ((root_pt >> 12) & RV_IOMMU_DC_IOHGATP_PPN_MASK);
         iohgatp |= ((vm->id << RV_IOMMU_DC_IOHGATP_GSCID_OFF) & RV_IOMMU_DC_IOHGATP_GSCID_MASK);
         iohgatp |= RV_IOMMU_IOHGATP_SV39X4;
         rv_iommu.hw.ddt[dev_id].iohgatp = iohgatp;
 
-        // TODO: Configure first-stage translation. Second-stage only by now Configure MSI
-        // translation
+        // TODO: Configure first-stage translation. Second-stage only by now
+
+        // MSI translation stays off. MSI page table entries would have to point at the guest
+        // interrupt files backing the VM's virtual IMSICs, but there is no IMSIC support that
+        // allocates guest interrupt files to VMs. Device MSIs are thus translated by the
+        // second-stage tables like any other write
+        rv_iommu.hw.ddt[dev_id].msiptp = RV_IOMMU_DC_MSIPTP_MODE_OFF_VAL;
+
+        fence_ord_write();
+
+        uint64_t tc = 0;
+        tc |= RV_IOMMU_DC_VALID_BIT;
+        rv_iommu.hw.ddt[dev_id].tc = tc;
+
+        // Drop any DC the IOMMU might have cached for this device
+        spin_lock(&rv_iommu.cq_lock);
+        rv_iommu_cq_push(RV_IOMMU_CMD_IODIR | RV_IOMMU_CMD_IODIR_INVAL_DDT |
+                RV_IOMMU_CMD_IODIR_DV_BIT |
+                (((uint64_t)dev_id << RV_IOMMU_CMD_IODIR_DID_OFF) & RV_IOMMU_CMD_IODIR_DID_MASK),
+            0);
+        rv_iommu_cq_submit();
+        spin_unlock(&rv_iommu.cq_lock);
     }
     spin_unlock(&rv_iommu.ddt_lock);
 }
 
 /**************** IOMMU IF functions ****************/
 
+/**
+ * Invalidate the IOTLB entries of a VM's guest physical range. One IOTINVAL.GVMA is queued per
+ * page, or a single one for the whole GSCID if the range is too big, and the batch is completed
+ * with a single IOFENCE.C.
+ *
+ * @vmid:   VM (GSCID) whose mappings changed
+ * @va:     base guest physical address of the range
+ * @size:   size of the range
+ */
+void iommu_arch_vm_inv_range(asid_t vmid, vaddr_t va, size_t size)
+{
+    if (rv_iommu.hw.reg_ptr == NULL) {
+        return;
+    }
+
+    uint64_t cmd0 = RV_IOMMU_CMD_IOTINVAL | RV_IOMMU_CMD_IOTINVAL_GVMA |
+        RV_IOMMU_CMD_IOTINVAL_GV_BIT |
+        (((uint64_t)vmid << RV_IOMMU_CMD_IOTINVAL_GSCID_OFF) & RV_IOMMU_CMD_IOTINVAL_GSCID_MASK);
+    vaddr_t base = va & ~(PAGE_SIZE - 1);
+    size_t num_pages = NUM_PAGES((va - base) + size);
+
+    spin_lock(&rv_iommu.cq_lock);
+    if (size == 0 || num_pages > TLB_INV_RANGE_MAX_OPS || num_pages >= (CQ_N_ENTRIES - 1)) {
+        rv_iommu_cq_push(cmd0, 0);
+    } else {
+        for (size_t i = 0; i < num_pages; i++) {
+            uint64_t addr = ((base + (i * PAGE_SIZE)) >> 12) << RV_IOMMU_CMD_IOTINVAL_ADDR_OFF;
+            rv_iommu_cq_push(cmd0 | RV_IOMMU_CMD_IOTINVAL_AV_BIT,
+                addr & RV_IOMMU_CMD_IOTINVAL_ADDR_MASK);
+        }
+    }
+    rv_iommu_cq_submit();
+    spin_unlock(&rv_iommu.cq_lock);
+}
+
+/**
+ * Invalidate all IOTLB entries of a VM.
+ *
+ * @vmid:   VM (GSCID) whose mappings changed
+ */
+void iommu_arch_vm_inv_all(asid_t vmid)
+{
+    iommu_arch_vm_inv_range(vmid, 0, 0);
+}
+
 /**
  * IOMMU HW Initialization.
  *
@@ -171,7 +171,7 @@ irqid_t aplic_idc_get_claimi_intpid(idcid_t idc_id)
     return (aplic_idc[idc_id].claimi >> IDC_CLAIMI_INTP_ID_SHIFT) & IDC_CLAIMI_INTP_ID_MASK;
 }
 
-void aplic_handle(void)
+__hot void aplic_handle(void)
 {
     idcid_t idc_id = cpu()->id;
     irqid_t intp_identity = aplic_idc_get_claimi_intpid(idc_id);
@@ -30,6 +30,19 @@ struct vaplic {
     struct emul_mem aplic_idc_emul;
 };
 
+/**
+ * The configuration the guest programmed in the virtual APLIC, kept by vm snapshots. Pending
+ * and active interrupts are not part of it.
+ */
+struct vaplic_snapshot {
+    uint32_t domaincfg;
+    uint32_t srccfg[APLIC_MAX_INTERRUPTS];
+    uint32_t ie[APLIC_MAX_INTERRUPTS / 32];
+    uint32_t target[APLIC_MAX_INTERRUPTS];
+    BITMAP_ALLOC(idelivery, APLIC_DOMAIN_NUM_HARTS);
+    uint32_t ithreshold[APLIC_DOMAIN_NUM_HARTS];
+};
+
 struct vm;
 struct vcpu;
 union vm_irqc_dscrp;
@@ -63,6 +76,29 @@ void vaplic_inject(struct vcpu* vcpu, irqid_t id);
  */
 void vaplic_set_hw(struct vm* vm, irqid_t id);
 
+/**
+ * @brief Bring the virtual APLIC of a vm back to its reset state
+ *
+ * @param vm Virtual machine being reset
+ */
+void vaplic_reset(struct vm* vm);
+
+/**
+ * @brief Save the configuration of the virtual APLIC of a vm
+ *
+ * @param vm Virtual machine being snapshotted
+ * @param snap Where to save the configuration to
+ */
+void vaplic_snapshot_save(struct vm* vm, struct vaplic_snapshot* snap);
+
+/**
+ * @brief Bring the virtual APLIC of a vm back to a saved configuration
+ *
+ * @param vm Virtual machine being restored
+ * @param snap The configuration to restore
+ */
+void vaplic_snapshot_restore(struct vm* vm, const struct vaplic_snapshot* snap);
+
 /**
  * @brief Wrapper for the virtual irqc initialization function
  *
@@ -74,6 +110,42 @@ static inline void virqc_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_
     vaplic_init(vm, vm_irqc_dscrp);
 }
 
+/**
+ * @brief Wrapper for the virtual irqc reset function
+ *
+ * @param vm Virtual Machine
+ */
+static inline void virqc_reset(struct vm* vm)
+{
+    vaplic_reset(vm);
+}
+
+struct virqc_snapshot {
+    struct vaplic_snapshot vaplic;
+};
+
+/**
+ * @brief Wrapper for the virtual irqc snapshot save function
+ *
+ * @param vm Virtual Machine
+ * @param snap Where to save the configuration to
+ */
+static inline void virqc_snapshot_save(struct vm* vm, struct virqc_snapshot* snap)
+{
+    vaplic_snapshot_save(vm, &snap->vaplic);
+}
+
+/**
+ * @brief Wrapper for the virtual irqc snapshot restore function
+ *
+ * @param vm Virtual Machine
+ * @param snap The configuration to restore
+ */
+static inline void virqc_snapshot_restore(struct vm* vm, const struct virqc_snapshot* snap)
+{
+    vaplic_snapshot_restore(vm, &snap->vaplic);
+}
+
 /**
  * @brief Injects a given interrupt into a virtual cpu
  *
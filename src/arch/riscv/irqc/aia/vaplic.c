@@ -5,11 +5,15 @@
 
 #include <vaplic.h>
 #include <vm.h>
+#include <config.h>
 #include <cpu.h>
 #include <emul.h>
 #include <mem.h>
 #include <interrupts.h>
+#include <irq_limit.h>
 #include <arch/csrs.h>
+#include <prof.h>
+#include <string.h>
 
 #define APLIC_MIN_PRIO             (0xFF)
 #define UPDATE_ALL_HARTS           (-1)
@@ -173,6 +177,8 @@ static bool vaplic_set_pend(struct vcpu* vcpu, irqid_t intp_id)
  */
 static bool vaplic_update_topi(struct vcpu* vcpu)
 {
+    PROF_SCOPE(PROF_VAPLIC_UPDATE_TOPI);
+
     struct vaplic* vaplic = &vcpu->vm->arch.vaplic;
     bool ret = false;
     uint32_t intp_prio = APLIC_MIN_PRIO;
@@ -184,10 +190,20 @@ static bool vaplic_update_topi(struct vcpu* vcpu)
     bool idc_force = false;
     uint32_t update_topi = 0;
 
-    /** Find highest pending and enabled interrupt */
-    for (size_t i = 1; i < APLIC_MAX_INTERRUPTS; i++) {
-        if (vaplic_get_hart_index(vcpu, i) == vcpu->id) {
-            if (vaplic_get_pend(vcpu, i) && vaplic_get_enbl(vcpu, i)) {
+    /**
+     * Find highest pending and enabled interrupt. Only sources both pending and enabled, found a
+     * word at a time, have their target checked. Interrupt 0 does not exist.
+     */
+    for (size_t reg = 0; reg < APLIC_NUM_SETIx_REGS; reg++) {
+        uint32_t pend_enbl = vaplic->ip[reg] & vaplic->ie[reg];
+        if (reg == 0) {
+            pend_enbl &= MASK_INTP_ZERO;
+        }
+        while (pend_enbl != 0) {
+            size_t bit = (size_t)bit32_ffs(pend_enbl);
+            pend_enbl = bit32_clear(pend_enbl, bit);
+            irqid_t i = (irqid_t)((reg * 32) + bit);
+            if (vaplic_get_hart_index(vcpu, i) == vcpu->id) {
                 prio = vaplic_get_target(vcpu, i) & APLIC_TARGET_IPRIO_MASK;
                 if (prio < intp_prio) {
                     intp_prio = prio;
@@ -240,7 +256,7 @@ static void vaplic_update_hart_line(struct vcpu* vcpu, vcpuid_t vhart_index)
         }
     } else {
         struct cpu_msg msg = { VPLIC_IPI_ID, UPDATE_HART_LINE, vhart_index };
-        cpu_send_msg(pcpu_id, &msg);
+        cpu_send_urgent_msg(pcpu_id, &msg);
     }
 }
 
@@ -265,6 +281,34 @@ static void vaplic_update_hart(struct vcpu* vcpu, int16_t vhart_index)
     }
 }
 
+/**
+ * @brief Triggers the interrupt line update of the harts targeted by a register's interrupts.
+ *        Each hart is updated once, however many of its interrupts the register write changed,
+ *        so that bursts of interrupts do not each rescan the hart's interrupts or message it.
+ *
+ * @param vcpu virtual cpu
+ * @param reg register index
+ * @param intps interrupts of the register whose state changed, bit-mapped
+ */
+static void vaplic_update_harts(struct vcpu* vcpu, size_t reg, uint32_t intps)
+{
+    struct vaplic* vaplic = &vcpu->vm->arch.vaplic;
+    cpumask_t harts = CPUMASK_EMPTY;
+
+    while (intps != 0) {
+        irqid_t intp_id = (reg * APLIC_NUM_INTP_PER_REG) + bit_ctz(intps);
+        vcpuid_t vhart_index = vaplic_get_hart_index(vcpu, intp_id);
+        if (vhart_index < vaplic->idc_num) {
+            cpumask_set(&harts, vhart_index);
+        }
+        intps &= intps - 1;
+    }
+
+    cpumask_foreach (&harts, vhart_index) {
+        vaplic_update_hart_line(vcpu, (vcpuid_t)vhart_index);
+    }
+}
+
 /**
  * @brief Processes an incoming event.
  *
@@ -415,12 +459,7 @@ static void vaplic_set_setip(struct vcpu* vcpu, size_t reg, uint32_t new_val)
         new_val &= vaplic->active[reg];
         update_intps = (~vaplic->ip[reg]) & new_val;
         vaplic->ip[reg] |= new_val;
-        for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
-             i < (reg * APLIC_NUM_INTP_PER_REG) + APLIC_NUM_INTP_PER_REG; i++) {
-            if (!!bit32_get(update_intps, i % 32)) {
-                vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, i));
-            }
-        }
+        vaplic_update_harts(vcpu, reg, update_intps);
     }
     spin_unlock(&vaplic->lock);
 }
@@ -463,12 +502,7 @@ static void vaplic_set_in_clrip(struct vcpu* vcpu, size_t reg, uint32_t new_val)
         aplic_clr_pend_reg(reg, new_val);
         vaplic->ip[reg] |= aplic_get_pend_reg(reg);
         update_intps &= ~(vaplic->ip[reg]);
-        for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
-             i < (reg * APLIC_NUM_INTP_PER_REG) + APLIC_NUM_INTP_PER_REG; i++) {
-            if (!!bit32_get(update_intps, i % 32)) {
-                vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, i));
-            }
-        }
+        vaplic_update_harts(vcpu, reg, update_intps);
     }
     spin_unlock(&vaplic->lock);
 }
@@ -551,12 +585,7 @@ static void vaplic_set_setie(struct vcpu* vcpu, size_t reg, uint32_t new_val)
         vaplic->ie[reg] |= new_val;
         new_val &= vaplic->hw[reg];
         aplic_set_enbl_reg(reg, new_val);
-        for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
-             i < (reg * APLIC_NUM_INTP_PER_REG) + APLIC_NUM_INTP_PER_REG; i++) {
-            if (!!bit32_get(update_intps, i % 32)) {
-                vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, i));
-            }
-        }
+        vaplic_update_harts(vcpu, reg, update_intps);
     }
     spin_unlock(&vaplic->lock);
 }
@@ -601,12 +630,7 @@ static void vaplic_set_clrie(struct vcpu* vcpu, size_t reg, uint32_t new_val)
         vaplic->ie[reg] &= ~(new_val);
         new_val &= vaplic->hw[reg];
         aplic_clr_enbl_reg(reg, new_val);
-        for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
-             i < (reg * APLIC_NUM_INTP_PER_REG) + APLIC_NUM_INTP_PER_REG; i++) {
-            if (!!bit32_get(update_intps, i % 32)) {
-                vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, i));
-            }
-        }
+        vaplic_update_harts(vcpu, reg, update_intps);
     }
     spin_unlock(&vaplic->lock);
 }
@@ -664,8 +688,13 @@ static void vaplic_set_target(struct vcpu* vcpu, irqid_t intp_id, uint32_t new_v
         prev_hart_index = vaplic_get_hart_index(vcpu, intp_id);
         if (vaplic_get_hw(vcpu, intp_id)) {
             aplic_set_target_hart(intp_id, pcpu_id);
-            aplic_set_target_prio(intp_id, priority);
-            priority = aplic_get_target_prio(intp_id);
+            /* A critical vm's interrupts are claimed first, the guest keeping its own priority */
+            if (vcpu->vm->config->critical) {
+                aplic_set_target_prio(intp_id, APLIC_TARGET_MAX_PRIO);
+            } else {
+                aplic_set_target_prio(intp_id, priority);
+                priority = aplic_get_target_prio(intp_id);
+            }
         }
         vaplic->target[intp_id] = (hart_index << APLIC_TARGET_HART_IDX_SHIFT) | priority;
         if (prev_hart_index != hart_index) {
@@ -1118,6 +1147,24 @@ void vaplic_inject(struct vcpu* vcpu, irqid_t intp_id)
     spin_unlock(&vaplic->lock);
 }
 
+/**
+ * An APLIC source is claimed by reading claimi, after which it can fire again, so a deferred
+ * interrupt must be disabled at the APLIC until it is injected.
+ */
+void irq_limit_arch_mask(irqid_t int_id, bool mask)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    struct vaplic* vaplic = &vcpu->vm->arch.vaplic;
+
+    spin_lock(&vaplic->lock);
+    if (mask) {
+        aplic_clr_enbl(int_id);
+    } else if (vaplic_get_enbl(vcpu, int_id) && vaplic_get_hw(vcpu, int_id)) {
+        aplic_set_enbl(int_id);
+    }
+    spin_unlock(&vaplic->lock);
+}
+
 /**
  * @brief Given an address, this function returns if it is reserved
  *
@@ -1238,6 +1285,13 @@ static bool vaplic_domain_emul_handler(struct emul_access* acc)
 /**
  * @brief Function to handle writes (or reads) to (from) IDC structure.
  *
+ * The IDCs are deliberately always emulated, even for harts and sources the vm owns alone, as
+ * passing them through would break delivery. Unlike with a plic context, the hypervisor would see
+ * none of the guest's accesses: reading claimi has no matching complete, and the claimi and
+ * ithreshold registers share a page. Only the hypervisor can clear hvip.VSEIP, the sole path the
+ * IDC's line has to the guest without IMSIC guest files, so the guest would keep taking external
+ * interrupts once it had claimed them all. A page of IDCs also spans up to 128 harts.
+ *
  * @param acc emulated access
  * @return true  if conclude without errors.
  * @return false if the access is not aligned.
@@ -1278,6 +1332,86 @@ static bool vaplic_idc_emul_handler(struct emul_access* acc)
     return true;
 }
 
+/**
+ * @brief Bring the virtual APLIC of a vm back to its reset state
+ *
+ * @param vm Virtual machine being reset
+ *
+ * The physical sources of the vm's interrupts are made inactive, which also drops their pending
+ * and enable bits, so no interrupt from before the reset reaches the restarted guest.
+ */
+void vaplic_reset(struct vm* vm)
+{
+    struct vaplic* vaplic = &vm->arch.vaplic;
+
+    spin_lock(&vaplic->lock);
+    for (irqid_t i = 1; i < APLIC_MAX_INTERRUPTS; i++) {
+        if (bitmap_get(vaplic->hw, i)) {
+            aplic_clr_enbl(i);
+            aplic_set_sourcecfg(i, APLIC_SOURCECFG_SM_INACTIVE);
+        }
+    }
+    vaplic->domaincfg = 0;
+    memset(vaplic->srccfg, 0, sizeof(vaplic->srccfg));
+    memset(vaplic->active, 0, sizeof(vaplic->active));
+    memset(vaplic->ip, 0, sizeof(vaplic->ip));
+    memset(vaplic->ie, 0, sizeof(vaplic->ie));
+    memset(vaplic->target, 0, sizeof(vaplic->target));
+    memset(vaplic->idelivery, 0, sizeof(vaplic->idelivery));
+    memset(vaplic->iforce, 0, sizeof(vaplic->iforce));
+    memset(vaplic->ithreshold, 0, sizeof(vaplic->ithreshold));
+    memset(vaplic->topi_claimi, 0, sizeof(vaplic->topi_claimi));
+    spin_unlock(&vaplic->lock);
+}
+
+void vaplic_snapshot_save(struct vm* vm, struct vaplic_snapshot* snap)
+{
+    struct vaplic* vaplic = &vm->arch.vaplic;
+
+    spin_lock(&vaplic->lock);
+    snap->domaincfg = vaplic->domaincfg;
+    memcpy(snap->srccfg, vaplic->srccfg, sizeof(snap->srccfg));
+    memcpy(snap->ie, vaplic->ie, sizeof(snap->ie));
+    memcpy(snap->target, vaplic->target, sizeof(snap->target));
+    memcpy(snap->idelivery, vaplic->idelivery, sizeof(snap->idelivery));
+    memcpy(snap->ithreshold, vaplic->ithreshold, sizeof(snap->ithreshold));
+    spin_unlock(&vaplic->lock);
+}
+
+/**
+ * @brief Bring the virtual APLIC of a vm back to a saved configuration
+ *
+ * @param vm Virtual machine being restored
+ * @param snap The configuration to restore
+ *
+ * The configuration is written over a reset virtual APLIC through the same paths as the guest's
+ * own writes, so the physical sources of the vm's interrupts are reprogrammed. The sources are
+ * configured before their targets and enables, which only apply to active sources.
+ */
+void vaplic_snapshot_restore(struct vm* vm, const struct vaplic_snapshot* snap)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    vaplic_reset(vm);
+
+    vaplic_set_domaincfg(vcpu, snap->domaincfg);
+    for (irqid_t i = 1; i < APLIC_MAX_INTERRUPTS; i++) {
+        if (snap->srccfg[i] != APLIC_SOURCECFG_SM_INACTIVE) {
+            vaplic_set_sourcecfg(vcpu, i, snap->srccfg[i]);
+            vaplic_set_target(vcpu, i, snap->target[i]);
+        }
+    }
+    for (idcid_t idc = 0; idc < vm->arch.vaplic.idc_num; idc++) {
+        vaplic_set_ithreshold(vcpu, idc, snap->ithreshold[idc]);
+        vaplic_set_idelivery(vcpu, idc, bitmap_get((bitmap_t*)snap->idelivery, idc));
+    }
+    for (size_t reg = 0; reg < APLIC_NUM_SETIx_REGS; reg++) {
+        if (snap->ie[reg] != 0) {
+            vaplic_set_setie(vcpu, reg, snap->ie[reg]);
+        }
+    }
+}
+
 void vaplic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
 {
     if (cpu()->id == vm->master) {
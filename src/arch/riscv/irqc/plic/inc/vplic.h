@@ -21,22 +21,54 @@ struct vplic {
     uint32_t prio[PLIC_MAX_INTERRUPTS];
     BITMAP_ALLOC_ARRAY(enbl, PLIC_MAX_INTERRUPTS, PLIC_PLAT_CNTXT_NUM);
     uint32_t threshold[PLIC_PLAT_CNTXT_NUM];
+    /* Generation tagged cache of each context's next pending interrupt, see vplic_next_pending */
+    uint32_t gen;
+    uint64_t next_pend[PLIC_PLAT_CNTXT_NUM];
     struct emul_mem plic_global_emul;
     struct emul_mem plic_threshold_emul;
 };
 
+/* The priorities, enables and thresholds the guest programmed, kept by vm snapshots */
+struct vplic_snapshot {
+    uint32_t prio[PLIC_MAX_INTERRUPTS];
+    BITMAP_ALLOC_ARRAY(enbl, PLIC_MAX_INTERRUPTS, PLIC_PLAT_CNTXT_NUM);
+    uint32_t threshold[PLIC_PLAT_CNTXT_NUM];
+};
+
 struct vm;
 struct vcpu;
 union vm_irqc_dscrp;
 void vplic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp);
 void vplic_inject(struct vcpu* vcpu, irqid_t id);
 void vplic_set_hw(struct vm* vm, irqid_t id);
+void vplic_reset(struct vm* vm);
+void vplic_snapshot_save(struct vm* vm, struct vplic_snapshot* snap);
+void vplic_snapshot_restore(struct vm* vm, const struct vplic_snapshot* snap);
 
 static inline void virqc_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
 {
     vplic_init(vm, vm_irqc_dscrp);
 }
 
+static inline void virqc_reset(struct vm* vm)
+{
+    vplic_reset(vm);
+}
+
+struct virqc_snapshot {
+    struct vplic_snapshot vplic;
+};
+
+static inline void virqc_snapshot_save(struct vm* vm, struct virqc_snapshot* snap)
+{
+    vplic_snapshot_save(vm, &snap->vplic);
+}
+
+static inline void virqc_snapshot_restore(struct vm* vm, const struct virqc_snapshot* snap)
+{
+    vplic_snapshot_restore(vm, &snap->vplic);
+}
+
 typedef struct vcpu vcpu_t;
 static inline void virqc_inject(vcpu_t* vcpu, irqid_t id)
 {
@@ -7,6 +7,7 @@
 #include <interrupts.h>
 #include <cpu.h>
 #include <fences.h>
+#include <arch/csrs.h>
 
 size_t PLIC_IMPL_INTERRUPTS;
 
@@ -57,6 +58,7 @@ void plic_init()
 void plic_cpu_init()
 {
     cpu()->arch.plic_cntxt = plic_plat_cntxt_to_id((struct plic_cntxt){ cpu()->id, PRIV_S });
+    cpu()->arch.plic_direct = false;
     plic_hart[cpu()->arch.plic_cntxt].threshold = 0;
 }
 
@@ -136,8 +138,19 @@ uint32_t plic_get_threshold(unsigned cntxt)
     return threshold;
 }
 
-void plic_handle()
+/**
+ * A context owned by the vcpu is left for the guest to claim from. Its interrupt is masked until
+ * the guest completes or changes the context's threshold, which still trap, as the plic's
+ * interrupt line can only reach the guest through hvip.
+ */
+__hot void plic_handle()
 {
+    if (cpu()->arch.plic_direct) {
+        CSRC(sie, SIE_SEIE);
+        CSRS(CSR_HVIP, HIP_VSEIP);
+        return;
+    }
+
     uint32_t id = plic_hart[cpu()->arch.plic_cntxt].claim;
 
     if (id != 0) {
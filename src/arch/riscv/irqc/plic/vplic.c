@@ -8,8 +8,12 @@
 #include <emul.h>
 #include <mem.h>
 #include <vm.h>
+#include <config.h>
 #include <interrupts.h>
 #include <arch/csrs.h>
+#include <fences.h>
+#include <string.h>
+#include <remio.h>
 
 static int vplic_vcntxt_to_pcntxt(struct vcpu* vcpu, int vcntxt_id)
 {
@@ -95,26 +99,55 @@ static uint32_t vplic_get_threshold(struct vcpu* vcpu, int vcntxt)
     return vplic->threshold[vcntxt];
 }
 
+/**
+ * Must be called holding the vplic lock whenever pend, act, enbl, prio or threshold are modified,
+ * so the cached next pending interrupt of every context is recomputed.
+ */
+static inline void vplic_invalidate_next_pending(struct vplic* vplic)
+{
+    vplic->gen++;
+}
+
 static irqid_t vplic_next_pending(struct vcpu* vcpu, int vcntxt)
 {
+    struct vplic* vplic = &vcpu->vm->arch.vplic;
     uint32_t max_prio = 0;
     irqid_t int_id = 0;
 
-    for (size_t i = 0; i < PLIC_MAX_INTERRUPTS; i++) {
-        if (vplic_get_pend(vcpu, i) && !vplic_get_act(vcpu, i) && vplic_get_enbl(vcpu, vcntxt, i)) {
-            uint32_t prio = vplic_get_prio(vcpu, i);
+    /**
+     * The cached result is tagged with the generation it was computed in. It might be computed
+     * without holding the lock, in which case a concurrent update bumps the generation and the
+     * stale result is never used.
+     */
+    uint32_t gen = vplic->gen;
+    fence_ord_read();
+    uint64_t cached = vplic->next_pend[vcntxt];
+    if ((uint32_t)(cached >> 32) == gen) {
+        return (irqid_t)(cached & 0xffffffff);
+    }
+
+    for (size_t reg = 0; reg < BITMAP_SIZE(PLIC_MAX_INTERRUPTS); reg++) {
+        bitmap_granule_t candidates =
+            vplic->pend[reg] & ~vplic->act[reg] & vplic->enbl[vcntxt][reg];
+        while (candidates != 0) {
+            size_t bit = (size_t)bit32_ffs(candidates);
+            candidates = bit32_clear(candidates, bit);
+            irqid_t id = (irqid_t)((reg * BITMAP_GRANULE_LEN) + bit);
+            uint32_t prio = vplic_get_prio(vcpu, id);
             if (prio > max_prio) {
                 max_prio = prio;
-                int_id = i;
+                int_id = id;
             }
         }
     }
 
-    if (max_prio > vplic_get_threshold(vcpu, vcntxt)) {
-        return int_id;
-    } else {
-        return 0;
+    if (max_prio <= vplic_get_threshold(vcpu, vcntxt)) {
+        int_id = 0;
     }
+
+    vplic->next_pend[vcntxt] = ((uint64_t)gen << 32) | int_id;
+
+    return int_id;
 }
 
 enum { UPDATE_HART_LINE };
@@ -125,7 +158,11 @@ void vplic_update_hart_line(struct vcpu* vcpu, int vcntxt)
 {
     int pcntxt_id = vplic_vcntxt_to_pcntxt(vcpu, vcntxt);
     struct plic_cntxt pcntxt = plic_plat_id_to_cntxt(pcntxt_id);
-    if (pcntxt.hart_id == cpu()->id) {
+    if ((pcntxt.hart_id == cpu()->id) && cpu()->arch.plic_direct) {
+        /* If the context's line is still raised, plic_handle raises the guest's again */
+        CSRC(CSR_HVIP, HIP_VSEIP);
+        CSRS(sie, SIE_SEIE);
+    } else if (pcntxt.hart_id == cpu()->id) {
         int id = vplic_next_pending(vcpu, vcntxt);
         if (id != 0) {
             CSRS(CSR_HVIP, HIP_VSEIP);
@@ -134,7 +171,7 @@ void vplic_update_hart_line(struct vcpu* vcpu, int vcntxt)
         }
     } else {
         struct cpu_msg msg = { VPLIC_IPI_ID, UPDATE_HART_LINE, vcntxt };
-        cpu_send_msg(pcntxt.hart_id, &msg);
+        cpu_send_urgent_msg(pcntxt.hart_id, &msg);
     }
 }
 
@@ -152,6 +189,7 @@ static void vplic_set_threshold(struct vcpu* vcpu, int vcntxt, uint32_t threshol
     struct vplic* vplic = &vcpu->vm->arch.vplic;
     spin_lock(&vplic->lock);
     vplic->threshold[vcntxt] = threshold;
+    vplic_invalidate_next_pending(vplic);
     int pcntxt = vplic_vcntxt_to_pcntxt(vcpu, vcntxt);
     plic_set_threshold(pcntxt, threshold);
     spin_unlock(&vplic->lock);
@@ -169,6 +207,7 @@ static void vplic_set_enbl(struct vcpu* vcpu, int vcntxt, irqid_t id, bool set)
         } else {
             bitmap_clear(vplic->enbl[vcntxt], id);
         }
+        vplic_invalidate_next_pending(vplic);
 
         if (vplic_get_hw(vcpu, id)) {
             int pcntxt_id = vplic_vcntxt_to_pcntxt(vcpu, vcntxt);
@@ -186,8 +225,10 @@ static void vplic_set_prio(struct vcpu* vcpu, irqid_t id, uint32_t prio)
     spin_lock(&vplic->lock);
     if (id < PLIC_MAX_INTERRUPTS && vplic_get_prio(vcpu, id) != prio) {
         vplic->prio[id] = prio;
+        vplic_invalidate_next_pending(vplic);
         if (vplic_get_hw(vcpu, id)) {
-            plic_set_prio(id, prio);
+            /* A critical vm's interrupts are claimed first, the guest keeping its own priority */
+            plic_set_prio(id, ((prio != 0) && vcpu->vm->config->critical) ? (uint32_t)-1 : prio);
         } else {
             for (size_t i = 0; i < vplic->cntxt_num; i++) {
                 if (plic_plat_id_to_cntxt(i).mode != PRIV_S) {
@@ -208,6 +249,7 @@ static irqid_t vplic_claim(struct vcpu* vcpu, int vcntxt)
     irqid_t int_id = vplic_next_pending(vcpu, vcntxt);
     bitmap_clear(vcpu->vm->arch.vplic.pend, int_id);
     bitmap_set(vcpu->vm->arch.vplic.act, int_id);
+    vplic_invalidate_next_pending(&vcpu->vm->arch.vplic);
     spin_unlock(&vcpu->vm->arch.vplic.lock);
 
     vplic_update_hart_line(vcpu, vcntxt);
@@ -222,6 +264,7 @@ static void vplic_complete(struct vcpu* vcpu, int vcntxt, irqid_t int_id)
 
     spin_lock(&vcpu->vm->arch.vplic.lock);
     bitmap_clear(vcpu->vm->arch.vplic.act, int_id);
+    vplic_invalidate_next_pending(&vcpu->vm->arch.vplic);
     spin_unlock(&vcpu->vm->arch.vplic.lock);
 
     vplic_update_hart_line(vcpu, vcntxt);
@@ -233,6 +276,7 @@ void vplic_inject(struct vcpu* vcpu, irqid_t id)
     spin_lock(&vplic->lock);
     if (id > 0 && id < PLIC_MAX_INTERRUPTS && !vplic_get_pend(vcpu, id)) {
         bitmap_set(vplic->pend, id);
+        vplic_invalidate_next_pending(vplic);
 
         if (vplic_get_hw(vcpu, id)) {
             struct plic_cntxt vcntxt = { vcpu->id, PRIV_S };
@@ -360,6 +404,131 @@ static bool vplic_hart_emul_handler(struct emul_access* acc)
     return true;
 }
 
+/**
+ * Interrupts claimed by the guest are invisible to the vplic, so a guest directly owning a context
+ * must neither be given virtual interrupts, which it would not find when claiming, nor share the
+ * context with the hypervisor's interrupts. The claim register shares its page with the threshold,
+ * so the page is mapped read only and completions and threshold writes are still emulated, which
+ * is when the guest's interrupt line is updated.
+ */
+static void vplic_direct_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
+{
+    const struct vm_platform* vm_platform = &vm->config->platform;
+    bool shared = false;
+
+    for (size_t i = 0; i < vm_platform->ipc_num; i++) {
+        shared = shared || (vm_platform->ipcs[i].interrupt_num > 0);
+    }
+    for (size_t i = 0; i < vm_platform->remio_dev_num; i++) {
+        shared = shared || (vm_platform->remio_devs[i].type == REMIO_DEV_BACKEND);
+    }
+    for (irqid_t id = 1; id <= PLIC_IMPL_INTERRUPTS; id++) {
+        shared = shared || plic_get_enbl(cpu()->arch.plic_cntxt, id);
+    }
+
+    if (shared) {
+        WARNING("VM %d can not directly own plic context %d, it is emulated", vm->id,
+            cpu()->arch.plic_cntxt);
+        return;
+    }
+
+    int vcntxt = plic_plat_cntxt_to_id((struct plic_cntxt){ cpu()->vcpu->id, PRIV_S });
+    vaddr_t va = vm_irqc_dscrp->plic.base + PLIC_THRESHOLD_OFF +
+        ((vaddr_t)vcntxt * sizeof(struct plic_hart_hw));
+    paddr_t pa = platform.arch.irqc.plic.base + HART_REG_OFF +
+        ((paddr_t)cpu()->arch.plic_cntxt * sizeof(struct plic_hart_hw));
+    struct ppages ppages = mem_ppages_get(pa, 1);
+    if (mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, va, 1, PTE_VM_RO_FLAGS) != va) {
+        ERROR("failed to map plic context %d to VM %d", cpu()->arch.plic_cntxt, vm->id);
+    }
+
+    cpu()->arch.plic_direct = true;
+}
+
+/**
+ * Physical interrupts pending or active in the vplic were already claimed from the plic, so they
+ * are completed here, through this hart's context, before every context of the vm is disabled.
+ */
+void vplic_reset(struct vm* vm)
+{
+    struct vplic* vplic = &vm->arch.vplic;
+
+    spin_lock(&vplic->lock);
+    for (irqid_t id = 1; id < PLIC_MAX_INTERRUPTS; id++) {
+        if (!bitmap_get(vplic->hw, id)) {
+            continue;
+        }
+        plic_set_prio(id, 0);
+        if (bitmap_get(vplic->pend, id) || bitmap_get(vplic->act, id) ||
+            vm->config->platform.arch.irqc.plic.direct_cntxt) {
+            plic_set_enbl(cpu()->arch.plic_cntxt, id, true);
+            plic_hart[cpu()->arch.plic_cntxt].complete = id;
+            plic_set_enbl(cpu()->arch.plic_cntxt, id, false);
+        }
+    }
+    for (size_t vcntxt = 0; vcntxt < vplic->cntxt_num; vcntxt++) {
+        int pcntxt = vplic_vcntxt_to_pcntxt(cpu()->vcpu, vcntxt);
+        for (irqid_t id = 1; (pcntxt >= 0) && (id < PLIC_MAX_INTERRUPTS); id++) {
+            if (bitmap_get(vplic->hw, id) && bitmap_get(vplic->enbl[vcntxt], id)) {
+                plic_set_enbl(pcntxt, id, false);
+            }
+        }
+        if ((pcntxt >= 0) && (plic_plat_id_to_cntxt(vcntxt).mode == PRIV_S)) {
+            plic_set_threshold(pcntxt, 0);
+        }
+        vplic->threshold[vcntxt] = 0;
+    }
+    memset(vplic->pend, 0, sizeof(vplic->pend));
+    memset(vplic->act, 0, sizeof(vplic->act));
+    memset(vplic->prio, 0, sizeof(vplic->prio));
+    memset(vplic->enbl, 0, sizeof(vplic->enbl));
+    vplic_invalidate_next_pending(vplic);
+    spin_unlock(&vplic->lock);
+}
+
+void vplic_snapshot_save(struct vm* vm, struct vplic_snapshot* snap)
+{
+    struct vplic* vplic = &vm->arch.vplic;
+
+    spin_lock(&vplic->lock);
+    memcpy(snap->prio, vplic->prio, sizeof(snap->prio));
+    memcpy(snap->enbl, vplic->enbl, sizeof(snap->enbl));
+    memcpy(snap->threshold, vplic->threshold, sizeof(snap->threshold));
+    spin_unlock(&vplic->lock);
+}
+
+/**
+ * The configuration is reapplied on top of a reset vplic through the same paths as the guest's
+ * writes, so that the plic is reprogrammed for the hw interrupts. Pending and active interrupts
+ * are dropped, as on a reset.
+ */
+void vplic_snapshot_restore(struct vm* vm, const struct vplic_snapshot* snap)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    struct vplic* vplic = &vm->arch.vplic;
+
+    vplic_reset(vm);
+
+    for (irqid_t id = 1; id < PLIC_MAX_INTERRUPTS; id++) {
+        if (snap->prio[id] != 0) {
+            vplic_set_prio(vcpu, id, snap->prio[id]);
+        }
+    }
+    for (size_t vcntxt = 0; vcntxt < vplic->cntxt_num; vcntxt++) {
+        if (!vplic_vcntxt_valid(vcpu, (int)vcntxt)) {
+            continue;
+        }
+        if (snap->threshold[vcntxt] != 0) {
+            vplic_set_threshold(vcpu, (int)vcntxt, snap->threshold[vcntxt]);
+        }
+        for (irqid_t id = 1; id < PLIC_MAX_INTERRUPTS; id++) {
+            if (bitmap_get((bitmap_t*)snap->enbl[vcntxt], id)) {
+                vplic_set_enbl(vcpu, (int)vcntxt, id, true);
+            }
+        }
+    }
+}
+
 void vplic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
 {
     if (cpu()->id == vm->master) {
@@ -379,4 +548,8 @@ void vplic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
         /* assumes 2 contexts per hart */
         vm->arch.vplic.cntxt_num = vm->cpu_num * 2;
     }
+
+    if (vm_irqc_dscrp->plic.direct_cntxt) {
+        vplic_direct_init(vm, vm_irqc_dscrp);
+    }
 }
@@ -7,6 +7,16 @@
 
 #include <platform.h>
 #include <cpu.h>
+#include <string.h>
+#include <arch/instructions.h>
+
+/**
+ * The Zicboz block size is not discoverable from S-mode. Platforms implementing the extension must
+ * override this if their cache block size differs.
+ */
+#ifndef CPU_CBOZ_BLOCK_SIZE
+#define CPU_CBOZ_BLOCK_SIZE (64)
+#endif
 
 static inline void as_map_physical_identity(struct addr_space* as)
 {
@@ -42,7 +52,7 @@ void as_arch_init(struct addr_space* as)
     }
 }
 
-bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
+bool mem_arch_translate(struct addr_space* as, vaddr_t va, paddr_t* pa, size_t* block_size)
 {
     size_t pte_index = pt_getpteindex_by_va(&as->pt, va, 0);
     pte_t* pte = &(as->pt.root[pte_index]);
@@ -59,9 +69,36 @@ bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
     if (pte && pte_valid(pte)) {
         *pa = pte_addr(pte);
         paddr_t mask = (1ULL << as->pt.dscr->lvl_off[lvl]) - 1;
+        if (pte_contig(pte)) {
+            mask = (PTE_NAPOT_NUM << as->pt.dscr->lvl_off[lvl]) - 1;
+        }
         *pa = (*pa & ~mask) | ((paddr_t)va & mask);
+        *block_size = (size_t)mask + 1;
         return true;
     } else {
         return false;
     }
 }
+
+void mem_zero_pages(void* base, size_t num_pages)
+{
+    size_t size = num_pages * PAGE_SIZE;
+
+    /**
+     * cbo.zero additionally requires the firmware to have set menvcfg.CBZE, which is the case for
+     * any firmware advertising the extension to the supervisor.
+     */
+    if (CPU_HAS_EXTENSION(CPU_EXT_ZICBOZ)) {
+        for (vaddr_t addr = (vaddr_t)base; addr < (vaddr_t)base + size;
+             addr += CPU_CBOZ_BLOCK_SIZE) {
+            cbo_zero(addr);
+        }
+    } else {
+        memset(base, 0, size);
+    }
+}
+
+bool mem_arch_hw_access(void)
+{
+    return CPU_HAS_EXTENSION(CPU_EXT_SVADU);
+}
@@ -13,6 +13,13 @@ cpu-objs-y+=interrupts.o
 cpu-objs-y+=sync_exceptions.o
 cpu-objs-y+=cpu.o
 cpu-objs-y+=cache.o
+cpu-objs-y+=tlb.o
 cpu-objs-y+=iommu.o
 cpu-objs-y+=relocate.o
-cpu-objs-y+=aclint.o
\ No newline at end of file
+cpu-objs-y+=aclint.o
+cpu-objs-y+=qos.o
+cpu-objs-y+=timer.o
+cpu-objs-y+=fp.o
+cpu-objs-y+=fp_switch.o
+cpu-objs-y+=string.o
+cpu-objs-y+=string_vec.o
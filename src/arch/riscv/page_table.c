@@ -5,6 +5,7 @@
 
 #include <bao.h>
 #include <page_table.h>
+#include <cpu.h>
 
 #if (SV32)
 struct page_table_dscr sv32_pt_dscr = { .lvls = 2,
@@ -64,3 +65,11 @@ bool pte_page(struct page_table* pt, pte_t* pte, size_t lvl)
 {
     return ((*pte & PTE_VALID) != 0) && ((*pte & PTE_RWX) != 0);
 }
+
+size_t pt_contig_num(struct page_table* pt, size_t lvl)
+{
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVNAPOT) && (PTE_NAPOT != 0) && (lvl == pt->dscr->lvls - 1)) {
+        return PTE_NAPOT_NUM;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/qos.h>
+#include <arch/csrs.h>
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <mem.h>
+#include <platform.h>
+#include <spinlock.h>
+#include <fences.h>
+#include <bit.h>
+#include <vm_qos.h>
+
+static volatile struct cbqri_cc_hw* qos_cc[CBQRI_CTL_MAX];
+static volatile struct cbqri_bc_hw* qos_bc[CBQRI_CTL_MAX];
+
+/* A controller's limit registers must not change until its configuration operation is issued. */
+static spinlock_t qos_ctl_lock = SPINLOCK_INITVAL;
+
+static bool qos_ctl_config(volatile uint64_t* alloc_ctl, size_t rcid)
+{
+    *alloc_ctl = (CBQRI_ALLOC_CTL_OP_CFG_LIMIT << CBQRI_ALLOC_CTL_OP_OFF) |
+        ((uint64_t)rcid << CBQRI_ALLOC_CTL_RCID_OFF);
+    fence_sync();
+
+    uint64_t ctl = 0;
+    do {
+        ctl = *alloc_ctl;
+    } while ((ctl & CBQRI_ALLOC_CTL_BUSY_BIT) != 0);
+
+    return bit64_extract(ctl, CBQRI_ALLOC_CTL_STATUS_OFF, CBQRI_ALLOC_CTL_STATUS_LEN) ==
+        CBQRI_ALLOC_CTL_STATUS_OK;
+}
+
+static void qos_cc_config(volatile struct cbqri_cc_hw* cc, size_t rcid, uint64_t portions)
+{
+    size_t ncblks = bit64_extract(cc->capabilities, CBQRI_CC_CAP_NCBLKS_OFF,
+        CBQRI_CC_CAP_NCBLKS_LEN);
+    size_t mask_num = min(ALIGN(ncblks, 64) / 64, CBQRI_CC_BLOCK_MASK_MAX);
+    for (size_t i = 0; i < mask_num; i++) {
+        cc->block_mask[i] = (i == 0) ? portions : 0;
+    }
+
+    if (!qos_ctl_config(&cc->alloc_ctl, rcid)) {
+        WARNING("CBQRI capacity controller failed to configure rcid %d", rcid);
+    }
+}
+
+/**
+ * The reserved bandwidth is given in blocks, of which the controller has up to mrbwb to reserve.
+ * The vm's weight in sharing the non-reserved bandwidth is left at zero, so that the reservation
+ * is also its limit.
+ */
+static void qos_bc_config(volatile struct cbqri_bc_hw* bc, size_t rcid, uint32_t percent)
+{
+    size_t mrbwb = bit64_extract(bc->capabilities, CBQRI_BC_CAP_MRBWB_OFF,
+        CBQRI_BC_CAP_MRBWB_LEN);
+    size_t rbwb = max((mrbwb * min(percent, (uint32_t)100)) / 100, (size_t)1);
+    bc->bw_alloc = (rbwb << CBQRI_BW_ALLOC_RBWB_OFF) &
+        BIT64_MASK(CBQRI_BW_ALLOC_RBWB_OFF, CBQRI_BW_ALLOC_RBWB_LEN);
+
+    if (!qos_ctl_config(&bc->alloc_ctl, rcid)) {
+        WARNING("CBQRI bandwidth controller failed to configure rcid %d", rcid);
+    }
+}
+
+void qos_init(void)
+{
+    if (!CPU_HAS_EXTENSION(CPU_EXT_SSQOSID)) {
+        return;
+    }
+
+    CSRW(CSR_SRMCFG, 0);
+
+    if (cpu_is_master()) {
+        if ((platform.arch.qos.cc_num > CBQRI_CTL_MAX) ||
+            (platform.arch.qos.bc_num > CBQRI_CTL_MAX)) {
+            ERROR("Platform defines more CBQRI controllers than supported");
+        }
+
+        for (size_t i = 0; i < platform.arch.qos.cc_num; i++) {
+            qos_cc[i] = (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+                platform.arch.qos.cc_addr[i], NUM_PAGES(sizeof(struct cbqri_cc_hw)));
+        }
+        for (size_t i = 0; i < platform.arch.qos.bc_num; i++) {
+            qos_bc[i] = (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+                platform.arch.qos.bc_addr[i], NUM_PAGES(sizeof(struct cbqri_bc_hw)));
+        }
+    }
+}
+
+/**
+ * A partitioned vm's resource control and monitoring ids are vm id + 1, id 0 being left to the
+ * hypervisor and the unpartitioned vms. The guest can not access srmcfg, so the vm can not leave
+ * its partition. The vm's first vcpu configures the controllers.
+ */
+void qos_vcpu_init(struct vcpu* vcpu, struct vm* vm)
+{
+    const struct vm_config* config = vm->config;
+    vcpu->arch.srmcfg = 0;
+
+    if ((config->qos.cache_portions == 0) && (config->qos.mbw_max == 0)) {
+        return;
+    }
+
+    size_t rcid = vm->id + 1;
+    if (!CPU_HAS_EXTENSION(CPU_EXT_SSQOSID) || (rcid > BIT_MASK(0, SRMCFG_RCID_LEN))) {
+        WARNING("QoS partitioning not supported for VM %d, ignored", vm->id);
+        return;
+    }
+
+    vcpu->arch.srmcfg = (rcid << SRMCFG_RCID_OFF) | (rcid << SRMCFG_MCID_OFF);
+
+    if (vcpu->id == 0) {
+        spin_lock(&qos_ctl_lock);
+        for (size_t i = 0; (config->qos.cache_portions != 0) && (i < platform.arch.qos.cc_num);
+             i++) {
+            qos_cc_config(qos_cc[i], rcid, config->qos.cache_portions);
+        }
+        for (size_t i = 0; (config->qos.mbw_max != 0) && (i < platform.arch.qos.bc_num); i++) {
+            qos_bc_config(qos_bc[i], rcid, config->qos.mbw_max);
+        }
+        spin_unlock(&qos_ctl_lock);
+    }
+}
+
+/**
+ * Only a vm given a partition at boot can be repartitioned, as its vcpus only then select its
+ * rcid. Unrestricted resources are given all capacity blocks or the whole bandwidth.
+ */
+bool vm_qos_arch_partition(vmid_t vm_id, uint64_t cache_portions, uint32_t mbw_max)
+{
+    const struct vm_config* vm_config = &config.vmlist[vm_id];
+    if (!CPU_HAS_EXTENSION(CPU_EXT_SSQOSID) ||
+        ((vm_config->qos.cache_portions == 0) && (vm_config->qos.mbw_max == 0))) {
+        return false;
+    }
+
+    size_t rcid = vm_id + 1;
+    spin_lock(&qos_ctl_lock);
+    for (size_t i = 0; i < platform.arch.qos.cc_num; i++) {
+        qos_cc_config(qos_cc[i], rcid, (cache_portions != 0) ? cache_portions : ~0ULL);
+    }
+    for (size_t i = 0; i < platform.arch.qos.bc_num; i++) {
+        qos_bc_config(qos_bc[i], rcid, (mbw_max != 0) ? mbw_max : 100);
+    }
+    spin_unlock(&qos_ctl_lock);
+
+    return true;
+}
@@ -10,6 +10,15 @@
 #include <bit.h>
 #include <fences.h>
 #include <hypercall.h>
+#include <spinlock.h>
+#include <arch/instructions.h>
+#include <arch/tlb.h>
+#include <timer.h>
+#include <platform.h>
+#include <config.h>
+#include <string.h>
+
+#define SBI_SPEC_VERSION_2_0            (2UL << 24)
 
 #define SBI_EXTID_BASE                  (0x10)
 #define SBI_GET_SBI_SPEC_VERSION_FID    (0)
@@ -40,6 +49,20 @@
 #define SBI_REMOTE_HFENCE_VVMA_FID      (5)
 #define SBI_REMOTE_HFENCE_VVMA_ASID_FID (6)
 
+#define SBI_EXTID_SRST                  (0x53525354)
+#define SBI_SYSTEM_RESET_FID            (0)
+#define SBI_RESET_TYPE_SHUTDOWN         (0)
+#define SBI_RESET_TYPE_COLD_REBOOT      (1)
+#define SBI_RESET_TYPE_WARM_REBOOT      (2)
+
+#define SBI_EXTID_STA                   (0x535441)
+#define SBI_STEAL_TIME_SET_SHMEM_FID    (0)
+
+#define SBI_EXTID_DBCN                  (0x4442434E)
+#define SBI_DBCN_WRITE_FID              (0)
+#define SBI_DBCN_READ_FID               (1)
+#define SBI_DBCN_WRITE_BYTE_FID         (2)
+
 /**
  * For now we're defining bao specific ecalls, ie, hypercall, under the experimental extension id
  * space.
@@ -71,6 +94,36 @@ void sbi_console_putchar(int ch)
     (void)sbi_ecall(0x1, 0, ch, 0, 0, 0, 0, 0);
 }
 
+/* Whether the firmware implements the debug console extension, probed by sbi_init */
+static bool sbi_dbcn = false;
+
+/**
+ * The firmware takes the buffer's physical address, so it is written a page at a time, the
+ * hypervisor's pages, e.g. when colored, not being physically contiguous. Returns the number of
+ * bytes written, which is short of n if the firmware has no debug console or fails.
+ */
+size_t sbi_debug_console_write(const char* buf, size_t n)
+{
+    size_t done = 0;
+
+    while (sbi_dbcn && (done < n)) {
+        vaddr_t va = (vaddr_t)&buf[done];
+        size_t len = min(n - done, PAGE_SIZE - (va & PAGE_OFFSET_MASK));
+        paddr_t pa = 0;
+        if (!mem_translate(&cpu()->as, va, &pa)) {
+            break;
+        }
+        struct sbiret ret = sbi_ecall(SBI_EXTID_DBCN, SBI_DBCN_WRITE_FID, (long)len, (long)pa, 0,
+            0, 0, 0);
+        if ((ret.error != SBI_SUCCESS) || (ret.value <= 0)) {
+            break;
+        }
+        done += (size_t)ret.value;
+    }
+
+    return done;
+}
+
 struct sbiret sbi_get_spec_version(void)
 {
     return sbi_ecall(SBI_EXTID_BASE, SBI_GET_SBI_SPEC_VERSION_FID, 0, 0, 0, 0, 0, 0);
@@ -105,6 +158,15 @@ struct sbiret sbi_send_ipi(const unsigned long hart_mask, unsigned long hart_mas
     return sbi_ecall(SBI_EXTID_IPI, SBI_SEND_IPI_FID, hart_mask, hart_mask_base, 0, 0, 0, 0);
 }
 
+struct sbiret sbi_system_reset_warm(void)
+{
+    if (sbi_probe_extension(SBI_EXTID_SRST).value == 0) {
+        return (struct sbiret){ .error = SBI_ERR_NOT_SUPPORTED };
+    }
+    return sbi_ecall(SBI_EXTID_SRST, SBI_SYSTEM_RESET_FID, SBI_RESET_TYPE_WARM_REBOOT, 0, 0, 0, 0,
+        0);
+}
+
 struct sbiret sbi_set_timer(uint64_t stime_value)
 {
     return sbi_ecall(SBI_EXTID_TIME, SBI_SET_TIMER_FID, stime_value, 0, 0, 0, 0, 0);
@@ -184,7 +246,12 @@ void sbi_msg_handler(uint32_t event, uint64_t data)
         case HART_START: {
             spin_lock(&cpu()->vcpu->arch.sbi_ctx.lock);
             if (cpu()->vcpu->arch.sbi_ctx.state == START_PENDING) {
-                vcpu_arch_reset(cpu()->vcpu, cpu()->vcpu->arch.sbi_ctx.start_addr);
+                if (cpu()->vcpu->arch.sbi_ctx.armed) {
+                    vcpu_writepc(cpu()->vcpu, cpu()->vcpu->arch.sbi_ctx.start_addr);
+                } else {
+                    vcpu_arch_reset(cpu()->vcpu, cpu()->vcpu->arch.sbi_ctx.start_addr);
+                }
+                cpu()->vcpu->arch.sbi_ctx.armed = false;
                 vcpu_writereg(cpu()->vcpu, REG_A1, cpu()->vcpu->arch.sbi_ctx.priv);
                 cpu()->vcpu->arch.sbi_ctx.state = STARTED;
             }
@@ -206,18 +273,52 @@ struct sbiret sbi_time_handler(unsigned long fid)
     if (CPU_HAS_EXTENSION(CPU_EXT_SSTC)) {
         CSRW(CSR_VSTIMECMP, stime_value);
     } else {
-        sbi_set_timer(stime_value); // assumes always success
+        /**
+         * The guest deadline is multiplexed on the hypervisor timer. Deadlines already in the past
+         * are injected right away without touching the hardware timer.
+         */
         CSRC(CSR_HVIP, HIP_VSTIP);
-        CSRS(sie, SIE_STIE);
+        if (stime_value <= timer_get()) {
+            timer_cancel(&cpu()->vcpu->arch.vstimer);
+            CSRS(CSR_HVIP, HIP_VSTIP);
+        } else {
+            timer_arm(&cpu()->vcpu->arch.vstimer, stime_value);
+        }
     }
 
     return (struct sbiret){ SBI_SUCCESS };
 }
 
-void sbi_timer_irq_handler()
+void sbi_vstimer_handler(struct timer_event* event)
 {
     CSRS(CSR_HVIP, HIP_VSTIP);
-    CSRC(sie, SIE_STIE);
+}
+
+/**
+ * The ipi is the vcpu's supervisor software interrupt, so there is a single one and ipi_id must be
+ * 0. A hart targeting itself sets it directly, all other targets are signaled by a single
+ * multicast message.
+ */
+bool vcpu_arch_send_ipi(struct vcpu* vcpu, cpumask_t pcpu_mask, unsigned long ipi_id)
+{
+    if (ipi_id != 0) {
+        return false;
+    }
+
+    if (cpumask_test(&pcpu_mask, cpu()->id)) {
+        cpumask_clear(&pcpu_mask, cpu()->id);
+        CSRS(CSR_HVIP, HIP_VSSIP);
+    }
+
+    if (!cpumask_empty(&pcpu_mask)) {
+        struct cpu_msg msg = {
+            .handler = SBI_MSG_ID,
+            .event = SEND_IPI,
+        };
+        cpu_send_urgent_msg_mask(&pcpu_mask, &msg);
+    }
+
+    return true;
 }
 
 struct sbiret sbi_ipi_handler(unsigned long fid)
@@ -229,21 +330,21 @@ struct sbiret sbi_ipi_handler(unsigned long fid)
     unsigned long hart_mask = vcpu_readreg(cpu()->vcpu, REG_A0);
     unsigned long hart_mask_base = vcpu_readreg(cpu()->vcpu, REG_A1);
 
-    struct cpu_msg msg = {
-        .handler = SBI_MSG_ID,
-        .event = SEND_IPI,
-    };
-
-    for (size_t i = 0; i < sizeof(hart_mask) * 8; i++) {
-        if (bit_get(hart_mask, i)) {
-            vcpuid_t vhart_id = hart_mask_base + i;
-            cpuid_t phart_id = vm_translate_to_pcpuid(cpu()->vcpu->vm, vhart_id);
-            if (phart_id != INVALID_CPUID) {
-                cpu_send_msg(phart_id, &msg);
-            }
-        }
+    /**
+     * Translate the whole virtual hart mask at once so that all targets are signaled by a single
+     * multicast IPI. A mask base of -1 targets all harts of the vm.
+     */
+    struct vm* vm = cpu()->vcpu->vm;
+    cpumask_t phart_mask = CPUMASK_EMPTY;
+    if (hart_mask_base == (unsigned long)-1) {
+        phart_mask = vm->cpus;
+    } else if (hart_mask_base < vm_cpu_num(vm)) {
+        cpumap_t vhart_mask = hart_mask << hart_mask_base;
+        phart_mask = vm_translate_to_pcpu_mask(vm, vhart_mask, vm_cpu_num(vm));
     }
 
+    vcpu_arch_send_ipi(cpu()->vcpu, phart_mask, 0);
+
     return (struct sbiret){ SBI_SUCCESS };
 }
 
@@ -254,7 +355,7 @@ struct sbiret sbi_base_handler(unsigned long fid)
 
     switch (fid) {
         case SBI_GET_SBI_SPEC_VERSION_FID:
-            ret.value = 2;
+            ret.value = SBI_SPEC_VERSION_2_0;
             break;
         case SBI_PROBE_EXTENSION_FID:
             ret.value = 0;
@@ -263,6 +364,10 @@ struct sbiret sbi_base_handler(unsigned long fid)
                     ret.value = extid;
                 }
             }
+            if ((extid == SBI_EXTID_SRST) || (extid == SBI_EXTID_STA) ||
+                ((extid == SBI_EXTID_DBCN) && sbi_dbcn)) {
+                ret.value = extid;
+            }
             break;
         default:
             break;
@@ -274,6 +379,147 @@ struct sbiret sbi_base_handler(unsigned long fid)
     return ret;
 }
 
+/**
+ * Guest remote fences are carried out by bao itself instead of the firmware. The current hart
+ * fences inline. For the other harts each request is merged into the target's pending fence, which
+ * only needs an ipi if none is already pending. The caller then waits for every target to catch up
+ * with its request, while serving its own messages so two harts fencing each other cannot
+ * deadlock.
+ */
+#define SBI_RFENCE_FLAG_I   (1UL << 0)
+#define SBI_RFENCE_FLAG_VMA (1UL << 1)
+#define SBI_RFENCE_ALL_ASID (-1UL)
+
+struct sbi_rfence {
+    unsigned long flags;
+    unsigned long start;
+    unsigned long end;
+    unsigned long asid;
+};
+
+static struct sbi_rfence_target {
+    spinlock_t lock;
+    struct sbi_rfence pending;
+    volatile size_t req;
+    volatile size_t done;
+} sbi_rfence_targets[PLAT_CPU_NUM];
+
+static void sbi_rfence_local(struct sbi_rfence* rfence)
+{
+    if (rfence->flags & (SBI_RFENCE_FLAG_I | SBI_RFENCE_FLAG_VMA)) {
+        vcpu_arch_ins_cache_inv(cpu()->vcpu);
+    }
+
+    if (rfence->flags & SBI_RFENCE_FLAG_I) {
+        fence_i();
+    }
+
+    if (rfence->flags & SBI_RFENCE_FLAG_VMA) {
+        size_t num_pages = NUM_PAGES(rfence->end - rfence->start);
+        bool all_addr = (rfence->end == (unsigned long)-1) || (num_pages > TLB_INV_RANGE_MAX_OPS);
+        bool all_asid = rfence->asid == SBI_RFENCE_ALL_ASID;
+
+        if (all_addr && all_asid) {
+            hfence_vvma_all();
+        } else if (all_addr) {
+            hfence_vvma_all_addr(rfence->asid);
+        } else {
+            for (unsigned long addr = rfence->start; addr < rfence->end; addr += PAGE_SIZE) {
+                if (all_asid) {
+                    hfence_vvma_all_asid(addr);
+                } else {
+                    hfence_vvma(addr, rfence->asid);
+                }
+            }
+        }
+    }
+}
+
+static void sbi_rfence_merge(struct sbi_rfence* pending, struct sbi_rfence* rfence)
+{
+    if (!(rfence->flags & SBI_RFENCE_FLAG_VMA)) {
+        pending->flags |= rfence->flags;
+    } else if (!(pending->flags & SBI_RFENCE_FLAG_VMA)) {
+        pending->flags |= rfence->flags;
+        pending->start = rfence->start;
+        pending->end = rfence->end;
+        pending->asid = rfence->asid;
+    } else {
+        pending->flags |= rfence->flags;
+        pending->start = min(pending->start, rfence->start);
+        pending->end = max(pending->end, rfence->end);
+        if (pending->asid != rfence->asid) {
+            pending->asid = SBI_RFENCE_ALL_ASID;
+        }
+    }
+}
+
+static void sbi_rfence_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(sbi_rfence_msg_handler, SBI_RFENCE_IPI_ID)
+
+static void sbi_rfence_msg_handler(uint32_t event, uint64_t data)
+{
+    struct sbi_rfence_target* target = &sbi_rfence_targets[cpu()->id];
+
+    spin_lock(&target->lock);
+    struct sbi_rfence rfence = target->pending;
+    size_t req = target->req;
+    target->pending.flags = 0;
+    spin_unlock(&target->lock);
+
+    sbi_rfence_local(&rfence);
+
+    fence_ord_write();
+    target->done = req;
+}
+
+static void sbi_rfence(const cpumask_t* phart_mask, struct sbi_rfence* rfence)
+{
+    size_t reqs[PLAT_CPU_NUM];
+    cpumask_t ipi_mask = CPUMASK_EMPTY;
+    cpumask_t wait_mask = CPUMASK_EMPTY;
+
+    /* Align the range to pages, a full fence is kept as such */
+    if (rfence->flags & SBI_RFENCE_FLAG_VMA) {
+        if (rfence->end <= rfence->start) {
+            rfence->start = 0;
+            rfence->end = (unsigned long)-1;
+        } else {
+            rfence->start = ALIGN_FLOOR(rfence->start, PAGE_SIZE);
+        }
+    }
+
+    for (cpuid_t i = 0; i < platform.cpu_num; i++) {
+        if (!cpumask_test(phart_mask, i)) {
+            continue;
+        } else if (i == cpu()->id) {
+            sbi_rfence_local(rfence);
+            continue;
+        }
+
+        struct sbi_rfence_target* target = &sbi_rfence_targets[i];
+        spin_lock(&target->lock);
+        if (target->pending.flags == 0) {
+            cpumask_set(&ipi_mask, i);
+        }
+        sbi_rfence_merge(&target->pending, rfence);
+        reqs[i] = ++target->req;
+        spin_unlock(&target->lock);
+        cpumask_set(&wait_mask, i);
+    }
+
+    if (!cpumask_empty(&ipi_mask)) {
+        struct cpu_msg msg = { (uint32_t)SBI_RFENCE_IPI_ID, 0, 0 };
+        cpu_send_msg_mask(&ipi_mask, &msg);
+    }
+
+    cpumask_foreach (&wait_mask, i) {
+        while ((ssize_t)(sbi_rfence_targets[i].done - reqs[i]) < 0) {
+            cpu_msg_handler();
+        }
+    }
+}
+
 struct sbiret sbi_rfence_handler(unsigned long fid)
 {
     struct sbiret ret;
@@ -293,23 +539,34 @@ struct sbiret sbi_rfence_handler(unsigned long fid)
 
     hart_mask = hart_mask << hart_mask_base;
 
-    unsigned long phart_mask =
+    cpumask_t phart_mask =
         vm_translate_to_pcpu_mask(cpu()->vcpu->vm, hart_mask, sizeof(hart_mask) * 8);
 
+    struct sbi_rfence rfence = { 0 };
+    bool full = (size == 0) || (size == (unsigned long)-1) || (start_addr + size < start_addr);
+
+    ret.error = SBI_SUCCESS;
+    ret.value = 0;
+
     switch (fid) {
         case SBI_REMOTE_FENCE_I_FID:
-            ret = sbi_remote_fence_i(phart_mask, 0);
+            rfence.flags = SBI_RFENCE_FLAG_I;
             break;
         case SBI_REMOTE_SFENCE_VMA_FID:
-            ret = sbi_remote_hfence_vvma(phart_mask, 0, start_addr, size);
-            break;
         case SBI_REMOTE_SFENCE_VMA_ASID_FID:
-            ret = sbi_remote_hfence_vvma_asid(phart_mask, 0, start_addr, size, asid);
+            rfence.flags = SBI_RFENCE_FLAG_VMA;
+            rfence.start = full ? 0 : start_addr;
+            rfence.end = full ? (unsigned long)-1 : start_addr + size;
+            rfence.asid = (fid == SBI_REMOTE_SFENCE_VMA_ASID_FID) ? asid : SBI_RFENCE_ALL_ASID;
             break;
         default:
             ret.error = SBI_ERR_NOT_SUPPORTED;
     }
 
+    if (ret.error == SBI_SUCCESS) {
+        sbi_rfence(&phart_mask, &rfence);
+    }
+
     return ret;
 }
 
@@ -389,6 +646,202 @@ struct sbiret sbi_hsm_handler(unsigned long fid)
     return ret;
 }
 
+/**
+ * A reboot only resets the calling vm, shutting it down is not supported as there would be nothing
+ * left to run on its cpus. On success bao restarts the vm and so the call never returns.
+ */
+struct sbiret sbi_srst_handler(unsigned long fid)
+{
+    struct sbiret ret = { .error = SBI_SUCCESS };
+    unsigned long reset_type = vcpu_readreg(cpu()->vcpu, REG_A0);
+    vmid_t vm_id = cpu()->vcpu->vm->id;
+
+    if (fid != SBI_SYSTEM_RESET_FID) {
+        ret.error = SBI_ERR_NOT_SUPPORTED;
+    } else if (reset_type == SBI_RESET_TYPE_SHUTDOWN) {
+        ret.error = SBI_ERR_NOT_SUPPORTED;
+    } else if ((reset_type != SBI_RESET_TYPE_COLD_REBOOT) &&
+        (reset_type != SBI_RESET_TYPE_WARM_REBOOT)) {
+        ret.error = SBI_ERR_INVALID_PARAM;
+    } else if (!vm_reset(vm_id)) {
+        WARNING("VM %d can not be reset without a pristine image copy", vm_id);
+        ret.error = SBI_ERR_FAILURE;
+    }
+
+    return ret;
+}
+
+static void sbi_sta_unmap(struct vcpu* vcpu)
+{
+    vcpu->steal.record = NULL;
+    if (vcpu->arch.sta_page != (vaddr_t)NULL) {
+        mem_unmap(&cpu()->as, vcpu->arch.sta_page, 1, false);
+        vcpu->arch.sta_page = (vaddr_t)NULL;
+    }
+}
+
+void sbi_sta_reset(struct vcpu* vcpu)
+{
+    sbi_sta_unmap(vcpu);
+    vcpu->arch.sta_ipa = INVALID_VA;
+}
+
+/* The page must be of the vm's own memory regions, e.g., not one borrowed from another vm */
+static bool sbi_sta_vm_owns(struct vm* vm, vaddr_t page_ipa)
+{
+    for (size_t i = 0; i < vm->config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        if (range_in_range(page_ipa, PAGE_SIZE, reg->base, reg->size)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The shared memory is mapped in the hypervisor for the steal to be updated on every exit, so it
+ * must be a page the guest owns and can write itself, found through its stage 2. Returns the sbi
+ * error, leaving the vcpu without a record on failure.
+ */
+static long sbi_sta_map(struct vcpu* vcpu, vaddr_t ipa)
+{
+    vaddr_t page_ipa = ipa & ~(PAGE_SIZE - 1);
+    paddr_t pa = 0;
+    vm_mem_populate(vcpu->vm, page_ipa);
+    if (!sbi_sta_vm_owns(vcpu->vm, page_ipa) ||
+        !mem_translate_writable(&vcpu->vm->as, page_ipa, &pa) || !platform_is_mem(pa)) {
+        return SBI_ERR_INVALID_ADDRESS;
+    }
+
+    struct ppages ppages = mem_ppages_get(pa, 1);
+    vaddr_t va = mem_alloc_map(&cpu()->as, SEC_HYP_PRIVATE, &ppages, INVALID_VA, 1, PTE_HYP_FLAGS);
+    if (va == INVALID_VA) {
+        return SBI_ERR_FAILURE;
+    }
+
+    vcpu->arch.sta_page = va;
+    vcpu->arch.sta_ipa = ipa;
+    vcpu->steal.record = (struct sbi_sta_shmem*)(va + (ipa - page_ipa));
+    return SBI_SUCCESS;
+}
+
+/* The shared memory is mapped again from its guest address, its content left as it was */
+void vcpu_arch_hyp_maps_release(struct vcpu* vcpu)
+{
+    sbi_sta_unmap(vcpu);
+}
+
+void vcpu_arch_hyp_maps_restore(struct vcpu* vcpu)
+{
+    if ((vcpu->arch.sta_ipa != INVALID_VA) &&
+        (sbi_sta_map(vcpu, vcpu->arch.sta_ipa) != SBI_SUCCESS)) {
+        vcpu->arch.sta_ipa = INVALID_VA;
+    }
+}
+
+/* Only the lower half of the address is used, as guests are always rv64. */
+static struct sbiret sbi_sta_set_shmem(unsigned long lo, unsigned long hi, unsigned long flags)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    if (flags != 0) {
+        return (struct sbiret){ .error = SBI_ERR_INVALID_PARAM };
+    }
+
+    sbi_sta_reset(vcpu);
+    if ((lo == ~0UL) && (hi == ~0UL)) {
+        return (struct sbiret){ .error = SBI_SUCCESS };
+    }
+
+    if ((lo % sizeof(struct sbi_sta_shmem)) != 0) {
+        return (struct sbiret){ .error = SBI_ERR_INVALID_PARAM };
+    }
+
+    if (hi != 0) {
+        return (struct sbiret){ .error = SBI_ERR_INVALID_ADDRESS };
+    }
+
+    long err = sbi_sta_map(vcpu, lo);
+    if (err != SBI_SUCCESS) {
+        return (struct sbiret){ .error = err };
+    }
+
+    memset(vcpu->steal.record, 0, sizeof(struct sbi_sta_shmem));
+    vcpu_arch_steal_update(vcpu, timer_ticks_to_ns(vcpu->steal.ticks));
+
+    return (struct sbiret){ .error = SBI_SUCCESS };
+}
+
+struct sbiret sbi_sta_handler(unsigned long fid)
+{
+    if (fid != SBI_STEAL_TIME_SET_SHMEM_FID) {
+        return (struct sbiret){ .error = SBI_ERR_NOT_SUPPORTED };
+    }
+
+    return sbi_sta_set_shmem(vcpu_readreg(cpu()->vcpu, REG_A0),
+        vcpu_readreg(cpu()->vcpu, REG_A1), vcpu_readreg(cpu()->vcpu, REG_A2));
+}
+
+/**
+ * The guest's writes are forwarded to the firmware's debug console a page at a time, the buffer
+ * only being contiguous in the guest's physical address space. Console input is not shared with
+ * the guests, so reads are denied.
+ */
+static struct sbiret sbi_dbcn_write(unsigned long num, unsigned long lo, unsigned long hi)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    size_t done = 0;
+
+    if (hi != 0) {
+        return (struct sbiret){ .error = SBI_ERR_INVALID_PARAM };
+    }
+
+    while (done < num) {
+        vaddr_t ipa = lo + done;
+        size_t len = min(num - done, PAGE_SIZE - (ipa & PAGE_OFFSET_MASK));
+        paddr_t pa = 0;
+        vm_mem_populate(vcpu->vm, ipa & ~(PAGE_SIZE - 1));
+        if (!mem_translate(&vcpu->vm->as, ipa, &pa) || !platform_is_mem(pa)) {
+            return (struct sbiret){ .error = SBI_ERR_INVALID_PARAM, .value = (long)done };
+        }
+
+        struct sbiret ret = sbi_ecall(SBI_EXTID_DBCN, SBI_DBCN_WRITE_FID, (long)len, (long)pa, 0,
+            0, 0, 0);
+        if (ret.error != SBI_SUCCESS) {
+            ret.value = (long)done;
+            return ret;
+        }
+        done += (size_t)ret.value;
+        if ((size_t)ret.value < len) {
+            break;
+        }
+    }
+
+    return (struct sbiret){ .error = SBI_SUCCESS, .value = (long)done };
+}
+
+struct sbiret sbi_dbcn_handler(unsigned long fid)
+{
+    unsigned long a0 = vcpu_readreg(cpu()->vcpu, REG_A0);
+
+    if (!sbi_dbcn) {
+        return (struct sbiret){ .error = SBI_ERR_NOT_SUPPORTED };
+    }
+
+    switch (fid) {
+        case SBI_DBCN_WRITE_FID:
+            return sbi_dbcn_write(a0, vcpu_readreg(cpu()->vcpu, REG_A1),
+                vcpu_readreg(cpu()->vcpu, REG_A2));
+        case SBI_DBCN_WRITE_BYTE_FID:
+            return sbi_ecall(SBI_EXTID_DBCN, SBI_DBCN_WRITE_BYTE_FID, (long)(a0 & 0xff), 0, 0, 0,
+                0, 0);
+        case SBI_DBCN_READ_FID:
+            return (struct sbiret){ .error = SBI_ERR_DENIED };
+        default:
+            return (struct sbiret){ .error = SBI_ERR_NOT_SUPPORTED };
+    }
+}
+
 struct sbiret sbi_bao_handler(unsigned long fid)
 {
     struct sbiret ret;
@@ -420,6 +873,15 @@ size_t sbi_vs_handler()
         case SBI_EXTID_HSM:
             ret = sbi_hsm_handler(fid);
             break;
+        case SBI_EXTID_SRST:
+            ret = sbi_srst_handler(fid);
+            break;
+        case SBI_EXTID_STA:
+            ret = sbi_sta_handler(fid);
+            break;
+        case SBI_EXTID_DBCN:
+            ret = sbi_dbcn_handler(fid);
+            break;
         case SBI_EXTID_BAO:
             ret = sbi_bao_handler(fid);
             break;
@@ -451,7 +913,6 @@ void sbi_init()
         }
     }
 
-    if (!interrupts_reserve(TIMR_INT_ID, sbi_timer_irq_handler)) {
-        ERROR("Failed to reserve SBI TIMR_INT_ID interrupt");
-    }
+    ret = sbi_probe_extension(SBI_EXTID_DBCN);
+    sbi_dbcn = (ret.error == SBI_SUCCESS) && (ret.value != 0);
 }
@@ -0,0 +1,37 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <string.h>
+#include <platform.h>
+#include <arch/cpu.h>
+
+/**
+ * Platforms whose harts implement the vector extension (CPU_EXT_V) copy and fill with vector
+ * loads and stores, but for sizes below this, for which the word loops are as fast.
+ */
+#ifndef STRING_VEC_MIN
+#define STRING_VEC_MIN (128)
+#endif
+
+void* memcpy_vec(void* dst, const void* src, size_t count);
+void* memset_vec(void* dest, int c, size_t count);
+
+void* memcpy(void* dst, const void* src, size_t count)
+{
+    if (CPU_HAS_EXTENSION(CPU_EXT_V) && (count >= STRING_VEC_MIN)) {
+        return memcpy_vec(dst, src, count);
+    }
+
+    return memcpy_words(dst, src, count);
+}
+
+void* memset(void* dest, int c, size_t count)
+{
+    if (CPU_HAS_EXTENSION(CPU_EXT_V) && (count >= STRING_VEC_MIN)) {
+        return memset_vec(dest, c, count);
+    }
+
+    return memset_words(dest, c, count);
+}
@@ -6,11 +6,12 @@
 #include <bao.h>
 #include <cpu.h>
 #include <vm.h>
+#include <trace.h>
 #include <arch/encoding.h>
 #include <arch/csrs.h>
 #include <arch/instructions.h>
 
-void internal_exception_handler(unsigned long gprs[])
+__cold void internal_exception_handler(unsigned long gprs[])
 {
     for (int i = 0; i < 31; i++) {
         console_printk("x%d:\t\t0x%0lx\n", i, gprs[i]);
@@ -73,6 +74,43 @@ static inline bool ins_ldst_decode(vaddr_t ins, struct emul_access* emul)
     return true;
 }
 
+static inline struct vcpu_ins_cache_entry* ins_cache_entry(struct vcpu* vcpu, vaddr_t pc)
+{
+    return &vcpu->arch.ins_cache[(pc >> 1) % VCPU_INS_CACHE_SIZE];
+}
+
+/**
+ * Decodes the load or store at pc, reading it from guest memory only if it is not cached.
+ * Returns the instruction's size.
+ */
+static size_t ins_cached_decode(struct vcpu* vcpu, vaddr_t pc, struct emul_access* emul)
+{
+    struct vcpu_ins_cache_entry* entry = ins_cache_entry(vcpu, pc);
+    unsigned long vsatp = CSRR(CSR_VSATP);
+
+    if ((entry->ins_size == 0) || (entry->pc != pc) || (entry->vsatp != vsatp)) {
+        uint32_t ins = read_ins(pc);
+        if (!ins_ldst_decode(ins, emul)) {
+            ERROR("cant decode ld/st instruction");
+        }
+        *entry = (struct vcpu_ins_cache_entry){ .pc = pc,
+            .vsatp = vsatp,
+            .ins_size = (uint8_t)INS_SIZE(ins),
+            .width = (uint8_t)emul->width,
+            .reg = (uint8_t)emul->reg,
+            .write = emul->write,
+            .sign_ext = emul->sign_ext };
+    } else {
+        emul->width = entry->width;
+        emul->reg_width = REGLEN;
+        emul->write = entry->write;
+        emul->reg = entry->reg;
+        emul->sign_ext = entry->sign_ext;
+    }
+
+    return entry->ins_size;
+}
+
 static inline bool is_pseudo_ins(uint32_t ins)
 {
     return ins == TINST_PSEUDO_STORE || ins == TINST_PSEUDO_LOAD;
@@ -82,18 +120,37 @@ size_t guest_page_fault_handler()
 {
     vaddr_t addr = CSRR(CSR_HTVAL) << 2;
 
+    /**
+     * Doorbell stores are done with as soon as they are recognized, whatever the stored value, if
+     * htinst gives the size of the instruction to step over.
+     */
+    if (CSRR(scause) == SCAUSE_CODE_SGPF) {
+        unsigned long tinst = CSRR(CSR_HTINST);
+        if ((tinst != 0) && !is_pseudo_ins(tinst) && ipc_doorbell_write(cpu()->vcpu, addr)) {
+            return TINST_INS_SIZE(tinst);
+        }
+    }
+
+    /**
+     * The faulting access is retried once the lazily mapped chunk holding it is populated, or once
+     * the page it writes, write protected for dirty logging, is marked dirty.
+     */
+    if (vm_mem_populate(cpu()->vcpu->vm, addr) ||
+        ((CSRR(scause) == SCAUSE_CODE_SGPF) && vm_mem_dirty_fault(cpu()->vcpu->vm, addr))) {
+        return 0;
+    }
+
     emul_handler_t handler = vm_emul_get_mem(cpu()->vcpu->vm, addr);
     if (handler != NULL) {
         unsigned long ins = CSRR(CSR_HTINST);
         size_t ins_size;
+        struct emul_access emul;
         if (ins == 0) {
             /**
              * If htinst does not provide information about the trap, we must read the instruction
-             * from the guest's memory manually.
+             * from the guest's memory manually, unless it was already decoded.
              */
-            vaddr_t ins_addr = CSRR(sepc);
-            ins = read_ins(ins_addr);
-            ins_size = INS_SIZE(ins);
+            ins_size = ins_cached_decode(cpu()->vcpu, CSRR(sepc), &emul);
         } else if (is_pseudo_ins(ins)) {
             // TODO: we should reinject this in the guest as a fault access
             ERROR("fault on 1st stage page table walk");
@@ -104,11 +161,9 @@ size_t guest_page_fault_handler()
              */
             ins_size = TINST_INS_SIZE(ins);
             ins = ins | 0b10;
-        }
-
-        struct emul_access emul;
-        if (!ins_ldst_decode(ins, &emul)) {
-            ERROR("cant decode ld/st instruction");
+            if (!ins_ldst_decode(ins, &emul)) {
+                ERROR("cant decode ld/st instruction");
+            }
         }
         emul.addr = addr;
 
@@ -126,15 +181,41 @@ size_t guest_page_fault_handler()
     }
 }
 
+size_t guest_inst_page_fault_handler()
+{
+    vaddr_t addr = CSRR(CSR_HTVAL) << 2;
+
+    if (!vm_mem_populate(cpu()->vcpu->vm, addr)) {
+        ERROR("unhandled instruction guest page fault (0x%lx at 0x%lx)", addr, CSRR(sepc));
+    }
+
+    return 0;
+}
+
+size_t virtual_instruction_handler()
+{
+    /* Only wfi is trapped, through hstatus.VTW, and its encoding is reported in stval. */
+    if (CSRR(stval) != MATCH_WFI) {
+        ERROR("unexpected virtual instruction exception (0x%lx at 0x%lx)", CSRR(stval), CSRR(sepc));
+    }
+
+    cpu_standby();
+
+    return 4;
+}
+
 sync_handler_t sync_handler_table[] = {
+    [SCAUSE_CODE_ILI] = fp_trap_handler,
     [SCAUSE_CODE_ECV] = sbi_vs_handler,
+    [SCAUSE_CODE_IGPF] = guest_inst_page_fault_handler,
     [SCAUSE_CODE_LGPF] = guest_page_fault_handler,
     [SCAUSE_CODE_SGPF] = guest_page_fault_handler,
+    [SCAUSE_CODE_VRTI] = virtual_instruction_handler,
 };
 
 static const size_t sync_handler_table_size = sizeof(sync_handler_table) / sizeof(sync_handler_t);
 
-void sync_exception_handler()
+__hot void sync_exception_handler()
 {
     size_t pc_step = 0;
     unsigned long _scause = CSRR(scause);
@@ -145,6 +226,18 @@ void sync_exception_handler()
 
     // TODO: Do we need to check call comes from VS-mode and not VU-mode or U-mode ?
 
+    uint64_t trace_start = trace_exit_begin();
+    struct vcpu_exit_stamp exit_stamp = vcpu_exit_begin();
+    uint64_t trace_info = 0;
+    if (DEFINED(TRACE)) {
+        if (_scause == SCAUSE_CODE_ECV) {
+            trace_info = ((uint64_t)vcpu_readreg(cpu()->vcpu, REG_A7) << 32) |
+                (uint32_t)vcpu_readreg(cpu()->vcpu, REG_A6);
+        } else {
+            trace_info = CSRR(stval);
+        }
+    }
+
     if (_scause < sync_handler_table_size && sync_handler_table[_scause]) {
         pc_step = sync_handler_table[_scause]();
     } else {
@@ -152,4 +245,10 @@ void sync_exception_handler()
     }
 
     cpu()->vcpu->regs.sepc += pc_step;
+
+    vcpu_exit_end(exit_stamp);
+    stats_exit_sync(_scause);
+    trace_exit_end(TRACE_EXIT_SYNC, _scause, trace_info, trace_start);
+
+    vcpu_check_restart();
 }
@@ -0,0 +1,28 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <timer.h>
+#include <arch/sbi.h>
+#include <cpu.h>
+
+void timer_arch_init(void)
+{
+    CSRC(sie, SIE_STIE);
+}
+
+void timer_arch_program(uint64_t deadline)
+{
+    if (CPU_HAS_EXTENSION(CPU_EXT_SSTC)) {
+        CSRW(CSR_STIMECMP, deadline);
+    } else {
+        sbi_set_timer(deadline);
+    }
+    CSRS(sie, SIE_STIE);
+}
+
+void timer_arch_disable(void)
+{
+    CSRC(sie, SIE_STIE);
+}
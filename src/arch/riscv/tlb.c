@@ -0,0 +1,55 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/tlb.h>
+#include <arch/instructions.h>
+#include <cpu.h>
+
+/**
+ * The invalidations of a range are not ordered among themselves, so the hart only serializes once
+ * for the whole range: sfence.w.inval orders the page table updates before them and
+ * sfence.inval.ir orders them before the translations that follow.
+ */
+
+static inline unsigned long tlb_remote_harts(void)
+{
+    return ((1UL << platform.cpu_num) - 1) & ~(1UL << cpu()->id);
+}
+
+void tlb_svinval_hyp(vaddr_t va, size_t size)
+{
+    if (size == 0) {
+        sfence_vma_all();
+    } else {
+        sfence_w_inval();
+        for (vaddr_t addr = va; addr < (va + size); addr += PAGE_SIZE) {
+            sinval_vma_all_asid(addr);
+        }
+        sfence_inval_ir();
+    }
+
+    unsigned long harts = tlb_remote_harts();
+    if (harts != 0) {
+        sbi_remote_sfence_vma(harts, 0, (unsigned long)va, size);
+    }
+}
+
+void tlb_svinval_vm(asid_t vmid, vaddr_t va, size_t size)
+{
+    if (size == 0) {
+        hfence_gvma_all_addr(vmid);
+    } else {
+        sfence_w_inval();
+        for (vaddr_t addr = va; addr < (va + size); addr += PAGE_SIZE) {
+            hinval_gvma(addr, vmid);
+        }
+        sfence_inval_ir();
+    }
+
+    unsigned long harts = tlb_remote_harts();
+    if (harts != 0) {
+        sbi_remote_hfence_gvma_vmid(harts, 0, (unsigned long)va, size, vmid);
+    }
+}
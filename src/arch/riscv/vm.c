@@ -10,6 +10,15 @@
 #include <arch/instructions.h>
 #include <string.h>
 #include <config.h>
+#include <arch/qos.h>
+
+/* There is no G-stage translation format smaller than the default one */
+struct page_table_dscr* vm_arch_pt_dscr(const struct vm_config* config, vaddr_t ipa_top)
+{
+    (void)config;
+    (void)ipa_top;
+    return vm_pt_dscr;
+}
 
 void vm_arch_init(struct vm* vm, const struct vm_config* config)
 {
@@ -28,24 +37,209 @@ void vcpu_arch_init(struct vcpu* vcpu, struct vm* vm)
 {
     vcpu->arch.sbi_ctx.lock = SPINLOCK_INITVAL;
     vcpu->arch.sbi_ctx.state = vcpu->id == 0 ? STARTED : STOPPED;
+    vcpu->arch.vstimer.handler = sbi_vstimer_handler;
+    vcpu->arch.vstimer.deferrable = false;
+    vcpu->arch.sta_page = (vaddr_t)NULL;
+    vcpu->arch.sta_ipa = INVALID_VA;
+
+    qos_vcpu_init(vcpu, vm);
+    fp_vcpu_init(vcpu);
+}
+
+void vm_arch_reset(struct vm* vm)
+{
+    virqc_reset(vm);
+}
+
+/**
+ * Only the first hart restarts, the others are left stopped for the guest to start through the
+ * hsm extension. The reinstalled image must not be fetched from stale instruction cache lines.
+ */
+void vcpu_arch_vm_reset(struct vcpu* vcpu)
+{
+    spin_lock(&vcpu->arch.sbi_ctx.lock);
+    vcpu->arch.sbi_ctx.state = vcpu->id == 0 ? STARTED : STOPPED;
+    spin_unlock(&vcpu->arch.sbi_ctx.lock);
+
+    fence_i();
+}
+
+/* The vs-level interrupts are disabled and the guest's timer stopped, none waking the idle hart */
+void vcpu_arch_stop(struct vcpu* vcpu)
+{
+    CSRW(CSR_HIE, 0);
+    CSRW(CSR_HVIP, 0);
+    if (CPU_HAS_EXTENSION(CPU_EXT_SSTC)) {
+        CSRW(CSR_VSTIMECMP, -1);
+    } else {
+        timer_cancel(&vcpu->arch.vstimer);
+    }
+}
+
+bool vm_arch_snapshot_init(struct vm* vm, struct vm_arch_snapshot* snap)
+{
+    (void)vm;
+    (void)snap;
+    return true;
+}
+
+/* The virtual interrupt controller's snapshot holds all of its state itself */
+size_t vm_arch_snapshot_data_size(struct vm* vm)
+{
+    (void)vm;
+    return 0;
+}
+
+bool vm_arch_snapshot_place(struct vm* vm, struct vm_arch_snapshot* snap, void* data)
+{
+    (void)vm;
+    (void)snap;
+    (void)data;
+    return true;
+}
+
+void vm_arch_snapshot_save(struct vm* vm, struct vm_arch_snapshot* snap)
+{
+    virqc_snapshot_save(vm, &snap->virqc);
+}
+
+void vm_arch_snapshot_restore(struct vm* vm, const struct vm_arch_snapshot* snap)
+{
+    virqc_snapshot_restore(vm, &snap->virqc);
+}
+
+void vcpu_arch_snapshot_save(struct vcpu* vcpu, struct vcpu_arch_snapshot* snap)
+{
+    spin_lock(&vcpu->arch.sbi_ctx.lock);
+    snap->sbi_ctx = vcpu->arch.sbi_ctx;
+    spin_unlock(&vcpu->arch.sbi_ctx.lock);
+
+    snap->vsstatus = CSRR(CSR_VSSTATUS);
+    snap->hie = CSRR(CSR_HIE);
+    snap->hvip = CSRR(CSR_HVIP);
+    snap->vstvec = CSRR(CSR_VSTVEC);
+    snap->vsscratch = CSRR(CSR_VSSCRATCH);
+    snap->vsepc = CSRR(CSR_VSEPC);
+    snap->vscause = CSRR(CSR_VSCAUSE);
+    snap->vstval = CSRR(CSR_VSTVAL);
+    snap->vsatp = CSRR(CSR_VSATP);
+    if (CPU_HAS_EXTENSION(CPU_EXT_SSTC)) {
+        snap->vstimecmp = CSRR(CSR_VSTIMECMP);
+        snap->vstimer_armed = false;
+    } else {
+        snap->vstimecmp = vcpu->arch.vstimer.deadline;
+        snap->vstimer_armed = timer_is_armed(&vcpu->arch.vstimer);
+    }
+
+    if ((cpu()->arch.fp_owner == vcpu) &&
+        ((vcpu->regs.sstatus & SSTATUS_FS_MSK) == SSTATUS_FS_DIRTY)) {
+        CSRS(sstatus, SSTATUS_FS_CLEAN);
+        fp_ctx_save(&vcpu->arch.fp);
+    }
+    snap->fp = vcpu->arch.fp;
+}
+
+/**
+ * The external interrupt line is left to the virtual irqc, restored beforehand. As time is not
+ * rolled back, timer deadlines that passed since the snapshot expire right away. The vcpu gives up
+ * the fp registers, so its restored state is loaded on its next fp access, and neither the
+ * instruction cache nor the guest's VS-stage translations may be kept from before the restore.
+ */
+void vcpu_arch_snapshot_restore(struct vcpu* vcpu, const struct vcpu_arch_snapshot* snap)
+{
+    spin_lock(&vcpu->arch.sbi_ctx.lock);
+    vcpu->arch.sbi_ctx.state = snap->sbi_ctx.state;
+    vcpu->arch.sbi_ctx.start_addr = snap->sbi_ctx.start_addr;
+    vcpu->arch.sbi_ctx.priv = snap->sbi_ctx.priv;
+    vcpu->arch.sbi_ctx.armed = false;
+    spin_unlock(&vcpu->arch.sbi_ctx.lock);
+
+    CSRW(CSR_VSSTATUS, snap->vsstatus);
+    CSRW(CSR_HIE, snap->hie);
+    CSRW(CSR_HVIP, (CSRR(CSR_HVIP) & HIP_VSEIP) | (snap->hvip & ~HIP_VSEIP));
+    CSRW(CSR_VSTVEC, snap->vstvec);
+    CSRW(CSR_VSSCRATCH, snap->vsscratch);
+    CSRW(CSR_VSEPC, snap->vsepc);
+    CSRW(CSR_VSCAUSE, snap->vscause);
+    CSRW(CSR_VSTVAL, snap->vstval);
+    CSRW(CSR_VSATP, snap->vsatp);
+    hfence_vvma_all();
+    if (CPU_HAS_EXTENSION(CPU_EXT_SSTC)) {
+        CSRW(CSR_VSTIMECMP, snap->vstimecmp);
+    } else if (snap->vstimer_armed) {
+        timer_arm(&vcpu->arch.vstimer, snap->vstimecmp);
+    } else {
+        timer_cancel(&vcpu->arch.vstimer);
+    }
+
+    vcpu->arch.fp = snap->fp;
+    if (cpu()->arch.fp_owner == vcpu) {
+        cpu()->arch.fp_owner = NULL;
+    }
+
+    vcpu_arch_ins_cache_inv(vcpu);
+    fence_i();
+}
+
+/**
+ * Local fence.i and sfence.vma do not trap, so the remote fences the guest requests through sbi
+ * and resets are the only points at which its code or its translations are known to change.
+ */
+void vcpu_arch_ins_cache_inv(struct vcpu* vcpu)
+{
+    memset(vcpu->arch.ins_cache, 0, sizeof(vcpu->arch.ins_cache));
+}
+
+/**
+ * The sequence is odd while the steal is being written, so the guest retries reads that overlap
+ * it.
+ */
+void vcpu_arch_steal_update(struct vcpu* vcpu, uint64_t steal_ns)
+{
+    struct sbi_sta_shmem* shmem = vcpu->steal.record;
+
+    shmem->sequence++;
+    fence_ord_write();
+    shmem->steal = steal_ns;
+    fence_ord_write();
+    shmem->sequence++;
+}
+
+bool vcpu_arch_irq_pending(struct vcpu* vcpu)
+{
+    return (CSRR(CSR_HIP) & CSRR(CSR_HIE) & (HIP_VSSIP | HIP_VSTIP | HIP_VSEIP)) != 0;
 }
 
 void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry)
 {
     memset(&vcpu->regs, 0, sizeof(struct arch_regs));
+    vcpu_arch_ins_cache_inv(vcpu);
+    sbi_sta_reset(vcpu);
 
     CSRW(sscratch, &vcpu->regs);
 
     vcpu->regs.hstatus = HSTATUS_SPV | HSTATUS_VSXL_64;
+    if (vcpu->vm->config->trap_wfi) {
+        vcpu->regs.hstatus |= HSTATUS_VTW;
+    }
     vcpu->regs.sstatus = SSTATUS_SPP_BIT | SSTATUS_FS_DIRTY | SSTATUS_XS_DIRTY;
     vcpu->regs.sepc = entry;
     vcpu->regs.a0 = vcpu->arch.hart_id = vcpu->id;
     vcpu->regs.a1 = 0; // according to sbi it should be the dtb load address
+    vcpu->arch.sbi_ctx.armed = vcpu->vm->config->fast_start;
 
     if (CPU_HAS_EXTENSION(CPU_EXT_SSTC)) {
         CSRW(CSR_VSTIMECMP, -1);
+    } else {
+        timer_cancel(&vcpu->arch.vstimer);
     }
-    CSRW(CSR_HCOUNTEREN, HCOUNTEREN_TM);
+    /**
+     * The cycle and instret counters are handed to the guest, as the hart only ever runs this vcpu.
+     * They keep counting while in HS-mode, since without Smcntrpmf there is no way to inhibit
+     * counting per privilege mode. The hpm counters stay hidden as there is no sbi pmu extension
+     * to program their events.
+     */
+    CSRW(CSR_HCOUNTEREN, HCOUNTEREN_TM | HCOUNTEREN_CY | HCOUNTEREN_IR);
     CSRW(CSR_HTIMEDELTA, 0);
     CSRW(CSR_VSSTATUS, SSTATUS_SD | SSTATUS_FS_DIRTY | SSTATUS_XS_DIRTY);
     CSRW(CSR_HIE, 0);
@@ -56,6 +250,8 @@ void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry)
     CSRW(CSR_VSTVAL, 0);
     CSRW(CSR_HVIP, 0);
     CSRW(CSR_VSATP, 0);
+    /* The external interrupt may have been left masked for a directly owned plic context */
+    CSRS(sie, SIE_SEIE);
 }
 
 unsigned long vcpu_readreg(struct vcpu* vcpu, unsigned long reg)
@@ -86,7 +282,12 @@ void vcpu_writepc(struct vcpu* vcpu, unsigned long pc)
 
 void vcpu_arch_run(struct vcpu* vcpu)
 {
+    if (CPU_HAS_EXTENSION(CPU_EXT_SSQOSID)) {
+        CSRW(CSR_SRMCFG, vcpu->arch.srmcfg);
+    }
+
     if (vcpu->arch.sbi_ctx.state == STARTED) {
+        fp_vcpu_run(vcpu);
         vcpu_arch_entry();
     } else {
         cpu_idle();
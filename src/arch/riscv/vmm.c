@@ -5,6 +5,7 @@
 
 #include <vmm.h>
 #include <arch/csrs.h>
+#include <arch/qos.h>
 
 void vmm_arch_init()
 {
@@ -39,6 +40,21 @@ void vmm_arch_init()
         CSRC(CSR_HENVCFG, HENVCFG_STCE);
     }
 
+    /* Let the G-stage memory types of non cacheable vm memory take effect */
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVPBMT)) {
+        CSRS(CSR_HENVCFG, HENVCFG_PBMTE);
+    }
+
+    /**
+     * Have the hardware set the dirty bit of the g-stage entries dirty logging protects, instead of
+     * faulting. It also updates the guest's own, vs-stage, accessed and dirty bits, as Svadu does.
+     */
+    if (CPU_HAS_EXTENSION(CPU_EXT_SVADU)) {
+        CSRS(CSR_HENVCFG, HENVCFG_ADUE);
+    }
+
+    qos_init();
+
     /**
      * TODO: consider delegating other exceptions e.g. breakpoint or ins misaligned
      */
@@ -0,0 +1,69 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <boot_timing.h>
+#include <cpu.h>
+#include <timer.h>
+#include <platform_defs.h>
+
+/**
+ * Kept per cpu and only written by the cpu it belongs to. When the hypervisor colors itself, wait
+ * time accounted while the image is being copied might not make it to the colored copy.
+ */
+static struct boot_timing_cpu {
+    bool running;
+    uint64_t start;
+    uint64_t phases[BOOT_PHASE_NUM];
+} boot_timing_cpus[PLAT_CPU_NUM];
+
+static inline unsigned long boot_timing_us(uint64_t ticks)
+{
+    return (unsigned long)((ticks * 1000000) / timer_arch_get_freq());
+}
+
+void boot_timing_init(void)
+{
+    struct boot_timing_cpu* timing = &boot_timing_cpus[cpu()->id];
+
+    timing->start = timer_get();
+    for (size_t i = 0; i < BOOT_PHASE_NUM; i++) {
+        timing->phases[i] = 0;
+    }
+    timing->running = true;
+}
+
+uint64_t boot_timing_begin(void)
+{
+    return timer_get();
+}
+
+void boot_timing_end(enum boot_phase phase, uint64_t begin)
+{
+    struct boot_timing_cpu* timing = &boot_timing_cpus[cpu()->id];
+
+    if (timing->running) {
+        timing->phases[phase] += timer_get() - begin;
+    }
+}
+
+void boot_timing_report(void)
+{
+    struct boot_timing_cpu* timing = &boot_timing_cpus[cpu()->id];
+    uint64_t now = timer_get();
+
+    if (!timing->running) {
+        return;
+    }
+    timing->running = false;
+
+    INFO("cpu %d boot done at %lu us, took %lu us: page pools %lu, coloring %lu, "
+         "vm page tables %lu, image install %lu, barriers %lu",
+        cpu()->id, boot_timing_us(now), boot_timing_us(now - timing->start),
+        boot_timing_us(timing->phases[BOOT_PHASE_PAGE_POOLS]),
+        boot_timing_us(timing->phases[BOOT_PHASE_COLORING]),
+        boot_timing_us(timing->phases[BOOT_PHASE_VM_PAGE_TABLES]),
+        boot_timing_us(timing->phases[BOOT_PHASE_IMAGE_INSTALL]),
+        boot_timing_us(timing->phases[BOOT_PHASE_BARRIERS]));
+}
@@ -4,14 +4,25 @@
  */
 
 #include <cache.h>
-
-static struct cache cache_dscr;
+#include <cpu.h>
+#include <platform.h>
 
 size_t COLOR_NUM = 1;
 size_t COLOR_SIZE = 1;
 
-static void cache_calc_colors(struct cache* dscrp, size_t page_size)
+size_t COLOR_BANK_NUM = 1;
+size_t COLOR_BANK_SIZE = 1;
+size_t COLOR_BANK_BITS = 0;
+paddr_t COLOR_BANK_MASKS[COLOR_BANK_BITS_MAX];
+
+struct cache_color_domain cache_color_domains[PLAT_CPU_NUM];
+
+static void cache_calc_colors(struct cache* dscrp, size_t page_size,
+    struct cache_color_domain* domain)
 {
+    domain->num = 1;
+    domain->size = 1;
+
     if (dscrp->lvls == 0) {
         /* No cache? */
         return;
@@ -38,12 +49,64 @@ static void cache_calc_colors(struct cache* dscrp, size_t page_size)
     size_t llc_num_colors = llc_way_size / page_size;
     size_t flc_num_colors = flc_way_size / page_size;
 
-    COLOR_SIZE = flc_num_colors;
-    COLOR_NUM = llc_num_colors / COLOR_SIZE;
+    domain->size = flc_num_colors;
+    domain->num = llc_num_colors / domain->size;
+}
+
+/**
+ * Banks can only be colored at page granularity and must fit in their half of the colormap, next
+ * to every cache color.
+ */
+static void cache_calc_banks(void)
+{
+    size_t bits = platform.dram.bank_bit_num;
+    paddr_t all = 0;
+
+    if (bits == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < min(bits, (size_t)COLOR_BANK_BITS_MAX); i++) {
+        all |= platform.dram.bank_masks[i];
+    }
+
+    if ((bits > COLOR_BANK_BITS_MAX) || ((1UL << bits) > COLOR_BANK_OFF) ||
+        (COLOR_NUM > COLOR_BANK_OFF) || ((all & (PAGE_SIZE - 1)) != 0) || (all == 0)) {
+        WARNING("Platform dram banks can not be colored, ignored");
+        return;
+    }
+
+    for (size_t i = 0; i < bits; i++) {
+        COLOR_BANK_MASKS[i] = platform.dram.bank_masks[i];
+    }
+    COLOR_BANK_BITS = bits;
+    COLOR_BANK_NUM = 1UL << bits;
+    COLOR_BANK_SIZE = ((paddr_t)1 << bit64_ctz(all)) / PAGE_SIZE;
+}
+
+__attribute__((weak)) bool cache_arch_partition(size_t part_id, uint32_t way_groups)
+{
+    return false;
+}
+
+size_t cache_color_domain(cpuid_t cpuid)
+{
+    return platform_cpu_cluster(cpuid);
 }
 
 void cache_enumerate()
 {
-    cache_arch_enumerate(&cache_dscr);
-    cache_calc_colors(&cache_dscr, PAGE_SIZE);
+    struct cache dscr = { 0 };
+    struct cache_color_domain* domain = &cache_color_domains[cache_color_domain(cpu()->id)];
+
+    /* Every cpu enumerates its own caches as clusters need not share the same cores. */
+    cache_arch_enumerate(&dscr);
+    cache_calc_colors(&dscr, PAGE_SIZE, domain);
+
+    /* The page allocator colors memory according to the master's domain. */
+    if (cpu_is_master()) {
+        COLOR_SIZE = domain->size;
+        COLOR_NUM = domain->num;
+        cache_calc_banks();
+    }
 }
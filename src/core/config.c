@@ -5,7 +5,7 @@
 
 #include <config.h>
 
-void config_adjust_vm_image_addr(paddr_t load_addr)
+__init void config_adjust_vm_image_addr(paddr_t load_addr)
 {
     for (size_t i = 0; i < config.vmlist_size; i++) {
         struct vm_config* vm_config = &config.vmlist[i];
@@ -15,9 +15,9 @@ void config_adjust_vm_image_addr(paddr_t load_addr)
     }
 }
 
-__attribute__((weak)) void config_mem_prot_init(paddr_t load_addr) { }
+__init __attribute__((weak)) void config_mem_prot_init(paddr_t load_addr) { }
 
-void config_init(paddr_t load_addr)
+__init void config_init(paddr_t load_addr)
 {
     config_adjust_vm_image_addr(load_addr);
     config_mem_prot_init(load_addr);
@@ -13,11 +13,77 @@
 #include <spinlock.h>
 #include <printk.h>
 #include <util.h>
+#include <vuart.h>
+#include <defer.h>
 
 static volatile bao_uart_t* uart;
 static bool console_ready = false;
 static spinlock_t console_lock = SPINLOCK_INITVAL;
 
+/**
+ * Output is first copied into a ring of the printing cpu and then written to the uart by whichever
+ * cpu finds no other one draining the rings, so a cpu never waits on the uart while another one
+ * is printing. Each ring has a single producer, its cpu, and the draining cpu as single consumer.
+ * The console lock only guards the draining flag.
+ */
+#ifndef CONSOLE_RING_SIZE
+#define CONSOLE_RING_SIZE (1024)
+#endif
+
+struct console_ring {
+    volatile size_t head;
+    volatile size_t tail;
+    char buf[CONSOLE_RING_SIZE];
+};
+
+static struct console_ring console_rings[PLAT_CPU_NUM];
+static bool console_draining = false;
+
+#define PRINTF_BUFFER_LEN (256)
+
+#ifdef CONSOLE_LOG_DEFERRED
+/**
+ * With deferred logging, printing only records the format string's address and the raw arguments
+ * into the ring. The message is formatted by the draining cpu or, with binary logging, not at all:
+ * records are written out as they are, each preceded by CONSOLE_LOG_SYNC, and decoded on the host
+ * by scripts/bao_log_decode.py against the hypervisor's elf. As the format string is looked up in
+ * the elf, any %s argument itself is printed only if it also lives in the image.
+ */
+#ifndef CONSOLE_LOG_MAX_ARGS
+#define CONSOLE_LOG_MAX_ARGS (8)
+#endif
+
+#define CONSOLE_LOG_SYNC "\x1b" "B"
+
+struct console_log_rec {
+    unsigned long fmt;
+    unsigned long nargs;
+};
+
+#define CONSOLE_LOG_REC_MAX_SIZE \
+    (sizeof(struct console_log_rec) + (CONSOLE_LOG_MAX_ARGS * sizeof(unsigned long)))
+
+static char console_drain_buffer[PRINTF_BUFFER_LEN];
+#endif
+
+static void console_drain(void);
+
+static void console_drain_work(uint64_t data)
+{
+    console_drain();
+}
+
+/**
+ * Writing out to the uart is the slow part of printing, so it is left to the cpu's deferred work
+ * when possible. Errors, after which the cpu never returns to the guest, flush it right away.
+ */
+void console_kick(void)
+{
+    if (!defer_work(console_drain_work, 0)) {
+        console_drain();
+    }
+}
+
 void console_init()
 {
     if (cpu_is_master()) {
@@ -34,38 +100,199 @@ void console_init()
         uart_enable(uart);
 
         console_ready = true;
+        console_drain();
     }
 
     cpu_sync_and_clear_msgs(&cpu_glb_sync);
 }
 
+/**
+ * Drivers able to write a whole buffer at once, e.g. with a single firmware call, override it.
+ */
+__attribute__((weak)) void uart_write(volatile bao_uart_t* uart, const char* buf, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uart_putc(uart, buf[i]);
+    }
+}
+
 void console_write(const char* buf, size_t n)
 {
     while (!console_ready)
         ;
+    size_t start = 0;
     for (size_t i = 0; i < n; i++) {
         if (buf[i] == '\n') {
-            uart_putc(uart, '\r');
+            uart_write(uart, &buf[start], i - start);
+            uart_write(uart, "\r\n", 2);
+            start = i + 1;
         }
-        uart_putc(uart, buf[i]);
     }
+    uart_write(uart, &buf[start], n - start);
 }
 
-#define PRINTF_BUFFER_LEN (256)
-static char console_bufffer[PRINTF_BUFFER_LEN];
+static bool console_pending(void)
+{
+    for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+        if (console_rings[i].head != console_rings[i].tail) {
+            return true;
+        }
+    }
+    return vuart_pending();
+}
+
+#ifdef CONSOLE_LOG_DEFERRED
+static size_t console_ring_read(struct console_ring* ring, size_t head, void* dst, size_t n)
+{
+    char* dst_it = dst;
+    for (size_t i = 0; i < n; i++) {
+        dst_it[i] = ring->buf[head];
+        head = (head + 1) % CONSOLE_RING_SIZE;
+    }
+    return head;
+}
+
+static size_t console_log_drain_rec(struct console_ring* ring, size_t head)
+{
+    struct console_log_rec rec;
+    unsigned long vals[CONSOLE_LOG_MAX_ARGS];
+
+    head = console_ring_read(ring, head, &rec, sizeof(rec));
+    head = console_ring_read(ring, head, vals, rec.nargs * sizeof(unsigned long));
+
+#ifdef CONSOLE_LOG_BINARY
+    uart_write(uart, CONSOLE_LOG_SYNC, sizeof(CONSOLE_LOG_SYNC) - 1);
+    uart_write(uart, (char*)&rec, sizeof(rec));
+    uart_write(uart, (char*)vals, rec.nargs * sizeof(unsigned long));
+#else
+    const char* fmt_it = (const char*)rec.fmt;
+    const unsigned long* vals_it = vals;
+    while (*fmt_it != '\0') {
+        size_t n = snprintk_vals(console_drain_buffer, PRINTF_BUFFER_LEN, &fmt_it, &vals_it);
+        console_write(console_drain_buffer, n);
+    }
+#endif
+
+    return head;
+}
+#endif
+
+static void console_drain(void)
+{
+    while (true) {
+        spin_lock(&console_lock);
+        if (!console_ready || console_draining || !console_pending()) {
+            spin_unlock(&console_lock);
+            return;
+        }
+        console_draining = true;
+        spin_unlock(&console_lock);
+
+        for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+            struct console_ring* ring = &console_rings[i];
+            size_t head = ring->head;
+            size_t tail = ring->tail;
+            fence_ord_read();
+            while (head != tail) {
+#ifdef CONSOLE_LOG_DEFERRED
+                head = console_log_drain_rec(ring, head);
+#else
+                size_t n = (tail > head) ? tail - head : CONSOLE_RING_SIZE - head;
+                console_write(&ring->buf[head], n);
+                head = (head + n) % CONSOLE_RING_SIZE;
+#endif
+            }
+            fence_ord();
+            ring->head = head;
+        }
+        vuart_drain();
+
+        spin_lock(&console_lock);
+        console_draining = false;
+        spin_unlock(&console_lock);
+    }
+}
+
+/**
+ * Writes out what other producers, e.g. the vms' virtual uarts, published, unless another cpu is
+ * already draining, in which case that one picks it up before it stops.
+ */
+void console_flush(void)
+{
+    console_drain();
+}
+
+static size_t console_ring_push(struct console_ring* ring, size_t tail, const char* buf,
+    size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        size_t next = (tail + 1) % CONSOLE_RING_SIZE;
+        while (next == ring->head) {
+            /* The ring is full, so publish what is there and wait for it to be drained */
+            fence_ord_write();
+            ring->tail = tail;
+            console_drain();
+        }
+        ring->buf[tail] = buf[i];
+        tail = next;
+    }
+    return tail;
+}
+
+#ifdef CONSOLE_LOG_DEFERRED
+__attribute__((format(printf, 1, 2))) void console_printk(const char* fmt, ...)
+{
+    va_list args;
+    struct console_log_rec rec;
+    unsigned long vals[CONSOLE_LOG_MAX_ARGS];
+    struct console_ring* ring = &console_rings[cpu()->id];
+    size_t tail = ring->tail;
+
+    va_start(args, fmt);
+    rec.fmt = (unsigned long)fmt;
+    rec.nargs = printk_collect_args(fmt, &args, vals, CONSOLE_LOG_MAX_ARGS);
+    va_end(args);
+
+    /**
+     * The drainer expects only whole records in the ring, so wait for room for this one instead of
+     * publishing it in parts when the ring fills up.
+     */
+    while (((ring->head + CONSOLE_RING_SIZE - tail - 1) % CONSOLE_RING_SIZE) <
+        CONSOLE_LOG_REC_MAX_SIZE) {
+        console_drain();
+    }
+
+    tail = console_ring_push(ring, tail, (const char*)&rec, sizeof(rec));
+    tail = console_ring_push(ring, tail, (const char*)vals, rec.nargs * sizeof(unsigned long));
+
+    fence_ord_write();
+    ring->tail = tail;
+
+    console_kick();
+}
+#else
+static char console_bufffer[PLAT_CPU_NUM][PRINTF_BUFFER_LEN];
 
 __attribute__((format(printf, 1, 2))) void console_printk(const char* fmt, ...)
 {
     va_list args;
     size_t chars_writen;
     const char* fmt_it = fmt;
+    struct console_ring* ring = &console_rings[cpu()->id];
+    char* buffer = console_bufffer[cpu()->id];
+    size_t tail = ring->tail;
 
     va_start(args, fmt);
-    spin_lock(&console_lock);
     while (*fmt_it != '\0') {
-        chars_writen = vsnprintk(console_bufffer, PRINTF_BUFFER_LEN, &fmt_it, &args);
-        console_write(console_bufffer, min(PRINTF_BUFFER_LEN, chars_writen));
+        chars_writen = vsnprintk(buffer, PRINTF_BUFFER_LEN, &fmt_it, &args);
+        tail = console_ring_push(ring, tail, buffer, min(PRINTF_BUFFER_LEN, chars_writen));
     }
-    spin_unlock(&console_lock);
     va_end(args);
+
+    /* The whole message is published at once, so it is never interleaved with other cpus' */
+    fence_ord_write();
+    ring->tail = tail;
+
+    console_kick();
 }
+#endif
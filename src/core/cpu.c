@@ -9,6 +9,13 @@
 #include <objpool.h>
 #include <vm.h>
 #include <fences.h>
+#include <timer.h>
+#include <prof.h>
+#include <defer.h>
+
+#if (CPU_MSG_RING_SIZE & (CPU_MSG_RING_SIZE - 1)) != 0
+#error "CPU_MSG_RING_SIZE must be a power of 2"
+#endif
 
 struct cpu_msg_node {
     node_t node;
@@ -24,9 +31,8 @@ OBJPOOL_ALLOC(msg_pool, struct cpu_msg_node, CPU_MSG_POOL_SIZE);
 
 struct cpu_synctoken cpu_glb_sync = { .ready = false };
 
-extern cpu_msg_handler_t ipi_cpumsg_handlers[];
+extern struct cpu_msg_handler_entry ipi_cpumsg_handlers[];
 extern uint8_t _ipi_cpumsg_handlers_size;
-extern size_t _ipi_cpumsg_handlers_id_start[];
 size_t ipi_cpumsg_handler_num;
 
 struct cpuif cpu_interfaces[PLAT_CPU_NUM];
@@ -39,57 +45,267 @@ void cpu_init(cpuid_t cpu_id, paddr_t load_addr)
 
     cpu_arch_init(cpu_id, load_addr);
 
-    list_init(&cpu()->interface->event_list);
+    for (size_t c = 0; c < CPU_MSG_CLASS_NUM; c++) {
+        for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+            cpu()->interface->msg_rings[c][i].head = 0;
+            cpu()->interface->msg_rings[c][i].tail = 0;
+            list_init(&cpu()->interface->msg_rings[c][i].overflow);
+        }
+        cpu()->msg_stats.depth_max[c] = 0;
+    }
+    cpu()->interface->msg_doorbell = false;
 
     if (cpu_is_master()) {
         cpu_sync_init(&cpu_glb_sync, platform.cpu_num);
 
-        ipi_cpumsg_handler_num = ((size_t)&_ipi_cpumsg_handlers_size) / sizeof(cpu_msg_handler_t);
+        ipi_cpumsg_handler_num =
+            ((size_t)&_ipi_cpumsg_handlers_size) / sizeof(struct cpu_msg_handler_entry);
         for (size_t i = 0; i < ipi_cpumsg_handler_num; i++) {
-            ((size_t*)_ipi_cpumsg_handlers_id_start)[i] = i;
+            *(volatile size_t*)ipi_cpumsg_handlers[i].id = i;
         }
     }
 
     cpu_sync_barrier(&cpu_glb_sync);
 }
 
-void cpu_send_msg(cpuid_t trgtcpu, struct cpu_msg* msg)
+static inline size_t cpu_msg_ring_used(struct cpu_msg_ring* ring)
 {
+    return ring->tail - ring->head;
+}
+
+static void cpu_msg_post(cpuid_t trgtcpu, struct cpu_msg* msg, enum cpu_msg_class class)
+{
+    struct cpu_msg_ring* ring = &cpu_if(trgtcpu)->msg_rings[class][cpu()->id];
+
+    /**
+     * If the ring is full, the target cpu has yet to handle the previously sent messages, for
+     * which it was already signaled. Drain our own messages while waiting so that two cpus
+     * messaging each other cannot deadlock. A message handler can not do so, so it queues the
+     * message in the overflow list instead. Once there, later messages follow it until the target
+     * drains the list, keeping the sender's messages in order.
+     */
+    while (list_empty(&ring->overflow) && (cpu_msg_ring_used(ring) >= CPU_MSG_RING_SIZE) &&
+        !cpu()->handling_msgs) {
+        cpu_msg_handler();
+    }
+
+    if (list_empty(&ring->overflow) && (cpu_msg_ring_used(ring) < CPU_MSG_RING_SIZE)) {
+        size_t tail = ring->tail;
+        ring->msgs[tail & (CPU_MSG_RING_SIZE - 1)] = *msg;
+        fence_ord_write();
+        ring->tail = tail + 1;
+        return;
+    }
+
     struct cpu_msg_node* node = objpool_alloc(&msg_pool);
     if (node == NULL) {
         ERROR("cant allocate msg node");
     }
     node->msg = *msg;
-    list_push(&cpu_if(trgtcpu)->event_list, (node_t*)node);
-    fence_sync_write();
-    interrupts_cpu_sendipi(trgtcpu, IPI_CPU_MSG);
+    /* Order the messages posted to the ring before this one, see cpu_msg_ring_drain */
+    fence_ord_write();
+    list_push(&ring->overflow, (node_t*)node);
+}
+
+/**
+ * Must be called after posting a message to the target cpu. Returns true if the target needs to
+ * be signaled, i.e. if it was not already signaled nor is it handling its messages.
+ */
+static bool cpu_msg_ring_doorbell(cpuid_t trgtcpu)
+{
+    struct cpuif* trgtif = cpu_if(trgtcpu);
+
+    /* Order the posted message before reading the doorbell. Pairs with cpu_msg_handler. */
+    fence_ord();
+    if (trgtif->msg_doorbell) {
+        return false;
+    }
+    trgtif->msg_doorbell = true;
+    return true;
+}
+
+static void cpu_send_class_msg(cpuid_t trgtcpu, struct cpu_msg* msg, enum cpu_msg_class class)
+{
+    cpu_msg_post(trgtcpu, msg, class);
+    stats_inc(STATS_CPU_MSGS_SENT);
+    if (cpu_msg_ring_doorbell(trgtcpu)) {
+        stats_inc(STATS_IPIS_SENT);
+        fence_sync_write();
+        interrupts_cpu_sendipi(trgtcpu, IPI_CPU_MSG);
+    }
+}
+
+static void cpu_send_class_msg_mask(const cpumask_t* trgtmask, struct cpu_msg* msg,
+    enum cpu_msg_class class)
+{
+    cpumask_t ipimask = CPUMASK_EMPTY;
+
+    cpumask_foreach (trgtmask, i) {
+        if (i >= PLAT_CPU_NUM) {
+            break;
+        }
+        cpu_msg_post(i, msg, class);
+        stats_inc(STATS_CPU_MSGS_SENT);
+        if (cpu_msg_ring_doorbell(i)) {
+            stats_inc(STATS_IPIS_SENT);
+            cpumask_set(&ipimask, i);
+        }
+    }
+
+    if (!cpumask_empty(&ipimask)) {
+        fence_sync_write();
+        interrupts_cpu_sendipi_mask(&ipimask, IPI_CPU_MSG);
+    }
+}
+
+void cpu_send_msg(cpuid_t trgtcpu, struct cpu_msg* msg)
+{
+    cpu_send_class_msg(trgtcpu, msg, CPU_MSG_NORMAL);
+}
+
+void cpu_send_msg_mask(const cpumask_t* trgtmask, struct cpu_msg* msg)
+{
+    cpu_send_class_msg_mask(trgtmask, msg, CPU_MSG_NORMAL);
+}
+
+void cpu_send_urgent_msg(cpuid_t trgtcpu, struct cpu_msg* msg)
+{
+    cpu_send_class_msg(trgtcpu, msg, CPU_MSG_URGENT);
+}
+
+void cpu_send_urgent_msg_mask(const cpumask_t* trgtmask, struct cpu_msg* msg)
+{
+    cpu_send_class_msg_mask(trgtmask, msg, CPU_MSG_URGENT);
+}
+
+static inline void cpu_msg_dispatch(struct cpu_msg* msg)
+{
+    if (msg->handler < ipi_cpumsg_handler_num && ipi_cpumsg_handlers[msg->handler].handler) {
+        ipi_cpumsg_handlers[msg->handler].handler(msg->event, msg->data);
+    }
 }
 
-bool cpu_get_msg(struct cpu_msg* msg)
+static inline void cpu_msg_receive(struct cpu_msg* msg, enum cpu_msg_class class)
 {
+    stats_inc(STATS_CPU_MSGS_RECEIVED);
+    if (class == CPU_MSG_URGENT) {
+        stats_inc(STATS_CPU_MSGS_URGENT_RECEIVED);
+    }
+    cpu_msg_dispatch(msg);
+}
+
+/**
+ * Handles all the messages the sender posted to the ring so far, only releasing their slots back
+ * to the sender after copying them out.
+ */
+static void cpu_msg_ring_batch(struct cpu_msg_ring* ring, enum cpu_msg_class class)
+{
+    size_t head = ring->head;
+    size_t tail = ring->tail;
+
+    struct cpu_msg_stats* stats = &cpu()->msg_stats;
+    stats->depth_max[class] = max(stats->depth_max[class], tail - head);
+
+    fence_ord_read();
+    while (head != tail) {
+        struct cpu_msg msg = ring->msgs[head & (CPU_MSG_RING_SIZE - 1)];
+        fence_ord();
+        ring->head = ++head;
+        cpu_msg_receive(&msg, class);
+    }
+}
+
+/**
+ * Drains all the messages the sender posted to the ring so far in a single batch, then those it
+ * queued in the overflow list. While a message is in the list, the sender posts none to the ring,
+ * so the messages in the ring once it is seen, which were posted before it, are handled first.
+ * The time spent is charged to the vm on the sender's cpu. Returns false if there were none.
+ */
+static bool cpu_msg_ring_drain(cpuid_t sender, enum cpu_msg_class class)
+{
+    struct cpu_msg_ring* ring = &cpu()->interface->msg_rings[class][sender];
+    if ((ring->head == ring->tail) && list_empty(&ring->overflow)) {
+        return false;
+    }
+
+    uint64_t start = timer_get();
+    uint64_t standby = cpu()->standby.residency;
+
+    cpu_msg_ring_batch(ring, class);
+
     struct cpu_msg_node* node = NULL;
-    if ((node = (struct cpu_msg_node*)list_pop(&cpu()->interface->event_list)) != NULL) {
-        *msg = node->msg;
+    while ((node = (struct cpu_msg_node*)list_peek(&ring->overflow)) != NULL) {
+        fence_ord_read();
+        cpu_msg_ring_batch(ring, class);
+        list_pop(&ring->overflow);
+        struct cpu_msg msg = node->msg;
         objpool_free(&msg_pool, node);
-        return true;
+        cpu_msg_receive(&msg, class);
     }
-    return false;
+
+    stats_charge(stats_cpus[sender].vm_id,
+        (timer_get() - start) - (cpu()->standby.residency - standby));
+
+    return true;
 }
 
-void cpu_msg_handler()
+static bool cpu_msg_drain_urgent(void)
 {
-    cpu()->handling_msgs = true;
-    struct cpu_msg msg;
-    while (cpu_get_msg(&msg)) {
-        if (msg.handler < ipi_cpumsg_handler_num && ipi_cpumsg_handlers[msg.handler]) {
-            ipi_cpumsg_handlers[msg.handler](msg.event, msg.data);
+    bool drained = false;
+    for (cpuid_t i = 0; i < PLAT_CPU_NUM; i++) {
+        drained |= cpu_msg_ring_drain(i, CPU_MSG_URGENT);
+    }
+    return drained;
+}
+
+static bool cpu_msg_rings_empty(void)
+{
+    for (size_t c = 0; c < CPU_MSG_CLASS_NUM; c++) {
+        for (cpuid_t i = 0; i < PLAT_CPU_NUM; i++) {
+            struct cpu_msg_ring* ring = &cpu()->interface->msg_rings[c][i];
+            if ((ring->head != ring->tail) || !list_empty(&ring->overflow)) {
+                return false;
+            }
         }
     }
+    return true;
+}
+
+__hot void cpu_msg_handler()
+{
+    PROF_SCOPE(PROF_CPU_MSG_HANDLER);
+
+    bool pending;
+
+    cpu()->handling_msgs = true;
+    do {
+        /* The urgent messages are drained first and again after each sender's normal batch */
+        pending = cpu_msg_drain_urgent();
+        for (cpuid_t i = 0; i < PLAT_CPU_NUM; i++) {
+            if (cpu_msg_ring_drain(i, CPU_MSG_NORMAL)) {
+                pending = true;
+                cpu_msg_drain_urgent();
+            }
+        }
+
+        if (!pending) {
+            /**
+             * Only clear the doorbell once the rings are empty, so that messages sent in the
+             * meantime did not need another IPI. Then recheck the rings for messages whose
+             * senders saw the doorbell still set.
+             */
+            cpu()->interface->msg_doorbell = false;
+            fence_ord();
+            pending = !cpu_msg_rings_empty();
+        }
+    } while (pending);
     cpu()->handling_msgs = false;
 }
 
 void cpu_idle()
 {
+    defer_flush();
+    timer_idle_enter();
     cpu_arch_idle();
 
     /**
@@ -99,13 +315,46 @@ void cpu_idle()
     ERROR("Spurious idle wake up");
 }
 
+/**
+ * Wait for an interrupt on behalf of the current vcpu without giving up the stack. Unlike cpu_idle,
+ * this returns once an interrupt is pending, which is only taken after returning to the guest. No
+ * waiting is done if the vcpu already has a pending virtual interrupt, as it would not wake the
+ * physical cpu.
+ */
+void cpu_standby()
+{
+    struct cpu_standby_stats* stats = &cpu()->standby;
+
+    if (cpu()->vcpu != NULL && vcpu_arch_irq_pending(cpu()->vcpu)) {
+        return;
+    }
+
+    defer_flush();
+    uint64_t deadline = timer_next_deadline();
+    uint64_t start = timer_get();
+    timer_idle_enter();
+    cpu_arch_standby();
+    uint64_t end = timer_get();
+    timer_idle_exit();
+
+    stats->count++;
+    stats->residency += end - start;
+    if ((deadline > start) && (deadline <= end)) {
+        stats->wake_latency_max = max(stats->wake_latency_max, end - deadline);
+    }
+}
+
 void cpu_idle_wakeup()
 {
+    timer_idle_exit();
+
     if (interrupts_check(IPI_CPU_MSG)) {
         interrupts_clear(IPI_CPU_MSG);
         cpu_msg_handler();
     }
 
+    vcpu_check_restart();
+
     if (cpu()->vcpu != NULL) {
         vcpu_run(cpu()->vcpu);
     } else {
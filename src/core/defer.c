@@ -0,0 +1,85 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <defer.h>
+
+#include <cpu.h>
+#include <timer.h>
+
+struct defer_item {
+    defer_handler_t handler;
+    uint64_t data;
+};
+
+struct defer_queue {
+    bool started;
+    size_t head;
+    size_t tail;
+    struct defer_item items[DEFER_QUEUE_SIZE];
+};
+
+static struct defer_queue defer_queues[PLAT_CPU_NUM];
+
+bool defer_work(defer_handler_t handler, uint64_t data)
+{
+    struct defer_queue* queue = &defer_queues[cpu()->id];
+
+    if (!queue->started) {
+        return false;
+    }
+
+    for (size_t i = queue->head; i != queue->tail; i++) {
+        struct defer_item* item = &queue->items[i % DEFER_QUEUE_SIZE];
+        if ((item->handler == handler) && (item->data == data)) {
+            return true;
+        }
+    }
+
+    if ((queue->tail - queue->head) >= DEFER_QUEUE_SIZE) {
+        return false;
+    }
+
+    queue->items[queue->tail % DEFER_QUEUE_SIZE] = (struct defer_item){ handler, data };
+    queue->tail++;
+
+    return true;
+}
+
+/**
+ * Items are taken off the queue before running, so the handlers may queue work themselves, which
+ * then runs in the same call if the budget allows.
+ */
+static void defer_run_until(uint64_t deadline)
+{
+    struct defer_queue* queue = &defer_queues[cpu()->id];
+
+    queue->started = true;
+    while (queue->head != queue->tail) {
+        struct defer_item item = queue->items[queue->head % DEFER_QUEUE_SIZE];
+        queue->head++;
+        item.handler(item.data);
+        if ((deadline != 0) && (timer_get() >= deadline)) {
+            break;
+        }
+    }
+}
+
+void defer_run(void)
+{
+    struct defer_queue* queue = &defer_queues[cpu()->id];
+
+    /* Most exits queue nothing, so the clock is only read when there is work */
+    if (queue->head == queue->tail) {
+        queue->started = true;
+        return;
+    }
+
+    defer_run_until(timer_get() + timer_ns_to_ticks(DEFER_BUDGET_NS));
+}
+
+void defer_flush(void)
+{
+    defer_run_until(0);
+}
@@ -0,0 +1,38 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <dirty_log.h>
+#include <cpu.h>
+#include <vm.h>
+
+long int dirty_log_hypercall(unsigned long op, unsigned long arg1, unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    long int ret = -HC_E_INVAL_ARGS;
+
+    switch (op) {
+        case DIRTY_LOG_START:
+            if (vm_mem_dirty_log_start(vm, arg1, arg2)) {
+                ret = HC_E_SUCCESS;
+            }
+            break;
+        case DIRTY_LOG_COLLECT: {
+            ssize_t dirty = vm_mem_dirty_log_collect(vm, arg1, arg2);
+            if (dirty >= 0) {
+                ret = (long int)dirty;
+            }
+            break;
+        }
+        case DIRTY_LOG_STOP:
+            if (vm_mem_dirty_log_stop(vm)) {
+                ret = HC_E_SUCCESS;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return ret;
+}
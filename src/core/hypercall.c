@@ -7,18 +7,263 @@
 #include <cpu.h>
 #include <vm.h>
 #include <ipc.h>
+#include <io.h>
+#include <grant.h>
+#include <mem.h>
+#include <platform.h>
+#include <trace.h>
+#include <prof.h>
+#include <recolor.h>
+#include <stats.h>
+#include <lock_prof.h>
+#include <dirty_log.h>
+#include <snapshot.h>
+#include <live_update.h>
+#include <vm_qos.h>
+#include <config.h>
+#include <spinlock.h>
+#include <fences.h>
+#include <string.h>
 
-long int hypercall(unsigned long id)
+static long int hypercall_dispatch(unsigned long id, unsigned long arg0, unsigned long arg1,
+    unsigned long arg2);
+
+/**
+ * Get the hypervisor mapping of the guest page holding the multicall descriptors, which the vm must
+ * be able to write. The guest address is translated on every call, as the page backing it might
+ * since have changed, e.g., by recoloring the vm, and only the mapping of the last physical page
+ * used is kept in the vcpu, as guests are expected to always use the same one.
+ */
+static struct hc_multicall_entry* hypercall_multicall_map(struct vcpu* vcpu, vaddr_t ipa)
 {
-    long int ret = -HC_E_INVAL_ID;
+    vaddr_t page_ipa = ipa & ~(PAGE_SIZE - 1);
+    paddr_t pa;
 
-    unsigned long ipc_id = vcpu_readreg(cpu()->vcpu, HYPCALL_ARG_REG(0));
-    unsigned long arg1 = vcpu_readreg(cpu()->vcpu, HYPCALL_ARG_REG(1));
-    unsigned long arg2 = vcpu_readreg(cpu()->vcpu, HYPCALL_ARG_REG(2));
+    vm_mem_populate(vcpu->vm, page_ipa);
+    if (!mem_translate_writable(&vcpu->vm->as, page_ipa, &pa) || !platform_is_mem(pa)) {
+        return NULL;
+    }
+
+    if (vcpu->multicall.va == (vaddr_t)NULL || vcpu->multicall.pa != pa) {
+        if (vcpu->multicall.va != (vaddr_t)NULL) {
+            mem_unmap(&cpu()->as, vcpu->multicall.va, 1, false);
+            vcpu->multicall.va = (vaddr_t)NULL;
+        }
+
+        struct ppages ppages = mem_ppages_get(pa, 1);
+        vaddr_t va =
+            mem_alloc_map(&cpu()->as, SEC_HYP_PRIVATE, &ppages, INVALID_VA, 1, PTE_HYP_FLAGS);
+        if (va == INVALID_VA) {
+            return NULL;
+        }
+
+        vcpu->multicall.pa = pa;
+        vcpu->multicall.va = va;
+    }
+
+    return (struct hc_multicall_entry*)(vcpu->multicall.va + (ipa - page_ipa));
+}
+
+/**
+ * Each descriptor is copied out before it runs and its page mapped again for the result, as the
+ * call might have moved the page, e.g., by recoloring the caller's own vm.
+ */
+static long int hypercall_multicall(unsigned long ipa, unsigned long count, unsigned long arg2)
+{
+    size_t max_count = (PAGE_SIZE - (ipa % PAGE_SIZE)) / sizeof(struct hc_multicall_entry);
+
+    if ((ipa % sizeof(uint64_t)) != 0 || count > max_count) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if (count == 0) {
+        return HC_E_SUCCESS;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        vaddr_t entry_ipa = ipa + (i * sizeof(struct hc_multicall_entry));
+        struct hc_multicall_entry* entry = hypercall_multicall_map(cpu()->vcpu, entry_ipa);
+        if (entry == NULL) {
+            return -HC_E_INVAL_ARGS;
+        }
+
+        struct hc_multicall_entry call = *entry;
+        long int ret = -HC_E_INVAL_ID;
+        if (call.id != HC_MULTICALL && call.id != HC_IO_FAULTS) {
+            ret = hypercall_dispatch(call.id, call.args[0], call.args[1], call.args[2]);
+        }
+
+        entry = hypercall_multicall_map(cpu()->vcpu, entry_ipa);
+        if (entry == NULL) {
+            return -HC_E_INVAL_ARGS;
+        }
+        entry->ret = ret;
+    }
+
+    return HC_E_SUCCESS;
+}
+
+/**
+ * Runs up to max of the requests submitted on the vm's hypercall queue, returning how many it ran.
+ * A single one of the vm's cpus runs them at a time, which the others, unless waiting, leave to it.
+ * Each entry is copied before being run, as the guest might be changing it.
+ */
+static size_t hypercall_queue_run(struct vm* vm, size_t max, bool wait)
+{
+    struct hc_queue* queue = vm->hc_queue.page;
+    size_t n = 0;
+
+    while (spin_atomic_cmpxchg(&vm->hc_queue.busy, 0, 1) != 0) {
+        if (!wait) {
+            return 0;
+        }
+        spin_wait();
+    }
+
+    uint32_t sq_head = queue->sq_head;
+    uint32_t cq_tail = queue->cq_tail;
+    while ((n < max) && (sq_head != queue->sq_tail) &&
+        ((uint32_t)(cq_tail - queue->cq_head) < HC_QUEUE_SIZE)) {
+        fence_ord_read();
+        struct hc_queue_sqe sqe = queue->sq[sq_head % HC_QUEUE_SIZE];
+        long int ret = -HC_E_INVAL_ID;
+        if ((sqe.id != HC_MULTICALL) && (sqe.id != HC_IO_FAULTS) && (sqe.id != HC_QUEUE)) {
+            ret = hypercall_dispatch(sqe.id, sqe.args[0], sqe.args[1], sqe.args[2]);
+        }
+
+        queue->cq[cq_tail % HC_QUEUE_SIZE] = (struct hc_queue_cqe){ sqe.user_data, ret };
+        fence_ord_write();
+        queue->sq_head = ++sq_head;
+        queue->cq_tail = ++cq_tail;
+        n++;
+    }
+
+    (void)spin_atomic_xchg(&vm->hc_queue.busy, 0);
+
+    return n;
+}
+
+static long int hypercall_queue_doorbell(unsigned long arg0, unsigned long arg1,
+    unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+
+    if (vm->hc_queue.page == NULL) {
+        return -HC_E_FAILURE;
+    }
+
+    return (long int)hypercall_queue_run(vm, HC_QUEUE_SIZE, true);
+}
+
+/**
+ * Called on every exit, so it only looks at the queue of vms having one.
+ */
+void hypercall_queue_poll(void)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    if ((vcpu != NULL) && (vcpu->vm->hc_queue.page != NULL) &&
+        (vcpu->vm->hc_queue.page->sq_head != vcpu->vm->hc_queue.page->sq_tail)) {
+        hypercall_queue_run(vcpu->vm, HC_QUEUE_BATCH, false);
+    }
+}
+
+/**
+ * Run by the vm's master cpu while the vm's address space is set up, before any of its vcpus runs.
+ */
+void hypercall_queue_vm_init(struct vm* vm, const struct vm_config* config)
+{
+    vaddr_t addr = config->platform.hc_queue_addr;
+    size_t n = NUM_PAGES(sizeof(struct hc_queue));
+
+    vm->hc_queue.page = NULL;
+    vm->hc_queue.busy = 0;
+    if (addr == 0) {
+        return;
+    }
+
+    if ((addr % PAGE_SIZE) != 0) {
+        WARNING("VM %d hypercall queue not page aligned. Ignored.", vm->id);
+        return;
+    }
+
+    struct hc_queue* queue = mem_alloc_page(n, SEC_HYP_VM, false);
+    if (queue == NULL) {
+        ERROR("failed to allocate hypercall queue");
+    }
+    memset(queue, 0, n * PAGE_SIZE);
+    queue->magic = HC_QUEUE_MAGIC;
+    queue->size = HC_QUEUE_SIZE;
+
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, (vaddr_t)queue, &pa);
+    struct ppages ppages = mem_ppages_get(pa, n);
+    mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, addr, n, PTE_VM_FLAGS);
+    vm->hc_queue.page = queue;
+}
+
+static long int hypercall_dispatch(unsigned long id, unsigned long arg0, unsigned long arg1,
+    unsigned long arg2)
+{
+    long int ret = -HC_E_INVAL_ID;
 
     switch (id) {
         case HC_IPC:
-            ret = ipc_hypercall(ipc_id, arg1, arg2);
+            ret = ipc_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_IO_FAULTS:
+            ret = io_fault_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_GRANT_LEND:
+            ret = grant_lend_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_GRANT_MAP:
+            ret = grant_map_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_GRANT_UNMAP:
+            ret = grant_unmap_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_GRANT_REVOKE:
+            ret = grant_revoke_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_MULTICALL:
+            ret = hypercall_multicall(arg0, arg1, arg2);
+            break;
+        case HC_TRACE:
+            ret = trace_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_PROF:
+            ret = prof_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_VM_RECOLOR:
+            ret = recolor_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_IPI:
+            ret = vm_ipi_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_STATS:
+            ret = stats_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_LOCK_PROF:
+            ret = lock_prof_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_DIRTY_LOG:
+            ret = dirty_log_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_VM_SNAPSHOT:
+            ret = snapshot_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_QUEUE:
+            ret = hypercall_queue_doorbell(arg0, arg1, arg2);
+            break;
+        case HC_VM_CTL:
+            ret = vm_ctl_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_LIVE_UPDATE:
+            ret = live_update_hypercall(arg0, arg1, arg2);
+            break;
+        case HC_VM_QOS:
+            ret = vm_qos_hypercall(arg0, arg1, arg2);
             break;
         default:
             WARNING("Unknown hypercall id %d", id);
@@ -26,3 +271,12 @@ long int hypercall(unsigned long id)
 
     return ret;
 }
+
+__hot long int hypercall(unsigned long id)
+{
+    unsigned long arg0 = vcpu_readreg(cpu()->vcpu, HYPCALL_ARG_REG(0));
+    unsigned long arg1 = vcpu_readreg(cpu()->vcpu, HYPCALL_ARG_REG(1));
+    unsigned long arg2 = vcpu_readreg(cpu()->vcpu, HYPCALL_ARG_REG(2));
+
+    return hypercall_dispatch(id, arg0, arg1, arg2);
+}
@@ -8,6 +8,10 @@
 
 #include <arch/bao.h>
 
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE (64)
+#endif
+
 #ifndef __ASSEMBLER__
 
 #include <types.h>
@@ -21,6 +25,7 @@
 #define ERROR(args, ...)                                                    \
     {                                                                       \
         console_printk("BAO ERROR: " args "\n" __VA_OPT__(, ) __VA_ARGS__); \
+        console_flush();                                                    \
         while (1) { }                                                       \
     }
 
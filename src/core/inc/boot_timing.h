@@ -0,0 +1,45 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __BOOT_TIMING_H__
+#define __BOOT_TIMING_H__
+
+#include <bao.h>
+
+enum boot_phase {
+    BOOT_PHASE_PAGE_POOLS,
+    BOOT_PHASE_COLORING,
+    BOOT_PHASE_VM_PAGE_TABLES,
+    BOOT_PHASE_IMAGE_INSTALL,
+    BOOT_PHASE_BARRIERS,
+    BOOT_PHASE_NUM
+};
+
+#ifdef BOOT_TIMING
+
+/**
+ * Each cpu accumulates the time it spends in each boot phase, from boot_timing_begin to the
+ * matching boot_timing_end, until it reports them right before running its vcpu, or idling.
+ */
+void boot_timing_init(void);
+uint64_t boot_timing_begin(void);
+void boot_timing_end(enum boot_phase phase, uint64_t begin);
+void boot_timing_report(void);
+
+#else
+
+static inline void boot_timing_init(void) { }
+
+static inline uint64_t boot_timing_begin(void)
+{
+    return 0;
+}
+
+static inline void boot_timing_end(enum boot_phase phase, uint64_t begin) { }
+static inline void boot_timing_report(void) { }
+
+#endif
+
+#endif /* __BOOT_TIMING_H__ */
@@ -8,6 +8,7 @@
 
 #include <bao.h>
 #include <arch/cache.h>
+#include <platform_defs.h>
 
 struct cache {
     size_t lvls;
@@ -22,9 +23,55 @@ struct cache {
 extern size_t COLOR_NUM;
 extern size_t COLOR_SIZE;
 
+/**
+ * Dram banks are a second coloring dimension, kept in the high half of a colormap, one bit per
+ * bank, above the cache colors in its low half. A bank is selected by the physical address bits
+ * the platform describes, which must be above the page offset, in runs of COLOR_BANK_SIZE pages.
+ */
+#define COLOR_BANK_OFF (sizeof(colormap_t) * 8 / 2)
+
+#ifndef COLOR_BANK_BITS_MAX
+#define COLOR_BANK_BITS_MAX (5)
+#endif
+
+extern size_t COLOR_BANK_NUM;
+extern size_t COLOR_BANK_SIZE;
+extern size_t COLOR_BANK_BITS;
+extern paddr_t COLOR_BANK_MASKS[COLOR_BANK_BITS_MAX];
+
+/**
+ * A color domain is one instance of the last level cache, i.e., the cluster of cpus sharing it.
+ * Pages of the same color only compete for cache sets when accessed from the same domain, so
+ * colors need only be partitioned among the vms placed on it. Domains are indexed by their id.
+ */
+struct cache_color_domain {
+    size_t num;
+    size_t size;
+};
+
+extern struct cache_color_domain cache_color_domains[PLAT_CPU_NUM];
+
+size_t cache_color_domain(cpuid_t cpuid);
+
 void cache_enumerate();
 void cache_flush_range(vaddr_t base, size_t size);
+void cache_clean_range(vaddr_t base, size_t size);
+/**
+ * Invalidation discards any dirty data in the lines overlapping the range, including bytes
+ * outside of it if base or size are not line aligned.
+ */
+void cache_inv_range(vaddr_t base, size_t size);
+
+/* Invalidates the current cpu's instruction cache */
+void cache_inv_icache(void);
 
 void cache_arch_enumerate(struct cache* dscrp);
 
+/**
+ * Restricts the last level cache allocations of the current cpu to the way groups in the mask,
+ * which are claimed for partition id across the cpu's cache. Returns false if the cache can not be
+ * partitioned by ways or does not support that partition id.
+ */
+bool cache_arch_partition(size_t part_id, uint32_t way_groups);
+
 #endif /* __CACHE_H__ */
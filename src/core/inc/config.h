@@ -43,6 +43,17 @@
         .size = VM_IMAGE_SIZE(img_name), .separately_loaded = false,          \
     }
 
+/**
+ * An image built in as an LZ4 frame, i.e., declared with VM_IMAGE on the output of the lz4 tool,
+ * which is decompressed to image_size bytes at image_base_addr when the vm is created.
+ */
+#define VM_IMAGE_COMPRESSED(img_name, image_base_addr, image_size)                          \
+    {                                                                                       \
+        .base_addr = image_base_addr, .load_addr = VM_IMAGE_OFFSET(img_name),               \
+        .size = image_size, .compressed_size = VM_IMAGE_SIZE(img_name),                     \
+        .separately_loaded = false,                                                         \
+    }
+
 #define VM_IMAGE_LOADED(image_base_addr, image_load_addr, image_size)                   \
     {                                                                                   \
         .base_addr = image_base_addr, .load_addr = image_load_addr, .size = image_size, \
@@ -64,12 +75,24 @@ struct vm_config {
         paddr_t load_addr;
         /* Image size */
         size_t size;
+        /* Size of the LZ4 frame at the load address, if the image is compressed, or zero */
+        size_t compressed_size;
         /**
          * Informs the hypervisor if the VM image is to be loaded separately by a bootloader.
          */
         bool separately_loaded;
         /* Dont copy the image */
         bool inplace;
+        /**
+         * Page aligned range of the image, e.g. its text and rodata, mapped read-only straight
+         * from the load address instead of being copied, where guest writes fault. Vms built with
+         * the same image so share a single copy of the range, and its cache lines, which are
+         * outside of the vms' colors. Ignored for compressed images and with an mpu.
+         */
+        struct {
+            vaddr_t base;
+            size_t size;
+        } shared_ro;
     } image;
 
     /* Entry point address in VM's address space */
@@ -81,12 +104,118 @@ struct vm_config {
      */
     cpumap_t cpu_affinity;
 
+    /**
+     * The vcpus not given a cpu through cpu_affinity are placed, if possible, in a single cluster
+     * so that they share the last level cache and exchange ipis locally. Setting this places them
+     * in cpu id order instead, regardless of the clusters they end up spanning.
+     */
+    bool cpu_cluster_spread;
+
     /**
      * A bitmap for the assigned colors of the VM. This value is truncated depending on the number
-     * of available colors calculated at runtime
+     * of available colors calculated at runtime. Colors only need to be exclusive among the VMs
+     * sharing a last level cache, i.e., placed on the same cluster. The high half of the bitmap
+     * assigns the platform's dram banks, see COLOR_BANK_OFF, which are exclusive system wide.
      */
     colormap_t colors;
 
+    /**
+     * Which of the platform's memory regions, given their tier and controller, the VM's memory
+     * and page tables are allocated from, e.g. MEM_PLACE_TIER at tier 0 for a real-time VM. Left
+     * zeroed, i.e., MEM_PLACE_ANY, it comes from the first region with enough free memory, those
+     * of the numa node of the vm's cpus first. Regions placed at a fixed physical address are not
+     * affected.
+     */
+    struct mem_place mem_place;
+
+    /**
+     * A bitmap of the last level cache way groups assigned to the VM, where the cache supports
+     * partitioning by ways, e.g. the DSU L3 of Arm DynamIQ clusters. Unlike coloring, this keeps
+     * the VM's memory contiguous so it can be mapped with huge pages. Ways claimed by no VM are
+     * shared with the VMs left unpartitioned, i.e., with a zero bitmap.
+     */
+    uint32_t cache_ways;
+
+    /**
+     * Hardware QoS partitioning, i.e., Arm MPAM or RISC-V Ssqosid with CBQRI controllers. The VM is
+     * given its own partition id, restricted to the portions in the cache_portions bitmap in caches
+     * implementing capacity partitioning and to mbw_max percent of the bandwidth of memory
+     * controllers implementing bandwidth partitioning. A zero value leaves the respective resource
+     * unrestricted. As for cache_ways, memory need not be colored.
+     */
+    struct {
+        uint64_t cache_portions;
+        uint32_t mbw_max;
+    } qos;
+
+    /**
+     * Memory bandwidth regulation. Each of the VM's vcpus may cause up to budget last level cache
+     * refills every period_us microseconds (MEMBW_DEFAULT_PERIOD_US if zero), after which it is
+     * held in the hypervisor until the next period. A zero budget leaves the VM unregulated. If any
+     * VM is regulated the hypervisor owns the pmu overflow interrupt, which can then not be
+     * assigned to a VM.
+     */
+    struct {
+        uint32_t budget;
+        uint32_t period_us;
+    } membw;
+
+    /**
+     * Interrupt storm protection. Each of the VM's vcpus is forwarded up to budget hardware
+     * interrupts every period_us microseconds (IRQ_LIMIT_DEFAULT_PERIOD_US if zero). Further
+     * interrupts are held at the physical interrupt controller and injected once the period ends.
+     * A zero budget leaves the VM unlimited.
+     */
+    struct {
+        uint32_t budget;
+        uint32_t period_us;
+    } irq_limit;
+
+    /**
+     * Working set sampling. Every period_us microseconds, the VM's master cpu counts the pages of
+     * each 2M chunk of the VM's memory regions accessed since the last sample, which the stats
+     * hypercall then reads (see STATS_WSS_PAGES). It relies on the cpus managing the stage 2
+     * access flag in hardware, i.e., FEAT_HAFDBS or Svadu. A zero period disables sampling.
+     */
+    struct {
+        uint32_t period_us;
+    } wss;
+
+    /**
+     * Trap the guest's wait for interrupt instruction. The hypervisor then waits for interrupts
+     * itself, accounting the time the cpu spends in standby.
+     */
+    bool trap_wfi;
+
+    /**
+     * The vm's secondary vcpus wait to be started by the guest with their registers already reset
+     * and their cpus kept out of power down states, so starting one only takes a message to set
+     * its entry point. Saves the firmware's power up and the vcpu reset on each start during the
+     * guest's boot, at the cost of the waiting cpus' power.
+     */
+    bool fast_start;
+
+    /**
+     * The VM's passthrough interrupts are given the highest physical priority, above the
+     * hypervisor's own and other VMs' interrupts, so that they are taken first whenever several
+     * are pending on the VM's cpus. The priorities the guest sees are not affected.
+     */
+    bool critical;
+
+    /**
+     * Let a vm_manager VM save and restore this VM's state through HC_VM_SNAPSHOT. The memory for a
+     * copy of the VM's regions is reserved up front and the VM's interrupt exits save all of its
+     * registers.
+     */
+    bool snapshot;
+
+    /**
+     * Allow the VM to issue management hypercalls on other VMs, e.g., to recolor them. Any VM can
+     * issue some of them on itself, but within its own configuration, e.g., only recoloring itself
+     * to a subset of its configured colors.
+     */
+    bool vm_manager;
+
     /**
      * A description of the virtual platform available to the guest, i.e., the virtual machine
      * itself.
@@ -108,6 +237,16 @@ extern struct config {
 
         /* Hypervisor colors */
         colormap_t colors;
+
+        /* Placement of the hypervisor's own allocations, see vm_config.mem_place */
+        struct mem_place mem_place;
+
+        /**
+         * The cpus the hypervisor's own global interrupts, e.g. the iommu fault interrupts, are
+         * routed to, so that the cpus of latency sensitive vms do not take them. They go to the
+         * first of these cpus, or if none is given, to the cpu setting them up.
+         */
+        cpumap_t housekeeping_cpus;
     } hyp;
 
     /* Definition of shared memory regions to be used by VMs */
@@ -124,4 +263,28 @@ extern struct config {
 
 void config_init(paddr_t load_addr);
 
+static inline bool config_vm_image_shared(const struct vm_config* vm_config, vaddr_t va)
+{
+    return (vm_config->image.shared_ro.size != 0) &&
+        in_range(va, vm_config->image.shared_ro.base, vm_config->image.shared_ro.size);
+}
+
+/* Whether any of the vm's devices is a bus master behind the iommu, i.e., might dma to memory */
+static inline bool config_vm_dma(const struct vm_config* vm_config)
+{
+    for (size_t i = 0; i < vm_config->platform.dev_num; i++) {
+        if (vm_config->platform.devs[i].id != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Size of the image as found at its load address */
+static inline size_t config_vm_image_load_size(const struct vm_config* vm_config)
+{
+    return (vm_config->image.compressed_size != 0) ? vm_config->image.compressed_size :
+                                                     vm_config->image.size;
+}
+
 #endif /* __CONFIG_H__ */
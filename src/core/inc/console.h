@@ -11,5 +11,7 @@
 void console_init();
 void console_write(const char* buf, size_t n);
 void console_printk(const char* fmt, ...);
+void console_flush(void);
+void console_kick(void);
 
 #endif /* __CONSOLE_H__ */
@@ -8,70 +8,158 @@
 
 #include <bao.h>
 #include <arch/cpu.h>
+#include <platform_defs.h>
 
 #include <spinlock.h>
 #include <mem.h>
 #include <list.h>
+#include <boot_timing.h>
+#include <cpumask.h>
 
 #ifndef __ASSEMBLER__
 
+#define CPU_MSG_RING_SIZE_DEFAULT (32)
+#ifndef CPU_MSG_RING_SIZE
+#define CPU_MSG_RING_SIZE CPU_MSG_RING_SIZE_DEFAULT
+#endif
+
+struct cpu_msg {
+    uint32_t handler;
+    uint32_t event;
+    uint64_t data;
+};
+
+/**
+ * Single-producer/single-consumer message ring. Each ring is only written by one sender cpu
+ * (which owns the tail) and only drained by the receiving cpu (which owns the head), so no locks
+ * are needed. Head and tail are free running counters and CPU_MSG_RING_SIZE must be a power of 2.
+ * Messages sent while the ring is full from a message handler, which can not wait for the
+ * receiver, go to the ring's locked overflow list instead, see cpu_msg_post.
+ */
+struct cpu_msg_ring {
+    volatile size_t head;
+    volatile size_t tail;
+    struct cpu_msg msgs[CPU_MSG_RING_SIZE];
+    struct list overflow;
+};
+
+/**
+ * Messages delivering interrupts are urgent and are drained before and in between the batches of
+ * normal messages, e.g. configuration updates, so that their latency stays bounded during bursts of
+ * the latter. Each class has its own rings, so there is no ordering guarantee between a sender's
+ * urgent and normal messages.
+ */
+enum cpu_msg_class { CPU_MSG_URGENT, CPU_MSG_NORMAL, CPU_MSG_CLASS_NUM };
+
+#if (STACK_SIZE % PAGE_SIZE) != 0
+#error "STACK_SIZE must be a multiple of PAGE_SIZE"
+#endif
+
 struct cpuif {
-    struct list event_list;
+    struct cpu_msg_ring msg_rings[CPU_MSG_CLASS_NUM][PLAT_CPU_NUM];
+
+    /**
+     * Set by the first sender that signals the cpu with an IPI and only cleared by the cpu itself
+     * once it is done draining its rings. While set, senders skip the IPI.
+     */
+    volatile bool msg_doorbell;
 
 } __attribute__((aligned(PAGE_SIZE)));
 
 struct vcpu;
 
+/**
+ * Accounting of the time spent in standby, in timer ticks. The wake-up latency is only measured
+ * for wake ups caused by the expiration of one of the cpu's hypervisor timer events.
+ */
+struct cpu_standby_stats {
+    uint64_t count;
+    uint64_t residency;
+    uint64_t wake_latency_max;
+};
+
+/* The most messages found pending in a single ring of each class when draining it */
+struct cpu_msg_stats {
+    size_t depth_max[CPU_MSG_CLASS_NUM];
+};
+
+/**
+ * The fields read on every exception come first, so that they share the cpu's first cache line.
+ */
 struct cpu {
     cpuid_t id;
 
     bool handling_msgs;
 
-    struct addr_space as;
-
     struct vcpu* vcpu;
 
+    struct cpuif* interface;
+
     struct cpu_arch arch;
 
-    struct cpuif* interface;
+    struct cpu_standby_stats standby;
+
+    struct cpu_msg_stats msg_stats;
+
+    struct addr_space as;
+
+    struct mem_page_caches page_caches;
 
     uint8_t stack[STACK_SIZE] __attribute__((aligned(PAGE_SIZE)));
 
 } __attribute__((aligned(PAGE_SIZE)));
-struct cpu_msg {
-    uint32_t handler;
-    uint32_t event;
-    uint64_t data;
-};
+
+_Static_assert((offsetof(struct cpu, interface) + sizeof(struct cpuif*)) <= CACHE_LINE_SIZE,
+    "cpu hot fields do not fit its first cache line");
 
 void cpu_send_msg(cpuid_t cpu, struct cpu_msg* msg);
 
 typedef void (*cpu_msg_handler_t)(uint32_t event, uint64_t data);
 
-#define CPU_MSG_HANDLER(handler, handler_id)                \
-    __attribute__((section(".ipi_cpumsg_handlers"), used))  \
-    cpu_msg_handler_t __cpumsg_handler_##handler = handler; \
-    __attribute__((section(".ipi_cpumsg_handlers_id"), used)) volatile const size_t handler_id;
+/**
+ * Each handler's entry points to its id, which is assigned at boot from the entry's index, so
+ * that ids do not depend on the handlers and the ids being laid out in the same order, which the
+ * compiler does not guarantee, e.g. under link time optimization.
+ */
+struct cpu_msg_handler_entry {
+    cpu_msg_handler_t handler;
+    volatile const size_t* id;
+};
 
+#define CPU_MSG_HANDLER(handler, handler_id)                                                \
+    __attribute__((section(".ipi_cpumsg_handlers_id"), used)) volatile const size_t handler_id; \
+    __attribute__((section(".ipi_cpumsg_handlers"), used))                                  \
+    struct cpu_msg_handler_entry __cpumsg_handler_##handler = { handler, &handler_id };
+
+/**
+ * A sense-reversing barrier: cpus count their arrival atomically and wait for the generation to
+ * change, which the last one to arrive does after resetting the count for the next round. Waiting
+ * cpus idle on spin_wait instead of hammering the token's cache line.
+ */
 struct cpu_synctoken {
-    spinlock_t lock;
     volatile size_t n;
     volatile bool ready;
-    volatile size_t count;
+    volatile uint32_t count;
+    volatile uint32_t generation;
 };
 
 extern struct cpu_synctoken cpu_glb_sync;
 
 void cpu_init(cpuid_t cpu_id, paddr_t load_addr);
 void cpu_send_msg(cpuid_t cpu, struct cpu_msg* msg);
-bool cpu_get_msg(struct cpu_msg* msg);
+void cpu_send_msg_mask(const cpumask_t* cpu_mask, struct cpu_msg* msg);
+void cpu_send_urgent_msg(cpuid_t cpu, struct cpu_msg* msg);
+void cpu_send_urgent_msg_mask(const cpumask_t* cpu_mask, struct cpu_msg* msg);
 void cpu_msg_handler();
 void cpu_msg_set_handler(cpuid_t id, cpu_msg_handler_t handler);
 void cpu_idle();
 void cpu_idle_wakeup();
+void cpu_standby();
 
 void cpu_arch_init(cpuid_t cpu_id, paddr_t load_addr);
 void cpu_arch_idle();
+void cpu_arch_standby();
+bool cpu_arch_warm_reset(void);
 
 extern struct cpuif cpu_interfaces[];
 static inline struct cpuif* cpu_if(cpuid_t cpu_id)
@@ -86,44 +174,71 @@ static inline bool cpu_is_master(void)
 
 static inline void cpu_sync_init(struct cpu_synctoken* token, size_t n)
 {
-    token->lock = SPINLOCK_INITVAL;
     token->n = n;
     token->count = 0;
+    token->generation = 0;
     token->ready = true;
 }
 
-static inline void cpu_sync_barrier(struct cpu_synctoken* token)
+/**
+ * Marks the calling cpu's arrival, returning the generation to wait on or, for the last cpu to
+ * arrive, having already released the others.
+ */
+static inline uint32_t cpu_sync_arrive(struct cpu_synctoken* token, bool* last)
 {
-    // TODO: no fence/barrier needed in this function?
-
-    size_t next_count = 0;
-
     while (!token->ready) { }
 
-    spin_lock(&token->lock);
-    token->count++;
-    next_count = ALIGN(token->count, token->n);
-    spin_unlock(&token->lock);
+    /* The generation is read before the arrival, which the atomic update orders */
+    uint32_t generation = token->generation;
+    uint32_t count;
+    do {
+        count = token->count;
+    } while (spin_atomic_cmpxchg(&token->count, count, count + 1) != count);
+
+    *last = ((count + 1) == token->n);
+    if (*last) {
+        token->count = 0;
+        fence_ord_write();
+        token->generation = generation + 1;
+        spin_notify();
+    }
 
-    while (token->count < next_count) { }
+    return generation;
 }
 
-static inline void cpu_sync_and_clear_msgs(struct cpu_synctoken* token)
+static inline void cpu_sync_barrier(struct cpu_synctoken* token)
 {
-    size_t next_count = 0;
+    uint64_t wait = boot_timing_begin();
+    bool last;
 
-    while (!token->ready) { }
+    uint32_t generation = cpu_sync_arrive(token, &last);
+    if (!last) {
+        while (token->generation == generation) {
+            spin_wait();
+        }
+    }
+    fence_ord();
 
-    spin_lock(&token->lock);
-    token->count++;
-    next_count = ALIGN(token->count, token->n);
-    spin_unlock(&token->lock);
+    boot_timing_end(BOOT_PHASE_BARRIERS, wait);
+}
 
-    while (token->count < next_count) {
-        if (!cpu()->handling_msgs) {
-            cpu_msg_handler();
+static inline void cpu_sync_and_clear_msgs(struct cpu_synctoken* token)
+{
+    uint64_t wait = boot_timing_begin();
+    bool last;
+
+    /* Messages are noticed by polling, as their interrupts do not wake this cpu from spin_wait */
+    uint32_t generation = cpu_sync_arrive(token, &last);
+    if (!last) {
+        while (token->generation == generation) {
+            if (!cpu()->handling_msgs) {
+                cpu_msg_handler();
+            }
         }
     }
+    fence_ord();
+
+    boot_timing_end(BOOT_PHASE_BARRIERS, wait);
 
     if (!cpu()->handling_msgs) {
         cpu_msg_handler();
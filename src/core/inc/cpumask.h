@@ -0,0 +1,152 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __CPUMASK_H__
+#define __CPUMASK_H__
+
+#include <bao.h>
+#include <bit.h>
+#include <platform_defs.h>
+
+/**
+ * Set of physical cpus, sized for PLAT_CPU_NUM and so not limited to the bits of a word as
+ * cpumap_t is. cpumap_t remains for masks whose width is fixed by an interface, e.g. guest visible
+ * target lists, which are converted at the edges with cpumask_from_map and cpumask_to_map.
+ */
+
+#define CPUMASK_WORD_BITS (sizeof(unsigned long) * 8)
+#define CPUMASK_WORDS     ((PLAT_CPU_NUM + CPUMASK_WORD_BITS - 1) / CPUMASK_WORD_BITS)
+
+typedef struct {
+    unsigned long words[CPUMASK_WORDS];
+} cpumask_t;
+
+#define CPUMASK_EMPTY ((cpumask_t){ { 0 } })
+
+static inline void cpumask_set(cpumask_t* mask, cpuid_t cpu)
+{
+    mask->words[cpu / CPUMASK_WORD_BITS] |= 1UL << (cpu % CPUMASK_WORD_BITS);
+}
+
+static inline void cpumask_clear(cpumask_t* mask, cpuid_t cpu)
+{
+    mask->words[cpu / CPUMASK_WORD_BITS] &= ~(1UL << (cpu % CPUMASK_WORD_BITS));
+}
+
+static inline bool cpumask_test(const cpumask_t* mask, cpuid_t cpu)
+{
+    return (cpu < PLAT_CPU_NUM) &&
+        ((mask->words[cpu / CPUMASK_WORD_BITS] & (1UL << (cpu % CPUMASK_WORD_BITS))) != 0);
+}
+
+static inline cpumask_t cpumask_of(cpuid_t cpu)
+{
+    cpumask_t mask = CPUMASK_EMPTY;
+    cpumask_set(&mask, cpu);
+    return mask;
+}
+
+static inline bool cpumask_empty(const cpumask_t* mask)
+{
+    for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+        if (mask->words[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool cpumask_equal(const cpumask_t* a, const cpumask_t* b)
+{
+    for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+        if (a->words[i] != b->words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline size_t cpumask_weight(const cpumask_t* mask)
+{
+    size_t weight = 0;
+    for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+        weight += bit_popcount(mask->words[i]);
+    }
+    return weight;
+}
+
+/* Number of cpus in the mask below cpu, i.e., the index of cpu among them */
+static inline size_t cpumask_weight_below(const cpumask_t* mask, cpuid_t cpu)
+{
+    size_t weight = 0;
+    for (size_t i = 0; i < (cpu / CPUMASK_WORD_BITS); i++) {
+        weight += bit_popcount(mask->words[i]);
+    }
+    if ((cpu % CPUMASK_WORD_BITS) != 0) {
+        weight += bit_popcount(mask->words[cpu / CPUMASK_WORD_BITS] &
+            ((1UL << (cpu % CPUMASK_WORD_BITS)) - 1));
+    }
+    return weight;
+}
+
+static inline void cpumask_and(cpumask_t* dst, const cpumask_t* a, const cpumask_t* b)
+{
+    for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+        dst->words[i] = a->words[i] & b->words[i];
+    }
+}
+
+static inline void cpumask_or(cpumask_t* dst, const cpumask_t* a, const cpumask_t* b)
+{
+    for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+        dst->words[i] = a->words[i] | b->words[i];
+    }
+}
+
+static inline void cpumask_andnot(cpumask_t* dst, const cpumask_t* a, const cpumask_t* b)
+{
+    for (size_t i = 0; i < CPUMASK_WORDS; i++) {
+        dst->words[i] = a->words[i] & ~b->words[i];
+    }
+}
+
+/* First cpu of the mask at or after cpu, or PLAT_CPU_NUM if there is none */
+static inline cpuid_t cpumask_next(const cpumask_t* mask, cpuid_t cpu)
+{
+    size_t i = cpu / CPUMASK_WORD_BITS;
+    if (i >= CPUMASK_WORDS) {
+        return PLAT_CPU_NUM;
+    }
+
+    unsigned long word = mask->words[i] & ~((1UL << (cpu % CPUMASK_WORD_BITS)) - 1);
+    while (word == 0) {
+        if (++i >= CPUMASK_WORDS) {
+            return PLAT_CPU_NUM;
+        }
+        word = mask->words[i];
+    }
+
+    cpuid_t next = (i * CPUMASK_WORD_BITS) + bit_ctz(word);
+    return (next < PLAT_CPU_NUM) ? next : PLAT_CPU_NUM;
+}
+
+#define cpumask_foreach(mask, cpu)                                  \
+    for (cpuid_t cpu = cpumask_next((mask), 0); cpu < PLAT_CPU_NUM; \
+         cpu = cpumask_next((mask), cpu + 1))
+
+static inline cpumask_t cpumask_from_map(cpumap_t map)
+{
+    cpumask_t mask = CPUMASK_EMPTY;
+    mask.words[0] = (PLAT_CPU_NUM < CPUMASK_WORD_BITS) ? (map & BIT_MASK(0, PLAT_CPU_NUM)) : map;
+    return mask;
+}
+
+/* Only the first word's cpus, for interfaces which can not address more */
+static inline cpumap_t cpumask_to_map(const cpumask_t* mask)
+{
+    return mask->words[0];
+}
+
+#endif /* __CPUMASK_H__ */
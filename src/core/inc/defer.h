@@ -0,0 +1,36 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __DEFER_H__
+#define __DEFER_H__
+
+#include <bao.h>
+
+/**
+ * Work not urgent enough to hold up the exit or message that brought it, e.g. writing out the
+ * console, is queued on the cpu and run on its way back to the guest, within DEFER_BUDGET_NS, or
+ * all of it once the cpu idles. Work left over past the budget waits for the next exit. Queuing
+ * work already pending, i.e., the same handler and data, is a no-op.
+ *
+ * Only the cpu itself queues and runs its work, with interrupts masked, so the queue needs no
+ * locking. Work is only deferred on cpus that have run their queue once, as the others, e.g.
+ * still booting, might never get to run it. Otherwise, and when the queue is full, defer_work
+ * returns false and the caller does the work right away.
+ */
+#ifndef DEFER_QUEUE_SIZE
+#define DEFER_QUEUE_SIZE (16)
+#endif
+
+#ifndef DEFER_BUDGET_NS
+#define DEFER_BUDGET_NS (20000)
+#endif
+
+typedef void (*defer_handler_t)(uint64_t data);
+
+bool defer_work(defer_handler_t handler, uint64_t data);
+void defer_run(void);
+void defer_flush(void);
+
+#endif /* __DEFER_H__ */
@@ -0,0 +1,28 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __DIRTY_LOG_H__
+#define __DIRTY_LOG_H__
+
+#include <bao.h>
+#include <hypercall.h>
+
+/**
+ * HC_DIRTY_LOG(op, arg1, arg2) logs the writes to a range of the caller's own memory, write
+ * protecting its stage 2 entries (see vm_mem_dirty_log_start). Where the cpus manage the dirty
+ * state in hardware (FEAT_HAFDBS, Svadu), logged writes take no exit. Otherwise, the first write
+ * to each page after it is protected faults into the hypervisor.
+ *   DIRTY_LOG_START(base, num_pages) starts logging the num_pages pages from base. Vms with
+ *   dma devices are refused.
+ *   DIRTY_LOG_COLLECT(bitmap_ipa, size) fills the size bytes buffer at bitmap_ipa with a bit per
+ *   page of the range, set for the pages written since the last collection, protects them again
+ *   and returns their number.
+ *   DIRTY_LOG_STOP() gives the range its write permissions back.
+ */
+enum { DIRTY_LOG_START = 0, DIRTY_LOG_COLLECT = 1, DIRTY_LOG_STOP = 2 };
+
+long int dirty_log_hypercall(unsigned long op, unsigned long arg1, unsigned long arg2);
+
+#endif /* __DIRTY_LOG_H__ */
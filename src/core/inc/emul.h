@@ -27,6 +27,8 @@ struct emul_mem {
     vaddr_t va_base;
     size_t size;
     emul_handler_t handler;
+    /* Index of the emulator in the order it was added to the vm */
+    size_t id;
 };
 
 struct emul_reg {
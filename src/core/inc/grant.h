@@ -0,0 +1,51 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef GRANT_H
+#define GRANT_H
+
+#include <bao.h>
+
+/**
+ * Grants let a vm lend a range of its own memory pages to another vm for the duration of a
+ * transfer, without copies or a fixed shared window:
+ *
+ *  - lend(ipa, num_pages, target_vm): the lender creates the grant, returns its id;
+ *  - map(grant_id, ipa): the target maps the granted pages at ipa in its address space;
+ *  - unmap(grant_id): the target drops the mapping;
+ *  - revoke(grant_id): the lender releases the grant, only once the target unmapped it.
+ *
+ * The lender keeps its own mapping of the pages throughout. Only pages private to the lender and
+ * writable by it can be lent.
+ */
+
+#ifndef GRANT_TABLE_SIZE
+#define GRANT_TABLE_SIZE (64)
+#endif
+
+#ifndef GRANT_MAX_PAGES
+#define GRANT_MAX_PAGES (1024)
+#endif
+
+/* Maximum number of physically contiguous runs backing a single grant */
+#ifndef GRANT_MAX_RUNS
+#define GRANT_MAX_RUNS (16)
+#endif
+
+unsigned long grant_lend_hypercall(unsigned long ipa, unsigned long num_pages,
+    unsigned long target_vm);
+unsigned long grant_map_hypercall(unsigned long grant_id, unsigned long ipa, unsigned long arg2);
+unsigned long grant_unmap_hypercall(unsigned long grant_id, unsigned long arg1,
+    unsigned long arg2);
+unsigned long grant_revoke_hypercall(unsigned long grant_id, unsigned long arg1,
+    unsigned long arg2);
+
+/* Whether the vm lends pages through any grant, which pins their physical addresses */
+bool grant_vm_lends(vmid_t vm_id);
+
+struct vm;
+void grant_vm_release(struct vm* vm);
+
+#endif /* GRANT_H */
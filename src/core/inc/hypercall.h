@@ -9,13 +9,103 @@
 #include <bao.h>
 #include <arch/hypercall.h>
 
-enum { HC_INVAL = 0, HC_IPC = 1 };
+enum {
+    HC_INVAL = 0,
+    HC_IPC = 1,
+    HC_IO_FAULTS = 2,
+    HC_GRANT_LEND = 3,
+    HC_GRANT_MAP = 4,
+    HC_GRANT_UNMAP = 5,
+    HC_GRANT_REVOKE = 6,
+    HC_MULTICALL = 7,
+    HC_TRACE = 8,
+    HC_PROF = 9,
+    HC_VM_RECOLOR = 10,
+    HC_IPI = 11,
+    HC_STATS = 12,
+    HC_LOCK_PROF = 13,
+    HC_DIRTY_LOG = 14,
+    HC_VM_SNAPSHOT = 15,
+    HC_QUEUE = 16,
+    HC_VM_CTL = 17,
+    HC_LIVE_UPDATE = 18,
+    HC_VM_QOS = 19,
+};
 
 enum { HC_E_SUCCESS = 0, HC_E_FAILURE = 1, HC_E_INVAL_ID = 2, HC_E_INVAL_ARGS = 3 };
 
 typedef unsigned long (*hypercall_handler)(unsigned long arg0, unsigned long arg1,
     unsigned long arg2);
 
+/**
+ * A multicall executes an array of these descriptors, which must lie within a single page of guest
+ * ram, in sequence. The result of each call is written back to its ret field. Hypercalls that
+ * return values through registers (HC_IO_FAULTS) and nested multicalls are rejected.
+ */
+struct hc_multicall_entry {
+    uint64_t id;
+    uint64_t args[3];
+    int64_t ret;
+};
+
+/**
+ * A vm configured with a hypercall queue address is given a page there holding a submission and a
+ * completion queue, through which it issues hypercalls without trapping. The guest fills the
+ * submission entry at sq_tail and then advances it. The hypervisor runs the submitted requests in
+ * order, up to HC_QUEUE_BATCH of them on each exit of one of the vm's vcpus, and posts the result
+ * of each, along with its user_data, at cq_tail, which the guest consumes advancing cq_head.
+ * Requests are held back while the completion queue is full.
+ *
+ * A guest not wanting to wait for the next exit rings the doorbell, the HC_QUEUE hypercall, which
+ * runs all the submitted requests and returns how many it ran. Requests are run as if issued by the
+ * vcpu of the cpu running them. The hypercalls rejected by multicalls, and HC_QUEUE itself, are
+ * rejected here too. The indexes are free running, the position in each queue being the index
+ * modulo HC_QUEUE_SIZE.
+ */
+#define HC_QUEUE_MAGIC (0x5143484f4142ULL) /* "BAOHCQ" */
+
+#ifndef HC_QUEUE_SIZE
+#define HC_QUEUE_SIZE (64)
+#endif
+
+#ifndef HC_QUEUE_BATCH
+#define HC_QUEUE_BATCH (8)
+#endif
+
+#if (HC_QUEUE_SIZE & (HC_QUEUE_SIZE - 1)) != 0
+#error "HC_QUEUE_SIZE must be a power of 2"
+#endif
+
+struct hc_queue_sqe {
+    uint64_t id;
+    uint64_t args[3];
+    uint64_t user_data;
+};
+
+struct hc_queue_cqe {
+    uint64_t user_data;
+    int64_t ret;
+};
+
+struct hc_queue {
+    uint64_t magic;
+    uint32_t size;
+    uint32_t res;
+    /* Written by the guest */
+    volatile uint32_t sq_tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile uint32_t cq_head;
+    /* Written by the hypervisor */
+    volatile uint32_t sq_head __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile uint32_t cq_tail;
+    struct hc_queue_sqe sq[HC_QUEUE_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct hc_queue_cqe cq[HC_QUEUE_SIZE];
+};
+
+struct vm;
+struct vm_config;
+
 long int hypercall(unsigned long id);
+void hypercall_queue_vm_init(struct vm* vm, const struct vm_config* config);
+void hypercall_queue_poll(void);
 
 #endif /* HYPERCALL_H */
@@ -23,5 +23,10 @@ void io_init();
 /* iommu api for vms. */
 bool io_vm_init(struct vm* vm, const struct vm_config* config);
 bool io_vm_add_device(struct vm* vm, deviceid_t dev_id);
+void io_vm_commit(struct vm* vm);
+
+/* iommu fault accounting, reported by the arch iommu drivers and queried by vms. */
+void io_fault_report(deviceid_t dev_id, unsigned long cause, unsigned long addr);
+unsigned long io_fault_hypercall(unsigned long dev_id, unsigned long nth, unsigned long arg2);
 
 #endif /* IO_H_ */
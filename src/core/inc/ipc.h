@@ -8,6 +8,7 @@
 
 #include <bao.h>
 #include <mem.h>
+#include <emul.h>
 
 struct ipc {
     paddr_t base;
@@ -15,12 +16,24 @@ struct ipc {
     size_t shmem_id;
     size_t interrupt_num;
     irqid_t* interrupts;
+    /* The vcpu the interrupts are injected in when another vm notifies this ipc */
+    vcpuid_t notify_vcpu;
+    /**
+     * Guest address of a page of doorbells, or 0 for none. A write of any value to its n-th word
+     * notifies event n of the ipc to the other vms, as the ipc hypercall would.
+     */
+    vaddr_t doorbell;
+    struct emul_mem doorbell_emul;
 };
 
 struct vm_config;
+struct vcpu;
 
 unsigned long ipc_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2);
 void ipc_init();
 struct shmem* ipc_get_shmem(size_t shmem_id);
+bool ipc_vm_shares_shmem(const struct vm_config* vm_config, size_t shmem_id);
+bool ipc_doorbell_write(struct vcpu* vcpu, vaddr_t addr);
+bool ipc_doorbell_emul_handler(struct emul_access* acc);
 
 #endif /* IPC_H */
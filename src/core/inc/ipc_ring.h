@@ -0,0 +1,43 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef IPC_RING_H
+#define IPC_RING_H
+
+#include <bao.h>
+
+/**
+ * Layout of the header at the base of a shared memory configured as a single-producer
+ * single-consumer ring. The slots following the header and their format are up to the guests.
+ * Indices are free running and only wrap at 2^32.
+ *
+ * Notifications are suppressed event index style: each side publishes the index of the other side
+ * after which it wants to be notified, and the other side only issues the ipc hypercall once its
+ * index moves past it. A consumer can batch notifications by setting its event index ahead of the
+ * last head it has seen. The hypervisor applies the same check to every ipc hypercall on a ring,
+ * so notifications nobody asked for never reach the other vm.
+ */
+#define IPC_RING_CACHE_LINE (64)
+
+struct ipc_ring {
+    /* Written by the producer */
+    volatile uint32_t head;
+    volatile uint32_t tail_event;
+    uint8_t res0[IPC_RING_CACHE_LINE - (2 * sizeof(uint32_t))];
+    /* Written by the consumer */
+    volatile uint32_t tail;
+    volatile uint32_t head_event;
+    uint8_t res1[IPC_RING_CACHE_LINE - (2 * sizeof(uint32_t))];
+};
+
+/**
+ * Check if an index moving from old_idx to new_idx went past the event index.
+ */
+static inline bool ipc_ring_need_event(uint32_t event, uint32_t new_idx, uint32_t old_idx)
+{
+    return (uint32_t)(new_idx - event - 1) < (uint32_t)(new_idx - old_idx);
+}
+
+#endif /* IPC_RING_H */
@@ -0,0 +1,29 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __IRQ_LIMIT_H__
+#define __IRQ_LIMIT_H__
+
+#include <bao.h>
+
+#ifndef IRQ_LIMIT_DEFAULT_PERIOD_US
+#define IRQ_LIMIT_DEFAULT_PERIOD_US (1000)
+#endif
+
+struct vcpu;
+
+void irq_limit_vcpu_init(struct vcpu* vcpu);
+void irq_limit_vcpu_set(uint32_t budget, uint32_t period_us);
+bool irq_limit_take(irqid_t int_id);
+
+/**
+ * May be implemented by the architecture to mask a deferred interrupt at the physical interrupt
+ * controller, where leaving it unacknowledged does not keep it from firing again. Unmasking must
+ * leave the interrupt masked if the guest has disabled it meanwhile. The default implementation
+ * does nothing.
+ */
+void irq_limit_arch_mask(irqid_t int_id, bool mask);
+
+#endif /* __IRQ_LIMIT_H__ */
@@ -0,0 +1,63 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __LIVE_UPDATE_H__
+#define __LIVE_UPDATE_H__
+
+#include <bao.h>
+#include <snapshot.h>
+
+/**
+ * HC_LIVE_UPDATE() lets a vm manager hand the running vms over to a new hypervisor image, e.g. one
+ * the platform's bootloader picks up on its next boot, without rebooting them. Once all cpus are
+ * held, the vcpus' registers and the virtual interrupt controllers' configuration are saved, in
+ * the layout of the vms' snapshots, to the platform's live update area, which must be kept across
+ * a warm reset, and the vms' memory is cleaned to the point of coherency. The platform is then warm
+ * reset, e.g., through PSCI SYSTEM_RESET2, as a cold one need not keep memory, the update being
+ * aborted if the firmware has no warm reset. The new image builds the vms from the config as
+ * usual, but keeps the memory of the vms found in the area instead of installing their images, and
+ * resumes them where they were stopped.
+ *
+ * The vms' page tables, iommu contexts and devices are set up again from the config, which must be
+ * the same for both images. Only vms configured with snapshot whose memory and shared memories are
+ * all placed at fixed physical addresses can be resumed, the others, and those whose arch does not
+ * support snapshots, are booted afresh. Pending and active interrupts are lost, as with snapshots,
+ * and devices are left to the guests' drivers, as the reset might reset them. The call returns
+ * once the update is scheduled and fails if the platform has no live update area. It must not be
+ * issued while the manager has other operations on vms pending.
+ */
+#define LIVE_UPDATE_MAGIC   (0x445055564c4f4142ULL) /* "BAOLVUPD" */
+#define LIVE_UPDATE_VERSION (1)
+
+struct live_update_vm {
+    bool saved;
+    size_t cpu_num;
+    /* Of the vm's memory layout, which must not have changed for the vm to be resumed */
+    uint64_t fingerprint;
+    /* Offset from the record of the data its arch snapshot points to */
+    size_t arch_data_off;
+    size_t arch_data_size;
+    struct vm_arch_snapshot arch;
+    struct vcpu_snapshot vcpus[];
+};
+
+struct live_update_hdr {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t vm_num;
+    /* The sizes of the records, which both images must agree on */
+    uint64_t layout;
+    /* Size of each vm's slot, the first one following the header's page */
+    size_t slot_size;
+};
+
+struct vm;
+
+void live_update_init(void);
+bool live_update_vm_resumed(struct vm* vm);
+void live_update_vm_resume(struct vm* vm);
+long int live_update_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2);
+
+#endif /* __LIVE_UPDATE_H__ */
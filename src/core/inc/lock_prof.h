@@ -0,0 +1,34 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __LOCK_PROF_H__
+#define __LOCK_PROF_H__
+
+#include <bao.h>
+#include <hypercall.h>
+
+#ifdef LOCK_PROF
+
+/* Callsites tracked per cpu. Acquisitions from further callsites are only counted as dropped. */
+#ifndef LOCK_PROF_SITES
+#define LOCK_PROF_SITES (128)
+#endif
+
+void lock_prof_dump(void);
+long int lock_prof_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2);
+
+#else
+
+static inline void lock_prof_dump(void) { }
+
+static inline long int lock_prof_hypercall(unsigned long arg0, unsigned long arg1,
+    unsigned long arg2)
+{
+    return -HC_E_INVAL_ID;
+}
+
+#endif
+
+#endif /* __LOCK_PROF_H__ */
@@ -12,9 +12,20 @@
 #include <spinlock.h>
 #include <cache.h>
 #include <bitmap.h>
+#include <platform_defs.h>
+#include <cpumask.h>
 
 #ifndef __ASSEMBLER__
 
+/**
+ * Cacheability of the vm's accesses to one of its memory regions or shared memories. Non cacheable
+ * memory, e.g. for frame buffers or streaming buffers shared with devices, is still normal memory,
+ * which the architecture may gather writes to. Inner only memory is not cached in the outer cache
+ * levels, e.g. a system level cache. Where an architecture can not restrict the vm's accesses as
+ * such, the memory is left cacheable.
+ */
+enum mem_cacheability { MEM_CACHE_WB, MEM_CACHE_NC, MEM_CACHE_INNER };
+
 struct ppages {
     paddr_t base;
     size_t num_pages;
@@ -28,25 +39,116 @@ struct page_pool {
     size_t free;
     size_t last;
     bitmap_t* bitmap;
-    spinlock_t lock;
+    /**
+     * Buddy index over the page bitmap used to find large and naturally aligned free blocks.
+     * Each leaf covers one bitmap granule and each node holds 1 + log2 of the largest free, aligned
+     * block of leaves in its subtree (0 if there is none). The first off leaves are padding to keep
+     * blocks physically aligned.
+     */
+    struct {
+        uint8_t* tree;
+        size_t leaves;
+        size_t off;
+    } buddy;
+    mcslock_t lock;
+    /* Copied from the pool's region, see struct mem_region */
+    size_t tier;
+    size_t controller;
+    size_t numa_node;
 };
 
 struct mem_region {
     paddr_t base;
     size_t size;
+    /**
+     * The region's speed, lower tiers being faster, e.g. on-chip memory at tier 0 and dram at tier
+     * 1, and the memory controller serving it, matched by the struct mem_place policies.
+     */
+    size_t tier;
+    size_t controller;
+    /**
+     * The numa node the region is local to, i.e., the node of the cpus closest to it, see
+     * platform.cpu_nodes. Allocations are served from the allocating cpu's node first.
+     */
+    size_t numa_node;
     struct page_pool page_pool;
 };
 
+/**
+ * How a shared memory not placed at a fixed physical address is colored. By default it gets the
+ * colors given in its colors field, e.g. a communication color left unused by the vms. Otherwise,
+ * it gets the colors common to all the vms sharing it, or the colors of any of them, so that their
+ * traffic stays within their own cache partitions.
+ */
+enum shmem_colors { SHMEM_COLORS_FIXED, SHMEM_COLORS_INTERSECT, SHMEM_COLORS_UNION };
+
+/**
+ * A shared memory may instead hold the hypervisor's exit trace stream (see trace.h), whose per cpu
+ * rings either drop new records or overwrite the oldest when full.
+ */
+enum shmem_trace { SHMEM_TRACE_NONE, SHMEM_TRACE_DROP, SHMEM_TRACE_OVERWRITE };
+
 struct shmem {
     size_t size;
     colormap_t colors;
+    enum shmem_colors color_placement;
+    /* Not applied to shared memories holding a ring, which the hypervisor also accesses */
+    enum mem_cacheability cacheability;
     bool place_phys;
     union {
         paddr_t base;
         paddr_t phys;
     };
-    cpumap_t cpu_masters;
+    /* The shared memory starts with a struct ipc_ring header */
+    bool ring;
+    enum shmem_trace trace;
+    /**
+     * The physical cpus notified on an ipc hypercall on this shared memory, one per sharing vm,
+     * and the ipc object of that vm each of them injects the interrupt for.
+     */
+    cpumask_t notify_cpus;
+    struct ipc* notify_ipc[PLAT_CPU_NUM];
     spinlock_t lock;
+    struct ipc_ring* ring_hdr;
+    uint32_t ring_head;
+    uint32_t ring_tail;
+    /* Events rung through a doorbell whose notification is yet to be delivered */
+    uint32_t doorbell_pend;
+};
+
+static inline mem_flags_t mem_vm_flags(enum mem_cacheability cacheability)
+{
+    switch (cacheability) {
+        case MEM_CACHE_NC:
+            return PTE_VM_NC_FLAGS;
+        case MEM_CACHE_INNER:
+            return PTE_VM_INNER_FLAGS;
+        default:
+            return PTE_VM_FLAGS;
+    }
+}
+
+#define MEM_PAGE_CACHE_SIZE_DEFAULT (16)
+#ifndef MEM_PAGE_CACHE_SIZE
+#define MEM_PAGE_CACHE_SIZE MEM_PAGE_CACHE_SIZE_DEFAULT
+#endif
+
+#define MEM_PAGE_CACHE_NUM (2)
+
+/**
+ * Per-cpu cache of single physical pages, refilled in bulk from the page pools so that most
+ * single page allocations do not need to take a pool lock. Each cache holds pages of a single
+ * color set, so that hypervisor and VM allocations with different colors do not thrash each other.
+ */
+struct mem_page_cache {
+    colormap_t colors;
+    size_t num;
+    paddr_t pages[MEM_PAGE_CACHE_SIZE];
+};
+
+struct mem_page_caches {
+    struct mem_page_cache cache[MEM_PAGE_CACHE_NUM];
+    size_t victim;
 };
 
 static inline struct ppages mem_ppages_get(paddr_t base, size_t num_pages)
@@ -54,34 +156,188 @@ static inline struct ppages mem_ppages_get(paddr_t base, size_t num_pages)
     return (struct ppages){ .colors = 0, .base = base, .num_pages = num_pages };
 }
 
+static inline colormap_t clrs_banks(colormap_t clrs)
+{
+    return (clrs >> COLOR_BANK_OFF) & BIT_MASK(0, COLOR_BANK_NUM);
+}
+
+/* Whether the colors restrict the banks, i.e., hold some but not all of them */
+static inline bool clrs_bank_colored(colormap_t clrs)
+{
+    colormap_t banks = clrs_banks(clrs);
+    return (banks != 0) && (banks != BIT_MASK(0, COLOR_BANK_NUM));
+}
+
+/* The colormap bits that mean anything on this platform */
+static inline colormap_t clrs_mask(void)
+{
+    return BIT_MASK(0, COLOR_NUM) | (BIT_MASK(0, COLOR_BANK_NUM) << COLOR_BANK_OFF);
+}
+
+/**
+ * Fills in either dimension the colors leave unrestricted, i.e., empty or full, with all of its
+ * colors, for colormaps to be intersected and merged dimension by dimension.
+ */
+static inline colormap_t clrs_fill(colormap_t clrs)
+{
+    colormap_t cache = clrs & BIT_MASK(0, COLOR_NUM);
+    colormap_t banks = clrs_banks(clrs);
+    if (cache == 0) {
+        cache = BIT_MASK(0, COLOR_NUM);
+    }
+    if (banks == 0) {
+        banks = BIT_MASK(0, COLOR_BANK_NUM);
+    }
+    return cache | (banks << COLOR_BANK_OFF);
+}
+
 static inline bool all_clrs(colormap_t clrs)
 {
     colormap_t mask = (((colormap_t)1) << COLOR_NUM) - 1;
     colormap_t masked_colors = clrs & mask;
-    return (masked_colors == 0) || (masked_colors == mask);
+    return ((masked_colors == 0) || (masked_colors == mask)) && !clrs_bank_colored(clrs);
+}
+
+static inline size_t pp_bank(paddr_t pa)
+{
+    size_t bank = 0;
+    for (size_t i = 0; i < COLOR_BANK_BITS; i++) {
+        bank |= (size_t)(bit64_popcount(pa & COLOR_BANK_MASKS[i]) & 1) << i;
+    }
+    return bank;
+}
+
+/* Whether the page at pa is of the given colors, in both dimensions */
+static inline bool pp_clr_match(paddr_t pa, colormap_t colors)
+{
+    colormap_t cache = colors & BIT_MASK(0, COLOR_NUM);
+    size_t color = ((pa / PAGE_SIZE) / COLOR_SIZE) % COLOR_NUM;
+    return ((cache == 0) || bit_get(cache, color)) &&
+        (!clrs_bank_colored(colors) || bit_get(clrs_banks(colors), pp_bank(pa)));
+}
+
+/**
+ * Pages of a given color come in chunks of COLOR_SIZE contiguous pages, repeating every COLOR_NUM
+ * chunks. Instead of testing page by page, the helpers below jump straight to the next chunk of
+ * a target color and operate on whole chunks at a time. Bank colored chunks are further split
+ * in runs of COLOR_BANK_SIZE pages of the same bank, which pp_next_bank_clr skips over.
+ */
+static inline size_t pp_clr_offset(paddr_t base)
+{
+    return (base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
+}
+
+/* The index, from base, of the first page of the bank run following the one of index */
+static inline size_t pp_bank_run_end(paddr_t base, size_t index)
+{
+    size_t page = (base / PAGE_SIZE) + index;
+    return (((page / COLOR_BANK_SIZE) + 1) * COLOR_BANK_SIZE) - (base / PAGE_SIZE);
+}
+
+static inline size_t pp_next_cache_clr(paddr_t base, size_t from, colormap_t colors)
+{
+    size_t clr_offset = pp_clr_offset(base);
+    size_t chunk = (from + clr_offset) / COLOR_SIZE;
+    size_t color = chunk % COLOR_NUM;
+    colormap_t mask = colors & BIT_MASK(0, COLOR_NUM);
+    size_t next_color;
+
+    if ((mask == 0) || bit_get(mask, color)) {
+        return from;
+    }
+
+    colormap_t higher = mask & ~BIT_MASK(0, color + 1);
+    if (higher != 0) {
+        next_color = bit_ctz(higher);
+    } else {
+        next_color = COLOR_NUM + bit_ctz(mask);
+    }
+
+    return ((chunk + (next_color - color)) * COLOR_SIZE) - clr_offset;
+}
+
+size_t pp_next_bank_clr(paddr_t base, size_t from, colormap_t colors);
+
+/**
+ * Returns the index, from base, of the first page of the given colors from index from on, or
+ * (size_t)-1 if there is none, i.e., if the cache colors and the banks never meet.
+ */
+static inline size_t pp_next_clr(paddr_t base, size_t from, colormap_t colors)
+{
+    size_t index = pp_next_cache_clr(base, from, colors);
+    if (!clrs_bank_colored(colors)) {
+        return index;
+    }
+    return pp_next_bank_clr(base, index, colors);
+}
+
+static inline size_t pp_clr_chunk_end(paddr_t base, size_t index, colormap_t colors)
+{
+    size_t clr_offset = pp_clr_offset(base);
+    size_t end = ((((index + clr_offset) / COLOR_SIZE) + 1) * COLOR_SIZE) - clr_offset;
+    if (clrs_bank_colored(colors)) {
+        end = min(end, pp_bank_run_end(base, index));
+    }
+    return end;
 }
 
 void mem_init(paddr_t load_addr);
 void* mem_alloc_page(size_t num_pages, enum AS_SEC sec, bool phys_aligned);
 struct ppages mem_alloc_ppages(colormap_t colors, size_t num_pages, bool aligned);
+struct ppages mem_alloc_ppages_place(const struct mem_place* place, colormap_t colors,
+    size_t num_pages, bool aligned);
 vaddr_t mem_alloc_map(struct addr_space* as, enum AS_SEC section, struct ppages* page, vaddr_t at,
     size_t num_pages, mem_flags_t flags);
 vaddr_t mem_alloc_map_dev(struct addr_space* as, enum AS_SEC section, vaddr_t at, paddr_t pa,
     size_t size);
 void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_ppages);
+vaddr_t mem_alloc_inflate(struct addr_space* as, enum AS_SEC section, vaddr_t at,
+    size_t num_pages);
+bool mem_map_share(struct addr_space* as, vaddr_t va, size_t num_pages, mem_flags_t flags,
+    size_t share, size_t num_shares);
 bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t num_pages,
     mem_flags_t flags);
 vaddr_t mem_map_cpy(struct addr_space* ass, struct addr_space* asd, vaddr_t vas, vaddr_t vad,
     size_t num_pages);
 bool pp_alloc(struct page_pool* pool, size_t num_pages, bool aligned, struct ppages* ppages);
+size_t pp_metadata_num_pages(paddr_t base, size_t size);
+void pp_buddy_update(struct page_pool* pool, size_t index, size_t num_pages);
+void pp_buddy_init(struct page_pool* pool);
+bool pp_alloc_clr(struct page_pool* pool, size_t num_pages, colormap_t colors,
+    struct ppages* ppages);
 
 void mem_prot_init();
 size_t mem_cpu_boot_alloc_size();
+void mem_free_ppages(struct ppages* ppages);
+void mem_reclaim_init(void);
+void mem_fast_place(void);
+
+/**
+ * Zero num_pages whole pages, mapped contiguously starting at the page aligned base. Architectures
+ * may override it to use cache block zeroing instructions which avoid fetching the old contents of
+ * the lines from memory.
+ */
+void mem_zero_pages(void* base, size_t num_pages);
 
 /* Functions implemented in architecture dependent files */
 
 void as_arch_init(struct addr_space* as);
+
+/* Functions implemented by the memory protection model */
+
 bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa);
+/**
+ * Translates va of a vm's address space for the hypervisor to write to on the vm's behalf, failing
+ * if the vm may not write there itself. A dirty logged page is marked dirty as a write by the vm
+ * would.
+ */
+bool mem_translate_writable(struct addr_space* as, vaddr_t va, paddr_t* pa);
+/**
+ * Translates va, returning its pa and the number of bytes of the size bytes starting at va mapped
+ * physically contiguous from there, or zero if va is not mapped. Bulk operations go through a
+ * range in runs, translating each just once.
+ */
+size_t mem_translate_range(struct addr_space* as, vaddr_t va, size_t size, paddr_t* pa);
 
 extern struct list page_pool_list;
 
@@ -0,0 +1,32 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __MEMBW_H__
+#define __MEMBW_H__
+
+#include <bao.h>
+#include <interrupts.h>
+
+#ifndef MEMBW_DEFAULT_PERIOD_US
+#define MEMBW_DEFAULT_PERIOD_US (1000)
+#endif
+
+struct vcpu;
+
+void membw_init(void);
+void membw_vcpu_init(struct vcpu* vcpu);
+bool membw_vcpu_set(uint32_t budget, uint32_t period_us);
+bool membw_throttled(void);
+
+/**
+ * Must be implemented by the architecture, which counts the guest's memory traffic and raises the
+ * handler once the budget given to membw_arch_start is exhausted. The default implementation
+ * reports regulation as unsupported.
+ */
+bool membw_arch_init(irq_handler_t handler);
+void membw_arch_start(uint32_t budget);
+bool membw_arch_ack(void);
+
+#endif /* __MEMBW_H__ */
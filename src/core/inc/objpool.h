@@ -8,26 +8,39 @@
 
 #include <bao.h>
 #include <bitmap.h>
-#include <arch/spinlock.h>
+#include <spinlock.h>
 
+/**
+ * Objects are handed out first by bumping the watermark and, once freed, recycled through an
+ * intrusive free list that stores the link in the freed object itself. This keeps both alloc and
+ * free constant-time. The bitmap only tracks which objects are allocated, to catch stray frees.
+ */
 struct objpool {
     void* pool;
     bitmap_t* bitmap;
     size_t objsize;
     size_t num;
     size_t count;
-    spinlock_t lock;
+    size_t watermark;
+    void* free_list;
+    mcslock_t lock;
 };
 
-#define OBJPOOL_ALLOC(NAME, TYPE, N)         \
-    TYPE _##NAME##_array[N];                 \
-    BITMAP_ALLOC(_##NAME##_array_bitmap, N); \
-    struct objpool NAME = {                  \
-        .pool = _##NAME##_array,             \
-        .bitmap = _##NAME##_array_bitmap,    \
-        .objsize = sizeof(TYPE),             \
-        .num = N,                            \
-        .lock = SPINLOCK_INITVAL,            \
+#define OBJPOOL_ALLOC(NAME, TYPE, N)           \
+    union {                                    \
+        TYPE obj;                              \
+        void* next;                            \
+    } _##NAME##_array[N];                      \
+    BITMAP_ALLOC(_##NAME##_array_bitmap, N);   \
+    struct objpool NAME = {                    \
+        .pool = _##NAME##_array,               \
+        .bitmap = _##NAME##_array_bitmap,      \
+        .objsize = sizeof(_##NAME##_array[0]), \
+        .num = N,                              \
+        .count = 0,                            \
+        .watermark = 0,                        \
+        .free_list = NULL,                     \
+        .lock = MCSLOCK_INITVAL,               \
     }
 
 void objpool_init(struct objpool* objpool);
@@ -11,6 +11,9 @@
 
 #ifndef __ASSEMBLER__
 
+/* Upper bound on the number of translation levels of any supported scheme */
+#define PT_LVLS_MAX (4)
+
 struct page_table_dscr {
     size_t lvls;
     size_t* lvl_off;
@@ -69,6 +72,8 @@ bool pte_check_rsw(pte_t* pte, pte_t flag);
 bool pte_valid(pte_t* pte);
 bool pte_table(struct page_table* pt, pte_t* pte, size_t lvl);
 bool pte_page(struct page_table* pt, pte_t* pte, size_t lvl);
+/* Number of entries a contiguous (or NAPOT) run spans at lvl, 0 if not supported */
+size_t pt_contig_num(struct page_table* pt, size_t lvl);
 
 #endif /* __ASSEMBLER__ */
 
@@ -27,9 +27,86 @@ struct platform {
 
     struct cache cache;
 
+    /**
+     * On-chip memory, e.g. ocm or tcm, the hypervisor's hot text is moved to with FAST_MEM. It
+     * must not overlap the memory regions.
+     */
+    struct {
+        paddr_t base;
+        size_t size;
+    } fast_mem;
+
+    /**
+     * Memory outside the memory regions and kept across a warm reset, where a live update hands
+     * the vms' state over to the hypervisor image booted next, see live_update.h.
+     */
+    struct {
+        paddr_t base;
+        size_t size;
+    } live_update;
+
+    /**
+     * Bit i of the dram bank a physical address falls in is the parity of the address bits set in
+     * bank_masks[i], which describes both plain and xor hashed bank bits. Platforms leaving it
+     * empty are a single bank.
+     */
+    struct {
+        size_t bank_bit_num;
+        paddr_t bank_masks[COLOR_BANK_BITS_MAX];
+    } dram;
+
+    /**
+     * The numa node of each cpu, matched against the memory regions' nodes, or NULL if the
+     * platform is a single node.
+     */
+    const size_t* cpu_nodes;
+
     struct arch_platform arch;
 };
 
 extern struct platform platform;
 
+static inline size_t platform_cpu_node(cpuid_t cpuid)
+{
+    return (platform.cpu_nodes != NULL) ? platform.cpu_nodes[cpuid] : 0;
+}
+
+/**
+ * The cluster of a cpu, i.e., the set of cpus sharing a last level cache with it. Cluster ids are
+ * dense and smaller than the platform's cpu_num. Platforms without topology information are a
+ * single cluster.
+ */
+size_t platform_cpu_cluster(cpuid_t cpuid);
+
+static inline bool platform_is_mem(paddr_t pa)
+{
+    for (size_t i = 0; i < platform.region_num; i++) {
+        struct mem_region* reg = &platform.regions[i];
+        if ((pa >= reg->base) && (pa < (reg->base + reg->size))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Whether the whole range is memory, possibly spanning adjacent regions */
+static inline bool platform_is_mem_range(paddr_t pa, size_t size)
+{
+    paddr_t top = pa + size;
+    while (pa < top) {
+        size_t i = 0;
+        for (; i < platform.region_num; i++) {
+            struct mem_region* reg = &platform.regions[i];
+            if ((pa >= reg->base) && (pa < (reg->base + reg->size))) {
+                pa = reg->base + reg->size;
+                break;
+            }
+        }
+        if (i == platform.region_num) {
+            return false;
+        }
+    }
+    return true;
+}
+
 #endif /* __PLATFORM_H__ */
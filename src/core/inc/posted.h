@@ -0,0 +1,53 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __POSTED_H__
+#define __POSTED_H__
+
+#include <bao.h>
+
+/**
+ * A vm's posted interrupts are not injected through its virtual interrupt controller. When one
+ * fires, the hypervisor sets its bit in a pending page shared with the guest and acknowledges the
+ * physical interrupt on the guest's behalf, so a guest busy polling the page sees it without a
+ * virtual interrupt, or even a world switch on the polling vcpu, if the interrupts are taken by
+ * another one of its vcpus.
+ *
+ * Interrupts are numbered by their position in the vm's config, which the page also lists. The
+ * guest clears an interrupt's pending bit with an atomic operation before servicing its device. As
+ * the physical interrupt is acknowledged once posted, a level triggered one keeps being posted
+ * until the device lowers it, so posting suits edge triggered interrupts best. The count of each
+ * interrupt, only ever incremented, tells a guest how many times it was posted.
+ *
+ * The guest must leave posted interrupts alone in its interrupt controller. The hypervisor enables
+ * them, targeting the cpu of the vcpu given in the config.
+ */
+#define POSTED_MAGIC   (0x4453544f504f4142ULL) /* "BAOPOSTD" */
+
+#ifndef POSTED_IRQ_MAX
+#define POSTED_IRQ_MAX (64)
+#endif
+
+#define POSTED_PENDING_WORDS ((POSTED_IRQ_MAX + 31) / 32)
+
+struct posted_page {
+    uint64_t magic;
+    uint32_t interrupt_num;
+    uint32_t res;
+    uint32_t interrupts[POSTED_IRQ_MAX];
+    /* Kept on a cache line of its own, the one the guest polls */
+    volatile uint32_t pending[POSTED_PENDING_WORDS] __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile uint64_t count[POSTED_IRQ_MAX] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct vm;
+struct vcpu;
+struct vm_config;
+
+void posted_vm_init(struct vm* vm, const struct vm_config* config);
+void posted_vcpu_init(struct vcpu* vcpu);
+void posted_irq_post(struct vm* vm, irqid_t int_id);
+
+#endif /* __POSTED_H__ */
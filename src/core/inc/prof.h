@@ -0,0 +1,76 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <bao.h>
+#include <hypercall.h>
+
+enum prof_site {
+    PROF_VGIC_ADD_LR,
+    PROF_VGIC_REFILL_LRS,
+    PROF_CPU_MSG_HANDLER,
+    PROF_VAPLIC_UPDATE_TOPI,
+    PROF_VM_EMUL_GET_MEM,
+    PROF_PP_ALLOC_CLR,
+    PROF_SITE_NUM
+};
+
+#ifdef PROF
+
+#include <arch/prof.h>
+
+/**
+ * Bucket i of the histogram counts the samples that took between 2^i and 2^(i+1) - 1 cycles. The
+ * last bucket also holds all longer samples.
+ */
+#define PROF_HIST_BUCKETS (16)
+
+struct prof_scope {
+    enum prof_site site;
+    uint64_t cycles;
+    uint64_t instrs;
+};
+
+static inline struct prof_scope prof_scope_begin(enum prof_site site)
+{
+    return (struct prof_scope){
+        .site = site,
+        .cycles = prof_arch_cycles(),
+        .instrs = prof_arch_instrs(),
+    };
+}
+
+void prof_scope_end(struct prof_scope* scope);
+
+/**
+ * Sample the cycle and retired instruction counters from this point until the end of the
+ * enclosing block, for every path leaving it. Only one scope per block is allowed.
+ */
+#define PROF_SCOPE(site)                                                            \
+    struct prof_scope __prof_scope __attribute__((cleanup(prof_scope_end), unused)) = \
+        prof_scope_begin(site)
+
+void prof_init(void);
+void prof_dump(void);
+long int prof_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2);
+
+#else
+
+#define PROF_SCOPE(site)
+
+static inline void prof_init(void) { }
+static inline void prof_dump(void) { }
+
+static inline long int prof_hypercall(unsigned long arg0, unsigned long arg1,
+    unsigned long arg2)
+{
+    return -HC_E_INVAL_ID;
+}
+
+#endif
+
+#endif /* __PROF_H__ */
@@ -0,0 +1,21 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __RECOLOR_H__
+#define __RECOLOR_H__
+
+#include <bao.h>
+#include <hypercall.h>
+
+/**
+ * HC_VM_RECOLOR(vm_id, colors) migrates the memory of a running vm to a new set of colors, e.g. to
+ * grow the cache share of a latency critical vm as the workload changes. The vm is paused for the
+ * duration of the migration, and vms with dma devices are refused. Only a vm configured as
+ * vm_manager can recolor other vms or move a vm onto any color. Any other vm may only recolor
+ * itself within its configured colors, so that it can not take the other vms' cache share.
+ */
+long int recolor_hypercall(unsigned long vm_id, unsigned long colors, unsigned long arg2);
+
+#endif /* __RECOLOR_H__ */
@@ -0,0 +1,93 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef REMIO_H
+#define REMIO_H
+
+#include <bao.h>
+#include <emul.h>
+#include <spinlock.h>
+#include <ipc_ring.h>
+#include <bitmap.h>
+
+/**
+ * Remote I/O lets a backend vm emulate a device, e.g. a virtio-mmio transport, for a frontend vm.
+ * The frontend's accesses to the device region are posted as requests to a ring in a page shared
+ * by the hypervisor and the backend, and the frontend vcpu waits for their completion, for at
+ * most REMIO_TIMEOUT_US, so that a stuck backend can not hold it in the hypervisor forever.
+ *
+ * The hypervisor fills a free slot at head, sets its state to REMIO_REQ_PENDING and then advances
+ * head. The backend handles the pending requests in order, writes the value read for each read,
+ * and sets their state to REMIO_REQ_DONE. Completions are polled by the waiting vcpus, so they
+ * need no hypercall. The backend is notified through its interrupt only once head moves past the
+ * head_event it publishes, so it can take new requests in batches while it is still busy, as with
+ * ipc rings.
+ */
+#define REMIO_RING_SIZE (64)
+
+#ifndef REMIO_TIMEOUT_US
+#define REMIO_TIMEOUT_US (100000)
+#endif
+
+enum { REMIO_REQ_FREE = 0, REMIO_REQ_PENDING = 1, REMIO_REQ_DONE = 2 };
+
+struct remio_req {
+    volatile uint32_t state;
+    uint32_t seq;
+    /* Offset of the access within the device region */
+    uint64_t addr;
+    /* The value written, or the value read once done */
+    volatile uint64_t value;
+    uint8_t width;
+    uint8_t write;
+    uint8_t res[6];
+};
+
+struct remio_ring {
+    /* Written by the hypervisor */
+    volatile uint32_t head;
+    uint8_t res0[IPC_RING_CACHE_LINE - sizeof(uint32_t)];
+    /* Written by the backend */
+    volatile uint32_t head_event;
+    uint8_t res1[IPC_RING_CACHE_LINE - sizeof(uint32_t)];
+    struct remio_req reqs[REMIO_RING_SIZE];
+};
+
+enum REMIO_DEV_TYPE { REMIO_DEV_FRONTEND, REMIO_DEV_BACKEND };
+
+struct remio_dev {
+    /* Identifies the device, so both the frontend and the backend configurations must set it */
+    uint32_t bind_key;
+    enum REMIO_DEV_TYPE type;
+    /**
+     * For the frontend, the guest address and size of the device region. For the backend, the
+     * guest address of the page the request ring is mapped at, the size being ignored.
+     */
+    vaddr_t va;
+    size_t size;
+    /* Backend interrupt, injected in its first vcpu, notifying new requests */
+    irqid_t interrupt;
+
+    /* Frontend runtime state */
+    struct emul_mem emul;
+    struct remio_dev* backend;
+
+    /* Backend runtime state */
+    spinlock_t lock;
+    struct remio_ring* ring;
+    uint32_t head;
+    /* Slots whose vcpu gave up waiting, freed by the hypervisor once the backend is done */
+    BITMAP_ALLOC(abandoned, REMIO_RING_SIZE);
+    volatile cpuid_t notify_cpu;
+};
+
+struct vm;
+struct vm_config;
+
+void remio_init(void);
+void remio_vm_init(struct vm* vm, const struct vm_config* config);
+bool remio_emul_handler(struct emul_access* acc);
+
+#endif /* REMIO_H */
@@ -0,0 +1,29 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <bao.h>
+
+/**
+ * Small objects whose number is only known at runtime are carved out of single pages drawn from
+ * the page pool, each page, i.e., slab, holding objects of one size class behind a header. Each
+ * cpu keeps a cache of free objects per class, so most allocations and frees take no lock, and
+ * the class's lock is only taken to move a batch of objects between the cache and the slabs. A
+ * slab that is entirely free goes back to the page pool unless it is the class's only free one.
+ * Objects are not zeroed, and sizes above the largest class must use mem_alloc_page instead.
+ */
+#define SLAB_MIN_SIZE (16)
+#define SLAB_MAX_SIZE (1024)
+
+#ifndef SLAB_CPU_CACHE_SIZE
+#define SLAB_CPU_CACHE_SIZE (16)
+#endif
+
+void* slab_alloc(size_t size);
+void slab_free(void* obj);
+
+#endif /* SLAB_H */
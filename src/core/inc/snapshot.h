@@ -0,0 +1,42 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <bao.h>
+#include <hypercall.h>
+#include <vm.h>
+
+/**
+ * HC_VM_SNAPSHOT(vm_id, op) saves or restores the state of another vm configured with snapshot,
+ * e.g. for a manager vm to roll a guest back to a known good state faster than rebooting it. The
+ * vm is paused for the duration of the operation. Only a vm configured as vm_manager can issue it.
+ *   SNAPSHOT_SAVE saves the vcpus' registers, the virtual interrupt controller's configuration and
+ *   the vm's memory. After the first save, which copies the memory whole, only the pages written
+ *   since are copied.
+ *   SNAPSHOT_RESTORE rolls the vm back to its last save, only copying back the pages written since.
+ * Pending and active interrupts are not part of the snapshot, time is not rolled back and devices
+ * are left to the guest's drivers. Devices doing dma to the vm's memory must be quiesced by the
+ * caller.
+ */
+enum { SNAPSHOT_SAVE = 0, SNAPSHOT_RESTORE = 1 };
+
+struct vcpu_snapshot {
+    struct arch_regs regs;
+    struct vcpu_arch_snapshot arch;
+};
+
+struct vm_snapshot {
+    struct vm_mem_snapshot* mem;
+    struct vm_arch_snapshot arch;
+    bool valid;
+    struct vcpu_snapshot vcpus[];
+};
+
+void snapshot_vm_init(struct vm* vm);
+long int snapshot_hypercall(unsigned long vm_id, unsigned long op, unsigned long arg2);
+
+#endif /* __SNAPSHOT_H__ */
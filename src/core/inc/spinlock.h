@@ -7,5 +7,158 @@
 #define __SPINLOCK_H__
 
 #include <arch/spinlock.h>
+#include <fences.h>
+
+#ifdef LOCK_PROF
+
+/**
+ * Lock profiling build (LOCK_PROF=y). Every ticket lock acquisition through spin_lock is recorded
+ * under its callsite, see lock_prof.h. The arch's spin_lock is still reachable as (spin_lock).
+ */
+
+void lock_prof_spin_lock(spinlock_t* lock, const char* site);
+
+#define spin_lock(lock) lock_prof_spin_lock((lock), __FILE__ ":" XSTR(__LINE__))
+
+#endif
+
+/**
+ * MCS queued lock for the shared locks most contended by all cpus. Ticket lock waiters all spin on
+ * the lock itself, so each release bounces its cache line to every one of them. Instead, a waiter
+ * queues one of its cpu's nodes at the lock's tail and spins on that node, which the previous owner
+ * clears to hand the lock over. The tail holds the node's id, 0 meaning the lock is free, and the
+ * owner records the node it took the lock with to release it. Each cpu may hold MCS_NODES_NUM of
+ * these locks at a time.
+ */
+
+typedef struct {
+    volatile uint32_t tail;
+    uint32_t node;
+} mcslock_t;
+
+#define MCSLOCK_INITVAL ((mcslock_t){ 0, 0 })
+
+static inline void mcslock_init(mcslock_t* lock)
+{
+    lock->tail = 0;
+    lock->node = 0;
+}
+
+void mcs_lock(mcslock_t* lock);
+void mcs_unlock(mcslock_t* lock);
+
+/**
+ * Sequence lock for state read far more often than written. Readers take no lock: they sample the
+ * sequence, which is odd while a write is ongoing, read the state and retry if the sequence moved.
+ * Writers must be serialized by a lock of their own.
+ */
+
+typedef struct {
+    volatile uint32_t seq;
+} seqlock_t;
+
+#define SEQLOCK_INITVAL ((seqlock_t){ 0 })
+
+static inline uint32_t seq_read_begin(seqlock_t* lock)
+{
+    uint32_t seq;
+    while (((seq = lock->seq) & 1U) != 0) { }
+    fence_ord_read();
+    return seq;
+}
+
+static inline bool seq_read_retry(seqlock_t* lock, uint32_t seq)
+{
+    fence_ord_read();
+    return lock->seq != seq;
+}
+
+static inline void seq_write_begin(seqlock_t* lock)
+{
+    lock->seq++;
+    fence_ord_write();
+}
+
+static inline void seq_write_end(seqlock_t* lock)
+{
+    fence_ord_write();
+    lock->seq++;
+}
+
+/**
+ * Readers-writer lock for state that is also written after init. Once the state is final it may be
+ * frozen, after which readers only check the frozen flag and writers are an error. Freezing must be
+ * followed by a synchronization of the readers' cpus, such as a cpu_sync_barrier, which publishes
+ * the final state to them.
+ */
+
+typedef struct {
+    volatile uint32_t state;
+    bool frozen;
+} rwlock_t;
+
+#define RWLOCK_WRITER (1U << 31)
+
+#define RWLOCK_INITVAL ((rwlock_t){ 0, false })
+
+static inline void rwlock_init(rwlock_t* lock)
+{
+    lock->state = 0;
+    lock->frozen = false;
+}
+
+static inline void read_lock(rwlock_t* lock)
+{
+    if (lock->frozen) {
+        return;
+    }
+
+    while (true) {
+        uint32_t state = lock->state;
+        if ((state & RWLOCK_WRITER) != 0) {
+            spin_wait();
+        } else if (spin_atomic_cmpxchg(&lock->state, state, state + 1) == state) {
+            break;
+        }
+    }
+}
+
+static inline void read_unlock(rwlock_t* lock)
+{
+    if (lock->frozen) {
+        return;
+    }
+
+    uint32_t state;
+    do {
+        state = lock->state;
+    } while (spin_atomic_cmpxchg(&lock->state, state, state - 1) != state);
+    spin_notify();
+}
+
+static inline void write_lock(rwlock_t* lock)
+{
+    if (lock->frozen) {
+        ERROR("write to frozen state");
+    }
+
+    while (spin_atomic_cmpxchg(&lock->state, 0, RWLOCK_WRITER) != 0) {
+        spin_wait();
+    }
+}
+
+static inline void write_unlock(rwlock_t* lock)
+{
+    (void)spin_atomic_xchg(&lock->state, 0);
+    spin_notify();
+}
+
+static inline void rwlock_freeze(rwlock_t* lock)
+{
+    write_lock(lock);
+    lock->frozen = true;
+    fence_ord_write();
+    write_unlock(lock);
+}
 
 #endif /* __SPINLOCK_H__ */
@@ -0,0 +1,145 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <bao.h>
+#include <cpu.h>
+#include <platform_defs.h>
+#include <config_defs.h>
+
+/* Synchronous exits are counted by exception class (armv8) or cause (riscv) */
+#define STATS_EXIT_REASONS (64)
+
+#ifndef STATS_MMIO_DEV_MAX
+#define STATS_MMIO_DEV_MAX (16)
+#endif
+
+/**
+ * The counters the stats hypercall reads. The per reason and per device counters are indexed by
+ * adding the exit reason or the device's index, in the order its emulator was added to the vm, to
+ * their base. The interference counters, kept past them, are not read by their slot here but
+ * from STATS_INTERFERENCE_NS.
+ */
+enum stats_counter {
+    STATS_EXITS_IRQ,
+    STATS_IRQS_INJECTED,
+    STATS_LRS_SPILLED,
+    STATS_IPIS_SENT,
+    STATS_CPU_MSGS_SENT,
+    STATS_CPU_MSGS_RECEIVED,
+    STATS_IPC_NOTIFIES_SENT,
+    STATS_IPC_NOTIFIES_RECEIVED,
+    STATS_MMIO_TRAPS,
+    /* Hardware interrupts taken on a cpu other than their target's, see vgic_route */
+    STATS_IRQS_FORWARDED,
+    /* The subset of the received cpu messages that were urgent, see cpu_msg_class */
+    STATS_CPU_MSGS_URGENT_RECEIVED,
+    /* Hardware interrupts deferred by the vm's irq_limit and the periods its budget ran out in */
+    STATS_IRQS_DEFERRED,
+    STATS_IRQ_LIMIT_HITS,
+    /* The periods the vcpu was throttled in by the vm's membw budget and for how long in total */
+    STATS_MEMBW_THROTTLES,
+    STATS_MEMBW_THROTTLED_NS,
+    STATS_EXITS_SYNC = 16,
+    STATS_MMIO_DEV = STATS_EXITS_SYNC + STATS_EXIT_REASONS,
+    STATS_INTERFERENCE = STATS_MMIO_DEV + STATS_MMIO_DEV_MAX,
+    STATS_COUNTER_NUM = STATS_INTERFERENCE + CONFIG_VM_NUM + 1
+};
+
+/**
+ * Past the per cpu counters, regardless of the vcpu, the number of pages of the vm's memory
+ * regions accessed in the last working set sampling period, the number of periods sampled, the
+ * number of 2M chunks the regions span and, for each chunk in the order of the regions, the pages
+ * of the chunk accessed in the last period.
+ */
+enum stats_wss_counter {
+    STATS_WSS_PAGES = STATS_INTERFERENCE,
+    STATS_WSS_SAMPLES,
+    STATS_WSS_CHUNKS,
+    STATS_WSS_HEAT,
+};
+
+/**
+ * Nanoseconds the hypervisor ran on the vcpu's cpu on behalf of each vm, see stats_charge, read
+ * by adding the id of the vm that caused the work, or CONFIG_VM_NUM for work not caused by any
+ * vm. They start at a fixed id past any heat chunk so that no other id depends on CONFIG_VM_NUM.
+ */
+#define STATS_INTERFERENCE_NS (0x100000)
+
+#define STATS_WSS_CHUNK_SIZE (0x200000)
+
+/**
+ * Written by the vm's master cpu at the end of each sampling period, in global memory for the
+ * same reason as the counters below. Samples are read while the next one may be taken.
+ */
+struct stats_wss {
+    uint16_t* heat;
+    size_t chunk_num;
+    uint64_t pages;
+    uint64_t samples;
+};
+
+extern struct stats_wss stats_wss[CONFIG_VM_NUM];
+
+/**
+ * Counters are kept per cpu, each cpu only counting for the vcpu it runs, and in global memory
+ * instead of the vm's, which only its own cpus map, so that a manager vm can read them.
+ */
+struct stats_cpu {
+    vmid_t vm_id;
+    vcpuid_t vcpu_id;
+    /* Timer ticks charged so far, never reset, which the exits discount from their own time */
+    uint64_t charged;
+    uint64_t counters[STATS_COUNTER_NUM];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+extern struct stats_cpu stats_cpus[PLAT_CPU_NUM];
+
+static inline void stats_inc(enum stats_counter counter)
+{
+    stats_cpus[cpu()->id].counters[counter]++;
+}
+
+static inline void stats_add(enum stats_counter counter, size_t n)
+{
+    stats_cpus[cpu()->id].counters[counter] += n;
+}
+
+static inline void stats_exit_sync(unsigned long reason)
+{
+    if (reason < STATS_EXIT_REASONS) {
+        stats_inc((enum stats_counter)(STATS_EXITS_SYNC + reason));
+    }
+}
+
+static inline void stats_mmio_trap(size_t dev_id)
+{
+    stats_inc(STATS_MMIO_TRAPS);
+    if (dev_id < STATS_MMIO_DEV_MAX) {
+        stats_inc((enum stats_counter)(STATS_MMIO_DEV + dev_id));
+    }
+}
+
+/**
+ * Charges hypervisor time on this cpu, in timer ticks until read, to the vm that caused it, i.e.,
+ * the vm on the cpu whose message it handled, which is its own for the rest of its vcpu's exits.
+ * Reading the whole row of each of a vm's vcpus gives its row of the vm by vm interference matrix.
+ */
+static inline void stats_charge(vmid_t cause, uint64_t ticks)
+{
+    struct stats_cpu* stats = &stats_cpus[cpu()->id];
+    size_t col = (cause < CONFIG_VM_NUM) ? cause : CONFIG_VM_NUM;
+
+    stats->counters[STATS_INTERFERENCE + col] += ticks;
+    stats->charged += ticks;
+}
+
+void stats_init(void);
+void stats_vcpu_init(vmid_t vm_id, vcpuid_t vcpu_id);
+long int stats_hypercall(unsigned long vm_id, unsigned long vcpu_id, unsigned long counter);
+
+#endif /* __STATS_H__ */
@@ -0,0 +1,88 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <bao.h>
+#include <list.h>
+#include <arch/timer.h>
+
+#define TIMER_NS_PER_SEC (1000000000ULL)
+
+struct timer_event;
+typedef void (*timer_handler_t)(struct timer_event* event);
+
+/**
+ * Deadlines are absolute values of the cpu's free running counter, as returned by timer_get. Events
+ * are kept in a per-cpu queue ordered by deadline and must only be armed or cancelled by the cpu
+ * they belong to. Handlers are called in interrupt context and may re-arm their own event.
+ *
+ * Deferrable events, e.g. periodic housekeeping or sampling, do not wake an idle cpu, they are
+ * run once it wakes up for another reason. A running cpu also runs the deferrable events due
+ * within TIMER_DEFER_SLACK_US along with the ones that expired, so that they share interrupts.
+ */
+#ifndef TIMER_DEFER_SLACK_US
+#define TIMER_DEFER_SLACK_US (50)
+#endif
+
+struct timer_event {
+    node_t node;
+    uint64_t deadline;
+    timer_handler_t handler;
+    bool armed;
+    bool deferrable;
+};
+
+static inline uint64_t timer_get(void)
+{
+    return timer_arch_get();
+}
+
+static inline uint64_t timer_ns_to_ticks(uint64_t ns)
+{
+    uint64_t freq = timer_arch_get_freq();
+    return ((ns / TIMER_NS_PER_SEC) * freq) + (((ns % TIMER_NS_PER_SEC) * freq) / TIMER_NS_PER_SEC);
+}
+
+static inline uint64_t timer_ticks_to_ns(uint64_t ticks)
+{
+    uint64_t freq = timer_arch_get_freq();
+    return ((ticks / freq) * TIMER_NS_PER_SEC) + (((ticks % freq) * TIMER_NS_PER_SEC) / freq);
+}
+
+void timer_init(void);
+void timer_arm(struct timer_event* event, uint64_t deadline);
+void timer_cancel(struct timer_event* event);
+void timer_handle_interrupt(irqid_t int_id);
+uint64_t timer_next_deadline(void);
+void timer_idle_enter(void);
+void timer_idle_exit(void);
+
+static inline void timer_arm_after(struct timer_event* event, uint64_t ns)
+{
+    timer_arm(event, timer_get() + timer_ns_to_ticks(ns));
+}
+
+/**
+ * Re-arms a periodic event one period after its last deadline, skipping the periods missed while
+ * it was deferred.
+ */
+static inline void timer_arm_next_period(struct timer_event* event, uint64_t period)
+{
+    uint64_t now = timer_get();
+    uint64_t deadline = event->deadline + period;
+    if (deadline <= now) {
+        deadline += (((now - deadline) / period) + 1) * period;
+    }
+    timer_arm(event, deadline);
+}
+
+static inline bool timer_is_armed(struct timer_event* event)
+{
+    return event->armed;
+}
+
+#endif /* __TIMER_H__ */
@@ -10,24 +10,43 @@
 #include <arch/tlb.h>
 
 #include <mem.h>
+#include <io.h>
 
 static inline void tlb_inv_va(struct addr_space* as, vaddr_t va)
 {
+    mem_xlate_inv(as);
     if (as->type == AS_HYP) {
         tlb_hyp_inv_va(va);
     } else if (as->type == AS_VM) {
         tlb_vm_inv_va(as->id, va);
-        // TODO: inval iommu tlbs
+        iommu_arch_vm_inv_range(as->id, va, PAGE_SIZE);
+    }
+}
+
+/**
+ * The iommus translate through the same stage 2 tables as the vm. On armv8 the smmu is usually
+ * covered by the cpus' broadcast tlb maintenance, an smmuv2 not seeing it being invalidated by ipa
+ * or vmid. The riscv iommu iotlb must be invalidated explicitly through its command queue.
+ */
+static inline void tlb_inv_range(struct addr_space* as, vaddr_t va, size_t size)
+{
+    mem_xlate_inv(as);
+    if (as->type == AS_HYP) {
+        tlb_hyp_inv_range(va, size);
+    } else if (as->type == AS_VM) {
+        tlb_vm_inv_range(as->id, va, size);
+        iommu_arch_vm_inv_range(as->id, va, size);
     }
 }
 
 static inline void tlb_inv_all(struct addr_space* as)
 {
+    mem_xlate_inv(as);
     if (as->type == AS_HYP) {
         tlb_hyp_inv_all();
     } else if (as->type == AS_VM) {
         tlb_vm_inv_all(as->id);
-        // TODO: inval iommu tlbs
+        iommu_arch_vm_inv_all(as->id);
     }
 }
 
@@ -0,0 +1,115 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <bao.h>
+#include <timer.h>
+#include <hypercall.h>
+
+#ifndef TRACE_BUF_SIZE
+#define TRACE_BUF_SIZE (256)
+#endif
+
+enum trace_exit_type {
+    TRACE_EXIT_SYNC,
+    TRACE_EXIT_IRQ,
+};
+
+/**
+ * A vm exit as seen by the cpu that took it. The reason is the exception class/cause for
+ * synchronous exits and the interrupt id (or, on riscv, the interrupt cause) for irqs. The info
+ * field carries the reason specific detail: the fault address for aborts, the function id for
+ * hypercalls and the extension and function ids (extid << 32 | fid) for sbi calls. Timestamps
+ * and durations are timer ticks.
+ */
+struct trace_entry {
+    uint64_t timestamp;
+    uint64_t duration;
+    uint32_t type;
+    uint32_t reason;
+    uint64_t info;
+};
+
+/**
+ * Layout of a shared memory holding the exit trace stream. The header is followed by one ring per
+ * cpu, each a single-producer single-consumer ring of ring_size entries, a power of 2, written by
+ * that cpu alone. Indices are free running. A consumer reads the entries from its tail up to head
+ * and then publishes its tail, so records are exported without any hypercall.
+ *
+ * Under SHMEM_TRACE_DROP, records arriving with the ring full are only counted in dropped. Under
+ * SHMEM_TRACE_OVERWRITE, the producer never waits for the consumer: an entry's seq is set to its
+ * index after it is written, and to all ones while it is, so a consumer that copied an entry whose
+ * seq is not the index it expected was overrun and must skip ahead to head - ring_size.
+ */
+#define TRACE_STREAM_CACHE_LINE (64)
+
+struct trace_stream_hdr {
+    uint32_t cpu_num;
+    uint32_t ring_size;
+    uint32_t entry_size;
+    uint32_t policy;
+    uint8_t res[TRACE_STREAM_CACHE_LINE - (4 * sizeof(uint32_t))];
+};
+
+struct trace_stream_entry {
+    volatile uint64_t seq;
+    struct trace_entry entry;
+};
+
+struct trace_stream_ring {
+    /* Written by the hypervisor */
+    volatile uint32_t head;
+    volatile uint32_t dropped;
+    uint8_t res0[TRACE_STREAM_CACHE_LINE - (2 * sizeof(uint32_t))];
+    /* Written by the consumer */
+    volatile uint32_t tail;
+    uint8_t res1[TRACE_STREAM_CACHE_LINE - sizeof(uint32_t)];
+    struct trace_stream_entry entries[];
+};
+
+struct shmem;
+
+#ifdef TRACE
+
+static inline uint64_t trace_exit_begin(void)
+{
+    return timer_get();
+}
+
+void trace_exit_end(enum trace_exit_type type, unsigned long reason, uint64_t info,
+    uint64_t start);
+void trace_dump(void);
+long int trace_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2);
+void trace_stream_init(struct shmem* shmem);
+
+#else
+
+static inline uint64_t trace_exit_begin(void)
+{
+    return 0;
+}
+
+static inline void trace_exit_end(enum trace_exit_type type, unsigned long reason,
+    uint64_t info, uint64_t start)
+{ }
+
+static inline void trace_dump(void) { }
+
+static inline void trace_stream_init(struct shmem* shmem)
+{
+    WARNING("Trace stream shared memory ignored, tracing is disabled in this build");
+}
+
+static inline long int trace_hypercall(unsigned long arg0, unsigned long arg1,
+    unsigned long arg2)
+{
+    return -HC_E_INVAL_ID;
+}
+
+#endif
+
+#endif /* __TRACE_H__ */
@@ -25,6 +25,7 @@ typedef signed long ssize_t;
 typedef unsigned long asid_t;
 
 typedef unsigned long vmid_t;
+#define INVALID_VMID ((vmid_t)-1)
 
 typedef uintptr_t paddr_t;
 typedef uintptr_t regaddr_t;
@@ -37,6 +38,20 @@ typedef ssize_t mpid_t;
 
 typedef unsigned long colormap_t;
 
+/**
+ * Which of the platform's memory regions pages are allocated from: any of them, those of the
+ * allocating cpu's numa node first; first those of the preferred tier, then the others; the
+ * regions in turn, one allocation each, to spread the traffic over the memory controllers; or only
+ * the regions of the given controller.
+ */
+enum mem_place_policy { MEM_PLACE_ANY = 0, MEM_PLACE_TIER, MEM_PLACE_INTERLEAVE, MEM_PLACE_PINNED };
+
+struct mem_place {
+    enum mem_place_policy policy;
+    size_t tier;
+    size_t controller;
+};
+
 typedef unsigned long cpuid_t;
 typedef unsigned long vcpuid_t;
 typedef unsigned long cpumap_t;
@@ -17,6 +17,41 @@
 #include <bitmap.h>
 #include <io.h>
 #include <ipc.h>
+#include <remio.h>
+#include <vuart.h>
+#include <timer.h>
+#include <stats.h>
+#include <config_defs.h>
+
+/* Number of slots of the direct-mapped system register emulator table */
+#ifndef VM_EMUL_REG_TABLE_SIZE
+#define VM_EMUL_REG_TABLE_SIZE (16)
+#endif
+
+struct vm_snapshot;
+
+/**
+ * The vm's arena holds the hypervisor's structures that live as long as the vm, e.g. its virtual
+ * interrupt controller and snapshot state, in chunks of VM_ARENA_CHUNK_PAGES taken in the vm's
+ * colors, so they are close to each other and can all be released at once. Allocations are only
+ * aligned to VM_ARENA_ALIGN and are not zeroed.
+ */
+#ifndef VM_ARENA_CHUNK_PAGES
+#define VM_ARENA_CHUNK_PAGES (4)
+#endif
+
+#define VM_ARENA_ALIGN CACHE_LINE_SIZE
+
+struct vm_arena_chunk;
+
+struct vm_arena {
+    spinlock_t lock;
+    struct vm_arena_chunk* chunks;
+    vaddr_t cur;
+    size_t left;
+    size_t num_pages;
+};
+struct vm_mem_snapshot;
 
 struct vm_mem_region {
     paddr_t base;
@@ -24,6 +59,14 @@ struct vm_mem_region {
     colormap_t colors;
     bool place_phys;
     paddr_t phys;
+    /**
+     * Only reserve the region's memory when the vm is created and map it in VM_LAZY_CHUNK_SIZE
+     * chunks, when the guest first touches them or in the background once the guest runs. Device
+     * dma to the region might hit chunks not yet mapped, so it's meant for memory only used by
+     * the cpus. Ignored for regions placed at a fixed physical address or holding the image.
+     */
+    bool lazy;
+    enum mem_cacheability cacheability;
 };
 
 struct vm_dev_region {
@@ -47,6 +90,31 @@ struct vm_platform {
     size_t dev_num;
     struct vm_dev_region* devs;
 
+    size_t remio_dev_num;
+    struct remio_dev* remio_devs;
+
+    struct vuart_config vuart;
+
+    /**
+     * Guest address of the vm's read-only info page, which the pages of its vcpus follow, or 0 for
+     * none (see vm_info.h).
+     */
+    vaddr_t info_addr;
+
+    /**
+     * Interrupts posted to the guest through a pending page at page_addr instead of being injected,
+     * taken by the cpu running the given vcpu (see posted.h).
+     */
+    struct {
+        vaddr_t page_addr;
+        vcpuid_t vcpu;
+        size_t interrupt_num;
+        irqid_t* interrupts;
+    } posted;
+
+    /* Guest address of the vm's hypercall queue page, or 0 for none (see hypercall.h) */
+    vaddr_t hc_queue_addr;
+
     // /**
     //  * In MPU-based platforms which might also support virtual memory
     //  * (i.e. aarch64 cortex-r) the hypervisor sets up the VM using an MPU by
@@ -58,45 +126,172 @@ struct vm_platform {
     struct arch_vm_platform arch;
 };
 
+/**
+ * The vms' interrupt bitmaps only cover the interrupt ids up to the highest one assigned to any vm
+ * in the configuration, which also keeps them within a few cache lines.
+ */
+#if defined(CONFIG_VM_INT_NUM) && (CONFIG_VM_INT_NUM < MAX_INTERRUPTS)
+#define VM_MAX_INTERRUPTS CONFIG_VM_INT_NUM
+#else
+#define VM_MAX_INTERRUPTS MAX_INTERRUPTS
+#endif
+
+/**
+ * The vm and vcpu structures are split in blocks, each starting on its own cache line: the fields
+ * read on the exits by all of the vm's cpus, which are only written while the vm is initialized;
+ * the fields any of them may write at runtime; and, for the vcpu, the state only its own cpu
+ * touches on every exit. The arch state, whose interrupt controller emulation other cpus lock and
+ * write, comes last.
+ */
 struct vm {
+    /* Read mostly */
     vmid_t id;
-
     const struct vm_config* config;
-
-    spinlock_t lock;
-    struct cpu_synctoken sync;
     cpuid_t master;
 
     struct vcpu* vcpus;
     size_t cpu_num;
-    cpumap_t cpus;
-
-    struct addr_space as;
-
-    struct vm_arch arch;
+    cpumask_t cpus;
+    /* The vcpu run by each physical cpu, or INVALID_CPUID, filled in by vm_vcpu_init */
+    vcpuid_t pcpu_to_vcpu[PLAT_CPU_NUM];
 
+    /* Emulators are only added during vm_init, which freezes them for the exits' lookups */
+    rwlock_t emul_lock;
     struct list emul_mem_list;
+    size_t emul_mem_num;
+    struct emul_reg* emul_reg_table[VM_EMUL_REG_TABLE_SIZE];
     struct list emul_reg_list;
 
     struct vm_io io;
 
-    BITMAP_ALLOC(interrupt_bitmap, MAX_INTERRUPTS);
+    BITMAP_ALLOC(interrupt_bitmap, VM_MAX_INTERRUPTS);
 
     size_t ipc_num;
     struct ipc* ipcs;
+
+    /* Written by the vm's cpus */
+    spinlock_t lock __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct cpu_synctoken sync;
+
+    struct addr_space as;
+
+    /* Lazily mapped memory regions, see vm_mem_populate */
+    struct {
+        spinlock_t lock;
+        struct list regions;
+        size_t pending;
+    } lazy;
+
+    /* Set by any of the vm's cpus lacking what working set sampling needs, see vm_mem_wss_start */
+    volatile bool wss_unsupported;
+
+    /* Range of the vm's pages whose writes are logged, see vm_mem_dirty_log_start */
+    struct {
+        spinlock_t lock;
+        vaddr_t base;
+        size_t num_pages;
+        volatile bool used;
+    } dirty_log;
+
+    /* Guest console multiplexed onto the hypervisor's, set up by vuart_vm_init */
+    struct vuart vuart;
+
+    struct vm_arena arena;
+
+    /* Set up by snapshot_vm_init if the vm is configured with snapshot and supports it */
+    struct vm_snapshot* snapshot;
+
+    /* Hypervisor mapping of the vm's info pages, set up by vm_info_vm_init */
+    struct vm_info* info;
+
+    /* Set up by posted_vm_init, page is NULL if the vm has no posted interrupts */
+    struct {
+        struct posted_page* page;
+        vcpuid_t vcpu;
+        size_t interrupt_num;
+        irqid_t* interrupts;
+        BITMAP_ALLOC(bitmap, VM_MAX_INTERRUPTS);
+    } posted;
+
+    /* Set up by hypercall_queue_vm_init, page is NULL if the vm has no hypercall queue */
+    struct {
+        struct hc_queue* page;
+        volatile uint32_t busy;
+    } hc_queue;
+
+    /* Image copy split across the vm's cpus, set up by the master during vm_init */
+    struct {
+        vaddr_t src_va;
+        vaddr_t dst_va;
+        size_t size;
+        size_t src_size;
+        size_t src_num_pages;
+        size_t dst_num_pages;
+    } img_install;
+
+    struct vm_arch arch __attribute__((aligned(CACHE_LINE_SIZE)));
 };
 
 struct vcpu {
-    node_t node;
-
+    /* Only touched by the vcpu's own cpu, the registers being saved and restored on every exit */
     struct arch_regs regs;
-    struct vcpu_arch arch;
 
+    struct vm* vm;
     vcpuid_t id;
     cpuid_t phys_id;
     bool active;
 
-    struct vm* vm;
+    /* Reset along with its vm, restarted once its cpu is done with the current exception */
+    bool restart;
+    /* Rolled back to its vm's snapshot, its registers restored once its cpu is done as well */
+    bool restore;
+    /* Stopped along with its vm by a vm manager, its cpu idling until the vm is started again */
+    bool stopped;
+    /* Interrupt exits save the whole register file too, for the vm's snapshots to copy it */
+    bool full_exits;
+
+    /* Last memory emulator hit by this vcpu, checked first on the next emulated access */
+    struct emul_mem* emul_mem_last;
+
+    /**
+     * Timer ticks spent in the hypervisor handling the vcpu's exits, which the guest sees as stolen
+     * from it, the waits for its own interrupts, e.g. on a trapped wfi, aside. Once the guest has a
+     * steal time record, in the format of the arch's paravirtual time interface, it is updated on
+     * every exit.
+     */
+    struct {
+        uint64_t ticks;
+        void* record;
+    } steal;
+
+    /* This vcpu's page of the vm's info pages, if any */
+    struct vm_info_vcpu* info;
+
+    /* Hypervisor mapping of the physical page last used for multicall descriptors */
+    struct {
+        paddr_t pa;
+        vaddr_t va;
+    } multicall;
+
+    node_t node;
+
+    struct vcpu_arch arch __attribute__((aligned(CACHE_LINE_SIZE)));
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+_Static_assert((offsetof(struct vm, lock) % CACHE_LINE_SIZE) == 0,
+    "vm runtime written fields share a cache line with the read mostly ones");
+_Static_assert((offsetof(struct vm, arch) % CACHE_LINE_SIZE) == 0,
+    "vm arch state shares a cache line with the runtime written fields");
+_Static_assert((offsetof(struct vcpu, regs) == 0) &&
+        ((_Alignof(struct vcpu) % CACHE_LINE_SIZE) == 0),
+    "vcpu register save area does not start on a cache line");
+_Static_assert((offsetof(struct vcpu, arch) % CACHE_LINE_SIZE) == 0,
+    "vcpu arch state shares a cache line with the register save area");
+
+struct vcpu_exit_stamp {
+    uint64_t time;
+    uint64_t standby;
+    uint64_t charged;
 };
 
 struct vm_allocation {
@@ -111,18 +306,52 @@ extern struct vm vm;
 struct vm* vm_init(struct vm_allocation* vm_alloc, const struct vm_config* config, bool master,
     vmid_t vm_id);
 void vm_start(struct vm* vm, vaddr_t entry);
+bool vm_map_mem_region_lazy(struct vm* vm, struct vm_mem_region* reg);
+bool vm_mem_populate(struct vm* vm, vaddr_t addr);
+void vm_mem_lazy_start(struct vm* vm);
+void vm_mem_wss_start(struct vm* vm);
+bool vm_mem_recolor(struct vm* vm, colormap_t colors);
+bool vm_mem_dirty_log_start(struct vm* vm, vaddr_t base, size_t num_pages);
+ssize_t vm_mem_dirty_log_collect(struct vm* vm, vaddr_t bitmap_ipa, size_t size);
+bool vm_mem_dirty_log_stop(struct vm* vm);
+bool vm_mem_dirty_fault(struct vm* vm, vaddr_t addr);
+struct vm_mem_snapshot* vm_mem_snapshot_init(struct vm* vm);
+bool vm_mem_snapshot_save(struct vm* vm, struct vm_mem_snapshot* snap);
+bool vm_mem_snapshot_restore(struct vm* vm, struct vm_mem_snapshot* snap);
+bool vm_reset(vmid_t vm_id);
+void vcpu_check_restart(void);
+long int vm_ipi_hypercall(unsigned long vcpu_mask, unsigned long mask_base, unsigned long ipi_id);
+
+enum { HC_VM_CTL_STATUS, HC_VM_CTL_STOP, HC_VM_CTL_START, HC_VM_CTL_LOAD };
+enum { HC_VM_CTL_RUNNING, HC_VM_CTL_STOPPED, HC_VM_CTL_PENDING };
+
+long int vm_ctl_hypercall(unsigned long op, unsigned long vm_id, unsigned long arg);
 void vm_emul_add_mem(struct vm* vm, struct emul_mem* emu);
 void vm_emul_add_reg(struct vm* vm, struct emul_reg* emu);
+void* vm_emul_add_shadow(struct vm* vm, vaddr_t va, void* page);
 emul_handler_t vm_emul_get_mem(struct vm* vm, vaddr_t addr);
 emul_handler_t vm_emul_get_reg(struct vm* vm, vaddr_t addr);
 void vcpu_init(struct vcpu* vcpu, struct vm* vm, vaddr_t entry);
 void vm_msg_broadcast(struct vm* vm, struct cpu_msg* msg);
-cpumap_t vm_translate_to_pcpu_mask(struct vm* vm, cpumap_t mask, size_t len);
-cpumap_t vm_translate_to_vcpu_mask(struct vm* vm, cpumap_t mask, size_t len);
+cpumask_t vm_translate_to_pcpu_mask(struct vm* vm, cpumap_t mask, size_t len);
+cpumap_t vm_translate_to_vcpu_mask(struct vm* vm, const cpumask_t* mask);
+
+/**
+ * If every configured vm has the same number of vcpus, it is known at build time, so that bounds
+ * checks on vcpu ids and loops over the vcpus fold into constants.
+ */
+static inline size_t vm_cpu_num(struct vm* vm)
+{
+#ifdef CONFIG_VM_CPU_NUM
+    return CONFIG_VM_CPU_NUM;
+#else
+    return vm->cpu_num;
+#endif
+}
 
 static inline struct vcpu* vm_get_vcpu(struct vm* vm, vcpuid_t vcpuid)
 {
-    if (vcpuid < vm->cpu_num) {
+    if (vcpuid < vm_cpu_num(vm)) {
         return &vm->vcpus[vcpuid];
     }
     return NULL;
@@ -141,8 +370,8 @@ static inline cpuid_t vm_translate_to_pcpuid(struct vm* vm, vcpuid_t vcpuid)
 
 static inline vcpuid_t vm_translate_to_vcpuid(struct vm* vm, cpuid_t pcpuid)
 {
-    if (vm->cpus & (1UL << pcpuid)) {
-        return (cpuid_t)bit_count(vm->cpus & BIT_MASK(0, pcpuid));
+    if (pcpuid < PLAT_CPU_NUM) {
+        return vm->pcpu_to_vcpu[pcpuid];
     } else {
         return INVALID_CPUID;
     }
@@ -150,16 +379,28 @@ static inline vcpuid_t vm_translate_to_vcpuid(struct vm* vm, cpuid_t pcpuid)
 
 static inline bool vm_has_interrupt(struct vm* vm, irqid_t int_id)
 {
-    return !!bitmap_get(vm->interrupt_bitmap, int_id);
+    return (int_id < VM_MAX_INTERRUPTS) && bitmap_get(vm->interrupt_bitmap, int_id);
+}
+
+static inline struct vcpu_exit_stamp vcpu_exit_begin(void)
+{
+    return (struct vcpu_exit_stamp){ timer_get(), cpu()->standby.residency,
+        stats_cpus[cpu()->id].charged };
 }
 
+void vcpu_exit_end(struct vcpu_exit_stamp stamp);
+void vcpu_hyp_maps_release(struct vcpu* vcpu);
+void vcpu_hyp_maps_restore(struct vcpu* vcpu);
+
 static inline void vcpu_inject_hw_irq(struct vcpu* vcpu, irqid_t id)
 {
+    stats_inc(STATS_IRQS_INJECTED);
     vcpu_arch_inject_hw_irq(vcpu, id);
 }
 
 static inline void vcpu_inject_irq(struct vcpu* vcpu, irqid_t id)
 {
+    stats_inc(STATS_IRQS_INJECTED);
     vcpu_arch_inject_irq(vcpu, id);
 }
 
@@ -167,16 +408,47 @@ static inline void vcpu_inject_irq(struct vcpu* vcpu, irqid_t id)
 
 void vm_mem_prot_init(struct vm* vm, const struct vm_config* config);
 
+void vm_arena_init(struct vm* vm);
+void* vm_arena_alloc(struct vm* vm, size_t size);
+void vm_arena_release(struct vm* vm);
+struct page_table_dscr* vm_arch_pt_dscr(const struct vm_config* config, vaddr_t ipa_top);
+
 /* ------------------------------------------------------------*/
 
 void vm_arch_init(struct vm* vm, const struct vm_config* config);
+void vm_arch_reset(struct vm* vm);
+bool vm_arch_snapshot_init(struct vm* vm, struct vm_arch_snapshot* snap);
+size_t vm_arch_snapshot_data_size(struct vm* vm);
+bool vm_arch_snapshot_place(struct vm* vm, struct vm_arch_snapshot* snap, void* data);
+void vm_arch_snapshot_save(struct vm* vm, struct vm_arch_snapshot* snap);
+void vm_arch_snapshot_restore(struct vm* vm, const struct vm_arch_snapshot* snap);
 void vcpu_arch_init(struct vcpu* vcpu, struct vm* vm);
+void vcpu_arch_vm_reset(struct vcpu* vcpu);
+/**
+ * Drops the hypervisor's own mappings of the vm's pages kept for the vcpu, on its cpu, before the
+ * pages backing the vm's memory change, and sets them up again from the guest addresses after.
+ */
+void vcpu_arch_hyp_maps_release(struct vcpu* vcpu);
+void vcpu_arch_hyp_maps_restore(struct vcpu* vcpu);
+/* Quiets the vcpu's interrupt sources on its stopped cpu, until the vm is reset */
+void vcpu_arch_stop(struct vcpu* vcpu);
+void vcpu_arch_snapshot_save(struct vcpu* vcpu, struct vcpu_arch_snapshot* snap);
+void vcpu_arch_snapshot_restore(struct vcpu* vcpu, const struct vcpu_arch_snapshot* snap);
 void vcpu_run(struct vcpu* vcpu);
+/**
+ * The register file is complete during synchronous exits. Interrupt exits only save the registers
+ * the calling convention does not preserve, plus the trap state, unless the vcpu has full_exits
+ * set, so their handlers must not access the others but through a vcpu reset or restore, which
+ * fully replaces them.
+ */
 unsigned long vcpu_readreg(struct vcpu* vcpu, unsigned long reg);
 void vcpu_writereg(struct vcpu* vcpu, unsigned long reg, unsigned long val);
 unsigned long vcpu_readpc(struct vcpu* vcpu);
 void vcpu_writepc(struct vcpu* vcpu, unsigned long pc);
 void vcpu_arch_run(struct vcpu* vcpu);
 void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry);
+bool vcpu_arch_irq_pending(struct vcpu* vcpu);
+bool vcpu_arch_send_ipi(struct vcpu* vcpu, cpumask_t pcpu_mask, unsigned long ipi_id);
+void vcpu_arch_steal_update(struct vcpu* vcpu, uint64_t steal_ns);
 
 #endif /* __VM_H__ */
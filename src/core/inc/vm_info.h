@@ -0,0 +1,100 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __VM_INFO_H__
+#define __VM_INFO_H__
+
+#include <bao.h>
+#include <fences.h>
+
+/**
+ * A vm configured with an info address is given a read-only page there describing it, followed by
+ * one page per vcpu, in vcpu id order, for the data of each vcpu. The guest finds out its layout,
+ * and reads what the hypervisor updates at run time, e.g., the steal time, without exits.
+ *
+ * Each page starts with a sequence count the hypervisor makes odd while it updates the page and
+ * even again once done. A guest reads the count, waiting for it to be even, then the fields it
+ * needs and then the count again, retrying if it changed.
+ */
+#define VM_INFO_MAGIC   (0x4f464e494f4142ULL) /* "BAOINFO" */
+#define VM_INFO_VERSION (1)
+
+#ifndef VM_INFO_IPC_MAX
+#define VM_INFO_IPC_MAX (16)
+#endif
+
+#ifndef VM_INFO_IPC_INTERRUPTS_MAX
+#define VM_INFO_IPC_INTERRUPTS_MAX (4)
+#endif
+
+#define VM_INFO_FEAT_STEAL_TIME (1UL << 0)
+#define VM_INFO_FEAT_VUART      (1UL << 1)
+#define VM_INFO_FEAT_SNAPSHOT   (1UL << 2)
+#define VM_INFO_FEAT_VM_MANAGER (1UL << 3)
+#define VM_INFO_FEAT_TRAP_WFI   (1UL << 4)
+#define VM_INFO_FEAT_HC_QUEUE   (1UL << 5)
+
+struct vm_info_ipc {
+    uint64_t base;
+    uint64_t size;
+    /* Guest address of the ipc's doorbell page, or zero for none */
+    uint64_t doorbell;
+    uint32_t shmem_id;
+    uint32_t interrupt_num;
+    uint32_t interrupts[VM_INFO_IPC_INTERRUPTS_MAX];
+};
+
+struct vm_info {
+    volatile uint32_t seq;
+    uint32_t version;
+    uint64_t magic;
+    uint32_t vm_id;
+    uint32_t cpu_num;
+    uint64_t features;
+    /* Offset from this page of the first vcpu's page */
+    uint64_t vcpu_info_off;
+    /* The colors of the vm's memory, updated when it is recolored */
+    volatile uint64_t colors;
+    uint32_t ipc_num;
+    uint32_t res;
+    struct vm_info_ipc ipcs[VM_INFO_IPC_MAX];
+};
+
+struct vm_info_vcpu {
+    volatile uint32_t seq;
+    uint32_t vcpu_id;
+    uint64_t pcpu_id;
+    /* Nanoseconds the hypervisor ran on the vcpu's behalf, updated on every exit */
+    volatile uint64_t steal_ns;
+};
+
+static inline void vm_info_write_begin(volatile uint32_t* seq)
+{
+    *seq = *seq + 1;
+    fence_ord_write();
+}
+
+static inline void vm_info_write_end(volatile uint32_t* seq)
+{
+    fence_ord_write();
+    *seq = *seq + 1;
+}
+
+struct vm;
+struct vcpu;
+struct vm_config;
+
+void vm_info_vm_init(struct vm* vm, const struct vm_config* config);
+void vm_info_vcpu_init(struct vcpu* vcpu);
+void vm_info_update_colors(struct vm* vm);
+
+static inline void vm_info_steal_update(struct vm_info_vcpu* info, uint64_t steal_ns)
+{
+    vm_info_write_begin(&info->seq);
+    info->steal_ns = steal_ns;
+    vm_info_write_end(&info->seq);
+}
+
+#endif /* __VM_INFO_H__ */
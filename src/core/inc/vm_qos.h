@@ -0,0 +1,64 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __VM_QOS_H__
+#define __VM_QOS_H__
+
+#include <bao.h>
+#include <hypercall.h>
+
+/**
+ * HC_VM_QOS(vm_id, param, value) reads, or with VM_QOS_SET set in param, adjusts one of another
+ * vm's resource parameters at run time, starting out as given in its config, e.g. for a controller
+ * in a manager vm to rebalance the vms as their load changes. A read returns the parameter's
+ * current value. Only a vm configured as vm_manager can issue it.
+ *   VM_QOS_COLORS is the vm's colors, set by recoloring it as HC_VM_RECOLOR does, which also
+ *   updates it.
+ *   VM_QOS_CACHE_WAYS is the vm's last level cache way groups, see vm_config.cache_ways.
+ *   VM_QOS_CACHE_PORTIONS and VM_QOS_MBW_MAX are the vm's hardware qos partition, see
+ *   vm_config.qos, which can only be changed for vms partitioned at boot.
+ *   VM_QOS_MEMBW_* and VM_QOS_IRQ_LIMIT_* are the budgets and periods of each of the vm's vcpus,
+ *   see vm_config.membw and vm_config.irq_limit. Memory bandwidth budgets can only be set if
+ *   some vm was configured with one.
+ * The vm's vcpus apply the per cpu parameters before they next run the guest. The effect of the
+ * rate limits is read back as the read only VM_QOS_STAT_* parameters, the stats counters of all the
+ * vm's vcpus. The resources the vms are given are not checked to be exclusive, which is up to the
+ * caller.
+ */
+enum {
+    VM_QOS_COLORS,
+    VM_QOS_CACHE_WAYS,
+    VM_QOS_CACHE_PORTIONS,
+    VM_QOS_MBW_MAX,
+    VM_QOS_MEMBW_BUDGET,
+    VM_QOS_MEMBW_PERIOD_US,
+    VM_QOS_IRQ_LIMIT_BUDGET,
+    VM_QOS_IRQ_LIMIT_PERIOD_US,
+    VM_QOS_PARAM_NUM
+};
+
+/* Read only, the STATS_* counters of the same names, see enum stats_counter */
+enum {
+    VM_QOS_STAT_MEMBW_THROTTLES = VM_QOS_PARAM_NUM,
+    VM_QOS_STAT_MEMBW_THROTTLED_NS,
+    VM_QOS_STAT_IRQS_DEFERRED,
+    VM_QOS_STAT_IRQ_LIMIT_HITS,
+    VM_QOS_STAT_END
+};
+
+#define VM_QOS_SET (1UL << 31)
+
+long int vm_qos_hypercall(unsigned long vm_id, unsigned long param, unsigned long value);
+
+/* Records the vm's colors after it is recolored, by either hypercall */
+void vm_qos_colors_update(vmid_t vm_id, colormap_t colors);
+
+/**
+ * May be implemented by the architecture to change the vm's hardware qos partition, where zero
+ * leaves a resource unrestricted. The default implementation reports it as unsupported.
+ */
+bool vm_qos_arch_partition(vmid_t vm_id, uint64_t cache_portions, uint32_t mbw_max);
+
+#endif /* __VM_QOS_H__ */
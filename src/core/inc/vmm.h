@@ -19,4 +19,6 @@ void vmm_io_init();
 struct vm_install_info vmm_get_vm_install_info(struct vm_allocation* vm_alloc);
 void vmm_vm_install(struct vm_install_info* install_info);
 
+const cpumask_t* vmm_vm_cpus(vmid_t vm_id);
+
 #endif /* __VMM_H__ */
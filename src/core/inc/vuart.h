@@ -0,0 +1,73 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __VUART_H__
+#define __VUART_H__
+
+#include <bao.h>
+#include <emul.h>
+#include <spinlock.h>
+#include <list.h>
+
+/**
+ * The virtual uart models a 16550 whose transmitter drains instantly: the line status always
+ * reports an empty fifo, so the guest writes a whole fifo's worth of characters for each status
+ * read, or for each transmit interrupt, instead of polling before every character. The characters
+ * are buffered in the vm's ring and only published for the console to write out, prefixed by the
+ * vm's id, once a line is complete or the ring is half full. There is no input, so the receive
+ * buffer is always empty.
+ */
+#ifndef VUART_RING_SIZE
+#define VUART_RING_SIZE (512)
+#endif
+
+#define VUART_FIFO_DEPTH (16)
+#define VUART_PREFIX_LEN (16)
+
+struct vuart_config {
+    /* Guest address of the first register, the vm having no virtual uart if it is zero */
+    vaddr_t base;
+    /* Distance between registers, 1 or 4 bytes, 1 if left zero */
+    size_t reg_width;
+    /* Transmit interrupt, or zero for a polled only uart */
+    irqid_t interrupt;
+};
+
+struct vuart {
+    node_t node;
+    struct emul_mem emul;
+    size_t reg_width;
+    irqid_t interrupt;
+    char prefix[VUART_PREFIX_LEN];
+    size_t prefix_len;
+
+    /* Register state and the producer's index, guarded by the lock */
+    spinlock_t lock;
+    size_t wr;
+    uint8_t ier;
+    uint8_t lcr;
+    uint8_t mcr;
+    uint8_t scr;
+    uint8_t dll;
+    uint8_t dlm;
+    bool fifo_en;
+    bool thre_pending;
+
+    /* Published by the vm's cpus and consumed by the console's drainer */
+    volatile size_t head;
+    volatile size_t tail;
+    bool line_start;
+    char buf[VUART_RING_SIZE];
+};
+
+struct vm;
+struct vm_config;
+
+void vuart_init(void);
+void vuart_vm_init(struct vm* vm, const struct vm_config* config);
+bool vuart_pending(void);
+void vuart_drain(void);
+
+#endif /* __VUART_H__ */
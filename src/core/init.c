@@ -12,6 +12,12 @@
 #include <printk.h>
 #include <platform.h>
 #include <vmm.h>
+#include <timer.h>
+#include <prof.h>
+#include <stats.h>
+#include <membw.h>
+#include <cache.h>
+#include <boot_timing.h>
 
 void init(cpuid_t cpu_id, paddr_t load_addr)
 {
@@ -20,6 +26,7 @@ void init(cpuid_t cpu_id, paddr_t load_addr)
      */
 
     cpu_init(cpu_id, load_addr);
+    boot_timing_init();
     mem_init(load_addr);
 
     /* -------------------------------------------------------------- */
@@ -28,10 +35,23 @@ void init(cpuid_t cpu_id, paddr_t load_addr)
 
     if (cpu_is_master()) {
         console_printk("Bao Hypervisor\n\r");
+        INFO("Cache coloring: %d colors of %d contiguous pages", COLOR_NUM, COLOR_SIZE);
+        if (COLOR_BANK_NUM > 1) {
+            INFO("Bank coloring: %d banks of %d contiguous pages", COLOR_BANK_NUM,
+                COLOR_BANK_SIZE);
+        }
     }
 
     interrupts_init();
 
+    timer_init();
+
+    prof_init();
+
+    stats_init();
+
+    membw_init();
+
     vmm_init();
 
     /* Should never reach here */
@@ -6,13 +6,19 @@
 #include <interrupts.h>
 
 #include <cpu.h>
+#include <config.h>
+#include <platform.h>
+#include <irq_limit.h>
+#include <posted.h>
 #include <vm.h>
 #include <bitmap.h>
 #include <string.h>
 
 BITMAP_ALLOC(hyp_interrupt_bitmap, MAX_INTERRUPTS);
 BITMAP_ALLOC(global_interrupt_bitmap, MAX_INTERRUPTS);
-spinlock_t irq_reserve_lock = SPINLOCK_INITVAL;
+mcslock_t irq_reserve_lock = MCSLOCK_INITVAL;
+/* Lets interrupts_handle read the interrupts' owners without taking irq_reserve_lock */
+seqlock_t irq_owner_seq = SEQLOCK_INITVAL;
 
 irq_handler_t interrupt_handlers[MAX_INTERRUPTS];
 
@@ -21,11 +27,58 @@ inline void interrupts_cpu_sendipi(cpuid_t target_cpu, irqid_t ipi_id)
     interrupts_arch_ipi_send(target_cpu, ipi_id);
 }
 
+inline void interrupts_cpu_sendipi_mask(const cpumask_t* cpu_mask, irqid_t ipi_id)
+{
+    if (!cpumask_empty(cpu_mask)) {
+        interrupts_arch_ipi_send_mask(cpu_mask, ipi_id);
+    }
+}
+
 inline void interrupts_cpu_enable(irqid_t int_id, bool en)
 {
     interrupts_arch_enable(int_id, en);
 }
 
+enum { INTERRUPTS_HYP_ENABLE };
+
+static void interrupts_msg_handler(uint32_t event, uint64_t data)
+{
+    switch (event) {
+        case INTERRUPTS_HYP_ENABLE:
+            interrupts_cpu_enable((irqid_t)data, true);
+            break;
+    }
+}
+CPU_MSG_HANDLER(interrupts_msg_handler, INTERRUPTS_CPUMSG_ID);
+
+static cpuid_t interrupts_housekeeping_cpu(void)
+{
+    for (cpuid_t cpu_id = 0; cpu_id < platform.cpu_num; cpu_id++) {
+        if ((config.hyp.housekeeping_cpus & (1UL << cpu_id)) != 0) {
+            return cpu_id;
+        }
+    }
+
+    return cpu()->id;
+}
+
+/**
+ * Enables a global interrupt reserved by the hypervisor on the housekeeping cpu. If that is
+ * another cpu, it enables the interrupt itself once it handles the message, since the routing
+ * and, e.g. on a plic, the enables are set for the cpu doing it.
+ */
+void interrupts_hyp_enable(irqid_t int_id)
+{
+    cpuid_t target = interrupts_housekeeping_cpu();
+
+    if (target == cpu()->id) {
+        interrupts_cpu_enable(int_id, true);
+    } else {
+        struct cpu_msg msg = { (uint32_t)INTERRUPTS_CPUMSG_ID, INTERRUPTS_HYP_ENABLE, int_id };
+        cpu_send_msg(target, &msg);
+    }
+}
+
 inline bool interrupts_check(irqid_t int_id)
 {
     return interrupts_arch_check(int_id);
@@ -67,36 +120,57 @@ static inline bool interrupt_assigned(irqid_t int_id)
     return bitmap_get(global_interrupt_bitmap, int_id);
 }
 
-enum irq_res interrupts_handle(irqid_t int_id)
+__hot enum irq_res interrupts_handle(irqid_t int_id)
 {
-    if (vm_has_interrupt(cpu()->vcpu->vm, int_id)) {
-        vcpu_inject_hw_irq(cpu()->vcpu, int_id);
+    if (int_id >= MAX_INTERRUPTS) {
+        ERROR("received unknown interrupt id = %d", int_id);
+    }
 
-        return FORWARD_TO_VM;
+    struct vm* vm = cpu()->vcpu->vm;
+    if (vm_has_interrupt(vm, int_id)) {
+        if ((vm->posted.page != NULL) && bitmap_get(vm->posted.bitmap, int_id)) {
+            posted_irq_post(vm, int_id);
+            return HANDLED_BY_HYP;
+        }
+
+        if (irq_limit_take(int_id)) {
+            vcpu_inject_hw_irq(cpu()->vcpu, int_id);
+        }
 
-    } else if (interrupt_assigned_to_hyp(int_id)) {
-        interrupt_handlers[int_id](int_id);
+        return FORWARD_TO_VM;
+    }
 
-        return HANDLED_BY_HYP;
+    irq_handler_t handler = NULL;
+    uint32_t seq;
+    do {
+        seq = seq_read_begin(&irq_owner_seq);
+        handler = interrupt_assigned_to_hyp(int_id) ? interrupt_handlers[int_id] : NULL;
+    } while (seq_read_retry(&irq_owner_seq, seq));
 
-    } else {
+    if (handler == NULL) {
         ERROR("received unknown interrupt id = %d", int_id);
     }
+
+    handler(int_id);
+
+    return HANDLED_BY_HYP;
 }
 
 bool interrupts_vm_assign(struct vm* vm, irqid_t id)
 {
     bool ret = false;
 
-    spin_lock(&irq_reserve_lock);
-    if (!interrupts_arch_conflict(global_interrupt_bitmap, id)) {
+    mcs_lock(&irq_reserve_lock);
+    if ((id < VM_MAX_INTERRUPTS) && !interrupts_arch_conflict(global_interrupt_bitmap, id)) {
         ret = true;
         interrupts_arch_vm_assign(vm, id);
 
+        seq_write_begin(&irq_owner_seq);
         bitmap_set(vm->interrupt_bitmap, id);
         bitmap_set(global_interrupt_bitmap, id);
+        seq_write_end(&irq_owner_seq);
     }
-    spin_unlock(&irq_reserve_lock);
+    mcs_unlock(&irq_reserve_lock);
 
     return ret;
 }
@@ -105,14 +179,16 @@ bool interrupts_reserve(irqid_t int_id, irq_handler_t handler)
 {
     bool ret = false;
 
-    spin_lock(&irq_reserve_lock);
+    mcs_lock(&irq_reserve_lock);
     if ((int_id < MAX_INTERRUPTS) && !interrupt_assigned(int_id)) {
         ret = true;
+        seq_write_begin(&irq_owner_seq);
         interrupt_handlers[int_id] = handler;
         bitmap_set(hyp_interrupt_bitmap, int_id);
         bitmap_set(global_interrupt_bitmap, int_id);
+        seq_write_end(&irq_owner_seq);
     }
-    spin_unlock(&irq_reserve_lock);
+    mcs_unlock(&irq_reserve_lock);
 
     return ret;
 }
@@ -9,6 +9,12 @@
 #include <vmm.h>
 #include <hypercall.h>
 #include <config.h>
+#include <ipc_ring.h>
+#include <trace.h>
+#include <fences.h>
+#include <string.h>
+#include <vm.h>
+#include <bit.h>
 
 enum { IPC_NOTIFY };
 
@@ -32,25 +38,19 @@ struct shmem* ipc_get_shmem(size_t shmem_id)
     }
 }
 
-static struct ipc* ipc_find_by_shmemid(struct vm* vm, size_t shmem_id)
+static void ipc_notify(size_t shmem_id, size_t event_id)
 {
-    struct ipc* ipc_obj = NULL;
-
-    for (size_t i = 0; i < vm->ipc_num; i++) {
-        if (vm->ipcs[i].shmem_id == shmem_id) {
-            ipc_obj = &vm->ipcs[i];
-            break;
-        }
+    struct shmem* shmem = ipc_get_shmem(shmem_id);
+    if ((shmem != NULL) && (event_id < (sizeof(shmem->doorbell_pend) * 8))) {
+        spin_lock(&shmem->lock);
+        shmem->doorbell_pend = bit32_clear(shmem->doorbell_pend, event_id);
+        spin_unlock(&shmem->lock);
     }
 
-    return ipc_obj;
-}
-
-static void ipc_notify(size_t shmem_id, size_t event_id)
-{
-    struct ipc* ipc_obj = ipc_find_by_shmemid(cpu()->vcpu->vm, shmem_id);
+    struct ipc* ipc_obj = (shmem != NULL) ? shmem->notify_ipc[cpu()->id] : NULL;
     if (ipc_obj != NULL && event_id < ipc_obj->interrupt_num) {
         irqid_t irq_id = ipc_obj->interrupts[event_id];
+        stats_inc(STATS_IPC_NOTIFIES_RECEIVED);
         vcpu_inject_hw_irq(cpu()->vcpu, irq_id);
     }
 }
@@ -66,37 +66,162 @@ static void ipc_handler(uint32_t event, uint64_t data)
 }
 CPU_MSG_HANDLER(ipc_handler, IPC_CPUMSG_ID);
 
-unsigned long ipc_hypercall(unsigned long ipc_id, unsigned long ipc_event, unsigned long arg2)
+/**
+ * Check if any of the ring indices moved past the event index published by the other side since
+ * the last notification, which must be called with the shmem lock held.
+ */
+static bool ipc_ring_notify_needed(struct shmem* shmem)
 {
-    unsigned long ret = -HC_E_SUCCESS;
+    struct ipc_ring* ring = shmem->ring_hdr;
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+
+    fence_ord_read();
+
+    bool notify = ipc_ring_need_event(ring->head_event, head, shmem->ring_head) ||
+        ipc_ring_need_event(ring->tail_event, tail, shmem->ring_tail);
+
+    shmem->ring_head = head;
+    shmem->ring_tail = tail;
 
+    return notify;
+}
+
+/**
+ * Notifies the event of the vm's ipc to the other vms sharing its memory. Doorbell events are
+ * coalesced, i.e., ringing an event whose previous notification was not delivered yet sends
+ * nothing, as the peer is still to get the interrupt anyway.
+ */
+static bool ipc_send_notify(struct vm* vm, size_t ipc_id, unsigned long ipc_event, bool doorbell)
+{
     struct shmem* shmem = NULL;
-    bool valid_ipc_obj = ipc_id < cpu()->vcpu->vm->ipc_num;
-    if (valid_ipc_obj) {
-        shmem = ipc_get_shmem(cpu()->vcpu->vm->ipcs[ipc_id].shmem_id);
+    if (ipc_id < vm->ipc_num) {
+        shmem = ipc_get_shmem(vm->ipcs[ipc_id].shmem_id);
+    }
+    if (shmem == NULL) {
+        return false;
     }
-    bool valid_shmem = shmem != NULL;
 
-    if (valid_ipc_obj && valid_shmem) {
-        cpumap_t ipc_cpu_masters = shmem->cpu_masters & ~cpu()->vcpu->vm->cpus;
+    cpumask_t ipc_notify_cpus;
+    cpumask_andnot(&ipc_notify_cpus, &shmem->notify_cpus, &vm->cpus);
+
+    bool notify = true;
+    if (shmem->ring || doorbell) {
+        spin_lock(&shmem->lock);
+        if (shmem->ring) {
+            notify = ipc_ring_notify_needed(shmem);
+        }
+        if (notify && doorbell && (ipc_event < (sizeof(shmem->doorbell_pend) * 8))) {
+            notify = !bit32_get(shmem->doorbell_pend, ipc_event);
+            shmem->doorbell_pend = bit32_set(shmem->doorbell_pend, ipc_event);
+        }
+        spin_unlock(&shmem->lock);
+    }
 
+    if (notify) {
         union ipc_msg_data data = {
-            .shmem_id = cpu()->vcpu->vm->ipcs[ipc_id].shmem_id,
+            .shmem_id = vm->ipcs[ipc_id].shmem_id,
             .event_id = ipc_event,
         };
         struct cpu_msg msg = { IPC_CPUMSG_ID, IPC_NOTIFY, data.raw };
 
-        for (size_t i = 0; i < platform.cpu_num; i++) {
-            if (ipc_cpu_masters & (1ULL << i)) {
-                cpu_send_msg(i, &msg);
-            }
+        stats_inc(STATS_IPC_NOTIFIES_SENT);
+        cpu_send_urgent_msg_mask(&ipc_notify_cpus, &msg);
+    }
+
+    return true;
+}
+
+unsigned long ipc_hypercall(unsigned long ipc_id, unsigned long ipc_event, unsigned long arg2)
+{
+    if (!ipc_send_notify(cpu()->vcpu->vm, ipc_id, ipc_event, false)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    return -HC_E_SUCCESS;
+}
+
+static ssize_t ipc_doorbell_find(struct vm* vm, vaddr_t addr)
+{
+    for (size_t i = 0; i < vm->ipc_num; i++) {
+        vaddr_t doorbell = vm->ipcs[i].doorbell;
+        if ((doorbell != 0) && (addr >= doorbell) && (addr < (doorbell + PAGE_SIZE))) {
+            return (ssize_t)i;
         }
+    }
 
-    } else {
-        ret = -HC_E_INVAL_ARGS;
+    return -1;
+}
+
+/**
+ * Fast path for guest writes to a doorbell, checked on a data abort before any other handling. The
+ * written value is irrelevant, so the access needs no further decoding. Returns false if addr is
+ * not in a doorbell of the vcpu's vm.
+ */
+bool ipc_doorbell_write(struct vcpu* vcpu, vaddr_t addr)
+{
+    ssize_t ipc_id = ipc_doorbell_find(vcpu->vm, addr);
+    if (ipc_id < 0) {
+        return false;
+    }
+
+    vaddr_t event = (addr - vcpu->vm->ipcs[ipc_id].doorbell) / sizeof(uint32_t);
+    ipc_send_notify(vcpu->vm, (size_t)ipc_id, event, true);
+
+    return true;
+}
+
+/* Accesses the fast path can not take, e.g. reads, which always return zero */
+bool ipc_doorbell_emul_handler(struct emul_access* acc)
+{
+    if (acc->write) {
+        return ipc_doorbell_write(cpu()->vcpu, acc->addr);
+    }
+
+    vcpu_writereg(cpu()->vcpu, acc->reg, 0);
+    return true;
+}
+
+bool ipc_vm_shares_shmem(const struct vm_config* vm_config, size_t shmem_id)
+{
+    for (size_t i = 0; i < vm_config->platform.ipc_num; i++) {
+        if (vm_config->platform.ipcs[i].shmem_id == shmem_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Uncolored vms, i.e., with all or no colors, count as having all colors, in each of the cache
+ * and bank dimensions. If the sharing vms have no colors in common in either, the shared memory
+ * gets the colors of any of them instead, as it would otherwise be left uncolored and pollute
+ * every other vm's partition.
+ */
+static colormap_t ipc_shmem_colors(struct shmem* shmem, size_t shmem_id)
+{
+    if (shmem->color_placement == SHMEM_COLORS_FIXED) {
+        return shmem->colors;
     }
 
-    return ret;
+    colormap_t intersection = clrs_mask();
+    colormap_t merged = 0;
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        if (ipc_vm_shares_shmem(&config.vmlist[i], shmem_id)) {
+            colormap_t colors = clrs_fill(config.vmlist[i].colors);
+            intersection &= colors;
+            merged |= colors;
+        }
+    }
+
+    if (shmem->color_placement == SHMEM_COLORS_INTERSECT) {
+        if (((intersection & BIT_MASK(0, COLOR_NUM)) != 0) && (clrs_banks(intersection) != 0)) {
+            return intersection;
+        }
+        WARNING("Shared memory %d vms have no colors in common. Using their union.", shmem_id);
+    }
+
+    return merged;
 }
 
 static void ipc_alloc_shmem()
@@ -104,6 +229,7 @@ static void ipc_alloc_shmem()
     for (size_t i = 0; i < shmem_table_size; i++) {
         struct shmem* shmem = &shmem_table[i];
         if (!shmem->place_phys) {
+            shmem->colors = ipc_shmem_colors(shmem, i);
             size_t n_pg = NUM_PAGES(shmem->size);
             struct ppages ppages = mem_alloc_ppages(shmem->colors, n_pg, false);
             if (ppages.num_pages < n_pg) {
@@ -114,6 +240,22 @@ static void ipc_alloc_shmem()
     }
 }
 
+static void ipc_ring_init(struct shmem* shmem)
+{
+    if (shmem->size < sizeof(struct ipc_ring)) {
+        WARNING("Shared memory too small to hold a ring. Ignored.");
+        shmem->ring = false;
+        return;
+    }
+
+    struct ppages ppages = mem_ppages_get(shmem->phys, NUM_PAGES(sizeof(struct ipc_ring)));
+    shmem->ring_hdr = (struct ipc_ring*)mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &ppages,
+        INVALID_VA, ppages.num_pages, PTE_HYP_FLAGS);
+    memset((void*)shmem->ring_hdr, 0, sizeof(struct ipc_ring));
+    shmem->ring_head = 0;
+    shmem->ring_tail = 0;
+}
+
 void ipc_init()
 {
     if (cpu_is_master()) {
@@ -122,7 +264,18 @@ void ipc_init()
         ipc_alloc_shmem();
 
         for (size_t i = 0; i < config.shmemlist_size; i++) {
-            config.shmemlist[i].cpu_masters = 0;
+            struct shmem* shmem = &config.shmemlist[i];
+            shmem->notify_cpus = CPUMASK_EMPTY;
+            bool hyp_access = shmem->ring || (shmem->trace != SHMEM_TRACE_NONE);
+            if (hyp_access && (shmem->cacheability != MEM_CACHE_WB)) {
+                WARNING("Shared memory %d holds a ring, so must be cacheable. Ignored.", i);
+                shmem->cacheability = MEM_CACHE_WB;
+            }
+            if (shmem->ring) {
+                ipc_ring_init(shmem);
+            } else if (shmem->trace != SHMEM_TRACE_NONE) {
+                trace_stream_init(shmem);
+            }
         }
     }
 }
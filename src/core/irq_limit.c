@@ -0,0 +1,130 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <irq_limit.h>
+#include <interrupts.h>
+#include <config.h>
+#include <cpu.h>
+#include <vm.h>
+#include <timer.h>
+#include <stats.h>
+#include <bitmap.h>
+
+/**
+ * Token bucket limiting of the hardware interrupts forwarded to each vcpu. The bucket is refilled
+ * with budget tokens at the start of each period, lazily by the first interrupt taken in it, and
+ * each forwarded interrupt takes a token. Once the bucket is empty, interrupts are deferred
+ * instead of injected. A deferred interrupt is left active at the GIC, or claimed and not
+ * completed at the PLIC, so it does not fire again until it is injected and the guest handles it.
+ * A timer refills the bucket at the end of the period and injects the deferred interrupts.
+ */
+struct irq_limit_cpu {
+    uint32_t budget;
+    uint32_t tokens;
+    uint64_t period_ticks;
+    uint64_t period_start;
+    struct timer_event refill;
+    size_t deferred_num;
+    BITMAP_ALLOC(deferred, MAX_INTERRUPTS);
+};
+
+static struct irq_limit_cpu irq_limit_cpus[PLAT_CPU_NUM];
+
+__attribute__((weak)) void irq_limit_arch_mask(irqid_t int_id, bool mask)
+{
+    (void)int_id;
+    (void)mask;
+}
+
+static void irq_limit_release(struct irq_limit_cpu* irql)
+{
+    for (irqid_t id = 0; (id < MAX_INTERRUPTS) && (irql->deferred_num > 0); id++) {
+        if (bitmap_get(irql->deferred, id)) {
+            bitmap_clear(irql->deferred, id);
+            irql->deferred_num--;
+            if (irql->tokens > 0) {
+                irql->tokens--;
+            }
+            irq_limit_arch_mask(id, false);
+            vcpu_inject_hw_irq(cpu()->vcpu, id);
+        }
+    }
+}
+
+static void irq_limit_refill_handler(struct timer_event* event)
+{
+    struct irq_limit_cpu* irql = &irq_limit_cpus[cpu()->id];
+
+    irql->tokens = irql->budget;
+    irql->period_start = event->deadline;
+    irq_limit_release(irql);
+}
+
+void irq_limit_vcpu_init(struct vcpu* vcpu)
+{
+    irq_limit_cpus[cpu()->id].deferred_num = 0;
+    irq_limit_vcpu_set(vcpu->vm->config->irq_limit.budget, vcpu->vm->config->irq_limit.period_us);
+}
+
+/**
+ * Sets the budget of the cpu's vcpu, starting a new period. The interrupts deferred so far are
+ * injected right away, taking tokens from the new budget. A zero budget leaves the vcpu unlimited.
+ */
+void irq_limit_vcpu_set(uint32_t budget, uint32_t period_us)
+{
+    struct irq_limit_cpu* irql = &irq_limit_cpus[cpu()->id];
+
+    if (period_us == 0) {
+        period_us = IRQ_LIMIT_DEFAULT_PERIOD_US;
+    }
+
+    timer_cancel(&irql->refill);
+    irql->period_ticks = timer_ns_to_ticks((uint64_t)period_us * 1000);
+    irql->period_start = timer_get();
+    irql->tokens = budget;
+    irql->refill.handler = irq_limit_refill_handler;
+    /* The held interrupts are masked at the controller, they can not wake an idle cpu */
+    irql->refill.deferrable = false;
+    irql->budget = budget;
+    irq_limit_release(irql);
+}
+
+/**
+ * Takes a token for forwarding the interrupt to the cpu's vcpu. Returns false if the interrupt
+ * was deferred instead, in which case it must not be acknowledged at the interrupt controller.
+ */
+bool irq_limit_take(irqid_t int_id)
+{
+    struct irq_limit_cpu* irql = &irq_limit_cpus[cpu()->id];
+
+    if (irql->budget == 0) {
+        return true;
+    }
+
+    uint64_t now = timer_get();
+    if (!timer_is_armed(&irql->refill) && ((now - irql->period_start) >= irql->period_ticks)) {
+        irql->tokens = irql->budget;
+        irql->period_start = now;
+    }
+
+    if (irql->tokens > 0) {
+        irql->tokens--;
+        return true;
+    }
+
+    if (!bitmap_get(irql->deferred, int_id)) {
+        bitmap_set(irql->deferred, int_id);
+        irql->deferred_num++;
+        irq_limit_arch_mask(int_id, true);
+        stats_inc(STATS_IRQS_DEFERRED);
+    }
+
+    if (!timer_is_armed(&irql->refill)) {
+        stats_inc(STATS_IRQ_LIMIT_HITS);
+        timer_arm(&irql->refill, irql->period_start + irql->period_ticks);
+    }
+
+    return false;
+}
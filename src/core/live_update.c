@@ -0,0 +1,356 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <live_update.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <vmm.h>
+#include <mem.h>
+#include <cache.h>
+#include <config.h>
+#include <platform.h>
+#include <spinlock.h>
+#include <fences.h>
+#include <string.h>
+
+/**
+ * The area is split in one slot per vm, so that each vm's master finds its record without
+ * agreeing on a layout with the others. The header is only written by the master cpu, once all
+ * records are, and goes last, so a reset interrupting the save leaves no valid handoff behind.
+ */
+static struct {
+    struct live_update_hdr* hdr;
+    /* Whether the area held a valid handoff when this image booted */
+    bool handoff;
+    spinlock_t lock;
+    bool pending;
+} live_update;
+
+#define LIVE_UPDATE_LAYOUT \
+    (((uint64_t)sizeof(struct live_update_vm) << 32) | sizeof(struct vcpu_snapshot))
+
+enum { LIVE_UPDATE_SAVE };
+
+static void live_update_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(live_update_msg_handler, LIVE_UPDATE_CPUMSG_ID);
+
+static size_t live_update_slot_size(void)
+{
+    size_t slots = platform.live_update.size - PAGE_SIZE;
+    return ((slots / CONFIG_VM_NUM) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE;
+}
+
+static struct live_update_vm* live_update_vm_rec(vmid_t vm_id)
+{
+    vaddr_t slots = (vaddr_t)live_update.hdr + PAGE_SIZE;
+    return (struct live_update_vm*)(slots + (vm_id * live_update_slot_size()));
+}
+
+static struct shmem* live_update_shmem(const struct ipc* ipc)
+{
+    return (ipc->shmem_id < config.shmemlist_size) ? &config.shmemlist[ipc->shmem_id] : NULL;
+}
+
+static uint64_t live_update_hash(uint64_t hash, uint64_t val)
+{
+    for (size_t i = 0; i < sizeof(val); i++) {
+        hash = (hash ^ ((val >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t live_update_vm_fingerprint(const struct vm_config* config)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = live_update_hash(hash, config->platform.cpu_num);
+    hash = live_update_hash(hash, config->image.base_addr);
+    hash = live_update_hash(hash, config->image.size);
+    for (size_t i = 0; i < config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &config->platform.regions[i];
+        hash = live_update_hash(hash, reg->base);
+        hash = live_update_hash(hash, reg->size);
+        hash = live_update_hash(hash, reg->phys);
+    }
+    for (size_t i = 0; i < config->platform.ipc_num; i++) {
+        struct shmem* shmem = live_update_shmem(&config->platform.ipcs[i]);
+        hash = live_update_hash(hash, config->platform.ipcs[i].base);
+        hash = live_update_hash(hash, (shmem != NULL) ? shmem->phys : 0);
+    }
+
+    return hash;
+}
+
+/**
+ * The memory a guest sees must be the same physical memory in the new image, and its interrupt
+ * exits must save the whole register file, as for snapshots.
+ */
+static bool live_update_vm_preservable(const struct vm_config* config)
+{
+    if (!config->snapshot) {
+        return false;
+    }
+    for (size_t i = 0; i < config->platform.region_num; i++) {
+        if (!config->platform.regions[i].place_phys) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < config->platform.ipc_num; i++) {
+        struct shmem* shmem = live_update_shmem(&config->platform.ipcs[i]);
+        if ((shmem == NULL) || !shmem->place_phys) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Run by the master cpu before the vms are initialized. The area is outside the memory regions,
+ * so the allocator never hands out its pages.
+ */
+void live_update_init(void)
+{
+    paddr_t base = platform.live_update.base;
+    size_t size = platform.live_update.size;
+
+    if (size == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < platform.region_num; i++) {
+        struct mem_region* reg = &platform.regions[i];
+        if (range_overlap_range(base, size, reg->base, reg->size)) {
+            ERROR("live update area overlaps the platform's memory");
+        }
+    }
+
+    if (((base % PAGE_SIZE) != 0) || (size <= PAGE_SIZE)) {
+        WARNING("Live update area not page aligned or too small. Ignored.");
+        return;
+    }
+
+    struct ppages ppages = mem_ppages_get(base, NUM_PAGES(size));
+    struct live_update_hdr* hdr = (struct live_update_hdr*)mem_alloc_map(&cpu()->as,
+        SEC_HYP_GLOBAL, &ppages, INVALID_VA, ppages.num_pages, PTE_HYP_FLAGS);
+    if (hdr == (struct live_update_hdr*)INVALID_VA) {
+        ERROR("failed to map the live update area");
+    }
+
+    live_update.handoff = (hdr->magic == LIVE_UPDATE_MAGIC) &&
+        (hdr->version == LIVE_UPDATE_VERSION) && (hdr->vm_num == CONFIG_VM_NUM) &&
+        (hdr->layout == LIVE_UPDATE_LAYOUT) && (hdr->slot_size == live_update_slot_size());
+    hdr->magic = 0;
+    fence_ord_write();
+    live_update.hdr = hdr;
+
+    if (live_update.handoff) {
+        INFO("Resuming vms after live update");
+    }
+}
+
+/**
+ * Whether the vm is resumed from the handoff, i.e., its memory is kept as is. Only valid once the
+ * vm's arch is initialized, as its arch snapshot size depends on it.
+ */
+bool live_update_vm_resumed(struct vm* vm)
+{
+    if (!live_update.handoff) {
+        return false;
+    }
+
+    struct live_update_vm* rec = live_update_vm_rec(vm->id);
+    return rec->saved && (rec->cpu_num == vm->cpu_num) &&
+        (rec->fingerprint == live_update_vm_fingerprint(vm->config)) &&
+        (rec->arch_data_size == vm_arch_snapshot_data_size(vm));
+}
+
+/**
+ * Called by all of the vm's cpus once the vm is initialized. The record is discarded once
+ * restored, so an ordinary reboot later finds none.
+ */
+void live_update_vm_resume(struct vm* vm)
+{
+    if (!live_update_vm_resumed(vm)) {
+        return;
+    }
+
+    struct live_update_vm* rec = live_update_vm_rec(vm->id);
+    struct vcpu* vcpu = cpu()->vcpu;
+    bool master = (cpu()->id == vm->master);
+
+    if (master) {
+        vm_arch_snapshot_place(vm, &rec->arch, (void*)((vaddr_t)rec + rec->arch_data_off));
+        vm_arch_snapshot_restore(vm, &rec->arch);
+    }
+
+    cpu_sync_barrier(&vm->sync);
+
+    vcpu_arch_snapshot_restore(vcpu, &rec->vcpus[vcpu->id].arch);
+    vcpu->regs = rec->vcpus[vcpu->id].regs;
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (master) {
+        rec->saved = false;
+        INFO("VM %d resumed", vm->id);
+    }
+}
+
+#ifndef LIVE_UPDATE_CLEAN_CHUNK
+#define LIVE_UPDATE_CLEAN_CHUNK (0x200000)
+#endif
+
+/**
+ * The vm's memory is only mapped in its own stage 2, so it is cleaned to the point of coherency
+ * through temporary hypervisor mappings, a chunk at a time, for none of the guest's writes still in
+ * the caches to be lost on the reset.
+ */
+static bool live_update_mem_clean(paddr_t base, size_t size)
+{
+    for (size_t off = 0; off < size; off += LIVE_UPDATE_CLEAN_CHUNK) {
+        size_t n = NUM_PAGES(min(size - off, (size_t)LIVE_UPDATE_CLEAN_CHUNK));
+        struct ppages ppages = mem_ppages_get(base + off, n);
+        vaddr_t va =
+            mem_alloc_map(&cpu()->as, SEC_HYP_PRIVATE, &ppages, INVALID_VA, n, PTE_HYP_FLAGS);
+        if (va == INVALID_VA) {
+            return false;
+        }
+        cache_clean_range(va, n * PAGE_SIZE);
+        mem_unmap(&cpu()->as, va, n, false);
+    }
+    return true;
+}
+
+static bool live_update_vm_clean(const struct vm_config* config)
+{
+    for (size_t i = 0; i < config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &config->platform.regions[i];
+        if (!live_update_mem_clean(reg->phys, reg->size)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < config->platform.ipc_num; i++) {
+        struct shmem* shmem = live_update_shmem(&config->platform.ipcs[i]);
+        if (!live_update_mem_clean(shmem->phys, shmem->size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void live_update_vm_save(struct vm* vm, struct live_update_vm* rec)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    bool master = (cpu()->id == vm->master);
+    size_t arch_data_off = ALIGN(sizeof(struct live_update_vm) +
+            (vm->cpu_num * sizeof(struct vcpu_snapshot)), CACHE_LINE_SIZE);
+    size_t arch_data_size = vm_arch_snapshot_data_size(vm);
+
+    if (master) {
+        rec->saved = false;
+        rec->cpu_num = vm->cpu_num;
+        rec->fingerprint = live_update_vm_fingerprint(vm->config);
+        rec->arch_data_off = arch_data_off;
+        rec->arch_data_size = arch_data_size;
+    }
+
+    if (!live_update_vm_preservable(vm->config) ||
+        ((arch_data_off + arch_data_size) > live_update_slot_size()) ||
+        !vm_arch_snapshot_place(vm, &rec->arch, (void*)((vaddr_t)rec + arch_data_off))) {
+        return;
+    }
+
+    vcpu_arch_snapshot_save(vcpu, &rec->vcpus[vcpu->id].arch);
+    rec->vcpus[vcpu->id].regs = vcpu->regs;
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (master) {
+        vm_arch_snapshot_save(vm, &rec->arch);
+        rec->saved = live_update_vm_clean(vm->config);
+    }
+}
+
+/**
+ * All cpus hold here, those running a vcpu saving it along with the rest of its vm. If the reset
+ * is refused, the handoff is invalidated and the vms simply go on running here.
+ */
+static void live_update_save_handler(void)
+{
+    struct live_update_hdr* hdr = live_update.hdr;
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    if (cpu()->vcpu != NULL) {
+        live_update_vm_save(cpu()->vcpu->vm, live_update_vm_rec(cpu()->vcpu->vm->id));
+    }
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    if (cpu_is_master()) {
+        hdr->version = LIVE_UPDATE_VERSION;
+        hdr->vm_num = CONFIG_VM_NUM;
+        hdr->layout = LIVE_UPDATE_LAYOUT;
+        hdr->slot_size = live_update_slot_size();
+        fence_ord_write();
+        hdr->magic = LIVE_UPDATE_MAGIC;
+        cache_clean_range((vaddr_t)hdr, platform.live_update.size);
+
+        INFO("Live update, resetting the platform");
+        if (!cpu_arch_warm_reset()) {
+            WARNING("Platform can not be warm reset, live update aborted");
+            hdr->magic = 0;
+        }
+
+        spin_lock(&live_update.lock);
+        live_update.pending = false;
+        spin_unlock(&live_update.lock);
+    }
+
+    cpu_sync_barrier(&cpu_glb_sync);
+}
+
+static void live_update_msg_handler(uint32_t event, uint64_t data)
+{
+    (void)data;
+
+    switch (event) {
+        case LIVE_UPDATE_SAVE:
+            live_update_save_handler();
+            break;
+    }
+}
+
+/**
+ * The cpus are held from their message handlers, where the vcpus' registers are either complete
+ * or saved whole by the interrupt exit bringing the message, and the caller's already hold the
+ * hypercall's return value.
+ */
+long int live_update_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2)
+{
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+
+    if (!cpu()->vcpu->vm->config->vm_manager || (live_update.hdr == NULL)) {
+        return -HC_E_FAILURE;
+    }
+
+    spin_lock(&live_update.lock);
+    bool pending = live_update.pending;
+    live_update.pending = true;
+    spin_unlock(&live_update.lock);
+    if (pending) {
+        return -HC_E_FAILURE;
+    }
+
+    struct cpu_msg msg = { (uint32_t)LIVE_UPDATE_CPUMSG_ID, LIVE_UPDATE_SAVE, 0 };
+    for (cpuid_t cpu_id = 0; cpu_id < platform.cpu_num; cpu_id++) {
+        cpu_send_msg(cpu_id, &msg);
+    }
+
+    return HC_E_SUCCESS;
+}
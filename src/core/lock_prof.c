@@ -0,0 +1,116 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <lock_prof.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <timer.h>
+#include <string.h>
+#include <platform_defs.h>
+
+struct lock_prof_site {
+    const char* site;
+    size_t count;
+    size_t contended;
+    uint64_t wait_total;
+    uint64_t wait_max;
+};
+
+/**
+ * Stats are kept per cpu, only written by the cpu they belong to, so recording them takes no lock.
+ * Each callsite's tag is a distinct string literal, so sites are looked up by its address in an
+ * open addressing table. The cpu's own acquisitions while dumping, e.g. of the console's lock, are
+ * not recorded.
+ */
+static struct lock_prof_cpu {
+    bool dumping;
+    size_t dropped;
+    struct lock_prof_site sites[LOCK_PROF_SITES];
+} lock_prof_cpus[PLAT_CPU_NUM];
+
+static struct lock_prof_site* lock_prof_get_site(struct lock_prof_cpu* prof_cpu, const char* site)
+{
+    size_t hash = ((uintptr_t)site >> 3) % LOCK_PROF_SITES;
+
+    for (size_t i = 0; i < LOCK_PROF_SITES; i++) {
+        struct lock_prof_site* entry = &prof_cpu->sites[(hash + i) % LOCK_PROF_SITES];
+        if (entry->site == site) {
+            return entry;
+        } else if (entry->site == NULL) {
+            entry->site = site;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * An acquisition is contended if the lock was already held, or had waiters, when the cpu took its
+ * ticket. On both ticket lock implementations that is when the lock's two counters differ. The
+ * wait is in timer ticks and includes taking the ticket.
+ */
+void lock_prof_spin_lock(spinlock_t* lock, const char* site)
+{
+    volatile spinlock_t* vlock = lock;
+    bool contended = vlock->ticket != vlock->next;
+    uint64_t start = timer_get();
+
+    (spin_lock)(lock);
+
+    uint64_t wait = timer_get() - start;
+    cpuid_t cpu_id = cpu()->id;
+    if (cpu_id >= PLAT_CPU_NUM) {
+        return;
+    }
+
+    struct lock_prof_cpu* prof_cpu = &lock_prof_cpus[cpu_id];
+    if (prof_cpu->dumping) {
+        return;
+    }
+
+    struct lock_prof_site* entry = lock_prof_get_site(prof_cpu, site);
+    if (entry == NULL) {
+        prof_cpu->dropped++;
+        return;
+    }
+
+    entry->count++;
+    if (contended) {
+        entry->contended++;
+    }
+    entry->wait_total += wait;
+    entry->wait_max = max(entry->wait_max, wait);
+}
+
+void lock_prof_dump(void)
+{
+    struct lock_prof_cpu* prof_cpu = &lock_prof_cpus[cpu()->id];
+
+    prof_cpu->dumping = true;
+    INFO("cpu %d lock profile (wait in timer ticks)", cpu()->id);
+    for (size_t i = 0; i < LOCK_PROF_SITES; i++) {
+        struct lock_prof_site* entry = &prof_cpu->sites[i];
+        if (entry->site == NULL) {
+            continue;
+        }
+        console_printk("%s: n %lu contended %lu wait total %lu max %lu\n", entry->site,
+            (unsigned long)entry->count, (unsigned long)entry->contended,
+            (unsigned long)entry->wait_total, (unsigned long)entry->wait_max);
+    }
+    if (prof_cpu->dropped != 0) {
+        console_printk("%lu acquisitions from untracked sites\n", (unsigned long)prof_cpu->dropped);
+    }
+
+    memset(prof_cpu->sites, 0, sizeof(prof_cpu->sites));
+    prof_cpu->dropped = 0;
+    prof_cpu->dumping = false;
+}
+
+long int lock_prof_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2)
+{
+    lock_prof_dump();
+    return HC_E_SUCCESS;
+}
@@ -13,74 +13,12 @@
 #include <vm.h>
 #include <fences.h>
 #include <config.h>
+#include <boot_timing.h>
 
 extern uint8_t _image_start, _image_load_end, _image_end, _vm_image_start, _vm_image_end;
 
 struct list page_pool_list;
-
-bool pp_alloc(struct page_pool* pool, size_t num_pages, bool aligned, struct ppages* ppages)
-{
-    ppages->colors = 0;
-    ppages->num_pages = 0;
-
-    bool ok = false;
-
-    if (num_pages == 0) {
-        return true;
-    }
-
-    spin_lock(&pool->lock);
-
-    /**
-     * If we need a contigous segment aligned to its size, lets start at an already aligned index.
-     */
-    size_t start = aligned ? pool->base / PAGE_SIZE % num_pages : 0;
-    size_t curr = pool->last + ((pool->last + start) % num_pages);
-
-    /**
-     * Lets make two searches:
-     *  - one starting from the last known free index.
-     *  - in case this does not work, start from index 0.
-     */
-    for (size_t i = 0; i < 2 && !ok; i++) {
-        while (pool->free != 0) {
-            ssize_t bit = bitmap_find_consec(pool->bitmap, pool->size, curr, num_pages, false);
-
-            if (bit < 0) {
-                /**
-                 * No num_page page sement was found. If this is the first iteration set position
-                 * to 0 to start next search from index
-                 * 0.
-                 */
-                size_t next_aligned =
-                    (num_pages - ((pool->base / PAGE_SIZE) % num_pages)) % num_pages;
-                curr = aligned ? next_aligned : 0;
-                break;
-            } else if (aligned && (((bit + start) % num_pages) != 0)) {
-                /**
-                 * If we're looking for an aligned segment and the found contigous segment is not
-                 * aligned, start the search again from the last aligned index
-                 */
-                curr = bit + ((bit + start) % num_pages);
-            } else {
-                /**
-                 * We've found our pages. Fill output argument info, mark them as allocated, and
-                 * update page pool bookkeeping.
-                 */
-                ppages->base = pool->base + (bit * PAGE_SIZE);
-                ppages->num_pages = num_pages;
-                bitmap_set_consecutive(pool->bitmap, bit, num_pages);
-                pool->free -= num_pages;
-                pool->last = bit + num_pages;
-                ok = true;
-                break;
-            }
-        }
-    }
-    spin_unlock(&pool->lock);
-
-    return ok;
-}
+static size_t page_pool_num;
 
 bool mem_are_ppages_reserved_in_pool(struct page_pool* ppool, struct ppages* ppages)
 {
@@ -135,6 +73,7 @@ bool mem_reserve_ppool_ppages(struct page_pool* pool, struct ppages* ppages)
     }
 
     bitmap_set_consecutive(pool->bitmap, pageoff, ppages->num_pages);
+    pp_buddy_update(pool, pageoff, ppages->num_pages);
     pool->free -= ppages->num_pages;
 
     return is_in_rgn && was_free;
@@ -143,7 +82,8 @@ bool mem_reserve_ppool_ppages(struct page_pool* pool, struct ppages* ppages)
 void* mem_alloc_page(size_t num_pages, enum AS_SEC sec, bool phys_aligned)
 {
     vaddr_t vpage = INVALID_VA;
-    struct ppages ppages = mem_alloc_ppages(cpu()->as.colors, num_pages, phys_aligned);
+    struct ppages ppages =
+        mem_alloc_ppages_place(&cpu()->as.place, cpu()->as.colors, num_pages, phys_aligned);
 
     if (ppages.num_pages == num_pages) {
         vpage = mem_alloc_map(&cpu()->as, sec, &ppages, INVALID_VA, num_pages, PTE_HYP_FLAGS);
@@ -152,14 +92,13 @@ void* mem_alloc_page(size_t num_pages, enum AS_SEC sec, bool phys_aligned)
     return (void*)vpage;
 }
 
-bool root_pool_set_up_bitmap(paddr_t load_addr, struct page_pool* root_pool)
+__init bool root_pool_set_up_bitmap(paddr_t load_addr, struct page_pool* root_pool)
 {
     size_t image_size = (size_t)(&_image_end - &_image_start);
     size_t vm_image_size = (size_t)(&_vm_image_end - &_vm_image_start);
     size_t cpu_size = platform.cpu_num * mem_cpu_boot_alloc_size();
 
-    size_t bitmap_num_pages =
-        root_pool->size / (8 * PAGE_SIZE) + ((root_pool->size % (8 * PAGE_SIZE) != 0) ? 1 : 0);
+    size_t bitmap_num_pages = pp_metadata_num_pages(root_pool->base, root_pool->size);
     if (root_pool->size <= bitmap_num_pages) {
         return false;
     }
@@ -169,12 +108,13 @@ bool root_pool_set_up_bitmap(paddr_t load_addr, struct page_pool* root_pool)
     bitmap_t* root_bitmap = (bitmap_t*)mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &bitmap_pp,
         INVALID_VA, bitmap_num_pages, PTE_HYP_FLAGS);
     root_pool->bitmap = root_bitmap;
-    memset((void*)root_pool->bitmap, 0, bitmap_num_pages * PAGE_SIZE);
+    mem_zero_pages((void*)root_pool->bitmap, bitmap_num_pages);
+    pp_buddy_init(root_pool);
 
     return mem_reserve_ppool_ppages(root_pool, &bitmap_pp);
 }
 
-bool pp_root_reserve_hyp_mem(paddr_t load_addr, struct page_pool* root_pool)
+__init bool pp_root_reserve_hyp_mem(paddr_t load_addr, struct page_pool* root_pool)
 {
     size_t image_load_size = (size_t)(&_image_load_end - &_image_start);
     size_t image_noload_size = (size_t)(&_image_end - &_image_load_end);
@@ -195,13 +135,16 @@ bool pp_root_reserve_hyp_mem(paddr_t load_addr, struct page_pool* root_pool)
     return image_load_reserved && image_noload_reserved && cpu_reserved;
 }
 
-static bool pp_root_init(paddr_t load_addr, struct mem_region* root_region)
+__init static bool pp_root_init(paddr_t load_addr, struct mem_region* root_region)
 {
     struct page_pool* root_pool = &root_region->page_pool;
     root_pool->base = ALIGN(root_region->base, PAGE_SIZE);
     root_pool->size = root_region->size / PAGE_SIZE; /* TODO: what if not
                                                         aligned? */
     root_pool->free = root_pool->size;
+    root_pool->tier = root_region->tier;
+    root_pool->controller = root_region->controller;
+    root_pool->numa_node = root_region->numa_node;
 
     if (!root_pool_set_up_bitmap(load_addr, root_pool)) {
         return false;
@@ -214,7 +157,7 @@ static bool pp_root_init(paddr_t load_addr, struct mem_region* root_region)
     return true;
 }
 
-static void pp_init(struct page_pool* pool, paddr_t base, size_t size)
+__init static void pp_init(struct page_pool* pool, paddr_t base, size_t size)
 {
     struct ppages pages;
 
@@ -225,7 +168,7 @@ static void pp_init(struct page_pool* pool, paddr_t base, size_t size)
     memset((void*)pool, 0, sizeof(struct page_pool));
     pool->base = ALIGN(base, PAGE_SIZE);
     pool->size = NUM_PAGES(size);
-    size_t bitmap_size = pool->size / (8 * PAGE_SIZE) + !!(pool->size % (8 * PAGE_SIZE) != 0);
+    size_t bitmap_size = pp_metadata_num_pages(pool->base, pool->size);
 
     if (size <= bitmap_size) {
         return;
@@ -241,13 +184,14 @@ static void pp_init(struct page_pool* pool, paddr_t base, size_t size)
         return;
     }
 
-    memset((void*)pool->bitmap, 0, bitmap_size * PAGE_SIZE);
+    mem_zero_pages((void*)pool->bitmap, bitmap_size);
+    pp_buddy_init(pool);
 
     pool->last = 0;
     pool->free = pool->size;
 }
 
-bool mem_vm_img_in_phys_rgn(struct vm_config* vm_config)
+__init bool mem_vm_img_in_phys_rgn(struct vm_config* vm_config)
 {
     bool img_in_rgn = false;
 
@@ -256,7 +200,7 @@ bool mem_vm_img_in_phys_rgn(struct vm_config* vm_config)
             vaddr_t rgn_base = vm_config->platform.regions[i].phys;
             size_t rgn_size = vm_config->platform.regions[i].size;
             paddr_t img_base = vm_config->image.load_addr;
-            size_t img_size = vm_config->image.size;
+            size_t img_size = config_vm_image_load_size(vm_config);
             if (range_in_range(img_base, img_size, rgn_base, rgn_size)) {
                 img_in_rgn = true;
                 break;
@@ -267,7 +211,7 @@ bool mem_vm_img_in_phys_rgn(struct vm_config* vm_config)
     return img_in_rgn;
 }
 
-bool mem_reserve_physical_memory(struct page_pool* pool)
+__init bool mem_reserve_physical_memory(struct page_pool* pool)
 {
     if (pool == NULL) {
         return false;
@@ -275,7 +219,7 @@ bool mem_reserve_physical_memory(struct page_pool* pool)
 
     for (size_t i = 0; i < config.vmlist_size; i++) {
         struct vm_config* vm_cfg = &config.vmlist[i];
-        size_t n_pg = NUM_PAGES(vm_cfg->image.size);
+        size_t n_pg = NUM_PAGES(config_vm_image_load_size(vm_cfg));
         struct ppages ppages = mem_ppages_get(vm_cfg->image.load_addr, n_pg);
 
         // If the vm image is part of a statically allocated region of the same vm, we defer the
@@ -323,7 +267,7 @@ bool mem_reserve_physical_memory(struct page_pool* pool)
     return true;
 }
 
-bool mem_create_ppools(struct mem_region* root_mem_region)
+__init bool mem_create_ppools(struct mem_region* root_mem_region)
 {
     for (size_t i = 0; i < platform.region_num; i++) {
         if (&platform.regions[i] != root_mem_region) {
@@ -331,10 +275,14 @@ bool mem_create_ppools(struct mem_region* root_mem_region)
             struct page_pool* pool = &reg->page_pool;
             if (pool != NULL) {
                 pp_init(pool, reg->base, reg->size);
+                pool->tier = reg->tier;
+                pool->controller = reg->controller;
+                pool->numa_node = reg->numa_node;
                 if (!mem_reserve_physical_memory(pool)) {
                     return false;
                 }
                 list_push(&page_pool_list, &pool->node);
+                page_pool_num++;
             }
         }
     }
@@ -342,7 +290,7 @@ bool mem_create_ppools(struct mem_region* root_mem_region)
     return true;
 }
 
-struct mem_region* mem_find_root_region(paddr_t load_addr)
+__init struct mem_region* mem_find_root_region(paddr_t load_addr)
 {
     size_t image_size = (size_t)(&_image_end - &_image_start);
 
@@ -360,7 +308,7 @@ struct mem_region* mem_find_root_region(paddr_t load_addr)
     return root_mem_region;
 }
 
-bool mem_setup_root_pool(paddr_t load_addr, struct mem_region** root_mem_region)
+__init bool mem_setup_root_pool(paddr_t load_addr, struct mem_region** root_mem_region)
 {
     *root_mem_region = mem_find_root_region(load_addr);
     if (*root_mem_region == NULL) {
@@ -370,6 +318,11 @@ bool mem_setup_root_pool(paddr_t load_addr, struct mem_region** root_mem_region)
     return pp_root_init(load_addr, *root_mem_region);
 }
 
+__attribute__((weak)) void mem_zero_pages(void* base, size_t num_pages)
+{
+    memset(base, 0, num_pages * PAGE_SIZE);
+}
+
 __attribute__((weak)) void mem_color_hypervisor(const paddr_t load_addr,
     struct mem_region* root_region)
 {
@@ -390,30 +343,180 @@ __attribute__((weak)) bool pp_alloc_clr(struct page_pool* pool, size_t num_pages
           "implementation");
 }
 
-struct ppages mem_alloc_ppages(colormap_t colors, size_t num_pages, bool aligned)
+/**
+ * Pools are tried in two passes, the first over the pools the placement prefers and the second
+ * over the ones it falls back to. Interleaving starts each allocation one pool after the last,
+ * wrapping around in the second pass. Racing allocations may start at the same pool, which only
+ * makes the spreading less even. Without a policy, the pools of the allocating cpu's node are
+ * preferred, so that per-cpu and per-vm structures, allocated by the cpus using them, stay local.
+ */
+static bool mem_place_pool_pass(const struct mem_place* place, struct page_pool* pool,
+    size_t index, size_t first, size_t pass, size_t node)
 {
-    struct ppages pages = { .num_pages = 0 };
+    bool preferred = (pool->numa_node == node);
 
-    list_foreach (page_pool_list, struct page_pool, pool) {
-        bool ok = (!all_clrs(colors) && !aligned) ? pp_alloc_clr(pool, num_pages, colors, &pages) :
-                                                    pp_alloc(pool, num_pages, aligned, &pages);
-        if (ok) {
+    switch (place->policy) {
+        case MEM_PLACE_TIER:
+            preferred = (pool->tier == place->tier);
+            break;
+        case MEM_PLACE_INTERLEAVE:
+            preferred = (index >= first);
             break;
+        case MEM_PLACE_PINNED:
+            return (pass == 0) && (pool->controller == place->controller);
+        default:
+            break;
+    }
+
+    return preferred == (pass == 0);
+}
+
+static struct ppages mem_alloc_ppages_pools(const struct mem_place* place, colormap_t colors,
+    size_t num_pages, bool aligned)
+{
+    static size_t interleave_next = 0;
+    struct ppages pages = { .num_pages = 0 };
+    size_t first = 0;
+    size_t node = platform_cpu_node(cpu()->id);
+
+    if ((place->policy == MEM_PLACE_INTERLEAVE) && (page_pool_num > 0)) {
+        first = interleave_next % page_pool_num;
+        interleave_next = first + 1;
+    }
+
+    for (size_t pass = 0; pass < 2; pass++) {
+        size_t index = 0;
+        list_foreach (page_pool_list, struct page_pool, pool) {
+            if (mem_place_pool_pass(place, pool, index++, first, pass, node)) {
+                bool ok = (!all_clrs(colors) && !aligned) ?
+                    pp_alloc_clr(pool, num_pages, colors, &pages) :
+                    pp_alloc(pool, num_pages, aligned, &pages);
+                if (ok) {
+                    return pages;
+                }
+            }
         }
     }
 
     return pages;
 }
 
-void mem_init(paddr_t load_addr)
+static inline colormap_t mem_page_cache_colors(colormap_t colors)
+{
+    return all_clrs(colors) ? 0 : (colors & clrs_mask());
+}
+
+static void mem_page_cache_drain(struct mem_page_cache* cache)
 {
+    while (cache->num > 0) {
+        struct ppages ppages = mem_ppages_get(cache->pages[--cache->num], 1);
+        ppages.colors = cache->colors;
+        mem_free_ppages(&ppages);
+    }
+}
+
+static bool mem_page_cache_refill(struct mem_page_cache* cache, colormap_t colors)
+{
+    struct mem_place any = { .policy = MEM_PLACE_ANY };
+    struct ppages ppages = mem_alloc_ppages_pools(&any, colors, MEM_PAGE_CACHE_SIZE, false);
+    if (ppages.num_pages != MEM_PAGE_CACHE_SIZE) {
+        return false;
+    }
+
+    /* Fill the cache backwards so that pages are handed out in ascending address order. */
+    size_t index = 0;
+    for (size_t i = MEM_PAGE_CACHE_SIZE; i > 0; i--) {
+        if (colors != 0) {
+            index = pp_next_clr(ppages.base, index, colors);
+        }
+        cache->pages[i - 1] = ppages.base + (index * PAGE_SIZE);
+        index++;
+    }
+    cache->colors = colors;
+    cache->num = MEM_PAGE_CACHE_SIZE;
+
+    return true;
+}
+
+static bool mem_page_cache_alloc(colormap_t colors, struct ppages* ppages)
+{
+    struct mem_page_caches* caches = &cpu()->page_caches;
+    struct mem_page_cache* cache = NULL;
+
+    colors = mem_page_cache_colors(colors);
+
+    for (size_t i = 0; i < MEM_PAGE_CACHE_NUM; i++) {
+        if ((caches->cache[i].colors == colors) || (caches->cache[i].num == 0)) {
+            cache = &caches->cache[i];
+            if (cache->colors == colors) {
+                break;
+            }
+        }
+    }
+
+    if (cache == NULL) {
+        cache = &caches->cache[caches->victim];
+        caches->victim = (caches->victim + 1) % MEM_PAGE_CACHE_NUM;
+    }
+
+    if (cache->num == 0 || cache->colors != colors) {
+        mem_page_cache_drain(cache);
+        if (!mem_page_cache_refill(cache, colors)) {
+            return false;
+        }
+    }
+
+    *ppages = mem_ppages_get(cache->pages[--cache->num], 1);
+    ppages->colors = colors;
+
+    return true;
+}
+
+static void mem_page_cache_init()
+{
+    for (size_t i = 0; i < MEM_PAGE_CACHE_NUM; i++) {
+        cpu()->page_caches.cache[i].colors = 0;
+        cpu()->page_caches.cache[i].num = 0;
+    }
+    cpu()->page_caches.victim = 0;
+}
+
+struct ppages mem_alloc_ppages_place(const struct mem_place* place, colormap_t colors,
+    size_t num_pages, bool aligned)
+{
+    struct ppages pages = { .num_pages = 0 };
+
+    /**
+     * Single pages are served from the cpu's page cache. Fall back to the page pools if the cache
+     * can't be refilled, e.g. if there are less than MEM_PAGE_CACHE_SIZE contiguous free pages.
+     * The cache holds pages from any pool, so placed allocations skip it.
+     */
+    if ((num_pages == 1) && (place->policy == MEM_PLACE_ANY) &&
+        mem_page_cache_alloc(colors, &pages)) {
+        return pages;
+    }
+
+    return mem_alloc_ppages_pools(place, colors, num_pages, aligned);
+}
+
+struct ppages mem_alloc_ppages(colormap_t colors, size_t num_pages, bool aligned)
+{
+    struct mem_place any = { .policy = MEM_PLACE_ANY };
+    return mem_alloc_ppages_place(&any, colors, num_pages, aligned);
+}
+
+__init void mem_init(paddr_t load_addr)
+{
+    mem_page_cache_init();
+
     mem_prot_init();
 
     static struct mem_region* root_mem_region = NULL;
 
-    if (cpu_is_master()) {
-        cache_enumerate();
+    cache_enumerate();
 
+    uint64_t pools = boot_timing_begin();
+    if (cpu_is_master()) {
         if (!mem_setup_root_pool(load_addr, &root_mem_region)) {
             ERROR("couldn't not initialize root pool");
         }
@@ -421,6 +524,7 @@ void mem_init(paddr_t load_addr)
         /* Insert root pool in pool list */
         list_init(&page_pool_list);
         list_push(&page_pool_list, &(root_mem_region->page_pool.node));
+        page_pool_num = 1;
 
         config_init(load_addr);
 
@@ -428,18 +532,33 @@ void mem_init(paddr_t load_addr)
             ERROR("failed reserving memory in root pool");
         }
     }
+    boot_timing_end(BOOT_PHASE_PAGE_POOLS, pools);
 
     cpu_sync_and_clear_msgs(&cpu_glb_sync);
 
     if (!all_clrs(config.hyp.colors)) {
+        uint64_t coloring = boot_timing_begin();
         mem_color_hypervisor(load_addr, root_mem_region);
+        boot_timing_end(BOOT_PHASE_COLORING, coloring);
     }
 
+    pools = boot_timing_begin();
     if (cpu_is_master()) {
         if (!mem_create_ppools(root_mem_region)) {
             ERROR("couldn't create additional page pools");
         }
     }
+    boot_timing_end(BOOT_PHASE_PAGE_POOLS, pools);
+
+#ifdef FAST_MEM
+    /* The other cpus wait without handling messages, which would run the hot text being moved */
+    cpu_sync_barrier(&cpu_glb_sync);
+    if (cpu_is_master()) {
+        mem_fast_place();
+    }
+    cpu_sync_barrier(&cpu_glb_sync);
+    cache_inv_icache();
+#endif
 
     /* Wait for master core to initialize memory management */
     cpu_sync_and_clear_msgs(&cpu_glb_sync);
@@ -0,0 +1,139 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <membw.h>
+#include <config.h>
+#include <cpu.h>
+#include <vm.h>
+#include <timer.h>
+#include <stats.h>
+
+/**
+ * MemGuard-like regulation of the memory bandwidth of each vcpu. At the start of every period the
+ * vcpu's budget is replenished and the counter armed to overflow once it is exhausted. The
+ * overflow throttles the vcpu, i.e., the architecture keeps servicing the cpu's interrupts in the
+ * hypervisor instead of returning to the guest, until the next period starts.
+ */
+struct membw_cpu {
+    bool supported;
+    volatile bool throttled;
+    uint32_t budget;
+    uint64_t period_ticks;
+    struct timer_event period;
+    uint64_t throttle_start;
+};
+
+static struct membw_cpu membw_cpus[PLAT_CPU_NUM];
+
+__attribute__((weak)) bool membw_arch_init(irq_handler_t handler)
+{
+    return false;
+}
+
+__attribute__((weak)) void membw_arch_start(uint32_t budget)
+{
+}
+
+__attribute__((weak)) bool membw_arch_ack(void)
+{
+    return false;
+}
+
+static void membw_handle_overflow(irqid_t int_id)
+{
+    struct membw_cpu* membw = &membw_cpus[cpu()->id];
+
+    if (membw_arch_ack() && membw->budget != 0 && !membw->throttled) {
+        membw->throttled = true;
+        membw->throttle_start = timer_get();
+        stats_inc(STATS_MEMBW_THROTTLES);
+    }
+}
+
+static void membw_unthrottle(struct membw_cpu* membw)
+{
+    if (membw->throttled) {
+        stats_add(STATS_MEMBW_THROTTLED_NS,
+            (size_t)timer_ticks_to_ns(timer_get() - membw->throttle_start));
+        membw->throttled = false;
+    }
+}
+
+static void membw_period_handler(struct timer_event* event)
+{
+    struct membw_cpu* membw = &membw_cpus[cpu()->id];
+
+    membw_arch_start(membw->budget);
+    membw_unthrottle(membw);
+
+    timer_arm_next_period(event, membw->period_ticks);
+}
+
+void membw_init(void)
+{
+    bool regulated = false;
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        if (config.vmlist[i].membw.budget != 0) {
+            regulated = true;
+        }
+    }
+
+    if (!regulated) {
+        return;
+    }
+
+    membw_cpus[cpu()->id].supported = membw_arch_init(membw_handle_overflow);
+    if (!membw_cpus[cpu()->id].supported) {
+        WARNING("Memory bandwidth regulation not supported on cpu %d, budgets ignored",
+            cpu()->id);
+    }
+}
+
+void membw_vcpu_init(struct vcpu* vcpu)
+{
+    uint32_t budget = vcpu->vm->config->membw.budget;
+    uint32_t period_us = vcpu->vm->config->membw.period_us;
+
+    if (budget != 0) {
+        membw_vcpu_set(budget, period_us);
+    }
+}
+
+/**
+ * Sets the budget of the cpu's vcpu, which takes effect right away, lifting a throttle in place.
+ * A zero budget leaves the vcpu unregulated. Fails if regulation was not set up on the cpu, as
+ * no vm was configured with a budget, or is not supported.
+ */
+bool membw_vcpu_set(uint32_t budget, uint32_t period_us)
+{
+    struct membw_cpu* membw = &membw_cpus[cpu()->id];
+
+    if (!membw->supported) {
+        return budget == 0;
+    }
+
+    if (period_us == 0) {
+        period_us = MEMBW_DEFAULT_PERIOD_US;
+    }
+
+    timer_cancel(&membw->period);
+    membw_unthrottle(membw);
+    membw->budget = budget;
+    membw->period_ticks = timer_ns_to_ticks((uint64_t)period_us * 1000);
+    membw->period.handler = membw_period_handler;
+    membw->period.deferrable = true;
+
+    if (budget != 0) {
+        membw_arch_start(budget);
+        timer_arm(&membw->period, timer_get() + membw->period_ticks);
+    }
+
+    return true;
+}
+
+bool membw_throttled(void)
+{
+    return membw_cpus[cpu()->id].throttled;
+}
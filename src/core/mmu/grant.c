@@ -0,0 +1,319 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <grant.h>
+#include <cpu.h>
+#include <vm.h>
+#include <mem.h>
+#include <config.h>
+#include <platform.h>
+#include <hypercall.h>
+#include <vmm.h>
+#include <spinlock.h>
+
+struct grant {
+    bool used;
+    bool mapped;
+    /* Released by the lender, the slot only being freed once the target dropped its mapping */
+    bool revoked;
+    vmid_t owner;
+    vmid_t target;
+    vaddr_t target_ipa;
+    size_t num_pages;
+    size_t run_num;
+    struct ppages runs[GRANT_MAX_RUNS];
+};
+
+static struct grant grant_table[GRANT_TABLE_SIZE];
+static spinlock_t grant_lock = SPINLOCK_INITVAL;
+
+enum { GRANT_MSG_UNMAP };
+
+static void grant_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(grant_msg_handler, GRANT_CPUMSG_ID);
+
+static struct grant* grant_get(unsigned long grant_id)
+{
+    if ((grant_id < GRANT_TABLE_SIZE) && grant_table[grant_id].used) {
+        return &grant_table[grant_id];
+    }
+    return NULL;
+}
+
+/**
+ * Only memory that is the lender's own to write can be lent, as the target maps it writable. That
+ * rules out the vm's shared memories and anything it maps read-only, e.g., the pages of an image
+ * shared with other vms, as well as pages it borrowed itself, which are outside its regions.
+ */
+static bool grant_range_private(struct vm* vm, vaddr_t ipa, size_t num_pages)
+{
+    const struct vm_platform* plat = &vm->config->platform;
+    size_t size = num_pages * PAGE_SIZE;
+    bool in_region = false;
+
+    for (size_t i = 0; i < plat->region_num; i++) {
+        if (range_in_range(ipa, size, plat->regions[i].base, plat->regions[i].size)) {
+            in_region = true;
+            break;
+        }
+    }
+    if (!in_region) {
+        return false;
+    }
+
+    for (size_t i = 0; i < plat->ipc_num; i++) {
+        if (range_overlap_range(ipa, size, plat->ipcs[i].base, plat->ipcs[i].size)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        paddr_t pa;
+        vm_mem_populate(vm, ipa + (i * PAGE_SIZE));
+        if (!mem_translate_writable(&vm->as, ipa + (i * PAGE_SIZE), &pa)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Collect the physical runs backing the lender's range. It is translated up front, by the lender,
+ * as other vms' stage 2 tables are not reachable from the target's cpus. The lender can't unmap its
+ * own memory, so the translations stay valid for the lifetime of the grant.
+ */
+static bool grant_collect_runs(struct vm* vm, vaddr_t ipa, size_t num_pages, struct grant* grant)
+{
+    size_t size = num_pages * PAGE_SIZE;
+    grant->run_num = 0;
+
+    for (size_t off = 0; off < size;) {
+        paddr_t pa;
+        vm_mem_populate(vm, ipa + off);
+        size_t len = mem_translate_range(&vm->as, ipa + off, size - off, &pa);
+        if ((len == 0) || !platform_is_mem_range(pa, len)) {
+            return false;
+        }
+
+        struct ppages* run = (grant->run_num > 0) ? &grant->runs[grant->run_num - 1] : NULL;
+        if (run != NULL && pa == (run->base + (run->num_pages * PAGE_SIZE))) {
+            run->num_pages += len / PAGE_SIZE;
+        } else if (grant->run_num < GRANT_MAX_RUNS) {
+            grant->runs[grant->run_num++] = mem_ppages_get(pa, len / PAGE_SIZE);
+        } else {
+            return false;
+        }
+        off += len;
+    }
+
+    return true;
+}
+
+unsigned long grant_lend_hypercall(unsigned long ipa, unsigned long num_pages,
+    unsigned long target_vm)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    struct grant new_grant;
+
+    if ((ipa % PAGE_SIZE) != 0 || num_pages == 0 || num_pages > GRANT_MAX_PAGES ||
+        target_vm >= CONFIG_VM_NUM || target_vm == vm->id) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if (!grant_range_private(vm, ipa, num_pages) ||
+        !grant_collect_runs(vm, ipa, num_pages, &new_grant)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    new_grant.used = true;
+    new_grant.mapped = false;
+    new_grant.revoked = false;
+    new_grant.owner = vm->id;
+    new_grant.target = (vmid_t)target_vm;
+    new_grant.target_ipa = INVALID_VA;
+    new_grant.num_pages = num_pages;
+
+    unsigned long ret = -HC_E_FAILURE;
+    spin_lock(&grant_lock);
+    for (size_t i = 0; i < GRANT_TABLE_SIZE; i++) {
+        if (!grant_table[i].used) {
+            grant_table[i] = new_grant;
+            ret = i;
+            break;
+        }
+    }
+    spin_unlock(&grant_lock);
+
+    return ret;
+}
+
+unsigned long grant_map_hypercall(unsigned long grant_id, unsigned long ipa, unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    unsigned long ret = -HC_E_INVAL_ARGS;
+
+    spin_lock(&grant_lock);
+    struct grant* grant = grant_get(grant_id);
+    /* The vm's stage 2 only translates as much guest physical address space as it was sized for */
+    uint64_t last = (uint64_t)ipa + ((grant != NULL) ? (grant->num_pages * PAGE_SIZE) : 0) - 1;
+    bool in_ipa = (last >> vm->as.pt.dscr->lvl_wdt[0]) == 0;
+    if (grant != NULL && grant->target == vm->id && !grant->mapped && !grant->revoked &&
+        (ipa % PAGE_SIZE) == 0 && in_ipa) {
+        if (mem_alloc_vpage(&vm->as, SEC_VM_ANY, ipa, grant->num_pages) == ipa) {
+            vaddr_t va = ipa;
+            for (size_t i = 0; i < grant->run_num; i++) {
+                mem_map(&vm->as, va, &grant->runs[i], grant->runs[i].num_pages, PTE_VM_FLAGS);
+                va += grant->runs[i].num_pages * PAGE_SIZE;
+            }
+            grant->mapped = true;
+            grant->target_ipa = ipa;
+            ret = HC_E_SUCCESS;
+        } else {
+            ret = -HC_E_FAILURE;
+        }
+    }
+    spin_unlock(&grant_lock);
+
+    return ret;
+}
+
+/* Called with grant_lock held, on one of the target's cpus */
+static void grant_unmap(struct vm* vm, struct grant* grant)
+{
+    mem_batch_begin(&vm->as);
+    mem_unmap(&vm->as, grant->target_ipa, grant->num_pages, false);
+    mem_batch_end(&vm->as);
+    grant->mapped = false;
+    grant->target_ipa = INVALID_VA;
+    if (grant->revoked) {
+        grant->used = false;
+    }
+}
+
+unsigned long grant_unmap_hypercall(unsigned long grant_id, unsigned long arg1, unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    unsigned long ret = -HC_E_INVAL_ARGS;
+
+    spin_lock(&grant_lock);
+    struct grant* grant = grant_get(grant_id);
+    if (grant != NULL && grant->target == vm->id && grant->mapped) {
+        grant_unmap(vm, grant);
+        ret = HC_E_SUCCESS;
+    }
+    spin_unlock(&grant_lock);
+
+    return ret;
+}
+
+unsigned long grant_revoke_hypercall(unsigned long grant_id, unsigned long arg1,
+    unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    unsigned long ret = -HC_E_INVAL_ARGS;
+
+    spin_lock(&grant_lock);
+    struct grant* grant = grant_get(grant_id);
+    if (grant != NULL && grant->owner == vm->id && !grant->revoked) {
+        if (grant->mapped) {
+            /* The target must finish the transfer and unmap the pages first. */
+            ret = -HC_E_FAILURE;
+        } else {
+            grant->used = false;
+            ret = HC_E_SUCCESS;
+        }
+    }
+    spin_unlock(&grant_lock);
+
+    return ret;
+}
+
+bool grant_vm_lends(vmid_t vm_id)
+{
+    bool lends = false;
+
+    spin_lock(&grant_lock);
+    for (size_t i = 0; i < GRANT_TABLE_SIZE; i++) {
+        if (grant_table[i].used && (grant_table[i].owner == vm_id)) {
+            lends = true;
+            break;
+        }
+    }
+    spin_unlock(&grant_lock);
+
+    return lends;
+}
+
+/* Drops the vm's mappings of the grants revoked from it, returning whether the vm still has to */
+static bool grant_vm_unmap_revoked(struct vm* vm, vmid_t owner)
+{
+    bool pending = false;
+
+    spin_lock(&grant_lock);
+    for (size_t i = 0; i < GRANT_TABLE_SIZE; i++) {
+        struct grant* grant = &grant_table[i];
+        if (grant->used && grant->revoked && (grant->target == vm->id)) {
+            grant_unmap(vm, grant);
+        }
+        pending |= grant->used && grant->revoked && (grant->owner == owner);
+    }
+    spin_unlock(&grant_lock);
+
+    return pending;
+}
+
+static void grant_msg_handler(uint32_t event, uint64_t data)
+{
+    switch (event) {
+        case GRANT_MSG_UNMAP:
+            if (cpu()->vcpu != NULL) {
+                grant_vm_unmap_revoked(cpu()->vcpu->vm, INVALID_VMID);
+            }
+            break;
+    }
+}
+
+/**
+ * Run by the vm's master when the vm is stopped or reset, the guest losing track of its grants. The
+ * vm drops the pages it borrowed and revokes those it lent, waiting for the targets to drop theirs,
+ * so that no other vm keeps access to the vm's memory, e.g., to a newly loaded image. While
+ * waiting, the vm drops the grants revoked from it in turn, so two vms released at once do not
+ * wait on each other.
+ */
+void grant_vm_release(struct vm* vm)
+{
+    cpumask_t targets = CPUMASK_EMPTY;
+
+    spin_lock(&grant_lock);
+    for (size_t i = 0; i < GRANT_TABLE_SIZE; i++) {
+        struct grant* grant = &grant_table[i];
+        if (!grant->used) {
+            continue;
+        }
+        if ((grant->target == vm->id) && grant->mapped) {
+            grant_unmap(vm, grant);
+        }
+        if ((grant->owner == vm->id) && !grant->revoked) {
+            grant->revoked = true;
+            if (grant->mapped) {
+                cpumask_or(&targets, &targets, vmm_vm_cpus(grant->target));
+            } else {
+                grant->used = false;
+            }
+        }
+    }
+    spin_unlock(&grant_lock);
+
+    if (cpumask_empty(&targets)) {
+        return;
+    }
+
+    struct cpu_msg msg = { (uint32_t)GRANT_CPUMSG_ID, GRANT_MSG_UNMAP, 0 };
+    cpu_send_urgent_msg_mask(&targets, &msg);
+    while (grant_vm_unmap_revoked(vm, vm->id)) {
+        spin_wait();
+    }
+}
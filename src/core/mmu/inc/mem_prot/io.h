@@ -20,5 +20,11 @@ struct io_prot {
 bool iommu_arch_init();
 bool iommu_arch_vm_init(struct vm* vm, const struct vm_config* config);
 bool iommu_arch_vm_add_device(struct vm* vm, deviceid_t id);
+/* Writes the vm's devices, added until then, to the iommu, if it defers programming them. */
+void iommu_arch_vm_commit(struct vm* vm);
+
+/* Only needed if the iommu is not covered by the cpu's tlb invalidations. */
+void iommu_arch_vm_inv_range(asid_t vmid, vaddr_t va, size_t size);
+void iommu_arch_vm_inv_all(asid_t vmid);
 
 #endif /* MEM_PROT_IO_H */
@@ -10,20 +10,70 @@
 #include <arch/mem.h>
 #include <page_table.h>
 #include <spinlock.h>
+#include <bitmap.h>
 
 #define HYP_ASID 0
 struct addr_space {
     struct page_table pt;
     enum AS_TYPE type;
     colormap_t colors;
+    struct mem_place place;
     asid_t id;
     spinlock_t lock;
+    struct {
+        size_t depth;
+        vaddr_t base;
+        vaddr_t top;
+    } batch;
+    /* Bumped whenever mappings are taken down or changed, dropping the cached translations */
+    volatile uint32_t xlate_gen;
+    /* Contiguous table pages set aside by mem_pt_reserve, handed out before any other */
+    struct {
+        paddr_t base;
+        size_t num;
+    } pt_reserve;
 };
 enum AS_SEC;
 
 typedef pte_t mem_flags_t;
 
 void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, pte_t* root_pt, colormap_t colors);
+void as_vm_init(struct addr_space* as, asid_t id, colormap_t colors,
+    struct page_table_dscr* dscr);
 vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at, size_t n);
+struct ppages;
+bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t num_pages,
+    mem_flags_t flags);
+void mem_map_report(struct addr_space* as, vaddr_t va, size_t num_pages);
+void mem_batch_begin(struct addr_space* as);
+void mem_batch_end(struct addr_space* as);
+void mem_pt_reserve(struct addr_space* as, size_t num_pages);
+void mem_dirty_log_arm(struct addr_space* as, vaddr_t va, size_t num_pages);
+void mem_dirty_log_disarm(struct addr_space* as, vaddr_t va, size_t num_pages);
+size_t mem_dirty_log_collect(struct addr_space* as, vaddr_t va, size_t num_pages, bitmap_t* bitmap);
+bool mem_dirty_log_fault(struct addr_space* as, vaddr_t va);
+size_t mem_access_sample(struct addr_space* as, vaddr_t va, size_t num_pages, size_t chunk_size,
+    uint16_t* heat);
+bool mem_arch_hw_access(void);
+struct page_pool;
+size_t pp_clr_update_bitmap(struct page_pool* pool, size_t index, size_t n, colormap_t colors,
+    bool set);
+
+/**
+ * Walks the address space for va, returning its pa and the size of the naturally aligned block
+ * containing it that is mapped physically contiguous, e.g. the page or the superpage.
+ */
+bool mem_arch_translate(struct addr_space* as, vaddr_t va, paddr_t* pa, size_t* block_size);
+
+static inline void mem_xlate_inv(struct addr_space* as)
+{
+    as->xlate_gen = as->xlate_gen + 1;
+}
+
+static inline bool mem_handle_fault(struct addr_space* as, vaddr_t addr)
+{
+    /* Page tables always hold all of the address space's mappings, faults are never resolved */
+    return false;
+}
 
 #endif /* __MEM_PROT_H__ */
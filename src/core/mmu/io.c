@@ -5,11 +5,133 @@
 
 #include <io.h>
 #include <vm.h>
+#include <cpu.h>
+#include <hypercall.h>
+#include <spinlock.h>
+#include <config.h>
 
 struct iommu_device {
     deviceid_t id;
 };
 
+#ifndef IO_FAULT_DEV_NUM
+#define IO_FAULT_DEV_NUM (32)
+#endif
+
+#ifndef IO_FAULT_RING_SIZE
+#define IO_FAULT_RING_SIZE (16)
+#endif
+
+struct io_fault_record {
+    deviceid_t dev_id;
+    unsigned long cause;
+    unsigned long addr;
+};
+
+/**
+ * Faults are counted per device and the most recent records are kept in a ring. Devices that do
+ * not fit the counter table are only accounted in the overflow counter.
+ */
+static struct {
+    spinlock_t lock;
+    struct {
+        deviceid_t id;
+        size_t count;
+    } devs[IO_FAULT_DEV_NUM];
+    size_t overflow;
+    struct io_fault_record ring[IO_FAULT_RING_SIZE];
+    size_t ring_next;
+} io_faults = { .lock = SPINLOCK_INITVAL };
+
+static size_t* io_fault_counter(deviceid_t dev_id, bool alloc)
+{
+    for (size_t i = 0; i < IO_FAULT_DEV_NUM; i++) {
+        if (io_faults.devs[i].id == dev_id) {
+            return &io_faults.devs[i].count;
+        } else if (io_faults.devs[i].id == 0) {
+            if (alloc) {
+                io_faults.devs[i].id = dev_id;
+                return &io_faults.devs[i].count;
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Called by the iommu drivers for each fault record. Only the 1st, 2nd, 4th, 8th, ... fault of
+ * each device is logged so a fault storm does not stall the cpu on the console.
+ */
+void io_fault_report(deviceid_t dev_id, unsigned long cause, unsigned long addr)
+{
+    size_t count = 0;
+
+    spin_lock(&io_faults.lock);
+    size_t* counter = io_fault_counter(dev_id, true);
+    if (counter != NULL) {
+        count = ++(*counter);
+    } else {
+        io_faults.overflow++;
+    }
+    io_faults.ring[io_faults.ring_next] =
+        (struct io_fault_record){ .dev_id = dev_id, .cause = cause, .addr = addr };
+    io_faults.ring_next = (io_faults.ring_next + 1) % IO_FAULT_RING_SIZE;
+    spin_unlock(&io_faults.lock);
+
+    if (count != 0 && (count & (count - 1)) == 0) {
+        WARNING("iommu: device %d fault #%d (cause 0x%x, addr 0x%lx)", dev_id, count, cause, addr);
+    }
+}
+
+static bool io_vm_owns_device(struct vm* vm, deviceid_t dev_id)
+{
+    for (size_t i = 0; i < vm->config->platform.dev_num; i++) {
+        if (vm->config->platform.devs[i].id == dev_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Returns the fault count of one of the calling vm's devices. The cause and address of its nth
+ * most recent fault record still in the ring, if any, are returned in the 2nd and 3rd argument
+ * registers.
+ */
+unsigned long io_fault_hypercall(unsigned long dev_id, unsigned long nth, unsigned long arg2)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    unsigned long cause = 0;
+    unsigned long addr = 0;
+    unsigned long ret = 0;
+
+    if (dev_id == 0 || !io_vm_owns_device(vcpu->vm, (deviceid_t)dev_id)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    spin_lock(&io_faults.lock);
+    size_t* counter = io_fault_counter((deviceid_t)dev_id, false);
+    if (counter != NULL) {
+        ret = *counter;
+    }
+    for (size_t i = 1; i <= IO_FAULT_RING_SIZE; i++) {
+        struct io_fault_record* record =
+            &io_faults.ring[(io_faults.ring_next + IO_FAULT_RING_SIZE - i) % IO_FAULT_RING_SIZE];
+        if (record->dev_id == dev_id && nth-- == 0) {
+            cause = record->cause;
+            addr = record->addr;
+            break;
+        }
+    }
+    spin_unlock(&io_faults.lock);
+
+    vcpu_writereg(vcpu, HYPCALL_ARG_REG(1), cause);
+    vcpu_writereg(vcpu, HYPCALL_ARG_REG(2), addr);
+
+    return ret;
+}
+
 /* Mainly for HW initialization. */
 void io_init()
 {
@@ -38,3 +160,15 @@ bool io_vm_add_device(struct vm* vm, deviceid_t dev_id)
 
     return res;
 }
+
+/* Done adding the vm's devices, which the iommu may only then be programmed with. */
+void io_vm_commit(struct vm* vm)
+{
+    iommu_arch_vm_commit(vm);
+}
+
+__attribute__((weak)) void iommu_arch_vm_commit(struct vm* vm) { }
+
+__attribute__((weak)) void iommu_arch_vm_inv_range(asid_t vmid, vaddr_t va, size_t size) { }
+
+__attribute__((weak)) void iommu_arch_vm_inv_all(asid_t vmid) { }
@@ -17,7 +17,8 @@
 #include <config.h>
 
 extern uint8_t _image_start, _image_load_end, _image_end, _dmem_phys_beg, _dmem_beg,
-    _cpu_private_beg, _cpu_private_end, _vm_beg, _vm_end, _vm_image_start, _vm_image_end;
+    _cpu_private_beg, _cpu_private_end, _vm_beg, _vm_end, _vm_image_start, _vm_image_end,
+    _init_start, _init_end, _hot_text_start, _hot_text_end;
 
 void switch_space(struct cpu*, paddr_t);
 
@@ -26,11 +27,47 @@ void switch_space(struct cpu*, paddr_t);
  * table.
  */
 
+/**
+ * The shared sections hand out the virtual ranges not requested at a given address in slots of
+ * SEC_VA_SLOT_SIZE, tracked in a bitmap covering the section's first SEC_VA_SLOTS slots. This
+ * spares searching the page tables for a free range. The page tables stay authoritative: a range
+ * is only handed out once its entries are reserved, which fails if anything was mapped there
+ * otherwise, and the page tables are searched if the slots run out.
+ */
+#ifndef SEC_VA_SLOTS
+#define SEC_VA_SLOTS (4096)
+#endif
+#define SEC_VA_SLOT_SIZE (0x200000UL)
+
+/**
+ * Each cpu caches the blocks its last translations hit, tagged with the address space and its
+ * translation generation at the time of the walk, so they are dropped by any later change to the
+ * address space's mappings without reaching into the other cpus' caches.
+ */
+#ifndef MEM_XLATE_CACHE_SIZE
+#define MEM_XLATE_CACHE_SIZE (4)
+#endif
+
+struct mem_xlate_cache {
+    struct {
+        struct addr_space* as;
+        uint32_t gen;
+        vaddr_t va;
+        paddr_t pa;
+        size_t size;
+    } entries[MEM_XLATE_CACHE_SIZE];
+    size_t next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct mem_xlate_cache mem_xlate_caches[PLAT_CPU_NUM];
+
 struct section {
     vaddr_t beg;
     vaddr_t end;
     bool shared;
     spinlock_t lock;
+    BITMAP_ALLOC(va_slots, SEC_VA_SLOTS);
+    size_t va_hint;
 };
 
 struct section hyp_secs[] = {
@@ -62,111 +99,25 @@ size_t mem_cpu_boot_alloc_size()
     return size;
 }
 
-static inline size_t pp_next_clr(paddr_t base, size_t from, colormap_t colors)
-{
-    size_t clr_offset = (base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
-    size_t index = from;
-
-    while (!((colors >> ((index + clr_offset) / COLOR_SIZE % COLOR_NUM)) & 1)) {
-        index++;
-    }
-
-    return index;
-}
-
-static void mem_free_ppages(struct ppages* ppages)
+void mem_free_ppages(struct ppages* ppages)
 {
     list_foreach (page_pool_list, struct page_pool, pool) {
-        spin_lock(&pool->lock);
+        mcs_lock(&pool->lock);
         if (in_range(ppages->base, pool->base, pool->size * PAGE_SIZE)) {
             size_t index = (ppages->base - pool->base) / PAGE_SIZE;
             if (!all_clrs(ppages->colors)) {
-                for (size_t i = 0; i < ppages->num_pages; i++) {
-                    index = pp_next_clr(pool->base, index, ppages->colors);
-                    bitmap_clear(pool->bitmap, index++);
-                }
+                size_t end =
+                    pp_clr_update_bitmap(pool, index, ppages->num_pages, ppages->colors, false);
+                pp_buddy_update(pool, index, end - index);
             } else {
                 bitmap_clear_consecutive(pool->bitmap, index, ppages->num_pages);
+                pp_buddy_update(pool, index, ppages->num_pages);
             }
         }
-        spin_unlock(&pool->lock);
+        mcs_unlock(&pool->lock);
     }
 }
 
-bool pp_alloc_clr(struct page_pool* pool, size_t n, colormap_t colors, struct ppages* ppages)
-{
-    size_t allocated = 0;
-
-    size_t first_index = 0;
-    bool ok = false;
-
-    ppages->colors = colors;
-    ppages->num_pages = 0;
-
-    spin_lock(&pool->lock);
-
-    /**
-     * Lets start the search at the first available color after the last known free position to the
-     * top of the pool.
-     */
-    size_t index = pp_next_clr(pool->base, pool->last, colors);
-    size_t top = pool->size;
-
-    /**
-     * Two iterations. One starting from the last known free page, other starting from the
-     * beggining of page pool to the start of the previous iteration.
-     */
-    for (size_t i = 0; i < 2 && !ok; i++) {
-        while ((allocated < n) && (index < top)) {
-            allocated = 0;
-
-            /* Find first free page on the target colors */
-            while ((index < top) && bitmap_get(pool->bitmap, index)) {
-                index = pp_next_clr(pool->base, ++index, colors);
-            }
-            first_index = index;
-
-            /**
-             * Count the number of free pages contigous on the target color segement until n pages
-             * are found or we reach top page of the search.
-             */
-            while ((index < top) && (bitmap_get(pool->bitmap, index) == 0) && (allocated < n)) {
-                allocated++;
-                index = pp_next_clr(pool->base, ++index, colors);
-            }
-
-            index++;
-        }
-
-        if (allocated == n) {
-            /**
-             * We've found n contigous free pages that fit the color pattern, Fill the output ppage
-             * arg, mark the pages as allocated and update page pool internal state.
-             */
-            ppages->num_pages = n;
-            ppages->base = pool->base + (first_index * PAGE_SIZE);
-            for (size_t i = 0; i < n; i++) {
-                first_index = pp_next_clr(pool->base, first_index, colors);
-                bitmap_set(pool->bitmap, first_index++);
-            }
-            pool->free -= n;
-            pool->last = first_index;
-            ok = true;
-            break;
-        } else {
-            /**
-             * If this is the first iteration, setup index and top to search from base of the page
-             * pool until the previous iteration start point
-             */
-            index = 0;
-        }
-    }
-
-    spin_unlock(&pool->lock);
-
-    return ok;
-}
-
 static struct section* mem_find_sec(struct addr_space* as, vaddr_t va)
 {
     for (size_t i = 0; i < sections[as->type].sec_size; i++) {
@@ -191,7 +142,14 @@ static inline pte_t* mem_alloc_pt(struct addr_space* as, pte_t* parent, size_t l
 {
     /* Must have lock on as and va section to call */
     size_t ptsize = NUM_PAGES(pt_size(&as->pt, lvl + 1));
-    struct ppages ppage = mem_alloc_ppages(as->colors, ptsize, ptsize > 1 ? true : false);
+    struct ppages ppage;
+    if ((ptsize == 1) && (as->pt_reserve.num > 0)) {
+        ppage = mem_ppages_get(as->pt_reserve.base, 1);
+        as->pt_reserve.base += PAGE_SIZE;
+        as->pt_reserve.num--;
+    } else {
+        ppage = mem_alloc_ppages_place(&as->place, as->colors, ptsize, ptsize > 1 ? true : false);
+    }
     if (ppage.num_pages == 0) {
         return NULL;
     }
@@ -199,8 +157,12 @@ static inline pte_t* mem_alloc_pt(struct addr_space* as, pte_t* parent, size_t l
     pte_set(parent, ppage.base, PTE_TABLE, PTE_HYP_FLAGS);
     fence_sync_write();
     pte_t* temp_pt = pt_get(&as->pt, lvl + 1, addr);
-    for (size_t i = 0; i < pt_nentries(&as->pt, lvl + 1); i++) {
-        temp_pt[i] = pte_dflt_val;
+    if (pte_dflt_val == 0) {
+        mem_zero_pages((void*)temp_pt, ptsize);
+    } else {
+        for (size_t i = 0; i < pt_nentries(&as->pt, lvl + 1); i++) {
+            temp_pt[i] = pte_dflt_val;
+        }
     }
     return temp_pt;
 }
@@ -218,6 +180,132 @@ static inline pte_type_t pt_page_type(struct page_table* pt, size_t lvl)
     return (lvl == pt->dscr->lvls - 1) ? PTE_PAGE : PTE_SUPERPAGE;
 }
 
+static void mem_break_contig(struct addr_space* as, vaddr_t va, size_t lvl)
+{
+    /* Must have lock on as and va section to call */
+
+    size_t n = pt_contig_num(&as->pt, lvl);
+    pte_t* pte = pt_get_pte(&as->pt, lvl, va);
+    if ((n <= 1) || (pte == NULL) || !pte_valid(pte) || !pte_contig(pte)) {
+        return;
+    }
+
+    /**
+     * The whole run must be taken down before its entries can be rewritten without the hint,
+     * otherwise the tlb might end up holding conflicting entries for the same address.
+     */
+    size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+    vaddr_t base_va = va & ~((n * lvlsz) - 1);
+    pte_t* base = pt_get_pte(&as->pt, lvl, base_va);
+    pte_t pte_val = *base;
+    paddr_t paddr = pte_addr(base);
+
+    for (size_t i = 0; i < n; i++) {
+        base[i] = PTE_INVALID;
+    }
+    fence_sync_write();
+    tlb_inv_range(as, base_va, n * lvlsz);
+
+    for (size_t i = 0; i < n; i++) {
+        base[i] = pte_val;
+        pte_clear_contig(&base[i], paddr + (i * lvlsz));
+    }
+    fence_sync_write();
+}
+
+static bool mem_contig_run(struct addr_space* as, pte_t* pte, size_t lvl, size_t n)
+{
+    size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+    paddr_t paddr = pte_addr(pte);
+
+    if ((paddr % (n * lvlsz)) != 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!pte_valid(&pte[i]) || !pte_page(&as->pt, &pte[i], lvl) || pte_contig(&pte[i]) ||
+            (pte_addr(&pte[i]) != paddr + (i * lvlsz)) ||
+            ((pte[i] & PTE_FLAGS_MSK) != (pte[0] & PTE_FLAGS_MSK))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static pte_t* mem_leaf_pte(struct addr_space* as, vaddr_t va, size_t* lvl)
+{
+    pte_t* pte = NULL;
+    for (*lvl = 0; *lvl < as->pt.dscr->lvls; (*lvl)++) {
+        pte = pt_get_pte(&as->pt, *lvl, va);
+        if (!pte_valid(pte) || !pte_table(&as->pt, pte, *lvl)) {
+            break;
+        }
+    }
+    return pte;
+}
+
+static void mem_coalesce_contig(struct addr_space* as, vaddr_t va, size_t num_pages)
+{
+    /**
+     * Must have lock on as and va section to call. Only runs fully inside the given range are
+     * marked, so the range must not have been mapped before the current mem_map.
+     */
+
+    if (pt_contig_num(&as->pt, as->pt.dscr->lvls - 1) <= 1) {
+        return;
+    }
+
+    vaddr_t top = va + (num_pages * PAGE_SIZE);
+    bool coalesced = false;
+
+    /**
+     * The entries might already be cached in the tlb, so each run is first taken down while being
+     * marked contiguous and only made valid again after the tlb is invalidated.
+     */
+    for (vaddr_t vaddr = va; vaddr < top;) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, vaddr, &lvl);
+        size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+        size_t n = pt_contig_num(&as->pt, lvl);
+
+        if ((n > 1) && pte_valid(pte) && ((vaddr % (n * lvlsz)) == 0) &&
+            ((top - vaddr) >= (n * lvlsz)) && mem_contig_run(as, pte, lvl, n)) {
+            for (size_t i = 0; i < n; i++) {
+                pte_set_contig(&pte[i]);
+                pte[i] &= ~PTE_VALID;
+            }
+            coalesced = true;
+            vaddr += n * lvlsz;
+        } else {
+            vaddr = (vaddr & ~(lvlsz - 1)) + lvlsz;
+        }
+    }
+
+    if (!coalesced) {
+        return;
+    }
+
+    fence_sync_write();
+    tlb_inv_range(as, va, num_pages * PAGE_SIZE);
+
+    for (vaddr_t vaddr = va; vaddr < top;) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, vaddr, &lvl);
+        size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+        size_t n = pt_contig_num(&as->pt, lvl);
+
+        if ((n > 1) && !pte_valid(pte) && pte_contig(pte)) {
+            for (size_t i = 0; i < n; i++) {
+                pte[i] |= PTE_VALID;
+            }
+            vaddr += n * lvlsz;
+        } else {
+            vaddr = (vaddr & ~(lvlsz - 1)) + lvlsz;
+        }
+    }
+}
+
 static void mem_expand_pte(struct addr_space* as, vaddr_t va, size_t lvl)
 {
     /* Must have lock on as and va section to call */
@@ -227,6 +315,7 @@ static void mem_expand_pte(struct addr_space* as, vaddr_t va, size_t lvl)
         return;
     }
 
+    mem_break_contig(as, va, lvl);
     pte_t* pte = pt_get_pte(&as->pt, lvl, va);
 
     /**
@@ -250,7 +339,7 @@ static void mem_expand_pte(struct addr_space* as, vaddr_t va, size_t lvl)
              * Therefore this function cannot be call on the entry mapping hypervisor code or data
              * used in it (including stack).
              */
-            tlb_inv_va(&cpu()->as, va);
+            tlb_inv_va(as, va);
 
             /**
              *  Now traverse the new next level page table to replicate the original mapping.
@@ -262,7 +351,9 @@ static void mem_expand_pte(struct addr_space* as, vaddr_t va, size_t lvl)
             size_t nentries = pt_nentries(&as->pt, lvl);
             size_t lvlsz = pt_lvlsize(&as->pt, lvl);
             pte_type_t type = pt_page_type(&as->pt, lvl);
-            pte_flags_t flags = (as->type == AS_HYP ? PTE_HYP_FLAGS : PTE_VM_FLAGS);
+            pte_flags_t flags = (as->type == AS_HYP) ?
+                PTE_HYP_FLAGS :
+                ((PTE_VM_FLAGS & ~PTE_VM_ATTR_MSK) | (pte_val & PTE_VM_ATTR_MSK));
 
             while (entry < nentries) {
                 if (vld) {
@@ -298,7 +389,64 @@ static void mem_inflate_pt(struct addr_space* as, vaddr_t va, size_t length)
     }
 }
 
-vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at, size_t n)
+static inline vaddr_t sec_va_slots_base(struct section* sec)
+{
+    return ALIGN(sec->beg, SEC_VA_SLOT_SIZE);
+}
+
+static inline size_t sec_va_slots_num(struct section* sec)
+{
+    vaddr_t base = sec_va_slots_base(sec);
+    if (base > sec->end) {
+        return 0;
+    }
+    return min((size_t)(((sec->end - base) + 1) / SEC_VA_SLOT_SIZE), (size_t)SEC_VA_SLOTS);
+}
+
+static vaddr_t sec_va_alloc(struct section* sec, size_t n)
+{
+    size_t size = sec_va_slots_num(sec);
+    size_t num = ALIGN(n * PAGE_SIZE, SEC_VA_SLOT_SIZE) / SEC_VA_SLOT_SIZE;
+    vaddr_t va = INVALID_VA;
+
+    spin_lock(&sec->lock);
+    ssize_t slot = bitmap_find_consec(sec->va_slots, size, sec->va_hint, num, false);
+    if ((slot < 0) && (sec->va_hint > 0)) {
+        slot = bitmap_find_consec(sec->va_slots, size, 0, num, false);
+    }
+    if (slot >= 0) {
+        bitmap_set_consecutive(sec->va_slots, (size_t)slot, num);
+        sec->va_hint = ((size_t)slot + num) % size;
+        va = sec_va_slots_base(sec) + ((size_t)slot * SEC_VA_SLOT_SIZE);
+    }
+    spin_unlock(&sec->lock);
+
+    return va;
+}
+
+/**
+ * Frees the slots overlapping the range. This might free a slot still partly used by a range not
+ * handed out by sec_va_alloc, which only costs a failed reservation when it is handed out again.
+ * Must have the lock on the section.
+ */
+static void sec_va_free(struct section* sec, vaddr_t va, size_t n)
+{
+    vaddr_t base = sec_va_slots_base(sec);
+    size_t size = sec_va_slots_num(sec);
+    vaddr_t top = va + (n * PAGE_SIZE);
+
+    if ((n == 0) || (top <= base)) {
+        return;
+    }
+
+    size_t first = (max(va, base) - base) / SEC_VA_SLOT_SIZE;
+    size_t last = min((size_t)(((top - 1) - base) / SEC_VA_SLOT_SIZE) + 1, size);
+    if (first < last) {
+        bitmap_clear_consecutive(sec->va_slots, first, last - first);
+    }
+}
+
+static vaddr_t mem_search_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at, size_t n)
 {
     size_t lvl = 0;
     size_t entry = 0;
@@ -349,7 +497,7 @@ vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at,
         lvlsze = pt_lvlsize(&as->pt, lvl);
 
         while ((entry < nentries) && (count < n) && !failed) {
-            if (pte_check_rsw(pte, PTE_RSW_RSRV) ||
+            if (pte_check_rsw(pte, PTE_RSW_RSRV) || pte_check_rsw(pte, PTE_RSW_STALE) ||
                 (pte_valid(pte) && !pte_table(&as->pt, pte, lvl))) {
                 count = 0;
                 vpage = INVALID_VA;
@@ -411,14 +559,69 @@ vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at,
     return vpage;
 }
 
+/**
+ * When no address is given, the range handed out from the section's slots starts off bytes into
+ * its first slot, so that it can be mapped with blocks to physical memory at the same offset.
+ */
+static vaddr_t mem_alloc_vpage_off(struct addr_space* as, enum AS_SEC section, vaddr_t at,
+    size_t n, size_t off)
+{
+    struct section* sec = &sections[as->type].sec[section];
+
+    if ((at == INVALID_VA) && sec->shared && (n > 0)) {
+        vaddr_t va = INVALID_VA;
+        while ((va = sec_va_alloc(sec, n + (off / PAGE_SIZE))) != INVALID_VA) {
+            if (mem_search_vpage(as, section, va + off, n) == (va + off)) {
+                return va + off;
+            }
+        }
+    }
+
+    return mem_search_vpage(as, section, at, n);
+}
+
+vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at, size_t n)
+{
+    return mem_alloc_vpage_off(as, section, at, n, 0);
+}
+
+static void mem_unmap_flush(struct addr_space* as, vaddr_t* inv_base, vaddr_t vaddr,
+    struct ppages* freed)
+{
+    /* Must have lock on as and va section to call */
+
+    /**
+     * The pending range is invalidated before its pages are returned to the pools, so that no
+     * stale translation to them survives once they can be reallocated.
+     */
+    if (vaddr > *inv_base) {
+        fence_sync_write();
+        tlb_inv_range(as, *inv_base, vaddr - *inv_base);
+    }
+    *inv_base = vaddr;
+
+    if (freed->num_pages > 0) {
+        mem_free_ppages(freed);
+        freed->num_pages = 0;
+    }
+}
+
 void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_ppages)
 {
     vaddr_t vaddr = at;
     vaddr_t top = at + (num_pages * PAGE_SIZE);
+    vaddr_t inv_base = at;
+    struct ppages freed = mem_ppages_get(0, 0);
     size_t lvl = 0;
 
     spin_lock(&as->lock);
 
+    /**
+     * Inside a batch the invalidation is left for mem_batch_end. Unmaps which free the pages are
+     * never deferred, as the pages could be reallocated while still reachable through the tlb.
+     */
+    bool batched = (as->batch.depth > 0) && !free_ppages;
+
     struct section* sec = mem_find_sec(as, at);
     if (sec->shared) {
         spin_lock(&sec->lock);
@@ -440,6 +643,7 @@ void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_pp
 
             while ((entry < nentries) && (vaddr < top)) {
                 if (!pte_table(&as->pt, pte, lvl)) {
+                    mem_break_contig(as, vaddr, lvl);
                     vaddr_t vpage_base = vaddr & ~(lvlsz - 1);
 
                     if (vaddr > vpage_base || top < (vpage_base + lvlsz)) {
@@ -450,12 +654,20 @@ void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_pp
 
                     if (free_ppages) {
                         paddr_t paddr = pte_addr(pte);
-                        struct ppages ppages = mem_ppages_get(paddr, lvlsz / PAGE_SIZE);
-                        mem_free_ppages(&ppages);
+                        if ((freed.num_pages > 0) &&
+                            (paddr != freed.base + (freed.num_pages * PAGE_SIZE))) {
+                            mem_unmap_flush(as, &inv_base, vaddr, &freed);
+                        }
+                        if (freed.num_pages == 0) {
+                            freed.base = paddr;
+                        }
+                        freed.num_pages += lvlsz / PAGE_SIZE;
                     }
 
                     *pte = 0;
-                    tlb_inv_va(&cpu()->as, vaddr);
+                    if (batched) {
+                        pte_set_rsw(pte, PTE_RSW_STALE);
+                    }
 
                 } else {
                     break;
@@ -475,13 +687,134 @@ void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_pp
         }
     }
 
+    if (batched) {
+        if (as->batch.top == as->batch.base) {
+            as->batch.base = at;
+            as->batch.top = top;
+        } else {
+            as->batch.base = min(as->batch.base, at);
+            as->batch.top = max(as->batch.top, top);
+        }
+        fence_ord_write();
+        mem_xlate_inv(as);
+    } else {
+        mem_unmap_flush(as, &inv_base, top, &freed);
+    }
+
     if (sec->shared) {
+        if (!batched) {
+            sec_va_free(sec, at, num_pages);
+        }
         spin_unlock(&sec->lock);
     }
 
     spin_unlock(&as->lock);
 }
 
+/**
+ * Sets aside num_pages contiguous pages for the address space's tables, allocated in one go rather
+ * than one at a time as they are needed. Only done for uncolored address spaces, whose pages are
+ * contiguous. The pages not taken are given back at the end of the outermost batch.
+ */
+void mem_pt_reserve(struct addr_space* as, size_t num_pages)
+{
+    if ((num_pages == 0) || !all_clrs(as->colors)) {
+        return;
+    }
+
+    struct ppages ppages = mem_alloc_ppages_place(&as->place, as->colors, num_pages, false);
+    if (ppages.num_pages < num_pages) {
+        return;
+    }
+
+    spin_lock(&as->lock);
+    as->pt_reserve.base = ppages.base;
+    as->pt_reserve.num = num_pages;
+    spin_unlock(&as->lock);
+}
+
+static void mem_pt_reserve_release(struct addr_space* as)
+{
+    /* Must have lock on as to call */
+    if (as->pt_reserve.num > 0) {
+        struct ppages ppages = mem_ppages_get(as->pt_reserve.base, as->pt_reserve.num);
+        mem_free_ppages(&ppages);
+        as->pt_reserve.num = 0;
+    }
+}
+
+void mem_batch_begin(struct addr_space* as)
+{
+    spin_lock(&as->lock);
+    as->batch.depth++;
+    spin_unlock(&as->lock);
+}
+
+void mem_batch_end(struct addr_space* as)
+{
+    spin_lock(&as->lock);
+
+    if (as->batch.depth == 0) {
+        WARNING("mem batch end without matching begin");
+    } else if ((--as->batch.depth == 0) && (as->batch.top > as->batch.base)) {
+        vaddr_t base = as->batch.base;
+        vaddr_t top = as->batch.top;
+
+        fence_sync_write();
+        tlb_inv_range(as, base, top - base);
+
+        /**
+         * Only after the invalidation can the unmapped entries be handed out again. Clearing the
+         * mark is a single write, so there is no need for the section lock.
+         */
+        vaddr_t vaddr = base;
+        while (vaddr < top) {
+            size_t lvl = 0;
+            pte_t* pte = mem_leaf_pte(as, vaddr, &lvl);
+            size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+            if (!pte_valid(pte) && pte_check_rsw(pte, PTE_RSW_STALE)) {
+                *pte = PTE_INVALID;
+            }
+            vaddr = (vaddr & ~(lvlsz - 1)) + lvlsz;
+        }
+        fence_sync_write();
+
+        for (size_t i = 0; i < sections[as->type].sec_size; i++) {
+            struct section* sec = &sections[as->type].sec[i];
+            if (sec->shared && (base <= sec->end) && (top > sec->beg)) {
+                vaddr_t va = max(base, sec->beg);
+                spin_lock(&sec->lock);
+                sec_va_free(sec, va, ((min(top - 1, sec->end) - va) + 1) / PAGE_SIZE);
+                spin_unlock(&sec->lock);
+            }
+        }
+
+        as->batch.base = 0;
+        as->batch.top = 0;
+    }
+
+    if (as->batch.depth == 0) {
+        mem_pt_reserve_release(as);
+    }
+
+    spin_unlock(&as->lock);
+}
+
+static void mem_map_clr_pages(struct addr_space* as, vaddr_t vaddr, struct ppages* ppages,
+    mem_flags_t flags)
+{
+    /* The last level page tables covering the range must already exist */
+    size_t index = 0;
+    for (size_t i = 0; i < ppages->num_pages; i++) {
+        pte_t* pte = pt_get_pte(&as->pt, as->pt.dscr->lvls - 1, vaddr);
+        index = pp_next_clr(ppages->base, index, ppages->colors);
+        paddr_t paddr = ppages->base + (index * PAGE_SIZE);
+        pte_set(pte, paddr, PTE_PAGE, flags);
+        vaddr += PAGE_SIZE;
+        index++;
+    }
+}
+
 bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t num_pages,
     mem_flags_t flags)
 {
@@ -506,7 +839,7 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
 
     struct ppages temp_ppages;
     if (ppages == NULL && !all_clrs(as->colors)) {
-        temp_ppages = mem_alloc_ppages(as->colors, num_pages, false);
+        temp_ppages = mem_alloc_ppages_place(&as->place, as->colors, num_pages, false);
         if (temp_ppages.num_pages < num_pages) {
             ERROR("failed to alloc colored physical pages");
         }
@@ -514,16 +847,8 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
     }
 
     if (ppages && !all_clrs(ppages->colors)) {
-        size_t index = 0;
         mem_inflate_pt(as, vaddr, num_pages * PAGE_SIZE);
-        for (size_t i = 0; i < ppages->num_pages; i++) {
-            pte = pt_get_pte(&as->pt, as->pt.dscr->lvls - 1, vaddr);
-            index = pp_next_clr(ppages->base, index, ppages->colors);
-            paddr_t paddr = ppages->base + (index * PAGE_SIZE);
-            pte_set(pte, paddr, PTE_PAGE, flags);
-            vaddr += PAGE_SIZE;
-            index++;
-        }
+        mem_map_clr_pages(as, vaddr, ppages, flags);
     } else {
         paddr_t paddr = ppages ? ppages->base : 0;
         while (count < num_pages) {
@@ -549,7 +874,8 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
             while ((entry < nentries) && (count < num_pages) &&
                 (num_pages - count >= lvlsz / PAGE_SIZE)) {
                 if (ppages == NULL) {
-                    struct ppages temp = mem_alloc_ppages(as->colors, lvlsz / PAGE_SIZE, true);
+                    struct ppages temp =
+                        mem_alloc_ppages_place(&as->place, as->colors, lvlsz / PAGE_SIZE, true);
                     if (temp.num_pages < lvlsz / PAGE_SIZE) {
                         if (lvl == (as->pt.dscr->lvls - 1)) {
                             // TODO: free previously allocated pages
@@ -574,6 +900,8 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
         }
     }
 
+    mem_coalesce_contig(as, va & ~(PAGE_SIZE - 1), num_pages);
+
     fence_sync();
 
     if (sec->shared) {
@@ -585,6 +913,64 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
     return true;
 }
 
+vaddr_t mem_alloc_inflate(struct addr_space* as, enum AS_SEC section, vaddr_t at,
+    size_t num_pages)
+{
+    vaddr_t address = mem_alloc_vpage(as, section, at, num_pages);
+    if (address == INVALID_VA) {
+        return address;
+    }
+
+    struct section* sec = mem_find_sec(as, address);
+
+    spin_lock(&as->lock);
+    if (sec->shared) {
+        spin_lock(&sec->lock);
+    }
+
+    mem_inflate_pt(as, address, num_pages * PAGE_SIZE);
+
+    if (sec->shared) {
+        spin_unlock(&sec->lock);
+    }
+    spin_unlock(&as->lock);
+
+    return address;
+}
+
+bool mem_map_share(struct addr_space* as, vaddr_t va, size_t num_pages, mem_flags_t flags,
+    size_t share, size_t num_shares)
+{
+    /**
+     * The range is split in shares of whole last level page tables, so no two cpus ever write the
+     * same table, contiguous runs included, and the lock can be left alone. It must have been
+     * reserved and inflated beforehand with mem_alloc_inflate.
+     */
+    vaddr_t vaddr = va & ~(PAGE_SIZE - 1);
+    vaddr_t top = vaddr + (num_pages * PAGE_SIZE);
+    size_t tblsz = pt_lvlsize(&as->pt, as->pt.dscr->lvls - 2);
+    size_t num_tbls = (ALIGN(top, tblsz) - (vaddr & ~(tblsz - 1))) / tblsz;
+    size_t per_share = (num_tbls + num_shares - 1) / num_shares;
+    vaddr_t beg = max((vaddr & ~(tblsz - 1)) + (share * per_share * tblsz), vaddr);
+    vaddr_t end = min((vaddr & ~(tblsz - 1)) + ((share + 1) * per_share * tblsz), top);
+
+    if (beg >= end) {
+        return true;
+    }
+
+    size_t n = (end - beg) / PAGE_SIZE;
+    struct ppages ppages = mem_alloc_ppages_place(&as->place, as->colors, n, false);
+    if (ppages.num_pages < n) {
+        return false;
+    }
+
+    mem_map_clr_pages(as, beg, &ppages, flags);
+    mem_coalesce_contig(as, beg, n);
+    fence_sync();
+
+    return true;
+}
+
 bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t num_pages,
     mem_flags_t flags)
 {
@@ -596,11 +982,9 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
      * Count how many pages are not colored in original images. Allocate the necessary colored
      * pages. Mapped onto hypervisor address space.
      */
-    size_t reclrd_num = num_pages / (COLOR_NUM * COLOR_SIZE) * COLOR_SIZE *
-        bit_count(~(as->colors & BIT_MASK(0, COLOR_NUM)));
-    size_t clr_offset = (ppages->base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
-    for (size_t i = 0; i < (num_pages % (COLOR_NUM * COLOR_SIZE)); i++) {
-        if (!bit_get(as->colors, (i + clr_offset) / COLOR_SIZE % COLOR_NUM)) {
+    size_t reclrd_num = 0;
+    for (size_t i = 0; i < num_pages; i++) {
+        if (!pp_clr_match(ppages->base + (i * PAGE_SIZE), as->colors)) {
             reclrd_num++;
         }
     }
@@ -614,7 +998,8 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
     }
 
     vaddr_t reclrd_va_base = mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, reclrd_num);
-    struct ppages reclrd_ppages = mem_alloc_ppages(as->colors, reclrd_num, false);
+    struct ppages reclrd_ppages =
+        mem_alloc_ppages_place(&as->place, as->colors, reclrd_num, false);
     mem_map(&cpu()->as, reclrd_va_base, &reclrd_ppages, reclrd_num, PTE_HYP_FLAGS);
 
     /**
@@ -643,7 +1028,7 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
          * If image page is already color, just map it. Otherwise first copy it to the previously
          * allocated pages.
          */
-        if (bit_get(as->colors, ((i + clr_offset) / COLOR_SIZE % COLOR_NUM))) {
+        if (pp_clr_match(paddr, as->colors)) {
             pte_set(pte, paddr, PTE_PAGE, flags);
         } else {
             memcpy((void*)clrd_vaddr, (void*)phys_va, PAGE_SIZE);
@@ -659,6 +1044,8 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
         vaddr += PAGE_SIZE;
     }
 
+    mem_coalesce_contig(as, va & ~(PAGE_SIZE - 1), num_pages);
+
     /**
      * Flush the newly allocated colored pages to which parts of the image was copied, and might
      * stayed in the cache system.
@@ -666,15 +1053,26 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
     cache_flush_range(reclrd_va_base, reclrd_num * PAGE_SIZE);
 
     /**
-     * Free the uncolored pages of the original image.
+     * Free the uncolored pages of the original image, in runs of contiguous ones, as the pages off
+     * colors in either dimension do not follow a color pattern of their own.
      */
-    struct ppages unused_pages = { .base = ppages->base,
-        .num_pages = reclrd_num,
-        .colors = ~as->colors };
-    mem_free_ppages(&unused_pages);
+    for (size_t i = 0; i < num_pages;) {
+        size_t run = 0;
+        while (((i + run) < num_pages) &&
+            !pp_clr_match(ppages->base + ((i + run) * PAGE_SIZE), as->colors)) {
+            run++;
+        }
+        if (run > 0) {
+            struct ppages unused_pages = mem_ppages_get(ppages->base + (i * PAGE_SIZE), run);
+            mem_free_ppages(&unused_pages);
+        }
+        i += run + 1;
+    }
 
+    mem_batch_begin(&cpu()->as);
     mem_unmap(&cpu()->as, reclrd_va_base, reclrd_num, false);
     mem_unmap(&cpu()->as, phys_va_base, num_pages, false);
+    mem_batch_end(&cpu()->as);
 
     return true;
 }
@@ -734,9 +1132,54 @@ void* copy_space(void* base, const size_t size, struct ppages* pages)
  * coloring is actually never achieved. The drawbacks of this limitation are yet to be seen, and
  * are in need of more testing.
  */
-void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_region)
+/**
+ * Unmaps the boot only code and data from the hypervisor's image and frees their pages, which the
+ * page tables shared by all cpus map, the tlb invalidation reaching all of them. Called once no
+ * cpu executes __init code anymore.
+ */
+void mem_reclaim_init(void)
+{
+    size_t num_pages = (size_t)(&_init_end - &_init_start) / PAGE_SIZE;
+    if (num_pages > 0) {
+        mem_unmap(&cpu()->as, (vaddr_t)&_init_start, num_pages, true);
+    }
+}
+
+/**
+ * Moves the hot text, i.e. the exception vectors and the __hot functions, to the platform's fast
+ * memory by copying it there and remapping its pages in place, so its addresses do not change. It
+ * is left in dram if it does not fit. The other cpus must not run any of it meanwhile.
+ */
+__init void mem_fast_place(void)
+{
+    vaddr_t hot_va = (vaddr_t)&_hot_text_start;
+    size_t num_pages = (size_t)(&_hot_text_end - &_hot_text_start) / PAGE_SIZE;
+
+    if ((platform.fast_mem.size == 0) || (num_pages == 0)) {
+        return;
+    }
+
+    if (((platform.fast_mem.base % PAGE_SIZE) != 0) ||
+        ((num_pages * PAGE_SIZE) > platform.fast_mem.size)) {
+        WARNING("Hot text does not fit in fast memory, left in dram");
+        return;
+    }
+
+    struct ppages fast_ppages = mem_ppages_get(platform.fast_mem.base, num_pages);
+    vaddr_t va = mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &fast_ppages, INVALID_VA, num_pages,
+        PTE_HYP_FLAGS);
+    memcpy((void*)va, (void*)hot_va, num_pages * PAGE_SIZE);
+    cache_clean_range(va, num_pages * PAGE_SIZE);
+    mem_unmap(&cpu()->as, va, num_pages, false);
+
+    mem_unmap(&cpu()->as, hot_va, num_pages, true);
+    mem_map(&cpu()->as, hot_va, &fast_ppages, num_pages, PTE_HYP_FLAGS);
+}
+
+__init void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_region)
 {
     volatile static pte_t shared_pte;
+    volatile static vaddr_t image_copy_va;
     vaddr_t va = INVALID_VA;
     struct cpu* cpu_new;
     struct ppages p_cpu;
@@ -749,9 +1192,7 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
     size_t vm_image_size = (size_t)(&_vm_image_end - &_vm_image_start);
     size_t cpu_boot_size = mem_cpu_boot_alloc_size();
     struct page_pool* root_pool = &root_region->page_pool;
-    size_t bitmap_size =
-        (root_pool->size / (8 * PAGE_SIZE) + !!(root_pool->size % (8 * PAGE_SIZE) != 0)) *
-        PAGE_SIZE;
+    size_t bitmap_size = pp_metadata_num_pages(root_pool->base, root_pool->size) * PAGE_SIZE;
     colormap_t colors = config.hyp.colors;
 
     /* Set hypervisor colors in current address space */
@@ -793,12 +1234,17 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
     /*
      * Copy the Hypervisor image and root page pool bitmap into a colored region.
      *
-     * CPU_MASTER allocates, copies and maps the image and the root page pool bitmap on a shared
-     * space, whilst other CPUs only have to copy the image from the CPU_MASTER in order to be able
-     * to access it.
+     * CPU_MASTER allocates and maps the image and the root page pool bitmap on a shared space,
+     * whilst other CPUs only have to copy the image page table entry from the CPU_MASTER in order
+     * to be able to access it.
      */
     if (cpu_is_master()) {
-        copy_space(&_image_start, image_size, &p_image);
+        p_image = mem_alloc_ppages(colors, NUM_PAGES(image_size), false);
+        image_copy_va = mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &p_image, INVALID_VA,
+            NUM_PAGES(image_size), PTE_HYP_FLAGS);
+        if (image_copy_va == INVALID_VA) {
+            ERROR("Can't map the colored Bao Image");
+        }
         va = mem_alloc_vpage(&cpu_new->as, SEC_HYP_IMAGE, (vaddr_t)&_image_start,
             NUM_PAGES(image_size));
 
@@ -818,6 +1264,22 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
 
     cpu_sync_barrier(&cpu_glb_sync);
 
+    /*
+     * The colored image is mapped in the shared global section, so all CPUs copy and flush their
+     * own page aligned slice of it in parallel. No CPU may change the image until all copies are
+     * done, as its state would not be carried over.
+     */
+    size_t slice = ALIGN((image_size / platform.cpu_num) + 1, PAGE_SIZE);
+    size_t slice_beg = min(cpu()->id * slice, image_size);
+    size_t slice_end = min(slice_beg + slice, image_size);
+    if (slice_beg < slice_end) {
+        memcpy((void*)(image_copy_va + slice_beg), (void*)((vaddr_t)&_image_start + slice_beg),
+            slice_end - slice_beg);
+        cache_flush_range(image_copy_va + slice_beg, slice_end - slice_beg);
+    }
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
     /*
      * CPU_MASTER will also take care of mapping the configuration onto the new space.
      *
@@ -841,10 +1303,10 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
     switch_space(cpu_new, p_root_pt_addr);
 
     /**
-     * Make sure the new physical pages containing image and cpu are flushed to main memmory
+     * Make sure the new physical pages containing the cpu are flushed to main memmory. The image
+     * slices were flushed right after being copied.
      */
 
-    cache_flush_range((vaddr_t)&_image_start, image_size);
     cache_flush_range((vaddr_t)&_cpu_private_beg, sizeof(struct cpu));
 
     /**
@@ -874,14 +1336,14 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
         p_image = mem_ppages_get(load_addr, NUM_PAGES(image_load_size));
         va = mem_alloc_vpage(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, p_image.num_pages);
         mem_map(&cpu()->as, va, &p_image, p_image.num_pages, PTE_HYP_FLAGS);
-        memset((void*)va, 0, p_image.num_pages * PAGE_SIZE);
+        mem_zero_pages((void*)va, p_image.num_pages);
         mem_unmap(&cpu()->as, va, p_image.num_pages, true);
 
         p_image = mem_ppages_get(load_addr + image_load_size + vm_image_size,
             NUM_PAGES(image_noload_size));
         va = mem_alloc_vpage(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, p_image.num_pages);
         mem_map(&cpu()->as, va, &p_image, p_image.num_pages, PTE_HYP_FLAGS);
-        memset((void*)va, 0, p_image.num_pages * PAGE_SIZE);
+        mem_zero_pages((void*)va, p_image.num_pages);
         mem_unmap(&cpu()->as, va, p_image.num_pages, true);
 
         p_bitmap = mem_ppages_get(load_addr + image_size + vm_image_size +
@@ -890,7 +1352,7 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
 
         va = mem_alloc_vpage(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, p_bitmap.num_pages);
         mem_map(&cpu()->as, va, &p_bitmap, p_bitmap.num_pages, PTE_HYP_FLAGS);
-        memset((void*)va, 0, p_bitmap.num_pages * PAGE_SIZE);
+        mem_zero_pages((void*)va, p_bitmap.num_pages);
         mem_unmap(&cpu()->as, va, p_bitmap.num_pages, true);
     }
 
@@ -898,33 +1360,158 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region* root_regio
         cpu_boot_size / PAGE_SIZE);
     va = mem_alloc_vpage(&cpu()->as, SEC_HYP_PRIVATE, INVALID_VA, p_cpu.num_pages);
     mem_map(&cpu()->as, va, &p_cpu, p_cpu.num_pages, PTE_HYP_FLAGS);
-    memset((void*)va, 0, p_cpu.num_pages * PAGE_SIZE);
+    mem_zero_pages((void*)va, p_cpu.num_pages);
     mem_unmap(&cpu()->as, va, p_cpu.num_pages, false);
 }
 
-void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, pte_t* root_pt, colormap_t colors)
+/**
+ * Looks va up in the cpu's translation cache, walking the address space on a miss. The generation
+ * is read before the walk, so a change made meanwhile leaves the new entry stale.
+ */
+static bool mem_translate_block(struct addr_space* as, vaddr_t va, paddr_t* pa, size_t* size)
+{
+    struct mem_xlate_cache* cache = &mem_xlate_caches[cpu()->id];
+    uint32_t gen = as->xlate_gen;
+
+    for (size_t i = 0; i < MEM_XLATE_CACHE_SIZE; i++) {
+        if ((cache->entries[i].as == as) && (cache->entries[i].gen == gen) &&
+            (va - cache->entries[i].va < cache->entries[i].size)) {
+            *pa = cache->entries[i].pa + (va - cache->entries[i].va);
+            *size = cache->entries[i].size - (va - cache->entries[i].va);
+            return true;
+        }
+    }
+
+    fence_ord_read();
+    paddr_t block_pa;
+    size_t block_size;
+    if (!mem_arch_translate(as, va, &block_pa, &block_size)) {
+        return false;
+    }
+
+    vaddr_t offset = va & (block_size - 1);
+    size_t i = cache->next;
+    cache->entries[i].as = as;
+    cache->entries[i].gen = gen;
+    cache->entries[i].va = va - offset;
+    cache->entries[i].pa = block_pa - offset;
+    cache->entries[i].size = block_size;
+    cache->next = (i + 1) % MEM_XLATE_CACHE_SIZE;
+
+    *pa = block_pa;
+    *size = block_size - offset;
+    return true;
+}
+
+bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
+{
+    paddr_t block_pa;
+    size_t size;
+
+    if (!mem_translate_block(as, va, &block_pa, &size)) {
+        return false;
+    }
+    if (pa != NULL) {
+        *pa = block_pa;
+    }
+    return true;
+}
+
+bool mem_translate_writable(struct addr_space* as, vaddr_t va, paddr_t* pa)
+{
+    bool writable = false;
+
+    spin_lock(&as->lock);
+    size_t lvl = 0;
+    pte_t* pte = mem_leaf_pte(as, va, &lvl);
+    if (pte_valid(pte)) {
+        if (pte_dirty_writable(pte)) {
+            writable = true;
+        } else if (pte_dirty_armed(pte)) {
+            *pte |= PTE_DIRTY_LOG_BIT;
+            fence_sync_write();
+            tlb_inv_va(as, va & ~(PAGE_SIZE - 1));
+            writable = true;
+        }
+    }
+    spin_unlock(&as->lock);
+
+    return writable && mem_translate(as, va, pa);
+}
+
+size_t mem_translate_range(struct addr_space* as, vaddr_t va, size_t size, paddr_t* pa)
+{
+    paddr_t base_pa;
+    size_t run;
+
+    if ((size == 0) || !mem_translate_block(as, va, &base_pa, &run)) {
+        return 0;
+    }
+
+    while (run < size) {
+        paddr_t next_pa;
+        size_t next;
+        if (!mem_translate_block(as, va + run, &next_pa, &next) || (next_pa != base_pa + run)) {
+            break;
+        }
+        run += next;
+    }
+
+    if (pa != NULL) {
+        *pa = base_pa;
+    }
+    return min(run, size);
+}
+
+static void as_init_dscr(struct addr_space* as, enum AS_TYPE type, asid_t id, pte_t* root_pt,
+    colormap_t colors, struct page_table_dscr* dscr)
 {
     as->type = type;
-    as->pt.dscr = type == AS_HYP || type == AS_HYP_CPY ? hyp_pt_dscr : vm_pt_dscr;
+    as->pt.dscr = dscr;
     as->colors = colors;
+    as->place = (struct mem_place){ .policy = MEM_PLACE_ANY };
     as->lock = SPINLOCK_INITVAL;
     as->id = id;
+    as->batch.depth = 0;
+    as->batch.base = 0;
+    as->batch.top = 0;
+    as->pt_reserve.base = 0;
+    as->pt_reserve.num = 0;
+    /**
+     * The address space may take the place of one whose translations are still cached, e.g. the
+     * cpu's own once the hypervisor is recolored, so those are dropped.
+     */
+    mem_xlate_inv(as);
+    memset(&mem_xlate_caches[cpu()->id], 0, sizeof(struct mem_xlate_cache));
 
     if (root_pt == NULL) {
         size_t n = NUM_PAGES(pt_size(&as->pt, 0));
         root_pt = (pte_t*)mem_alloc_page(n,
             type == AS_HYP || type == AS_HYP_CPY ? SEC_HYP_PRIVATE : SEC_HYP_VM, true);
-        memset((void*)root_pt, 0, n * PAGE_SIZE);
+        mem_zero_pages((void*)root_pt, n);
     }
     as->pt.root = root_pt;
 
     as_arch_init(as);
 }
 
+void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, pte_t* root_pt, colormap_t colors)
+{
+    as_init_dscr(as, type, id, root_pt, colors,
+        type == AS_HYP || type == AS_HYP_CPY ? hyp_pt_dscr : vm_pt_dscr);
+}
+
+void as_vm_init(struct addr_space* as, asid_t id, colormap_t colors,
+    struct page_table_dscr* dscr)
+{
+    as_init_dscr(as, AS_VM, id, NULL, colors, dscr);
+}
+
 void mem_prot_init()
 {
     pte_t* root_pt = (pte_t*)ALIGN(((vaddr_t)cpu()) + sizeof(struct cpu), PAGE_SIZE);
     as_init(&cpu()->as, AS_HYP, HYP_ASID, root_pt, config.hyp.colors);
+    cpu()->as.place = config.hyp.mem_place;
 }
 
 vaddr_t mem_alloc_map(struct addr_space* as, enum AS_SEC section, struct ppages* page, vaddr_t at,
@@ -937,10 +1524,239 @@ vaddr_t mem_alloc_map(struct addr_space* as, enum AS_SEC section, struct ppages*
     return address;
 }
 
+/**
+ * Prints the block sizes the range is mapped with, only in builds with MEM_MAP_REPORT=y, as it
+ * takes a line per region of every vm.
+ */
+void mem_map_report(struct addr_space* as, vaddr_t va, size_t num_pages)
+{
+    if (!DEFINED(MEM_MAP_REPORT)) {
+        return;
+    }
+
+    size_t hist[PT_LVLS_MAX] = { 0 };
+    size_t unmapped = 0;
+    vaddr_t vaddr = va & ~(PAGE_SIZE - 1);
+    vaddr_t top = vaddr + (num_pages * PAGE_SIZE);
+
+    spin_lock(&as->lock);
+    while (vaddr < top) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, vaddr, &lvl);
+        size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+        if (pte_valid(pte) && pte_page(&as->pt, pte, lvl)) {
+            hist[lvl]++;
+            vaddr = (vaddr & ~(lvlsz - 1)) + lvlsz;
+        } else {
+            unmapped++;
+            vaddr += PAGE_SIZE;
+        }
+    }
+    spin_unlock(&as->lock);
+
+    console_printk("BAO INFO: as %lu 0x%lx-0x%lx mapped with", as->id, va, top - 1);
+    for (size_t lvl = 0; lvl < as->pt.dscr->lvls; lvl++) {
+        if (pt_lvl_terminal(&as->pt, lvl)) {
+            console_printk(" %lux%luK", (unsigned long)hist[lvl],
+                (unsigned long)(pt_lvlsize(&as->pt, lvl) / 1024));
+        }
+    }
+    if (unmapped > 0) {
+        console_printk(" (%lu pages unmapped)", (unsigned long)unmapped);
+    }
+    console_printk("\n");
+}
+
+/**
+ * Dirty logging write protects each writable page of the range, splitting its blocks and
+ * contiguous runs first so that the dirty state is kept per page. The arch's dirty state of the
+ * entries is then set on the first write to each page, either by the hardware or through
+ * mem_dirty_log_fault, and harvested by mem_dirty_log_collect. Pages mapped after arming are left
+ * writable and so are not logged.
+ */
+void mem_dirty_log_arm(struct addr_space* as, vaddr_t va, size_t num_pages)
+{
+    size_t last = as->pt.dscr->lvls - 1;
+    vaddr_t vaddr = va;
+    vaddr_t top = va + (num_pages * PAGE_SIZE);
+
+    spin_lock(&as->lock);
+    while (vaddr < top) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, vaddr, &lvl);
+        size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+        if (!pte_valid(pte)) {
+            vaddr = (vaddr & ~(lvlsz - 1)) + lvlsz;
+        } else if (lvl < last) {
+            mem_expand_pte(as, vaddr, lvl);
+        } else {
+            mem_break_contig(as, vaddr, lvl);
+            pte_dirty_arm(pte);
+            vaddr += PAGE_SIZE;
+        }
+    }
+    fence_sync_write();
+    tlb_inv_range(as, va, num_pages * PAGE_SIZE);
+    spin_unlock(&as->lock);
+}
+
+void mem_dirty_log_disarm(struct addr_space* as, vaddr_t va, size_t num_pages)
+{
+    spin_lock(&as->lock);
+    for (size_t i = 0; i < num_pages; i++) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, va + (i * PAGE_SIZE), &lvl);
+        if (pte_valid(pte) && (lvl == as->pt.dscr->lvls - 1)) {
+            pte_dirty_disarm(pte);
+        }
+    }
+    fence_sync_write();
+    tlb_inv_range(as, va, num_pages * PAGE_SIZE);
+    spin_unlock(&as->lock);
+}
+
+/**
+ * The hardware may set the access and dirty state concurrently, so it is cleared atomically, on
+ * the entry's low word, which holds PTE_DIRTY_LOG_BIT and PTE_ACCESSED_BIT on all archs.
+ */
+static bool mem_pte_test_clear(pte_t* pte, uint32_t bit)
+{
+    volatile uint32_t* word = (volatile uint32_t*)pte;
+    uint32_t val = *word;
+
+    while ((val & bit) != 0) {
+        uint32_t old = spin_atomic_cmpxchg(word, val, val & ~bit);
+        if (old == val) {
+            return true;
+        }
+        val = old;
+    }
+
+    return false;
+}
+
+/**
+ * Sets the bit of each page of the range written since it was armed or last collected, and write
+ * protects it again. The whole range is invalidated from the tlb at once, after all of its entries
+ * are cleared. Returns the number of dirty pages.
+ */
+size_t mem_dirty_log_collect(struct addr_space* as, vaddr_t va, size_t num_pages, bitmap_t* bitmap)
+{
+    size_t dirty = 0;
+
+    spin_lock(&as->lock);
+    for (size_t i = 0; i < num_pages; i++) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, va + (i * PAGE_SIZE), &lvl);
+        if (pte_valid(pte) && (lvl == as->pt.dscr->lvls - 1) && pte_dirty_armed(pte) &&
+            mem_pte_test_clear(pte, PTE_DIRTY_LOG_BIT)) {
+            bitmap_set(bitmap, i);
+            dirty++;
+        }
+    }
+    if (dirty > 0) {
+        fence_sync_write();
+        tlb_inv_range(as, va, num_pages * PAGE_SIZE);
+    }
+    spin_unlock(&as->lock);
+
+    return dirty;
+}
+
+/**
+ * Handles a write to an armed page the hardware did not set the dirty state of itself. The fault
+ * might also predate another cpu setting the entry or disarming it, in which case the write is
+ * only retried, the tlb being invalidated anyway.
+ */
+bool mem_dirty_log_fault(struct addr_space* as, vaddr_t va)
+{
+    bool handled = false;
+
+    spin_lock(&as->lock);
+    size_t lvl = 0;
+    pte_t* pte = mem_leaf_pte(as, va, &lvl);
+    if (pte_valid(pte) && (lvl == as->pt.dscr->lvls - 1)) {
+        if (pte_dirty_armed(pte)) {
+            *pte |= PTE_DIRTY_LOG_BIT;
+            fence_sync_write();
+            handled = true;
+        } else {
+            handled = pte_dirty_writable(pte);
+        }
+        if (handled) {
+            tlb_inv_va(as, va & ~(PAGE_SIZE - 1));
+        }
+    }
+    spin_unlock(&as->lock);
+
+    return handled;
+}
+
+/**
+ * Adds the number of pages of the range accessed since the last sample to the heat of each
+ * chunk_size chunk from va, clearing their access flags, which the hardware must set itself. A
+ * block or contiguous run counts as a whole, the hardware setting the flag of any of a run's
+ * entries. The whole range is invalidated from the tlb at once. Returns the total.
+ */
+size_t mem_access_sample(struct addr_space* as, vaddr_t va, size_t num_pages, size_t chunk_size,
+    uint16_t* heat)
+{
+    vaddr_t vaddr = va;
+    vaddr_t top = va + (num_pages * PAGE_SIZE);
+    size_t total = 0;
+    bool cleared = false;
+
+    spin_lock(&as->lock);
+    while (vaddr < top) {
+        size_t lvl = 0;
+        pte_t* pte = mem_leaf_pte(as, vaddr, &lvl);
+        size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+        size_t n = (pte_valid(pte) && pte_contig(pte)) ? pt_contig_num(&as->pt, lvl) : 1;
+        vaddr_t base = vaddr & ~((n * lvlsz) - 1);
+        vaddr_t next = min(base + (n * lvlsz), top);
+
+        bool accessed = false;
+        if (pte_valid(pte) && pte_page(&as->pt, pte, lvl)) {
+            pte_t* entries = pt_get_pte(&as->pt, lvl, base);
+            for (size_t i = 0; i < n; i++) {
+                accessed |= mem_pte_test_clear(&entries[i], PTE_ACCESSED_BIT);
+            }
+        }
+
+        if (accessed) {
+            cleared = true;
+            while (vaddr < next) {
+                size_t chunk = (vaddr - va) / chunk_size;
+                vaddr_t chunk_top = min(va + ((chunk + 1) * chunk_size), next);
+                size_t pages = (chunk_top - vaddr) / PAGE_SIZE;
+                heat[chunk] = (uint16_t)(heat[chunk] + pages);
+                total += pages;
+                vaddr = chunk_top;
+            }
+        }
+        vaddr = next;
+    }
+    if (cleared) {
+        fence_sync_write();
+        tlb_inv_range(as, va, num_pages * PAGE_SIZE);
+    }
+    spin_unlock(&as->lock);
+
+    return total;
+}
+
+/**
+ * Device regions are mapped with the largest blocks their alignment allows. Those given no address
+ * get one at the same offset into a block as their physical address, so that only their unaligned
+ * ends take pages.
+ */
 vaddr_t mem_alloc_map_dev(struct addr_space* as, enum AS_SEC section, vaddr_t at, paddr_t pa,
     size_t num_pages)
 {
-    vaddr_t address = mem_alloc_vpage(as, section, at, num_pages);
+    size_t off = ((num_pages * PAGE_SIZE) >= SEC_VA_SLOT_SIZE) ?
+        ((pa % SEC_VA_SLOT_SIZE) & ~(PAGE_SIZE - 1)) :
+        0;
+    vaddr_t address = mem_alloc_vpage_off(as, section, at, num_pages, off);
     if (address != INVALID_VA) {
         struct ppages pages = mem_ppages_get(pa, num_pages);
         mem_flags_t flags = as->type == AS_HYP ? PTE_HYP_DEV_FLAGS : PTE_VM_DEV_FLAGS;
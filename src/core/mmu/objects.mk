@@ -2,6 +2,8 @@
 ## Copyright (c) Bao Project and Contributors. All rights reserved
 
 core-objs-y+=mmu/mem.o
+core-objs-y+=mmu/page_pool.o
 core-objs-y+=mmu/io.o
 core-objs-y+=mmu/vmm.o
 core-objs-y+=mmu/vm.o
+core-objs-y+=mmu/grant.o
@@ -0,0 +1,115 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <mem.h>
+#include <prof.h>
+
+/**
+ * Sets or clears in the pool bitmap the n pages of the given colors starting at index. Returns the
+ * index following the last page.
+ */
+size_t pp_clr_update_bitmap(struct page_pool* pool, size_t index, size_t n, colormap_t colors,
+    bool set)
+{
+    while (n > 0) {
+        index = pp_next_clr(pool->base, index, colors);
+        size_t num = min(n, pp_clr_chunk_end(pool->base, index, colors) - index);
+        if (set) {
+            bitmap_set_consecutive(pool->bitmap, index, num);
+        } else {
+            bitmap_clear_consecutive(pool->bitmap, index, num);
+        }
+        index += num;
+        n -= num;
+    }
+
+    return index;
+}
+
+bool pp_alloc_clr(struct page_pool* pool, size_t n, colormap_t colors, struct ppages* ppages)
+{
+    PROF_SCOPE(PROF_PP_ALLOC_CLR);
+
+    size_t allocated = 0;
+
+    size_t first_index = 0;
+    bool ok = false;
+
+    ppages->colors = colors;
+    ppages->num_pages = 0;
+
+    mcs_lock(&pool->lock);
+
+    /**
+     * Lets start the search at the first available color after the last known free position to the
+     * top of the pool.
+     */
+    size_t index = pp_next_clr(pool->base, pool->last, colors);
+    size_t top = pool->size;
+
+    /**
+     * Two iterations. One starting from the last known free page, other starting from the
+     * beggining of page pool to the start of the previous iteration.
+     */
+    for (size_t i = 0; i < 2 && !ok; i++) {
+        allocated = 0;
+
+        while ((allocated < n) && (index < top)) {
+            size_t chunk_end = min(pp_clr_chunk_end(pool->base, index, colors), top);
+
+            if (bitmap_get(pool->bitmap, index)) {
+                /* Find first free page on the target colors */
+                allocated = 0;
+                ssize_t free_index = bitmap_find_first(pool->bitmap, chunk_end, index, false);
+                if (free_index < 0) {
+                    index = pp_next_clr(pool->base, chunk_end, colors);
+                    continue;
+                }
+                index = (size_t)free_index;
+            }
+
+            if (allocated == 0) {
+                first_index = index;
+            }
+
+            /**
+             * Count the number of free pages contigous on the target color segement until n pages
+             * are found or we reach the end of this color chunk.
+             */
+            size_t count = bitmap_count_consecutive(pool->bitmap, chunk_end, index, n - allocated);
+            allocated += count;
+            index += count;
+
+            if ((allocated < n) && (index >= chunk_end)) {
+                index = pp_next_clr(pool->base, chunk_end, colors);
+            }
+        }
+
+        if (allocated == n) {
+            /**
+             * We've found n contigous free pages that fit the color pattern, Fill the output ppage
+             * arg, mark the pages as allocated and update page pool internal state.
+             */
+            ppages->num_pages = n;
+            ppages->base = pool->base + (first_index * PAGE_SIZE);
+            size_t end_index = pp_clr_update_bitmap(pool, first_index, n, colors, true);
+            pp_buddy_update(pool, first_index, end_index - first_index);
+            pool->free -= n;
+            pool->last = end_index;
+            ok = true;
+            break;
+        } else {
+            /**
+             * If this is the first iteration, setup index and top to search from base of the page
+             * pool until the previous iteration start point
+             */
+            index = pp_next_clr(pool->base, 0, colors);
+        }
+    }
+
+    mcs_unlock(&pool->lock);
+
+    return ok;
+}
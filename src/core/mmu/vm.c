@@ -7,8 +7,603 @@
 
 #include <config.h>
 #include <mem.h>
+#include <tlb.h>
+#include <timer.h>
+#include <grant.h>
+#include <platform.h>
+#include <stats.h>
+#include <fences.h>
+#include <string.h>
+
+#ifndef VM_LAZY_CHUNK_SIZE
+#define VM_LAZY_CHUNK_SIZE (0x200000)
+#endif
+
+/* Period of the background mapping of lazy regions, in which each of the vm's cpus maps a chunk */
+#ifndef VM_LAZY_PERIOD_US
+#define VM_LAZY_PERIOD_US (1000)
+#endif
+
+/**
+ * The physical pages of each chunk are allocated when the region is reserved, so a vm never fails
+ * to map its memory later on. The chunks are aligned to VM_LAZY_CHUNK_SIZE, except for the first
+ * and last one, so uncolored chunks can be mapped with superpages. A chunk is marked as mapped by
+ * zeroing its number of pages.
+ */
+struct vm_lazy_region {
+    node_t node;
+    vaddr_t base;
+    size_t size;
+    size_t num_chunks;
+    mem_flags_t flags;
+    struct ppages chunks[];
+};
+
+static struct timer_event vm_lazy_events[PLAT_CPU_NUM];
+static struct timer_event vm_wss_events[PLAT_CPU_NUM];
+
+/**
+ * The top of the guest physical address space the vm's regions, devices, shared memories and
+ * remote io devices span. The arch adds its own emulated devices and picks the stage 2 page table
+ * format translating no more than needed.
+ */
+static vaddr_t vm_ipa_top(const struct vm_config* config)
+{
+    const struct vm_platform* platform = &config->platform;
+    vaddr_t top = 0;
+
+    for (size_t i = 0; i < platform->region_num; i++) {
+        top = max(top, platform->regions[i].base + platform->regions[i].size);
+    }
+    for (size_t i = 0; i < platform->dev_num; i++) {
+        top = max(top, platform->devs[i].va + platform->devs[i].size);
+    }
+    for (size_t i = 0; i < platform->ipc_num; i++) {
+        top = max(top, platform->ipcs[i].base + platform->ipcs[i].size);
+    }
+    for (size_t i = 0; i < platform->remio_dev_num; i++) {
+        struct remio_dev* dev = &platform->remio_devs[i];
+        size_t size = (dev->type == REMIO_DEV_BACKEND) ? sizeof(struct remio_ring) : dev->size;
+        top = max(top, dev->va + size);
+    }
+
+    return top;
+}
 
 void vm_mem_prot_init(struct vm* vm, const struct vm_config* config)
 {
-    as_init(&vm->as, AS_VM, vm->id, NULL, config->colors);
+    as_vm_init(&vm->as, vm->id, config->colors, vm_arch_pt_dscr(config, vm_ipa_top(config)));
+    vm->as.place = config->mem_place;
+
+#ifdef CONFIG_VM_PT_PAGES
+    /* Counted by the config's generator for the mappings fixed in the config */
+    static const size_t vm_pt_pages[] = CONFIG_VM_PT_PAGES;
+    mem_pt_reserve(&vm->as, vm_pt_pages[vm->id]);
+#endif
+}
+
+static inline vaddr_t vm_lazy_chunk_base(struct vm_lazy_region* lreg, size_t chunk)
+{
+    vaddr_t base = (lreg->base & ~(VM_LAZY_CHUNK_SIZE - 1)) + (chunk * VM_LAZY_CHUNK_SIZE);
+    return max(base, lreg->base);
+}
+
+static void vm_lazy_map_chunk(struct vm* vm, struct vm_lazy_region* lreg, size_t chunk)
+{
+    /* Must have the lock on the vm's lazy regions to call */
+    struct ppages* ppages = &lreg->chunks[chunk];
+
+    if (ppages->num_pages == 0) {
+        return;
+    }
+
+    if (!mem_map(&vm->as, vm_lazy_chunk_base(lreg, chunk), ppages, ppages->num_pages,
+            lreg->flags)) {
+        ERROR("failed to map lazy chunk of vm region at 0x%lx", lreg->base);
+    }
+    ppages->num_pages = 0;
+    vm->lazy.pending--;
+}
+
+bool vm_map_mem_region_lazy(struct vm* vm, struct vm_mem_region* reg)
+{
+    if (reg->place_phys) {
+        WARNING("lazy mapping of vm regions at fixed physical addresses not supported");
+        return false;
+    }
+
+    vaddr_t top = reg->base + reg->size;
+    vaddr_t chunks_base = reg->base & ~(VM_LAZY_CHUNK_SIZE - 1);
+    size_t num_chunks = (ALIGN(top, VM_LAZY_CHUNK_SIZE) - chunks_base) / VM_LAZY_CHUNK_SIZE;
+    size_t lreg_size = sizeof(struct vm_lazy_region) + (num_chunks * sizeof(struct ppages));
+
+    struct vm_lazy_region* lreg = mem_alloc_page(NUM_PAGES(lreg_size), SEC_HYP_GLOBAL, false);
+    if (lreg == NULL) {
+        ERROR("failed to allocate lazy vm region at 0x%lx", reg->base);
+    }
+
+    if (mem_alloc_vpage(&vm->as, SEC_VM_ANY, (vaddr_t)reg->base, NUM_PAGES(reg->size)) !=
+        (vaddr_t)reg->base) {
+        ERROR("failed to allocate vm's region at 0x%lx", reg->base);
+    }
+
+    lreg->base = reg->base;
+    lreg->size = reg->size;
+    lreg->num_chunks = num_chunks;
+    lreg->flags = mem_vm_flags(reg->cacheability);
+    for (size_t i = 0; i < num_chunks; i++) {
+        vaddr_t chunk_base = vm_lazy_chunk_base(lreg, i);
+        vaddr_t chunk_top = min(chunks_base + ((i + 1) * VM_LAZY_CHUNK_SIZE), top);
+        size_t n = NUM_PAGES(chunk_top - chunk_base);
+        bool aligned = all_clrs(vm->as.colors) && ((n * PAGE_SIZE) == VM_LAZY_CHUNK_SIZE);
+        lreg->chunks[i] = mem_alloc_ppages_place(&vm->as.place, vm->as.colors, n, aligned);
+        if (lreg->chunks[i].num_pages < n) {
+            ERROR("failed to reserve memory for vm region at 0x%lx", reg->base);
+        }
+    }
+
+    spin_lock(&vm->lazy.lock);
+    list_push(&vm->lazy.regions, &lreg->node);
+    vm->lazy.pending += num_chunks;
+    spin_unlock(&vm->lazy.lock);
+
+    return true;
+}
+
+bool vm_mem_populate(struct vm* vm, vaddr_t addr)
+{
+    bool lazy = false;
+
+    /* Regions are only added while the vm is created, so emulated accesses skip the lock */
+    if (list_empty(&vm->lazy.regions)) {
+        return false;
+    }
+
+    spin_lock(&vm->lazy.lock);
+    list_foreach (vm->lazy.regions, struct vm_lazy_region, lreg) {
+        if ((addr >= lreg->base) && (addr < (lreg->base + lreg->size))) {
+            size_t chunk = (addr - (lreg->base & ~(VM_LAZY_CHUNK_SIZE - 1))) / VM_LAZY_CHUNK_SIZE;
+            if (lreg->chunks[chunk].num_pages == 0) {
+                /* Mapped by another cpu, drop any translation fault the tlb might hold */
+                tlb_inv_va(&vm->as, addr);
+            } else {
+                vm_lazy_map_chunk(vm, lreg, chunk);
+            }
+            lazy = true;
+            break;
+        }
+    }
+    spin_unlock(&vm->lazy.lock);
+
+    return lazy;
+}
+
+static void vm_lazy_handler(struct timer_event* event)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    bool pending = false;
+
+    spin_lock(&vm->lazy.lock);
+    list_foreach (vm->lazy.regions, struct vm_lazy_region, lreg) {
+        size_t chunk = 0;
+        while ((chunk < lreg->num_chunks) && (lreg->chunks[chunk].num_pages == 0)) {
+            chunk++;
+        }
+        if (chunk < lreg->num_chunks) {
+            vm_lazy_map_chunk(vm, lreg, chunk);
+            break;
+        }
+    }
+    pending = vm->lazy.pending > 0;
+    spin_unlock(&vm->lazy.lock);
+
+    if (pending) {
+        timer_arm_next_period(event, timer_ns_to_ticks(VM_LAZY_PERIOD_US * 1000ULL));
+    }
+}
+
+void vm_mem_lazy_start(struct vm* vm)
+{
+    struct timer_event* event = &vm_lazy_events[cpu()->id];
+
+    if (vm->lazy.pending > 0) {
+        event->handler = vm_lazy_handler;
+        event->deferrable = true;
+        timer_arm_after(event, VM_LAZY_PERIOD_US * 1000ULL);
+    }
+}
+
+static inline size_t vm_wss_chunks(struct vm_mem_region* reg)
+{
+    return ALIGN(reg->size, STATS_WSS_CHUNK_SIZE) / STATS_WSS_CHUNK_SIZE;
+}
+
+static void vm_wss_handler(struct timer_event* event)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    struct stats_wss* wss = &stats_wss[vm->id];
+    uint16_t* heat = wss->heat;
+    uint64_t pages = 0;
+
+    memset(heat, 0, wss->chunk_num * sizeof(uint16_t));
+    for (size_t i = 0; i < vm->config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        pages += mem_access_sample(&vm->as, reg->base, NUM_PAGES(reg->size), STATS_WSS_CHUNK_SIZE,
+            heat);
+        heat += vm_wss_chunks(reg);
+    }
+    wss->pages = pages;
+    wss->samples++;
+
+    timer_arm_next_period(event, timer_ns_to_ticks(vm->config->wss.period_us * 1000ULL));
+}
+
+/**
+ * The vm's master samples its working set, as the stage 2 tlb invalidations only apply to the
+ * vm's own cpus. Every one of them must set the access flags in hardware, as clearing the flags
+ * would otherwise have the guest's accesses fault. Vms with devices behind the iommu are refused,
+ * as the iommu walks the same stage 2 tables and its dma would fault on the cleared flags.
+ */
+void vm_mem_wss_start(struct vm* vm)
+{
+    struct timer_event* event = &vm_wss_events[cpu()->id];
+    struct stats_wss* wss = &stats_wss[vm->id];
+
+    if ((vm->config->wss.period_us == 0) || (vm->config->platform.region_num == 0)) {
+        return;
+    }
+
+    if (!mem_arch_hw_access() || config_vm_dma(vm->config)) {
+        vm->wss_unsupported = true;
+    }
+    cpu_sync_barrier(&vm->sync);
+
+    if (cpu()->id != vm->master) {
+        return;
+    } else if (vm->wss_unsupported) {
+        WARNING("Working set sampling not supported for VM %d, ignored", vm->id);
+        return;
+    }
+
+    size_t chunk_num = 0;
+    for (size_t i = 0; i < vm->config->platform.region_num; i++) {
+        chunk_num += vm_wss_chunks(&vm->config->platform.regions[i]);
+    }
+
+    wss->heat = mem_alloc_page(NUM_PAGES(chunk_num * sizeof(uint16_t)), SEC_HYP_GLOBAL, false);
+    if (wss->heat == NULL) {
+        WARNING("Failed to allocate VM %d working set heatmap", vm->id);
+        return;
+    }
+    memset(wss->heat, 0, chunk_num * sizeof(uint16_t));
+    wss->pages = 0;
+    wss->samples = 0;
+    fence_sync_write();
+    wss->chunk_num = chunk_num;
+
+    event->handler = vm_wss_handler;
+    event->deferrable = true;
+    timer_arm_after(event, vm->config->wss.period_us * 1000ULL);
+}
+
+/**
+ * Migrates the vm's memory to the given colors, which must be called by its master with all of its
+ * other cpus held in the hypervisor. Each page not already of one of the colors is copied to a new
+ * page of those colors, cleaned to the point of coherency in case the guest maps it non cacheable,
+ * and remapped in place of the old one. Regions at fixed physical addresses and the image's shared
+ * range are left alone. Vms with chunks still to be lazily mapped or lending pages are refused, as
+ * their physical addresses must not change, and so are vms with devices behind the iommu, which
+ * might be doing dma to the old pages, and vms logging dirty pages or taking snapshots, as
+ * remapping would drop the pages' write protection. The hypervisor's own mappings of the vm's
+ * pages must have been dropped, see vcpu_hyp_maps_release. On failure, the vm is left with the
+ * pages migrated so far, which remain valid.
+ */
+bool vm_mem_recolor(struct vm* vm, colormap_t colors)
+{
+    if ((vm->lazy.pending > 0) || grant_vm_lends(vm->id) || config_vm_dma(vm->config) ||
+        (vm->dirty_log.num_pages > 0) || (vm->snapshot != NULL)) {
+        return false;
+    }
+
+    bool ok = true;
+    vm->as.colors = colors;
+    for (size_t i = 0; (i < vm->config->platform.region_num) && ok; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        if (reg->place_phys) {
+            continue;
+        }
+
+        for (vaddr_t ipa = reg->base; (ipa < (reg->base + reg->size)) && ok; ipa += PAGE_SIZE) {
+            paddr_t pa;
+            if (config_vm_image_shared(vm->config, ipa) || !mem_translate(&vm->as, ipa, &pa) ||
+                (pp_next_clr(pa, 0, colors) == 0)) {
+                continue;
+            }
+
+            struct ppages old_page = mem_ppages_get(pa & ~(PAGE_SIZE - 1), 1);
+            struct ppages new_page = mem_alloc_ppages_place(&vm->as.place, colors, 1, false);
+            if (new_page.num_pages < 1) {
+                ok = false;
+                break;
+            }
+            new_page.colors = 0;
+
+            vaddr_t old_va =
+                mem_alloc_map(&cpu()->as, SEC_HYP_PRIVATE, &old_page, INVALID_VA, 1, PTE_HYP_FLAGS);
+            vaddr_t new_va =
+                mem_alloc_map(&cpu()->as, SEC_HYP_PRIVATE, &new_page, INVALID_VA, 1, PTE_HYP_FLAGS);
+            if ((old_va == INVALID_VA) || (new_va == INVALID_VA)) {
+                ERROR("failed to map pages to recolor");
+            }
+            memcpy((void*)new_va, (void*)old_va, PAGE_SIZE);
+            cache_flush_range(new_va, PAGE_SIZE);
+            mem_unmap(&cpu()->as, old_va, 1, false);
+            mem_unmap(&cpu()->as, new_va, 1, false);
+
+            mem_unmap(&vm->as, ipa, 1, false);
+            mem_map(&vm->as, ipa, &new_page, 1, mem_vm_flags(reg->cacheability));
+            mem_free_ppages(&old_page);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Starts logging the writes to the vm's pages in the given range, e.g. for the vm to checkpoint its
+ * memory incrementally. It must be called from one of the vm's cpus, which the stage 2 tlb
+ * invalidations apply to. Only one range is logged at a time. Vms with chunks still to be lazily
+ * mapped are refused, as those would be mapped unprotected, and so are vms taking snapshots, which
+ * log the writes to all of their memory themselves. Vms with devices behind the iommu are refused
+ * too, as their dma would fault on the write protected stage 2 tables the iommu walks. Writes
+ * through pages lent to other vms and by the hypervisor itself are not logged.
+ */
+bool vm_mem_dirty_log_start(struct vm* vm, vaddr_t base, size_t num_pages)
+{
+    size_t ipa_bits = vm->as.pt.dscr->lvl_wdt[0];
+    uint64_t last = (uint64_t)base + ((uint64_t)num_pages * PAGE_SIZE) - 1;
+    if (((base % PAGE_SIZE) != 0) || (num_pages == 0) ||
+        (num_pages > ((1ULL << ipa_bits) / PAGE_SIZE)) || (last < base) ||
+        ((last >> ipa_bits) != 0) || (vm->lazy.pending > 0) || (vm->snapshot != NULL) ||
+        config_vm_dma(vm->config)) {
+        return false;
+    }
+
+    bool ok = false;
+    spin_lock(&vm->dirty_log.lock);
+    if (vm->dirty_log.num_pages == 0) {
+        vm->dirty_log.base = base;
+        vm->dirty_log.num_pages = num_pages;
+        /* Published before any page is protected, for the faults on them to be looked at */
+        vm->dirty_log.used = true;
+        fence_ord_write();
+        mem_dirty_log_arm(&vm->as, base, num_pages);
+        ok = true;
+    }
+    spin_unlock(&vm->dirty_log.lock);
+
+    return ok;
+}
+
+static bool vm_mem_is_ram(struct vm* vm, vaddr_t ipa, size_t num_pages)
+{
+    size_t size = num_pages * PAGE_SIZE;
+
+    for (size_t off = 0; off < size;) {
+        paddr_t pa;
+        size_t len = mem_translate_range(&vm->as, ipa + off, size - off, &pa);
+        if ((len == 0) || !platform_is_mem_range(pa, len)) {
+            return false;
+        }
+        off += len;
+    }
+
+    return true;
+}
+
+/**
+ * Writes the bitmap of the logged pages written since logging started or since the last
+ * collection, a bit per page from the range's base, to the guest buffer at bitmap_ipa, and write
+ * protects them again. Returns the number of dirty pages, or -1 if logging is off or the buffer is
+ * misaligned, too small or not in the vm's memory.
+ */
+ssize_t vm_mem_dirty_log_collect(struct vm* vm, vaddr_t bitmap_ipa, size_t size)
+{
+    ssize_t dirty = -1;
+
+    spin_lock(&vm->dirty_log.lock);
+    size_t num_pages = vm->dirty_log.num_pages;
+    size_t bytes = BITMAP_SIZE(num_pages) * sizeof(bitmap_granule_t);
+    vaddr_t page_ipa = bitmap_ipa & ~(PAGE_SIZE - 1);
+    size_t buf_pages = NUM_PAGES((bitmap_ipa - page_ipa) + bytes);
+
+    if ((num_pages > 0) && (size >= bytes) && ((bitmap_ipa % sizeof(bitmap_granule_t)) == 0) &&
+        vm_mem_is_ram(vm, page_ipa, buf_pages)) {
+        vaddr_t va = mem_map_cpy(&vm->as, &cpu()->as, page_ipa, INVALID_VA, buf_pages);
+        bitmap_t* bitmap = (bitmap_t*)(va + (bitmap_ipa - page_ipa));
+        memset(bitmap, 0, bytes);
+        dirty = (ssize_t)mem_dirty_log_collect(&vm->as, vm->dirty_log.base, num_pages, bitmap);
+        mem_unmap(&cpu()->as, va, buf_pages, false);
+    }
+    spin_unlock(&vm->dirty_log.lock);
+
+    return dirty;
+}
+
+bool vm_mem_dirty_log_stop(struct vm* vm)
+{
+    bool ok = false;
+
+    spin_lock(&vm->dirty_log.lock);
+    if (vm->dirty_log.num_pages > 0) {
+        mem_dirty_log_disarm(&vm->as, vm->dirty_log.base, vm->dirty_log.num_pages);
+        vm->dirty_log.num_pages = 0;
+        ok = true;
+    }
+    spin_unlock(&vm->dirty_log.lock);
+
+    return ok;
+}
+
+/**
+ * Once logging was ever started, a write fault might be on a page armed, disarmed or set by
+ * another cpu meanwhile, whichever range is logged now, so the entry itself is looked at.
+ */
+bool vm_mem_dirty_fault(struct vm* vm, vaddr_t addr)
+{
+    if (!vm->dirty_log.used) {
+        return false;
+    }
+
+    return mem_dirty_log_fault(&vm->as, addr);
+}
+
+struct vm_mem_snapshot_region {
+    vaddr_t base;
+    size_t num_pages;
+    vaddr_t copy;
+    bitmap_t* dirty;
+};
+
+/**
+ * A copy of each of the vm's memory regions, kept in the vm's hypervisor section, and the bitmap
+ * of the region's pages written since the copy was last brought up to date, harvested from the
+ * stage 2 dirty state.
+ */
+struct vm_mem_snapshot {
+    bool saved;
+    size_t region_num;
+    struct vm_mem_snapshot_region regions[];
+};
+
+/**
+ * Reserves the memory for the copy of the vm's regions, which must be called by its master. Vms
+ * with chunks still to be lazily mapped are refused, as those would be mapped unprotected, and so
+ * are vms with devices behind the iommu, whose dma would fault on the write protected stage 2
+ * tables the iommu walks, and go unlogged.
+ */
+struct vm_mem_snapshot* vm_mem_snapshot_init(struct vm* vm)
+{
+    size_t region_num = vm->config->platform.region_num;
+    if (vm->lazy.pending > 0) {
+        WARNING("VM %d snapshots not supported with lazily mapped regions", vm->id);
+        return NULL;
+    }
+
+    if (config_vm_dma(vm->config)) {
+        WARNING("VM %d snapshots not supported with dma devices", vm->id);
+        return NULL;
+    }
+
+    size_t size = sizeof(struct vm_mem_snapshot) +
+        (region_num * sizeof(struct vm_mem_snapshot_region));
+    struct vm_mem_snapshot* snap = vm_arena_alloc(vm, size);
+    if (snap == NULL) {
+        ERROR("failed to allocate vm %d snapshot", vm->id);
+    }
+    snap->saved = false;
+    snap->region_num = region_num;
+
+    for (size_t i = 0; i < region_num; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        struct vm_mem_snapshot_region* sreg = &snap->regions[i];
+        sreg->base = reg->base;
+        sreg->num_pages = NUM_PAGES(reg->size);
+        sreg->copy = (vaddr_t)mem_alloc_page(sreg->num_pages, SEC_HYP_VM, false);
+        sreg->dirty = vm_arena_alloc(vm, BITMAP_SIZE(sreg->num_pages) * sizeof(bitmap_t));
+        if ((sreg->copy == (vaddr_t)NULL) || (sreg->dirty == NULL)) {
+            WARNING("Not enough memory for VM %d snapshots", vm->id);
+            return NULL;
+        }
+    }
+
+    return snap;
+}
+
+/* The guest might map its pages non cacheable, so they are cleaned to the point of coherency */
+static void vm_mem_snapshot_copy(struct vm_mem_snapshot_region* sreg, vaddr_t guest_va,
+    bool to_guest)
+{
+    for (size_t i = 0; i < sreg->num_pages; i++) {
+        if (!bitmap_get(sreg->dirty, i)) {
+            continue;
+        }
+
+        vaddr_t guest = guest_va + (i * PAGE_SIZE);
+        vaddr_t copy = sreg->copy + (i * PAGE_SIZE);
+        if (to_guest) {
+            memcpy((void*)guest, (void*)copy, PAGE_SIZE);
+            cache_flush_range(guest, PAGE_SIZE);
+        } else {
+            cache_flush_range(guest, PAGE_SIZE);
+            memcpy((void*)copy, (void*)guest, PAGE_SIZE);
+        }
+    }
+}
+
+/**
+ * Brings the copy of the vm's memory up to date, which must be called by its master with all of
+ * its other cpus held in the hypervisor. The first save copies the regions whole and starts
+ * logging their writes, so later saves and restores only copy the pages written since. Writes by
+ * the hypervisor itself and through pages lent to other vms are not logged, so vms lending pages
+ * are refused, as are vms with dma devices, see vm_mem_snapshot_init.
+ */
+bool vm_mem_snapshot_save(struct vm* vm, struct vm_mem_snapshot* snap)
+{
+    if (grant_vm_lends(vm->id)) {
+        return false;
+    }
+
+    if (!snap->saved) {
+        /* Published before any page is protected, for the faults on them to be looked at */
+        vm->dirty_log.used = true;
+        fence_ord_write();
+    }
+
+    for (size_t i = 0; i < snap->region_num; i++) {
+        struct vm_mem_snapshot_region* sreg = &snap->regions[i];
+        size_t bytes = BITMAP_SIZE(sreg->num_pages) * sizeof(bitmap_t);
+        vaddr_t va = mem_map_cpy(&vm->as, &cpu()->as, sreg->base, INVALID_VA, sreg->num_pages);
+
+        if (!snap->saved) {
+            cache_flush_range(va, sreg->num_pages * PAGE_SIZE);
+            memcpy((void*)sreg->copy, (void*)va, sreg->num_pages * PAGE_SIZE);
+            mem_dirty_log_arm(&vm->as, sreg->base, sreg->num_pages);
+        } else {
+            memset(sreg->dirty, 0, bytes);
+            mem_dirty_log_collect(&vm->as, sreg->base, sreg->num_pages, sreg->dirty);
+            vm_mem_snapshot_copy(sreg, va, false);
+        }
+
+        mem_unmap(&cpu()->as, va, sreg->num_pages, false);
+    }
+    snap->saved = true;
+
+    return true;
+}
+
+/**
+ * Rolls the vm's memory back to its last save, under the same conditions, by copying back the
+ * pages written since.
+ */
+bool vm_mem_snapshot_restore(struct vm* vm, struct vm_mem_snapshot* snap)
+{
+    if (!snap->saved || grant_vm_lends(vm->id)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < snap->region_num; i++) {
+        struct vm_mem_snapshot_region* sreg = &snap->regions[i];
+        size_t bytes = BITMAP_SIZE(sreg->num_pages) * sizeof(bitmap_t);
+        memset(sreg->dirty, 0, bytes);
+        if (mem_dirty_log_collect(&vm->as, sreg->base, sreg->num_pages, sreg->dirty) == 0) {
+            continue;
+        }
+
+        vaddr_t va = mem_map_cpy(&vm->as, &cpu()->as, sreg->base, INVALID_VA, sreg->num_pages);
+        vm_mem_snapshot_copy(sreg, va, true);
+        mem_unmap(&cpu()->as, va, sreg->num_pages, false);
+    }
+
+    return true;
 }
@@ -6,7 +6,7 @@
 #include <bao.h>
 #include <config.h>
 
-void config_mem_prot_init(paddr_t load_addr)
+__init void config_mem_prot_init(paddr_t load_addr)
 {
     for (size_t i = 0; i < config.vmlist_size; i++) {
         for (size_t j = 0; j < config.vmlist[i].platform.region_num; j++) {
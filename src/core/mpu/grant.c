@@ -0,0 +1,39 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <grant.h>
+#include <hypercall.h>
+
+unsigned long grant_lend_hypercall(unsigned long ipa, unsigned long num_pages,
+    unsigned long target_vm)
+{
+    return -HC_E_FAILURE;
+}
+
+unsigned long grant_map_hypercall(unsigned long grant_id, unsigned long ipa, unsigned long arg2)
+{
+    return -HC_E_FAILURE;
+}
+
+unsigned long grant_unmap_hypercall(unsigned long grant_id, unsigned long arg1, unsigned long arg2)
+{
+    return -HC_E_FAILURE;
+}
+
+unsigned long grant_revoke_hypercall(unsigned long grant_id, unsigned long arg1,
+    unsigned long arg2)
+{
+    return -HC_E_FAILURE;
+}
+
+bool grant_vm_lends(vmid_t vm_id)
+{
+    return false;
+}
+
+void grant_vm_release(struct vm* vm)
+{
+    (void)vm;
+}
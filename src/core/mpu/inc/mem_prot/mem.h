@@ -10,6 +10,7 @@
 #include <bitmap.h>
 #include <arch/mem.h>
 #include <arch/spinlock.h>
+#include <cpumask.h>
 
 #define HYP_ASID         0
 #define VMPU_NUM_ENTRIES 64
@@ -21,33 +22,58 @@ struct mp_region {
     as_sec_t as_sec;
 };
 
+struct mem_batch;
+
 struct addr_space {
     asid_t id;
     enum AS_TYPE type;
     colormap_t colors;
+    struct mem_place place;
     struct mpe {
         enum { MPE_S_FREE, MPE_S_INVALID, MPE_S_VALID } state;
         struct mp_region region;
+        /* Entries set up at boot mirror locked mpu regions and are never merged */
+        bool locked;
     } vmpu[VMPU_NUM_ENTRIES];
     spinlock_t lock;
+    struct {
+        size_t depth;
+        uint64_t generation;
+        cpumask_t cpus;
+        struct mem_batch* pending;
+    } batch;
 };
 
 void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, colormap_t colors);
 
+static inline void mem_map_report(struct addr_space* as, vaddr_t va, size_t num_pages)
+{
+    /* MPU regions are mapped as a whole, there is no page size breakdown to report */
+}
+
+void mem_batch_begin(struct addr_space* as);
+void mem_batch_end(struct addr_space* as);
+
 static inline bool mem_regions_overlap(struct mp_region* reg1, struct mp_region* reg2)
 {
     return range_in_range(reg1->base, reg1->size, reg2->base, reg2->size);
 }
 
+bool mem_handle_fault(struct addr_space* as, vaddr_t addr);
+
 /**
  * This functions must be defined for the physical MPU. The abstraction provided by the physical
  * MPU layer is minimal. Besides initialization:
  * i) It must provide the view of a separate physical MPU for each privilege;
  * ii) It must allow the mapping and unmapping of regions on these MPUs,returning a binary return
- * success value.
+ * success value;
+ * iii) It must tell if an address is mapped for a privilege and be able to evict the oldest
+ * unlocked entry only accessible by a given privilege, to make room when it runs out of entries.
  */
 void mpu_init();
 bool mpu_map(priv_t priv, struct mp_region* mem);
 bool mpu_unmap(priv_t priv, struct mp_region* mem);
+bool mpu_mapped(priv_t priv, vaddr_t addr);
+bool mpu_evict(priv_t priv);
 
 #endif /* __MEM_PROT_H__ */
@@ -5,6 +5,7 @@
 
 #include <io.h>
 #include <vm.h>
+#include <hypercall.h>
 
 void io_init()
 {
@@ -20,3 +21,18 @@ bool io_vm_add_device(struct vm* vm, deviceid_t dev_id)
 {
     return true;
 }
+
+void io_vm_commit(struct vm* vm)
+{
+    return;
+}
+
+void io_fault_report(deviceid_t dev_id, unsigned long cause, unsigned long addr)
+{
+    return;
+}
+
+unsigned long io_fault_hypercall(unsigned long dev_id, unsigned long nth, unsigned long arg2)
+{
+    return -HC_E_FAILURE;
+}
@@ -11,25 +11,64 @@
 #include <platform_defs.h>
 #include <objpool.h>
 #include <config.h>
+#include <platform.h>
 
-struct shared_region {
+/**
+ * Region changes are broadcast to the cpus sharing the section in batches. A single batch node is
+ * shared by all its target cpus, each applying the whole list of changes in one pass, and freed by
+ * the last of them. Batches of a vm's address space carry a generation number, as they might be
+ * sent by different cpus and thus arrive through different message rings, and are only applied in
+ * generation order.
+ */
+#ifndef MEM_BATCH_SIZE
+#define MEM_BATCH_SIZE (16)
+#endif
+
+#ifndef MEM_BATCH_POOL_SIZE
+#define MEM_BATCH_POOL_SIZE (16)
+#endif
+
+#ifndef MEM_BATCH_DEFERRED_NUM
+#define MEM_BATCH_DEFERRED_NUM (4)
+#endif
+
+struct mem_batch {
     enum AS_TYPE as_type;
     asid_t asid;
-    struct mp_region region;
-    cpumap_t sharing_cpus;
+    uint64_t generation;
+    spinlock_t lock;
+    cpumask_t pending_cpus;
+    size_t num;
+    struct {
+        uint32_t op;
+        struct mp_region region;
+    } ops[MEM_BATCH_SIZE];
 };
 
-void mem_handle_broadcast_region(uint32_t event, uint64_t data);
+void mem_handle_broadcast_batch(uint32_t event, uint64_t data);
 bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast);
 bool mem_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool broadcast);
 
 enum { MEM_INSERT_REGION, MEM_REMOVE_REGION };
 
-#define SHARED_REGION_POOL_SIZE_DEFAULT (128)
-#ifndef SHARED_REGION_POOL_SIZE
-#define SHARED_REGION_POOL_SIZE SHARED_REGION_POOL_SIZE_DEFAULT
-#endif
-OBJPOOL_ALLOC(shared_region_pool, struct shared_region, SHARED_REGION_POOL_SIZE);
+OBJPOOL_ALLOC(mem_batch_pool, struct mem_batch, MEM_BATCH_POOL_SIZE);
+
+static struct {
+    uint64_t vm_generation;
+    struct mem_batch* deferred[MEM_BATCH_DEFERRED_NUM];
+} mem_batch_cpus[PLAT_CPU_NUM];
+
+/**
+ * Guest regions only live in the mpu while there is room for them. When the mpu runs out of
+ * entries, the oldest entries holding only guest regions are evicted until the new region fits,
+ * even when mapping hypervisor regions. Evicted regions stay in the vm's vmpu and are loaded back
+ * when the guest faults on them. A vm may thus have up to VMPU_NUM_ENTRIES regions, regardless of
+ * the number of mpu entries, at the cost of these faults.
+ */
+static struct {
+    uint64_t faults;
+    uint64_t evictions;
+} mem_swap_stats[PLAT_CPU_NUM];
 
 static inline struct mpe* mem_vmpu_get_entry(struct addr_space* as, mpid_t mpid)
 {
@@ -59,6 +98,7 @@ void mem_vmpu_clear_entry(struct addr_space* as, mpid_t mpid)
     mpe->region.mem_flags = PTE_INVALID;
     mpe->region.as_sec = SEC_UNKNOWN;
     mpe->state = MPE_S_INVALID;
+    mpe->locked = false;
 }
 
 void mem_vmpu_free_entry(struct addr_space* as, mpid_t mpid)
@@ -152,6 +192,7 @@ static void as_init_boot_regions()
         .as_sec = SEC_HYP_IMAGE,
     };
     mem_vmpu_set_entry(&cpu()->as, mpid, &mpr);
+    mem_vmpu_get_entry(&cpu()->as, mpid)->locked = true;
     mpid++;
 
     if (separate_noload_region) {
@@ -162,6 +203,7 @@ static void as_init_boot_regions()
             .as_sec = SEC_HYP_IMAGE,
         };
         mem_vmpu_set_entry(&cpu()->as, mpid, &mpr);
+        mem_vmpu_get_entry(&cpu()->as, mpid)->locked = true;
         mpid++;
     }
 
@@ -172,6 +214,7 @@ static void as_init_boot_regions()
         .as_sec = SEC_HYP_PRIVATE,
     };
     mem_vmpu_set_entry(&cpu()->as, mpid, &mpr);
+    mem_vmpu_get_entry(&cpu()->as, mpid)->locked = true;
     mpid++;
 }
 
@@ -179,6 +222,7 @@ void mem_prot_init()
 {
     mpu_init();
     as_init(&cpu()->as, AS_HYP, HYP_ASID, 0);
+    cpu()->as.place = config.hyp.mem_place;
     as_init_boot_regions();
 }
 
@@ -192,7 +236,12 @@ void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, colormap_t col
 {
     as->type = type;
     as->colors = 0;
+    as->place = (struct mem_place){ .policy = MEM_PLACE_ANY };
     as->id = id;
+    as->batch.depth = 0;
+    as->batch.generation = 0;
+    as->batch.cpus = CPUMASK_EMPTY;
+    as->batch.pending = NULL;
     as_arch_init(as);
 
     for (size_t i = 0; i < VMPU_NUM_ENTRIES; i++) {
@@ -200,30 +249,50 @@ void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, colormap_t col
     }
 }
 
-static void mem_free_ppages(struct ppages* ppages)
+void mem_free_ppages(struct ppages* ppages)
 {
     list_foreach (page_pool_list, struct page_pool, pool) {
-        spin_lock(&pool->lock);
+        mcs_lock(&pool->lock);
         if (in_range(ppages->base, pool->base, pool->size * PAGE_SIZE)) {
             size_t index = (ppages->base - pool->base) / PAGE_SIZE;
             bitmap_clear_consecutive(pool->bitmap, index, ppages->num_pages);
+            pp_buddy_update(pool, index, ppages->num_pages);
         }
-        spin_unlock(&pool->lock);
+        mcs_unlock(&pool->lock);
+    }
+}
+
+/**
+ * The image is covered by the boot regions as a whole, which are not split to leave the boot only
+ * code and data out, so nothing is reclaimed.
+ */
+void mem_reclaim_init(void) { }
+
+/**
+ * The image runs at its physical address, so the hot text can not be remapped to the fast memory
+ * and is left in place.
+ */
+void mem_fast_place(void)
+{
+    if (cpu_is_master() && (platform.fast_mem.size > 0)) {
+        WARNING("Fast memory placement not supported with an mpu");
     }
 }
 
 void mem_msg_handler(uint32_t event, uint64_t data)
 {
-    mem_handle_broadcast_region(event, data);
+    mem_handle_broadcast_batch(event, data);
 }
 CPU_MSG_HANDLER(mem_msg_handler, MEM_PROT_SYNC);
 
-static cpumap_t mem_section_shared_cpus(struct addr_space* as, as_sec_t section)
+static cpumask_t mem_section_shared_cpus(struct addr_space* as, as_sec_t section)
 {
-    cpumap_t cpus = 0;
+    cpumask_t cpus = CPUMASK_EMPTY;
     if (as->type == AS_HYP) {
         if ((section == SEC_HYP_GLOBAL) || (section == SEC_HYP_IMAGE)) {
-            cpus = BIT_MASK(0, PLAT_CPU_NUM);
+            for (cpuid_t i = 0; i < PLAT_CPU_NUM; i++) {
+                cpumask_set(&cpus, i);
+            }
         } else if (section == SEC_HYP_VM) {
             /**
              * If we don't have a valid vcpu at this point, it means we are creating this region
@@ -241,31 +310,118 @@ static cpumap_t mem_section_shared_cpus(struct addr_space* as, as_sec_t section)
     return cpus;
 }
 
+static void mem_batch_flush(struct addr_space* as)
+{
+    struct mem_batch* batch = as->batch.pending;
+
+    if (batch == NULL) {
+        return;
+    }
+
+    as->batch.pending = NULL;
+    batch->generation = ++as->batch.generation;
+    batch->pending_cpus = as->batch.cpus;
+    if (as->type == AS_VM) {
+        /* The sender already applied the changes as it made them */
+        mem_batch_cpus[cpu()->id].vm_generation = batch->generation;
+    }
+
+    struct cpu_msg msg = { MEM_PROT_SYNC, 0, (uintptr_t)batch };
+    cpu_send_msg_mask(&batch->pending_cpus, &msg);
+}
+
 void mem_region_broadcast(struct addr_space* as, struct mp_region* mpr, uint32_t op)
 {
-    cpumap_t shared_cpus = mem_section_shared_cpus(as, mpr->as_sec);
+    cpumask_t shared_cpus = mem_section_shared_cpus(as, mpr->as_sec);
+    cpumask_clear(&shared_cpus, cpu()->id);
 
-    if (shared_cpus == 0) {
+    if (cpumask_empty(&shared_cpus)) {
         return;
     }
 
-    struct shared_region shared_region = {
-        .as_type = as->type,
-        .asid = as->id,
-        .region = *mpr,
-    };
+    struct mem_batch* batch = as->batch.pending;
+    if ((batch != NULL) &&
+        (!cpumask_equal(&as->batch.cpus, &shared_cpus) || (batch->num >= MEM_BATCH_SIZE))) {
+        mem_batch_flush(as);
+        batch = NULL;
+    }
 
-    for (cpuid_t cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
-        if ((cpu()->id != cpuid) && bit_get(shared_cpus, cpuid)) {
-            struct shared_region* node = objpool_alloc(&shared_region_pool);
-            if (node == NULL) {
-                ERROR("Failed allocating shared region node");
-            }
-            *node = shared_region;
-            struct cpu_msg msg = { MEM_PROT_SYNC, op, (uintptr_t)node };
-            cpu_send_msg(cpuid, &msg);
+    if (batch == NULL) {
+        batch = objpool_alloc(&mem_batch_pool);
+        if (batch == NULL) {
+            ERROR("Failed allocating mem broadcast batch");
+        }
+        batch->as_type = as->type;
+        batch->asid = as->id;
+        batch->lock = SPINLOCK_INITVAL;
+        batch->num = 0;
+        as->batch.cpus = shared_cpus;
+        as->batch.pending = batch;
+    }
+
+    batch->ops[batch->num].op = op;
+    batch->ops[batch->num].region = *mpr;
+    batch->num++;
+
+    if (as->batch.depth == 0) {
+        mem_batch_flush(as);
+    }
+}
+
+void mem_batch_begin(struct addr_space* as)
+{
+    spin_lock(&as->lock);
+    as->batch.depth++;
+    spin_unlock(&as->lock);
+}
+
+void mem_batch_end(struct addr_space* as)
+{
+    spin_lock(&as->lock);
+
+    if (as->batch.depth == 0) {
+        WARNING("mem batch end without matching begin");
+    } else if (--as->batch.depth == 0) {
+        mem_batch_flush(as);
+    }
+
+    spin_unlock(&as->lock);
+}
+
+static bool mem_mpu_map(struct addr_space* as, struct mp_region* mpr)
+{
+    priv_t priv = as_priv(as);
+
+    while (!mpu_map(priv, mpr)) {
+        /* Drop whatever part of the region was mapped before the mpu ran out of entries */
+        mpu_unmap(priv, mpr);
+        if (!mpu_evict(PRIV_VM)) {
+            return false;
         }
+        mem_swap_stats[cpu()->id].evictions++;
+    }
+
+    return true;
+}
+
+bool mem_handle_fault(struct addr_space* as, vaddr_t addr)
+{
+    bool loaded = false;
+
+    spin_lock(&as->lock);
+
+    mpid_t mpid = mem_vmpu_get_entry_by_addr(as, addr);
+    if ((mpid != INVALID_MPID) && !mpu_mapped(as_priv(as), addr)) {
+        struct mp_region mpr = mem_vmpu_get_entry(as, mpid)->region;
+        mem_swap_stats[cpu()->id].faults++;
+        /* Parts of the region might still be mapped if it was only partially evicted */
+        mpu_unmap(as_priv(as), &mpr);
+        loaded = mem_mpu_map(as, &mpr);
     }
+
+    spin_unlock(&as->lock);
+
+    return loaded;
 }
 
 bool mem_vmpu_insert_region(struct addr_space* as, mpid_t mpid, struct mp_region* mpr,
@@ -275,7 +431,7 @@ bool mem_vmpu_insert_region(struct addr_space* as, mpid_t mpid, struct mp_region
         return false;
     }
 
-    if (mpu_map(as_priv(as), mpr)) {
+    if (mem_mpu_map(as, mpr)) {
         mem_vmpu_set_entry(as, mpid, mpr);
         if (broadcast) {
             mem_region_broadcast(as, mpr, MEM_INSERT_REGION);
@@ -309,7 +465,7 @@ void mem_handle_broadcast_insert(struct addr_space* as, struct mp_region* mpr)
     if (as->type == AS_HYP) {
         mem_map(&cpu()->as, mpr, false);
     } else {
-        mpu_map(as_priv(as), mpr);
+        mem_mpu_map(as, mpr);
     }
 }
 
@@ -322,34 +478,95 @@ void mem_handle_broadcast_remove(struct addr_space* as, struct mp_region* mpr)
     }
 }
 
-void mem_handle_broadcast_region(uint32_t event, uint64_t data)
+static void mem_batch_apply(struct mem_batch* batch)
 {
-    struct shared_region* sh_reg = (struct shared_region*)(uintptr_t)data;
-
-    if (sh_reg != NULL) {
-        struct addr_space* as;
-        if (sh_reg->as_type == AS_HYP) {
-            as = &cpu()->as;
-        } else {
-            struct addr_space* vm_as = &cpu()->vcpu->vm->as;
-            if (vm_as->id != sh_reg->asid) {
-                ERROR("Received shared region for unkown vm address space.");
-            }
-            as = vm_as;
+    struct addr_space* as;
+    if (batch->as_type == AS_HYP) {
+        as = &cpu()->as;
+    } else {
+        struct addr_space* vm_as = &cpu()->vcpu->vm->as;
+        if (vm_as->id != batch->asid) {
+            ERROR("Received shared region for unkown vm address space.");
         }
+        as = vm_as;
+        mem_batch_cpus[cpu()->id].vm_generation = batch->generation;
+    }
 
-        switch (event) {
+    for (size_t i = 0; i < batch->num; i++) {
+        switch (batch->ops[i].op) {
             case MEM_INSERT_REGION:
-                mem_handle_broadcast_insert(as, &sh_reg->region);
+                mem_handle_broadcast_insert(as, &batch->ops[i].region);
                 break;
             case MEM_REMOVE_REGION:
-                mem_handle_broadcast_remove(as, &sh_reg->region);
+                mem_handle_broadcast_remove(as, &batch->ops[i].region);
                 break;
             default:
                 ERROR("unknown mem broadcast msg");
         }
+    }
+
+    spin_lock(&batch->lock);
+    cpumask_clear(&batch->pending_cpus, cpu()->id);
+    bool last = cpumask_empty(&batch->pending_cpus);
+    spin_unlock(&batch->lock);
 
-        objpool_free(&shared_region_pool, sh_reg);
+    if (last) {
+        objpool_free(&mem_batch_pool, batch);
+    }
+}
+
+static struct mem_batch* mem_batch_take_deferred(uint64_t generation)
+{
+    struct mem_batch** deferred = mem_batch_cpus[cpu()->id].deferred;
+
+    for (size_t i = 0; i < MEM_BATCH_DEFERRED_NUM; i++) {
+        struct mem_batch* batch = deferred[i];
+        if ((batch != NULL) && (batch->generation == generation)) {
+            deferred[i] = NULL;
+            return batch;
+        }
+    }
+
+    return NULL;
+}
+
+static void mem_batch_defer(struct mem_batch* batch)
+{
+    struct mem_batch** deferred = mem_batch_cpus[cpu()->id].deferred;
+
+    for (size_t i = 0; i < MEM_BATCH_DEFERRED_NUM; i++) {
+        if (deferred[i] == NULL) {
+            deferred[i] = batch;
+            return;
+        }
+    }
+
+    ERROR("Too many out of order mem broadcast batches");
+}
+
+void mem_handle_broadcast_batch(uint32_t event, uint64_t data)
+{
+    struct mem_batch* batch = (struct mem_batch*)(uintptr_t)data;
+
+    if (batch == NULL) {
+        return;
+    }
+
+    if (batch->as_type == AS_HYP) {
+        /* A cpu's own changes to the hypervisor address space arrive in order through its ring */
+        mem_batch_apply(batch);
+        return;
+    }
+
+    uint64_t* vm_generation = &mem_batch_cpus[cpu()->id].vm_generation;
+    if (batch->generation != (*vm_generation + 1)) {
+        mem_batch_defer(batch);
+        return;
+    }
+
+    while (batch != NULL) {
+        mem_batch_apply(batch);
+        batch = mem_batch_take_deferred(*vm_generation + 1);
     }
 }
 
@@ -373,6 +590,68 @@ mpid_t mem_vmpu_find_overlapping_region(struct addr_space* as, struct mp_region*
     return mpid;
 }
 
+static inline bool mem_vmpu_entry_mergeable(struct mpe* mpe, struct mp_region* mpr)
+{
+    vaddr_t limit = mpe->region.base + mpe->region.size;
+    bool adjacent = (limit == mpr->base) || ((mpr->base + mpr->size) == mpe->region.base);
+
+    return (mpe->state == MPE_S_VALID) && !mpe->locked && adjacent &&
+        (mpe->region.as_sec == mpr->as_sec) &&
+        mem_flags_equal(mpe->region.mem_flags, mpr->mem_flags);
+}
+
+static mpid_t mem_vmpu_find_mergeable_region(struct addr_space* as, struct mp_region* mpr,
+    mpid_t skip)
+{
+    mpid_t mpid = INVALID_MPID;
+
+    for (mpid_t i = 0; i < VMPU_NUM_ENTRIES; i++) {
+        if ((i != skip) && mem_vmpu_entry_mergeable(mem_vmpu_get_entry(as, i), mpr)) {
+            mpid = i;
+            break;
+        }
+    }
+
+    return mpid;
+}
+
+/**
+ * Instead of using up a new vmpu entry, grow an adjacent entry with the same flags and section to
+ * also cover the new region. Only the new region is mapped in the mpu and broadcast, the physical
+ * mpu layer merges it on its own. If the grown entry now also touches another mergeable entry,
+ * both are coalesced into a single one.
+ */
+static bool mem_vmpu_merge_region(struct addr_space* as, mpid_t mpid, struct mp_region* mpr,
+    bool broadcast)
+{
+    struct mpe* mpe = mem_vmpu_get_entry(as, mpid);
+
+    if (!mem_mpu_map(as, mpr)) {
+        return false;
+    }
+
+    if (broadcast) {
+        mem_region_broadcast(as, mpr, MEM_INSERT_REGION);
+    }
+
+    if (mpr->base < mpe->region.base) {
+        mpe->region.base = mpr->base;
+    }
+    mpe->region.size += mpr->size;
+
+    mpid_t other_mpid = mem_vmpu_find_mergeable_region(as, &mpe->region, mpid);
+    if (other_mpid != INVALID_MPID) {
+        struct mpe* other = mem_vmpu_get_entry(as, other_mpid);
+        if (other->region.base < mpe->region.base) {
+            mpe->region.base = other->region.base;
+        }
+        mpe->region.size += other->region.size;
+        mem_vmpu_free_entry(as, other_mpid);
+    }
+
+    return true;
+}
+
 bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
 {
     bool mapped = false;
@@ -389,10 +668,14 @@ bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
     spin_lock(&as->lock);
 
     if (mem_vmpu_find_overlapping_region(as, mpr) == INVALID_MPID) {
-        // TODO: check if it possible to merge with another region
-        mpid_t mpid = mem_vmpu_allocate_entry(as);
+        mpid_t mpid = mem_vmpu_find_mergeable_region(as, mpr, INVALID_MPID);
         if (mpid != INVALID_MPID) {
-            mapped = mem_vmpu_insert_region(as, mpid, mpr, broadcast);
+            mapped = mem_vmpu_merge_region(as, mpid, mpr, broadcast);
+        } else {
+            mpid = mem_vmpu_allocate_entry(as);
+            if (mpid != INVALID_MPID) {
+                mapped = mem_vmpu_insert_region(as, mpid, mpr, broadcast);
+            }
         }
     }
 
@@ -478,13 +761,23 @@ vaddr_t mem_map_cpy(struct addr_space* ass, struct addr_space* asd, vaddr_t vas,
         // identify mappings are supported, the source va must equal the destination va, or be an
         // invalid va. This still covers the most useful uses cases.
 
+        // Source entries may have been merged with adjacent ones, so only the requested range of
+        // the entry is copied.
         spin_lock(&ass->lock);
         mpid_t reg_num_src = mem_vmpu_get_entry_by_addr(ass, vas);
         mpe = mem_vmpu_get_entry(ass, reg_num_src);
-        mpr = mpe->region;
+        mpr = (mpe != NULL) ? mpe->region : (struct mp_region){ .size = 0 };
         spin_unlock(&ass->lock);
 
-        if (mem_map(asd, &mpr, true)) {
+        size_t size = num_pages * PAGE_SIZE;
+        if ((mpr.size > 0) && range_in_range(vas, size, mpr.base, mpr.size)) {
+            mpr.base = vas;
+            mpr.size = size;
+        } else {
+            mpr.size = 0;
+        }
+
+        if ((mpr.size > 0) && mem_map(asd, &mpr, true)) {
             va_res = vas;
         } else {
             INFO("failed mem map on mem map cpy");
@@ -506,6 +799,37 @@ bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
     }
 }
 
+bool mem_translate_writable(struct addr_space* as, vaddr_t va, paddr_t* pa)
+{
+    mpid_t mpid = mem_vmpu_get_entry_by_addr(as, va);
+    if ((mpid == INVALID_MPID) ||
+        !mem_flags_writable(mem_vmpu_get_entry(as, mpid)->region.mem_flags)) {
+        return false;
+    }
+    *pa = va;
+    return true;
+}
+
+/* Regions are identity mapped, so a run goes on through adjacent regions */
+size_t mem_translate_range(struct addr_space* as, vaddr_t va, size_t size, paddr_t* pa)
+{
+    size_t run = 0;
+
+    while (run < size) {
+        mpid_t mpid = mem_vmpu_get_entry_by_addr(as, va + run);
+        if (mpid == INVALID_MPID) {
+            break;
+        }
+        struct mp_region* mpr = &mem_vmpu_get_entry(as, mpid)->region;
+        run = (mpr->base + mpr->size) - va;
+    }
+
+    if ((run > 0) && (pa != NULL)) {
+        *pa = va;
+    }
+    return min(run, size);
+}
+
 vaddr_t mem_alloc_map(struct addr_space* as, as_sec_t section, struct ppages* ppages, vaddr_t at,
     size_t num_pages, mem_flags_t flags)
 {
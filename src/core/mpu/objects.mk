@@ -5,4 +5,5 @@ core-objs-y+=mpu/mem.o
 core-objs-y+=mpu/vmm.o
 core-objs-y+=mpu/vm.o
 core-objs-y+=mpu/io.o
+core-objs-y+=mpu/grant.o
 core-objs-y+=mpu/config.o
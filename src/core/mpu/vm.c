@@ -9,3 +9,60 @@ void vm_mem_prot_init(struct vm* vm, const struct vm_config* config)
 {
     as_init(&vm->as, AS_VM, vm->id, 0);
 }
+
+bool vm_map_mem_region_lazy(struct vm* vm, struct vm_mem_region* reg)
+{
+    /* Guest regions are loaded into the mpu on demand anyway, so they are always mapped up front */
+    WARNING("lazy mapping of vm regions not supported");
+    return false;
+}
+
+bool vm_mem_populate(struct vm* vm, vaddr_t addr)
+{
+    return false;
+}
+
+void vm_mem_lazy_start(struct vm* vm) { }
+
+void vm_mem_wss_start(struct vm* vm) { }
+
+bool vm_mem_recolor(struct vm* vm, colormap_t colors)
+{
+    return false;
+}
+
+bool vm_mem_dirty_log_start(struct vm* vm, vaddr_t base, size_t num_pages)
+{
+    return false;
+}
+
+ssize_t vm_mem_dirty_log_collect(struct vm* vm, vaddr_t bitmap_ipa, size_t size)
+{
+    return -1;
+}
+
+bool vm_mem_dirty_log_stop(struct vm* vm)
+{
+    return false;
+}
+
+bool vm_mem_dirty_fault(struct vm* vm, vaddr_t addr)
+{
+    return false;
+}
+
+struct vm_mem_snapshot* vm_mem_snapshot_init(struct vm* vm)
+{
+    WARNING("vm snapshots not supported");
+    return NULL;
+}
+
+bool vm_mem_snapshot_save(struct vm* vm, struct vm_mem_snapshot* snap)
+{
+    return false;
+}
+
+bool vm_mem_snapshot_restore(struct vm* vm, struct vm_mem_snapshot* snap)
+{
+    return false;
+}
@@ -3,13 +3,43 @@
 
 core-objs-y+=init.o
 core-objs-y+=mem.o
+core-objs-y+=page_pool.o
 core-objs-y+=cache.o
 core-objs-y+=interrupts.o
 core-objs-y+=cpu.o
 core-objs-y+=vmm.o
 core-objs-y+=vm.o
+core-objs-y+=vm_arena.o
 core-objs-y+=config.o
 core-objs-y+=console.o
 core-objs-y+=ipc.o
+core-objs-y+=remio.o
+core-objs-y+=vuart.o
 core-objs-y+=objpool.o
+core-objs-y+=slab.o
+core-objs-y+=spinlock.o
 core-objs-y+=hypercall.o
+core-objs-y+=timer.o
+core-objs-y+=membw.o
+core-objs-y+=irq_limit.o
+core-objs-y+=recolor.o
+core-objs-y+=stats.o
+core-objs-y+=dirty_log.o
+core-objs-y+=snapshot.o
+core-objs-y+=vm_info.o
+core-objs-y+=posted.o
+core-objs-y+=defer.o
+core-objs-y+=live_update.o
+core-objs-y+=vm_qos.o
+ifeq ($(TRACE),y)
+core-objs-y+=trace.o
+endif
+ifeq ($(PROF),y)
+core-objs-y+=prof.o
+endif
+ifeq ($(LOCK_PROF),y)
+core-objs-y+=lock_prof.o
+endif
+ifeq ($(BOOT_TIMING),y)
+core-objs-y+=boot_timing.o
+endif
@@ -10,18 +10,28 @@ void objpool_init(struct objpool* objpool)
 {
     memset(objpool->pool, 0, objpool->objsize * objpool->num);
     memset(objpool->bitmap, 0, BITMAP_SIZE(objpool->num));
+    objpool->count = 0;
+    objpool->watermark = 0;
+    objpool->free_list = NULL;
 }
 
 void* objpool_alloc(struct objpool* objpool)
 {
     void* obj = NULL;
-    spin_lock(&objpool->lock);
-    ssize_t n = bitmap_find_nth(objpool->bitmap, objpool->num, 1, 0, false);
-    if (n >= 0) {
+    mcs_lock(&objpool->lock);
+    if (objpool->free_list != NULL) {
+        obj = objpool->free_list;
+        objpool->free_list = *(void**)obj;
+    } else if (objpool->watermark < objpool->num) {
+        obj = objpool->pool + (objpool->objsize * objpool->watermark);
+        objpool->watermark++;
+    }
+    if (obj != NULL) {
+        size_t n = ((vaddr_t)obj - (vaddr_t)objpool->pool) / objpool->objsize;
         bitmap_set(objpool->bitmap, n);
-        obj = objpool->pool + (objpool->objsize * n);
+        objpool->count++;
     }
-    spin_unlock(&objpool->lock);
+    mcs_unlock(&objpool->lock);
     return obj;
 }
 
@@ -33,9 +43,16 @@ void objpool_free(struct objpool* objpool, void* obj)
     bool aligned = IS_ALIGNED(obj_addr - pool_addr, objpool->objsize);
     if (in_pool && aligned) {
         size_t n = (obj_addr - pool_addr) / objpool->objsize;
-        spin_lock(&objpool->lock);
-        bitmap_clear(objpool->bitmap, n);
-        spin_unlock(&objpool->lock);
+        mcs_lock(&objpool->lock);
+        if (bitmap_get(objpool->bitmap, n)) {
+            bitmap_clear(objpool->bitmap, n);
+            *(void**)obj = objpool->free_list;
+            objpool->free_list = obj;
+            objpool->count--;
+        } else {
+            WARNING("trying to free object which is not allocated");
+        }
+        mcs_unlock(&objpool->lock);
     } else {
         WARNING("leaked while trying to free stray object");
     }
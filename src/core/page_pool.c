@@ -0,0 +1,248 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <mem.h>
+
+#define PP_BUDDY_LEAF_PAGES (BITMAP_GRANULE_LEN)
+
+static size_t pp_buddy_num_leaves(paddr_t base, size_t size, size_t* off)
+{
+    size_t base_leaf = base / (PP_BUDDY_LEAF_PAGES * PAGE_SIZE);
+    size_t used_leaves = size / PP_BUDDY_LEAF_PAGES;
+    size_t leaves = 1;
+
+    /**
+     * Leaves must match bitmap granules, so the index is only available for pools whose base is
+     * aligned to a granule worth of pages.
+     */
+    if (!IS_ALIGNED(base, PP_BUDDY_LEAF_PAGES * PAGE_SIZE) || (used_leaves == 0)) {
+        return 0;
+    }
+
+    while (((base_leaf % leaves) + used_leaves) > leaves) {
+        leaves <<= 1;
+    }
+
+    if (off != NULL) {
+        *off = base_leaf % leaves;
+    }
+
+    return leaves;
+}
+
+size_t pp_metadata_num_pages(paddr_t base, size_t size)
+{
+    size_t bitmap_size = BITMAP_SIZE(size) * sizeof(bitmap_granule_t);
+    size_t tree_size = 2 * pp_buddy_num_leaves(base, size, NULL) * sizeof(uint8_t);
+    return NUM_PAGES(bitmap_size + tree_size);
+}
+
+static inline uint8_t pp_buddy_leaf(struct page_pool* pool, size_t leaf)
+{
+    size_t granule = leaf - pool->buddy.off;
+    bool in_pool = (leaf >= pool->buddy.off) && (granule < (pool->size / PP_BUDDY_LEAF_PAGES));
+    return (in_pool && (pool->bitmap[granule] == 0)) ? 1 : 0;
+}
+
+static inline uint8_t pp_buddy_merge(uint8_t left, uint8_t right, uint8_t child_full)
+{
+    if ((left == child_full) && (right == child_full)) {
+        return child_full + 1;
+    }
+    return max(left, right);
+}
+
+static void pp_buddy_update_leaves(struct page_pool* pool, size_t first, size_t last)
+{
+    uint8_t* tree = pool->buddy.tree;
+    size_t leaves = pool->buddy.leaves;
+
+    for (size_t leaf = first; leaf <= last; leaf++) {
+        tree[leaves + leaf] = pp_buddy_leaf(pool, leaf);
+    }
+
+    uint8_t full = 1;
+    for (size_t lo = (leaves + first) / 2, hi = (leaves + last) / 2; lo > 0; lo /= 2, hi /= 2) {
+        for (size_t node = lo; node <= hi; node++) {
+            tree[node] = pp_buddy_merge(tree[2 * node], tree[(2 * node) + 1], full);
+        }
+        full++;
+    }
+}
+
+/**
+ * Must be called after modifying pool bitmap bits in the range [index, index + num_pages).
+ */
+void pp_buddy_update(struct page_pool* pool, size_t index, size_t num_pages)
+{
+    if ((pool->buddy.tree == NULL) || (num_pages == 0)) {
+        return;
+    }
+
+    size_t first = (index / PP_BUDDY_LEAF_PAGES) + pool->buddy.off;
+    size_t last = ((index + num_pages - 1) / PP_BUDDY_LEAF_PAGES) + pool->buddy.off;
+    pp_buddy_update_leaves(pool, first, min(last, pool->buddy.leaves - 1));
+}
+
+/**
+ * Sets up the buddy index at the end of the pool metadata, right after the bitmap.
+ */
+void pp_buddy_init(struct page_pool* pool)
+{
+    pool->buddy.leaves = pp_buddy_num_leaves(pool->base, pool->size, &pool->buddy.off);
+    if (pool->buddy.leaves == 0) {
+        pool->buddy.tree = NULL;
+        return;
+    }
+
+    pool->buddy.tree = (uint8_t*)&pool->bitmap[BITMAP_SIZE(pool->size)];
+    pp_buddy_update_leaves(pool, 0, pool->buddy.leaves - 1);
+}
+
+/**
+ * Finds a free block of 2^order leaves, naturally aligned to its size, by descending the buddy
+ * tree. Returns the index of its first page in the pool or -1 if there is no such block.
+ */
+static ssize_t pp_buddy_find(struct page_pool* pool, size_t order)
+{
+    uint8_t* tree = pool->buddy.tree;
+    size_t root_order = bit_ctz(pool->buddy.leaves);
+    size_t node = 1;
+
+    if ((order > root_order) || (tree[node] < (order + 1))) {
+        return -1;
+    }
+
+    for (size_t node_order = root_order; node_order > order; node_order--) {
+        node = (tree[2 * node] >= (order + 1)) ? (2 * node) : ((2 * node) + 1);
+    }
+
+    size_t first_leaf = (node << order) - pool->buddy.leaves;
+    return (ssize_t)((first_leaf - pool->buddy.off) * PP_BUDDY_LEAF_PAGES);
+}
+
+static bool pp_alloc_buddy(struct page_pool* pool, size_t num_pages, struct ppages* ppages)
+{
+    size_t leaves = (num_pages + PP_BUDDY_LEAF_PAGES - 1) / PP_BUDDY_LEAF_PAGES;
+    size_t order = (leaves > 1) ? ((sizeof(leaves) * 8) - bit_clz(leaves - 1)) : 0;
+
+    ssize_t bit = pp_buddy_find(pool, order);
+    if (bit < 0) {
+        return false;
+    }
+
+    ppages->base = pool->base + (bit * PAGE_SIZE);
+    ppages->num_pages = num_pages;
+    bitmap_set_consecutive(pool->bitmap, bit, num_pages);
+    pp_buddy_update(pool, bit, num_pages);
+    pool->free -= num_pages;
+
+    return true;
+}
+
+bool pp_alloc(struct page_pool* pool, size_t num_pages, bool aligned, struct ppages* ppages)
+{
+    ppages->colors = 0;
+    ppages->num_pages = 0;
+
+    bool ok = false;
+
+    if (num_pages == 0) {
+        return true;
+    }
+
+    mcs_lock(&pool->lock);
+
+    /**
+     * Serve requests of at least a bitmap granule worth of pages from the buddy index. For aligned
+     * power of two sized requests the index is exact, so there is no point in falling back to the
+     * linear search. Other requests are served from the smallest aligned free block that fits
+     * them, if any.
+     */
+    bool pow2 = (num_pages & (num_pages - 1)) == 0;
+    if ((pool->buddy.tree != NULL) && (num_pages >= PP_BUDDY_LEAF_PAGES) && (!aligned || pow2)) {
+        ok = pp_alloc_buddy(pool, num_pages, ppages);
+        if (ok || aligned) {
+            mcs_unlock(&pool->lock);
+            return ok;
+        }
+    }
+
+    /**
+     * If we need a contigous segment aligned to its size, lets start at an already aligned index.
+     */
+    size_t start = aligned ? pool->base / PAGE_SIZE % num_pages : 0;
+    size_t curr = pool->last + ((pool->last + start) % num_pages);
+
+    /**
+     * Lets make two searches:
+     *  - one starting from the last known free index.
+     *  - in case this does not work, start from index 0.
+     */
+    for (size_t i = 0; i < 2 && !ok; i++) {
+        while (pool->free != 0) {
+            ssize_t bit = bitmap_find_consec(pool->bitmap, pool->size, curr, num_pages, false);
+
+            if (bit < 0) {
+                /**
+                 * No num_page page sement was found. If this is the first iteration set position
+                 * to 0 to start next search from index
+                 * 0.
+                 */
+                size_t next_aligned =
+                    (num_pages - ((pool->base / PAGE_SIZE) % num_pages)) % num_pages;
+                curr = aligned ? next_aligned : 0;
+                break;
+            } else if (aligned && (((bit + start) % num_pages) != 0)) {
+                /**
+                 * If we're looking for an aligned segment and the found contigous segment is not
+                 * aligned, start the search again from the last aligned index
+                 */
+                curr = bit + ((bit + start) % num_pages);
+            } else {
+                /**
+                 * We've found our pages. Fill output argument info, mark them as allocated, and
+                 * update page pool bookkeeping.
+                 */
+                ppages->base = pool->base + (bit * PAGE_SIZE);
+                ppages->num_pages = num_pages;
+                bitmap_set_consecutive(pool->bitmap, bit, num_pages);
+                pp_buddy_update(pool, bit, num_pages);
+                pool->free -= num_pages;
+                pool->last = bit + num_pages;
+                ok = true;
+                break;
+            }
+        }
+    }
+    mcs_unlock(&pool->lock);
+
+    return ok;
+}
+
+/**
+ * Cache colors and banks repeat together every period pages, the longer of their own periods, so
+ * a search not meeting both within a period from its start never does.
+ */
+size_t pp_next_bank_clr(paddr_t base, size_t from, colormap_t colors)
+{
+    paddr_t all = 0;
+    for (size_t i = 0; i < COLOR_BANK_BITS; i++) {
+        all |= COLOR_BANK_MASKS[i];
+    }
+    size_t bank_period = (size_t)((((paddr_t)1 << (63 - bit64_clz(all))) << 1) / PAGE_SIZE);
+    size_t period = max(COLOR_NUM * COLOR_SIZE, bank_period);
+    colormap_t banks = clrs_banks(colors);
+
+    size_t index = from;
+    while ((index - from) < period) {
+        if (bit_get(banks, pp_bank(base + (index * PAGE_SIZE)))) {
+            return index;
+        }
+        index = pp_next_cache_clr(base, pp_bank_run_end(base, index), colors);
+    }
+
+    return (size_t)-1;
+}
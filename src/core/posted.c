@@ -0,0 +1,117 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <posted.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <mem.h>
+#include <interrupts.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <string.h>
+
+/**
+ * Run by the vm's master cpu while the vm's address space is set up, after its devices' interrupts
+ * are assigned, so a posted interrupt also listed for a device fails to be assigned.
+ */
+void posted_vm_init(struct vm* vm, const struct vm_config* config)
+{
+    vaddr_t addr = config->platform.posted.page_addr;
+    size_t interrupt_num = config->platform.posted.interrupt_num;
+
+    vm->posted.page = NULL;
+    memset(vm->posted.bitmap, 0, sizeof(vm->posted.bitmap));
+    if (addr == 0 || interrupt_num == 0) {
+        return;
+    }
+
+    if ((addr % PAGE_SIZE) != 0) {
+        ERROR("VM %d posted interrupts page not page aligned", vm->id);
+    }
+
+    if (interrupt_num > POSTED_IRQ_MAX) {
+        ERROR("VM %d has more than %d posted interrupts", vm->id, POSTED_IRQ_MAX);
+    }
+
+    if (config->platform.posted.vcpu >= vm->cpu_num) {
+        ERROR("VM %d posted interrupts target an invalid vcpu", vm->id);
+    }
+
+    struct posted_page* page = mem_alloc_page(NUM_PAGES(sizeof(struct posted_page)), SEC_HYP_VM,
+        false);
+    if (page == NULL) {
+        ERROR("failed to allocate posted interrupts page");
+    }
+    memset(page, 0, NUM_PAGES(sizeof(struct posted_page)) * PAGE_SIZE);
+
+    page->magic = POSTED_MAGIC;
+    page->interrupt_num = (uint32_t)interrupt_num;
+    for (size_t i = 0; i < interrupt_num; i++) {
+        irqid_t int_id = config->platform.posted.interrupts[i];
+        if (!interrupts_vm_assign(vm, int_id)) {
+            ERROR("Failed to assign posted interrupt id %d", int_id);
+        }
+        bitmap_set(vm->posted.bitmap, int_id);
+        page->interrupts[i] = (uint32_t)int_id;
+    }
+
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, (vaddr_t)page, &pa);
+    struct ppages ppages = mem_ppages_get(pa, NUM_PAGES(sizeof(struct posted_page)));
+    mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, addr, NUM_PAGES(sizeof(struct posted_page)),
+        PTE_VM_FLAGS);
+
+    vm->posted.vcpu = config->platform.posted.vcpu;
+    vm->posted.interrupt_num = interrupt_num;
+    vm->posted.interrupts = config->platform.posted.interrupts;
+    vm->posted.page = page;
+}
+
+/**
+ * Enables the posted interrupts on the cpu running the vcpu meant to take them, which leaves the
+ * vm's other vcpus free to poll the page undisturbed.
+ */
+void posted_vcpu_init(struct vcpu* vcpu)
+{
+    struct vm* vm = vcpu->vm;
+
+    if (vm->posted.page == NULL || vcpu->id != vm->posted.vcpu) {
+        return;
+    }
+
+    for (size_t i = 0; i < vm->posted.interrupt_num; i++) {
+        interrupts_cpu_enable(vm->posted.interrupts[i], true);
+    }
+}
+
+/**
+ * Called by interrupts_handle for a posted interrupt of the running vm, which has the physical
+ * interrupt acknowledged as one handled by the hypervisor. The count goes first, so a guest
+ * seeing the pending bit also sees the count including it.
+ */
+__hot void posted_irq_post(struct vm* vm, irqid_t int_id)
+{
+    struct posted_page* page = vm->posted.page;
+
+    size_t idx = 0;
+    while ((idx < vm->posted.interrupt_num) && (vm->posted.interrupts[idx] != int_id)) {
+        idx++;
+    }
+    if (idx >= vm->posted.interrupt_num) {
+        return;
+    }
+
+    page->count[idx] = page->count[idx] + 1;
+    fence_ord_write();
+
+    volatile uint32_t* word = &page->pending[idx / 32];
+    uint32_t bit = 1U << (idx % 32);
+    uint32_t val;
+    do {
+        val = *word;
+    } while (((val & bit) == 0) && (spin_atomic_cmpxchg(word, val, val | bit) != val));
+}
@@ -0,0 +1,100 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <prof.h>
+#include <cpu.h>
+#include <bit.h>
+#include <string.h>
+#include <platform_defs.h>
+
+struct prof_stats {
+    size_t count;
+    uint64_t cycles_total;
+    uint64_t cycles_min;
+    uint64_t cycles_max;
+    uint64_t instrs_total;
+    size_t hist[PROF_HIST_BUCKETS];
+};
+
+/**
+ * Stats are kept per cpu, so that cores of different types in the same platform can be told apart,
+ * and are only written by the cpu they belong to.
+ */
+static struct prof_cpu {
+    bool enabled;
+    struct prof_stats sites[PROF_SITE_NUM];
+} prof_cpus[PLAT_CPU_NUM];
+
+static const char* const prof_site_names[PROF_SITE_NUM] = {
+    [PROF_VGIC_ADD_LR] = "vgic_add_lr",
+    [PROF_VGIC_REFILL_LRS] = "vgic_refill_lrs",
+    [PROF_CPU_MSG_HANDLER] = "cpu_msg_handler",
+    [PROF_VAPLIC_UPDATE_TOPI] = "vaplic_update_topi",
+    [PROF_VM_EMUL_GET_MEM] = "vm_emul_get_mem",
+    [PROF_PP_ALLOC_CLR] = "pp_alloc_clr",
+};
+
+void prof_scope_end(struct prof_scope* scope)
+{
+    uint64_t cycles = (prof_arch_cycles() - scope->cycles) & PROF_ARCH_CNT_MSK;
+    uint64_t instrs = (prof_arch_instrs() - scope->instrs) & PROF_ARCH_CNT_MSK;
+    struct prof_cpu* prof_cpu = &prof_cpus[cpu()->id];
+    struct prof_stats* stats = &prof_cpu->sites[scope->site];
+
+    if (!prof_cpu->enabled) {
+        return;
+    }
+
+    if (stats->count == 0 || cycles < stats->cycles_min) {
+        stats->cycles_min = cycles;
+    }
+    if (cycles > stats->cycles_max) {
+        stats->cycles_max = cycles;
+    }
+    stats->cycles_total += cycles;
+    stats->instrs_total += instrs;
+    stats->count++;
+
+    size_t bucket = (cycles == 0) ? 0 : (63 - bit64_clz(cycles));
+    stats->hist[min(bucket, PROF_HIST_BUCKETS - 1)]++;
+}
+
+void prof_init(void)
+{
+    prof_cpus[cpu()->id].enabled = prof_arch_init();
+    if (!prof_cpus[cpu()->id].enabled) {
+        WARNING("cpu %d: no performance counters available for profiling", cpu()->id);
+    }
+}
+
+void prof_dump(void)
+{
+    struct prof_cpu* prof_cpu = &prof_cpus[cpu()->id];
+
+    INFO("cpu %d profile (cycles/instructions)", cpu()->id);
+    for (size_t i = 0; i < PROF_SITE_NUM; i++) {
+        struct prof_stats* stats = &prof_cpu->sites[i];
+        if (stats->count == 0) {
+            continue;
+        }
+        console_printk("%s: n %lu min %lu avg %lu max %lu instrs %lu\n", prof_site_names[i],
+            (unsigned long)stats->count, (unsigned long)stats->cycles_min,
+            (unsigned long)(stats->cycles_total / stats->count), (unsigned long)stats->cycles_max,
+            (unsigned long)(stats->instrs_total / stats->count));
+        for (size_t j = 0; j < PROF_HIST_BUCKETS; j++) {
+            if (stats->hist[j] != 0) {
+                console_printk("    2^%lu: %lu\n", (unsigned long)j, (unsigned long)stats->hist[j]);
+            }
+        }
+    }
+
+    memset(prof_cpu->sites, 0, sizeof(prof_cpu->sites));
+}
+
+long int prof_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2)
+{
+    prof_dump();
+    return HC_E_SUCCESS;
+}
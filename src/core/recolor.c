@@ -0,0 +1,147 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <recolor.h>
+#include <cpu.h>
+#include <vm.h>
+#include <vmm.h>
+#include <mem.h>
+#include <config.h>
+#include <spinlock.h>
+#include <fences.h>
+#include <vm_info.h>
+#include <vm_qos.h>
+
+/**
+ * As a vm's address space is only mapped on its own cpus, its pages are migrated by its master cpu
+ * while its other cpus are held in the hypervisor. The requester waits for the migration handling
+ * its own messages meanwhile, as it might be one of the vm's cpus or be held by another recoloring.
+ * For the same reason, a busy request slot is not waited for with interrupts masked on a lock.
+ */
+struct recolor_req {
+    spinlock_t lock;
+    bool busy;
+    colormap_t colors;
+    volatile size_t arrived;
+    volatile size_t left;
+    volatile bool release;
+    volatile bool done;
+    bool result;
+};
+
+static struct recolor_req recolor_reqs[CONFIG_VM_NUM];
+
+enum { RECOLOR_MIGRATE };
+
+static void recolor_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(recolor_msg_handler, RECOLOR_CPUMSG_ID);
+
+static void recolor_req_count(struct recolor_req* req, volatile size_t* counter)
+{
+    spin_lock(&req->lock);
+    (*counter)++;
+    spin_unlock(&req->lock);
+}
+
+static void recolor_migrate(struct recolor_req* req)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    size_t others = cpumask_weight(&vm->cpus) - 1;
+
+    /* The pages the hypervisor maps for the vcpus might be freed, so those mappings are dropped */
+    vcpu_hyp_maps_release(cpu()->vcpu);
+
+    if (cpu()->id != vm->master) {
+        recolor_req_count(req, &req->arrived);
+        while (!req->release) { }
+        vcpu_hyp_maps_restore(cpu()->vcpu);
+        recolor_req_count(req, &req->left);
+        return;
+    }
+
+    while (req->arrived < others) { }
+    fence_ord();
+
+    req->result = vm_mem_recolor(vm, req->colors);
+    vm_info_update_colors(vm);
+    vcpu_hyp_maps_restore(cpu()->vcpu);
+
+    fence_sync_write();
+    req->release = true;
+    while (req->left < others) { }
+    fence_ord();
+    req->done = true;
+}
+
+static void recolor_msg_handler(uint32_t event, uint64_t data)
+{
+    if ((data < CONFIG_VM_NUM) && (cpu()->vcpu != NULL) && (cpu()->vcpu->vm->id == data)) {
+        switch (event) {
+            case RECOLOR_MIGRATE:
+                recolor_migrate(&recolor_reqs[data]);
+                break;
+        }
+    }
+}
+
+static bool recolor_req_claim(struct recolor_req* req)
+{
+    bool claimed = false;
+
+    spin_lock(&req->lock);
+    if (!req->busy) {
+        req->busy = true;
+        claimed = true;
+    }
+    spin_unlock(&req->lock);
+
+    return claimed;
+}
+
+long int recolor_hypercall(unsigned long vm_id, unsigned long colors, unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+
+    colors &= clrs_mask();
+    if ((vm_id >= CONFIG_VM_NUM) || (colors == 0)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    colormap_t allowed = all_clrs(vm->config->colors) ? clrs_mask() : vm->config->colors;
+    if (!vm->config->vm_manager && ((vm_id != vm->id) || ((colors & ~allowed) != 0))) {
+        return -HC_E_FAILURE;
+    }
+
+    struct recolor_req* req = &recolor_reqs[vm_id];
+    while (!recolor_req_claim(req)) {
+        cpu_msg_handler();
+    }
+
+    req->colors = colors;
+    req->arrived = 0;
+    req->left = 0;
+    req->release = false;
+    req->done = false;
+    fence_sync_write();
+
+    struct cpu_msg msg = { (uint32_t)RECOLOR_CPUMSG_ID, RECOLOR_MIGRATE, vm_id };
+    cpu_send_msg_mask(vmm_vm_cpus(vm_id), &msg);
+
+    while (!req->done) {
+        cpu_msg_handler();
+    }
+    fence_ord();
+
+    long int ret = req->result ? HC_E_SUCCESS : -HC_E_FAILURE;
+    if (req->result) {
+        vm_qos_colors_update((vmid_t)vm_id, (colormap_t)colors);
+    }
+
+    spin_lock(&req->lock);
+    req->busy = false;
+    spin_unlock(&req->lock);
+
+    return ret;
+}
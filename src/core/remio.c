@@ -0,0 +1,240 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <remio.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <mem.h>
+#include <fences.h>
+#include <string.h>
+#include <timer.h>
+
+enum { REMIO_NOTIFY };
+
+static void remio_handler(uint32_t event, uint64_t data)
+{
+    switch (event) {
+        case REMIO_NOTIFY:
+            vcpu_inject_hw_irq(cpu()->vcpu, (irqid_t)data);
+            break;
+    }
+}
+CPU_MSG_HANDLER(remio_handler, REMIO_CPUMSG_ID);
+
+static struct remio_dev* remio_find_backend(uint32_t bind_key)
+{
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_platform* platform = &config.vmlist[i].platform;
+        for (size_t j = 0; j < platform->remio_dev_num; j++) {
+            struct remio_dev* dev = &platform->remio_devs[j];
+            if ((dev->type == REMIO_DEV_BACKEND) && (dev->bind_key == bind_key)) {
+                return dev;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Allocates the backends' rings and binds each frontend to its backend, before any vm is
+ * initialized, so that frontends may post requests even before their backend boots.
+ */
+void remio_init(void)
+{
+    if (!cpu_is_master()) {
+        return;
+    }
+
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_platform* platform = &config.vmlist[i].platform;
+        for (size_t j = 0; j < platform->remio_dev_num; j++) {
+            struct remio_dev* dev = &platform->remio_devs[j];
+            dev->backend = NULL;
+            if (dev->type != REMIO_DEV_BACKEND) {
+                continue;
+            }
+
+            dev->lock = SPINLOCK_INITVAL;
+            dev->head = 0;
+            memset(dev->abandoned, 0, sizeof(dev->abandoned));
+            dev->notify_cpu = INVALID_CPUID;
+            dev->ring = mem_alloc_page(NUM_PAGES(sizeof(struct remio_ring)), SEC_HYP_GLOBAL, false);
+            if (dev->ring == NULL) {
+                ERROR("failed to allocate remote io ring");
+            }
+            memset(dev->ring, 0, sizeof(struct remio_ring));
+        }
+    }
+
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_platform* platform = &config.vmlist[i].platform;
+        for (size_t j = 0; j < platform->remio_dev_num; j++) {
+            struct remio_dev* dev = &platform->remio_devs[j];
+            if (dev->type == REMIO_DEV_FRONTEND) {
+                dev->backend = remio_find_backend(dev->bind_key);
+            }
+        }
+    }
+}
+
+void remio_vm_init(struct vm* vm, const struct vm_config* config)
+{
+    for (size_t i = 0; i < config->platform.remio_dev_num; i++) {
+        struct remio_dev* dev = &config->platform.remio_devs[i];
+
+        if (dev->type == REMIO_DEV_FRONTEND) {
+            if (dev->backend == NULL) {
+                WARNING("Remote io device %d has no backend. Ignored.", dev->bind_key);
+                continue;
+            }
+            dev->emul = (struct emul_mem){
+                .va_base = dev->va,
+                .size = dev->size,
+                .handler = remio_emul_handler,
+            };
+            vm_emul_add_mem(vm, &dev->emul);
+        } else if ((dev->va % PAGE_SIZE) != 0) {
+            WARNING("Remote io device %d ring not page aligned. Ignored.", dev->bind_key);
+        } else {
+            paddr_t pa = 0;
+            mem_translate(&cpu()->as, (vaddr_t)dev->ring, &pa);
+            struct ppages ppages = mem_ppages_get(pa, NUM_PAGES(sizeof(struct remio_ring)));
+            mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, dev->va, ppages.num_pages,
+                PTE_VM_FLAGS);
+            dev->notify_cpu = vm_translate_to_pcpuid(vm, 0);
+        }
+    }
+}
+
+static struct remio_dev* remio_find_frontend(struct vm* vm, vaddr_t addr)
+{
+    for (size_t i = 0; i < vm->config->platform.remio_dev_num; i++) {
+        struct remio_dev* dev = &vm->config->platform.remio_devs[i];
+        if ((dev->type == REMIO_DEV_FRONTEND) && (addr >= dev->va) &&
+            (addr < (dev->va + dev->size))) {
+            return dev;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Frees the slot if the backend is done with a request its vcpu gave up waiting for. Must be
+ * called with the backend's lock held.
+ */
+static bool remio_slot_free(struct remio_dev* backend, size_t slot)
+{
+    struct remio_req* req = &backend->ring->reqs[slot];
+
+    if ((req->state == REMIO_REQ_DONE) && bitmap_get(backend->abandoned, slot)) {
+        req->state = REMIO_REQ_FREE;
+    }
+
+    return req->state == REMIO_REQ_FREE;
+}
+
+/**
+ * Posts the request at the ring's head, waiting for the slot to be freed if the ring is full.
+ * Returns the slot and sets seq to the request's sequence number, or NULL if the slot is not
+ * freed before the deadline.
+ */
+static struct remio_req* remio_post(struct remio_dev* backend, struct remio_req* request,
+    uint32_t* seq, uint64_t deadline)
+{
+    struct remio_ring* ring = backend->ring;
+
+    spin_lock(&backend->lock);
+    while (!remio_slot_free(backend, backend->head % REMIO_RING_SIZE)) {
+        spin_unlock(&backend->lock);
+        if (timer_get() >= deadline) {
+            return NULL;
+        }
+        cpu_msg_handler();
+        spin_lock(&backend->lock);
+    }
+
+    struct remio_req* req = &ring->reqs[backend->head % REMIO_RING_SIZE];
+    bitmap_clear(backend->abandoned, backend->head % REMIO_RING_SIZE);
+    *seq = backend->head;
+    req->seq = *seq;
+    req->addr = request->addr;
+    req->value = request->value;
+    req->width = request->width;
+    req->write = request->write;
+    fence_ord_write();
+    req->state = REMIO_REQ_PENDING;
+
+    uint32_t old_head = backend->head;
+    backend->head = old_head + 1;
+    ring->head = backend->head;
+
+    /* Publish head before reading the event index, which pairs with the backend's update */
+    fence_sync();
+    bool notify = ipc_ring_need_event(ring->head_event, backend->head, old_head);
+    spin_unlock(&backend->lock);
+
+    cpuid_t notify_cpu = backend->notify_cpu;
+    if (notify && (notify_cpu != INVALID_CPUID)) {
+        struct cpu_msg msg = { REMIO_CPUMSG_ID, REMIO_NOTIFY, backend->interrupt };
+        cpu_send_urgent_msg(notify_cpu, &msg);
+    }
+
+    return req;
+}
+
+/**
+ * The vcpu waits for the backend to complete the access, handling the messages sent to its cpu
+ * meanwhile, for at most REMIO_TIMEOUT_US. A read whose request is dropped, i.e., it is no longer
+ * pending without having been completed, or times out reads as all ones, as from a bus with no
+ * device responding. A timed out request is left to the backend, its slot being freed once done.
+ */
+bool remio_emul_handler(struct emul_access* acc)
+{
+    struct remio_dev* dev = remio_find_frontend(cpu()->vcpu->vm, acc->addr);
+    if ((dev == NULL) || (dev->backend == NULL)) {
+        return false;
+    }
+
+    struct remio_req request = {
+        .addr = acc->addr - dev->va,
+        .value = acc->write ? vcpu_readreg(cpu()->vcpu, acc->reg) : 0,
+        .width = (uint8_t)acc->width,
+        .write = acc->write,
+    };
+
+    uint64_t deadline = timer_get() + timer_ns_to_ticks(REMIO_TIMEOUT_US * 1000ULL);
+    uint32_t seq = 0;
+    struct remio_req* req = remio_post(dev->backend, &request, &seq, deadline);
+
+    while ((req != NULL) && (req->state == REMIO_REQ_PENDING) && (req->seq == seq) &&
+        (timer_get() < deadline)) {
+        cpu_msg_handler();
+    }
+
+    unsigned long value = ~0UL;
+    if (req == NULL) {
+        WARNING("Remote io device %d ring full, access dropped", dev->bind_key);
+    } else if ((req->state == REMIO_REQ_DONE) && (req->seq == seq)) {
+        fence_ord_read();
+        value = (unsigned long)req->value;
+        fence_ord();
+        req->state = REMIO_REQ_FREE;
+    } else if (req->seq == seq) {
+        spin_lock(&dev->backend->lock);
+        bitmap_set(dev->backend->abandoned, seq % REMIO_RING_SIZE);
+        spin_unlock(&dev->backend->lock);
+        WARNING("Remote io device %d access timed out", dev->bind_key);
+    }
+
+    if (!acc->write) {
+        vcpu_writereg(cpu()->vcpu, acc->reg, value & BIT_MASK(0, acc->width * 8));
+    }
+
+    return true;
+}
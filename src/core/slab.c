@@ -0,0 +1,211 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <slab.h>
+
+#include <cpu.h>
+#include <mem.h>
+#include <spinlock.h>
+
+#define SLAB_CLASS_NUM (7)
+
+struct slab {
+    struct slab* next;
+    struct slab* prev;
+    struct slab_class* cls;
+    void* free_list;
+    size_t free_num;
+};
+
+struct slab_class {
+    spinlock_t lock;
+    size_t objsize;
+    /* Slabs with free objects, the ones entirely free included */
+    struct slab* partial;
+    size_t empty_num;
+};
+
+struct slab_cpu_cache {
+    size_t num;
+    void* objs[SLAB_CPU_CACHE_SIZE];
+};
+
+static struct slab_class slab_classes[SLAB_CLASS_NUM] = {
+    { SPINLOCK_INITVAL, SLAB_MIN_SIZE, NULL, 0 },
+    { SPINLOCK_INITVAL, 32, NULL, 0 },
+    { SPINLOCK_INITVAL, 64, NULL, 0 },
+    { SPINLOCK_INITVAL, 128, NULL, 0 },
+    { SPINLOCK_INITVAL, 256, NULL, 0 },
+    { SPINLOCK_INITVAL, 512, NULL, 0 },
+    { SPINLOCK_INITVAL, SLAB_MAX_SIZE, NULL, 0 },
+};
+
+static struct slab_cpu_cache slab_cpu_caches[PLAT_CPU_NUM][SLAB_CLASS_NUM];
+
+static inline size_t slab_obj_offset(struct slab_class* cls)
+{
+    return ALIGN(sizeof(struct slab), cls->objsize);
+}
+
+static inline size_t slab_obj_num(struct slab_class* cls)
+{
+    return (PAGE_SIZE - slab_obj_offset(cls)) / cls->objsize;
+}
+
+static ssize_t slab_class_index(size_t size)
+{
+    for (size_t i = 0; i < SLAB_CLASS_NUM; i++) {
+        if (size <= slab_classes[i].objsize) {
+            return (ssize_t)i;
+        }
+    }
+    return -1;
+}
+
+static void slab_partial_push(struct slab_class* cls, struct slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = cls->partial;
+    if (cls->partial != NULL) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
+}
+
+static void slab_partial_rm(struct slab_class* cls, struct slab* slab)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/* Called with the class's lock held */
+static struct slab* slab_grow(struct slab_class* cls)
+{
+    struct slab* slab = mem_alloc_page(1, SEC_HYP_GLOBAL, false);
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->cls = cls;
+    slab->free_list = NULL;
+    slab->free_num = slab_obj_num(cls);
+    for (size_t i = slab->free_num; i > 0; i--) {
+        void* obj = (void*)((vaddr_t)slab + slab_obj_offset(cls) + ((i - 1) * cls->objsize));
+        *(void**)obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    slab_partial_push(cls, slab);
+    cls->empty_num++;
+
+    return slab;
+}
+
+/* Moves up to n free objects from the class's slabs to the cache, returning how many were moved */
+static size_t slab_refill(struct slab_class* cls, struct slab_cpu_cache* cache, size_t n)
+{
+    size_t moved = 0;
+
+    spin_lock(&cls->lock);
+    while (moved < n) {
+        struct slab* slab = cls->partial;
+        if ((slab == NULL) && ((slab = slab_grow(cls)) == NULL)) {
+            break;
+        }
+
+        if (slab->free_num == slab_obj_num(cls)) {
+            cls->empty_num--;
+        }
+        while ((moved < n) && (slab->free_num > 0)) {
+            void* obj = slab->free_list;
+            slab->free_list = *(void**)obj;
+            slab->free_num--;
+            cache->objs[cache->num++] = obj;
+            moved++;
+        }
+        if (slab->free_num == 0) {
+            slab_partial_rm(cls, slab);
+        }
+    }
+    spin_unlock(&cls->lock);
+
+    return moved;
+}
+
+/* Returns the n objects at the top of the cache to their slabs */
+static void slab_drain(struct slab_class* cls, struct slab_cpu_cache* cache, size_t n)
+{
+    spin_lock(&cls->lock);
+    for (size_t i = 0; i < n; i++) {
+        void* obj = cache->objs[--cache->num];
+        struct slab* slab = (struct slab*)((vaddr_t)obj & PAGE_FRAME_MASK);
+
+        if (slab->free_num == 0) {
+            slab_partial_push(cls, slab);
+        }
+        *(void**)obj = slab->free_list;
+        slab->free_list = obj;
+        slab->free_num++;
+
+        if (slab->free_num == slab_obj_num(cls)) {
+            if (cls->empty_num > 0) {
+                slab_partial_rm(cls, slab);
+                mem_unmap(&cpu()->as, (vaddr_t)slab, 1, true);
+            } else {
+                cls->empty_num++;
+            }
+        }
+    }
+    spin_unlock(&cls->lock);
+}
+
+void* slab_alloc(size_t size)
+{
+    ssize_t index = slab_class_index(size);
+    if (index < 0) {
+        return NULL;
+    }
+
+    struct slab_class* cls = &slab_classes[index];
+    struct slab_cpu_cache* cache = &slab_cpu_caches[cpu()->id][index];
+
+    if ((cache->num == 0) && (slab_refill(cls, cache, SLAB_CPU_CACHE_SIZE / 2) == 0)) {
+        return NULL;
+    }
+
+    return cache->objs[--cache->num];
+}
+
+void slab_free(void* obj)
+{
+    if (obj == NULL) {
+        return;
+    }
+
+    struct slab* slab = (struct slab*)((vaddr_t)obj & PAGE_FRAME_MASK);
+    struct slab_class* cls = slab->cls;
+    if ((cls < &slab_classes[0]) || (cls >= &slab_classes[SLAB_CLASS_NUM])) {
+        WARNING("leaked while trying to free stray object");
+        return;
+    }
+
+    size_t off = (vaddr_t)obj & PAGE_OFFSET_MASK;
+    if ((off < slab_obj_offset(cls)) || (((off - slab_obj_offset(cls)) % cls->objsize) != 0)) {
+        WARNING("leaked while trying to free stray object");
+        return;
+    }
+
+    struct slab_cpu_cache* cache = &slab_cpu_caches[cpu()->id][cls - slab_classes];
+    if (cache->num == SLAB_CPU_CACHE_SIZE) {
+        slab_drain(cls, cache, SLAB_CPU_CACHE_SIZE / 2);
+    }
+    cache->objs[cache->num++] = obj;
+}
@@ -0,0 +1,205 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <snapshot.h>
+#include <cpu.h>
+#include <vm.h>
+#include <vmm.h>
+#include <mem.h>
+#include <config.h>
+#include <spinlock.h>
+#include <timer.h>
+#include <fences.h>
+
+/**
+ * As with recoloring, the vm's state is saved and restored by its own cpus, its memory and shared
+ * state by its master, while all of them are held in the hypervisor. The requester waits for the
+ * operation handling its own messages meanwhile.
+ */
+struct snapshot_req {
+    spinlock_t lock;
+    /* Set once the vm's snapshot is set up, as it is never torn down */
+    bool ready;
+    bool busy;
+    unsigned long op;
+    volatile bool done;
+    volatile bool result;
+};
+
+static struct snapshot_req snapshot_reqs[CONFIG_VM_NUM];
+
+enum { SNAPSHOT_OP };
+
+static void snapshot_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(snapshot_msg_handler, SNAPSHOT_CPUMSG_ID);
+
+/**
+ * Sets up the vm's snapshot, which must be called by its master once the vm is initialized. Vms
+ * whose arch or memory can not be snapshotted are left without one.
+ */
+void snapshot_vm_init(struct vm* vm)
+{
+    vm->snapshot = NULL;
+    if (!vm->config->snapshot) {
+        return;
+    }
+
+    size_t size = sizeof(struct vm_snapshot) + (vm->cpu_num * sizeof(struct vcpu_snapshot));
+    struct vm_snapshot* snap = vm_arena_alloc(vm, size);
+    if (snap == NULL) {
+        ERROR("failed to allocate vm %d snapshot", vm->id);
+    }
+    snap->valid = false;
+
+    if (!vm_arch_snapshot_init(vm, &snap->arch)) {
+        WARNING("VM %d snapshots not supported", vm->id);
+        return;
+    }
+
+    snap->mem = vm_mem_snapshot_init(vm);
+    if (snap->mem == NULL) {
+        return;
+    }
+
+    vm->snapshot = snap;
+
+    spin_lock(&snapshot_reqs[vm->id].lock);
+    snapshot_reqs[vm->id].ready = true;
+    spin_unlock(&snapshot_reqs[vm->id].lock);
+}
+
+/**
+ * The master first checks the operation can be carried out and does the vm wide part, so that a
+ * refused save leaves the last snapshot whole. The vcpus' registers are only restored once their
+ * cpus are done handling the current exception, see vcpu_check_restart.
+ */
+static void snapshot_handler(struct snapshot_req* req)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    struct vm* vm = vcpu->vm;
+    struct vm_snapshot* snap = vm->snapshot;
+    struct vcpu_snapshot* vcpu_snap = &snap->vcpus[vcpu->id];
+    bool master = (cpu()->id == vm->master);
+    uint64_t start = timer_get();
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (master) {
+        bool ok = false;
+        if (req->op == SNAPSHOT_SAVE) {
+            ok = vm_mem_snapshot_save(vm, snap->mem);
+            if (ok) {
+                vm_arch_snapshot_save(vm, &snap->arch);
+            }
+        } else if (snap->valid) {
+            ok = vm_mem_snapshot_restore(vm, snap->mem);
+            if (ok) {
+                vm_arch_snapshot_restore(vm, &snap->arch);
+            }
+        }
+        req->result = ok;
+    }
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (req->result) {
+        if (req->op == SNAPSHOT_SAVE) {
+            vcpu_snap->regs = vcpu->regs;
+            vcpu_arch_snapshot_save(vcpu, &vcpu_snap->arch);
+        } else {
+            vcpu_arch_snapshot_restore(vcpu, &vcpu_snap->arch);
+            vcpu->restore = true;
+        }
+    }
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (master) {
+        if (req->result) {
+            snap->valid = true;
+            INFO("VM %d snapshot %s in %lu us", vm->id,
+                (req->op == SNAPSHOT_SAVE) ? "saved" : "restored",
+                (unsigned long)(timer_ticks_to_ns(timer_get() - start) / 1000));
+        }
+        fence_sync_write();
+        req->done = true;
+    }
+}
+
+static void snapshot_msg_handler(uint32_t event, uint64_t data)
+{
+    if ((data < CONFIG_VM_NUM) && (cpu()->vcpu != NULL) && (cpu()->vcpu->vm->id == data)) {
+        switch (event) {
+            case SNAPSHOT_OP:
+                snapshot_handler(&snapshot_reqs[data]);
+                break;
+        }
+    }
+}
+
+static bool snapshot_req_claim(struct snapshot_req* req)
+{
+    bool claimed = false;
+
+    spin_lock(&req->lock);
+    if (!req->busy) {
+        req->busy = true;
+        claimed = true;
+    }
+    spin_unlock(&req->lock);
+
+    return claimed;
+}
+
+/**
+ * A vm can not snapshot itself, as all of its cpus must be held while the calling one would have
+ * to return from the hypercall in both the saved and the restored state.
+ */
+long int snapshot_hypercall(unsigned long vm_id, unsigned long op, unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+
+    if ((vm_id >= CONFIG_VM_NUM) || (vm_id == vm->id) ||
+        ((op != SNAPSHOT_SAVE) && (op != SNAPSHOT_RESTORE))) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if (!vm->config->vm_manager) {
+        return -HC_E_FAILURE;
+    }
+
+    struct snapshot_req* req = &snapshot_reqs[vm_id];
+    spin_lock(&req->lock);
+    bool ready = req->ready;
+    spin_unlock(&req->lock);
+    if (!ready) {
+        return -HC_E_FAILURE;
+    }
+
+    while (!snapshot_req_claim(req)) {
+        cpu_msg_handler();
+    }
+
+    req->op = op;
+    req->result = false;
+    req->done = false;
+    fence_sync_write();
+
+    struct cpu_msg msg = { (uint32_t)SNAPSHOT_CPUMSG_ID, SNAPSHOT_OP, vm_id };
+    cpu_send_msg_mask(vmm_vm_cpus(vm_id), &msg);
+
+    while (!req->done) {
+        cpu_msg_handler();
+    }
+    fence_ord();
+
+    long int ret = req->result ? HC_E_SUCCESS : -HC_E_FAILURE;
+
+    spin_lock(&req->lock);
+    req->busy = false;
+    spin_unlock(&req->lock);
+
+    return ret;
+}
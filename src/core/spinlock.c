@@ -0,0 +1,83 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <spinlock.h>
+#include <cpu.h>
+#include <fences.h>
+
+#ifndef MCS_NODES_NUM
+#define MCS_NODES_NUM (4)
+#endif
+
+/* Each node sits in its own cache line so that waiters do not share the lines they spin on */
+#define MCS_NODE_ALIGN (64)
+
+struct mcs_node {
+    volatile uint32_t next;
+    volatile bool locked;
+} __attribute__((aligned(MCS_NODE_ALIGN)));
+
+static struct mcs_node mcs_nodes[PLAT_CPU_NUM][MCS_NODES_NUM];
+static unsigned long mcs_nodes_used[PLAT_CPU_NUM];
+
+static inline struct mcs_node* mcs_node(uint32_t id)
+{
+    return &mcs_nodes[(id - 1) / MCS_NODES_NUM][(id - 1) % MCS_NODES_NUM];
+}
+
+void mcs_lock(mcslock_t* lock)
+{
+    cpuid_t cpu_id = cpu()->id;
+    size_t i = 0;
+
+    while ((i < MCS_NODES_NUM) && ((mcs_nodes_used[cpu_id] & (1UL << i)) != 0)) {
+        i++;
+    }
+    if (i >= MCS_NODES_NUM) {
+        ERROR("cpu %d holds too many mcs locks", cpu_id);
+    }
+    mcs_nodes_used[cpu_id] |= 1UL << i;
+
+    uint32_t id = (uint32_t)((cpu_id * MCS_NODES_NUM) + i + 1);
+    struct mcs_node* node = mcs_node(id);
+    node->next = 0;
+    node->locked = true;
+
+    /* The exchange is fully ordered, so the node is initialized before it is queued */
+    uint32_t prev = spin_atomic_xchg(&lock->tail, id);
+    if (prev != 0) {
+        mcs_node(prev)->next = id;
+        spin_notify();
+        while (node->locked) {
+            spin_wait();
+        }
+        fence_ord();
+    }
+
+    lock->node = id;
+}
+
+void mcs_unlock(mcslock_t* lock)
+{
+    uint32_t id = lock->node;
+    struct mcs_node* node = mcs_node(id);
+
+    if (node->next == 0) {
+        if (spin_atomic_cmpxchg(&lock->tail, id, 0) != id) {
+            /* A waiter swapped itself in as the tail but has not yet linked to this node */
+            while (node->next == 0) {
+                spin_wait();
+            }
+        }
+    }
+
+    if (node->next != 0) {
+        fence_ord();
+        mcs_node(node->next)->locked = false;
+        spin_notify();
+    }
+
+    mcs_nodes_used[(id - 1) / MCS_NODES_NUM] &= ~(1UL << ((id - 1) % MCS_NODES_NUM));
+}
@@ -0,0 +1,89 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <stats.h>
+#include <vm.h>
+#include <config.h>
+#include <hypercall.h>
+#include <string.h>
+#include <fences.h>
+#include <platform.h>
+#include <timer.h>
+
+struct stats_cpu stats_cpus[PLAT_CPU_NUM];
+struct stats_wss stats_wss[CONFIG_VM_NUM];
+
+void stats_init(void)
+{
+    stats_cpus[cpu()->id].vm_id = INVALID_VMID;
+}
+
+void stats_vcpu_init(vmid_t vm_id, vcpuid_t vcpu_id)
+{
+    struct stats_cpu* stats = &stats_cpus[cpu()->id];
+
+    memset(stats->counters, 0, sizeof(stats->counters));
+    stats->vcpu_id = vcpu_id;
+    fence_sync_write();
+    stats->vm_id = vm_id;
+}
+
+static long int stats_wss_read(struct stats_wss* wss, unsigned long counter)
+{
+    switch (counter) {
+        case STATS_WSS_PAGES:
+            return (long int)((volatile struct stats_wss*)wss)->pages;
+        case STATS_WSS_SAMPLES:
+            return (long int)((volatile struct stats_wss*)wss)->samples;
+        case STATS_WSS_CHUNKS:
+            return (long int)wss->chunk_num;
+        default:
+            if ((wss->heat == NULL) || (counter >= STATS_INTERFERENCE_NS) ||
+                ((counter - STATS_WSS_HEAT) >= wss->chunk_num)) {
+                return -HC_E_INVAL_ARGS;
+            }
+            return ((volatile uint16_t*)wss->heat)[counter - STATS_WSS_HEAT];
+    }
+}
+
+/**
+ * Reads a counter of one of the vm's vcpus, or its sum over all of them if vcpu_id is all ones.
+ * Counters are read while their cpus keep counting, so a multicall reading several is not a
+ * consistent snapshot. Only a vm_manager vm may read other vms' counters. The interference
+ * counters are kept in timer ticks and converted as they are read.
+ */
+long int stats_hypercall(unsigned long vm_id, unsigned long vcpu_id, unsigned long counter)
+{
+    if (vm_id >= CONFIG_VM_NUM) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if ((vm_id != cpu()->vcpu->vm->id) && !cpu()->vcpu->vm->config->vm_manager) {
+        return -HC_E_FAILURE;
+    }
+
+    size_t slot = counter;
+    if ((counter >= STATS_INTERFERENCE_NS) && (counter <= STATS_INTERFERENCE_NS + CONFIG_VM_NUM)) {
+        slot = STATS_INTERFERENCE + (counter - STATS_INTERFERENCE_NS);
+    } else if (counter >= STATS_INTERFERENCE) {
+        return stats_wss_read(&stats_wss[vm_id], counter);
+    }
+
+    bool found = false;
+    uint64_t value = 0;
+    for (cpuid_t i = 0; i < PLAT_CPU_NUM; i++) {
+        struct stats_cpu* stats = &stats_cpus[i];
+        if ((stats->vm_id == vm_id) && ((vcpu_id == ~0UL) || (stats->vcpu_id == vcpu_id))) {
+            value += ((volatile uint64_t*)stats->counters)[slot];
+            found = true;
+        }
+    }
+
+    if (slot >= STATS_INTERFERENCE) {
+        value = timer_ticks_to_ns(value);
+    }
+
+    return found ? (long int)value : -HC_E_INVAL_ARGS;
+}
@@ -0,0 +1,174 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <timer.h>
+#include <cpu.h>
+#include <interrupts.h>
+
+/**
+ * Bao owns the cpu's hypervisor timer and multiplexes it among the events in the queue. The
+ * hardware is only reprogrammed when an event earlier than the programmed deadline is armed, or
+ * after the programmed deadline expired. Cancelled events are not reprogrammed away, the resulting
+ * early interrupt is absorbed by the interrupt handler. On some architectures (e.g. riscv without
+ * Sstc) each reprogramming is a firmware call, so they are kept to a minimum.
+ *
+ * While the cpu is idle, only the first event that is not deferrable is programmed, so a cpu left
+ * with deferrable events alone is not woken up at all.
+ */
+struct timer_cpu {
+    struct list queue;
+    bool hw_armed;
+    uint64_t hw_deadline;
+    bool idle;
+    uint64_t slack_ticks;
+};
+
+static struct timer_cpu timer_cpus[PLAT_CPU_NUM];
+
+static int timer_event_cmp(node_t* _n1, node_t* _n2)
+{
+    struct timer_event* n1 = (struct timer_event*)_n1;
+    struct timer_event* n2 = (struct timer_event*)_n2;
+    if (n1->deadline > n2->deadline) {
+        return 1;
+    } else if (n1->deadline < n2->deadline) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+static struct timer_event* timer_next_event(struct timer_cpu* timer)
+{
+    if (!timer->idle) {
+        return (struct timer_event*)list_peek(&timer->queue);
+    }
+
+    list_foreach (timer->queue, struct timer_event, event) {
+        if (!event->deferrable) {
+            return event;
+        }
+    }
+
+    return NULL;
+}
+
+static void timer_program(struct timer_cpu* timer)
+{
+    struct timer_event* next = timer_next_event(timer);
+
+    if (next == NULL) {
+        if (!timer->hw_armed) {
+            timer_arch_disable();
+        }
+    } else if (!timer->hw_armed || next->deadline < timer->hw_deadline) {
+        timer_arch_program(next->deadline);
+        timer->hw_armed = true;
+        timer->hw_deadline = next->deadline;
+    }
+}
+
+void timer_arm(struct timer_event* event, uint64_t deadline)
+{
+    struct timer_cpu* timer = &timer_cpus[cpu()->id];
+
+    if (event->armed) {
+        list_rm(&timer->queue, &event->node);
+    }
+
+    event->deadline = deadline;
+    event->armed = true;
+    list_insert_ordered(&timer->queue, &event->node, timer_event_cmp);
+    timer_program(timer);
+}
+
+void timer_cancel(struct timer_event* event)
+{
+    struct timer_cpu* timer = &timer_cpus[cpu()->id];
+
+    if (event->armed) {
+        list_rm(&timer->queue, &event->node);
+        event->armed = false;
+    }
+}
+
+uint64_t timer_next_deadline(void)
+{
+    struct timer_event* next = (struct timer_event*)list_peek(&timer_cpus[cpu()->id].queue);
+    return (next != NULL) ? next->deadline : UINT64_MAX;
+}
+
+static void timer_run(struct timer_cpu* timer)
+{
+    uint64_t now = timer_get();
+    struct timer_event* event = NULL;
+
+    /* The programmed deadline was reached, whatever is next must be programmed again. */
+    timer->hw_armed = false;
+
+    while ((event = (struct timer_event*)list_peek(&timer->queue)) != NULL &&
+        ((event->deadline <= now) ||
+            (event->deferrable && (event->deadline <= (now + timer->slack_ticks))))) {
+        list_pop(&timer->queue);
+        event->armed = false;
+        event->handler(event);
+    }
+
+    timer_program(timer);
+}
+
+void timer_handle_interrupt(irqid_t int_id)
+{
+    timer_run(&timer_cpus[cpu()->id]);
+}
+
+/**
+ * Called before the cpu waits for interrupts with nothing to run. The hardware is reprogrammed
+ * unless what it is programmed with is also the first event that must wake the cpu.
+ */
+void timer_idle_enter(void)
+{
+    struct timer_cpu* timer = &timer_cpus[cpu()->id];
+
+    timer->idle = true;
+    struct timer_event* next = timer_next_event(timer);
+    if (!timer->hw_armed || (next == NULL) || (next->deadline != timer->hw_deadline)) {
+        timer->hw_armed = false;
+        timer_program(timer);
+    }
+}
+
+/**
+ * Called once the cpu wakes up, whatever the reason, with its interrupts still masked. The events
+ * that expired meanwhile, among them any deferred ones, are run here in a single batch, which also
+ * clears the timer interrupt that may have woken the cpu.
+ */
+void timer_idle_exit(void)
+{
+    struct timer_cpu* timer = &timer_cpus[cpu()->id];
+
+    if (timer->idle) {
+        timer->idle = false;
+        timer_run(timer);
+    }
+}
+
+void timer_init(void)
+{
+    struct timer_cpu* timer = &timer_cpus[cpu()->id];
+
+    list_init(&timer->queue);
+    timer->hw_armed = false;
+    timer->idle = false;
+    timer->slack_ticks = timer_ns_to_ticks(TIMER_DEFER_SLACK_US * 1000ULL);
+
+    if (cpu_is_master()) {
+        if (!interrupts_reserve(TIMER_ARCH_IRQ_ID, timer_handle_interrupt)) {
+            ERROR("Failed to reserve hypervisor timer interrupt");
+        }
+    }
+
+    timer_arch_init();
+}
@@ -0,0 +1,139 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <trace.h>
+#include <cpu.h>
+#include <hypercall.h>
+#include <platform_defs.h>
+#include <mem.h>
+#include <fences.h>
+#include <string.h>
+
+/**
+ * Each cpu only ever writes to its own buffer, so no locking is needed. When the buffer is full
+ * the oldest entries are overwritten.
+ */
+static struct trace_buf {
+    struct trace_entry entries[TRACE_BUF_SIZE];
+    size_t next;
+    size_t count;
+} trace_bufs[PLAT_CPU_NUM];
+
+/* Set up by the master cpu in ipc_init, before the others run any vcpu */
+static struct trace_stream {
+    struct trace_stream_hdr* hdr;
+    size_t ring_size;
+    size_t ring_stride;
+    bool overwrite;
+} trace_stream;
+
+static inline struct trace_stream_ring* trace_stream_ring(cpuid_t cpu_id)
+{
+    uintptr_t rings = (uintptr_t)trace_stream.hdr + sizeof(struct trace_stream_hdr);
+    return (struct trace_stream_ring*)(rings + (cpu_id * trace_stream.ring_stride));
+}
+
+static void trace_stream_put(struct trace_entry* entry)
+{
+    struct trace_stream_ring* ring = trace_stream_ring(cpu()->id);
+    uint32_t head = ring->head;
+
+    if (!trace_stream.overwrite && ((uint32_t)(head - ring->tail) >= trace_stream.ring_size)) {
+        ring->dropped++;
+        return;
+    }
+
+    struct trace_stream_entry* slot = &ring->entries[head & (trace_stream.ring_size - 1)];
+    slot->seq = ~0ULL;
+    fence_ord_write();
+    slot->entry = *entry;
+    fence_ord_write();
+    slot->seq = head;
+    ring->head = head + 1;
+}
+
+/**
+ * Each cpu gets an equal, cache line aligned share of the shared memory after the header, holding
+ * the largest power of 2 of entries that fits.
+ */
+void trace_stream_init(struct shmem* shmem)
+{
+    size_t share = 0;
+    if (shmem->size > sizeof(struct trace_stream_hdr)) {
+        share = (shmem->size - sizeof(struct trace_stream_hdr)) / PLAT_CPU_NUM;
+        share &= ~((size_t)TRACE_STREAM_CACHE_LINE - 1);
+    }
+    if (share <= sizeof(struct trace_stream_ring)) {
+        WARNING("Shared memory too small to hold the trace stream. Ignored.");
+        return;
+    }
+
+    size_t entries = (share - sizeof(struct trace_stream_ring)) / sizeof(struct trace_stream_entry);
+    size_t ring_size = 1;
+    while ((ring_size * 2) <= entries) {
+        ring_size *= 2;
+    }
+
+    struct ppages ppages = mem_ppages_get(shmem->phys, NUM_PAGES(shmem->size));
+    struct trace_stream_hdr* hdr = (struct trace_stream_hdr*)mem_alloc_map(&cpu()->as,
+        SEC_HYP_GLOBAL, &ppages, INVALID_VA, ppages.num_pages, PTE_HYP_FLAGS);
+    memset(hdr, 0, shmem->size);
+    hdr->cpu_num = PLAT_CPU_NUM;
+    hdr->ring_size = (uint32_t)ring_size;
+    hdr->entry_size = sizeof(struct trace_stream_entry);
+    hdr->policy = (uint32_t)shmem->trace;
+
+    trace_stream.ring_size = ring_size;
+    trace_stream.ring_stride = share;
+    trace_stream.overwrite = (shmem->trace == SHMEM_TRACE_OVERWRITE);
+    fence_ord_write();
+    trace_stream.hdr = hdr;
+}
+
+void trace_exit_end(enum trace_exit_type type, unsigned long reason, uint64_t info,
+    uint64_t start)
+{
+    struct trace_buf* buf = &trace_bufs[cpu()->id];
+    struct trace_entry* entry = &buf->entries[buf->next];
+
+    entry->timestamp = start;
+    entry->duration = timer_get() - start;
+    entry->type = (uint32_t)type;
+    entry->reason = (uint32_t)reason;
+    entry->info = info;
+
+    buf->next = (buf->next + 1) % TRACE_BUF_SIZE;
+    if (buf->count < TRACE_BUF_SIZE) {
+        buf->count++;
+    }
+
+    if (trace_stream.hdr != NULL) {
+        trace_stream_put(entry);
+    }
+}
+
+void trace_dump(void)
+{
+    struct trace_buf* buf = &trace_bufs[cpu()->id];
+    size_t first = (buf->next + TRACE_BUF_SIZE - buf->count) % TRACE_BUF_SIZE;
+
+    INFO("cpu %d exit trace (%d entries)", cpu()->id, buf->count);
+    for (size_t i = 0; i < buf->count; i++) {
+        struct trace_entry* entry = &buf->entries[(first + i) % TRACE_BUF_SIZE];
+        console_printk("%s 0x%x info 0x%lx at %lu took %lu\n",
+            entry->type == TRACE_EXIT_IRQ ? "irq " : "sync", entry->reason,
+            (unsigned long)entry->info, (unsigned long)entry->timestamp,
+            (unsigned long)entry->duration);
+    }
+
+    buf->next = 0;
+    buf->count = 0;
+}
+
+long int trace_hypercall(unsigned long arg0, unsigned long arg1, unsigned long arg2)
+{
+    trace_dump();
+    return HC_E_SUCCESS;
+}
@@ -8,6 +8,40 @@
 #include <mem.h>
 #include <cache.h>
 #include <config.h>
+#include <prof.h>
+#include <boot_timing.h>
+#include <lz4.h>
+#include <vmm.h>
+#include <hypercall.h>
+#include <snapshot.h>
+#include <vm_info.h>
+#include <posted.h>
+#include <defer.h>
+#include <live_update.h>
+#include <grant.h>
+
+/**
+ * A vm is reset by its own cpus, as its structures are only mapped on those, while the other vms
+ * keep running. The requests are kept here so that any vm can request a reset, and concurrent
+ * requests for the same vm result in a single reset. The image is reinstalled from its load
+ * address, which only holds a pristine copy if the image was copied to the vm's memory, or from
+ * img_src, if a vm manager loaded a new one. Stopping a vm goes through the same requests.
+ */
+enum vm_img_copy { VM_IMG_KEPT, VM_IMG_COPIED, VM_IMG_SHARED };
+
+static struct vm_reset_req {
+    spinlock_t lock;
+    bool running;
+    bool pending;
+    bool stopped;
+    paddr_t img_src;
+    enum vm_img_copy img;
+} vm_reset_reqs[CONFIG_VM_NUM];
+
+enum { VM_MSG_RESET, VM_MSG_STOP };
+
+static void vm_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(vm_msg_handler, VM_CPUMSG_ID);
 
 static void vm_master_init(struct vm* vm, const struct vm_config* config, vmid_t vm_id)
 {
@@ -15,28 +49,37 @@ static void vm_master_init(struct vm* vm, const struct vm_config* config, vmid_t
     vm->config = config;
     vm->cpu_num = config->platform.cpu_num;
     vm->id = vm_id;
+    vm->img_install.size = 0;
+    for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+        vm->pcpu_to_vcpu[i] = INVALID_CPUID;
+    }
+    rwlock_init(&vm->emul_lock);
+    vm->emul_mem_num = 0;
+    vm->lazy.lock = SPINLOCK_INITVAL;
+    list_init(&vm->lazy.regions);
+    vm->lazy.pending = 0;
+    vm->dirty_log.lock = SPINLOCK_INITVAL;
+    vm->dirty_log.num_pages = 0;
+    vm->dirty_log.used = false;
+    vm->wss_unsupported = false;
+    vm->snapshot = NULL;
 
     cpu_sync_init(&vm->sync, vm->cpu_num);
 
     vm_mem_prot_init(vm, config);
+    vm_arena_init(vm);
 }
 
 void vm_cpu_init(struct vm* vm)
 {
     spin_lock(&vm->lock);
-    vm->cpus |= (1UL << cpu()->id);
+    cpumask_set(&vm->cpus, cpu()->id);
     spin_unlock(&vm->lock);
 }
 
 static vcpuid_t vm_calc_vcpu_id(struct vm* vm)
 {
-    vcpuid_t vcpu_id = 0;
-    for (size_t i = 0; i < cpu()->id; i++) {
-        if (!!bit_get(vm->cpus, i)) {
-            vcpu_id++;
-        }
-    }
-    return vcpu_id;
+    return (vcpuid_t)cpumask_weight_below(&vm->cpus, cpu()->id);
 }
 
 void vm_vcpu_init(struct vm* vm, const struct vm_config* config)
@@ -46,16 +89,84 @@ void vm_vcpu_init(struct vm* vm, const struct vm_config* config)
 
     vcpu->id = vcpu_id;
     vcpu->phys_id = cpu()->id;
+    vm->pcpu_to_vcpu[cpu()->id] = vcpu_id;
     vcpu->vm = vm;
+    vcpu->emul_mem_last = NULL;
+    vcpu->multicall.pa = 0;
+    vcpu->multicall.va = (vaddr_t)NULL;
+    vcpu->steal.ticks = 0;
+    vcpu->steal.record = NULL;
+    vcpu->info = NULL;
+    vcpu->restore = false;
+    vcpu->stopped = false;
+    vcpu->full_exits = config->snapshot;
     cpu()->vcpu = vcpu;
+    stats_vcpu_init(vm->id, vcpu->id);
 
     vcpu_arch_init(vcpu, vm);
     vcpu_arch_reset(vcpu, config->entry);
+
+    /* Partition id 0 is left to the hypervisor and the vms without a partition. */
+    if ((config->cache_ways != 0) && !cache_arch_partition(vm->id + 1, config->cache_ways)) {
+        WARNING("Cache way partitioning not supported for VM %d, ways ignored", vm->id);
+    }
+}
+
+__hot void vcpu_exit_end(struct vcpu_exit_stamp stamp)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    if (vcpu == NULL) {
+        return;
+    }
+
+    uint64_t standby = cpu()->standby.residency - stamp.standby;
+    uint64_t ticks = (timer_get() - stamp.time) - standby;
+    vcpu->steal.ticks += ticks;
+    /* What the exit's messages were not charged to is the vm's own */
+    stats_charge(vcpu->vm->id, ticks - (stats_cpus[cpu()->id].charged - stamp.charged));
+    if ((vcpu->steal.record != NULL) || (vcpu->info != NULL)) {
+        uint64_t steal_ns = timer_ticks_to_ns(vcpu->steal.ticks);
+        if (vcpu->steal.record != NULL) {
+            vcpu_arch_steal_update(vcpu, steal_ns);
+        }
+        if (vcpu->info != NULL) {
+            vm_info_steal_update(vcpu->info, steal_ns);
+        }
+    }
+}
+
+__attribute__((weak)) void vcpu_arch_hyp_maps_release(struct vcpu* vcpu)
+{
+    (void)vcpu;
+}
+
+__attribute__((weak)) void vcpu_arch_hyp_maps_restore(struct vcpu* vcpu)
+{
+    (void)vcpu;
+}
+
+/**
+ * The multicall page is translated again on its next use, so only its mapping is dropped. Must
+ * run on the vcpu's cpu, which the mappings are private to.
+ */
+void vcpu_hyp_maps_release(struct vcpu* vcpu)
+{
+    if (vcpu->multicall.va != (vaddr_t)NULL) {
+        mem_unmap(&cpu()->as, vcpu->multicall.va, 1, false);
+        vcpu->multicall.va = (vaddr_t)NULL;
+    }
+    vcpu_arch_hyp_maps_release(vcpu);
+}
+
+void vcpu_hyp_maps_restore(struct vcpu* vcpu)
+{
+    vcpu_arch_hyp_maps_restore(vcpu);
 }
 
 void vm_map_mem_region(struct vm* vm, struct vm_mem_region* reg)
 {
     size_t n = NUM_PAGES(reg->size);
+    mem_flags_t flags = mem_vm_flags(reg->cacheability);
 
     struct ppages pa_reg;
     struct ppages* pa_ptr = NULL;
@@ -67,10 +178,12 @@ void vm_map_mem_region(struct vm* vm, struct vm_mem_region* reg)
         pa_ptr = NULL;
     }
 
-    vaddr_t va = mem_alloc_map(&vm->as, SEC_VM_ANY, pa_ptr, (vaddr_t)reg->base, n, PTE_VM_FLAGS);
+    vaddr_t va = mem_alloc_map(&vm->as, SEC_VM_ANY, pa_ptr, (vaddr_t)reg->base, n, flags);
     if (va != (vaddr_t)reg->base) {
         ERROR("failed to allocate vm's region at 0x%lx", reg->base);
     }
+
+    mem_map_report(&vm->as, va, n);
 }
 
 static void vm_map_img_rgn_inplace(struct vm* vm, const struct vm_config* config,
@@ -84,22 +197,163 @@ static void vm_map_img_rgn_inplace(struct vm* vm, const struct vm_config* config
     size_t n_aft = NUM_PAGES((reg->base + reg->size) - (img_base + img_size));
     /* mem region pages for img */
     size_t n_img = NUM_PAGES(img_size);
+    mem_flags_t flags = mem_vm_flags(reg->cacheability);
 
     /* map img in place */
     struct ppages pa_img = mem_ppages_get(config->image.load_addr, n_img);
 
-    mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, (vaddr_t)reg->base, n_before, PTE_VM_FLAGS);
+    mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, (vaddr_t)reg->base, n_before, flags);
     if (all_clrs(vm->as.colors)) {
         /* map img in place */
-        mem_alloc_map(&vm->as, SEC_VM_ANY, &pa_img, img_base, n_img, PTE_VM_FLAGS);
+        mem_alloc_map(&vm->as, SEC_VM_ANY, &pa_img, img_base, n_img, flags);
         /* we are mapping in place, config is already reserved */
     } else {
         /* recolour img */
-        mem_map_reclr(&vm->as, img_base, &pa_img, n_img, PTE_VM_FLAGS);
+        mem_map_reclr(&vm->as, img_base, &pa_img, n_img, flags);
     }
     /* map pages after img */
     mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, img_base + NUM_PAGES(img_size) * PAGE_SIZE, n_aft,
-        PTE_VM_FLAGS);
+        flags);
+
+    mem_map_report(&vm->as, (vaddr_t)reg->base, NUM_PAGES(reg->size));
+}
+
+static void vm_install_image_map_pa(struct vm* vm, paddr_t src_pa, vaddr_t va, size_t size,
+    size_t src_size)
+{
+    size_t src_off = src_pa % PAGE_SIZE;
+    size_t dst_off = va % PAGE_SIZE;
+
+    vm->img_install.size = size;
+    vm->img_install.src_size = src_size;
+    vm->img_install.src_num_pages = NUM_PAGES(src_off + src_size);
+    vm->img_install.dst_num_pages = NUM_PAGES(dst_off + size);
+
+    struct ppages src_ppages = mem_ppages_get(src_pa - src_off, vm->img_install.src_num_pages);
+    vm->img_install.src_va = mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &src_ppages, INVALID_VA,
+                                 vm->img_install.src_num_pages, PTE_HYP_FLAGS) +
+        src_off;
+    vm->img_install.dst_va = mem_map_cpy(&vm->as, &cpu()->as, va - dst_off, INVALID_VA,
+                                 vm->img_install.dst_num_pages) +
+        dst_off;
+}
+
+static void vm_install_image_map(struct vm* vm, vaddr_t va, size_t size, size_t src_size)
+{
+    paddr_t src_pa = vm->config->image.load_addr + (va - vm->config->image.base_addr);
+    vm_install_image_map_pa(vm, src_pa, va, size, src_size);
+}
+
+static void vm_install_image_copy(struct vm* vm, size_t off, size_t size)
+{
+    memcpy((void*)(vm->img_install.dst_va + off), (void*)(vm->img_install.src_va + off), size);
+    cache_clean_range(vm->img_install.dst_va + off, size);
+}
+
+static void vm_install_image_unmap(struct vm* vm)
+{
+    mem_batch_begin(&cpu()->as);
+    mem_unmap(&cpu()->as, vm->img_install.src_va & ~(PAGE_SIZE - 1),
+        vm->img_install.src_num_pages, false);
+    mem_unmap(&cpu()->as, vm->img_install.dst_va & ~(PAGE_SIZE - 1),
+        vm->img_install.dst_num_pages, false);
+    mem_batch_end(&cpu()->as);
+    vm->img_install.size = 0;
+}
+
+static void vm_install_image_range(struct vm* vm, vaddr_t va, size_t size)
+{
+    vm_install_image_map(vm, va, size, size);
+    vm_install_image_copy(vm, 0, size);
+    vm_install_image_unmap(vm);
+}
+
+/**
+ * Each of the vm's cpus copies and flushes its own page aligned slice of the image mapped by the
+ * master. The windows live in the shared hypervisor section, so with an mmu they are visible to
+ * all cpus. With an mpu they would only be after handling the master's broadcasts, so there the
+ * master does the whole copy on its own.
+ */
+/**
+ * The lz4 tool fills all blocks of a frame but the last, so each block is decompressed to its own
+ * block_max_size slice of the image. As such, with independent blocks each of the vm's cpus takes
+ * every cpu_num-th block. Linked blocks reference the previous blocks' output, so the master
+ * decompresses those on its own, as it does with an mpu. Every cpu walks all the block headers to
+ * check the frame covers exactly the image.
+ */
+static void vm_install_image_inflate(struct vm* vm)
+{
+    uint8_t* dst = (uint8_t*)vm->img_install.dst_va;
+    size_t size = vm->img_install.size;
+    struct lz4_frame frame;
+
+    if (!lz4_frame_parse(&frame, (void*)vm->img_install.src_va, vm->img_install.src_size) ||
+        (frame.has_content_size && (frame.content_size != size))) {
+        ERROR("VM %d compressed image is not an LZ4 frame of the image size", vm->id);
+    }
+
+    bool parallel = DEFINED(MEM_PROT_MMU) && frame.independent;
+    if (!parallel && (cpu()->id != vm->master)) {
+        return;
+    }
+    size_t stride = parallel ? vm->cpu_num : 1;
+    size_t first = parallel ? cpu()->vcpu->id : 0;
+
+    const uint8_t* cursor = frame.blocks;
+    struct lz4_block block;
+    size_t block_num = 0;
+    while (lz4_frame_next_block(&frame, &cursor, &block)) {
+        size_t off = block_num * frame.block_max_size;
+        if (off >= size) {
+            ERROR("VM %d compressed image larger than the image size", vm->id);
+        }
+
+        if ((block_num % stride) == first) {
+            size_t dst_size = min(frame.block_max_size, size - off);
+            ssize_t n = lz4_block_decompress(&block, dst + off, dst_size,
+                frame.independent ? (dst + off) : dst);
+            if ((n < 0) || ((size_t)n != dst_size)) {
+                ERROR("VM %d compressed image block %d is corrupt", vm->id, block_num);
+            }
+            cache_clean_range((vaddr_t)(dst + off), dst_size);
+        }
+        block_num++;
+    }
+
+    if ((cursor == NULL) || ((block_num * frame.block_max_size) < size)) {
+        ERROR("VM %d compressed image is truncated", vm->id);
+    }
+}
+
+static void vm_install_image_slice(struct vm* vm)
+{
+    size_t size = vm->img_install.size;
+    if (size == 0) {
+        return;
+    }
+
+    if (vm->config->image.compressed_size != 0) {
+        vm_install_image_inflate(vm);
+        return;
+    }
+
+    if (!DEFINED(MEM_PROT_MMU)) {
+        if (cpu()->id == vm->master) {
+            vm_install_image_copy(vm, 0, size);
+        }
+        return;
+    }
+
+    /* slices end on page boundaries of the destination so no two cpus flush the same line */
+    size_t slice = ALIGN((size / vm->cpu_num) + 1, PAGE_SIZE);
+    size_t dst_off = vm->img_install.dst_va % PAGE_SIZE;
+    size_t beg = (cpu()->vcpu->id == 0) ? 0 : (cpu()->vcpu->id * slice) - dst_off;
+    size_t end = (cpu()->vcpu->id == (vm->cpu_num - 1)) ?
+        size :
+        min(((cpu()->vcpu->id + 1) * slice) - dst_off, size);
+    if (beg < end) {
+        vm_install_image_copy(vm, beg, end - beg);
+    }
 }
 
 static void vm_install_image(struct vm* vm, struct vm_mem_region* reg)
@@ -109,12 +363,19 @@ static void vm_install_image(struct vm* vm, struct vm_mem_region* reg)
         paddr_t img_load_pa = vm->config->image.load_addr;
         size_t img_sz = vm->config->image.size;
 
-        if (img_base == img_load_pa) {
+        if ((img_base == img_load_pa) && (vm->config->image.compressed_size == 0)) {
             // The image is already correctly installed. Our work is done.
+            vm_reset_reqs[vm->id].img = VM_IMG_KEPT;
+            return;
+        }
+
+        if (live_update_vm_resumed(vm)) {
+            // The vm's memory, image included, is kept as the previous hypervisor image left it.
             return;
         }
 
-        if (range_overlap_range(img_base, img_sz, img_load_pa, img_sz)) {
+        if (range_overlap_range(img_base, img_sz, img_load_pa,
+                config_vm_image_load_size(vm->config))) {
             // We impose an image load region cannot overlap its runtime region. This both
             // simplifies the copying procedure as well as avoids limitations of mpu-based memory
             // management which does not allow overlapping mappings on the same address space.
@@ -123,28 +384,212 @@ static void vm_install_image(struct vm* vm, struct vm_mem_region* reg)
         }
     }
 
-    size_t img_num_pages = NUM_PAGES(vm->config->image.size);
-    struct ppages img_ppages = mem_ppages_get(vm->config->image.load_addr, img_num_pages);
-    vaddr_t src_va = mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &img_ppages, INVALID_VA,
-        img_num_pages, PTE_HYP_FLAGS);
-    vaddr_t dst_va =
-        mem_map_cpy(&vm->as, &cpu()->as, vm->config->image.base_addr, INVALID_VA, img_num_pages);
-    memcpy((void*)dst_va, (void*)src_va, vm->config->image.size);
-    cache_flush_range((vaddr_t)dst_va, vm->config->image.size);
-    mem_unmap(&cpu()->as, src_va, img_num_pages, false);
-    mem_unmap(&cpu()->as, dst_va, img_num_pages, false);
+    vm_install_image_map(vm, vm->config->image.base_addr, vm->config->image.size,
+        config_vm_image_load_size(vm->config));
+}
+
+/* Whether no other vm loads its image from the same memory, e.g., by booting the same image */
+static bool vm_img_load_exclusive(const struct vm_config* vm_config)
+{
+    size_t load_size = config_vm_image_load_size(vm_config);
+
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        const struct vm_config* other = &config.vmlist[i];
+        if ((other != vm_config) &&
+            range_overlap_range(vm_config->image.load_addr, load_size, other->image.load_addr,
+                config_vm_image_load_size(other))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool vm_img_adoptable(const struct vm_config* config, struct vm_mem_region* reg)
+{
+    vaddr_t img_base = config->image.base_addr;
+    vaddr_t img_end = img_base + config->image.size;
+
+    /**
+     * The load pages can only back the region if they sit at the same page offset as the image
+     * runtime address. Only pages fully covered by the image are adopted, as the remainder of a
+     * partial page might belong to something else. The pages become the vm's own, so they are not
+     * adopted if another vm loads from them too. With an mpu, splitting the region would cost
+     * extra mpu entries, so the image is always copied.
+     */
+    return DEFINED(MEM_PROT_MMU) && !reg->place_phys && vm_img_load_exclusive(config) &&
+        (((img_base - config->image.load_addr) % PAGE_SIZE) == 0) &&
+        (ALIGN(img_base, PAGE_SIZE) < (img_end & ~(PAGE_SIZE - 1)));
+}
+
+static void vm_map_img_rgn_adopt(struct vm* vm, const struct vm_config* config,
+    struct vm_mem_region* reg)
+{
+    vaddr_t img_base = config->image.base_addr;
+    vaddr_t img_end = img_base + config->image.size;
+    vaddr_t adopt_base = ALIGN(img_base, PAGE_SIZE);
+    vaddr_t adopt_end = img_end & ~(PAGE_SIZE - 1);
+    size_t n_before = (adopt_base - reg->base) / PAGE_SIZE;
+    size_t n_adopt = (adopt_end - adopt_base) / PAGE_SIZE;
+    size_t n_aft = NUM_PAGES((reg->base + reg->size) - adopt_end);
+    mem_flags_t flags = mem_vm_flags(reg->cacheability);
+
+    struct ppages pa_img =
+        mem_ppages_get(config->image.load_addr + (adopt_base - img_base), n_adopt);
+
+    mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, (vaddr_t)reg->base, n_before, flags);
+    if (all_clrs(vm->as.colors)) {
+        mem_alloc_map(&vm->as, SEC_VM_ANY, &pa_img, adopt_base, n_adopt, flags);
+    } else {
+        /* only the pages outside the vm's colors end up being copied */
+        mem_map_reclr(&vm->as, adopt_base, &pa_img, n_adopt, flags);
+    }
+    mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, adopt_end, n_aft, flags);
+
+    mem_map_report(&vm->as, (vaddr_t)reg->base, NUM_PAGES(reg->size));
+
+    /* the partially covered head and tail pages are copied to the freshly allocated ones */
+    if (adopt_base > img_base) {
+        vm_install_image_range(vm, img_base, adopt_base - img_base);
+    }
+    if (img_end > adopt_end) {
+        vm_install_image_range(vm, adopt_end, img_end - adopt_end);
+    }
+}
+
+static bool vm_img_shareable(const struct vm_config* config, struct vm_mem_region* reg)
+{
+    vaddr_t img_base = config->image.base_addr;
+    vaddr_t shared_base = config->image.shared_ro.base;
+    size_t shared_size = config->image.shared_ro.size;
+
+    if (shared_size == 0) {
+        return false;
+    }
+
+    if (!DEFINED(MEM_PROT_MMU) || reg->place_phys || (config->image.compressed_size != 0) ||
+        (((shared_base | shared_size) % PAGE_SIZE) != 0) ||
+        (((img_base - config->image.load_addr) % PAGE_SIZE) != 0) ||
+        !range_in_range(shared_base, shared_size, img_base, config->image.size)) {
+        WARNING("VM image shared range can not be shared. Ignored.");
+        return false;
+    }
+
+    return true;
+}
+
+static void vm_install_image_unshared(struct vm* vm, const struct vm_config* config)
+{
+    vaddr_t img_base = config->image.base_addr;
+    vaddr_t img_end = img_base + config->image.size;
+    vaddr_t shared_base = config->image.shared_ro.base;
+    vaddr_t shared_end = shared_base + config->image.shared_ro.size;
+
+    if (shared_base > img_base) {
+        vm_install_image_range(vm, img_base, shared_base - img_base);
+    }
+    if (img_end > shared_end) {
+        vm_install_image_range(vm, shared_end, img_end - shared_end);
+    }
+}
+
+/**
+ * The rest of the region is freshly allocated, and the rest of the image copied to it, as the
+ * vm's private copy.
+ */
+static void vm_map_img_rgn_shared(struct vm* vm, const struct vm_config* config,
+    struct vm_mem_region* reg)
+{
+    vaddr_t img_base = config->image.base_addr;
+    vaddr_t shared_base = config->image.shared_ro.base;
+    vaddr_t shared_end = shared_base + config->image.shared_ro.size;
+    size_t n_before = NUM_PAGES(shared_base - reg->base);
+    size_t n_shared = config->image.shared_ro.size / PAGE_SIZE;
+    size_t n_aft = NUM_PAGES((reg->base + reg->size) - shared_end);
+    mem_flags_t flags = mem_vm_flags(reg->cacheability);
+
+    struct ppages pa_shared =
+        mem_ppages_get(config->image.load_addr + (shared_base - img_base), n_shared);
+
+    mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, (vaddr_t)reg->base, n_before, flags);
+    mem_alloc_map(&vm->as, SEC_VM_ANY, &pa_shared, shared_base, n_shared, PTE_VM_RO_FLAGS);
+    mem_alloc_map(&vm->as, SEC_VM_ANY, NULL, shared_end, n_aft, flags);
+
+    mem_map_report(&vm->as, (vaddr_t)reg->base, NUM_PAGES(reg->size));
+
+    vm_install_image_unshared(vm, config);
 }
 
 static void vm_map_img_rgn(struct vm* vm, const struct vm_config* config, struct vm_mem_region* reg)
 {
-    if (!reg->place_phys && config->image.inplace) {
+    struct vm_reset_req* req = &vm_reset_reqs[vm->id];
+
+    /* A compressed image always has to be decompressed to freshly mapped memory */
+    if (config->image.compressed_size != 0) {
+        req->img = VM_IMG_COPIED;
+        vm_map_mem_region(vm, reg);
+        vm_install_image(vm, reg);
+    } else if (vm_img_shareable(config, reg)) {
+        req->img = VM_IMG_SHARED;
+        vm_map_img_rgn_shared(vm, config, reg);
+    } else if (!reg->place_phys && config->image.inplace) {
+        req->img = VM_IMG_KEPT;
         vm_map_img_rgn_inplace(vm, config, reg);
+    } else if (vm_img_adoptable(config, reg)) {
+        req->img = VM_IMG_KEPT;
+        vm_map_img_rgn_adopt(vm, config, reg);
     } else {
+        req->img = VM_IMG_COPIED;
         vm_map_mem_region(vm, reg);
         vm_install_image(vm, reg);
     }
 }
 
+/**
+ * Colored regions are mapped page by page, which for large vms takes long enough to be worth
+ * sharing among the vm's cpus. The master only reserves these regions and builds their page tables
+ * down to the last level. Each cpu then allocates and maps the pages of its share of the last
+ * level tables.
+ */
+static bool vm_mem_region_shared_map(struct vm* vm, const struct vm_config* config,
+    struct vm_mem_region* reg)
+{
+    return DEFINED(MEM_PROT_MMU) && (vm->cpu_num > 1) && !reg->place_phys && !reg->lazy &&
+        !all_clrs(vm->as.colors) &&
+        !range_in_range(config->image.base_addr, config->image.size, reg->base, reg->size);
+}
+
+static void vm_map_mem_region_prepare(struct vm* vm, struct vm_mem_region* reg)
+{
+    size_t n = NUM_PAGES(reg->size);
+
+    vaddr_t va = mem_alloc_inflate(&vm->as, SEC_VM_ANY, (vaddr_t)reg->base, n);
+    if (va != (vaddr_t)reg->base) {
+        ERROR("failed to allocate vm's region at 0x%lx", reg->base);
+    }
+}
+
+static void vm_map_mem_region_shares(struct vm* vm, const struct vm_config* config)
+{
+    for (size_t i = 0; i < config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &config->platform.regions[i];
+        if (vm_mem_region_shared_map(vm, config, reg) &&
+            !mem_map_share(&vm->as, (vaddr_t)reg->base, NUM_PAGES(reg->size),
+                mem_vm_flags(reg->cacheability), cpu()->vcpu->id, vm->cpu_num)) {
+            ERROR("failed to map vm's region at 0x%lx", reg->base);
+        }
+    }
+}
+
+static void vm_report_mem_region_shares(struct vm* vm, const struct vm_config* config)
+{
+    for (size_t i = 0; i < config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &config->platform.regions[i];
+        if (vm_mem_region_shared_map(vm, config, reg)) {
+            mem_map_report(&vm->as, (vaddr_t)reg->base, NUM_PAGES(reg->size));
+        }
+    }
+}
+
 static void vm_init_mem_regions(struct vm* vm, const struct vm_config* config)
 {
     for (size_t i = 0; i < config->platform.region_num; i++) {
@@ -153,6 +598,10 @@ static void vm_init_mem_regions(struct vm* vm, const struct vm_config* config)
             range_in_range(config->image.base_addr, config->image.size, reg->base, reg->size);
         if (img_is_in_rgn) {
             vm_map_img_rgn(vm, config, reg);
+        } else if (reg->lazy && vm_map_mem_region_lazy(vm, reg)) {
+            continue;
+        } else if (vm_mem_region_shared_map(vm, config, reg)) {
+            vm_map_mem_region_prepare(vm, reg);
         } else {
             vm_map_mem_region(vm, reg);
         }
@@ -176,8 +625,17 @@ static void vm_init_ipc(struct vm* vm, const struct vm_config* config)
             WARNING("Trying to map region to smaller shared memory. Truncated");
         }
 
+        cpuid_t notify_cpu = vm_translate_to_pcpuid(vm, ipc->notify_vcpu);
+        if (notify_cpu == INVALID_CPUID) {
+            WARNING("Invalid ipc notification vcpu in configuration. Using vcpu 0.");
+            notify_cpu = vm_translate_to_pcpuid(vm, 0);
+        }
+
         spin_lock(&shmem->lock);
-        shmem->cpu_masters |= (1ULL << cpu()->id);
+        if (!cpumask_test(&shmem->notify_cpus, notify_cpu)) {
+            cpumask_set(&shmem->notify_cpus, notify_cpu);
+            shmem->notify_ipc[notify_cpu] = ipc;
+        }
         spin_unlock(&shmem->lock);
 
         struct vm_mem_region reg = {
@@ -186,9 +644,22 @@ static void vm_init_ipc(struct vm* vm, const struct vm_config* config)
             .place_phys = true,
             .phys = shmem->phys,
             .colors = shmem->colors,
+            .cacheability = shmem->cacheability,
         };
 
         vm_map_mem_region(vm, &reg);
+
+        if ((ipc->doorbell % PAGE_SIZE) != 0) {
+            WARNING("Ipc doorbell not page aligned. Ignored.");
+            ipc->doorbell = 0;
+        } else if (ipc->doorbell != 0) {
+            ipc->doorbell_emul = (struct emul_mem){
+                .va_base = ipc->doorbell,
+                .size = PAGE_SIZE,
+                .handler = ipc_doorbell_emul_handler,
+            };
+            vm_emul_add_mem(vm, &ipc->doorbell_emul);
+        }
     }
 }
 
@@ -219,6 +690,7 @@ static void vm_init_dev(struct vm* vm, const struct vm_config* config)
                 }
             }
         }
+        io_vm_commit(vm);
     }
 }
 
@@ -264,36 +736,405 @@ struct vm* vm_init(struct vm_allocation* vm_alloc, const struct vm_config* confi
     /**
      * Create the VM's address space according to configuration and where its image was loaded.
      */
+    uint64_t page_tables = boot_timing_begin();
     if (master) {
+        mem_batch_begin(&vm->as);
         vm_init_mem_regions(vm, config);
         vm_init_dev(vm, config);
         vm_init_ipc(vm, config);
+        remio_vm_init(vm, config);
+        vuart_vm_init(vm, config);
+        vm_info_vm_init(vm, config);
+        posted_vm_init(vm, config);
+        hypercall_queue_vm_init(vm, config);
+        mem_batch_end(&vm->as);
+    }
+
+    /**
+     * The colored regions left to the vm's cpus are mapped and the image, if it has to be copied,
+     * is installed by all the vm's cpus in parallel.
+     */
+    boot_timing_end(BOOT_PHASE_VM_PAGE_TABLES, page_tables);
+    cpu_sync_barrier(&vm->sync);
+    vm_info_vcpu_init(cpu()->vcpu);
+    posted_vcpu_init(cpu()->vcpu);
+    page_tables = boot_timing_begin();
+    vm_map_mem_region_shares(vm, config);
+    boot_timing_end(BOOT_PHASE_VM_PAGE_TABLES, page_tables);
+    uint64_t image_install = boot_timing_begin();
+    vm_install_image_slice(vm);
+    boot_timing_end(BOOT_PHASE_IMAGE_INSTALL, image_install);
+    cpu_sync_barrier(&vm->sync);
+    if (master) {
+        /* The final sync below publishes the frozen emulators to all the vm's cpus */
+        rwlock_freeze(&vm->emul_lock);
+        vm_report_mem_region_shares(vm, config);
+        if (vm->img_install.size > 0) {
+            image_install = boot_timing_begin();
+            vm_install_image_unmap(vm);
+            boot_timing_end(BOOT_PHASE_IMAGE_INSTALL, image_install);
+        }
     }
 
     cpu_sync_and_clear_msgs(&vm->sync);
 
+    live_update_vm_resume(vm);
+
+    /**
+     * Resets and snapshots are only accepted once no barrier of the vm's initialization handles
+     * messages.
+     */
+    if (master) {
+        snapshot_vm_init(vm);
+        spin_lock(&vm_reset_reqs[vm_id].lock);
+        vm_reset_reqs[vm_id].running = true;
+        spin_unlock(&vm_reset_reqs[vm_id].lock);
+    }
+
     return vm;
 }
 
+static void vm_reset_image(struct vm* vm)
+{
+    const struct vm_config* config = vm->config;
+    bool master = (cpu()->id == vm->master);
+
+    if (master) {
+        if (vm_reset_reqs[vm->id].img_src != 0) {
+            vm_install_image_map_pa(vm, vm_reset_reqs[vm->id].img_src, config->image.base_addr,
+                config->image.size, config->image.size);
+        } else if (vm_reset_reqs[vm->id].img == VM_IMG_SHARED) {
+            vm_install_image_unshared(vm, config);
+        } else {
+            vm_install_image_map(vm, config->image.base_addr, config->image.size,
+                config_vm_image_load_size(config));
+        }
+    }
+
+    cpu_sync_barrier(&vm->sync);
+    vm_install_image_slice(vm);
+    cpu_sync_barrier(&vm->sync);
+
+    if (master && (vm->img_install.size > 0)) {
+        vm_install_image_unmap(vm);
+    }
+}
+
+/**
+ * The reset runs on all of the vm's cpus at once, with its stage 2 translation left as is. The
+ * master resets the virtual interrupt controller's shared state and each cpu that of its own vcpu,
+ * along with the vcpu's power state, so only the first vcpu is restarted at the vm's entry. The
+ * vcpus' registers are only reset once their cpus are done handling the current exception, see
+ * vcpu_check_restart. The vm's memory is not cleared, as on a board reset, and its devices are left
+ * to the guest's drivers. Its grants are released first, so that no other vm keeps access to the
+ * memory the reinstalled image goes to.
+ */
+static void vm_reset_handler(struct vm* vm)
+{
+    cpu_sync_barrier(&vm->sync);
+
+    if (cpu()->id == vm->master) {
+        grant_vm_release(vm);
+        vm_arch_reset(vm);
+    }
+    vcpu_hyp_maps_release(cpu()->vcpu);
+    vm_reset_image(vm);
+    vcpu_arch_vm_reset(cpu()->vcpu);
+    cpu()->vcpu->stopped = false;
+    cpu()->vcpu->restart = true;
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (cpu()->id == vm->master) {
+        INFO("VM %d reset", vm->id);
+        spin_lock(&vm_reset_reqs[vm->id].lock);
+        vm_reset_reqs[vm->id].pending = false;
+        vm_reset_reqs[vm->id].stopped = false;
+        vm_reset_reqs[vm->id].img_src = 0;
+        spin_unlock(&vm_reset_reqs[vm->id].lock);
+    }
+}
+
+/**
+ * Once all of the vm's cpus are done with the current exception, they idle instead of returning to
+ * the guest, see vcpu_check_restart, only handling messages and the hypervisor's own interrupts.
+ * The vm's interrupts are disabled and deactivated in the physical interrupt controller, as on a
+ * reset, and its vcpus' own sources quieted, so that none keeps waking the idle cpus. Their state
+ * is lost, the vm only running again once reset. Its grants are released as on a reset.
+ */
+static void vm_stop_handler(struct vm* vm)
+{
+    cpu_sync_barrier(&vm->sync);
+
+    if (cpu()->id == vm->master) {
+        grant_vm_release(vm);
+        vm_arch_reset(vm);
+    }
+
+    cpu_sync_barrier(&vm->sync);
+
+    vcpu_arch_stop(cpu()->vcpu);
+    cpu()->vcpu->stopped = true;
+
+    cpu_sync_barrier(&vm->sync);
+
+    if (cpu()->id == vm->master) {
+        INFO("VM %d stopped", vm->id);
+        spin_lock(&vm_reset_reqs[vm->id].lock);
+        vm_reset_reqs[vm->id].pending = false;
+        vm_reset_reqs[vm->id].stopped = true;
+        spin_unlock(&vm_reset_reqs[vm->id].lock);
+    }
+}
+
+static void vm_msg_handler(uint32_t event, uint64_t data)
+{
+    if ((data < CONFIG_VM_NUM) && (cpu()->vcpu != NULL) && (cpu()->vcpu->vm->id == data)) {
+        switch (event) {
+            case VM_MSG_RESET:
+                vm_reset_handler(cpu()->vcpu->vm);
+                break;
+            case VM_MSG_STOP:
+                vm_stop_handler(cpu()->vcpu->vm);
+                break;
+        }
+    }
+}
+
+/**
+ * Requests the reset of a vm, which is carried out asynchronously by the vm's cpus, including the
+ * requester's if it is one of them. Fails if the vm's image can not be reinstalled, i.e., if the
+ * vm runs its image or part of it from the load address.
+ */
+bool vm_reset(vmid_t vm_id)
+{
+    if (vm_id >= CONFIG_VM_NUM) {
+        return false;
+    }
+
+    struct vm_reset_req* req = &vm_reset_reqs[vm_id];
+    bool send = false;
+
+    spin_lock(&req->lock);
+    if (!req->running || (req->img == VM_IMG_KEPT)) {
+        spin_unlock(&req->lock);
+        return false;
+    }
+    if (!req->pending) {
+        req->pending = true;
+        send = true;
+    }
+    spin_unlock(&req->lock);
+
+    if (send) {
+        struct cpu_msg msg = { (uint32_t)VM_CPUMSG_ID, VM_MSG_RESET, vm_id };
+        cpu_send_msg_mask(vmm_vm_cpus(vm_id), &msg);
+    }
+
+    return true;
+}
+
+/**
+ * HC_VM_CTL(op, vm_id, arg) lets a vm manager stop another vm and start it again, optionally from
+ * a new image, without touching the other vms. HC_VM_CTL_STATUS returns whether the vm is running,
+ * stopped or has an operation pending, which the others are carried out asynchronously by the vm's
+ * cpus, failing while one is. HC_VM_CTL_STOP stops the vm. HC_VM_CTL_START resets a stopped vm
+ * with its pristine image, as does a reset, failing if it has none. HC_VM_CTL_LOAD does the same
+ * with the new image at the manager's address arg instead. It takes the size of the vm's image,
+ * must be physically contiguous and left untouched until the operation is no longer pending. Vms
+ * with a compressed or a partly shared image can not be loaded.
+ *
+ * The vm keeps its memory, cpus, devices and interrupts while stopped, as the vms and what they
+ * are assigned are fixed by the config, but its interrupts are masked and its grants released.
+ */
+long int vm_ctl_hypercall(unsigned long op, unsigned long vm_id, unsigned long arg)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+
+    if (!vm->config->vm_manager || (vm_id >= CONFIG_VM_NUM) || (vm_id == vm->id)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    const struct vm_config* vm_config = &config.vmlist[vm_id];
+    paddr_t img_src = 0;
+    if (op == HC_VM_CTL_LOAD) {
+        size_t size = vm_config->image.size;
+        if ((vm_config->image.compressed_size != 0) ||
+            (mem_translate_range(&vm->as, arg, size, &img_src) < size) ||
+            !platform_is_mem_range(img_src, size)) {
+            return -HC_E_INVAL_ARGS;
+        }
+    }
+
+    struct vm_reset_req* req = &vm_reset_reqs[vm_id];
+    struct cpu_msg msg = { (uint32_t)VM_CPUMSG_ID, VM_MSG_RESET, vm_id };
+    long int ret = HC_E_SUCCESS;
+
+    spin_lock(&req->lock);
+    bool idle = req->running && !req->pending;
+    switch (op) {
+        case HC_VM_CTL_STATUS:
+            ret = !idle        ? HC_VM_CTL_PENDING :
+                  req->stopped ? HC_VM_CTL_STOPPED :
+                                 HC_VM_CTL_RUNNING;
+            break;
+        case HC_VM_CTL_STOP:
+            msg.event = VM_MSG_STOP;
+            ret = (idle && !req->stopped) ? HC_E_SUCCESS : -HC_E_FAILURE;
+            break;
+        case HC_VM_CTL_START:
+            ret = (idle && req->stopped && (req->img != VM_IMG_KEPT)) ? HC_E_SUCCESS :
+                                                                         -HC_E_FAILURE;
+            break;
+        case HC_VM_CTL_LOAD:
+            ret = (idle && req->stopped && (req->img != VM_IMG_SHARED)) ? HC_E_SUCCESS :
+                                                                           -HC_E_FAILURE;
+            req->img_src = (ret == HC_E_SUCCESS) ? img_src : req->img_src;
+            break;
+        default:
+            ret = -HC_E_INVAL_ARGS;
+    }
+    bool send = (op != HC_VM_CTL_STATUS) && (ret == HC_E_SUCCESS);
+    req->pending = req->pending || send;
+    spin_unlock(&req->lock);
+
+    if (send) {
+        cpu_send_msg_mask(vmm_vm_cpus(vm_id), &msg);
+    }
+
+    return ret;
+}
+
+/**
+ * HC_IPI(vcpu_mask, mask_base, ipi_id) raises an ipi on every vcpu of the caller's vm set in
+ * vcpu_mask, shifted by mask_base, or on all of them if mask_base is -1. Unlike the emulated ipi
+ * interfaces, which take an exit per target cluster, all targets are reached in a single exit and
+ * a single cpu message multicast. ipi_id selects the arch's ipi, e.g. an sgi. The caller may be
+ * among the targets.
+ */
+long int vm_ipi_hypercall(unsigned long vcpu_mask, unsigned long mask_base, unsigned long ipi_id)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    cpumask_t pcpu_mask = CPUMASK_EMPTY;
+
+    if (mask_base == (unsigned long)-1) {
+        pcpu_mask = vm->cpus;
+    } else if (mask_base < vm_cpu_num(vm)) {
+        pcpu_mask = vm_translate_to_pcpu_mask(vm, vcpu_mask << mask_base, vm_cpu_num(vm));
+    } else {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if (!vcpu_arch_send_ipi(cpu()->vcpu, pcpu_mask, ipi_id)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    return HC_E_SUCCESS;
+}
+
+static int vm_emul_mem_cmp(node_t* _n1, node_t* _n2)
+{
+    struct emul_mem* n1 = (struct emul_mem*)_n1;
+    struct emul_mem* n2 = (struct emul_mem*)_n2;
+    if (n1->va_base > n2->va_base) {
+        return 1;
+    } else if (n1->va_base < n2->va_base) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
 void vm_emul_add_mem(struct vm* vm, struct emul_mem* emu)
 {
-    list_push(&vm->emul_mem_list, &emu->node);
+    write_lock(&vm->emul_lock);
+    emu->id = vm->emul_mem_num++;
+    list_insert_ordered(&vm->emul_mem_list, &emu->node, vm_emul_mem_cmp);
+    write_unlock(&vm->emul_lock);
+}
+
+/**
+ * Backs the page at va of an emulated region with a page of hypervisor memory the vm can only
+ * read, so that reads of the read only registers it holds do not trap. Writes still fault into
+ * the region's handler. A NULL page allocates a zeroed one, otherwise the given page is shared.
+ * Returns the hypervisor's mapping of the page, for the emulator to fill in and keep up to date,
+ * or NULL if the page must keep being emulated. That is the case on mpu-based platforms, as each
+ * shadow page would cost a region.
+ */
+void* vm_emul_add_shadow(struct vm* vm, vaddr_t va, void* page)
+{
+    if (!DEFINED(MEM_PROT_MMU) || (va % PAGE_SIZE) != 0) {
+        return NULL;
+    }
+
+    if (page == NULL) {
+        page = mem_alloc_page(1, SEC_HYP_GLOBAL, false);
+        if (page == NULL) {
+            return NULL;
+        }
+        memset(page, 0, PAGE_SIZE);
+    }
+
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, (vaddr_t)page, &pa);
+    struct ppages ppages = mem_ppages_get(pa, 1);
+    if (mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, va, 1, PTE_VM_RO_FLAGS) != va) {
+        return NULL;
+    }
+
+    return page;
+}
+
+static inline size_t vm_emul_reg_hash(vaddr_t addr)
+{
+    /* Fold the encoded register address so registers of the same group land on distinct slots */
+    return ((addr >> 1) ^ (addr >> 10) ^ (addr >> 17)) % VM_EMUL_REG_TABLE_SIZE;
 }
 
 void vm_emul_add_reg(struct vm* vm, struct emul_reg* emu)
 {
-    list_push(&vm->emul_reg_list, &emu->node);
+    struct emul_reg** slot = &vm->emul_reg_table[vm_emul_reg_hash(emu->addr)];
+    write_lock(&vm->emul_lock);
+    if (*slot == NULL) {
+        *slot = emu;
+    } else {
+        list_push(&vm->emul_reg_list, &emu->node);
+    }
+    write_unlock(&vm->emul_lock);
+}
+
+static inline bool vm_emul_mem_contains(struct emul_mem* emu, vaddr_t addr)
+{
+    return (addr >= emu->va_base) && (addr < (emu->va_base + emu->size));
 }
 
 emul_handler_t vm_emul_get_mem(struct vm* vm, vaddr_t addr)
 {
+    PROF_SCOPE(PROF_VM_EMUL_GET_MEM);
+
+    /**
+     * Guests tend to repeatedly access the same device, so first try the emulator last hit by this
+     * vcpu. Otherwise, the list is sorted by base address and the walk stops once past addr.
+     */
+    struct vcpu* vcpu = cpu()->vcpu;
+    if (vcpu->emul_mem_last != NULL && vm_emul_mem_contains(vcpu->emul_mem_last, addr)) {
+        stats_mmio_trap(vcpu->emul_mem_last->id);
+        return vcpu->emul_mem_last->handler;
+    }
+
     emul_handler_t handler = NULL;
+    read_lock(&vm->emul_lock);
     list_foreach (vm->emul_mem_list, struct emul_mem, emu) {
-        if (addr >= emu->va_base && (addr < (emu->va_base + emu->size))) {
+        if (addr < emu->va_base) {
+            break;
+        } else if (vm_emul_mem_contains(emu, addr)) {
+            vcpu->emul_mem_last = emu;
             handler = emu->handler;
+            stats_mmio_trap(emu->id);
             break;
         }
     }
+    read_unlock(&vm->emul_lock);
 
     return handler;
 }
@@ -301,52 +1142,101 @@ emul_handler_t vm_emul_get_mem(struct vm* vm, vaddr_t addr)
 emul_handler_t vm_emul_get_reg(struct vm* vm, vaddr_t addr)
 {
     emul_handler_t handler = NULL;
-    list_foreach (vm->emul_reg_list, struct emul_reg, emu) {
-        if (emu->addr == addr) {
-            handler = emu->handler;
-            break;
+    read_lock(&vm->emul_lock);
+    struct emul_reg* slot = vm->emul_reg_table[vm_emul_reg_hash(addr)];
+    if (slot != NULL && slot->addr == addr) {
+        handler = slot->handler;
+    } else {
+        /* Only emulators colliding with an already occupied slot are kept in the list */
+        list_foreach (vm->emul_reg_list, struct emul_reg, emu) {
+            if (emu->addr == addr) {
+                handler = emu->handler;
+                break;
+            }
         }
     }
+    read_unlock(&vm->emul_lock);
 
     return handler;
 }
 
 void vm_msg_broadcast(struct vm* vm, struct cpu_msg* msg)
 {
-    for (size_t i = 0, n = 0; n < vm->cpu_num - 1; i++) {
-        if (((1U << i) & vm->cpus) && (i != cpu()->id)) {
-            n++;
-            cpu_send_msg(i, msg);
-        }
-    }
+    cpumask_t cpus = vm->cpus;
+    cpumask_clear(&cpus, cpu()->id);
+    cpu_send_msg_mask(&cpus, msg);
 }
 
-__attribute__((weak)) cpumap_t vm_translate_to_pcpu_mask(struct vm* vm, cpumap_t mask, size_t len)
+/**
+ * Mask translations only visit the mask's set bits, looking each one up in the vcpus' physical ids
+ * or in pcpu_to_vcpu, so the common single target ipi costs a single lookup.
+ */
+__attribute__((weak)) cpumask_t vm_translate_to_pcpu_mask(struct vm* vm, cpumap_t mask,
+    size_t len)
 {
-    cpumap_t pmask = 0;
-    cpuid_t shift;
-    for (size_t i = 0; i < len; i++) {
-        if ((mask & (1ULL << i)) && ((shift = vm_translate_to_pcpuid(vm, i)) != INVALID_CPUID)) {
-            pmask |= (1ULL << shift);
-        }
+    cpumask_t pmask = CPUMASK_EMPTY;
+
+    len = min(len, vm_cpu_num(vm));
+    if (len < (sizeof(mask) * 8)) {
+        mask &= (1UL << len) - 1;
+    }
+
+    while (mask != 0) {
+        vcpuid_t vcpuid = bit_ctz(mask);
+        mask = bit_clear(mask, vcpuid);
+        cpumask_set(&pmask, vm->vcpus[vcpuid].phys_id);
     }
+
     return pmask;
 }
 
-__attribute__((weak)) cpumap_t vm_translate_to_vcpu_mask(struct vm* vm, cpumap_t mask, size_t len)
+__attribute__((weak)) cpumap_t vm_translate_to_vcpu_mask(struct vm* vm, const cpumask_t* mask)
 {
-    cpumap_t pmask = 0;
-    vcpuid_t shift;
-    for (size_t i = 0; i < len; i++) {
-        if ((mask & (1ULL << i)) && ((shift = vm_translate_to_vcpuid(vm, i)) != INVALID_CPUID)) {
-            pmask |= (1ULL << shift);
+    cpumap_t vmask = 0;
+    cpumask_t pmask;
+
+    cpumask_and(&pmask, mask, &vm->cpus);
+    cpumask_foreach (&pmask, pcpu) {
+        vcpuid_t vcpuid = vm->pcpu_to_vcpu[pcpu];
+        if (vcpuid < (sizeof(vmask) * 8)) {
+            vmask |= (1UL << vcpuid);
         }
     }
-    return pmask;
+
+    return vmask;
 }
 
 void vcpu_run(struct vcpu* vcpu)
 {
+    defer_run();
+    hypercall_queue_poll();
     cpu()->vcpu->active = true;
     vcpu_arch_run(vcpu);
 }
+
+/**
+ * Called at the end of the arch's exception handlers, so that a vcpu reset or restored while its
+ * cpu handles an exception neither gets the handler's results written to its fresh registers nor
+ * leaves the exception, e.g. the physical interrupt that brought the message, unfinished. A reset
+ * takes precedence over a restore. Being on every path back to the guest, it also runs the cpu's
+ * deferred work and the requests on the vm's hypercall queue, which might restart the vcpu.
+ */
+void vcpu_check_restart(void)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    defer_run();
+
+    if ((vcpu != NULL) && vcpu->stopped && !vcpu->restart) {
+        cpu_idle();
+    } else if ((vcpu != NULL) && vcpu->restart) {
+        vcpu->restart = false;
+        vcpu->restore = false;
+        vcpu_arch_reset(vcpu, vcpu->vm->config->entry);
+        vcpu_run(vcpu);
+    } else if ((vcpu != NULL) && vcpu->restore) {
+        vcpu->restore = false;
+        vcpu->regs = vcpu->vm->snapshot->vcpus[vcpu->id].regs;
+        vcpu_run(vcpu);
+    }
+}
@@ -0,0 +1,100 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <vm.h>
+#include <mem.h>
+#include <cpu.h>
+
+struct vm_arena_chunk {
+    struct vm_arena_chunk* next;
+    size_t num_pages;
+};
+
+void vm_arena_init(struct vm* vm)
+{
+    vm->arena.lock = SPINLOCK_INITVAL;
+    vm->arena.chunks = NULL;
+    vm->arena.cur = 0;
+    vm->arena.left = 0;
+    vm->arena.num_pages = 0;
+}
+
+/**
+ * Called with the arena's lock held. The chunk's pages are taken in the vm's colors and placement,
+ * as only the vm's cpus use them.
+ */
+static struct vm_arena_chunk* vm_arena_grow(struct vm* vm, size_t num_pages)
+{
+    struct ppages ppages = mem_alloc_ppages_place(&vm->as.place, vm->as.colors, num_pages, false);
+    if (ppages.num_pages != num_pages) {
+        return NULL;
+    }
+
+    struct vm_arena_chunk* chunk = (struct vm_arena_chunk*)mem_alloc_map(&cpu()->as, SEC_HYP_VM,
+        &ppages, INVALID_VA, num_pages, PTE_HYP_FLAGS);
+    if (chunk == NULL) {
+        mem_free_ppages(&ppages);
+        return NULL;
+    }
+
+    chunk->next = vm->arena.chunks;
+    chunk->num_pages = num_pages;
+    vm->arena.chunks = chunk;
+    vm->arena.num_pages += num_pages;
+
+    return chunk;
+}
+
+void* vm_arena_alloc(struct vm* vm, size_t size)
+{
+    struct vm_arena* arena = &vm->arena;
+    size_t hdr_size = ALIGN(sizeof(struct vm_arena_chunk), VM_ARENA_ALIGN);
+    void* obj = NULL;
+
+    size = ALIGN(size, VM_ARENA_ALIGN);
+
+    spin_lock(&arena->lock);
+    if (size <= arena->left) {
+        obj = (void*)arena->cur;
+        arena->cur += size;
+        arena->left -= size;
+    } else {
+        /**
+         * Allocations larger than a chunk get one of their own, which leaves the current chunk's
+         * free space to the following ones.
+         */
+        size_t num_pages = NUM_PAGES(hdr_size + size);
+        bool own = num_pages > VM_ARENA_CHUNK_PAGES;
+        struct vm_arena_chunk* chunk = vm_arena_grow(vm, own ? num_pages : VM_ARENA_CHUNK_PAGES);
+        if (chunk != NULL) {
+            obj = (void*)((vaddr_t)chunk + hdr_size);
+            if (!own) {
+                arena->cur = (vaddr_t)obj + size;
+                arena->left = (VM_ARENA_CHUNK_PAGES * PAGE_SIZE) - hdr_size - size;
+            }
+        }
+    }
+    spin_unlock(&arena->lock);
+
+    return obj;
+}
+
+void vm_arena_release(struct vm* vm)
+{
+    struct vm_arena* arena = &vm->arena;
+
+    spin_lock(&arena->lock);
+    struct vm_arena_chunk* chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct vm_arena_chunk* next = chunk->next;
+        mem_unmap(&cpu()->as, (vaddr_t)chunk, chunk->num_pages, true);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->cur = 0;
+    arena->left = 0;
+    arena->num_pages = 0;
+    spin_unlock(&arena->lock);
+}
@@ -0,0 +1,135 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <vm_info.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <mem.h>
+#include <string.h>
+
+static uint64_t vm_info_features(const struct vm_config* config)
+{
+    uint64_t features = VM_INFO_FEAT_STEAL_TIME;
+
+    if (config->platform.vuart.base != 0) {
+        features |= VM_INFO_FEAT_VUART;
+    }
+    if (config->snapshot) {
+        features |= VM_INFO_FEAT_SNAPSHOT;
+    }
+    if (config->vm_manager) {
+        features |= VM_INFO_FEAT_VM_MANAGER;
+    }
+    if (config->trap_wfi) {
+        features |= VM_INFO_FEAT_TRAP_WFI;
+    }
+    if (config->platform.hc_queue_addr != 0) {
+        features |= VM_INFO_FEAT_HC_QUEUE;
+    }
+
+    return features;
+}
+
+static void vm_info_ipcs_init(struct vm_info* info, const struct vm_config* config)
+{
+    size_t ipc_num = config->platform.ipc_num;
+    if (ipc_num > VM_INFO_IPC_MAX) {
+        WARNING("Only the first %d ipcs are described in the info page", VM_INFO_IPC_MAX);
+        ipc_num = VM_INFO_IPC_MAX;
+    }
+
+    for (size_t i = 0; i < ipc_num; i++) {
+        struct ipc* ipc = &config->platform.ipcs[i];
+        struct vm_info_ipc* ipc_info = &info->ipcs[i];
+        size_t interrupt_num = ipc->interrupt_num;
+        if (interrupt_num > VM_INFO_IPC_INTERRUPTS_MAX) {
+            interrupt_num = VM_INFO_IPC_INTERRUPTS_MAX;
+        }
+
+        ipc_info->base = ipc->base;
+        ipc_info->size = ipc->size;
+        ipc_info->doorbell = ipc->doorbell;
+        ipc_info->shmem_id = (uint32_t)ipc->shmem_id;
+        ipc_info->interrupt_num = (uint32_t)interrupt_num;
+        for (size_t j = 0; j < interrupt_num; j++) {
+            ipc_info->interrupts[j] = (uint32_t)ipc->interrupts[j];
+        }
+    }
+
+    info->ipc_num = (uint32_t)ipc_num;
+}
+
+/**
+ * Run by the vm's master cpu while the vm's address space is set up, before any of its vcpus runs,
+ * so the pages need no sequence count updates.
+ */
+void vm_info_vm_init(struct vm* vm, const struct vm_config* config)
+{
+    vaddr_t addr = config->platform.info_addr;
+
+    vm->info = NULL;
+    if (addr == 0) {
+        return;
+    }
+
+    if ((addr % PAGE_SIZE) != 0) {
+        WARNING("VM %d info page not page aligned. Ignored.", vm->id);
+        return;
+    }
+
+    size_t vm_pages = NUM_PAGES(sizeof(struct vm_info));
+    size_t n = vm_pages + vm->cpu_num;
+    struct vm_info* info = mem_alloc_page(n, SEC_HYP_VM, false);
+    if (info == NULL) {
+        ERROR("failed to allocate vm info pages");
+    }
+    memset(info, 0, n * PAGE_SIZE);
+
+    info->magic = VM_INFO_MAGIC;
+    info->version = VM_INFO_VERSION;
+    info->vm_id = (uint32_t)vm->id;
+    info->cpu_num = (uint32_t)vm->cpu_num;
+    info->features = vm_info_features(config);
+    info->vcpu_info_off = vm_pages * PAGE_SIZE;
+    info->colors = vm->as.colors;
+    vm_info_ipcs_init(info, config);
+
+    paddr_t pa = 0;
+    mem_translate(&cpu()->as, (vaddr_t)info, &pa);
+    struct ppages ppages = mem_ppages_get(pa, n);
+    mem_alloc_map(&vm->as, SEC_VM_ANY, &ppages, addr, n, PTE_VM_RO_FLAGS);
+    vm->info = info;
+}
+
+void vm_info_vcpu_init(struct vcpu* vcpu)
+{
+    struct vm_info* info = vcpu->vm->info;
+
+    vcpu->info = NULL;
+    if (info == NULL) {
+        return;
+    }
+
+    struct vm_info_vcpu* vcpu_info =
+        (struct vm_info_vcpu*)((vaddr_t)info + info->vcpu_info_off + (vcpu->id * PAGE_SIZE));
+    vcpu_info->vcpu_id = (uint32_t)vcpu->id;
+    vcpu_info->pcpu_id = vcpu->phys_id;
+    vcpu_info->steal_ns = 0;
+    vcpu->info = vcpu_info;
+}
+
+void vm_info_update_colors(struct vm* vm)
+{
+    struct vm_info* info = vm->info;
+    if (info == NULL) {
+        return;
+    }
+
+    vm_info_write_begin(&info->seq);
+    info->colors = vm->as.colors;
+    vm_info_write_end(&info->seq);
+}
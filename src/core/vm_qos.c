@@ -0,0 +1,214 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <vm_qos.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <vmm.h>
+#include <mem.h>
+#include <config.h>
+#include <cache.h>
+#include <membw.h>
+#include <irq_limit.h>
+#include <recolor.h>
+#include <spinlock.h>
+#include <stats.h>
+
+/**
+ * The parameters are kept in global memory, as the vm's own is only mapped by its cpus. Each of
+ * the vm's cpus applies the per cpu ones from its message handler, which runs before the cpu next
+ * returns to the guest.
+ */
+struct vm_qos {
+    spinlock_t lock;
+    bool ready;
+    uint64_t params[VM_QOS_PARAM_NUM];
+};
+
+static struct vm_qos vm_qos[CONFIG_VM_NUM];
+
+enum { VM_QOS_APPLY };
+
+static void vm_qos_msg_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(vm_qos_msg_handler, VM_QOS_CPUMSG_ID);
+
+__attribute__((weak)) bool vm_qos_arch_partition(vmid_t vm_id, uint64_t cache_portions,
+    uint32_t mbw_max)
+{
+    (void)vm_id;
+    (void)cache_portions;
+    (void)mbw_max;
+    return false;
+}
+
+/* Called with the lock held, the parameters starting out as in the vm's config */
+static void vm_qos_ready(struct vm_qos* qos, const struct vm_config* config)
+{
+    if (qos->ready) {
+        return;
+    }
+
+    qos->params[VM_QOS_COLORS] = config->colors;
+    qos->params[VM_QOS_CACHE_WAYS] = config->cache_ways;
+    qos->params[VM_QOS_CACHE_PORTIONS] = config->qos.cache_portions;
+    qos->params[VM_QOS_MBW_MAX] = config->qos.mbw_max;
+    qos->params[VM_QOS_MEMBW_BUDGET] = config->membw.budget;
+    qos->params[VM_QOS_MEMBW_PERIOD_US] = config->membw.period_us;
+    qos->params[VM_QOS_IRQ_LIMIT_BUDGET] = config->irq_limit.budget;
+    qos->params[VM_QOS_IRQ_LIMIT_PERIOD_US] = config->irq_limit.period_us;
+    qos->ready = true;
+}
+
+static const enum stats_counter vm_qos_stats[VM_QOS_STAT_END - VM_QOS_PARAM_NUM] = {
+    [VM_QOS_STAT_MEMBW_THROTTLES - VM_QOS_PARAM_NUM] = STATS_MEMBW_THROTTLES,
+    [VM_QOS_STAT_MEMBW_THROTTLED_NS - VM_QOS_PARAM_NUM] = STATS_MEMBW_THROTTLED_NS,
+    [VM_QOS_STAT_IRQS_DEFERRED - VM_QOS_PARAM_NUM] = STATS_IRQS_DEFERRED,
+    [VM_QOS_STAT_IRQ_LIMIT_HITS - VM_QOS_PARAM_NUM] = STATS_IRQ_LIMIT_HITS,
+};
+
+void vm_qos_colors_update(vmid_t vm_id, colormap_t colors)
+{
+    struct vm_qos* qos = &vm_qos[vm_id];
+
+    spin_lock(&qos->lock);
+    vm_qos_ready(qos, &config.vmlist[vm_id]);
+    qos->params[VM_QOS_COLORS] = colors;
+    spin_unlock(&qos->lock);
+}
+
+static void vm_qos_apply(struct vm* vm)
+{
+    struct vm_qos* qos = &vm_qos[vm->id];
+
+    spin_lock(&qos->lock);
+    uint32_t ways = (uint32_t)qos->params[VM_QOS_CACHE_WAYS];
+    uint32_t membw_budget = (uint32_t)qos->params[VM_QOS_MEMBW_BUDGET];
+    uint32_t membw_period_us = (uint32_t)qos->params[VM_QOS_MEMBW_PERIOD_US];
+    uint32_t irq_budget = (uint32_t)qos->params[VM_QOS_IRQ_LIMIT_BUDGET];
+    uint32_t irq_period_us = (uint32_t)qos->params[VM_QOS_IRQ_LIMIT_PERIOD_US];
+    spin_unlock(&qos->lock);
+
+    if ((ways != 0) && !cache_arch_partition(vm->id + 1, ways)) {
+        WARNING("Cache way partitioning not supported for VM %d, ways ignored", vm->id);
+    }
+    if (!membw_vcpu_set(membw_budget, membw_period_us)) {
+        WARNING("Memory bandwidth regulation not supported on cpu %d, budget ignored", cpu()->id);
+    }
+    irq_limit_vcpu_set(irq_budget, irq_period_us);
+}
+
+static void vm_qos_msg_handler(uint32_t event, uint64_t data)
+{
+    if ((data < CONFIG_VM_NUM) && (cpu()->vcpu != NULL) && (cpu()->vcpu->vm->id == data)) {
+        switch (event) {
+            case VM_QOS_APPLY:
+                vm_qos_apply(cpu()->vcpu->vm);
+                break;
+        }
+    }
+}
+
+/* Memory bandwidth regulation is only set up on boot if some vm is regulated, see membw_init */
+static bool vm_qos_membw_regulated(void)
+{
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        if (config.vmlist[i].membw.budget != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool vm_qos_valid(unsigned long param, unsigned long value)
+{
+    switch (param) {
+        case VM_QOS_CACHE_WAYS:
+            return value != 0;
+        case VM_QOS_MBW_MAX:
+            return value <= 100;
+        case VM_QOS_MEMBW_BUDGET:
+            return (value <= UINT32_MAX) && ((value == 0) || vm_qos_membw_regulated());
+        case VM_QOS_MEMBW_PERIOD_US:
+        case VM_QOS_IRQ_LIMIT_BUDGET:
+        case VM_QOS_IRQ_LIMIT_PERIOD_US:
+            return value <= UINT32_MAX;
+        default:
+            return param < VM_QOS_PARAM_NUM;
+    }
+}
+
+/**
+ * Recoloring and repartitioning are done right away by the caller, the other parameters once the
+ * vm's cpus handle the message, which the call does not wait for. Recoloring records the new
+ * colors itself, see vm_qos_colors_update, so that they are also kept on HC_VM_RECOLOR.
+ */
+long int vm_qos_hypercall(unsigned long vm_id, unsigned long param, unsigned long value)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+    bool set = (param & VM_QOS_SET) != 0;
+    param &= ~VM_QOS_SET;
+
+    if ((vm_id >= CONFIG_VM_NUM) || (param >= VM_QOS_STAT_END) ||
+        (set && (param >= VM_QOS_PARAM_NUM))) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if (!vm->config->vm_manager) {
+        return -HC_E_FAILURE;
+    }
+
+    if (param >= VM_QOS_PARAM_NUM) {
+        return stats_hypercall(vm_id, ~0UL, vm_qos_stats[param - VM_QOS_PARAM_NUM]);
+    }
+
+    const struct vm_config* vm_config = &config.vmlist[vm_id];
+    struct vm_qos* qos = &vm_qos[vm_id];
+
+    spin_lock(&qos->lock);
+    vm_qos_ready(qos, vm_config);
+    uint64_t cur = qos->params[param];
+    spin_unlock(&qos->lock);
+
+    if (!set) {
+        return (long int)cur;
+    }
+
+    if (!vm_qos_valid(param, value)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    if (param == VM_QOS_COLORS) {
+        return recolor_hypercall(vm_id, value, 0);
+    }
+
+    long int ret = HC_E_SUCCESS;
+    if ((param == VM_QOS_CACHE_PORTIONS) || (param == VM_QOS_MBW_MAX)) {
+        spin_lock(&qos->lock);
+        uint64_t cache_portions =
+            (param == VM_QOS_CACHE_PORTIONS) ? value : qos->params[VM_QOS_CACHE_PORTIONS];
+        uint32_t mbw_max =
+            (uint32_t)((param == VM_QOS_MBW_MAX) ? value : qos->params[VM_QOS_MBW_MAX]);
+        spin_unlock(&qos->lock);
+        if (!vm_qos_arch_partition(vm_id, cache_portions, mbw_max)) {
+            ret = -HC_E_FAILURE;
+        }
+    }
+
+    if (ret != HC_E_SUCCESS) {
+        return ret;
+    }
+
+    spin_lock(&qos->lock);
+    qos->params[param] = value;
+    spin_unlock(&qos->lock);
+
+    if ((param != VM_QOS_CACHE_PORTIONS) && (param != VM_QOS_MBW_MAX)) {
+        struct cpu_msg msg = { (uint32_t)VM_QOS_CPUMSG_ID, VM_QOS_APPLY, vm_id };
+        cpu_send_msg_mask(vmm_vm_cpus(vm_id), &msg);
+    }
+
+    return HC_E_SUCCESS;
+}
@@ -7,40 +7,222 @@
 #include <vm.h>
 #include <config.h>
 #include <cpu.h>
+#include <platform.h>
+#include <cache.h>
 #include <spinlock.h>
 #include <fences.h>
 #include <string.h>
 #include <ipc.h>
+#include <remio.h>
+#include <vuart.h>
+#include <membw.h>
+#include <irq_limit.h>
+#include <boot_timing.h>
+#include <live_update.h>
 
 static struct vm_assignment {
     spinlock_t lock;
     bool master;
     size_t ncpus;
-    cpumap_t cpus;
+    cpumask_t cpus;
     struct vm_allocation vm_alloc;
     struct vm_install_info vm_install_info;
     volatile bool install_info_ready;
 } vm_assign[CONFIG_VM_NUM];
 
-static bool vmm_assign_vcpu(bool* master, vmid_t* vm_id)
+__attribute__((weak)) size_t platform_cpu_cluster(cpuid_t cpuid)
+{
+    return 0;
+}
+
+/**
+ * Chooses the cluster to host a vm's count unplaced vcpus: the one of the vm's first cpu if it
+ * already has any, otherwise the tightest cluster that still fits them all or, if none does, the
+ * one with the most free cpus.
+ */
+__init static size_t vmm_place_cluster(vmid_t vm_id, const cpumask_t* free, size_t count)
+{
+    if (!cpumask_empty(&vm_assign[vm_id].cpus)) {
+        return platform_cpu_cluster(cpumask_next(&vm_assign[vm_id].cpus, 0));
+    }
+
+    size_t best = 0;
+    size_t best_free = 0;
+    for (size_t cluster = 0; cluster < platform.cpu_num; cluster++) {
+        size_t cluster_free = 0;
+        cpumask_foreach(free, cpu) {
+            if (platform_cpu_cluster(cpu) == cluster) {
+                cluster_free++;
+            }
+        }
+
+        bool fits = cluster_free >= count;
+        bool best_fits = best_free >= count;
+        if ((cluster == 0) || (fits && (!best_fits || cluster_free < best_free)) ||
+            (!fits && !best_fits && cluster_free > best_free)) {
+            best = cluster;
+            best_free = cluster_free;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Places the cpus left without a vm after the affinity assignment. Every such cpu replays the same
+ * placement over the same state and keeps only its own outcome, so no further coordination is
+ * needed. The vms are served in order, each first from the free cpus of its chosen cluster and
+ * then from any other free cpus in id order. Returns the vm of the given cpu, or INVALID_VMID if
+ * it is left idle.
+ */
+__init static vmid_t vmm_place_cpu(cpuid_t cpuid)
+{
+    cpumask_t free = CPUMASK_EMPTY;
+    for (cpuid_t cpu = 0; cpu < platform.cpu_num; cpu++) {
+        cpumask_set(&free, cpu);
+    }
+    for (vmid_t i = 0; i < config.vmlist_size; i++) {
+        cpumask_andnot(&free, &free, &vm_assign[i].cpus);
+    }
+
+    for (vmid_t i = 0; i < config.vmlist_size && !cpumask_empty(&free); i++) {
+        size_t count = config.vmlist[i].platform.cpu_num - vm_assign[i].ncpus;
+        if (count == 0) {
+            continue;
+        }
+
+        cpumask_t placed = CPUMASK_EMPTY;
+        if (!config.vmlist[i].cpu_cluster_spread) {
+            size_t cluster = vmm_place_cluster(i, &free, count);
+            cpumask_foreach(&free, cpu) {
+                if (count > 0 && platform_cpu_cluster(cpu) == cluster) {
+                    cpumask_set(&placed, cpu);
+                    count--;
+                }
+            }
+            cpumask_andnot(&free, &free, &placed);
+        }
+
+        cpumask_foreach(&free, cpu) {
+            if (count > 0) {
+                cpumask_set(&placed, cpu);
+                count--;
+            }
+        }
+        cpumask_andnot(&free, &free, &placed);
+
+        if (cpumask_test(&placed, cpuid)) {
+            return i;
+        }
+    }
+
+    return INVALID_VMID;
+}
+
+__init static bool vmm_share_color_domain(const cpumask_t* a, const cpumask_t* b)
+{
+    cpumask_foreach(a, cpu_a) {
+        cpumask_foreach(b, cpu_b) {
+            if (cache_color_domain(cpu_a) == cache_color_domain(cpu_b)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * A shared memory whose colors overlap those of a vm not sharing it, within a cache the vms
+ * sharing it are also placed on, pollutes that vm's partition with their traffic.
+ */
+__init static void vmm_check_shmem_colors(void)
+{
+    for (size_t i = 0; i < config.shmemlist_size; i++) {
+        struct shmem* shmem = &config.shmemlist[i];
+        if (shmem->place_phys || all_clrs(shmem->colors & BIT_MASK(0, COLOR_NUM))) {
+            continue;
+        }
+
+        cpumask_t sharers = CPUMASK_EMPTY;
+        for (vmid_t j = 0; j < config.vmlist_size; j++) {
+            if (ipc_vm_shares_shmem(&config.vmlist[j], i)) {
+                cpumask_or(&sharers, &sharers, &vm_assign[j].cpus);
+            }
+        }
+
+        for (vmid_t j = 0; j < config.vmlist_size; j++) {
+            if (!ipc_vm_shares_shmem(&config.vmlist[j], i) &&
+                !all_clrs(config.vmlist[j].colors & BIT_MASK(0, COLOR_NUM)) &&
+                ((shmem->colors & config.vmlist[j].colors & BIT_MASK(0, COLOR_NUM)) != 0) &&
+                vmm_share_color_domain(&sharers, &vm_assign[j].cpus)) {
+                WARNING("Shared memory %d shares cache colors with VM %d, which does not use it",
+                    i, j);
+            }
+        }
+    }
+}
+
+/**
+ * Colors only partition the cache instance, i.e., the color domain, they are accessed from. Vms
+ * placed on different domains may thus reuse each others' colors and only those sharing a domain
+ * are checked for overlaps. Domains whose cache geometry differs from the master's, which the
+ * allocator colors memory by, are reported as their vms' colors do not match their cache sets.
+ * Dram banks are shared by all cpus, so bank colored vms are checked for overlaps wherever they
+ * are placed.
+ */
+__init static void vmm_check_colors(void)
+{
+    for (vmid_t i = 0; i < config.vmlist_size; i++) {
+        colormap_t colors = config.vmlist[i].colors;
+        cpumask_foreach(&vm_assign[i].cpus, cpu) {
+            struct cache_color_domain* domain = &cache_color_domains[cache_color_domain(cpu)];
+            if (!all_clrs(colors & BIT_MASK(0, COLOR_NUM)) &&
+                ((domain->num != COLOR_NUM) || (domain->size != COLOR_SIZE))) {
+                WARNING("VM %d colors do not match the cache geometry of cpu %d", i, cpu);
+                break;
+            }
+        }
+
+        for (vmid_t j = i + 1; j < config.vmlist_size; j++) {
+            colormap_t other = config.vmlist[j].colors;
+            colormap_t shared = colors & other;
+            if (!all_clrs(colors & BIT_MASK(0, COLOR_NUM)) &&
+                !all_clrs(other & BIT_MASK(0, COLOR_NUM)) &&
+                ((shared & BIT_MASK(0, COLOR_NUM)) != 0) &&
+                vmm_share_color_domain(&vm_assign[i].cpus, &vm_assign[j].cpus)) {
+                WARNING("VMs %d and %d share cache colors within a cache", i, j);
+            }
+            if (clrs_bank_colored(colors) && clrs_bank_colored(other) &&
+                (clrs_banks(shared) != 0)) {
+                WARNING("VMs %d and %d share dram banks", i, j);
+            }
+        }
+    }
+
+    vmm_check_shmem_colors();
+}
+
+__init static bool vmm_assign_vcpu(bool* master, vmid_t* vm_id)
 {
     bool assigned = false;
     *master = false;
     /* Assign cpus according to vm affinity. */
     for (size_t i = 0; i < config.vmlist_size && !assigned; i++) {
-        if (config.vmlist[i].cpu_affinity & (1UL << cpu()->id)) {
+        /* The configured affinity only covers the cpus within a cpumap_t */
+        if ((cpu()->id < (sizeof(cpumap_t) * 8)) &&
+            ((config.vmlist[i].cpu_affinity & (1UL << cpu()->id)) != 0)) {
             spin_lock(&vm_assign[i].lock);
             if (!vm_assign[i].master) {
                 vm_assign[i].master = true;
                 vm_assign[i].ncpus++;
-                vm_assign[i].cpus |= (1UL << cpu()->id);
+                cpumask_set(&vm_assign[i].cpus, cpu()->id);
                 *master = true;
                 assigned = true;
                 *vm_id = i;
             } else if (vm_assign[i].ncpus < config.vmlist[i].platform.cpu_num) {
                 assigned = true;
                 vm_assign[i].ncpus++;
-                vm_assign[i].cpus |= (1UL << cpu()->id);
+                cpumask_set(&vm_assign[i].cpus, cpu()->id);
                 *vm_id = i;
             }
             spin_unlock(&vm_assign[i].lock);
@@ -49,33 +231,44 @@ static bool vmm_assign_vcpu(bool* master, vmid_t* vm_id)
 
     cpu_sync_barrier(&cpu_glb_sync);
 
+    /**
+     * The placement of the remaining cpus is computed from the assignments above, which must not
+     * change until every cpu is done computing it.
+     */
+    vmid_t placed_vm = assigned ? *vm_id : vmm_place_cpu(cpu()->id);
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
     /* Assign remaining cpus not assigned by affinity. */
-    if (assigned == false) {
-        for (size_t i = 0; i < config.vmlist_size && !assigned; i++) {
-            spin_lock(&vm_assign[i].lock);
-            if (vm_assign[i].ncpus < config.vmlist[i].platform.cpu_num) {
-                if (!vm_assign[i].master) {
-                    vm_assign[i].master = true;
-                    vm_assign[i].ncpus++;
-                    *master = true;
-                    assigned = true;
-                    vm_assign[i].cpus |= (1UL << cpu()->id);
-                    *vm_id = i;
-                } else {
-                    assigned = true;
-                    vm_assign[i].ncpus++;
-                    vm_assign[i].cpus |= (1UL << cpu()->id);
-                    *vm_id = i;
-                }
-            }
-            spin_unlock(&vm_assign[i].lock);
+    if (!assigned && placed_vm < config.vmlist_size) {
+        spin_lock(&vm_assign[placed_vm].lock);
+        if (!vm_assign[placed_vm].master) {
+            vm_assign[placed_vm].master = true;
+            *master = true;
         }
+        vm_assign[placed_vm].ncpus++;
+        cpumask_set(&vm_assign[placed_vm].cpus, cpu()->id);
+        spin_unlock(&vm_assign[placed_vm].lock);
+        assigned = true;
+        *vm_id = placed_vm;
+    }
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    if (cpu_is_master()) {
+        vmm_check_colors();
     }
 
     return assigned;
 }
 
-static bool vmm_alloc_vm(struct vm_allocation* vm_alloc, struct vm_config* config)
+/* The physical cpus assigned to a vm, which are final once every cpu is past vmm_assign_vcpu */
+const cpumask_t* vmm_vm_cpus(vmid_t vm_id)
+{
+    return &vm_assign[vm_id].cpus;
+}
+
+__init static bool vmm_alloc_vm(struct vm_allocation* vm_alloc, struct vm_config* config)
 {
     /**
      * We know that we will allocate a block aligned to the PAGE_SIZE, which is guaranteed to
@@ -93,7 +286,7 @@ static bool vmm_alloc_vm(struct vm_allocation* vm_alloc, struct vm_config* confi
     if (allocation == NULL) {
         return false;
     }
-    memset((void*)allocation, 0, total_size);
+    mem_zero_pages(allocation, NUM_PAGES(total_size));
 
     vm_alloc->base = (vaddr_t)allocation;
     vm_alloc->size = total_size;
@@ -103,7 +296,7 @@ static bool vmm_alloc_vm(struct vm_allocation* vm_alloc, struct vm_config* confi
     return true;
 }
 
-static struct vm_allocation* vmm_alloc_install_vm(vmid_t vm_id, bool master)
+__init static struct vm_allocation* vmm_alloc_install_vm(vmid_t vm_id, bool master)
 {
     struct vm_allocation* vm_alloc = &vm_assign[vm_id].vm_alloc;
     struct vm_config* vm_config = &config.vmlist[vm_id];
@@ -123,11 +316,33 @@ static struct vm_allocation* vmm_alloc_install_vm(vmid_t vm_id, bool master)
     return vm_alloc;
 }
 
-void vmm_init()
+static spinlock_t vmm_boot_lock = SPINLOCK_INITVAL;
+static size_t vmm_boot_done = 0;
+
+/**
+ * The last cpu to be done booting reclaims the boot only code, so no vm waits for the others.
+ */
+static void vmm_boot_end(void)
+{
+    spin_lock(&vmm_boot_lock);
+    bool last = (++vmm_boot_done == platform.cpu_num);
+    spin_unlock(&vmm_boot_lock);
+
+    if (last) {
+        mem_reclaim_init();
+    }
+}
+
+__cold void vmm_init()
 {
     vmm_arch_init();
     vmm_io_init();
     ipc_init();
+    remio_init();
+    vuart_init();
+    if (cpu_is_master()) {
+        live_update_init();
+    }
 
     cpu_sync_barrier(&cpu_glb_sync);
 
@@ -138,8 +353,16 @@ void vmm_init()
         struct vm_config* vm_config = &config.vmlist[vm_id];
         struct vm* vm = vm_init(vm_alloc, vm_config, master, vm_id);
         cpu_sync_barrier(&vm->sync);
+        boot_timing_report();
+        membw_vcpu_init(cpu()->vcpu);
+        irq_limit_vcpu_init(cpu()->vcpu);
+        vm_mem_lazy_start(vm);
+        vm_mem_wss_start(vm);
+        vmm_boot_end();
         vcpu_run(cpu()->vcpu);
     } else {
+        boot_timing_report();
+        vmm_boot_end();
         cpu_idle();
     }
 }
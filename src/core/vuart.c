@@ -0,0 +1,321 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <vuart.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <console.h>
+#include <fences.h>
+
+enum {
+    VUART_RBR_THR = 0,
+    VUART_IER = 1,
+    VUART_IIR_FCR = 2,
+    VUART_LCR = 3,
+    VUART_MCR = 4,
+    VUART_LSR = 5,
+    VUART_MSR = 6,
+    VUART_SCR = 7,
+    VUART_REG_NUM = 8,
+};
+
+#define VUART_IER_MASK     (0x0f)
+#define VUART_IER_ETBEI    (1U << 1)
+#define VUART_IIR_NO_INT   (0x01)
+#define VUART_IIR_THRI     (0x02)
+#define VUART_IIR_FIFO_EN  (0xc0)
+#define VUART_FCR_EN       (1U << 0)
+#define VUART_LCR_DLAB     (1U << 7)
+#define VUART_LSR_THRE     (1U << 5)
+#define VUART_LSR_TEMT     (1U << 6)
+#define VUART_MSR_CTS      (1U << 4)
+#define VUART_MSR_DSR      (1U << 5)
+#define VUART_MSR_DCD      (1U << 7)
+
+static struct list vuart_list;
+static volatile bool vuart_list_ready = false;
+
+static size_t vuart_used(struct vuart* vuart, size_t wr)
+{
+    return (wr + VUART_RING_SIZE - vuart->head) % VUART_RING_SIZE;
+}
+
+static void vuart_publish(struct vuart* vuart)
+{
+    fence_ord_write();
+    vuart->tail = vuart->wr;
+}
+
+/**
+ * Called with the vuart's lock held. Complete lines, or half a ring, are published and written
+ * out from the cpu's deferred work, so the guest does not wait on the uart. Only when the ring is
+ * full does the vcpu wait for the console to drain it, as a cpu does with its own console ring.
+ */
+static void vuart_tx(struct vuart* vuart, char c)
+{
+    size_t next = (vuart->wr + 1) % VUART_RING_SIZE;
+    while (next == vuart->head) {
+        vuart_publish(vuart);
+        console_flush();
+    }
+
+    vuart->buf[vuart->wr] = c;
+    vuart->wr = next;
+
+    if ((c == '\n') || (vuart_used(vuart, vuart->wr) >= (VUART_RING_SIZE / 2))) {
+        vuart_publish(vuart);
+        console_kick();
+    }
+}
+
+/**
+ * The transmit interrupt is pending whenever the fifo is empty, i.e., after every write, until
+ * the guest reads it from the iir. It is only injected when it becomes pending, so a burst of
+ * writes, e.g. from the guest's interrupt handler, raises a single interrupt.
+ */
+static void vuart_thre_set(struct vuart* vuart)
+{
+    bool raise = !vuart->thre_pending && ((vuart->ier & VUART_IER_ETBEI) != 0);
+    vuart->thre_pending = true;
+    if (raise && (vuart->interrupt != 0)) {
+        vcpu_inject_irq(cpu()->vcpu, vuart->interrupt);
+    }
+}
+
+static uint8_t vuart_reg_read(struct vuart* vuart, size_t reg)
+{
+    uint8_t fifo = vuart->fifo_en ? VUART_IIR_FIFO_EN : 0;
+    bool dlab = (vuart->lcr & VUART_LCR_DLAB) != 0;
+    uint8_t value = 0;
+
+    switch (reg) {
+        case VUART_RBR_THR:
+            value = dlab ? vuart->dll : 0;
+            break;
+        case VUART_IER:
+            value = dlab ? vuart->dlm : vuart->ier;
+            break;
+        case VUART_IIR_FCR:
+            if (vuart->thre_pending && ((vuart->ier & VUART_IER_ETBEI) != 0)) {
+                vuart->thre_pending = false;
+                value = fifo | VUART_IIR_THRI;
+            } else {
+                value = fifo | VUART_IIR_NO_INT;
+            }
+            break;
+        case VUART_LCR:
+            value = vuart->lcr;
+            break;
+        case VUART_MCR:
+            value = vuart->mcr;
+            break;
+        case VUART_LSR:
+            value = VUART_LSR_THRE | VUART_LSR_TEMT;
+            break;
+        case VUART_MSR:
+            value = VUART_MSR_CTS | VUART_MSR_DSR | VUART_MSR_DCD;
+            break;
+        case VUART_SCR:
+            value = vuart->scr;
+            break;
+    }
+
+    return value;
+}
+
+static void vuart_reg_write(struct vuart* vuart, size_t reg, uint8_t value)
+{
+    bool dlab = (vuart->lcr & VUART_LCR_DLAB) != 0;
+
+    switch (reg) {
+        case VUART_RBR_THR:
+            if (dlab) {
+                vuart->dll = value;
+            } else {
+                vuart_tx(vuart, (char)value);
+                vuart_thre_set(vuart);
+            }
+            break;
+        case VUART_IER:
+            if (dlab) {
+                vuart->dlm = value;
+            } else {
+                bool etbei = (vuart->ier & VUART_IER_ETBEI) != 0;
+                vuart->ier = value & VUART_IER_MASK;
+                /* Enabling the transmit interrupt with the fifo empty raises it right away */
+                if (!etbei && ((vuart->ier & VUART_IER_ETBEI) != 0)) {
+                    vuart->thre_pending = false;
+                    vuart_thre_set(vuart);
+                }
+            }
+            break;
+        case VUART_IIR_FCR:
+            vuart->fifo_en = (value & VUART_FCR_EN) != 0;
+            break;
+        case VUART_LCR:
+            vuart->lcr = value;
+            break;
+        case VUART_MCR:
+            vuart->mcr = value;
+            break;
+        case VUART_SCR:
+            vuart->scr = value;
+            break;
+        default:
+            break;
+    }
+}
+
+static bool vuart_emul_handler(struct emul_access* acc)
+{
+    struct vuart* vuart = &cpu()->vcpu->vm->vuart;
+    size_t off = acc->addr - vuart->emul.va_base;
+
+    if ((off % vuart->reg_width) != 0) {
+        return false;
+    }
+
+    size_t reg = off / vuart->reg_width;
+
+    spin_lock(&vuart->lock);
+    if (acc->write) {
+        vuart_reg_write(vuart, reg, (uint8_t)vcpu_readreg(cpu()->vcpu, acc->reg));
+    } else {
+        vcpu_writereg(cpu()->vcpu, acc->reg, vuart_reg_read(vuart, reg));
+    }
+    spin_unlock(&vuart->lock);
+
+    return true;
+}
+
+static size_t vuart_fmt_prefix(char* buf, vmid_t id)
+{
+    char digits[8];
+    size_t n = 0;
+    size_t len = 0;
+
+    do {
+        digits[n++] = (char)('0' + (id % 10));
+        id /= 10;
+    } while ((id != 0) && (n < sizeof(digits)));
+
+    buf[len++] = '[';
+    buf[len++] = 'V';
+    buf[len++] = 'M';
+    while (n > 0) {
+        buf[len++] = digits[--n];
+    }
+    buf[len++] = ']';
+    buf[len++] = ' ';
+
+    return len;
+}
+
+void vuart_init(void)
+{
+    if (cpu_is_master()) {
+        list_init(&vuart_list);
+        fence_sync_write();
+        vuart_list_ready = true;
+    }
+}
+
+void vuart_vm_init(struct vm* vm, const struct vm_config* config)
+{
+    const struct vuart_config* vuart_config = &config->platform.vuart;
+    struct vuart* vuart = &vm->vuart;
+
+    if (vuart_config->base == 0) {
+        return;
+    }
+
+    vuart->reg_width = (vuart_config->reg_width == 0) ? 1 : vuart_config->reg_width;
+    if ((vuart->reg_width != 1) && (vuart->reg_width != 4)) {
+        WARNING("VM %d virtual uart register width %d not supported. Ignored.", vm->id,
+            vuart->reg_width);
+        return;
+    }
+
+    vuart->interrupt = vuart_config->interrupt;
+    vuart->prefix_len = vuart_fmt_prefix(vuart->prefix, vm->id);
+    vuart->lock = SPINLOCK_INITVAL;
+    vuart->wr = 0;
+    vuart->ier = 0;
+    vuart->lcr = 0;
+    vuart->mcr = 0;
+    vuart->scr = 0;
+    vuart->dll = 0;
+    vuart->dlm = 0;
+    vuart->fifo_en = false;
+    vuart->thre_pending = false;
+    vuart->head = 0;
+    vuart->tail = 0;
+    vuart->line_start = true;
+
+    vuart->emul = (struct emul_mem){
+        .va_base = vuart_config->base,
+        .size = VUART_REG_NUM * vuart->reg_width,
+        .handler = vuart_emul_handler,
+    };
+    vm_emul_add_mem(vm, &vuart->emul);
+
+    list_push(&vuart_list, &vuart->node);
+}
+
+bool vuart_pending(void)
+{
+    if (!vuart_list_ready) {
+        return false;
+    }
+
+    list_foreach (vuart_list, struct vuart, vuart) {
+        if (vuart->head != vuart->tail) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Only called by the console's drainer, so each ring has a single consumer. The vm's prefix is
+ * written at the start of every line, partial lines published because their ring filled up being
+ * continued without one. With binary logging the lines are written as plain text between the
+ * records, which the decoder skips.
+ */
+void vuart_drain(void)
+{
+    if (!vuart_list_ready) {
+        return;
+    }
+
+    list_foreach (vuart_list, struct vuart, vuart) {
+        size_t head = vuart->head;
+        size_t tail = vuart->tail;
+        fence_ord_read();
+        while (head != tail) {
+            size_t end = (tail > head) ? tail : VUART_RING_SIZE;
+            size_t n = 0;
+            while (((head + n) < end) && (vuart->buf[head + n] != '\n')) {
+                n++;
+            }
+            bool eol = (head + n) < end;
+            if (eol) {
+                n++;
+            }
+
+            if (vuart->line_start) {
+                console_write(vuart->prefix, vuart->prefix_len);
+            }
+            console_write(&vuart->buf[head], n);
+            vuart->line_start = eol;
+            head = (head + n) % VUART_RING_SIZE;
+        }
+        fence_ord();
+        vuart->head = head;
+    }
+}
@@ -5,87 +5,112 @@
 
 #include <bitmap.h>
 
+static inline bitmap_granule_t bitmap_granule(bitmap_t* map, size_t index, bool set)
+{
+    return set ? map[index] : ~map[index];
+}
+
+/**
+ * Returns the index of the first bit with value set in [start, end), or end if there is none.
+ */
+static size_t bitmap_find_first_until(bitmap_t* map, size_t end, size_t start, bool set)
+{
+    if (start >= end) {
+        return end;
+    }
+
+    size_t index = start / BITMAP_GRANULE_LEN;
+    size_t last_index = (end - 1) / BITMAP_GRANULE_LEN;
+    bitmap_granule_t granule = bitmap_granule(map, index, set);
+    granule &= BITMAP_GRANULE_MASK(start % BITMAP_GRANULE_LEN,
+        BITMAP_GRANULE_LEN - (start % BITMAP_GRANULE_LEN));
+
+    while (granule == 0) {
+        if (++index > last_index) {
+            return end;
+        }
+        granule = bitmap_granule(map, index, set);
+    }
+
+    size_t pos = (index * BITMAP_GRANULE_LEN) + bit32_ctz(granule);
+    return min(pos, end);
+}
+
+ssize_t bitmap_find_first(bitmap_t* map, size_t size, size_t start, bool set)
+{
+    size_t pos = bitmap_find_first_until(map, size, start, set);
+    return (pos < size) ? (ssize_t)pos : -1;
+}
+
 ssize_t bitmap_find_nth(bitmap_t* map, size_t size, size_t nth, size_t start, bool set)
 {
-    if (size <= 0 || nth <= 0 || start < 0) {
+    if (size <= 0 || nth <= 0 || start >= size) {
         return -1;
     }
 
-    size_t count = 0;
-    unsigned bit = set ? 1 : 0;
+    if (nth == 1) {
+        return bitmap_find_first(map, size, start, set);
+    }
 
-    for (ssize_t i = start; i < size; i++) {
-        if (bitmap_get(map, i) == bit) {
-            if (++count == nth) {
-                return i;
+    size_t index = start / BITMAP_GRANULE_LEN;
+    size_t last_index = (size - 1) / BITMAP_GRANULE_LEN;
+    bitmap_granule_t granule = bitmap_granule(map, index, set);
+    granule &= BITMAP_GRANULE_MASK(start % BITMAP_GRANULE_LEN,
+        BITMAP_GRANULE_LEN - (start % BITMAP_GRANULE_LEN));
+
+    while (true) {
+        size_t count = bit32_popcount(granule);
+        if (count >= nth) {
+            while (--nth > 0) {
+                granule &= granule - 1;
             }
+            size_t pos = (index * BITMAP_GRANULE_LEN) + bit32_ctz(granule);
+            return (pos < size) ? (ssize_t)pos : -1;
         }
-    }
+        nth -= count;
 
-    return -1;
+        if (++index > last_index) {
+            return -1;
+        }
+        granule = bitmap_granule(map, index, set);
+    }
 }
 
 size_t bitmap_count_consecutive(bitmap_t* map, size_t size, size_t start, size_t n)
 {
-    size_t pos = start;
-    size_t count = 0;
-    size_t start_offset = start % BITMAP_GRANULE_LEN;
-    size_t first_word_bits = min(BITMAP_GRANULE_LEN - start_offset, n);
-    bool set = !!bitmap_get(map, start);
-    bitmap_granule_t init_mask = BITMAP_GRANULE_MASK(start_offset, first_word_bits);
-    bitmap_granule_t mask;
-
     if (n <= 1) {
         return n;
     }
 
-    mask = set ? init_mask : ~init_mask;
-    if (!((map[pos / BITMAP_GRANULE_LEN] ^ mask) & init_mask)) {
-        count += first_word_bits;
-        pos += first_word_bits;
-    }
-
-    mask = set ? ~0 : 0;
-    while ((pos < size) && !(map[pos / BITMAP_GRANULE_LEN] ^ mask) && (count < n)) {
-        count += BITMAP_GRANULE_LEN;
-        pos += BITMAP_GRANULE_LEN;
+    if (start >= size) {
+        return 0;
     }
 
-    while ((pos < size) && (!!bitmap_get(map, pos) == set) && (count < n)) {
-        count++;
-        pos += 1;
-    }
+    bool set = !!bitmap_get(map, start);
+    size_t end = (n < (size - start)) ? (start + n) : size;
 
-    return count;
+    return bitmap_find_first_until(map, end, start, !set) - start;
 }
 
 ssize_t bitmap_find_consec(bitmap_t* map, size_t size, size_t start, size_t n, bool set)
 {
-    ssize_t count = 0;
-    ssize_t i = 0;
+    size_t pos = start;
 
-    // find first set
-    if ((i = bitmap_find_nth(map, size, 1, start, set)) < 0) {
-        return -1;
-    }
+    while (true) {
+        // find first set
+        pos = bitmap_find_first_until(map, size, pos, set);
+        if ((pos >= size) || (n > (size - pos))) {
+            return -1;
+        }
 
-    while (i < size) {
-        // find the last (with n as maximum) contiguous set page
-        count = bitmap_count_consecutive(map, size, i, n);
-        if (count < n) { // if didn't found enough n contiguous set pages
-            i += count;
-            // find the last contiguous ~set page
-            i += bitmap_count_consecutive(map, size, i, -1);
-        } else {
-            break;
+        // find the first ~set in the next n
+        size_t end = bitmap_find_first_until(map, pos + n, pos, !set);
+        if (end == (pos + n)) {
+            return (ssize_t)pos;
         }
-    }
 
-    if (i >= size) {
-        i = -1;
+        pos = end;
     }
-
-    return i;
 }
 
 void bitmap_set_consecutive(bitmap_t* map, size_t start, size_t n)
@@ -95,6 +120,10 @@ void bitmap_set_consecutive(bitmap_t* map, size_t start, size_t n)
     size_t start_offset = start % BITMAP_GRANULE_LEN;
     size_t first_word_bits = min(BITMAP_GRANULE_LEN - start_offset, count);
 
+    if (n == 0) {
+        return;
+    }
+
     map[pos / BITMAP_GRANULE_LEN] |= BITMAP_GRANULE_MASK(start_offset, first_word_bits);
     pos += first_word_bits;
     count -= first_word_bits;
@@ -109,3 +138,54 @@ void bitmap_set_consecutive(bitmap_t* map, size_t start, size_t n)
         map[pos / BITMAP_GRANULE_LEN] |= BITMAP_GRANULE_MASK(0, count);
     }
 }
+
+void bitmap_clear_consecutive(bitmap_t* map, size_t start, size_t n)
+{
+    size_t pos = start;
+    size_t count = n;
+    size_t start_offset = start % BITMAP_GRANULE_LEN;
+    size_t first_word_bits = min(BITMAP_GRANULE_LEN - start_offset, count);
+
+    if (n == 0) {
+        return;
+    }
+
+    map[pos / BITMAP_GRANULE_LEN] &= ~BITMAP_GRANULE_MASK(start_offset, first_word_bits);
+    pos += first_word_bits;
+    count -= first_word_bits;
+
+    while (count >= BITMAP_GRANULE_LEN) {
+        map[pos / BITMAP_GRANULE_LEN] = 0;
+        pos += BITMAP_GRANULE_LEN;
+        count -= BITMAP_GRANULE_LEN;
+    }
+
+    if (count > 0) {
+        map[pos / BITMAP_GRANULE_LEN] &= ~BITMAP_GRANULE_MASK(0, count);
+    }
+}
+
+size_t bitmap_count(bitmap_t* map, size_t start, size_t n, bool set)
+{
+    size_t count = 0;
+
+    if (start >= n) {
+        return 0;
+    }
+
+    size_t index = start / BITMAP_GRANULE_LEN;
+    size_t last_index = (n - 1) / BITMAP_GRANULE_LEN;
+    bitmap_granule_t granule = bitmap_granule(map, index, set);
+    granule &= BITMAP_GRANULE_MASK(start % BITMAP_GRANULE_LEN,
+        BITMAP_GRANULE_LEN - (start % BITMAP_GRANULE_LEN));
+
+    for (; index < last_index; index++) {
+        count += bit32_popcount(granule);
+        granule = bitmap_granule(map, index + 1, set);
+    }
+
+    size_t end_offset = ((n - 1) % BITMAP_GRANULE_LEN) + 1;
+    count += bit32_popcount(granule & BITMAP_GRANULE_MASK(0, end_offset));
+
+    return count;
+}
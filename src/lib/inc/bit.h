@@ -20,6 +20,104 @@
 
 #ifndef __ASSEMBLER__
 
+/**
+ * Count leading/trailing zeros and population count helpers. The word passed to the clz/ctz
+ * variants must not be zero. When the target provides count leading zeros instructions (all arm
+ * targets, riscv with Zbb) the compiler builtins map to one or two instructions. Otherwise, we use
+ * portable fallbacks which, unlike the builtins, never result in calls to libgcc, which we do not
+ * link against. Population count always uses the portable SWAR version for the same reason, as
+ * aarch64 general register only builds have no popcount instruction.
+ */
+#if defined(__ARM_FEATURE_CLZ) || defined(__riscv_zbb)
+
+static inline size_t bit32_ctz(uint32_t word)
+{
+    return (size_t)__builtin_ctz(word);
+}
+
+static inline size_t bit32_clz(uint32_t word)
+{
+    return (size_t)__builtin_clz(word);
+}
+
+static inline size_t bit64_ctz(uint64_t word)
+{
+    return (size_t)__builtin_ctzll(word);
+}
+
+static inline size_t bit64_clz(uint64_t word)
+{
+    return (size_t)__builtin_clzll(word);
+}
+
+#else
+
+static inline size_t bit32_ctz(uint32_t word)
+{
+    static const uint8_t debruijn32[32] = { 0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4,
+        8, 31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9 };
+    return debruijn32[((word & -word) * UINT32_C(0x077CB531)) >> 27];
+}
+
+static inline size_t bit64_ctz(uint64_t word)
+{
+    static const uint8_t debruijn64[64] = { 0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48,
+        28, 62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11, 63, 52, 6, 26, 37, 40, 33,
+        47, 61, 45, 43, 21, 23, 58, 17, 10, 51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14,
+        13, 12 };
+    return debruijn64[((word & -word) * UINT64_C(0x022FDD63CC95386D)) >> 58];
+}
+
+static inline size_t bit64_clz(uint64_t word)
+{
+    size_t n = 0;
+    for (size_t shift = 32; shift > 0; shift >>= 1) {
+        if ((word >> (64 - shift)) == 0) {
+            n += shift;
+            word <<= shift;
+        }
+    }
+    return n;
+}
+
+static inline size_t bit32_clz(uint32_t word)
+{
+    return bit64_clz((uint64_t)word) - 32;
+}
+
+#endif
+
+static inline size_t bit32_popcount(uint32_t word)
+{
+    word = word - ((word >> 1) & UINT32_C(0x55555555));
+    word = (word & UINT32_C(0x33333333)) + ((word >> 2) & UINT32_C(0x33333333));
+    word = (word + (word >> 4)) & UINT32_C(0x0F0F0F0F);
+    return (size_t)((word * UINT32_C(0x01010101)) >> 24);
+}
+
+static inline size_t bit64_popcount(uint64_t word)
+{
+    word = word - ((word >> 1) & UINT64_C(0x5555555555555555));
+    word = (word & UINT64_C(0x3333333333333333)) + ((word >> 2) & UINT64_C(0x3333333333333333));
+    word = (word + (word >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    return (size_t)((word * UINT64_C(0x0101010101010101)) >> 56);
+}
+
+static inline size_t bit_ctz(unsigned long word)
+{
+    return (sizeof(word) == sizeof(uint64_t)) ? bit64_ctz(word) : bit32_ctz(word);
+}
+
+static inline size_t bit_clz(unsigned long word)
+{
+    return (sizeof(word) == sizeof(uint64_t)) ? bit64_clz(word) : bit32_clz(word);
+}
+
+static inline size_t bit_popcount(unsigned long word)
+{
+    return (sizeof(word) == sizeof(uint64_t)) ? bit64_popcount(word) : bit32_popcount(word);
+}
+
 #define BIT_OPS_GEN(PRE, TYPE, LIT, MASK)                                        \
     static inline TYPE PRE##_get(TYPE word, size_t off)                          \
     {                                                                            \
@@ -43,28 +141,11 @@
     }                                                                            \
     static inline ssize_t PRE##_ffs(TYPE word)                                   \
     {                                                                            \
-        ssize_t pos = (ssize_t)0;                                                \
-        TYPE mask = (LIT);                                                       \
-        while (mask != 0U) {                                                     \
-            if ((mask & word) != 0U) {                                           \
-                break;                                                           \
-            }                                                                    \
-            mask <<= 1U;                                                         \
-            pos++;                                                               \
-        }                                                                        \
-        return (mask != 0U) ? pos : (ssize_t)-1;                                 \
+        return (word != 0U) ? (ssize_t)PRE##_ctz(word) : (ssize_t)-1;            \
     }                                                                            \
     static inline ssize_t PRE##_count(TYPE word)                                 \
     {                                                                            \
-        size_t count = 0;                                                        \
-        TYPE mask = (LIT);                                                       \
-        while (mask != 0U) {                                                     \
-            if ((mask & word) != 0U) {                                           \
-                count += 1;                                                      \
-            }                                                                    \
-            mask <<= 1U;                                                         \
-        }                                                                        \
-        return count;                                                            \
+        return (ssize_t)PRE##_popcount(word);                                    \
     }
 
 BIT_OPS_GEN(bit32, uint32_t, UINT32_C(1), BIT32_MASK);
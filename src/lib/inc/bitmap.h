@@ -9,8 +9,6 @@
 #include <bao.h>
 #include <bit.h>
 
-/* TODO: needs optimizations */
-
 typedef uint32_t bitmap_granule_t;
 typedef bitmap_granule_t bitmap_t;
 
@@ -40,26 +38,16 @@ static inline unsigned bitmap_get(bitmap_t* map, size_t bit)
     return (map[bit / BITMAP_GRANULE_LEN] & (ONE << (bit % BITMAP_GRANULE_LEN))) ? 1U : 0U;
 }
 
+/**
+ * Search and range operations. These work a granule at a time, using count trailing zeros and
+ * population count over whole granules instead of testing bits one by one.
+ */
 void bitmap_set_consecutive(bitmap_t* map, size_t start, size_t n);
+void bitmap_clear_consecutive(bitmap_t* map, size_t start, size_t n);
 
-static inline void bitmap_clear_consecutive(bitmap_t* map, size_t start, size_t n)
-{
-    for (size_t i = 0; i < n; i++) {
-        bitmap_clear(map, start + i);
-    }
-}
+size_t bitmap_count(bitmap_t* map, size_t start, size_t n, bool set);
 
-static inline size_t bitmap_count(bitmap_t* map, size_t start, size_t n, bool set)
-{
-    size_t count = 0;
-    for (size_t i = start; i < n; i++) {
-        if (bitmap_get(map, i) == set) {
-            count++;
-        }
-    }
-
-    return count;
-}
+ssize_t bitmap_find_first(bitmap_t* map, size_t size, size_t start, bool set);
 
 ssize_t bitmap_find_nth(bitmap_t* map, size_t size, size_t nth, size_t start, bool set);
 
@@ -13,7 +13,7 @@ typedef void* node_t;
 struct list {
     node_t* head;
     node_t* tail;
-    spinlock_t lock;
+    mcslock_t lock;
 };
 
 #define list_foreach(list, type, nodeptr) \
@@ -28,7 +28,7 @@ static inline void list_init(struct list* list)
     if (list != NULL) {
         list->head = NULL;
         list->tail = NULL;
-        list->lock = SPINLOCK_INITVAL;
+        list->lock = MCSLOCK_INITVAL;
     }
 }
 
@@ -36,7 +36,7 @@ static inline void list_push(struct list* list, node_t* node)
 {
     if (list != NULL && node != NULL) {
         *node = NULL;
-        spin_lock(&list->lock);
+        mcs_lock(&list->lock);
 
         if (list->tail != NULL) {
             *list->tail = node;
@@ -48,7 +48,7 @@ static inline void list_push(struct list* list, node_t* node)
             list->head = node;
         }
 
-        spin_unlock(&list->lock);
+        mcs_unlock(&list->lock);
     }
 }
 
@@ -56,7 +56,7 @@ static inline node_t* list_pop(struct list* list)
 {
     node_t* temp = NULL;
     if (list != NULL) {
-        spin_lock(&list->lock);
+        mcs_lock(&list->lock);
 
         if (list->head != NULL) {
             temp = list->head;
@@ -69,7 +69,7 @@ static inline node_t* list_pop(struct list* list)
             *temp = NULL;
         }
 
-        spin_unlock(&list->lock);
+        mcs_unlock(&list->lock);
     }
     return temp;
 }
@@ -90,8 +90,9 @@ static inline bool list_empty(struct list* list)
 
 static inline bool list_rm(struct list* list, node_t* node)
 {
+    bool found = false;
     if (list != NULL && node != NULL) {
-        spin_lock(&list->lock);
+        mcs_lock(&list->lock);
 
         node_t* temp = list->head;
         node_t* temp_prev = NULL;
@@ -107,15 +108,18 @@ static inline bool list_rm(struct list* list, node_t* node)
                 list->head = *temp;
             }
 
-            if (list->head == NULL) {
-                list->tail = NULL;
+            if (list->tail == temp) {
+                list->tail = temp_prev;
             }
+
+            *temp = NULL;
+            found = true;
         }
 
-        spin_unlock(&list->lock);
+        mcs_unlock(&list->lock);
     }
 
-    return true;
+    return found;
 }
 
 typedef int (*node_cmp_t)(node_t*, node_t*);
@@ -124,7 +128,7 @@ static inline void list_insert_ordered(struct list* list, node_t* node, node_cmp
 {
     if (list != NULL && node != NULL) {
         *node = NULL;
-        spin_lock(&list->lock);
+        mcs_lock(&list->lock);
 
         node_t* cur = list->head;
         node_t* tail = NULL;
@@ -149,7 +153,7 @@ static inline void list_insert_ordered(struct list* list, node_t* node, node_cmp
             list->head = node;
         }
 
-        spin_unlock(&list->lock);
+        mcs_unlock(&list->lock);
     }
 }
 
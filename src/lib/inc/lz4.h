@@ -0,0 +1,49 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+#include <bao.h>
+
+/**
+ * A single LZ4 frame, as produced by the lz4 tool. Checksums are not verified and frames needing a
+ * dictionary are not supported. With independent blocks, each block is decompressed on its own,
+ * which lets the blocks of a frame be decompressed in parallel.
+ */
+struct lz4_frame {
+    const uint8_t* blocks;
+    const uint8_t* end;
+    size_t block_max_size;
+    bool independent;
+    bool block_checksum;
+    bool has_content_size;
+    uint64_t content_size;
+};
+
+struct lz4_block {
+    const uint8_t* data;
+    size_t size;
+    bool compressed;
+};
+
+bool lz4_frame_parse(struct lz4_frame* frame, const void* src, size_t size);
+
+/**
+ * Walks the frame's blocks, starting from *cursor set to the frame's blocks. Returns false once at
+ * the end mark, or if the frame is truncated, in which case *cursor is set to NULL.
+ */
+bool lz4_frame_next_block(const struct lz4_frame* frame, const uint8_t** cursor,
+    struct lz4_block* block);
+
+/**
+ * Decompresses the block to dst, which dst_size bytes are available at. Matches may reference
+ * output back to hist, i.e. dst for an independent block or the start of the previous blocks'
+ * output otherwise. Returns the decompressed size, or -1 if the block is malformed or does not fit.
+ */
+ssize_t lz4_block_decompress(const struct lz4_block* block, uint8_t* dst, size_t dst_size,
+    const uint8_t* hist);
+
+#endif /* __LZ4_H__ */
@@ -10,5 +10,7 @@
 #include <stdarg.h>
 
 size_t vsnprintk(char* buf, size_t buf_size, const char** fmt, va_list* args);
+size_t snprintk_vals(char* buf, size_t buf_size, const char** fmt, const unsigned long** vals);
+size_t printk_collect_args(const char* fmt, va_list* args, unsigned long* vals, size_t max_vals);
 
 #endif /* __PRINTK_H */
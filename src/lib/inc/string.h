@@ -10,6 +10,8 @@
 
 void* memcpy(void* dst, const void* src, size_t count);
 void* memset(void* dest, int c, size_t count);
+void* memcpy_words(void* dst, const void* src, size_t count);
+void* memset_words(void* dest, int c, size_t count);
 
 char* strcat(char* dest, char* src);
 size_t strlen(const char* s);
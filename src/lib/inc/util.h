@@ -38,6 +38,19 @@
 
 #define DEFINE_SIZE(SYMBOL, TYPE) asm volatile("\n-> " XSTR(SYMBOL) " %0 \n" : : "i"(sizeof(TYPE)))
 
+#define DEFINE_VALUE(SYMBOL, VAL) asm volatile("\n-> " XSTR(SYMBOL) " %0 \n" : : "i"(VAL))
+
+/**
+ * Functions on the exit path are packed together at the start of the text section and those that
+ * rarely run are moved after everything else, see linker.ld. Code and data only used until all
+ * cpus are done booting are marked __init and __initdata instead, and their pages are returned to
+ * the page pool afterwards, see mem_reclaim_init.
+ */
+#define __hot                     __attribute__((hot, section(".text.hot")))
+#define __cold                    __attribute__((cold, section(".text.cold")))
+#define __init                    __attribute__((cold, section(".text.init")))
+#define __initdata                __attribute__((section(".data.init")))
+
 #define max(n1, n2)               (((n1) > (n2)) ? (n1) : (n2))
 #define min(n1, n2)               (((n1) < (n2)) ? (n1) : (n2))
 
@@ -0,0 +1,182 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <lz4.h>
+#include <string.h>
+#include <bit.h>
+
+#define LZ4_FRAME_MAGIC         (0x184D2204UL)
+#define LZ4_FLG_VERSION_OFF     (6)
+#define LZ4_FLG_VERSION_LEN     (2)
+#define LZ4_FLG_VERSION         (1)
+#define LZ4_FLG_B_INDEP_BIT     (1U << 5)
+#define LZ4_FLG_B_CHECKSUM_BIT  (1U << 4)
+#define LZ4_FLG_C_SIZE_BIT      (1U << 3)
+#define LZ4_FLG_DICT_ID_BIT     (1U << 0)
+#define LZ4_BD_MAX_SIZE_OFF     (4)
+#define LZ4_BD_MAX_SIZE_LEN     (3)
+#define LZ4_BD_MAX_SIZE_MIN     (4)
+#define LZ4_BLOCK_UNCOMPRESSED  (1UL << 31)
+#define LZ4_MIN_MATCH           (4)
+#define LZ4_LEN_MASK            (0xf)
+
+static inline uint32_t lz4_read32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+        ((uint32_t)p[3] << 24);
+}
+
+bool lz4_frame_parse(struct lz4_frame* frame, const void* src, size_t size)
+{
+    const uint8_t* p = src;
+    const uint8_t* end = p + size;
+
+    /* magic, flags, block descriptor and header checksum */
+    if ((size < 7) || (lz4_read32(p) != LZ4_FRAME_MAGIC)) {
+        return false;
+    }
+    uint8_t flg = p[4];
+    uint8_t bd = p[5];
+    p += 6;
+
+    size_t max_size_id = bit32_extract(bd, LZ4_BD_MAX_SIZE_OFF, LZ4_BD_MAX_SIZE_LEN);
+    if ((bit32_extract(flg, LZ4_FLG_VERSION_OFF, LZ4_FLG_VERSION_LEN) != LZ4_FLG_VERSION) ||
+        ((flg & LZ4_FLG_DICT_ID_BIT) != 0) || (max_size_id < LZ4_BD_MAX_SIZE_MIN)) {
+        return false;
+    }
+
+    frame->independent = (flg & LZ4_FLG_B_INDEP_BIT) != 0;
+    frame->block_checksum = (flg & LZ4_FLG_B_CHECKSUM_BIT) != 0;
+    frame->has_content_size = (flg & LZ4_FLG_C_SIZE_BIT) != 0;
+    /* 64KiB, 256KiB, 1MiB or 4MiB */
+    frame->block_max_size = 1UL << (8 + (2 * max_size_id));
+    frame->content_size = 0;
+
+    if (frame->has_content_size) {
+        if ((size_t)(end - p) < (sizeof(uint64_t) + 1)) {
+            return false;
+        }
+        frame->content_size = (uint64_t)lz4_read32(p) | ((uint64_t)lz4_read32(p + 4) << 32);
+        p += sizeof(uint64_t);
+    }
+
+    frame->blocks = p + 1;
+    frame->end = end;
+
+    return true;
+}
+
+bool lz4_frame_next_block(const struct lz4_frame* frame, const uint8_t** cursor,
+    struct lz4_block* block)
+{
+    const uint8_t* p = *cursor;
+
+    if ((p == NULL) || ((size_t)(frame->end - p) < sizeof(uint32_t))) {
+        *cursor = NULL;
+        return false;
+    }
+
+    uint32_t size = lz4_read32(p);
+    if (size == 0) {
+        return false;
+    }
+    p += sizeof(uint32_t);
+
+    block->compressed = (size & LZ4_BLOCK_UNCOMPRESSED) == 0;
+    block->size = size & ~LZ4_BLOCK_UNCOMPRESSED;
+    block->data = p;
+
+    size_t footprint = block->size + (frame->block_checksum ? sizeof(uint32_t) : 0);
+    if ((size_t)(frame->end - p) < footprint) {
+        *cursor = NULL;
+        return false;
+    }
+    *cursor = p + footprint;
+
+    return true;
+}
+
+static inline bool lz4_read_len(const uint8_t** ip, const uint8_t* iend, size_t* len)
+{
+    if (*len == LZ4_LEN_MASK) {
+        uint8_t b = 0;
+        do {
+            if (*ip >= iend) {
+                return false;
+            }
+            b = *(*ip)++;
+            *len += b;
+        } while (b == 0xff);
+    }
+    return true;
+}
+
+/**
+ * Matches overlapping their own output, i.e. with an offset shorter than their length, repeat the
+ * last offset bytes, so they are copied byte by byte. Others are copied at once.
+ */
+ssize_t lz4_block_decompress(const struct lz4_block* block, uint8_t* dst, size_t dst_size,
+    const uint8_t* hist)
+{
+    if (!block->compressed) {
+        if (block->size > dst_size) {
+            return -1;
+        }
+        memcpy(dst, block->data, block->size);
+        return (ssize_t)block->size;
+    }
+
+    const uint8_t* ip = block->data;
+    const uint8_t* iend = ip + block->size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (!lz4_read_len(&ip, iend, &lit_len) || ((size_t)(iend - ip) < lit_len) ||
+            ((size_t)(oend - op) < lit_len)) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        /* the last sequence only has literals */
+        if (ip == iend) {
+            break;
+        }
+
+        if ((size_t)(iend - ip) < sizeof(uint16_t)) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += sizeof(uint16_t);
+
+        size_t match_len = token & LZ4_LEN_MASK;
+        if (!lz4_read_len(&ip, iend, &match_len)) {
+            return -1;
+        }
+        match_len += LZ4_MIN_MATCH;
+
+        if ((offset == 0) || (offset > (size_t)(op - hist)) ||
+            ((size_t)(oend - op) < match_len)) {
+            return -1;
+        }
+
+        const uint8_t* match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            while (match_len-- > 0) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (ssize_t)(op - dst);
+}
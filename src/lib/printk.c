@@ -41,20 +41,62 @@ static size_t prints(char** buf, const char* str)
     return char_count;
 }
 
-static size_t vprintd(char** buf, unsigned int flags, va_list* args)
+/**
+ * Arguments are either taken from a va_list or, for messages recorded to be formatted later, from
+ * an array with each argument stored as an unsigned long. Peeking at an argument leaves it to be
+ * taken again.
+ */
+struct printk_args {
+    va_list* va;
+    const unsigned long* vals;
+};
+
+static unsigned long printk_arg(struct printk_args* args, unsigned int flags, bool consume)
 {
-    unsigned long u;
-    size_t base = ((flags & F_BASE16) != 0U) ? (unsigned int)16U : 10U;
     bool is_long = ((flags & F_LONG) != 0U);
+    bool is_unsigned = ((flags & F_UNSIGNED) != 0U);
+    unsigned long val;
+
+    if (args->va == NULL) {
+        val = *args->vals;
+        if (consume) {
+            args->vals++;
+        }
+        if (!is_long) {
+            val = is_unsigned ? (unsigned int)val : (unsigned long)(signed long)(signed int)val;
+        }
+    } else {
+        va_list args_tmp;
+        va_list* src = args->va;
+        if (!consume) {
+            va_copy(args_tmp, *args->va);
+            src = &args_tmp;
+        }
+        if (is_unsigned) {
+            val = is_long ? va_arg(*src, unsigned long) : va_arg(*src, unsigned int);
+        } else {
+            val = is_long ? (unsigned long)va_arg(*src, signed long) :
+                            (unsigned long)(signed long)va_arg(*src, signed int);
+        }
+        if (!consume) {
+            va_end(args_tmp);
+        }
+    }
+
+    return val;
+}
+
+static size_t printd(char** buf, unsigned int flags, unsigned long val)
+{
+    unsigned long u = val;
+    size_t base = ((flags & F_BASE16) != 0U) ? (unsigned int)16U : 10U;
     bool is_unsigned = ((flags & F_UNSIGNED) != 0U) || (base != 10U);
     size_t divisor;
     unsigned long tmp;
     size_t char_count = 0;
 
-    if (is_unsigned) {
-        u = is_long ? va_arg(*args, unsigned long) : va_arg(*args, unsigned int);
-    } else {
-        signed long s = is_long ? va_arg(*args, signed long) : va_arg(*args, signed int);
+    if (!is_unsigned) {
+        signed long s = (signed long)val;
         if (s < 0) {
             printc(buf, '-');
             char_count++;
@@ -91,12 +133,11 @@ static size_t vprintd(char** buf, unsigned int flags, va_list* args)
  * characters written to the buffer, and changes fmt to point to the first character that was not
  * printed.
  */
-size_t vsnprintk(char* buf, size_t buf_size, const char** fmt, va_list* args)
+static size_t printk_fmt(char* buf, size_t buf_size, const char** fmt, struct printk_args* args)
 {
     char* buf_it = buf;
     size_t buf_left = buf_size;
     const char* fmt_it = *fmt;
-    va_list args_tmp;
 
     while ((*fmt_it != '\0') && (buf_left > 0U)) {
         if ((*fmt_it) != '%') {
@@ -129,23 +170,23 @@ size_t vsnprintk(char* buf, size_t buf_size, const char** fmt, va_list* args)
                     /* fallthrough */
                     case 'd':
                     case 'i':
-                        va_copy(args_tmp, *args);
-                        arg_char_count = vprintd(NULL, flags, &args_tmp);
+                        arg_char_count = printd(NULL, flags, printk_arg(args, flags, false));
                         if (arg_char_count <= buf_left) {
-                            (void)vprintd(&buf_it, flags, args);
+                            (void)printd(&buf_it, flags, printk_arg(args, flags, true));
                         }
                         break;
                     case 's':
-                        va_copy(args_tmp, *args);
-                        arg_char_count = prints(NULL, va_arg(args_tmp, char*));
+                        arg_char_count = prints(NULL,
+                            (const char*)printk_arg(args, F_LONG | F_UNSIGNED, false));
                         if (arg_char_count <= buf_left) {
-                            (void)prints(&buf_it, va_arg(*args, char*));
+                            (void)prints(&buf_it,
+                                (const char*)printk_arg(args, F_LONG | F_UNSIGNED, true));
                         }
                         break;
                     case 'c':
                         arg_char_count = 1;
                         if (arg_char_count <= buf_left) {
-                            printc(&buf_it, (char)va_arg(args_tmp, int));
+                            printc(&buf_it, (char)printk_arg(args, 0, true));
                         }
                         break;
                     case '%':
@@ -175,3 +216,71 @@ size_t vsnprintk(char* buf, size_t buf_size, const char** fmt, va_list* args)
     *fmt = fmt_it;
     return buf_size - buf_left;
 }
+
+size_t vsnprintk(char* buf, size_t buf_size, const char** fmt, va_list* args)
+{
+    struct printk_args printk_args = { .va = args, .vals = NULL };
+    return printk_fmt(buf, buf_size, fmt, &printk_args);
+}
+
+size_t snprintk_vals(char* buf, size_t buf_size, const char** fmt, const unsigned long** vals)
+{
+    struct printk_args printk_args = { .va = NULL, .vals = *vals };
+    size_t count = printk_fmt(buf, buf_size, fmt, &printk_args);
+    *vals = printk_args.vals;
+    return count;
+}
+
+/**
+ * Takes the arguments of fmt from args as unsigned longs, at most max_vals of them, so that the
+ * message can be formatted later with snprintk_vals. Strings are kept as pointers and so must
+ * outlive the record. Returns the number of arguments taken.
+ */
+size_t printk_collect_args(const char* fmt, va_list* args, unsigned long* vals, size_t max_vals)
+{
+    struct printk_args printk_args = { .va = args, .vals = NULL };
+    const char* fmt_it = fmt;
+    size_t n = 0;
+
+    while ((*fmt_it != '\0') && (n < max_vals)) {
+        if (*fmt_it == '%') {
+            unsigned int flags = 0;
+            fmt_it++;
+            if (*fmt_it == 'l') {
+                fmt_it++;
+                flags = flags | F_LONG;
+                if (*fmt_it == 'l') {
+                    fmt_it++;
+                }
+            }
+
+
+            switch (*fmt_it) {
+                case 'x':
+                case 'X':
+                case 'u':
+                    vals[n++] = printk_arg(&printk_args, flags | F_UNSIGNED, true);
+                    break;
+                case 'd':
+                case 'i':
+                    vals[n++] = printk_arg(&printk_args, flags, true);
+                    break;
+                case 's':
+                    vals[n++] = printk_arg(&printk_args, F_LONG | F_UNSIGNED, true);
+                    break;
+                case 'c':
+                    vals[n++] = printk_arg(&printk_args, 0, true);
+                    break;
+                default:
+                    break;
+            }
+
+            if (*fmt_it == '\0') {
+                break;
+            }
+        }
+        fmt_it++;
+    }
+
+    return n;
+}
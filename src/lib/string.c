@@ -5,50 +5,92 @@
 
 #include <string.h>
 
-void* memcpy(void* dst, const void* src, size_t count)
+/**
+ * Generic implementations, architectures may provide optimized ones, which can still fall back to
+ * the word based versions, e.g. for small sizes. Word accesses are only made when naturally
+ * aligned, so these are also usable on targets without misaligned access support.
+ */
+
+void* memcpy_words(void* dst, const void* src, size_t count)
 {
-    size_t i;
     uint8_t* dst_tmp = dst;
     const uint8_t* src_tmp = src;
     static const size_t WORD_SIZE = sizeof(unsigned long);
 
-    if (!((uintptr_t)src & (WORD_SIZE - 1)) && !((uintptr_t)dst & (WORD_SIZE - 1))) {
-        for (i = 0; i < count; i += WORD_SIZE) {
-            if (i + (WORD_SIZE - 1) > count - 1) {
-                break;
-            }
-            *(unsigned long*)dst_tmp = *(unsigned long*)src_tmp;
-            dst_tmp += WORD_SIZE;
-            src_tmp += WORD_SIZE;
+    if (!(((uintptr_t)src ^ (uintptr_t)dst) & (WORD_SIZE - 1))) {
+        while ((count > 0) && ((uintptr_t)dst_tmp & (WORD_SIZE - 1))) {
+            *dst_tmp++ = *src_tmp++;
+            count--;
         }
-        if (i <= count - 1) {
-            for (; i < count; i++) {
-                *dst_tmp = *src_tmp;
-                dst_tmp++;
-                src_tmp++;
-            }
+        while (count >= (4 * WORD_SIZE)) {
+            unsigned long* d = (unsigned long*)dst_tmp;
+            const unsigned long* s = (const unsigned long*)src_tmp;
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+            d[3] = s[3];
+            dst_tmp += 4 * WORD_SIZE;
+            src_tmp += 4 * WORD_SIZE;
+            count -= 4 * WORD_SIZE;
         }
-    } else {
-        for (i = 0; i < count; i++) {
-            dst_tmp[i] = src_tmp[i];
+        while (count >= WORD_SIZE) {
+            *(unsigned long*)dst_tmp = *(const unsigned long*)src_tmp;
+            dst_tmp += WORD_SIZE;
+            src_tmp += WORD_SIZE;
+            count -= WORD_SIZE;
         }
     }
+
+    while (count > 0) {
+        *dst_tmp++ = *src_tmp++;
+        count--;
+    }
+
     return dst;
 }
 
-void* memset(void* dest, int c, size_t count)
+void* memset_words(void* dest, int c, size_t count)
 {
-    uint8_t* d;
-    d = (uint8_t*)dest;
+    uint8_t* d = (uint8_t*)dest;
+    static const size_t WORD_SIZE = sizeof(unsigned long);
+    unsigned long word = (unsigned long)(uint8_t)c * (~0UL / 0xff);
 
-    while (count--) {
-        *d = c;
-        d++;
+    while ((count > 0) && ((uintptr_t)d & (WORD_SIZE - 1))) {
+        *d++ = (uint8_t)c;
+        count--;
+    }
+    while (count >= (4 * WORD_SIZE)) {
+        unsigned long* w = (unsigned long*)d;
+        w[0] = word;
+        w[1] = word;
+        w[2] = word;
+        w[3] = word;
+        d += 4 * WORD_SIZE;
+        count -= 4 * WORD_SIZE;
+    }
+    while (count >= WORD_SIZE) {
+        *(unsigned long*)d = word;
+        d += WORD_SIZE;
+        count -= WORD_SIZE;
+    }
+    while (count > 0) {
+        *d++ = (uint8_t)c;
+        count--;
     }
 
     return dest;
 }
 
+__attribute__((weak)) void* memcpy(void* dst, const void* src, size_t count)
+{
+    return memcpy_words(dst, src, count);
+}
+
+__attribute__((weak)) void* memset(void* dest, int c, size_t count)
+{
+    return memset_words(dest, c, count);
+}
+
 char* strcat(char* dest, char* src)
 {
     char* save = dest;
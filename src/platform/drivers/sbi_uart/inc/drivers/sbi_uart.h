@@ -13,5 +13,6 @@ typedef volatile uint8_t bao_uart_t;
 bool uart_init(bao_uart_t* uart);
 void uart_enable(bao_uart_t* uart);
 void uart_putc(bao_uart_t* uart, const char c);
+void uart_write(bao_uart_t* uart, const char* buf, size_t n);
 
 #endif /* __SBI_UART_H__ */
@@ -16,3 +16,11 @@ void uart_putc(bao_uart_t* uart, const char c)
 {
     sbi_console_putchar(c);
 }
+
+/* Whole buffers take a single ecall if the firmware has a debug console */
+void uart_write(bao_uart_t* uart, const char* buf, size_t n)
+{
+    for (size_t i = sbi_debug_console_write(buf, n); i < n; i++) {
+        sbi_console_putchar(buf[i]);
+    }
+}
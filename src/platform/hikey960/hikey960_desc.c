@@ -4,6 +4,7 @@
  */
 
 #include <platform.h>
+#include <arch/psci.h>
 
 struct platform platform = {
     .cpu_num = 4, /* ONLY SUPORT A53 FOR NOW, cpu_num max is 4 */
@@ -37,6 +38,26 @@ struct platform platform = {
             .base_addr = 0xFFF08000, /* SYS_CNT */
         },
 
+        /**
+         * The idle states of the hi3660 device tree, with the latencies of the slower of the two
+         * clusters.
+         */
+        .psci = {
+            .state_num = 2,
+            .states = (struct psci_pwr_state[]) {
+                {
+                    .power_state = PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_POWERDOWN,
+                    .exit_latency_us = 550,
+                    .min_residency_us = 4000,
+                },
+                {
+                    .power_state = PSCI_POWER_STATE_LVL_1 | PSCI_STATE_TYPE_POWERDOWN,
+                    .exit_latency_us = 5000,
+                    .min_residency_us = 20000,
+                },
+            },
+        },
+
         .smmu = {
             .base = 0xE8DC0000,
         },
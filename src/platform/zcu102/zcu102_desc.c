@@ -4,6 +4,7 @@
  */
 
 #include <platform.h>
+#include <arch/psci.h>
 
 struct platform platform = {
     .cpu_num = 4,
@@ -35,6 +36,12 @@ struct platform platform = {
         .base = 0xFF000000,
     },
 
+    /* The ocm below the Arm Trusted Firmware, which the default BOOT.BIN loads at 0xFFFEA000 */
+    .fast_mem = {
+        .base = 0xFFFC0000,
+        .size = 0x2A000,
+    },
+
     .arch = {
         .gic = {
             .gicd_addr = 0xF9010000,
@@ -52,6 +59,18 @@ struct platform platform = {
         .generic_timer = {
             .base_addr = 0xFF260000,
         },
+
+        /* The idle states of the zynqmp device tree, as implemented by the Arm Trusted Firmware */
+        .psci = {
+            .state_num = 1,
+            .states = (struct psci_pwr_state[]) {
+                {
+                    .power_state = PSCI_POWER_STATE_LVL_0 | PSCI_STATE_TYPE_POWERDOWN,
+                    .exit_latency_us = 600,
+                    .min_residency_us = 10000,
+                },
+            },
+        },
     },
 
 };